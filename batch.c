@@ -0,0 +1,393 @@
+/* batch.c: run a list of files headless as regression tests
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* Each file in the list is loaded into a freshly started machine, which
+   is then run flat out until either --batch-frames frames have passed or
+   the screen hash given by --batch-until-hash turns up. Where fork() is
+   available, every file gets a worker process of its own, forked from
+   the machine as it is after startup, with up to --batch-jobs of them
+   running at once; otherwise the files are run one after another with a
+   reset in between.
+
+   Workers are processes rather than threads because the machine's state
+   (the Z80, the memory map, the event list, the settings and so on) is
+   all held in globals, so only one machine can exist per address space.
+   Forking from a machine which has already started up means the ROMs and
+   everything else loaded at startup are shared copy-on-write between the
+   workers rather than being loaded again by each one */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_FORK
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif				/* #ifdef HAVE_FORK */
+
+#include <libspectrum.h>
+
+#include "batch.h"
+#include "display.h"
+#include "event.h"
+#include "fuse.h"
+#include "machine.h"
+#include "rzx.h"
+#include "settings.h"
+#include "sound.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+int batch_active = 0;
+
+/* How running one file turned out */
+typedef enum batch_status {
+
+  BATCH_STATUS_OK,		/* Ran for all its frames */
+  BATCH_STATUS_MATCHED,		/* Reached the wanted screen hash */
+  BATCH_STATUS_UNMATCHED,	/* Ran out of frames before reaching it */
+  BATCH_STATUS_ERROR,		/* Couldn't be loaded */
+  BATCH_STATUS_CRASHED,		/* The worker died without reporting */
+
+  BATCH_STATUS_COUNT,		/* End marker */
+
+} batch_status;
+
+static const char * const status_names[ BATCH_STATUS_COUNT ] = {
+  "ok", "matched", "unmatched", "error", "crashed",
+};
+
+/* Passed back from a worker through a pipe, so plain data only */
+typedef struct batch_result {
+
+  batch_status status;
+  libspectrum_dword frames;
+  libspectrum_dword hash;
+  double seconds;
+
+} batch_result;
+
+static libspectrum_dword frames_done;
+static int until_hash, matched;
+static libspectrum_dword wanted_hash;
+
+void
+batch_frame( void )
+{
+  frames_done++;
+
+  if( until_hash && display_screen_hash() == wanted_hash ) matched = 1;
+}
+
+static void
+run_one( const char *filename, batch_result *result )
+{
+  double start;
+
+  memset( result, 0, sizeof( *result ) );
+  result->status = BATCH_STATUS_ERROR;
+
+  if( utils_open_file( filename, 1, NULL ) ) return;
+
+  start = timer_get_time(); if( start < 0 ) return;
+
+  frames_done = 0;
+  matched = 0;
+  batch_active = 1;
+
+  while( !fuse_exiting && !matched &&
+         frames_done < (libspectrum_dword)settings_current.batch_frames ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  batch_active = 0;
+
+  result->seconds = timer_get_time() - start;
+  result->frames = frames_done;
+  result->hash = display_screen_hash();
+
+  if( matched ) {
+    result->status = BATCH_STATUS_MATCHED;
+  } else {
+    result->status = until_hash ? BATCH_STATUS_UNMATCHED : BATCH_STATUS_OK;
+  }
+}
+
+#ifdef HAVE_FORK
+
+typedef struct batch_worker {
+  pid_t pid;
+  int fd;			/* The read end of the worker's pipe */
+  size_t input;			/* Which file it's running */
+} batch_worker;
+
+static int
+worker_count( void )
+{
+  long jobs = settings_current.batch_jobs;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if( jobs <= 0 ) jobs = sysconf( _SC_NPROCESSORS_ONLN );
+#endif				/* #ifdef _SC_NPROCESSORS_ONLN */
+
+  return jobs > 0 ? jobs : 1;
+}
+
+static int
+start_worker( batch_worker *worker, char **inputs, size_t input )
+{
+  int fds[2];
+
+  if( pipe( fds ) ) return 1;
+
+  /* Don't let the worker write out anything still buffered here */
+  fflush( NULL );
+
+  worker->pid = fork();
+  if( worker->pid < 0 ) {
+    close( fds[0] ); close( fds[1] );
+    return 1;
+  }
+
+  if( !worker->pid ) {
+    batch_result result;
+    close( fds[0] );
+    run_one( inputs[ input ], &result );
+    if( write( fds[1], &result, sizeof( result ) ) != sizeof( result ) )
+      _exit( 1 );
+    _exit( 0 );
+  }
+
+  close( fds[1] );
+  worker->fd = fds[0];
+  worker->input = input;
+
+  return 0;
+}
+
+static void
+finish_worker( batch_worker *worker, batch_result *results )
+{
+  batch_result *result = &results[ worker->input ];
+
+  if( read( worker->fd, result, sizeof( *result ) ) != sizeof( *result ) ) {
+    memset( result, 0, sizeof( *result ) );
+    result->status = BATCH_STATUS_CRASHED;
+  }
+
+  close( worker->fd );
+  worker->pid = 0;
+}
+
+static void
+run_all( char **inputs, size_t count, batch_result *results )
+{
+  batch_worker *workers;
+  size_t next = 0, running = 0, i;
+  int jobs = worker_count(), status;
+  pid_t pid;
+
+  workers = libspectrum_new0( batch_worker, jobs );
+
+  while( next < count || running ) {
+
+    for( i = 0; i < (size_t)jobs && next < count; i++ ) {
+      if( workers[i].pid ) continue;
+      if( start_worker( &workers[i], inputs, next ) ) {
+        ui_error( UI_ERROR_ERROR, "couldn't start a worker for '%s'",
+                  inputs[ next ] );
+        results[ next ].status = BATCH_STATUS_CRASHED;
+      } else {
+        running++;
+      }
+      next++;
+    }
+
+    if( !running ) continue;
+
+    pid = waitpid( -1, &status, 0 );
+    if( pid < 0 ) {
+      if( errno == EINTR ) continue;
+      break;
+    }
+
+    for( i = 0; i < (size_t)jobs; i++ ) {
+      if( workers[i].pid == pid ) {
+        finish_worker( &workers[i], results );
+        running--;
+        break;
+      }
+    }
+  }
+
+  libspectrum_free( workers );
+}
+
+#else				/* #ifdef HAVE_FORK */
+
+static void
+run_all( char **inputs, size_t count, batch_result *results )
+{
+  size_t i;
+
+  for( i = 0; i < count && !fuse_exiting; i++ ) {
+    if( rzx_playback ) rzx_stop_playback( 0 );
+    if( machine_reset( 0 ) ) {
+      results[i].status = BATCH_STATUS_ERROR;
+      continue;
+    }
+    run_one( inputs[i], &results[i] );
+  }
+}
+
+#endif				/* #ifdef HAVE_FORK */
+
+/* One filename per line; blank lines and lines starting with `#' are
+   skipped */
+static char**
+read_list( const char *list, size_t *count )
+{
+  utils_file file;
+  char **inputs = NULL, *text, *line, *end;
+  size_t allocated = 0;
+
+  *count = 0;
+
+  if( utils_read_file( list, &file ) ) return NULL;
+
+  text = libspectrum_new( char, file.length + 1 );
+  memcpy( text, file.buffer, file.length );
+  text[ file.length ] = '\0';
+  utils_close_file( &file );
+
+  for( line = strtok( text, "\n" ); line; line = strtok( NULL, "\n" ) ) {
+
+    while( *line == ' ' || *line == '\t' ) line++;
+    end = line + strlen( line );
+    while( end > line &&
+           ( end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t' ) )
+      *--end = '\0';
+
+    if( !*line || *line == '#' ) continue;
+
+    if( *count == allocated ) {
+      allocated = allocated ? allocated * 2 : 16;
+      inputs = libspectrum_renew( char*, inputs, allocated );
+    }
+    inputs[ (*count)++ ] = utils_safe_strdup( line );
+  }
+
+  libspectrum_free( text );
+
+  return inputs;
+}
+
+static void
+write_csv_string( FILE *f, const char *string )
+{
+  fputc( '"', f );
+  for( ; *string; string++ ) {
+    if( *string == '"' ) fputc( '"', f );
+    fputc( *string, f );
+  }
+  fputc( '"', f );
+}
+
+static int
+write_report( char **inputs, size_t count, const batch_result *results )
+{
+  const char *filename = settings_current.batch_report;
+  FILE *f = stdout;
+  size_t i;
+
+  if( filename && *filename ) {
+    f = fopen( filename, "w" );
+    if( !f ) {
+      ui_error( UI_ERROR_ERROR, "unable to open batch report '%s' for writing",
+                filename );
+      return 1;
+    }
+  }
+
+  fprintf( f, "file,result,frames,screen_hash,seconds\n" );
+
+  for( i = 0; i < count; i++ ) {
+    write_csv_string( f, inputs[i] );
+    fprintf( f, ",%s,%lu,%08lx,%.3f\n", status_names[ results[i].status ],
+             (unsigned long)results[i].frames,
+             (unsigned long)results[i].hash, results[i].seconds );
+  }
+
+  if( f != stdout ) fclose( f );
+
+  return 0;
+}
+
+int
+batch_run( const char *list )
+{
+  batch_result *results;
+  char **inputs;
+  size_t count, i, failed = 0;
+  int error;
+
+  inputs = read_list( list, &count );
+  if( !count ) {
+    ui_error( UI_ERROR_ERROR, "no files to run in '%s'", list );
+    libspectrum_free( inputs );
+    return 1;
+  }
+
+  until_hash = settings_current.batch_until_hash &&
+               *settings_current.batch_until_hash;
+  if( until_hash )
+    wanted_hash = strtoul( settings_current.batch_until_hash, NULL, 16 );
+
+  /* Nothing is going to be listening */
+  sound_pause();
+
+  results = libspectrum_new0( batch_result, count );
+
+  run_all( inputs, count, results );
+
+  error = write_report( inputs, count, results );
+
+  for( i = 0; i < count; i++ ) {
+    if( results[i].status != BATCH_STATUS_OK &&
+        results[i].status != BATCH_STATUS_MATCHED )
+      failed++;
+    libspectrum_free( inputs[i] );
+  }
+
+  libspectrum_free( results );
+  libspectrum_free( inputs );
+
+  return error || failed;
+}
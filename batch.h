@@ -0,0 +1,40 @@
+/* batch.h: run a list of files headless as regression tests
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_BATCH_H
+#define FUSE_BATCH_H
+
+/* Non-zero while an input is being run */
+extern int batch_active;
+
+/* Run each of the files listed in `list' for --batch-frames frames, in
+   separate worker processes where possible, and write a report of how
+   each went. Returns non-zero if any of them failed */
+int
+batch_run( const char *list );
+
+/* Called at the end of each frame, after the display has been updated */
+void
+batch_frame( void );
+
+#endif				/* #ifndef FUSE_BATCH_H */
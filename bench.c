@@ -0,0 +1,624 @@
+/* bench.c: headless frame-throughput benchmark
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "bench.h"
+#include "compat.h"
+#include "display.h"
+#include "event.h"
+#include "fuse.h"
+#include "machine.h"
+#include "memory_pages.h"
+#include "peripherals/disk/disk.h"
+#include "peripherals/scld.h"
+#include "snapshot.h"
+#include "timer/timer.h"
+#include "ui/scaler/scaler.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+int bench_active = 0;
+
+static const char * const subsystem_names[ BENCH_SUBSYSTEM_COUNT ] = {
+  "z80", "display", "sound", "events",
+};
+
+/* Time spent in each subsystem so far, in seconds */
+static double subsystem_time[ BENCH_SUBSYSTEM_COUNT ];
+
+/* When the last mark was made */
+static double last_mark;
+
+static libspectrum_dword frames_done;
+
+void
+bench_mark( bench_subsystem subsystem )
+{
+  double now = timer_get_time();
+
+  subsystem_time[ subsystem ] += now - last_mark;
+  last_mark = now;
+}
+
+void
+bench_frame( void )
+{
+  bench_mark( BENCH_SUBSYSTEM_DISPLAY );
+  frames_done++;
+}
+
+static void
+bench_report( libspectrum_dword frames, double total )
+{
+  double ns_per_frame;
+  size_t i;
+
+  if( !frames || total <= 0 ) {
+    printf( "bench: no frames emulated\n" );
+    return;
+  }
+
+  ns_per_frame = total * 1e9 / frames;
+
+  printf( "machine: %s\n", libspectrum_machine_name( machine_current->machine ) );
+  printf( "frames: %lu\n", (unsigned long)frames );
+  printf( "seconds: %.3f\n", total );
+  printf( "frames_per_second: %.2f\n", frames / total );
+  printf( "speed_percent: %.1f\n",
+          frames / total * machine_current->timings.tstates_per_frame /
+          machine_current->timings.processor_speed * 100 );
+  printf( "ns_per_frame: %.0f\n", ns_per_frame );
+
+  for( i = 0; i < BENCH_SUBSYSTEM_COUNT; i++ ) {
+    printf( "%s_ns_per_frame: %.0f (%.1f%%)\n", subsystem_names[i],
+            subsystem_time[i] * 1e9 / frames,
+            subsystem_time[i] / total * 100 );
+  }
+}
+
+/* Run the emulation flat out until `frames' frames have been done */
+static void
+bench_emulate( libspectrum_dword frames )
+{
+  bench_active = 1;
+
+  while( !fuse_exiting && frames_done < frames ) {
+    z80_do_opcodes();
+    bench_mark( BENCH_SUBSYSTEM_Z80 );
+    event_do_events();
+    bench_mark( BENCH_SUBSYSTEM_EVENTS );
+  }
+
+  bench_active = 0;
+}
+
+int
+bench_run( libspectrum_dword frames )
+{
+  double start;
+  size_t i;
+
+  for( i = 0; i < BENCH_SUBSYSTEM_COUNT; i++ ) subsystem_time[i] = 0;
+  frames_done = 0;
+
+  start = last_mark = timer_get_time(); if( start < 0 ) return 1;
+
+  bench_emulate( frames );
+
+  bench_report( frames_done, last_mark - start );
+
+  return 0;
+}
+
+/* The scaler benchmark */
+
+/* Frames emulated before the screen is taken, so the ROM or whatever was
+   loaded has had the chance to draw something */
+#define BENCH_SCALERS_WARMUP 100
+
+/* The largest image scaled, in pixels, and the largest scaling factor */
+#define BENCH_SCALERS_WIDTH  DISPLAY_SCREEN_WIDTH
+#define BENCH_SCALERS_HEIGHT DISPLAY_SCREEN_HEIGHT
+#define BENCH_SCALERS_MAX_SCALE 4
+
+static const libspectrum_byte bench_rgb_colours[16][3] = {
+
+  {   0,   0,   0 },
+  {   0,   0, 192 },
+  { 192,   0,   0 },
+  { 192,   0, 192 },
+  {   0, 192,   0 },
+  {   0, 192, 192 },
+  { 192, 192,   0 },
+  { 192, 192, 192 },
+  {   0,   0,   0 },
+  {   0,   0, 255 },
+  { 255,   0,   0 },
+  { 255,   0, 255 },
+  {   0, 255,   0 },
+  {   0, 255, 255 },
+  { 255, 255,   0 },
+  { 255, 255, 255 },
+
+};
+
+/* An image to be scaled, in Spectrum colours */
+typedef struct bench_image {
+  const char *name;
+  int width, height;
+  int hires;
+  libspectrum_byte pixels[ BENCH_SCALERS_HEIGHT ][ BENCH_SCALERS_WIDTH ];
+} bench_image;
+
+/* The screen as the emulation left it, border and all */
+static void
+bench_image_screen( bench_image *image )
+{
+  const libspectrum_byte *screen = RAM[ memory_current_screen ];
+  libspectrum_byte ink, paper;
+  int x, y, bit;
+
+  image->name = "screen";
+  image->width = DISPLAY_ASPECT_WIDTH; image->height = DISPLAY_SCREEN_HEIGHT;
+  image->hires = 0;
+
+  for( y = 0; y < DISPLAY_SCREEN_HEIGHT; y++ )
+    memset( image->pixels[y], display_lores_border, image->width );
+
+  for( y = 0; y < DISPLAY_HEIGHT; y++ ) {
+    libspectrum_byte *line =
+      &image->pixels[ y + DISPLAY_BORDER_HEIGHT ][ DISPLAY_BORDER_ASPECT_WIDTH ];
+
+    for( x = 0; x < DISPLAY_WIDTH_COLS; x++ ) {
+      libspectrum_byte data = screen[ display_line_start[y] + x ];
+
+      display_parse_attr( screen[ display_attr_start[y] + x ], &ink, &paper );
+
+      for( bit = 0; bit < 8; bit++ )
+        *line++ = data & ( 0x80 >> bit ) ? ink : paper;
+    }
+  }
+}
+
+/* The same memory shown as a Timex hires screen, taking alternate bytes
+   from the two display files, in black on white */
+static void
+bench_image_hires( bench_image *image )
+{
+  const libspectrum_byte *screen = RAM[ memory_current_screen ];
+  int x, y, bit;
+
+  image->name = "hires";
+  image->width = DISPLAY_SCREEN_WIDTH; image->height = DISPLAY_SCREEN_HEIGHT;
+  image->hires = 1;
+
+  for( y = 0; y < DISPLAY_SCREEN_HEIGHT; y++ )
+    memset( image->pixels[y], 15, image->width );
+
+  for( y = 0; y < DISPLAY_HEIGHT; y++ ) {
+    libspectrum_byte *line =
+      &image->pixels[ y + DISPLAY_BORDER_HEIGHT ][ DISPLAY_BORDER_WIDTH ];
+
+    for( x = 0; x < 2 * DISPLAY_WIDTH_COLS; x++ ) {
+      libspectrum_byte data =
+        screen[ display_line_start[y] + x / 2 + ( x & 1 ) * ALTDFILE_OFFSET ];
+
+      for( bit = 0; bit < 8; bit++ )
+        *line++ = data & ( 0x80 >> bit ) ? 0 : 15;
+    }
+  }
+}
+
+/* Every pixel a different colour from its neighbours, as near as can be:
+   the worst case for the scalers which look for edges */
+static void
+bench_image_synthetic( bench_image *image )
+{
+  libspectrum_dword seed = 1;
+  int x, y;
+
+  image->name = "synthetic";
+  image->width = DISPLAY_ASPECT_WIDTH; image->height = DISPLAY_SCREEN_HEIGHT;
+  image->hires = 0;
+
+  for( y = 0; y < image->height; y++ )
+    for( x = 0; x < image->width; x++ ) {
+      seed = seed * 1103515245 + 12345;
+      image->pixels[y][x] = ( seed >> 16 ) & 0x0f;
+    }
+}
+
+static int
+bench_scaler_is_timex( scaler_type scaler )
+{
+  switch( scaler ) {
+  case SCALER_HALF: case SCALER_HALFSKIP: case SCALER_TIMEXTV:
+  case SCALER_TIMEX1_5X: case SCALER_TIMEX2X:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Time `proc' scaling `image' for `frames' frames at `bpp' bits per
+   pixel, with `colours' giving each Spectrum colour in that format */
+static void
+bench_scaler( scaler_type scaler, ScalerProc *proc, const bench_image *image,
+              int bpp, const libspectrum_dword *colours,
+              libspectrum_byte *src, libspectrum_byte *dst,
+              libspectrum_dword frames )
+{
+  int bytes = bpp / 8, x, y;
+  float factor = scaler_get_scaling_factor( scaler );
+  libspectrum_dword src_pitch = ( image->width + 3 ) * bytes;
+  libspectrum_dword dst_pitch =
+    ( image->width * BENCH_SCALERS_MAX_SCALE + 3 ) * bytes;
+  libspectrum_byte *origin = src + 2 * src_pitch + bytes;
+  libspectrum_dword i;
+  double start, total, pixels;
+
+  /* Leave a border of black round the image, as the UIs do, for the
+     scalers which look at the pixels around each one */
+  memset( src, 0, ( image->height + 4 ) * src_pitch );
+
+  for( y = 0; y < image->height; y++ )
+    for( x = 0; x < image->width; x++ ) {
+      libspectrum_byte *pixel = origin + y * src_pitch + x * bytes;
+      libspectrum_dword colour = colours[ image->pixels[y][x] ];
+
+      if( bytes == 2 ) {
+        *(libspectrum_word*)pixel = colour;
+      } else {
+        *(libspectrum_dword*)pixel = colour;
+      }
+    }
+
+  /* One untimed run to get everything into the caches */
+  proc( origin, src_pitch, dst, dst_pitch, image->width, image->height );
+
+  start = timer_get_time();
+  for( i = 0; i < frames; i++ )
+    proc( origin, src_pitch, dst, dst_pitch, image->width, image->height );
+  total = timer_get_time() - start;
+
+  if( total <= 0 ) total = 1e-9;
+  pixels = (double)image->width * image->height * frames;
+
+  printf( "%s: %s %dbpp: ns_per_frame: %.0f megapixels_per_second: %.1f"
+          " (%.0fx%.0f)\n",
+          scaler_name( scaler ), image->name, bpp, total * 1e9 / frames,
+          pixels / total / 1e6, image->width * factor,
+          image->height * factor );
+}
+
+int
+bench_scalers_run( libspectrum_dword frames )
+{
+  static bench_image images[3];
+  libspectrum_dword colours16[16], colours32[16];
+  libspectrum_byte *src, *dst;
+  size_t i;
+  int scaler;
+
+  frames_done = 0;
+  last_mark = timer_get_time(); if( last_mark < 0 ) return 1;
+  bench_emulate( BENCH_SCALERS_WARMUP );
+
+  bench_image_screen( &images[0] );
+  bench_image_synthetic( &images[1] );
+  bench_image_hires( &images[2] );
+
+  for( i = 0; i < 16; i++ ) {
+    libspectrum_dword red = bench_rgb_colours[i][0],
+      green = bench_rgb_colours[i][1], blue = bench_rgb_colours[i][2];
+
+    colours16[i] = ( red >> 3 ) << 11 | ( green >> 2 ) << 5 | blue >> 3;
+    colours32[i] = red << 16 | green << 8 | blue;
+  }
+
+  src = libspectrum_new( libspectrum_byte,
+                         4 * ( BENCH_SCALERS_WIDTH + 3 ) *
+                         ( BENCH_SCALERS_HEIGHT + 4 ) );
+  dst = libspectrum_new( libspectrum_byte,
+                         4 * ( BENCH_SCALERS_WIDTH * BENCH_SCALERS_MAX_SCALE
+                               + 3 ) *
+                         BENCH_SCALERS_HEIGHT * BENCH_SCALERS_MAX_SCALE );
+
+  printf( "machine: %s\n",
+          libspectrum_machine_name( machine_current->machine ) );
+  printf( "frames: %lu\n", (unsigned long)frames );
+
+  for( i = 0; i < 3; i++ ) {
+    const bench_image *image = &images[i];
+
+    /* As the UIs do, only the Timex scalers, and those which work on
+       anything, are used on hires images */
+    for( scaler = 0; scaler < SCALER_NUM; scaler++ ) {
+      if( bench_scaler_is_timex( scaler ) != image->hires &&
+          scaler != SCALER_NORMAL && scaler != SCALER_PALTV ) continue;
+
+      scaler_select_bitformat( 565 );
+      scaler_hq_palette_16( colours16, 16 );
+      bench_scaler( scaler, scaler_get_proc16( scaler ), image, 16, colours16,
+                    src, dst, frames );
+
+      scaler_hq_palette_32( colours32, 16 );
+      bench_scaler( scaler, scaler_get_proc32( scaler ), image, 32, colours32,
+                    src, dst, frames );
+    }
+  }
+
+  libspectrum_free( dst );
+  libspectrum_free( src );
+
+  return 0;
+}
+
+/* The media benchmark */
+
+/* Each measurement is the best of this many runs */
+#define BENCH_MEDIA_REPEATS 10
+
+/* Stop following a tape after this many edges, in case it loops */
+#define BENCH_MEDIA_MAX_EDGES 100000000
+
+static void
+bench_media_report( const char *name, double seconds )
+{
+  printf( "%s_ns: %.0f\n", name, seconds * 1e9 );
+}
+
+static void
+bench_media_best( double *best, double start )
+{
+  double taken = timer_get_time() - start;
+
+  if( *best < 0 || taken < *best ) *best = taken;
+}
+
+/* Time opening a disk image, generating the track holding the first
+   sector, and then generating every other track */
+static int
+bench_media_disk( const char *filename )
+{
+  double open = -1, first = -1, all = -1, start;
+  int error, i, sides = 0, cylinders = 0, head, cylinder;
+  disk_t d;
+
+  for( i = 0; i < BENCH_MEDIA_REPEATS; i++ ) {
+    memset( &d, 0, sizeof( d ) );
+
+    start = timer_get_time();
+    error = disk_open( &d, filename, 0, 0 );
+    bench_media_best( &open, start );
+    if( error != DISK_OK ) {
+      printf( "error: %s\n", disk_strerror( error ) );
+      return 1;
+    }
+
+    start = timer_get_time();
+    disk_load_track( &d, 0, 0 );
+    bench_media_best( &first, start );
+
+    start = timer_get_time();
+    for( cylinder = 0; cylinder < d.cylinders; cylinder++ )
+      for( head = 0; head < d.sides; head++ )
+        disk_load_track( &d, head, cylinder );
+    bench_media_best( &all, start );
+
+    sides = d.sides; cylinders = d.cylinders;
+    disk_close( &d );
+  }
+
+  printf( "sides: %d\ncylinders: %d\n", sides, cylinders );
+  bench_media_report( "open", open );
+  bench_media_report( "first_sector", first );
+  bench_media_report( "all_tracks", all );
+
+  return 0;
+}
+
+/* Disk images are opened by name, so a compressed one is uncompressed
+   to a temporary file first, outside the timing */
+static int
+bench_media_disk_compressed( const char *filename, const utils_file *file,
+                             libspectrum_id_t type )
+{
+  unsigned char *buffer = NULL;
+  size_t length = 0;
+  char *uncompressed_name = NULL, path[ PATH_MAX ];
+  const char *base;
+  int error;
+
+  if( libspectrum_uncompress_file( &buffer, &length, &uncompressed_name,
+                                   type, file->buffer, file->length,
+                                   filename ) )
+    return 1;
+
+  base = strrchr( uncompressed_name, FUSE_DIR_SEP_CHR );
+  base = base ? base + 1 : uncompressed_name;
+  snprintf( path, PATH_MAX, "%s" FUSE_DIR_SEP_STR "fuse-bench-%s",
+            compat_get_temp_path(), base );
+
+  error = utils_write_file( path, buffer, length );
+  libspectrum_free( buffer );
+  libspectrum_free( uncompressed_name );
+  if( error ) return error;
+
+  error = bench_media_disk( path );
+  remove( path );
+
+  return error;
+}
+
+/* Time reading a tape, then following every edge to its end */
+static int
+bench_media_tape( const utils_file *file, libspectrum_id_t type,
+                  const char *filename )
+{
+  double open = -1, edges_time = -1, start;
+  libspectrum_tape *tape;
+  libspectrum_dword tstates;
+  unsigned long edges = 0;
+  int flags, i;
+
+  for( i = 0; i < BENCH_MEDIA_REPEATS; i++ ) {
+    start = timer_get_time();
+    tape = libspectrum_tape_alloc();
+    if( libspectrum_tape_read( tape, file->buffer, file->length, type,
+                               filename ) ) {
+      libspectrum_tape_free( tape );
+      return 1;
+    }
+    bench_media_best( &open, start );
+
+    start = timer_get_time();
+    edges = 0;
+    do {
+      if( libspectrum_tape_get_next_edge( &tstates, &flags, tape ) ) break;
+      edges++;
+    } while( !( flags & LIBSPECTRUM_TAPE_FLAGS_TAPE ) &&
+             edges < BENCH_MEDIA_MAX_EDGES );
+    bench_media_best( &edges_time, start );
+
+    libspectrum_tape_free( tape );
+  }
+
+  printf( "edges: %lu\n", edges );
+  bench_media_report( "open", open );
+  bench_media_report( "edges", edges_time );
+
+  return 0;
+}
+
+/* Time reading a snapshot into the machine, including any change of
+   machine it needs */
+static int
+bench_media_snapshot( const char *filename )
+{
+  double read = -1, start;
+  int i;
+
+  for( i = 0; i < BENCH_MEDIA_REPEATS; i++ ) {
+    start = timer_get_time();
+    if( snapshot_read( filename ) ) return 1;
+    bench_media_best( &read, start );
+  }
+
+  printf( "machine: %s\n",
+          libspectrum_machine_name( machine_current->machine ) );
+  bench_media_report( "read", read );
+
+  return 0;
+}
+
+static int
+bench_media_file( const char *filename )
+{
+  libspectrum_id_t type, raw_type;
+  libspectrum_class_t class, raw_class;
+  utils_file file;
+  int error = 0;
+
+  if( utils_read_file( filename, &file ) ) return 1;
+
+  if( libspectrum_identify_file_with_class( &type, &class, filename,
+                                            file.buffer, file.length ) ||
+      libspectrum_identify_file_raw( &raw_type, filename, file.buffer,
+                                     file.length ) ||
+      libspectrum_identify_class( &raw_class, raw_type ) ) {
+    utils_close_file( &file );
+    return 1;
+  }
+
+  printf( "file: %s\n", filename );
+
+  switch( class ) {
+
+  case LIBSPECTRUM_CLASS_DISK_PLUS3:
+  case LIBSPECTRUM_CLASS_DISK_TRDOS:
+  case LIBSPECTRUM_CLASS_DISK_OPUS:
+  case LIBSPECTRUM_CLASS_DISK_PLUSD:
+  case LIBSPECTRUM_CLASS_DISK_DIDAKTIK:
+  case LIBSPECTRUM_CLASS_DISK_GENERIC:
+    printf( "class: disk\n" );
+    error = raw_class == LIBSPECTRUM_CLASS_COMPRESSED ?
+            bench_media_disk_compressed( filename, &file, raw_type ) :
+            bench_media_disk( filename );
+    break;
+
+  case LIBSPECTRUM_CLASS_TAPE:
+    printf( "class: tape\n" );
+    error = bench_media_tape( &file, raw_type, filename );
+    break;
+
+  case LIBSPECTRUM_CLASS_SNAPSHOT:
+    printf( "class: snapshot\n" );
+    error = bench_media_snapshot( filename );
+    break;
+
+  default:
+    printf( "class: skipped\n" );
+    break;
+
+  }
+
+  utils_close_file( &file );
+
+  if( error ) printf( "error: %d\n", error );
+  printf( "\n" );
+
+  return error;
+}
+
+int
+bench_media_run( const char *path )
+{
+  compat_dir directory;
+  char name[ PATH_MAX ], filename[ PATH_MAX ];
+  compat_dir_result_t result;
+  int error = 0;
+
+  directory = compat_opendir( path );
+  if( !directory ) return bench_media_file( path );
+
+  while( 1 ) {
+    result = compat_readdir( directory, name, sizeof( name ) );
+    if( result != COMPAT_DIR_RESULT_OK ) break;
+
+    if( name[0] == '.' ) continue;
+
+    snprintf( filename, PATH_MAX, "%s" FUSE_DIR_SEP_STR "%s", path, name );
+    if( bench_media_file( filename ) ) error = 1;
+  }
+
+  compat_closedir( directory );
+
+  return error || result == COMPAT_DIR_RESULT_ERROR;
+}
@@ -0,0 +1,67 @@
+/* bench.h: headless frame-throughput benchmark
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_BENCH_H
+#define FUSE_BENCH_H
+
+#include <libspectrum.h>
+
+/* The parts of the emulation we account time to */
+typedef enum bench_subsystem {
+
+  BENCH_SUBSYSTEM_Z80,
+  BENCH_SUBSYSTEM_DISPLAY,
+  BENCH_SUBSYSTEM_SOUND,
+  BENCH_SUBSYSTEM_EVENTS,
+
+  BENCH_SUBSYSTEM_COUNT,	/* End marker */
+
+} bench_subsystem;
+
+/* Non-zero while a benchmark run is in progress */
+extern int bench_active;
+
+/* Run the emulation flat out for `frames' frames and print the timings
+   to stdout */
+int
+bench_run( libspectrum_dword frames );
+
+/* Time every scaler, at 16 and 32 bits per pixel, over `frames' frames
+   of each test image and print the results to stdout */
+int
+bench_scalers_run( libspectrum_dword frames );
+
+/* Time opening each disk image, tape and snapshot at `path', a file or a
+   directory of them, and print the results to stdout */
+int
+bench_media_run( const char *path );
+
+/* Account all the time since the last mark to `subsystem' */
+void
+bench_mark( bench_subsystem subsystem );
+
+/* Called at the end of each frame, after the display has been updated */
+void
+bench_frame( void );
+
+#endif				/* #ifndef FUSE_BENCH_H */
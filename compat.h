@@ -30,6 +30,7 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* Remove the gcc-specific incantations if we're not using gcc */
 #ifdef __GNUC__
@@ -146,11 +147,21 @@ struct utils_file;
 compat_fd compat_file_open( const char *path, int write );
 off_t compat_file_get_length( compat_fd fd );
 int compat_file_read( compat_fd fd, struct utils_file *file );
+int compat_file_map( compat_fd fd, struct utils_file *file );
+void compat_file_unmap( struct utils_file *file );
 int compat_file_write( compat_fd fd, const unsigned char *buffer,
                        size_t length );
 int compat_file_close( compat_fd fd );
 int compat_file_exists( const char *path );
 
+/* Fill in when the file at `path' was last modified and how long it is;
+   returns non-zero if the file can't be looked at */
+int compat_file_get_info( const char *path, time_t *mtime, off_t *length );
+
+/* Rename `from' to `to', replacing any file already there; returns
+   non-zero with errno set on failure */
+int compat_file_replace( const char *from, const char *to );
+
 /* Directory handling */
 
 typedef enum compat_dir_result_t {
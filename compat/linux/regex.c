@@ -33,6 +33,17 @@
 #define MAX_LENGTH  256
 #define MAX_MATCHES 100
 
+/* The expressions are the same few constant strings every time, so keep
+   them compiled rather than compiling them again for every file name */
+#define MAX_COMPILED 16
+
+static struct {
+  const char *re_expression;
+  regex_t reg_expr;
+} compiled[ MAX_COMPILED ];
+static size_t compiled_count;
+
+static const regex_t* compile_pattern( const char* re_expression );
 static char* cut_patterns( const char* re_expression, const char* text );
 static int   cut_pattern( const regex_t* reg_expr, const char* text, char* remain );
 
@@ -47,31 +58,57 @@ compat_chop_expressions( const char** re_expressions, const char* text )
 
   i = 0;
   while ( re_expressions[i] ) {
-    strlcpy( new_search, cut_patterns( re_expressions[i], new_search ), MAX_LENGTH );
+    char *cut = cut_patterns( re_expressions[i], new_search );
+    strlcpy( new_search, cut, MAX_LENGTH );
+    libspectrum_free( cut );
     i++;
   }
 
   return new_search;
 }
 
+static const regex_t*
+compile_pattern( const char* re_expression )
+{
+  size_t i;
+
+  for( i = 0; i < compiled_count; i++ )
+    if( compiled[i].re_expression == re_expression )
+      return &compiled[i].reg_expr;
+
+  if( compiled_count == MAX_COMPILED ) return NULL;
+
+  if ( regcomp( &compiled[ compiled_count ].reg_expr, re_expression,
+                REG_ICASE|REG_EXTENDED|REG_NEWLINE ) )
+    return NULL;
+
+  compiled[ compiled_count ].re_expression = re_expression;
+  return &compiled[ compiled_count++ ].reg_expr;
+}
+
 static char*
 cut_patterns( const char* re_expression, const char* text )
 {
   char remain[MAX_LENGTH] = {'\0'};
   char *new_search;
-  regex_t reg_expr;
+  const regex_t *reg_expr;
+  regex_t uncached;
 
   new_search = libspectrum_new( char, MAX_LENGTH );
   strlcpy( new_search, text, MAX_LENGTH );
 
-  if ( regcomp( &reg_expr, re_expression, REG_ICASE|REG_EXTENDED|REG_NEWLINE ) )
-    return new_search;
+  reg_expr = compile_pattern( re_expression );
+  if( !reg_expr ) {
+    if ( regcomp( &uncached, re_expression, REG_ICASE|REG_EXTENDED|REG_NEWLINE ) )
+      return new_search;
+    reg_expr = &uncached;
+  }
 
-  while ( !cut_pattern( &reg_expr, new_search, &remain[0] ) )
+  while ( !cut_pattern( reg_expr, new_search, &remain[0] ) )
     strlcpy( new_search, &remain[0], MAX_LENGTH );
 
   strlcpy( new_search, &remain[0], MAX_LENGTH );
-  regfree( &reg_expr );
+  if( reg_expr == &uncached ) regfree( &uncached );
 
   return new_search;
 }
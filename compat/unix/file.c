@@ -30,6 +30,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef WIN32
+#include <windows.h>
+#endif				/* #ifdef WIN32 */
+
 #include "compat.h"
 #include "utils.h"
 #include "ui/ui.h"
@@ -104,6 +112,42 @@ compat_file_read( compat_fd fd, utils_file *file )
   return 0;
 }
 
+/* Map `file->length' bytes of `fd' into memory instead of reading them.
+   Returns non-zero, without reporting an error, if the file can't be
+   mapped; the caller should then read it as normal */
+int
+compat_file_map( compat_fd fd, utils_file *file )
+{
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+  void *buffer;
+
+  if( !file->length ) return 1;
+
+  /* Private and writable so that a caller which scribbles on the buffer
+     gets its own copy of just those pages rather than a fault */
+  buffer = mmap( NULL, file->length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fileno( fd ), 0 );
+  if( buffer == MAP_FAILED ) return 1;
+
+  file->buffer = buffer;
+  file->mapped = 1;
+
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+void
+compat_file_unmap( utils_file *file )
+{
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+  munmap( file->buffer, file->length );
+#endif
+  file->buffer = NULL;
+  file->mapped = 0;
+}
+
 int
 compat_file_write( compat_fd fd, const unsigned char *buffer, size_t length )
 {
@@ -129,3 +173,32 @@ compat_file_exists( const char *path )
 {
   return ( access( path, R_OK ) != -1 );
 }
+
+int
+compat_file_get_info( const char *path, time_t *mtime, off_t *length )
+{
+  struct stat file_info;
+
+  if( stat( path, &file_info ) ) return 1;
+
+  *mtime = file_info.st_mtime;
+  *length = file_info.st_size;
+
+  return 0;
+}
+
+int
+compat_file_replace( const char *from, const char *to )
+{
+#ifdef WIN32
+  /* rename() won't go over an existing file on Windows */
+  if( !MoveFileEx( from, to, MOVEFILE_REPLACE_EXISTING ) ) {
+    errno = EACCES;
+    return -1;
+  }
+
+  return 0;
+#else				/* #ifdef WIN32 */
+  return rename( from, to );
+#endif				/* #ifdef WIN32 */
+}
@@ -10,6 +10,9 @@
 /* Defined if BOB is in use */
 #define BOB 1
 
+/* Defined if we support netplay */
+#define BUILD_NETPLAY 1
+
 /* Define to 1 if SpeccyBoot is supported. */
 #define BUILD_SPECCYBOOT 1
 
@@ -22,6 +25,9 @@
 /* DirectX 7 or higher is required */
 /* #undef DIRECTSOUND_VERSION */
 
+/* Defined if frame timing probes are compiled in */
+/* #undef FRAME_TIMING */
+
 /* Define copyright of Fuse */
 #define FUSE_COPYRIGHT "(c) 1999-2018 Philip Kendall and others"
 
@@ -46,6 +52,9 @@
 /* Defined if we've got enough memory to compile z80_ops.c */
 #define HAVE_ENOUGH_MEMORY 1
 
+/* Define to 1 if you have the `fork' function. */
+#define HAVE_FORK 1
+
 /* Define to 1 if you have the `fsync' function. */
 #define HAVE_FSYNC 1
 
@@ -79,6 +88,9 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
+/* Define to 1 if you have the `mmap' function. */
+#define HAVE_MMAP 1
+
 /* Define if you have POSIX threads libraries and header files. */
 #define HAVE_PTHREAD 1
 
@@ -109,6 +121,15 @@
 /* Define to 1 if you have the <sys/audio.h> header file. */
 /* #undef HAVE_SYS_AUDIO_H */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/event.h> header file. */
+/* #undef HAVE_SYS_EVENT_H */
+
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#define HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/soundcard.h> header file. */
 #define HAVE_SYS_SOUNDCARD_H 1
 
@@ -201,6 +222,9 @@
 /* Defined if Xlib UI in use */
 /* #undef UI_X */
 
+/* Defined if the GTK+ display is drawn with OpenGL */
+/* #undef USE_GTK_GL */
+
 /* Defined if we're using hardware joysticks */
 #define USE_JOYSTICK 1
 
@@ -0,0 +1,441 @@
+/* config_write.c: deferred writing of configuration files
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * The settings and control mapping files are rewritten whenever an
+ * option is changed with autosave on, which on a handheld's SD card
+ * can take long enough to be noticed in the menus. Instead, the new
+ * contents are handed over here and written out a few seconds later on
+ * a background thread; anything else written to the same file in the
+ * meantime just replaces what's waiting. Files are written to a
+ * temporary file and renamed into place, so a file is never left half
+ * written, and not at all if they wouldn't change.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "config_write.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "infrastructure/writer_queue.h"
+#include "ui/ui.h"
+#include "utils.h"
+
+/* How long to wait after a change before writing it out, in seconds */
+#define CONFIG_WRITE_DELAY 3.0
+
+typedef struct config_write_file {
+
+  char *filename;
+
+  char *written;		/* What the file holds, if we know */
+  size_t written_length;
+  int written_known;
+
+  char *pending;		/* What's waiting to be written, if anything */
+  size_t pending_length;
+  int is_pending;		/* Set while a job for it is queued */
+  double due;			/* When to write it */
+
+  int busy;			/* Being written by the writer thread */
+  int error;			/* errno from the last write, not yet reported */
+
+} config_write_file;
+
+static config_write_file *files = NULL;
+static size_t file_count = 0;
+
+void
+config_write_buffer_init( config_write_buffer *buffer )
+{
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->allocated = 0;
+}
+
+void
+config_write_buffer_append( config_write_buffer *buffer, const char *data,
+                            size_t length )
+{
+  if( buffer->length + length > buffer->allocated ) {
+    size_t new_size = buffer->allocated ? buffer->allocated : 1024;
+    while( new_size < buffer->length + length ) new_size *= 2;
+    buffer->data = libspectrum_renew( char, buffer->data, new_size );
+    buffer->allocated = new_size;
+  }
+
+  memcpy( buffer->data + buffer->length, data, length );
+  buffer->length += length;
+}
+
+void
+config_write_buffer_free( config_write_buffer *buffer )
+{
+  libspectrum_free( buffer->data );
+  config_write_buffer_init( buffer );
+}
+
+static double
+config_write_now( void )
+{
+  struct timeval tv;
+
+  gettimeofday( &tv, NULL );
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Does `filename' already hold exactly `data'? */
+static int
+config_write_file_matches( const char *filename, const char *data,
+                           size_t length )
+{
+  char buffer[ 4096 ];
+  size_t offset = 0, got;
+  FILE *f;
+  int matches = 1;
+
+  f = fopen( filename, "rb" );
+  if( !f ) return 0;
+
+  while( matches && ( got = fread( buffer, 1, sizeof( buffer ), f ) ) ) {
+    if( offset + got > length || memcmp( buffer, data + offset, got ) )
+      matches = 0;
+    offset += got;
+  }
+
+  if( ferror( f ) || offset != length ) matches = 0;
+
+  fclose( f );
+
+  return matches;
+}
+
+/* Write `data' to a temporary file which is then renamed over
+   `filename'. Doesn't touch the UI, as this runs on the writer thread.
+   Returns 0 or an errno value */
+static int
+config_write_file_contents( const char *filename, const char *data,
+                            size_t length )
+{
+  char tmpname[ PATH_MAX ];
+  FILE *f;
+  int error;
+
+  snprintf( tmpname, PATH_MAX, "%s.tmp", filename );
+
+  f = fopen( tmpname, "wb" );
+  if( !f ) return errno;
+
+  if( fwrite( data, 1, length, f ) != length || fflush( f )
+#ifdef HAVE_FSYNC
+      || fsync( fileno( f ) )
+#endif				/* #ifdef HAVE_FSYNC */
+    ) {
+    error = errno ? errno : EIO;
+    fclose( f );
+    unlink( tmpname );
+    return error;
+  }
+
+  if( fclose( f ) || compat_file_replace( tmpname, filename ) ) {
+    error = errno;
+    unlink( tmpname );
+    return error;
+  }
+
+  return 0;
+}
+
+static config_write_file*
+config_write_find( const char *filename )
+{
+  config_write_file *file;
+  size_t i;
+
+  for( i = 0; i < file_count; i++ )
+    if( !strcmp( files[i].filename, filename ) ) return &files[i];
+
+  files = libspectrum_renew( config_write_file, files, file_count + 1 );
+  file = &files[ file_count++ ];
+  memset( file, 0, sizeof( *file ) );
+  file->filename = utils_safe_strdup( filename );
+
+  return file;
+}
+
+/* Report any write which failed since we last looked */
+static void
+config_write_report( void )
+{
+  size_t i;
+
+  for( i = 0; i < file_count; i++ ) {
+    if( files[i].error ) {
+      ui_error( UI_ERROR_ERROR, "couldn't write '%s': %s", files[i].filename,
+                strerror( files[i].error ) );
+      files[i].error = 0;
+    }
+  }
+}
+
+/* Write `data' out to `filename', unless `check_disk' is set and it's
+   already there. Returns 0 or an errno value */
+static int
+config_write_out( const char *filename, const char *data, size_t length,
+                  int check_disk )
+{
+  if( check_disk && config_write_file_matches( filename, data, length ) )
+    return 0;
+
+  return config_write_file_contents( filename, data, length );
+}
+
+/* Note how writing `data', which is taken over, to `file' went */
+static void
+config_write_finished( config_write_file *file, char *data, size_t length,
+                       int error )
+{
+  if( error ) {
+    libspectrum_free( data );
+    file->written_known = 0;
+    return;
+  }
+
+  libspectrum_free( file->written );
+  file->written = data;
+  file->written_length = length;
+  file->written_known = 1;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* Protects `files', which the writer thread also uses. The writer waits
+   on `due_cond' until the file it's to write is due */
+static pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t due_cond = PTHREAD_COND_INITIALIZER;
+
+static writer_queue *config_writer = NULL;
+
+/* A file to be written once it's due; `files' may move, so by index */
+typedef struct config_write_job {
+  size_t index;
+} config_write_job;
+
+static void
+config_write_job_write( void *data )
+{
+  config_write_job *job = data;
+  config_write_file *file;
+  struct timespec until;
+  double due, whole;
+  char *contents, *filename;
+  size_t length;
+  int check_disk, error;
+
+  pthread_mutex_lock( &files_mutex );
+
+  while( ( due = files[ job->index ].due ) > config_write_now() ) {
+    whole = (double)(time_t)due;
+    until.tv_sec = (time_t)due;
+    until.tv_nsec = ( due - whole ) * 1000000000.0;
+    pthread_cond_timedwait( &due_cond, &files_mutex, &until );
+  }
+
+  /* `files' may move while we're writing, but the filename won't */
+  file = &files[ job->index ];
+  contents = file->pending;
+  length = file->pending_length;
+  filename = file->filename;
+  check_disk = !file->written_known;
+  file->pending = NULL;
+  file->is_pending = 0;
+  file->busy = 1;
+
+  pthread_mutex_unlock( &files_mutex );
+
+  error = config_write_out( filename, contents, length, check_disk );
+
+  pthread_mutex_lock( &files_mutex );
+
+  file = &files[ job->index ];
+  config_write_finished( file, contents, length, error );
+  file->error = error;
+  file->busy = 0;
+
+  pthread_mutex_unlock( &files_mutex );
+}
+
+static void
+config_write_job_done( void *job )
+{
+  pthread_mutex_lock( &files_mutex );
+  config_write_report();
+  pthread_mutex_unlock( &files_mutex );
+
+  libspectrum_free( job );
+}
+
+/* Have everything waiting written as soon as the writer gets to it */
+static void
+config_write_hurry( void )
+{
+  size_t i;
+
+  pthread_mutex_lock( &files_mutex );
+  for( i = 0; i < file_count; i++ ) files[i].due = 0;
+  pthread_cond_broadcast( &due_cond );
+  pthread_mutex_unlock( &files_mutex );
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+int
+config_write( const char *filename, const char *data, size_t length )
+{
+  config_write_file *file;
+  char *copy;
+  int error;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &files_mutex );
+#endif
+
+  config_write_report();
+
+  file = config_write_find( filename );
+
+  /* Nothing to do if this is what's already waiting, or if nothing's
+     waiting and it's what the file already holds */
+  if( file->is_pending ?
+        ( file->pending_length == length &&
+          !memcmp( file->pending, data, length ) ) :
+        ( file->written_known && !file->busy &&
+          file->written_length == length &&
+          !memcmp( file->written, data, length ) ) ) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &files_mutex );
+#endif
+    return 0;
+  }
+
+  copy = libspectrum_new( char, length ? length : 1 );
+  memcpy( copy, data, length );
+
+#ifdef HAVE_PTHREAD
+  if( !config_writer )
+    config_writer = writer_queue_start( "configuration",
+                                        config_write_job_write,
+                                        config_write_job_done, 0 );
+
+  if( config_writer ) {
+    libspectrum_free( file->pending );
+    file->pending = copy;
+    file->pending_length = length;
+
+    /* Keep the time of the first change still waiting, so a stream of
+       changes still gets written every few seconds; that change's job
+       will pick this up too */
+    if( !file->is_pending ) {
+      config_write_job *job = libspectrum_new( config_write_job, 1 );
+
+      job->index = file - files;
+      file->is_pending = 1;
+      file->due = config_write_now() + CONFIG_WRITE_DELAY;
+      writer_queue_push( config_writer, job, 0, 1 );
+    }
+
+    pthread_mutex_unlock( &files_mutex );
+    return 0;
+  }
+  pthread_mutex_unlock( &files_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  /* No writer thread, so write it now */
+  error = config_write_out( filename, copy, length, !file->written_known );
+  config_write_finished( file, copy, length, error );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "couldn't write '%s': %s", filename,
+              strerror( error ) );
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+config_write_flush( void )
+{
+#ifdef HAVE_PTHREAD
+  if( !config_writer ) return;
+
+  config_write_hurry();
+  writer_queue_wait( config_writer );
+#endif			/* #ifdef HAVE_PTHREAD */
+}
+
+static void
+config_write_end( void )
+{
+  size_t i;
+
+#ifdef HAVE_PTHREAD
+  if( config_writer ) {
+    config_write_hurry();
+    writer_queue_stop( config_writer, NULL );
+    config_writer = NULL;
+  }
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  config_write_report();
+
+  for( i = 0; i < file_count; i++ ) {
+    libspectrum_free( files[i].filename );
+    libspectrum_free( files[i].written );
+    libspectrum_free( files[i].pending );
+  }
+
+  libspectrum_free( files );
+  files = NULL;
+  file_count = 0;
+}
+
+void
+config_write_register_startup( void )
+{
+  startup_manager_register_no_dependencies( STARTUP_MANAGER_MODULE_CONFIG_WRITE,
+                                            NULL, NULL, config_write_end );
+}
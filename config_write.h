@@ -0,0 +1,54 @@
+/* config_write.h: deferred writing of configuration files
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_CONFIG_WRITE_H
+#define FUSE_CONFIG_WRITE_H
+
+#include <stdlib.h>
+
+/* A file's contents as they're built up in memory */
+typedef struct config_write_buffer {
+
+  char *data;
+  size_t length;
+  size_t allocated;
+
+} config_write_buffer;
+
+void config_write_buffer_init( config_write_buffer *buffer );
+void config_write_buffer_append( config_write_buffer *buffer,
+                                 const char *data, size_t length );
+void config_write_buffer_free( config_write_buffer *buffer );
+
+void config_write_register_startup( void );
+
+/* Arrange for `filename' to be replaced by `length' bytes of `data'.
+   The write happens a little later on a background thread, so several
+   changes in quick succession become one write, and is skipped if the
+   file already holds the same contents. `data' is copied */
+int config_write( const char *filename, const char *data, size_t length );
+
+/* Finish any writes still waiting */
+void config_write_flush( void );
+
+#endif			/* #ifndef FUSE_CONFIG_WRITE_H */
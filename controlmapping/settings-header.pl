@@ -50,7 +50,8 @@ while(<>) {
     }
 
 
-    next if !($name =~ /^joystick/);
+    # The joysticks, and how the display is rendered, go with each game
+    next if !($name =~ /^joystick/ || $name eq 'od_render_mode');
 
     $options{$name} = { type => $type, default => $default, short => $short,
 			commandline => $commandline,
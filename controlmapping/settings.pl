@@ -50,7 +50,8 @@ while(<>) {
     }
 
 
-    next if !($name =~ /^joystick/);
+    # The joysticks, and how the display is rendered, go with each game
+    next if !($name =~ /^joystick/ || $name eq 'od_render_mode');
 
     $options{$name} = { type => $type, default => $default, short => $short,
 			commandline => $commandline,
@@ -73,6 +74,7 @@ print hashline( __LINE__ ), << 'CODE';
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_GETOPT_LONG		/* Did our libc include getopt_long? */
@@ -89,6 +91,7 @@ print hashline( __LINE__ ), << 'CODE';
 #include <libxml/parser.h>
 #endif				/* #ifdef HAVE_LIB_XML2 */
 
+#include "config_write.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
@@ -116,6 +119,23 @@ static void control_mapping_copy_from_settings_internal( control_mapping_info *d
 static void control_mapping_copy_to_settings_internal( settings_info *dest, control_mapping_info *src );
 static void control_mapping_end( void );
 
+static int read_config_file( control_mapping_info *control_mapping, const char *filename );
+static void mapping_cache_forget( const char *filename );
+
+/* Every mapping file read since startup, as it was parsed, so loading
+   the same game again doesn't need to parse its mapping again */
+typedef struct mapping_cache_entry {
+
+  char *filename;
+  time_t mtime;			/* When the file was last changed */
+  off_t length;
+  control_mapping_info control_mapping;
+
+} mapping_cache_entry;
+
+static mapping_cache_entry *mapping_cache = NULL;
+static size_t mapping_cache_count = 0;
+
 const char* re_expressions[] = {
     "(([[:space:]]|[-_])*)(([[]|[(])+[[:space:]]*)(([[:alnum:]]|[[:space:]]|[[:punct:]])*)([[:space:]]*([]]|[)])+)(([[:space:]]|[-_])*)",
     "(([[:space:]]|[-_])*)(([(]|[[])*[[:space:]]*)(disk|tape|side|part|release)(([[:space:]]|[[:punct:]])*)(([abcd1234])([[:space:]]*of[[:space:]]*[1234])*)([[:space:]]*([)]|[]])*)(([[:space:]]|[-_])*)",
@@ -133,8 +153,8 @@ void control_mapping_defaults( control_mapping_info *control_mapping )
 
 /* Read control mappings from the mapping file (if libxml2 is available) */
 
-int
-control_mapping_read_config_file( control_mapping_info *control_mapping, const char *filename )
+static int
+read_config_file( control_mapping_info *control_mapping, const char *filename )
 {
   xmlDocPtr doc;
 
@@ -238,11 +258,14 @@ control_mapping_write_config( control_mapping_info *control_mapping, const char
 {
   char buffer[80];
 
-  xmlDocPtr doc; xmlNodePtr root;
+  xmlDocPtr doc; xmlNodePtr root; xmlChar *xml; int length, error;
 
   /* If don't have file to save do nothing */
   if ( !filename ) return 0;
 
+  /* The file may be rewritten within the resolution of its timestamp */
+  mapping_cache_forget( filename );
+
   /* Create the XML document */
   doc = xmlNewDoc( (const xmlChar*)"1.0" );
 
@@ -277,19 +300,26 @@ CODE
 
   print hashline( __LINE__ ), << 'CODE';
 
-  xmlSaveFormatFile( filename, doc, 1 );
-
+  xmlDocDumpFormatMemory( doc, &xml, &length, 1 );
   xmlFreeDoc( doc );
+  if( !xml ) {
+    ui_error( UI_ERROR_ERROR, "couldn't write `%s'", filename );
+    return 1;
+  }
 
-  return 0;
+  error = config_write( filename, (const char *)xml, length );
+
+  xmlFree( xml );
+
+  return error;
 }
 
 #else				/* #ifdef HAVE_LIB_XML2 */
 
 /* Read control mapping from the config file as ini file (if libxml2 is not available) */
 
-int
-control_mapping_read_config_file( control_mapping_info *control_mapping, const char *filename )
+static int
+read_config_file( control_mapping_info *control_mapping, const char *filename )
 {
   int error;
 
@@ -416,13 +446,14 @@ print hashline( __LINE__ ), << 'CODE';
 }
 
 static int
-control_mapping_file_write( compat_fd fd, const char *buffer, size_t length )
+control_mapping_file_write( config_write_buffer *doc, const char *buffer, size_t length )
 {
-  return compat_file_write( fd, (const unsigned char *)buffer, length );
+  config_write_buffer_append( doc, buffer, length );
+  return 0;
 }
 
 static int
-control_mapping_string_write( compat_fd doc, const char* name, const char* config )
+control_mapping_string_write( config_write_buffer *doc, const char* name, const char* config )
 {
   if( config != NULL &&
       ( control_mapping_file_write( doc, name, strlen( name ) ) ||
@@ -434,7 +465,7 @@ control_mapping_string_write( compat_fd doc, const char* name, const char* confi
 }
 
 static int
-control_mapping_numeric_write( compat_fd doc, const char* name, int config )
+control_mapping_numeric_write( config_write_buffer *doc, const char* name, int config )
 {
   char buffer[80]; 
   snprintf( buffer, sizeof( buffer ), "%d", config );
@@ -444,17 +475,16 @@ control_mapping_numeric_write( compat_fd doc, const char* name, int config )
 int
 control_mapping_write_config( control_mapping_info *control_mapping, const char *filename )
 {
-  compat_fd doc;
+  config_write_buffer file, *doc = &file;
+  int error;
 
   /* If don't have file to save do nothing */
   if ( !filename ) return 0;
 
-  doc = compat_file_open( filename, 1 );
-  if( doc == COMPAT_FILE_OPEN_FAILED ) {
-    ui_error( UI_ERROR_ERROR, "couldn't open `%s' for writing: %s\n",
-	      filename, strerror( errno ) );
-    return 1;
-  }
+  /* The file may be rewritten within the resolution of its timestamp */
+  mapping_cache_forget( filename );
+
+  config_write_buffer_init( doc );
 
 CODE
 
@@ -494,17 +524,95 @@ CODE
 
   print hashline( __LINE__ ), << 'CODE';
 
-  compat_file_close( doc );
+  error = config_write( filename, doc->data, doc->length );
 
-  return 0;
+  config_write_buffer_free( doc );
+
+  return error;
 error:
-  compat_file_close( doc );
+  config_write_buffer_free( doc );
 
   return 1;
 }
 
 #endif				/* #ifdef HAVE_LIB_XML2 */
 
+int
+control_mapping_read_config_file( control_mapping_info *control_mapping, const char *filename )
+{
+  mapping_cache_entry *entry = NULL;
+  time_t mtime;
+  off_t length;
+  size_t i;
+
+  /* If don't have file to load there is no error */
+  if ( !filename ) return 1;
+
+  /* Make sure any change we've made to it has been written */
+  config_write_flush( filename );
+
+  /* See if the file exists, if don't there is no error */
+  if( compat_file_get_info( filename, &mtime, &length ) ) return 1;
+
+  for( i = 0; i < mapping_cache_count; i++ ) {
+    if( !strcmp( mapping_cache[i].filename, filename ) ) {
+      entry = &mapping_cache[i];
+      break;
+    }
+  }
+
+  if( entry && entry->mtime == mtime && entry->length == length ) {
+    control_mapping_copy( control_mapping, &entry->control_mapping );
+    return 0;
+  }
+
+  if( read_config_file( control_mapping, filename ) ) return 1;
+
+  if( !entry ) {
+    mapping_cache = libspectrum_renew( mapping_cache_entry, mapping_cache,
+                                       mapping_cache_count + 1 );
+    entry = &mapping_cache[ mapping_cache_count++ ];
+    memset( entry, 0, sizeof( *entry ) );
+    entry->filename = utils_safe_strdup( filename );
+  }
+
+  control_mapping_copy( &entry->control_mapping, control_mapping );
+  entry->mtime = mtime;
+  entry->length = length;
+
+  return 0;
+}
+
+static void
+mapping_cache_forget( const char *filename )
+{
+  size_t i;
+
+  for( i = 0; i < mapping_cache_count; i++ ) {
+    if( !strcmp( mapping_cache[i].filename, filename ) ) {
+      libspectrum_free( mapping_cache[i].filename );
+      control_mapping_free( &mapping_cache[i].control_mapping );
+      mapping_cache[i] = mapping_cache[ --mapping_cache_count ];
+      return;
+    }
+  }
+}
+
+static void
+mapping_cache_free( void )
+{
+  size_t i;
+
+  for( i = 0; i < mapping_cache_count; i++ ) {
+    libspectrum_free( mapping_cache[i].filename );
+    control_mapping_free( &mapping_cache[i].control_mapping );
+  }
+
+  libspectrum_free( mapping_cache );
+  mapping_cache = NULL;
+  mapping_cache_count = 0;
+}
+
 /* Compare two control mapping options */
 int
 control_mapping_something_changed( control_mapping_info *dest, settings_info *src )
@@ -734,6 +842,7 @@ control_mapping_end( void )
   control_mapping_free( &control_mapping_default );
   control_mapping_free( &control_mapping_default_old );
   if ( mapfile ) libspectrum_free( mapfile );
+  mapping_cache_free();
 
 #ifdef HAVE_LIB_XML2
   xmlCleanupParser();
@@ -35,6 +35,7 @@
 #include "event.h"
 #include "fuse.h"
 #include "memory_pages.h"
+#include "spectrum.h"
 #include "ui/ui.h"
 #include "utils.h"
 
@@ -44,6 +45,37 @@ GSList *debugger_breakpoints;
 /* The next breakpoint ID to use */
 static size_t next_breakpoint_id;
 
+/* For each of the address and port breakpoint types, which of the 64K
+   addresses or ports might trigger a breakpoint of that type. Everything
+   else can be rejected by debugger_check() without walking the list */
+#define BREAKPOINT_FILTER_TYPES ( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE + 1 )
+
+static libspectrum_byte
+  breakpoint_filter[ BREAKPOINT_FILTER_TYPES ][ 0x10000 / 8 ];
+
+/* An address which will be hit a number of times before any of the
+   breakpoints on it could trigger, as they're all being ignored for at
+   least that long. Until then, debugger_check() just counts the hits
+   rather than walking the list; the counts are taken off the
+   breakpoints' `ignore' fields by counters_flush() before anything else
+   looks at them */
+typedef struct breakpoint_counter {
+
+  debugger_breakpoint_type type;
+  libspectrum_word address;
+  size_t remaining;		/* Hits to go before the list is needed */
+  size_t used;			/* Hits not yet taken off `ignore' */
+
+} breakpoint_counter;
+
+#define COUNTER_TYPES ( DEBUGGER_BREAKPOINT_TYPE_WRITE + 1 )
+
+static breakpoint_counter *counters;
+static size_t counter_count;
+
+/* Which of the addresses have a counter */
+static libspectrum_byte counter_filter[ COUNTER_TYPES ][ 0x10000 / 8 ];
+
 /* Textual representations of the breakpoint types and lifetimes */
 const char *debugger_breakpoint_type_text[] = {
   "Execute", "Read", "Write", "Port Read", "Port Write", "Time", "Event",
@@ -78,6 +110,11 @@ static gint find_breakpoint_by_address( gconstpointer data,
 					gconstpointer user_data );
 static void free_breakpoint( gpointer data, gpointer user_data );
 static void add_time_event( gpointer data, gpointer user_data );
+static void update_filter( void );
+static breakpoint_counter* counter_find( debugger_breakpoint_type type,
+                                         libspectrum_dword address );
+static void counters_flush( void );
+static void counters_build( void );
 
 /* Add a breakpoint */
 int
@@ -211,10 +248,12 @@ breakpoint_add( debugger_breakpoint_type type, debugger_breakpoint_value value,
 
   bp->commands = NULL;
 
+  counters_flush();
   debugger_breakpoints = g_slist_append( debugger_breakpoints, bp );
+  update_filter();
 
   if( debugger_mode == DEBUGGER_MODE_INACTIVE )
-    debugger_mode = DEBUGGER_MODE_ACTIVE;
+    debugger_set_mode( DEBUGGER_MODE_ACTIVE );
 
   /* If this was a timed breakpoint, set an event to stop emulation
      at that point */
@@ -240,13 +279,29 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
   case DEBUGGER_MODE_INACTIVE: return 0;
 
   case DEBUGGER_MODE_ACTIVE:
+    if( type < BREAKPOINT_FILTER_TYPES &&
+        !( breakpoint_filter[ type ][ ( value & 0xffff ) >> 3 ] &
+           ( 1 << ( value & 0x07 ) ) ) )
+      return 0;
+
+    if( type < COUNTER_TYPES &&
+        counter_filter[ type ][ ( value & 0xffff ) >> 3 ] &
+          ( 1 << ( value & 0x07 ) ) ) {
+      breakpoint_counter *counter = counter_find( type, value );
+      if( counter->remaining ) {
+        counter->remaining--; counter->used++;
+        return 0;
+      }
+      counters_flush();
+    }
+
     for( ptr = debugger_breakpoints; ptr; ptr = ptr_next ) {
 
       bp = ptr->data;
       ptr_next = ptr->next;
 
       if( breakpoint_check( bp, type, value ) ) {
-        debugger_mode = DEBUGGER_MODE_HALTED;
+        debugger_set_mode( DEBUGGER_MODE_HALTED );
         debugger_command_evaluate( bp->commands );
 
         if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
@@ -263,8 +318,10 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
 
   }
 
-  if( signal_breakpoints_updated )
+  if( signal_breakpoints_updated ) {
+      update_filter();
       ui_breakpoints_updated();
+  }
 
   /* Debugger mode could have been reset by a breakpoint command */
   return ( debugger_mode == DEBUGGER_MODE_HALTED );
@@ -385,9 +442,11 @@ debugger_breakpoint_remove( size_t id )
 
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
+  counters_flush();
   debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+  update_filter();
   if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
-    debugger_mode = DEBUGGER_MODE_INACTIVE;
+    debugger_set_mode( DEBUGGER_MODE_INACTIVE );
 
   /* If this was a timed breakpoint, remove the event as well */
   if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME ) {
@@ -458,6 +517,8 @@ debugger_breakpoint_clear( libspectrum_word address )
 
   int found = 0;
 
+  counters_flush();
+
   while( 1 ) {
 
     ptr = g_slist_find_custom( debugger_breakpoints, &address,
@@ -469,11 +530,13 @@ debugger_breakpoint_clear( libspectrum_word address )
     ptr_data = ptr->data;
     debugger_breakpoints = g_slist_remove( debugger_breakpoints, ptr_data );
     if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
-      debugger_mode = DEBUGGER_MODE_INACTIVE;
+      debugger_set_mode( DEBUGGER_MODE_INACTIVE );
 
     free_breakpoint( ptr_data, NULL );
   }
 
+  if( found ) update_filter();
+
   if( !found ) {
     if( debugger_output_base == 10 ) {
       ui_error( UI_ERROR_ERROR, "No breakpoint at %d", address );
@@ -510,9 +573,10 @@ debugger_breakpoint_remove_all( void )
 {
   g_slist_foreach( debugger_breakpoints, free_breakpoint, NULL );
   g_slist_free( debugger_breakpoints ); debugger_breakpoints = NULL;
+  update_filter();
 
   if( debugger_mode == DEBUGGER_MODE_ACTIVE )
-    debugger_mode = DEBUGGER_MODE_INACTIVE;
+    debugger_set_mode( DEBUGGER_MODE_INACTIVE );
 
   /* Restart the breakpoint numbering */
   next_breakpoint_id = 1;
@@ -557,7 +621,9 @@ debugger_breakpoint_ignore( size_t id, size_t ignore )
 
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
+  counters_flush();
   bp->ignore = ignore;
+  update_filter();
 
   return 0;
 }
@@ -594,13 +660,185 @@ debugger_breakpoint_set_commands( size_t id, const char *commands )
   return 0;
 }
 
+static void
+filter_set( debugger_breakpoint_type type, libspectrum_word value )
+{
+  breakpoint_filter[ type ][ value >> 3 ] |= 1 << ( value & 0x07 );
+}
+
+static breakpoint_counter*
+counter_find( debugger_breakpoint_type type, libspectrum_dword address )
+{
+  size_t i;
+
+  for( i = 0; i < counter_count; i++ )
+    if( counters[i].type == type && counters[i].address == address )
+      return &counters[i];
+
+  /* The filter says there's one, so this can't happen */
+  ui_error( UI_ERROR_ERROR, "no breakpoint counter for %d:0x%04x", type,
+            (unsigned)address );
+  fuse_abort();
+}
+
+/* Could `bp' be hit by an access of `type' to `address'? */
+static int
+counter_covers( const debugger_breakpoint *bp, debugger_breakpoint_type type,
+                libspectrum_word address )
+{
+  if( bp->type != type ) return 0;
+
+  if( bp->value.address.source == memory_source_any )
+    return bp->value.address.offset == address;
+
+  return ( bp->value.address.offset & 0x3fff ) == ( address & 0x3fff );
+}
+
+/* Take the hits counted since the last flush off the breakpoints */
+static void
+counters_flush( void )
+{
+  GSList *ptr;
+  debugger_breakpoint *bp;
+  size_t i;
+
+  for( i = 0; i < counter_count; i++ ) {
+    if( !counters[i].used ) continue;
+
+    for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+      bp = ptr->data;
+      if( counter_covers( bp, counters[i].type, counters[i].address ) )
+        bp->ignore -= counters[i].used;
+    }
+
+    counters[i].used = 0;
+  }
+}
+
+/* Give a counter to every address whose breakpoints are all being
+   ignored. Page-specific breakpoints depend on what's paged in, so
+   anything they could cover is left to the list */
+static void
+counters_build( void )
+{
+  GSList *ptr, *ptr2;
+  debugger_breakpoint *bp, *bp2;
+  libspectrum_word address;
+  size_t remaining;
+
+  libspectrum_free( counters );
+  counters = NULL;
+  counter_count = 0;
+  memset( counter_filter, 0, sizeof( counter_filter ) );
+
+  for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+    bp = ptr->data;
+
+    if( bp->type >= COUNTER_TYPES || !bp->ignore ||
+        bp->value.address.source != memory_source_any )
+      continue;
+
+    address = bp->value.address.offset;
+    if( counter_filter[ bp->type ][ address >> 3 ] &
+        ( 1 << ( address & 0x07 ) ) )
+      continue;
+
+    remaining = bp->ignore;
+    for( ptr2 = debugger_breakpoints; ptr2; ptr2 = ptr2->next ) {
+      bp2 = ptr2->data;
+      if( !counter_covers( bp2, bp->type, address ) ) continue;
+      if( bp2->value.address.source != memory_source_any ) {
+        remaining = 0;
+        break;
+      }
+      if( bp2->ignore < remaining ) remaining = bp2->ignore;
+    }
+    if( !remaining ) continue;
+
+    counters = libspectrum_renew( breakpoint_counter, counters,
+                                  counter_count + 1 );
+    counters[ counter_count ].type = bp->type;
+    counters[ counter_count ].address = address;
+    counters[ counter_count ].remaining = remaining;
+    counters[ counter_count ].used = 0;
+    counter_count++;
+
+    counter_filter[ bp->type ][ address >> 3 ] |= 1 << ( address & 0x07 );
+  }
+}
+
+/* Make each breakpoint's `ignore' up to date, for anything showing it */
+void
+debugger_breakpoint_update_ignore( void )
+{
+  counters_flush();
+}
+
+/* Rebuild breakpoint_filter from the list of breakpoints */
+static void
+update_filter( void )
+{
+  GSList *ptr;
+  debugger_breakpoint *bp;
+  libspectrum_dword value;
+  int i, time_breakpoints = 0;
+
+  counters_flush();
+
+  memset( breakpoint_filter, 0, sizeof( breakpoint_filter ) );
+
+  for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+    bp = ptr->data;
+
+    switch( bp->type ) {
+
+    case DEBUGGER_BREAKPOINT_TYPE_EXECUTE:
+    case DEBUGGER_BREAKPOINT_TYPE_READ:
+    case DEBUGGER_BREAKPOINT_TYPE_WRITE:
+      /* A page-specific breakpoint could be hit wherever its page is
+         mapped in */
+      if( bp->value.address.source == memory_source_any ) {
+        filter_set( bp->type, bp->value.address.offset );
+      } else {
+        for( i = 0; i < 4; i++ )
+          filter_set( bp->type,
+                      ( bp->value.address.offset & 0x3fff ) | ( i << 14 ) );
+      }
+      break;
+
+    case DEBUGGER_BREAKPOINT_TYPE_PORT_READ:
+    case DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE:
+      for( value = 0; value < 0x10000; value++ )
+        if( ( value & bp->value.port.mask ) == bp->value.port.port )
+          filter_set( bp->type, value );
+      break;
+
+    case DEBUGGER_BREAKPOINT_TYPE_TIME:
+      time_breakpoints = 1;
+      break;
+
+    case DEBUGGER_BREAKPOINT_TYPE_EVENT:
+      /* Not filtered */
+      break;
+
+    }
+  }
+
+  counters_build();
+
+  /* Time breakpoints need their events adding again every frame */
+  if( time_breakpoints )
+    spectrum_frame_subscribe( debugger_add_time_events );
+  else
+    spectrum_frame_unsubscribe( debugger_add_time_events );
+}
+
 /* Add events corresponding to all the time breakpoints to happen during
    this frame */
-int
+void
 debugger_add_time_events( void )
 {
   g_slist_foreach( debugger_breakpoints, add_time_event, NULL );
-  return 0;
 }
 
 static void
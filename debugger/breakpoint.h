@@ -145,7 +145,8 @@ debugger_breakpoint_add_event(
 );
 
 /* Add events corresponding to all the time breakpoints to happen
-   during this frame */
-int debugger_add_time_events( void );
+   during this frame; called at the end of each frame while there are
+   any */
+void debugger_add_time_events( void );
 
 #endif				/* #ifndef FUSE_DEBUGGER_BREAKPOINT_H */
@@ -32,6 +32,7 @@
 
 #include "debugger/debugger.h"
 #include "debugger/debugger_internals.h"
+#include "memory_usage.h"
 #include "mempool.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
@@ -85,6 +86,7 @@
 %token		 FINISH
 %token		 IF
 %token		 DEBUGGER_IGNORE
+%token		 MEMORY
 %token		 NEXT
 %token		 DEBUGGER_OUT
 %token		 PORT
@@ -93,6 +95,7 @@
 %token		 SET
 %token		 STEP
 %token		 TIME
+%token		 TRACE
 %token		 WRITE
 
 %token <integer> NUMBER
@@ -181,6 +184,7 @@ command:   BASE number { debugger_output_base = $2; }
 	 | DEBUGGER_IGNORE NUMBER number {
 	     debugger_breakpoint_ignore( $2, $3 );
 	   }
+	 | MEMORY   { memory_usage_print(); }
 	 | NEXT	    { debugger_next(); }
 	 | DEBUGGER_OUT number NUMBER { debugger_port_write( $2, $3 ); }
 	 | DEBUGGER_PRINT number { printf( "0x%x\n", $2 ); }
@@ -188,6 +192,9 @@ command:   BASE number { debugger_output_base = $2; }
 	 | SET VARIABLE number { debugger_variable_set( $2, $3 ); }
          | SET STRING ':' STRING number { debugger_system_variable_set( $2, $4, $5 ); }
 	 | STEP	    { debugger_step(); }
+	 | TRACE    { debugger_trace_print( 20 ); }
+	 | TRACE number { debugger_trace_print( $2 ); }
+	 | TRACE WRITE { debugger_trace_write( NULL ); }
 ;
 
 breakpointlife:   BREAK  { $$ = DEBUGGER_BREAKPOINT_LIFE_PERMANENT; }
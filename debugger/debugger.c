@@ -63,22 +63,40 @@ debugger_init( void *context )
   debugger_event_init();
   debugger_system_variable_init();
   debugger_variable_init();
+  debugger_trace_init();
   debugger_reset();
 
   return 0;
 }
 
+/* Change the debugger's state. The memory and port accessors only check
+   for breakpoints while the debugger is anything other than inactive */
+void
+debugger_set_mode( enum debugger_mode_t mode )
+{
+  int active = ( mode != DEBUGGER_MODE_INACTIVE );
+
+  /* Anything looking at the breakpoints now wants the real counts */
+  if( mode != DEBUGGER_MODE_ACTIVE ) debugger_breakpoint_update_ignore();
+
+  debugger_mode = mode;
+
+  memory_set_debugger_accessors( active );
+  periph_set_debugger_accessors( active );
+}
+
 void
 debugger_reset( void )
 {
   debugger_breakpoint_remove_all();
-  debugger_mode = DEBUGGER_MODE_INACTIVE;
+  debugger_set_mode( DEBUGGER_MODE_INACTIVE );
 }
 
 static void
 debugger_end( void )
 {
   debugger_breakpoint_remove_all();
+  debugger_trace_end();
   debugger_variable_end();
   debugger_system_variable_end();
   debugger_event_end();
@@ -90,6 +108,7 @@ debugger_register_startup( void )
   startup_manager_module dependencies[] = {
     STARTUP_MANAGER_MODULE_EVENT,
     STARTUP_MANAGER_MODULE_MEMPOOL,
+    STARTUP_MANAGER_MODULE_SETTINGS_END,
     STARTUP_MANAGER_MODULE_SETUID,
   };
   startup_manager_register( STARTUP_MANAGER_MODULE_DEBUGGER, dependencies,
@@ -108,7 +127,7 @@ debugger_trap( void )
 int
 debugger_step( void )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
   ui_debugger_deactivate( 0 );
   return 0;
 }
@@ -137,9 +156,9 @@ debugger_next( void )
 int
 debugger_run( void )
 {
-  debugger_mode = debugger_breakpoints ?
-                  DEBUGGER_MODE_ACTIVE :
-                  DEBUGGER_MODE_INACTIVE;
+  debugger_set_mode( debugger_breakpoints ?
+                     DEBUGGER_MODE_ACTIVE :
+                     DEBUGGER_MODE_INACTIVE );
   ui_debugger_deactivate( 1 );
   return 0;
 }
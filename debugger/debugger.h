@@ -44,6 +44,9 @@ enum debugger_mode_t
 
 extern enum debugger_mode_t debugger_mode;
 
+/* Change the debugger's state */
+void debugger_set_mode( enum debugger_mode_t mode );
+
 /* Which base should we display things in */
 extern int debugger_output_base;
 
@@ -62,6 +65,11 @@ int debugger_run( void ); /* Set debugger_mode so that emulation will occur */
 void debugger_disassemble( char *buffer, size_t buflen, size_t *length,
 			   libspectrum_word address );
 
+/* The same, but from the `count' bytes at `bytes' rather than memory */
+void debugger_disassemble_bytes( char *buffer, size_t buflen, size_t *length,
+                                 libspectrum_word address,
+                                 const libspectrum_byte *bytes, size_t count );
+
 /* Get an instruction relative to a specific address */
 libspectrum_word debugger_search_instruction( libspectrum_word address,
                                               int delta );
@@ -94,6 +102,16 @@ void debugger_system_variable_register(
   debugger_get_system_variable_fn_t get,
   debugger_set_system_variable_fn_t set );
 
+/* The instruction trace: while active, every instruction executed is
+   recorded with debugger_trace_record() */
+extern int debugger_trace_active;
+
+void debugger_trace_record( void );
+
+/* Write the trace to `filename', or the --trace-file if that's NULL,
+   oldest instruction first */
+int debugger_trace_write( const char *filename );
+
 /* Unit tests */
 int debugger_disassemble_unittest( void );
 
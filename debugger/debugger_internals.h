@@ -43,6 +43,7 @@ int debugger_breakpoint_set_condition( size_t id,
 				       debugger_expression *condition );
 int debugger_breakpoint_set_commands( size_t id, const char *commands );
 int debugger_breakpoint_trigger( debugger_breakpoint *bp );
+void debugger_breakpoint_update_ignore( void );
 
 int debugger_poke( libspectrum_word address, libspectrum_byte value );
 int debugger_port_write( libspectrum_word address, libspectrum_byte value );
@@ -99,12 +100,20 @@ void debugger_event_init( void );
 int debugger_event_is_registered( const char *type, const char *detail );
 void debugger_event_end( void );
 
+/* Instruction trace */
+
+void debugger_trace_init( void );
+int debugger_trace_print( size_t count );
+void debugger_trace_end( void );
+
 /* System variables handling */
 
 void debugger_system_variable_init( void );
 void debugger_system_variable_end( void );
 int debugger_system_variable_find( const char *type, const char *detail );
 libspectrum_dword debugger_system_variable_get( int system_variable );
+debugger_get_system_variable_fn_t
+debugger_system_variable_getter( int system_variable );
 void debugger_system_variable_set( const char *type, const char *detail,
                                    libspectrum_dword value );
 void debugger_system_variable_text( char *buffer, size_t length,
@@ -116,5 +125,6 @@ void debugger_variable_init( void );
 void debugger_variable_end( void );
 void debugger_variable_set( const char *name, libspectrum_dword value );
 libspectrum_dword debugger_variable_get( const char *name );
+libspectrum_dword* debugger_variable_slot( const char *name );
 
 #endif				/* #ifndef FUSE_DEBUGGER_INTERNALS_H */
@@ -39,6 +39,38 @@
 /* Used to flag whether we're after a DD or FD prefix */
 enum hl_type { USE_HL, USE_IX, USE_IY };
 
+/* Recently disassembled instructions. Each entry remembers the bytes the
+   instruction was decoded from and is used only while memory still holds
+   those bytes, so writes and paging changes need no special handling */
+#define DISASSEMBLE_CACHE_SIZE 1024
+
+/* Instructions which needed more bytes than this (long runs of DD and FD
+   prefixes) are not cached */
+#define DISASSEMBLE_CACHE_BYTES 8
+
+typedef struct disassemble_cache_entry {
+  int valid;
+  libspectrum_word address;
+  int output_base;		/* debugger_output_base when decoded */
+  size_t length;		/* Length of the instruction */
+  size_t span;			/* Number of bytes read to decode it */
+  libspectrum_byte bytes[ DISASSEMBLE_CACHE_BYTES ];
+  char text[ 64 ];
+} disassemble_cache_entry;
+
+static disassemble_cache_entry disassemble_cache[ DISASSEMBLE_CACHE_SIZE ];
+
+/* Where the instruction being disassembled starts, and how many bytes
+   from there have been read so far */
+static libspectrum_word read_start;
+static size_t read_span;
+
+/* If non-NULL, the bytes to disassemble from rather than memory */
+static const libspectrum_byte *read_bytes;
+static size_t read_bytes_count;
+
+static libspectrum_byte read_byte( libspectrum_word address );
+
 static void disassemble_main( libspectrum_word address, char *buffer,
 			      size_t buflen, size_t *length,
 			      enum hl_type use_hl );
@@ -94,12 +126,64 @@ static const char *rotate_op( libspectrum_byte b );
 static const char *bit_op( libspectrum_byte b );
 static int bit_op_bit( libspectrum_byte b );
 
-/* A very thin wrapper to avoid exposing the USE_HL constant */
+/* A thin wrapper to avoid exposing the USE_HL constant, and to look in
+   the cache first */
 void
 debugger_disassemble( char *buffer, size_t buflen, size_t *length,
 		      libspectrum_word address )
 {
-  disassemble_main( address, buffer, buflen, length, USE_HL );
+  disassemble_cache_entry *entry =
+    &disassemble_cache[ address % DISASSEMBLE_CACHE_SIZE ];
+  size_t i;
+
+  if( entry->valid && entry->address == address &&
+      entry->output_base == debugger_output_base ) {
+
+    for( i = 0; i < entry->span; i++ )
+      if( readbyte_internal( address + i ) != entry->bytes[i] ) break;
+
+    if( i == entry->span ) {
+      if( buffer ) snprintf( buffer, buflen, "%s", entry->text );
+      *length = entry->length;
+      return;
+    }
+  }
+
+  read_start = address; read_span = 0;
+
+  disassemble_main( address, entry->text, sizeof( entry->text ), length,
+		    USE_HL );
+
+  entry->valid = read_span <= DISASSEMBLE_CACHE_BYTES;
+  if( entry->valid ) {
+    entry->address = address;
+    entry->output_base = debugger_output_base;
+    entry->length = *length;
+    entry->span = read_span;
+    for( i = 0; i < read_span; i++ )
+      entry->bytes[i] = readbyte_internal( address + i );
+  }
+
+  if( buffer ) snprintf( buffer, buflen, "%s", entry->text );
+}
+
+/* Disassemble an instruction from `count' bytes held elsewhere, as if
+   they were at `address'; anything past the end is taken to be 0 */
+void
+debugger_disassemble_bytes( char *buffer, size_t buflen, size_t *length,
+                            libspectrum_word address,
+                            const libspectrum_byte *bytes, size_t count )
+{
+  char text[ 64 ];
+
+  read_start = address; read_span = 0;
+  read_bytes = bytes; read_bytes_count = count;
+
+  disassemble_main( address, text, sizeof( text ), length, USE_HL );
+
+  read_bytes = NULL;
+
+  if( buffer ) snprintf( buffer, buflen, "%s", text );
 }
 
 /* Disassemble one instruction */
@@ -111,7 +195,7 @@ disassemble_main( libspectrum_word address, char *buffer, size_t buflen,
   char buffer2[40], buffer3[40];
   size_t prefix_length = 0;
 
-  b = readbyte_internal( address );
+  b = read_byte( address );
 
   /* Before we do anything else, strip off any DD or FD prefixes, keeping
      a count of how many we've seen */
@@ -119,7 +203,7 @@ disassemble_main( libspectrum_word address, char *buffer, size_t buflen,
     use_hl = b == 0xdd ? USE_IX : USE_IY;
     address++;
     prefix_length++;
-    b = readbyte_internal( address );
+    b = read_byte( address );
   }
 
   if( b < 0x40 ) {
@@ -169,7 +253,7 @@ disassemble_00xxxxxx( libspectrum_word address, char *buffer, size_t buflen,
   };
   char buffer2[40], buffer3[40];
 
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( b & 0x0f ) {
 
@@ -177,7 +261,7 @@ disassemble_00xxxxxx( libspectrum_word address, char *buffer, size_t buflen,
     if( b <= 0x08 ) {
       snprintf( buffer, buflen, "%s", opcode_00xxx000[ b >> 3 ] ); *length = 1;
     } else {
-      get_offset( buffer2, 40, address + 2, readbyte_internal( address + 1 ) );
+      get_offset( buffer2, 40, address + 2, read_byte( address + 1 ) );
       snprintf( buffer, buflen, "%s%s", opcode_00xxx000[ b >> 3 ], buffer2 );
       *length = 2;
     }
@@ -209,7 +293,7 @@ disassemble_00xxxxxx( libspectrum_word address, char *buffer, size_t buflen,
 
   case 0x06: case 0x0e:
     *length = 2 + dest_reg( address, use_hl, buffer2, 40 );
-    get_byte( buffer3, 40, readbyte_internal( address + *length - 1 ) );
+    get_byte( buffer3, 40, read_byte( address + *length - 1 ) );
     snprintf( buffer, buflen, "LD %s,%s", buffer2, buffer3 );
     break;
 
@@ -241,7 +325,7 @@ disassemble_00xxx010( libspectrum_word address, char *buffer, size_t buflen,
 		      size_t *length, enum hl_type use_hl )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( b >> 4 ) {
 
@@ -269,7 +353,7 @@ disassemble_00xxx110( libspectrum_word address, char *buffer, size_t buflen,
 		      size_t *length, enum hl_type use_hl )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( b >> 4 ) {
 
@@ -297,7 +381,7 @@ disassemble_11xxxxxx( libspectrum_word address, char *buffer, size_t buflen,
 		      size_t *length, enum hl_type use_hl )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( b & 0x07 ) {
 
@@ -330,7 +414,7 @@ disassemble_11xxxxxx( libspectrum_word address, char *buffer, size_t buflen,
     break;
 
   case 0x06:
-    get_byte( buffer2, 40, readbyte_internal( address + 1 ) );
+    get_byte( buffer2, 40, read_byte( address + 1 ) );
     snprintf( buffer, buflen, addition_op( b ), buffer2 );
     *length = 2;
     break;
@@ -374,7 +458,7 @@ disassemble_11xxx011( libspectrum_word address, char *buffer, size_t buflen,
 		      size_t *length, enum hl_type use_hl )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( ( b >> 3 ) - 0x18 ) {
 
@@ -385,7 +469,7 @@ disassemble_11xxx011( libspectrum_word address, char *buffer, size_t buflen,
 
   case 0x01:
     if( use_hl != USE_HL ) {
-      char offset = readbyte_internal( address + 1 );
+      char offset = read_byte( address + 1 );
       disassemble_ddfd_cb( address+2, offset, use_hl, buffer, buflen,
 			   length );
       (*length) += 2;
@@ -395,12 +479,12 @@ disassemble_11xxx011( libspectrum_word address, char *buffer, size_t buflen,
     break;
 
   case 0x02:
-    get_byte( buffer2, 40, readbyte_internal( address + 1 ) );
+    get_byte( buffer2, 40, read_byte( address + 1 ) );
     snprintf( buffer, buflen, "OUT (%s),A", buffer2 ); *length = 2;
     break;
 
   case 0x03:
-    get_byte( buffer2, 40, readbyte_internal( address + 1 ) );
+    get_byte( buffer2, 40, read_byte( address + 1 ) );
     snprintf( buffer, buflen, "IN A,(%s)", buffer2 ); *length = 2;
     break;
 
@@ -429,7 +513,7 @@ disassemble_11xxx101( libspectrum_word address, char *buffer, size_t buflen,
 		      size_t *length, enum hl_type use_hl )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   switch( ( b >> 3 ) - 0x18 ) {
 	
@@ -466,7 +550,7 @@ disassemble_cb( libspectrum_word address, char *buffer, size_t buflen,
 		size_t *length )
 {
   char buffer2[40];
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
 
   source_reg( address, USE_HL, buffer2, 40 );
 
@@ -503,7 +587,7 @@ disassemble_ed( libspectrum_word address, char *buffer, size_t buflen,
   /* The order in which the IM x instructions appear */
   const int im_modes[] = { 0, 0, 1, 2 };
 
-  b = readbyte_internal( address );
+  b = read_byte( address );
 
   if( b < 0x40 || b > 0xbb ) {
     snprintf( buffer, buflen, "NOPD" ); *length = 1;
@@ -588,7 +672,7 @@ disassemble_ddfd_cb( libspectrum_word address, char offset,
 		     enum hl_type use_hl, char *buffer, size_t buflen,
 		     size_t *length )
 {
-  libspectrum_byte b = readbyte_internal( address );
+  libspectrum_byte b = read_byte( address );
   char buffer2[40], buffer3[40];
 
   if( b < 0x40 ) {
@@ -622,6 +706,21 @@ disassemble_ddfd_cb( libspectrum_word address, char offset,
   }
 }
 
+/* Read a byte of the instruction being disassembled, keeping track of
+   how much of it we've looked at */
+static libspectrum_byte
+read_byte( libspectrum_word address )
+{
+  size_t offset = (libspectrum_word)( address - read_start );
+
+  if( offset >= read_span ) read_span = offset + 1;
+
+  if( read_bytes )
+    return offset < read_bytes_count ? read_bytes[ offset ] : 0;
+
+  return readbyte_internal( address );
+}
+
 /* Get a text representation of a one-byte number */
 static void
 get_byte( char *buffer, size_t buflen, libspectrum_byte b )
@@ -635,8 +734,8 @@ get_word( char *buffer, size_t buflen, libspectrum_word address )
 {
   libspectrum_word w;
 
-  w  = readbyte_internal( address + 1 ); w <<= 8;
-  w += readbyte_internal( address     );
+  w  = read_byte( address + 1 ); w <<= 8;
+  w += read_byte( address     );
 
   snprintf( buffer, buflen, debugger_output_base == 10 ? "%d" : "%04X", w );
 }
@@ -698,8 +797,8 @@ static int
 source_reg( libspectrum_word address, enum hl_type use_hl, char *buffer,
 	    size_t buflen )
 {
-  return single_reg( readbyte_internal( address ) & 0x07, use_hl,
-		     readbyte_internal( address + 1 ), buffer, buflen );
+  return single_reg( read_byte( address ) & 0x07, use_hl,
+		     read_byte( address + 1 ), buffer, buflen );
 }
 
 /* Get an 8-bit register, based on bits 3-5 of the opcode at 'address' */
@@ -707,8 +806,8 @@ static int
 dest_reg( libspectrum_word address, enum hl_type use_hl, char *buffer,
 	  size_t buflen )
 {
-  return single_reg( ( readbyte_internal( address ) >> 3 ) & 0x07, use_hl,
-		     readbyte_internal( address + 1 ), buffer, buflen );
+  return single_reg( ( read_byte( address ) >> 3 ) & 0x07, use_hl,
+		     read_byte( address + 1 ), buffer, buflen );
 }
 
 /* Get an 8-bit register name, including (HL). Also substitutes
@@ -873,7 +972,7 @@ run_test( libspectrum_byte *data, size_t data_length, const char *expected )
 int
 debugger_disassemble_unittest( void )
 {
-  int r = 0;
+  int r = 0, old_base;
 
   r += run_test( test1_data, sizeof( test1_data ), "NOP" );
 
@@ -896,5 +995,12 @@ debugger_disassemble_unittest( void )
   r += run_test( test14_data, sizeof( test14_data ), "LD A,(HL)" );
   r += run_test( test15_data, sizeof( test15_data ), "LD A,(IX+55)" );
 
+  /* The same bytes again, which must not come back from the cache in the
+     old base */
+  old_base = debugger_output_base;
+  debugger_output_base = 10;
+  r += run_test( test15_data, sizeof( test15_data ), "LD A,(IX+85)" );
+  debugger_output_base = old_base;
+
   return r;
 }
@@ -77,6 +77,49 @@ struct binaryop_type {
 
 };
 
+/* A compiled expression is the tree flattened into postfix order and
+   run on a small value stack. System variables are resolved to their
+   getter and user variables to their storage slot when compiling, so
+   evaluation does no lookups */
+
+typedef enum expression_opcode {
+
+  EXPRESSION_OP_INTEGER,	/* Push a constant */
+  EXPRESSION_OP_SYSVAR,		/* Push the value of a system variable */
+  EXPRESSION_OP_VARIABLE,	/* Push the value of a user variable */
+  EXPRESSION_OP_UNARYOP,	/* Replace the top of the stack */
+  EXPRESSION_OP_BINARYOP,	/* Replace the top two entries with one */
+  EXPRESSION_OP_LOGICAL_AND,	/* If top is zero, jump; else pop */
+  EXPRESSION_OP_LOGICAL_OR,	/* If top is non-zero, make it 1 and jump;
+				   else pop */
+  EXPRESSION_OP_BOOLEAN,	/* Convert the top of the stack to 0 or 1 */
+
+} expression_opcode;
+
+typedef struct expression_instruction {
+
+  expression_opcode opcode;
+
+  union {
+    libspectrum_dword integer;
+    debugger_get_system_variable_fn_t get;
+    libspectrum_dword *variable;
+    int operation;
+    size_t target;
+  } arg;
+
+} expression_instruction;
+
+/* Deeper expressions than this just aren't compiled */
+#define EXPRESSION_STACK_SIZE 32
+
+typedef struct expression_program {
+
+  expression_instruction *code;
+  size_t length;
+
+} expression_program;
+
 struct debugger_expression {
 
   expression_type type;
@@ -90,10 +133,21 @@ struct debugger_expression {
     int system_variable;
   } types;
 
+  /* Only set on the root of a tree made by debugger_expression_copy() */
+  expression_program *program;
+
 };
 
 static libspectrum_dword evaluate_unaryop( struct unaryop_type *unaryop );
 static libspectrum_dword evaluate_binaryop( struct binaryop_type *binary );
+static libspectrum_dword apply_unaryop( int operation,
+                                        libspectrum_dword operand );
+static libspectrum_dword apply_binaryop( int operation,
+                                         libspectrum_dword operand1,
+                                         libspectrum_dword operand2 );
+
+static expression_program* compile( debugger_expression *exp );
+static libspectrum_dword evaluate_program( const expression_program *program );
 
 static int deparse_unaryop( char *buffer, size_t length,
 			    const struct unaryop_type *unaryop );
@@ -157,6 +211,7 @@ debugger_expression_new_number( libspectrum_dword number, int pool )
   exp->type = DEBUGGER_EXPRESSION_TYPE_INTEGER;
   exp->precedence = PRECEDENCE_ATOMIC;
   exp->types.integer = number;
+  exp->program = NULL;
 
   return exp;
 }
@@ -175,6 +230,7 @@ debugger_expression_new_binaryop( int operation, debugger_expression *operand1,
   exp->types.binaryop.operation = operation;
   exp->types.binaryop.op1 = operand1;
   exp->types.binaryop.op2 = operand2;
+  exp->program = NULL;
 
   return exp;
 }
@@ -192,6 +248,7 @@ debugger_expression_new_unaryop( int operation, debugger_expression *operand,
 
   exp->types.unaryop.operation = operation;
   exp->types.unaryop.op = operand;
+  exp->program = NULL;
 
   return exp;
 }
@@ -215,6 +272,7 @@ debugger_expression_new_system_variable( const char *type, const char *detail,
   exp->type = DEBUGGER_EXPRESSION_TYPE_SYSVAR;
   exp->precedence = PRECEDENCE_ATOMIC;
   exp->types.system_variable = system_variable;
+  exp->program = NULL;
 
   return exp;
 }
@@ -229,6 +287,7 @@ debugger_expression_new_variable( const char *name, int pool )
   exp->type = DEBUGGER_EXPRESSION_TYPE_VARIABLE;
   exp->precedence = PRECEDENCE_ATOMIC;
   exp->types.variable = mempool_strdup( pool, name );
+  exp->program = NULL;
 
   return exp;
 }
@@ -255,12 +314,17 @@ debugger_expression_delete( debugger_expression *exp )
     libspectrum_free( exp->types.variable );
     break;
   }
+
+  if( exp->program ) {
+    libspectrum_free( exp->program->code );
+    libspectrum_free( exp->program );
+  }
     
   libspectrum_free( exp );
 }
 
-debugger_expression*
-debugger_expression_copy( debugger_expression *src )
+static debugger_expression*
+copy_expression( debugger_expression *src )
 {
   debugger_expression *dest;
 
@@ -269,6 +333,7 @@ debugger_expression_copy( debugger_expression *src )
 
   dest->type = src->type;
   dest->precedence = src->precedence;
+  dest->program = NULL;
 
   switch( dest->type ) {
 
@@ -278,7 +343,7 @@ debugger_expression_copy( debugger_expression *src )
 
   case DEBUGGER_EXPRESSION_TYPE_UNARYOP:
     dest->types.unaryop.operation = src->types.unaryop.operation;
-    dest->types.unaryop.op = debugger_expression_copy( src->types.unaryop.op );
+    dest->types.unaryop.op = copy_expression( src->types.unaryop.op );
     if( !dest->types.unaryop.op ) {
       libspectrum_free( dest );
       return NULL;
@@ -288,13 +353,13 @@ debugger_expression_copy( debugger_expression *src )
   case DEBUGGER_EXPRESSION_TYPE_BINARYOP:
     dest->types.binaryop.operation = src->types.binaryop.operation;
     dest->types.binaryop.op1 =
-      debugger_expression_copy( src->types.binaryop.op1 );
+      copy_expression( src->types.binaryop.op1 );
     if( !dest->types.binaryop.op1 ) {
       libspectrum_free( dest );
       return NULL;
     }
     dest->types.binaryop.op2 =
-      debugger_expression_copy( src->types.binaryop.op2 );
+      copy_expression( src->types.binaryop.op2 );
     if( !dest->types.binaryop.op2 ) {
       debugger_expression_delete( dest->types.binaryop.op1 );
       libspectrum_free( dest );
@@ -314,9 +379,24 @@ debugger_expression_copy( debugger_expression *src )
   return dest;
 }
 
+/* Copies are long-lived (breakpoint conditions), so compile them as
+   they are made */
+debugger_expression*
+debugger_expression_copy( debugger_expression *src )
+{
+  debugger_expression *dest;
+
+  dest = copy_expression( src );
+  if( dest ) dest->program = compile( dest );
+
+  return dest;
+}
+
 libspectrum_dword
 debugger_expression_evaluate( debugger_expression *exp )
 {
+  if( exp->program ) return evaluate_program( exp->program );
+
   switch( exp->type ) {
 
   case DEBUGGER_EXPRESSION_TYPE_INTEGER:
@@ -343,89 +423,274 @@ debugger_expression_evaluate( debugger_expression *exp )
 static libspectrum_dword
 evaluate_unaryop( struct unaryop_type *unary )
 {
-  switch( unary->operation ) {
+  return apply_unaryop( unary->operation,
+                        debugger_expression_evaluate( unary->op ) );
+}
+
+static libspectrum_dword
+evaluate_binaryop( struct binaryop_type *binary )
+{
+  switch( binary->operation ) {
+
+  case DEBUGGER_TOKEN_LOGICAL_AND:
+	    return debugger_expression_evaluate( binary->op1 ) &&
+		   debugger_expression_evaluate( binary->op2 );
+
+  case DEBUGGER_TOKEN_LOGICAL_OR:
+	    return debugger_expression_evaluate( binary->op1 ) ||
+		   debugger_expression_evaluate( binary->op2 );
+
+  }
+
+  return apply_binaryop( binary->operation,
+                         debugger_expression_evaluate( binary->op1 ),
+                         debugger_expression_evaluate( binary->op2 ) );
+}
+
+static libspectrum_dword
+apply_unaryop( int operation, libspectrum_dword operand )
+{
+  switch( operation ) {
 
-  case '!': return !debugger_expression_evaluate( unary->op );
-  case '~': return ~debugger_expression_evaluate( unary->op );
-  case '-': return -debugger_expression_evaluate( unary->op );
+  case '!': return !operand;
+  case '~': return ~operand;
+  case '-': return -operand;
 
   case DEBUGGER_TOKEN_DEREFERENCE:
-    return readbyte_internal( debugger_expression_evaluate( unary->op ) );
+    return readbyte_internal( operand );
 
   }
 
-  ui_error( UI_ERROR_ERROR, "unknown unary operator %d", unary->operation );
+  ui_error( UI_ERROR_ERROR, "unknown unary operator %d", operation );
   fuse_abort();
 }
 
+/* The logical operators short-circuit, so are handled by the callers */
 static libspectrum_dword
-evaluate_binaryop( struct binaryop_type *binary )
+apply_binaryop( int operation, libspectrum_dword operand1,
+                libspectrum_dword operand2 )
 {
-  switch( binary->operation ) {
+  switch( operation ) {
 
-  case '+': return debugger_expression_evaluate( binary->op1 ) +
-		   debugger_expression_evaluate( binary->op2 );
+  case '+': return operand1 + operand2;
+  case '-': return operand1 - operand2;
+  case '*': return operand1 * operand2;
 
-  case '-': return debugger_expression_evaluate( binary->op1 ) -
-		   debugger_expression_evaluate( binary->op2 );
+  case '/':
+    if( operand2 == 0 ) {
+      ui_error( UI_ERROR_ERROR, "divide by 0" );
+      return 0;
+    }
+    return operand1 / operand2;
 
-  case '*': return debugger_expression_evaluate( binary->op1 ) *
-		   debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_TOKEN_EQUAL_TO:     return operand1 == operand2;
+  case DEBUGGER_TOKEN_NOT_EQUAL_TO: return operand1 != operand2;
+
+  case '>': return operand1 >  operand2;
+  case '<': return operand1 <  operand2;
+
+  case DEBUGGER_TOKEN_LESS_THAN_OR_EQUAL_TO:    return operand1 <= operand2;
+  case DEBUGGER_TOKEN_GREATER_THAN_OR_EQUAL_TO: return operand1 >= operand2;
+
+  case '&': return operand1 & operand2;
+  case '^': return operand1 ^ operand2;
+  case '|': return operand1 | operand2;
+
+  }
+
+  ui_error( UI_ERROR_ERROR, "unknown binary operator %d", operation );
+  fuse_abort();
+}
+
+/* Work out how many instructions `exp' compiles to and how deep the
+   value stack gets while running them */
+static void
+compiled_size( debugger_expression *exp, size_t *length, size_t *depth )
+{
+  size_t length1, depth1, length2, depth2;
+
+  switch( exp->type ) {
+
+  case DEBUGGER_EXPRESSION_TYPE_INTEGER:
+  case DEBUGGER_EXPRESSION_TYPE_SYSVAR:
+  case DEBUGGER_EXPRESSION_TYPE_VARIABLE:
+    *length = 1; *depth = 1;
+    return;
+
+  case DEBUGGER_EXPRESSION_TYPE_UNARYOP:
+    compiled_size( exp->types.unaryop.op, length, depth );
+    (*length)++;
+    return;
+
+  case DEBUGGER_EXPRESSION_TYPE_BINARYOP:
+    compiled_size( exp->types.binaryop.op1, &length1, &depth1 );
+    compiled_size( exp->types.binaryop.op2, &length2, &depth2 );
+
+    switch( exp->types.binaryop.operation ) {
+
+    case DEBUGGER_TOKEN_LOGICAL_AND:
+    case DEBUGGER_TOKEN_LOGICAL_OR:
+      /* The first operand is popped before the second is evaluated */
+      *length = length1 + length2 + 2;
+      *depth = depth1 > depth2 ? depth1 : depth2;
+      return;
+
+    default:
+      *length = length1 + length2 + 1;
+      *depth = depth1 > depth2 + 1 ? depth1 : depth2 + 1;
+      return;
 
-  case '/': {
-      libspectrum_dword op2 = debugger_expression_evaluate( binary->op2 );
-      if( op2 == 0 ) {
-        ui_error( UI_ERROR_ERROR, "divide by 0" );
-        return 0;
-      }
-      return debugger_expression_evaluate( binary->op1 ) / op2;
     }
+  }
 
-  case DEBUGGER_TOKEN_EQUAL_TO:
-            return debugger_expression_evaluate( binary->op1 ) ==
-                   debugger_expression_evaluate( binary->op2 );
+  ui_error( UI_ERROR_ERROR, "unknown expression type %d", exp->type );
+  fuse_abort();
+}
 
-  case DEBUGGER_TOKEN_NOT_EQUAL_TO:
-	    return debugger_expression_evaluate( binary->op1 ) !=
-		   debugger_expression_evaluate( binary->op2 );
+static void
+emit( expression_program *program, debugger_expression *exp )
+{
+  expression_instruction *insn;
+  size_t jump;
 
-  case '>': return debugger_expression_evaluate( binary->op1 ) >
-		   debugger_expression_evaluate( binary->op2 );
+  switch( exp->type ) {
 
-  case '<': return debugger_expression_evaluate( binary->op1 ) <
-	           debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_EXPRESSION_TYPE_INTEGER:
+    insn = &program->code[ program->length++ ];
+    insn->opcode = EXPRESSION_OP_INTEGER;
+    insn->arg.integer = exp->types.integer;
+    return;
 
-  case DEBUGGER_TOKEN_LESS_THAN_OR_EQUAL_TO:
-	    return debugger_expression_evaluate( binary->op1 ) <=
-		   debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_EXPRESSION_TYPE_SYSVAR:
+    insn = &program->code[ program->length++ ];
+    insn->opcode = EXPRESSION_OP_SYSVAR;
+    insn->arg.get =
+      debugger_system_variable_getter( exp->types.system_variable );
+    return;
 
-  case DEBUGGER_TOKEN_GREATER_THAN_OR_EQUAL_TO:
-	    return debugger_expression_evaluate( binary->op1 ) >=
-		   debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_EXPRESSION_TYPE_VARIABLE:
+    insn = &program->code[ program->length++ ];
+    insn->opcode = EXPRESSION_OP_VARIABLE;
+    insn->arg.variable = debugger_variable_slot( exp->types.variable );
+    return;
 
-  case '&': return debugger_expression_evaluate( binary->op1 ) &
-	           debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_EXPRESSION_TYPE_UNARYOP:
+    emit( program, exp->types.unaryop.op );
+    insn = &program->code[ program->length++ ];
+    insn->opcode = EXPRESSION_OP_UNARYOP;
+    insn->arg.operation = exp->types.unaryop.operation;
+    return;
 
-  case '^': return debugger_expression_evaluate( binary->op1 ) ^
-		   debugger_expression_evaluate( binary->op2 );
+  case DEBUGGER_EXPRESSION_TYPE_BINARYOP:
+    emit( program, exp->types.binaryop.op1 );
 
-  case '|': return debugger_expression_evaluate( binary->op1 ) |
-		   debugger_expression_evaluate( binary->op2 );
+    switch( exp->types.binaryop.operation ) {
 
-  case DEBUGGER_TOKEN_LOGICAL_AND:
-	    return debugger_expression_evaluate( binary->op1 ) &&
-		   debugger_expression_evaluate( binary->op2 );
+    case DEBUGGER_TOKEN_LOGICAL_AND:
+    case DEBUGGER_TOKEN_LOGICAL_OR:
+      jump = program->length++;
+      program->code[ jump ].opcode =
+        exp->types.binaryop.operation == DEBUGGER_TOKEN_LOGICAL_AND ?
+        EXPRESSION_OP_LOGICAL_AND : EXPRESSION_OP_LOGICAL_OR;
 
-  case DEBUGGER_TOKEN_LOGICAL_OR:
-	    return debugger_expression_evaluate( binary->op1 ) ||
-		   debugger_expression_evaluate( binary->op2 );
+      emit( program, exp->types.binaryop.op2 );
+      insn = &program->code[ program->length++ ];
+      insn->opcode = EXPRESSION_OP_BOOLEAN;
+
+      program->code[ jump ].arg.target = program->length;
+      return;
 
+    default:
+      emit( program, exp->types.binaryop.op2 );
+      insn = &program->code[ program->length++ ];
+      insn->opcode = EXPRESSION_OP_BINARYOP;
+      insn->arg.operation = exp->types.binaryop.operation;
+      return;
+
+    }
   }
 
-  ui_error( UI_ERROR_ERROR, "unknown binary operator %d", binary->operation );
+  ui_error( UI_ERROR_ERROR, "unknown expression type %d", exp->type );
   fuse_abort();
 }
 
+/* Returns NULL if the expression is too deep to compile, in which case
+   it will just be evaluated by walking the tree */
+static expression_program*
+compile( debugger_expression *exp )
+{
+  expression_program *program;
+  size_t length, depth;
+
+  compiled_size( exp, &length, &depth );
+  if( depth > EXPRESSION_STACK_SIZE ) return NULL;
+
+  program = libspectrum_new( expression_program, 1 );
+  program->code = libspectrum_new( expression_instruction, length );
+  program->length = 0;
+
+  emit( program, exp );
+
+  return program;
+}
+
+static libspectrum_dword
+evaluate_program( const expression_program *program )
+{
+  libspectrum_dword stack[ EXPRESSION_STACK_SIZE ];
+  size_t sp = 0, pc = 0;
+
+  while( pc < program->length ) {
+
+    const expression_instruction *insn = &program->code[ pc++ ];
+
+    switch( insn->opcode ) {
+
+    case EXPRESSION_OP_INTEGER:
+      stack[ sp++ ] = insn->arg.integer;
+      break;
+
+    case EXPRESSION_OP_SYSVAR:
+      stack[ sp++ ] = insn->arg.get();
+      break;
+
+    case EXPRESSION_OP_VARIABLE:
+      stack[ sp++ ] = *insn->arg.variable;
+      break;
+
+    case EXPRESSION_OP_UNARYOP:
+      stack[ sp - 1 ] = apply_unaryop( insn->arg.operation, stack[ sp - 1 ] );
+      break;
+
+    case EXPRESSION_OP_BINARYOP:
+      sp--;
+      stack[ sp - 1 ] = apply_binaryop( insn->arg.operation, stack[ sp - 1 ],
+                                        stack[ sp ] );
+      break;
+
+    case EXPRESSION_OP_LOGICAL_AND:
+      if( !stack[ sp - 1 ] ) pc = insn->arg.target; else sp--;
+      break;
+
+    case EXPRESSION_OP_LOGICAL_OR:
+      if( stack[ sp - 1 ] ) {
+        stack[ sp - 1 ] = 1;
+        pc = insn->arg.target;
+      } else {
+        sp--;
+      }
+      break;
+
+    case EXPRESSION_OP_BOOLEAN:
+      stack[ sp - 1 ] = !!stack[ sp - 1 ];
+      break;
+
+    }
+  }
+
+  return stack[ 0 ];
+}
+
 int
 debugger_expression_deparse( char *buffer, size_t length,
 			     const debugger_expression *exp )
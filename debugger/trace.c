@@ -0,0 +1,214 @@
+/* trace.c: Record of the instructions most recently executed
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "debugger_internals.h"
+#include "memory_pages.h"
+#include "runahead.h"
+#include "settings.h"
+#include "spectrum.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "z80/z80.h"
+#include "z80/z80_macros.h"
+
+/*
+ * With --trace-length set, every instruction executed is recorded in a
+ * ring holding the last that many, so what led up to a crash can be
+ * seen after the event without stepping through it. Each instruction
+ * takes sixteen bytes:
+ *
+ *   dword  tstates since the start of the frame
+ *   word   PC, SP, AF, HL
+ *   byte   the (first) four bytes of the instruction
+ *
+ * The file written by `trace write' or at exit is "FTRC", a dword
+ * version (1) and a dword count, followed by that many of these, oldest
+ * first, with everything little endian.
+ */
+
+typedef struct trace_entry {
+
+  libspectrum_dword tstates;
+  libspectrum_word pc, sp, af, hl;
+  libspectrum_byte bytes[4];
+
+} trace_entry;
+
+#define TRACE_ENTRY_LENGTH 16
+#define TRACE_VERSION 1
+
+int debugger_trace_active = 0;
+
+static trace_entry *trace;
+static size_t trace_mask;	/* Length of `trace' less one */
+static size_t trace_next;	/* Where the next instruction goes */
+static int trace_wrapped;	/* Has `trace' been filled yet? */
+
+void
+debugger_trace_init( void )
+{
+  size_t length;
+
+  trace = NULL;
+  trace_next = 0;
+  trace_wrapped = 0;
+
+  if( settings_current.trace_length <= 0 ) return;
+
+  /* Round up to a power of two so finding the next entry is a mask */
+  for( length = 1; length < (size_t)settings_current.trace_length;
+       length <<= 1 )
+    ;
+
+  trace = libspectrum_new( trace_entry, length );
+  trace_mask = length - 1;
+
+  debugger_trace_active = 1;
+}
+
+void
+debugger_trace_record( void )
+{
+  trace_entry *entry = &trace[ trace_next ];
+
+  /* Frames run ahead are thrown away, and done again for real later */
+  if( runahead_active ) return;
+
+  entry->tstates = tstates;
+  entry->pc = PC;
+  entry->sp = SP;
+  entry->af = AF;
+  entry->hl = HL;
+  entry->bytes[0] = readbyte_internal( PC );
+  entry->bytes[1] = readbyte_internal( PC + 1 );
+  entry->bytes[2] = readbyte_internal( PC + 2 );
+  entry->bytes[3] = readbyte_internal( PC + 3 );
+
+  trace_next = ( trace_next + 1 ) & trace_mask;
+  if( !trace_next ) trace_wrapped = 1;
+}
+
+/* How many instructions are in the trace, and where the oldest is */
+static size_t
+trace_count( size_t *first )
+{
+  if( trace_wrapped ) {
+    *first = trace_next;
+    return trace_mask + 1;
+  }
+
+  *first = 0;
+  return trace_next;
+}
+
+/* Show the last `count' instructions */
+int
+debugger_trace_print( size_t count )
+{
+  char buffer[ 64 ];
+  size_t available, first, length, i;
+  const trace_entry *entry;
+
+  if( !trace ) {
+    ui_error( UI_ERROR_ERROR, "no instruction trace; see --trace-length" );
+    return 1;
+  }
+
+  available = trace_count( &first );
+  if( count > available ) count = available;
+
+  for( i = available - count; i < available; i++ ) {
+    entry = &trace[ ( first + i ) & trace_mask ];
+    debugger_disassemble_bytes( buffer, sizeof( buffer ), &length,
+                                entry->pc, entry->bytes,
+                                sizeof( entry->bytes ) );
+    printf( "%6lu %04X  %-20s AF=%04X HL=%04X SP=%04X\n",
+            (unsigned long)entry->tstates, entry->pc, buffer, entry->af,
+            entry->hl, entry->sp );
+  }
+
+  return 0;
+}
+
+int
+debugger_trace_write( const char *filename )
+{
+  libspectrum_byte *buffer, *ptr;
+  size_t count, first, i;
+  const trace_entry *entry;
+  int error;
+
+  if( !trace ) {
+    ui_error( UI_ERROR_ERROR, "no instruction trace; see --trace-length" );
+    return 1;
+  }
+
+  if( !filename ) filename = settings_current.trace_file;
+  if( !filename ) {
+    ui_error( UI_ERROR_ERROR, "no trace file; see --trace-file" );
+    return 1;
+  }
+
+  count = trace_count( &first );
+
+  buffer = libspectrum_new( libspectrum_byte,
+                            12 + count * TRACE_ENTRY_LENGTH );
+  ptr = buffer;
+
+  memcpy( ptr, "FTRC", 4 ); ptr += 4;
+  libspectrum_write_dword( &ptr, TRACE_VERSION );
+  libspectrum_write_dword( &ptr, count );
+
+  for( i = 0; i < count; i++ ) {
+    entry = &trace[ ( first + i ) & trace_mask ];
+    libspectrum_write_dword( &ptr, entry->tstates );
+    libspectrum_write_word( &ptr, entry->pc );
+    libspectrum_write_word( &ptr, entry->sp );
+    libspectrum_write_word( &ptr, entry->af );
+    libspectrum_write_word( &ptr, entry->hl );
+    memcpy( ptr, entry->bytes, sizeof( entry->bytes ) ); ptr += 4;
+  }
+
+  error = utils_write_file( filename, buffer, ptr - buffer );
+
+  libspectrum_free( buffer );
+
+  return error;
+}
+
+void
+debugger_trace_end( void )
+{
+  if( trace && settings_current.trace_file ) debugger_trace_write( NULL );
+
+  debugger_trace_active = 0;
+  libspectrum_free( trace );
+  trace = NULL;
+}
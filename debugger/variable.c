@@ -36,13 +36,17 @@
 #include "ui/ui.h"
 #include "utils.h"
 
+/* Each variable's value lives in its own heap-allocated slot which
+   stays put for the lifetime of the debugger, so compiled expressions
+   can read it directly rather than looking it up by name */
 static GHashTable *debugger_variables;
 
 void
 debugger_variable_init( void )
 {
   debugger_variables = g_hash_table_new_full( g_str_hash, g_str_equal,
-                                              libspectrum_free, NULL );
+                                              libspectrum_free,
+                                              libspectrum_free );
 }
 
 void
@@ -52,17 +56,30 @@ debugger_variable_end( void )
   debugger_variables = NULL;
 }
 
+libspectrum_dword*
+debugger_variable_slot( const char *name )
+{
+  libspectrum_dword *slot = g_hash_table_lookup( debugger_variables, name );
+
+  if( !slot ) {
+    slot = libspectrum_new( libspectrum_dword, 1 );
+    *slot = 0;
+    g_hash_table_insert( debugger_variables, utils_safe_strdup( name ), slot );
+  }
+
+  return slot;
+}
+
 void
 debugger_variable_set( const char *name, libspectrum_dword value )
 {
-  g_hash_table_insert( debugger_variables, utils_safe_strdup( name ),
-                       GINT_TO_POINTER(value) );
+  *debugger_variable_slot( name ) = value;
 }
 
 libspectrum_dword
 debugger_variable_get( const char *name )
 {
-  gpointer v = g_hash_table_lookup( debugger_variables, name );
+  libspectrum_dword *slot = g_hash_table_lookup( debugger_variables, name );
 
-  return v ? GPOINTER_TO_INT(v) : 0;
+  return slot ? *slot : 0;
 }
@@ -30,15 +30,24 @@
 #include <string.h>
 
 #include "display.h"
+#include "export.h"
+#include "frametime.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "module.h"
 #include "movie.h"
 #include "peripherals/scld.h"
+#include "phantom_typist.h"
 #include "rectangle.h"
+#include "runahead.h"
+#include "rzx.h"
 #include "screenshot.h"
 #include "settings.h"
+#include "shmexport.h"
 #include "spectrum.h"
+#include "tape.h"
+#include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/uidisplay.h"
 
@@ -83,6 +92,10 @@ static libspectrum_word
 static int display_frame_count;
 static int display_flash_reversed;
 
+/* The colours of the two pixels given by each byte in the Pentagon's 16
+   colour mode */
+static libspectrum_byte pentagon_16c_colours[ 256 ][ 2 ];
+
 /* Which eight-pixel chunks on each line (including border) need to
    be redisplayed. Bit 0 corresponds to pixels 0-7, bit 39 to
    pixels 311-319. */
@@ -92,12 +105,83 @@ static libspectrum_qword display_is_dirty[ DISPLAY_SCREEN_HEIGHT ];
    corresponds to pixels 0-7, bit 31 to pixels 248-255. */
 static libspectrum_dword display_maybe_dirty[ DISPLAY_HEIGHT ];
 
+/* The line the beam was last found on, and the tstates at which it
+   starts; beam_line_length is zero if there isn't one */
+static int beam_line;
+static libspectrum_dword beam_line_start, beam_line_length;
+
+/* The number of the lowest set bit in `mask', which mustn't be zero */
+static inline int
+lowest_bit( libspectrum_qword mask )
+{
+#ifdef __GNUC__
+  return __builtin_ctzll( mask );
+#else				/* #ifdef __GNUC__ */
+  int bit = 0;
+
+  while( !( mask & 0x01 ) ) {
+    mask >>= 1;
+    bit++;
+  }
+
+  return bit;
+#endif				/* #ifdef __GNUC__ */
+}
+
 /* This value signifies that the entire line must be redisplayed */
 static libspectrum_qword display_all_dirty;
 
 /* Used to signify that we're redrawing the entire screen */
 static int display_redraw_all;
 
+/* The part of the screen the UI shows: the chunks in viewport_columns on
+   lines viewport_top to viewport_bottom - 1. Border outside it is still
+   recorded in display_last_screen, but isn't drawn */
+static libspectrum_qword viewport_columns =
+  ( (libspectrum_qword)1 << DISPLAY_SCREEN_WIDTH_COLS ) - 1;
+static int viewport_left = 0, viewport_right = DISPLAY_SCREEN_WIDTH_COLS;
+static int viewport_top = 0, viewport_bottom = DISPLAY_SCREEN_HEIGHT;
+
+/* The chunks on line `y' which are drawn; a movie gets everything */
+static inline libspectrum_qword
+viewport_mask( int y )
+{
+  if( movie_recording ) return display_all_dirty;
+
+  return y >= viewport_top && y < viewport_bottom ? viewport_columns : 0;
+}
+
+/* When interlacing, only the lines of one field, the even ones or the
+   odd ones, are drawn each frame; the other field's changes wait until
+   the next frame which is drawn */
+static int display_interlace = 0;
+static int display_field = 0;
+
+static inline int
+line_deferred( int y )
+{
+  /* An export needs every line of every frame */
+  return display_interlace && !export_active && ( y & 1 ) != display_field;
+}
+
+/* The cells on each line whose attribute has FLASH set, so flash changes
+   needn't scan the whole attribute area. A write to a line's attributes
+   just marks the line stale; stale lines are looked at again when the
+   flash next changes, by which time the write has happened */
+static libspectrum_dword display_flash_cells[ DISPLAY_HEIGHT ];
+static libspectrum_byte display_flash_stale[ DISPLAY_HEIGHT ];
+static int display_flash_any_stale = 1;
+
+/* How many lines have any FLASH cells */
+static int display_flash_lines = 0;
+
+static inline void
+flash_mark_stale( int y )
+{
+  display_flash_stale[y] = 1;
+  display_flash_any_stale = 1;
+}
+
 /* The last point at which we updated the screen display */
 int critical_region_x = 0, critical_region_y = 0;
 
@@ -122,16 +206,20 @@ static void display_dirty64( libspectrum_word address );
 static void display_get_attr( int x, int y,
 			      libspectrum_byte *ink, libspectrum_byte *paper);
 
+static void discard_border_changes( void );
+
 static int border_changes_last = 0;
 static struct border_change_t *border_changes = NULL;
 
+/* The list is kept from one frame to the next, and grows by doubling, so
+   after the first busy frame adding a change never needs to allocate */
+static int border_changes_size = 0;
+
 static struct border_change_t *
 alloc_change(void)
 {
-  static int border_changes_size = 0;
-
   if( border_changes_size == border_changes_last ) {
-    border_changes_size += 10;
+    border_changes_size = border_changes_size ? 2 * border_changes_size : 64;
     border_changes = libspectrum_renew( struct border_change_t,
                                         border_changes, border_changes_size );
   }
@@ -150,6 +238,63 @@ add_border_sentinel( void )
   return 0;
 }
 
+/* The emulated parts of the display, as kept in an in-memory state */
+typedef struct display_state_t {
+  libspectrum_byte lores_border, hires_border, last_border;
+  int frame_count, flash_reversed;
+  int critical_region_x, critical_region_y;
+} display_state_t;
+
+static void
+display_state_to( module_state_t *state )
+{
+  display_state_t display;
+
+  display.lores_border = display_lores_border;
+  display.hires_border = display_hires_border;
+  display.last_border = display_last_border;
+  display.frame_count = display_frame_count;
+  display.flash_reversed = display_flash_reversed;
+  display.critical_region_x = critical_region_x;
+  display.critical_region_y = critical_region_y;
+
+  module_state_write( state, &display, sizeof( display ) );
+}
+
+/* What is on screen is still whatever was drawn last, so check every
+   chunk against the restored memory on its next pass, and start the
+   border afresh */
+static void
+display_state_from( module_state_t *state )
+{
+  display_state_t display;
+
+  module_state_read( state, &display, sizeof( display ) );
+
+  display_lores_border = display.lores_border;
+  display_hires_border = display.hires_border;
+  display_last_border = display.last_border;
+  display_frame_count = display.frame_count;
+  display_flash_reversed = display.flash_reversed;
+  critical_region_x = display.critical_region_x;
+  critical_region_y = display.critical_region_y;
+
+  discard_border_changes();
+  display_refresh_main_screen();
+}
+
+static module_info_t display_module_info = {
+
+  /* .reset = */ NULL,
+  /* .romcs = */ NULL,
+  /* .snapshot_enabled = */ NULL,
+  /* .snapshot_from = */ NULL,
+  /* .snapshot_to = */ NULL,
+  /* .state_to = */ display_state_to,
+  /* .state_from = */ display_state_from,
+
+};
+
 int
 display_init( int *argc, char ***argv )
 {
@@ -186,6 +331,11 @@ display_init( int *argc, char ***argv )
       display_dirty_xtable2[ (32*y) + x ] = x;
     }
 
+  for( i = 0; i < 256; i++ ) {
+    pentagon_16c_colours[i][0] = ( i & 0x07 ) + ( ( i & 0x40 ) >> 3 );
+    pentagon_16c_colours[i][1] = ( ( i & 0x38 ) >> 3 ) + ( ( i & 0x80 ) >> 4 );
+  }
+
   display_frame_count=0; display_flash_reversed=0;
 
   display_refresh_all();
@@ -194,11 +344,13 @@ display_init( int *argc, char ***argv )
   if( border_changes ) {
     libspectrum_free( border_changes );
   }
-  border_changes = NULL;
+  border_changes = NULL; border_changes_size = 0;
   error = add_border_sentinel(); if( error ) return error;
   display_last_border = scld_last_dec.name.hires ?
                             display_hires_border : display_lores_border;
 
+  module_register( &display_module_info );
+
   return 0;
 }
 
@@ -253,7 +405,10 @@ display_dirty_timex( libspectrum_word offset )
     case HIRES: /* hires mode */
       if( offset >= 0x3800 ) break;
       if( offset >= 0x1800 && offset < 0x2000 ) break;
-      if( offset >= 0x2000 ) offset -= ALTDFILE_OFFSET;
+      if( offset >= 0x2000 ) {
+        offset -= ALTDFILE_OFFSET;
+        flash_mark_stale( display_dirty_ytable[ offset ] );
+      }
       display_dirty8( offset );
       break;
 
@@ -262,8 +417,10 @@ display_dirty_timex( libspectrum_word offset )
        taken from second screen */
     /* case HIRESDOUBLECOL: hires mode, but data taken only from
        second screen */
-      if( offset >= 0x2000 && offset < 0x3800 )
+      if( offset >= 0x2000 && offset < 0x3800 ) {
+        flash_mark_stale( display_dirty_ytable[ offset - ALTDFILE_OFFSET ] );
 	display_dirty8( offset - ALTDFILE_OFFSET );
+      }
       break;
   }
 }
@@ -318,32 +475,63 @@ display_get_attr_byte( int x, int y )
   return attr;
 }
 
+/* How the render mode setting asks for frames to be drawn */
+display_render_mode_t
+display_render_mode( void )
+{
+  const char *mode = settings_current.od_render_mode;
+
+  if( !mode ) return DISPLAY_RENDER_FULL;
+
+  if( !strcmp( mode, "Interlaced" ) ) return DISPLAY_RENDER_INTERLACED;
+  if( !strcmp( mode, "Half rate" ) ) return DISPLAY_RENDER_HALF_RATE;
+
+  return DISPLAY_RENDER_FULL;
+}
+
 static void
 update_dirty_rects( void )
 {
-  int start, y;
+  int start, length, y;
+
+  if( settings_current.bitmap_damage ) {
+    for( y=0; y<DISPLAY_SCREEN_HEIGHT; y++ ) {
+      if( line_deferred( y ) ) continue;
+      rectangle_add_line( y, display_is_dirty[y] & viewport_mask( y ) );
+      display_is_dirty[y] = 0;
+    }
+    return;
+  }
 
   for( y=0; y<DISPLAY_SCREEN_HEIGHT; y++ ) {
+    libspectrum_qword dirty;
     int x = 0;
-    while( display_is_dirty[y] ) {
 
-      /* Find the first dirty chunk on this row */
-      while( !( display_is_dirty[y] & 0x01 ) ) {
-        display_is_dirty[y] >>= 1;
-        x++;
-      }
+    /* Lines of the other field keep their changes until next frame */
+    if( line_deferred( y ) ) {
+      rectangle_end_line( y );
+      continue;
+    }
 
-      start = x;
+    dirty = display_is_dirty[y] & viewport_mask( y );
 
-      /* Walk to the end of the dirty region */
-      do {
-        display_is_dirty[y] >>= 1;
-        x++;
-      } while( display_is_dirty[y] & 0x01 );
+    while( dirty ) {
 
-      rectangle_add( y, start, x - start );
+      /* Skip to the first dirty chunk on this row, and find the length
+         of the run of dirty chunks starting there; a row has fewer than
+         64 chunks, so there's always a clean bit after the run */
+      start = lowest_bit( dirty );
+      dirty >>= start; x += start;
+
+      length = lowest_bit( ~dirty );
+      dirty >>= length;
+
+      rectangle_add( y, x, length );
+      x += length;
     }
 
+    display_is_dirty[y] = 0;
+
     /* compress the active rectangles list */
     rectangle_end_line( y );
   }
@@ -424,8 +612,8 @@ static inline void
 pentagon_16c_get_colour( libspectrum_byte data, libspectrum_byte *colour1,
                          libspectrum_byte *colour2 )
 {
-  *colour1 = (data & 0x07) + ( (data & 0x40) >> 3 );
-  *colour2 = ( (data & 0x38) >> 3 ) + ( (data & 0x80) >> 4 );
+  *colour1 = pentagon_16c_colours[ data ][0];
+  *colour2 = pentagon_16c_colours[ data ][1];
 }
 
 /* In this mode we need to gather the pixel information for the 8 pixels to
@@ -536,6 +724,136 @@ display_write_if_dirty_sinclair( int x, int y )
   }
 }
 
+/* As display_write_if_dirty_sinclair(), but for all the chunks on line y
+   whose bits are set in `dirty', bit 0 being chunk 0. The whole row of
+   32 bytes of data and attributes is compared against the last screen
+   in one pass, which the compiler can do with wide loads and compares,
+   and only the chunks which changed are then written */
+static void
+display_write_line_if_dirty_sinclair( int y, libspectrum_dword dirty )
+{
+  int beam_y = y + DISPLAY_BORDER_HEIGHT;
+  int index = DISPLAY_BORDER_WIDTH_COLS + beam_y * DISPLAY_SCREEN_WIDTH_COLS;
+  libspectrum_byte *screen = RAM[ memory_current_screen ];
+  const libspectrum_byte *data, *attr;
+  libspectrum_dword *last = &display_last_screen[ index ];
+  libspectrum_dword flash = (libspectrum_dword)display_flash_reversed << 24;
+  libspectrum_dword detail[ DISPLAY_WIDTH_COLS ];
+  libspectrum_byte changed[ DISPLAY_WIDTH_COLS ];
+  libspectrum_dword changed_mask = 0;
+  int x;
+
+  data = screen + ( display_get_addr( 0, y ) );
+
+  if( scld_last_dec.name.b1 ) {
+    attr = screen + display_line_start[y] + ALTDFILE_OFFSET;
+  } else if( scld_last_dec.name.altdfile ) {
+    attr = screen + display_attr_start[y] + ALTDFILE_OFFSET;
+  } else {
+    attr = screen + display_attr_start[y];
+  }
+
+  for( x = 0; x < DISPLAY_WIDTH_COLS; x++ ) {
+    detail[x] = flash | ( attr[x] << 8 ) | data[x];
+    changed[x] = last[x] != detail[x];
+  }
+
+  for( x = 0; x < DISPLAY_WIDTH_COLS; x++ )
+    changed_mask |= (libspectrum_dword)changed[x] << x;
+
+  changed_mask &= dirty;
+
+  for( ; changed_mask; changed_mask &= changed_mask - 1 ) {
+    libspectrum_byte ink, paper;
+
+    x = lowest_bit( changed_mask );
+
+    display_parse_attr( attr[x], &ink, &paper );
+    uidisplay_plot8( x + DISPLAY_BORDER_WIDTH_COLS, beam_y, data[x], ink,
+                     paper );
+
+    last[x] = detail[x];
+    display_is_dirty[ beam_y ] |=
+      (libspectrum_qword)1 << ( x + DISPLAY_BORDER_WIDTH_COLS );
+  }
+}
+
+/* The same for the Timex machines' screens. The screen mode can't change
+   part way through a row, so where the second byte of each chunk comes
+   from, and for hi-res the colours, are worked out once for the row, and
+   the mode goes into every chunk's record just as
+   display_write_if_dirty_timex() puts it there */
+static void
+display_write_line_if_dirty_timex( int y, libspectrum_dword dirty )
+{
+  int beam_y = y + DISPLAY_BORDER_HEIGHT;
+  int index = DISPLAY_BORDER_WIDTH_COLS + beam_y * DISPLAY_SCREEN_WIDTH_COLS;
+  libspectrum_byte *screen = RAM[ memory_current_screen ];
+  const libspectrum_byte *data, *data2;
+  libspectrum_dword *last = &display_last_screen[ index ];
+  libspectrum_dword mode = ( (libspectrum_dword)display_flash_reversed << 24 ) |
+                           ( (libspectrum_dword)scld_last_dec.byte << 16 );
+  libspectrum_dword detail[ DISPLAY_WIDTH_COLS ];
+  libspectrum_byte changed[ DISPLAY_WIDTH_COLS ];
+  libspectrum_dword changed_mask = 0;
+  libspectrum_byte ink = 0, paper = 0;
+  int hires = scld_last_dec.name.hires;
+  int x;
+
+  data = screen + ( display_get_addr( 0, y ) );
+
+  if( hires ) {
+    switch( scld_last_dec.mask.scrnmode ) {
+    case HIRESATTRALTD:
+      data2 = screen + display_attr_start[y] + ALTDFILE_OFFSET;
+      break;
+    case HIRES:
+      data2 = data + ALTDFILE_OFFSET;
+      break;
+    case HIRESDOUBLECOL:
+      data2 = data;
+      break;
+    default: /* case HIRESATTR: */
+      data2 = screen + display_attr_start[y];
+      break;
+    }
+    display_parse_attr( hires_get_attr(), &ink, &paper );
+  } else if( scld_last_dec.name.b1 ) {
+    data2 = screen + display_line_start[y] + ALTDFILE_OFFSET;
+  } else if( scld_last_dec.name.altdfile ) {
+    data2 = screen + display_attr_start[y] + ALTDFILE_OFFSET;
+  } else {
+    data2 = screen + display_attr_start[y];
+  }
+
+  for( x = 0; x < DISPLAY_WIDTH_COLS; x++ ) {
+    detail[x] = mode | ( data2[x] << 8 ) | data[x];
+    changed[x] = last[x] != detail[x];
+  }
+
+  for( x = 0; x < DISPLAY_WIDTH_COLS; x++ )
+    changed_mask |= (libspectrum_dword)changed[x] << x;
+
+  changed_mask &= dirty;
+
+  for( ; changed_mask; changed_mask &= changed_mask - 1 ) {
+    x = lowest_bit( changed_mask );
+
+    if( hires ) {
+      uidisplay_plot16( x + DISPLAY_BORDER_WIDTH_COLS, beam_y,
+                        ( data[x] << 8 ) | data2[x], ink, paper );
+    } else {
+      display_parse_attr( data2[x], &ink, &paper );
+      uidisplay_plot8( x + DISPLAY_BORDER_WIDTH_COLS, beam_y, data[x], ink,
+                       paper );
+    }
+
+    last[x] = detail[x];
+    display_is_dirty[ beam_y ] |=
+      (libspectrum_qword)1 << ( x + DISPLAY_BORDER_WIDTH_COLS );
+  }
+}
+
 /* Plot any dirty data from ( x, y ) to ( end, y ) of the critical
    region to the drawing region */
 static void
@@ -543,6 +861,9 @@ copy_critical_region_line( int y, int x, int end )
 {
   libspectrum_dword bit_mask, dirty;
 
+  /* Leave the changes to be drawn with the other field */
+  if( line_deferred( y + DISPLAY_BORDER_HEIGHT ) ) return;
+
   if( x < DISPLAY_WIDTH_COLS ) {
 
     /* Build a mask for the bits we're interested in */
@@ -564,29 +885,21 @@ copy_critical_region_line( int y, int x, int end )
 
   }
 
-  while( dirty ) {
-
-    /* Find the first dirty chunk on this row */
-    while( !( dirty & 0x01 ) ) {
-
-      dirty >>= 1;
-      x++;
-
-    }
-
-    /* Walk to the end of the dirty region, writing the bytes to the
-       drawing area along the way */
-    do {
-
-      display_write_if_dirty( x, y );
-
-      dirty >>= 1;
-      x++;
-
-    } while( dirty & 0x01 );
+  /* Ordinary and Timex screens can be done a whole row at a time; the
+     Pentagon's 16 colour mode goes a chunk at a time */
+  if( dirty && display_write_if_dirty == display_write_if_dirty_sinclair &&
+      !scld_last_dec.name.hires ) {
+    display_write_line_if_dirty_sinclair( y, dirty << x );
+    return;
+  }
 
+  if( dirty && display_write_if_dirty == display_write_if_dirty_timex ) {
+    display_write_line_if_dirty_timex( y, dirty << x );
+    return;
   }
-  
+
+  for( ; dirty; dirty &= dirty - 1 )
+    display_write_if_dirty( x + lowest_bit( dirty ), y );
 }
 
 /* Copy any dirty data from the critical region to the drawing region */
@@ -615,6 +928,14 @@ copy_critical_region( int beam_x, int beam_y )
 static inline void
 get_beam_position( int *x, int *y )
 {
+  /* Most writes to the screen come in bursts on the same line, so the
+     line only needs working out once for each of them */
+  if( tstates - beam_line_start < beam_line_length ) {
+    *y = beam_line;
+    *x = ( tstates - beam_line_start ) / 4;
+    return;
+  }
+
   if( tstates < machine_current->line_times[ 0 ] ) {
     *x = *y = -1;
     return;
@@ -623,9 +944,15 @@ get_beam_position( int *x, int *y )
   *y = ( tstates - machine_current->line_times[ 0 ] ) /
     machine_current->timings.tstates_per_line;
 
-  if( *y >= 0 && *y <= DISPLAY_SCREEN_HEIGHT )
+  if( *y >= 0 && *y <= DISPLAY_SCREEN_HEIGHT ) {
     *x = ( tstates - machine_current->line_times[ *y ] ) / 4;
-  else *x = 0;
+
+    beam_line = *y;
+    beam_line_start = machine_current->line_times[ *y ];
+    beam_line_length = machine_current->timings.tstates_per_line;
+  } else {
+    *x = 0;
+  }
 }
 
 void
@@ -656,6 +983,29 @@ display_update_critical( int x, int y )
     copy_critical_region( beam_x, beam_y );
 }
 
+/* Mark the 8-pixel chunks on line y whose bits are set in `mask' as maybe
+   dirty, updating the critical region as display_dirty_chunk() would for
+   each of them. Only the leftmost chunk matters: if it is before the
+   beam, copying the critical region moves that up to the beam, and all
+   the other chunks are then outside it */
+static void
+display_dirty_chunks( int y, libspectrum_dword mask )
+{
+  int x;
+
+  if( !mask ) return;
+
+  x = lowest_bit( mask );
+
+  if(   y >  critical_region_y                             ||
+      ( y == critical_region_y && x >= critical_region_x )    ) {
+
+    display_update_critical( x, y );
+  }
+
+  display_maybe_dirty[y] |= mask;
+}
+
 /* Mark the 8-pixel chunk at (x,y) as maybe dirty and update the critical
    region as appropriate */
 static inline void
@@ -691,7 +1041,10 @@ display_dirty64( libspectrum_word offset )
   x=display_dirty_xtable2[ offset - 0x1800 ];
   y=display_dirty_ytable2[ offset - 0x1800 ];
 
-  for( i = 0; i < 8; i++ ) display_dirty_chunk( x, y + i );
+  for( i = 0; i < 8; i++ ) {
+    display_dirty_chunk( x, y + i );
+    flash_mark_stale( y + i );
+  }
 }
 
 /* Get the attributes for the eight pixels starting at
@@ -730,6 +1083,20 @@ push_border_change( int colour )
   if( beam_x > DISPLAY_SCREEN_WIDTH_COLS ) beam_x = DISPLAY_SCREEN_WIDTH_COLS;
   if( beam_y < 0 ) beam_y = 0;
 
+  /* Only the last of several changes at the same point is ever seen; this
+     is what happens to every change made while the beam is off the edge
+     of the screen. The first entry is the colour at the start of the
+     frame, so is never removed */
+  change = &border_changes[ border_changes_last - 1 ];
+  if( change->x == beam_x && change->y == beam_y ) {
+    if( border_changes_last > 1 && change[-1].colour == colour ) {
+      border_changes_last--;
+    } else {
+      change->colour = colour;
+    }
+    return;
+  }
+
   change = alloc_change();
 
   change->x = beam_x;
@@ -775,18 +1142,21 @@ set_border( int y, int start, int end, int colour )
 {
   libspectrum_dword chunk_detail = colour << 11;
   int index = start + y * DISPLAY_SCREEN_WIDTH_COLS;
+  libspectrum_qword visible = viewport_mask( y );
 
   for( ; start < end; start++ ) {
     /* Draw it if it is different to what was there last time - we know that
     data and mode will have been the same */
     if( display_last_screen[ index ] != chunk_detail ) {
-      uidisplay_plot8( start, y, 0x00, 0, colour );
 
       /* Update last display record */
       display_last_screen[ index ] = chunk_detail;
 
-      /* And now mark it dirty */
-      display_is_dirty[y] |= ( (libspectrum_qword)1 << start );
+      /* Draw it and mark it dirty, unless it won't be seen */
+      if( visible & ( (libspectrum_qword)1 << start ) ) {
+        uidisplay_plot8( start, y, 0x00, 0, colour );
+        display_is_dirty[y] |= ( (libspectrum_qword)1 << start );
+      }
     }
     index++;
   }
@@ -795,6 +1165,10 @@ set_border( int y, int start, int end, int colour )
 static void
 border_change_write( int y, int start, int end, int colour )
 {
+  /* The whole border is looked at every frame, so the other field's
+     lines will be done next time */
+  if( line_deferred( y ) ) return;
+
   if(   y <  DISPLAY_BORDER_HEIGHT                    ||
       ( y >= DISPLAY_BORDER_HEIGHT + DISPLAY_HEIGHT )    ) {
 
@@ -883,58 +1257,156 @@ update_border( void )
   error = add_border_sentinel(); if( error ) return;
 }
 
+/* Forget the border colour changes in a frame which isn't being drawn.
+   The changes in the next frame which is drawn cover the whole border,
+   so nothing is lost */
+static void
+discard_border_changes( void )
+{
+  border_changes_last = 0;
+
+  add_border_sentinel();
+}
+
+/* Look at the emulation speed once a second, and don't drop the amount of
+   automatic frame skip until we've kept up for a while */
+#define AUTO_FRAMESKIP_PERIOD 50
+#define AUTO_FRAMESKIP_SETTLE 10
+#define AUTO_FRAMESKIP_MAX 4
+
+/* How many frames in a row automatic frame skip is currently dropping */
+static int auto_frameskip = 0;
+
+static void
+update_auto_frameskip( void )
+{
+  static int frames = 0, settled = 0;
+
+  if( ++frames < AUTO_FRAMESKIP_PERIOD ) return;
+  frames = 0;
+
+  if( settings_current.emulation_speed >= 1 &&
+      current_speed < settings_current.emulation_speed * 0.95 ) {
+    if( auto_frameskip < AUTO_FRAMESKIP_MAX ) auto_frameskip++;
+    settled = 0;
+  } else if( auto_frameskip && ++settled >= AUTO_FRAMESKIP_SETTLE ) {
+    auto_frameskip--;
+    settled = 0;
+  }
+}
+
+/* Should this frame be emulated without being drawn? With a frame rate
+   of 1:n, only every nth frame is drawn; turbo mode has its own rate,
+   and automatic frame skip drops more frames if we're not keeping up */
+static int
+skip_frame( void )
+{
+  static int frame_count = 0;
+  int skip = settings_current.frame_rate - 1;
+
+  /* Nothing to see while we run through an RZX file to get somewhere,
+     while a tape block is flash loaded or while the phantom typist is
+     typing */
+  if( rzx_seeking || tape_flash_loading() || phantom_typist_hides_frames() )
+    return 1;
+
+  if( timer_turbo && settings_current.turbo_frame_rate - 1 > skip )
+    skip = settings_current.turbo_frame_rate - 1;
+
+  /* Half rate draws every other frame, whatever the frame rate */
+  if( display_render_mode() == DISPLAY_RENDER_HALF_RATE && skip < 1 )
+    skip = 1;
+
+  /* Movies record a fixed frame rate */
+  if( settings_current.auto_frameskip && !movie_recording ) {
+    update_auto_frameskip();
+    if( auto_frameskip > skip ) skip = auto_frameskip;
+  } else {
+    auto_frameskip = 0;
+  }
+
+  if( frame_count < skip ) {
+    frame_count++;
+    return 1;
+  }
+
+  frame_count = 0;
+  return 0;
+}
+
 /* Send the updated screen to the UI-specific code */
 static void
 update_ui_screen( void )
 {
-  static int frame_count = 0;
   int scale = machine_current->timex ? 2 : 1;
   size_t i;
   struct rectangle *ptr;
 
-  if( settings_current.frame_rate <= ++frame_count ) {
-    frame_count = 0;
+  if( movie_recording ) {
+    movie_start_frame();
+  }
+
+  /* Turn everything changed since the last frame shown into rectangles */
+  if( settings_current.bitmap_damage ) rectangle_coalesce();
+
+  if( display_redraw_all ) {
     if( movie_recording ) {
-      movie_start_frame();
+      movie_add_area( 0, 0, DISPLAY_ASPECT_WIDTH >> 3,
+                      DISPLAY_SCREEN_HEIGHT );
     }
-
-    if( display_redraw_all ) {
-      if( movie_recording ) {
-        movie_add_area( 0, 0, DISPLAY_ASPECT_WIDTH >> 3,
-                        DISPLAY_SCREEN_HEIGHT );
-      }
-      uidisplay_area( 0, 0,
-                      scale * DISPLAY_ASPECT_WIDTH,
-                      scale * DISPLAY_SCREEN_HEIGHT );
-      display_redraw_all = 0;
-    } else {
-      for( i = 0, ptr = rectangle_inactive;
-           i < rectangle_inactive_count;
-           i++, ptr++ ) {
-            if( movie_recording ) {
-              movie_add_area( ptr->x, ptr->y, ptr->w, ptr->h );
-            }
-              uidisplay_area( 8 * scale * ptr->x, scale * ptr->y,
-                        8 * scale * ptr->w, scale * ptr->h );
-      }
+    uidisplay_area( 8 * scale * viewport_left, scale * viewport_top,
+                    8 * scale * ( viewport_right - viewport_left ),
+                    scale * ( viewport_bottom - viewport_top ) );
+    display_redraw_all = 0;
+  } else {
+    for( i = 0, ptr = rectangle_inactive;
+         i < rectangle_inactive_count;
+         i++, ptr++ ) {
+          if( movie_recording ) {
+            movie_add_area( ptr->x, ptr->y, ptr->w, ptr->h );
+          }
+            uidisplay_area( 8 * scale * ptr->x, scale * ptr->y,
+                      8 * scale * ptr->w, scale * ptr->h );
     }
+  }
 
-    rectangle_inactive_count = 0;
+  rectangle_inactive_count = 0;
 
-    uidisplay_frame_end();
-  }
+  if( shmexport_active ) shmexport_frame();
+
+  FRAMETIME_ENTER( FRAMETIME_PROBE_UIDISPLAY );
+  uidisplay_frame_end();
+  FRAMETIME_LEAVE();
 }
 
 int
 display_frame( void )
 {
+  FRAMETIME_ENTER( FRAMETIME_PROBE_DISPLAY );
+
   /* Copy all the critical region to the display */
   copy_critical_region( DISPLAY_WIDTH_COLS, DISPLAY_HEIGHT - 1 );
   critical_region_x = critical_region_y = 0;
 
-  update_border();
-  update_dirty_rects();
-  update_ui_screen();
+  /* The timings may be different next frame */
+  beam_line_length = 0;
+
+  /* On a skipped frame, leave what has changed marked as dirty for the
+     next frame which is drawn. When running ahead, only the last frame
+     run ahead is drawn */
+  if( runahead_hides_frame() || skip_frame() ) {
+    discard_border_changes();
+  } else {
+    update_border();
+    update_dirty_rects();
+    update_ui_screen();
+
+    /* Draw the other field next time; a movie needs every line of every
+       frame */
+    display_interlace =
+      display_render_mode() == DISPLAY_RENDER_INTERLACED && !movie_recording;
+    display_field ^= 1;
+  }
 
   display_frame_count++;
   if(display_frame_count==16) {
@@ -945,39 +1417,61 @@ display_frame( void )
     display_dirty_flashing();
     display_frame_count=0;
   }
+
+  FRAMETIME_LEAVE();
   
   return 0;
 }
 
 display_dirty_flashing_fn display_dirty_flashing;
 
-void
-display_dirty_flashing_timex(void)
+/* Bring display_flash_cells up to date for the stale lines, whose
+   attributes start at `attr_start[y]' + `base' in the current screen,
+   then dirty every FLASH cell */
+static void
+display_dirty_flashing_cells( const libspectrum_word *attr_start,
+                              libspectrum_word base )
 {
-  libspectrum_word offset;
-  libspectrum_byte *screen, attr;
+  libspectrum_byte *screen = RAM[ memory_current_screen ];
+  int x, y;
 
-  screen = RAM[ memory_current_screen ];
-  
-  if( !scld_last_dec.name.hires ) {
-    if( scld_last_dec.name.b1 ) {
+  if( display_flash_any_stale ) {
 
-      for( offset = ALTDFILE_OFFSET; offset < 0x3800; offset++ ) {
-        attr = screen[ offset ];
-        if( attr & 0x80 ) display_dirty8( offset - ALTDFILE_OFFSET );
-      }
+    for( y = 0; y < DISPLAY_HEIGHT; y++ ) {
+      const libspectrum_byte *attr;
+      libspectrum_dword mask = 0;
 
-    } else if( scld_last_dec.name.altdfile ) {
+      if( !display_flash_stale[y] ) continue;
+      display_flash_stale[y] = 0;
 
-      for( offset= 0x3800; offset < 0x3b00; offset++ ) {
-        attr = screen[ offset ];
-        if( attr & 0x80 ) display_dirty64( offset - ALTDFILE_OFFSET );
-      }
+      attr = screen + attr_start[y] + base;
+      for( x = 0; x < DISPLAY_WIDTH_COLS; x++ )
+        mask |= (libspectrum_dword)( attr[x] >> 7 ) << x;
 
-    } else { /* Standard Speccy screen */
+      if( !mask != !display_flash_cells[y] )
+        display_flash_lines += mask ? 1 : -1;
+      display_flash_cells[y] = mask;
+    }
 
-      display_dirty_flashing_sinclair();
+    display_flash_any_stale = 0;
+  }
 
+  if( !display_flash_lines ) return;
+
+  for( y = 0; y < DISPLAY_HEIGHT; y++ )
+    display_dirty_chunks( y, display_flash_cells[y] );
+}
+
+void
+display_dirty_flashing_timex(void)
+{
+  if( !scld_last_dec.name.hires ) {
+    if( scld_last_dec.name.b1 ) {
+      display_dirty_flashing_cells( display_line_start, ALTDFILE_OFFSET );
+    } else if( scld_last_dec.name.altdfile ) {
+      display_dirty_flashing_cells( display_attr_start, ALTDFILE_OFFSET );
+    } else { /* Standard Speccy screen */
+      display_dirty_flashing_sinclair();
     }
   }
 }
@@ -991,16 +1485,7 @@ display_dirty_flashing_pentagon_16_col(void)
 void
 display_dirty_flashing_sinclair(void)
 {
-  libspectrum_word offset;
-  libspectrum_byte *screen, attr;
-
-  screen = RAM[ memory_current_screen ];
-  
-  /* Standard Speccy screen */
-  for( offset = 0x1800; offset < 0x1b00; offset++ ) {
-    attr = screen[ offset ];
-    if( attr & 0x80 ) display_dirty64( offset );
-  }
+  display_dirty_flashing_cells( display_attr_start, 0 );
 }
 
 void display_refresh_main_screen(void)
@@ -1009,6 +1494,44 @@ void display_refresh_main_screen(void)
 
   for( i = 0; i < DISPLAY_HEIGHT; i++ )
     display_maybe_dirty[i] = display_all_dirty;
+
+  /* The screen may have been paged or its mode changed, so the FLASH
+     cells must be found again */
+  memset( display_flash_stale, 1, sizeof( display_flash_stale ) );
+  display_flash_any_stale = 1;
+}
+
+/* Tell the display which part of the screen the UI shows, in
+   DISPLAY_ASPECT_WIDTH by DISPLAY_SCREEN_HEIGHT units, so the border
+   outside it needn't be drawn */
+void
+display_set_viewport( int x, int y, int width, int height )
+{
+  int left, right, top, bottom, i;
+
+  if( x < 0 ) { width += x; x = 0; }
+  if( y < 0 ) { height += y; y = 0; }
+
+  left = x >> 3;
+  right = ( x + width + 7 ) >> 3;
+  if( right > DISPLAY_SCREEN_WIDTH_COLS ) right = DISPLAY_SCREEN_WIDTH_COLS;
+
+  top = y;
+  bottom = y + height;
+  if( bottom > DISPLAY_SCREEN_HEIGHT ) bottom = DISPLAY_SCREEN_HEIGHT;
+
+  if( left == viewport_left && right == viewport_right &&
+      top == viewport_top && bottom == viewport_bottom ) return;
+
+  viewport_left = left; viewport_right = right;
+  viewport_top = top; viewport_bottom = bottom;
+
+  viewport_columns = 0;
+  for( i = left; i < right; i++ )
+    viewport_columns |= (libspectrum_qword)1 << i;
+
+  /* What was hidden before hasn't been drawn */
+  display_refresh_all();
 }
 
 void display_refresh_all(void)
@@ -1016,6 +1539,7 @@ void display_refresh_all(void)
   size_t i;
 
   display_redraw_all = 1;
+  beam_line_length = 0;
 
   display_refresh_main_screen();
 
@@ -1099,6 +1623,35 @@ void od_restore_last_saved_display_rect( void ) {
 }
 #endif
 
+/* A 32-bit FNV-1a hash of display_last_screen. Which way round flashing
+   characters are is folded into their pixel data, so the hash changes only
+   when the picture does. This is only worked out when asked for, so costs
+   nothing otherwise */
+libspectrum_dword
+display_screen_hash( void )
+{
+  libspectrum_dword hash = 0x811c9dc5, chunk;
+  size_t i, j;
+  scld mode;
+
+  for( i = 0; i < DISPLAY_SCREEN_WIDTH_COLS * DISPLAY_SCREEN_HEIGHT; i++ ) {
+    chunk = display_last_screen[i];
+
+    if( chunk & ( 1 << 24 ) ) {
+      mode.byte = ( chunk >> 16 ) & 0xff;
+      if( !mode.name.hires && ( chunk & 0x8000 ) ) chunk ^= 0xff;
+      chunk &= ~( 1 << 24 );
+    }
+
+    for( j = 0; j < 4; j++, chunk >>= 8 ) {
+      hash ^= chunk & 0xff;
+      hash *= 0x01000193;
+    }
+  }
+
+  return hash;
+}
+
 /* Fetch pixel (x, y). On a Timex this will be a point on a 640x480 canvas,
    on a Sinclair/Amstrad/Russian clone this will be a point on a 320x240
    canvas */
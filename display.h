@@ -115,6 +115,20 @@ int display_dirty_border(void);
 int display_frame(void);
 void display_refresh_main_screen(void);
 void display_refresh_all(void);
+
+void display_set_viewport( int x, int y, int width, int height );
+
+/* Ways of drawing less on slow machines: every frame in full, alternate
+   lines on alternate frames, or every other frame in full. The
+   emulation, and so the sound, still runs every frame */
+typedef enum display_render_mode_t {
+  DISPLAY_RENDER_FULL,
+  DISPLAY_RENDER_INTERLACED,
+  DISPLAY_RENDER_HALF_RATE,
+} display_render_mode_t;
+
+display_render_mode_t display_render_mode( void );
+
 #if defined(VKEYBOARD) || defined(GCWZERO)
 void display_refresh_main_screen_rect( int x, int y, int w, int h );
 void display_refresh_rect( int x, int y, int w, int h, int save );
@@ -128,6 +142,9 @@ void od_restore_last_saved_display_rect( void );
   display_get_offset( (x), (y) )
 int display_getpixel( int x, int y );
 
+/* A hash of the screen as it was last drawn, border included */
+libspectrum_dword display_screen_hash( void );
+
 void display_update_critical( int x, int y );
 
 #endif			/* #ifndef FUSE_DISPLAY_H */
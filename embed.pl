@@ -0,0 +1,81 @@
+#!/usr/bin/perl -w
+
+# embed.pl: generate embedded.c, holding data files as C arrays
+# Copyright (c) 2026 Fuse contributors
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Author contact information:
+
+# E-mail: philip-fuse@shadowmagic.org.uk
+
+# Each argument is <name>=<file>; the file's contents become
+# embedded_<name>[], with its length in embedded_<name>_length. The
+# names must match those declared in embedded.h
+
+use strict;
+
+print << "CODE";
+/* embedded.c: data files compiled into Fuse
+   Copyright (c) 2026 Fuse contributors
+
+   This file is autogenerated from the files it holds by embed.pl.
+   Do not edit unless you know what you\'re doing!
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse\@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include "embedded.h"
+CODE
+
+foreach my $arg ( @ARGV ) {
+
+    my( $name, $file ) = split /=/, $arg, 2;
+    die "$0: bad argument `$arg'\n" unless defined $file && $name =~ /^\w+$/;
+
+    open my $fh, '<', $file or die "$0: couldn't open `$file': $!\n";
+    binmode $fh;
+    local $/;
+    my $data = <$fh>;
+    close $fh;
+
+    my @bytes = map { sprintf '0x%02x', $_ } unpack 'C*', $data;
+
+    print "\n/* $file */\nconst unsigned char embedded_$name\[] = {\n";
+    while( my @line = splice @bytes, 0, 12 ) {
+	print '  ', join( ', ', @line ), ",\n";
+    }
+    print "};\n\nconst size_t embedded_${name}_length = ", length( $data ),
+	";\n";
+}
@@ -0,0 +1,49 @@
+/* embedded.h: Data files compiled into Fuse
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_EMBEDDED_H
+#define FUSE_EMBEDDED_H
+
+#include <stdlib.h>
+
+/* Files which are needed every time Fuse starts, or which are small
+   enough not to be worth looking for, built into embedded.c by embed.pl
+   so they don't have to be found and read at run time */
+
+/* The status bar icons, as BMPs (lib/...) */
+extern const unsigned char embedded_cassette_bmp[];
+extern const size_t embedded_cassette_bmp_length;
+extern const unsigned char embedded_microdrive_bmp[];
+extern const size_t embedded_microdrive_bmp_length;
+extern const unsigned char embedded_plus3disk_bmp[];
+extern const size_t embedded_plus3disk_bmp_length;
+
+/* The keyboard picture, as a Spectrum screen (lib/keyboard.scr) */
+extern const unsigned char embedded_keyboard_scr[];
+extern const size_t embedded_keyboard_scr_length;
+
+/* The widget font, as made by mkfusefont.pl (ui/widget/fuse.font) */
+extern const unsigned char embedded_fuse_font[];
+extern const size_t embedded_fuse_font_length;
+
+#endif			/* #ifndef FUSE_EMBEDDED_H */
@@ -30,6 +30,7 @@
 #include "event.h"
 #include "infrastructure/startup_manager.h"
 #include "fuse.h"
+#include "module.h"
 #include "ui/ui.h"
 #include "utils.h"
 
@@ -39,15 +40,85 @@ static const libspectrum_dword event_no_events = 0xffffffff;
 /* When will the next event happen? */
 libspectrum_dword event_next_event;
 
-/* The actual list of events */
-static GSList *event_list = NULL;
-
-/* An event ready to be reused */
-static event_t *event_free = NULL;
+/* An entry in the event heap. The ordering key is copied out of the
+   event itself so that comparisons don't have to chase the pointer, and so
+   that events nulled out in place (by event_cancel() and friends, or
+   via event_foreach()) don't upset the heap ordering. The time is held
+   against the monotonic `event_epoch' rather than the start of the
+   current frame, so nothing in the heap needs adjusting at the end of
+   a frame */
+typedef struct event_heap_entry_t {
+  libspectrum_qword time;
+  int type;
+  libspectrum_dword sequence;	/* Insertion order, used to break ties */
+  event_t *event;
+} event_heap_entry_t;
+
+/* The pending events, stored as a binary min-heap ordered by
+   ( tstates, type ) with the earliest event at index 0 */
+static event_heap_entry_t *event_heap = NULL;
+static size_t event_heap_count = 0, event_heap_allocated = 0;
+
+/* The absolute time at which the current frame started. Events are
+   stored relative to this and converted back to frame-relative T-states
+   whenever they are handed out */
+static libspectrum_qword event_epoch = 0;
+
+/* How many events have been added; ties between events with the same
+   time and type are resolved in favour of the most recently added one,
+   just as the old sorted list did */
+static libspectrum_dword event_sequence = 0;
+
+/* Events are carved out of fixed-size slabs and recycled through a free
+   list, so steady-state emulation never goes to the system allocator */
+#define EVENT_SLAB_SIZE 256
+
+typedef struct event_node_t {
+  event_t event;
+  libspectrum_qword time;	/* As in the event's heap entry */
+  libspectrum_dword sequence;	/* Likewise; checked against handles */
+  int pending;			/* Is the event in the heap? */
+  int cancelled;		/* Has it been removed from the event list? */
+  struct event_node_t *next_free;
+} event_node_t;
+
+typedef struct event_slab_t {
+  event_node_t nodes[ EVENT_SLAB_SIZE ];
+  struct event_slab_t *next;
+} event_slab_t;
+
+/* All the slabs allocated so far */
+static event_slab_t *event_slabs = NULL;
+
+/* Events ready to be reused */
+static event_node_t *event_free = NULL;
+
+/* Allocation counters */
+static event_pool_stats_t event_stats;
+
+/* Cancelled events are left in the heap as null events until there are
+   enough of them to be worth clearing out all at once */
+#define EVENT_COMPACT_MIN 64
+static size_t event_cancelled = 0;
 
 /* A null event */
 int event_type_null;
 
+static void event_state_to( module_state_t *state );
+static void event_state_from( module_state_t *state );
+
+static module_info_t event_module_info = {
+
+  /* .reset = */ NULL,
+  /* .romcs = */ NULL,
+  /* .snapshot_enabled = */ NULL,
+  /* .snapshot_from = */ NULL,
+  /* .snapshot_to = */ NULL,
+  /* .state_to = */ event_state_to,
+  /* .state_from = */ event_state_from,
+
+};
+
 typedef struct event_descriptor_t {
   event_fn_t fn;
   char *description;
@@ -64,6 +135,8 @@ event_init( void *context )
 
   event_next_event = event_no_events;
 
+  module_register( &event_module_info );
+
   return 0;
 }
 
@@ -80,38 +153,248 @@ event_register( event_fn_t fn, const char *description )
   return registered_events->len - 1;
 }
 
-static gint
-event_add_cmp( gconstpointer a1, gconstpointer b1 )
+/* Does heap entry `a' need to happen before heap entry `b'? The ordering
+   is by ( tstates, type ) exactly as the old sorted event list, so RZX
+   playback stays deterministic */
+static inline int
+event_heap_before( const event_heap_entry_t *a, const event_heap_entry_t *b )
+{
+  if( a->time != b->time ) return a->time < b->time;
+  if( a->type != b->type ) return a->type < b->type;
+  return (libspectrum_signed_dword)( a->sequence - b->sequence ) > 0;
+}
+
+/* Move the entry at `position' towards the root until its parent is
+   earlier than it */
+static void
+event_heap_sift_up( size_t position )
+{
+  event_heap_entry_t entry = event_heap[ position ];
+
+  while( position > 0 ) {
+    size_t parent = ( position - 1 ) / 2;
+    if( !event_heap_before( &entry, &event_heap[ parent ] ) ) break;
+    event_heap[ position ] = event_heap[ parent ];
+    position = parent;
+  }
+
+  event_heap[ position ] = entry;
+}
+
+/* Move the entry at `position' away from the root until both its
+   children are later than it */
+static void
+event_heap_sift_down( size_t position )
+{
+  event_heap_entry_t entry = event_heap[ position ];
+
+  while( 1 ) {
+    size_t child = 2 * position + 1;
+    if( child >= event_heap_count ) break;
+    if( child + 1 < event_heap_count &&
+        event_heap_before( &event_heap[ child + 1 ], &event_heap[ child ] ) )
+      child++;
+    if( !event_heap_before( &event_heap[ child ], &entry ) ) break;
+    event_heap[ position ] = event_heap[ child ];
+    position = child;
+  }
+
+  event_heap[ position ] = entry;
+}
+
+/* Work out when the next event is due relative to the current frame */
+static void
+event_update_next( void )
 {
-  const event_t *a = a1, *b = b1;
+  libspectrum_qword next;
+
+  if( !event_heap_count ) {
+    event_next_event = event_no_events;
+    return;
+  }
+
+  next = event_heap[0].time - event_epoch;
+  event_next_event = next < event_no_events ? next : event_no_events;
+}
 
-  return a->tstates != b->tstates ? a->tstates - b->tstates
-		                  : a->type - b->type;
+/* Bring an event's frame-relative time up to date before it is seen by
+   anything outside this file */
+static inline event_t*
+event_heap_event( event_heap_entry_t *entry )
+{
+  entry->event->tstates = entry->time - event_epoch;
+  return entry->event;
+}
+
+/* Get an event from the pool, adding a new slab if the pool is empty */
+static event_t*
+event_alloc( void )
+{
+  event_node_t *node;
+
+  if( !event_free ) {
+    event_slab_t *slab = libspectrum_new( event_slab_t, 1 );
+    size_t i;
+
+    for( i = 0; i < EVENT_SLAB_SIZE - 1; i++ )
+      slab->nodes[i].next_free = &slab->nodes[ i + 1 ];
+    slab->nodes[ EVENT_SLAB_SIZE - 1 ].next_free = NULL;
+
+    slab->next = event_slabs;
+    event_slabs = slab;
+    event_free = slab->nodes;
+
+    event_stats.slabs++;
+    event_stats.capacity += EVENT_SLAB_SIZE;
+    event_stats.heap_allocations++;
+  }
+
+  node = event_free;
+  event_free = node->next_free;
+
+  if( ++event_stats.in_use > event_stats.peak )
+    event_stats.peak = event_stats.in_use;
+
+  return &node->event;
+}
+
+/* Return an event to the pool */
+static void
+event_release( event_t *event )
+{
+  event_node_t *node = (event_node_t*)event;
+
+  node->pending = node->cancelled = 0;
+  node->next_free = event_free;
+  event_free = node;
+
+  event_stats.in_use--;
 }
 
 /* Add an event at the correct place in the event list */
-void
+event_handle_t
 event_add_with_data( libspectrum_dword event_time, int type, void *user_data )
 {
   event_t *ptr;
+  event_node_t *node;
+  event_heap_entry_t *entry;
+  event_handle_t handle;
 
-  if( event_free ) {
-    ptr = event_free;
-    event_free = NULL;
-  } else {
-    ptr = libspectrum_new( event_t, 1 );
-  }
+  ptr = event_alloc();
 
   ptr->tstates = event_time;
   ptr->type =type;
   ptr->user_data = user_data;
 
-  if( event_time < event_next_event ) {
-    event_next_event = event_time;
-    event_list = g_slist_prepend( event_list, ptr );
-  } else {
-    event_list = g_slist_insert_sorted( event_list, ptr, event_add_cmp );
+  if( event_heap_count == event_heap_allocated ) {
+    event_heap_allocated = event_heap_allocated ? 2 * event_heap_allocated
+                                                : 32;
+    event_heap = libspectrum_renew( event_heap_entry_t, event_heap,
+                                    event_heap_allocated );
+    event_stats.heap_allocations++;
   }
+
+  entry = &event_heap[ event_heap_count ];
+  entry->time = event_epoch + event_time;
+  entry->type = type;
+  entry->sequence = event_sequence++;
+  entry->event = ptr;
+
+  node = (event_node_t*)ptr;
+  node->time = entry->time;
+  node->sequence = entry->sequence;
+  node->pending = 1;
+
+  event_heap_sift_up( event_heap_count++ );
+
+  event_update_next();
+
+  handle.event = ptr;
+  handle.sequence = entry->sequence;
+  return handle;
+}
+
+/* Get the node `handle' refers to, if it's still waiting to happen */
+static event_node_t*
+event_handle_node( const event_handle_t *handle )
+{
+  event_node_t *node = (event_node_t*)handle->event;
+
+  if( !node || !node->pending || node->cancelled ||
+      node->sequence != handle->sequence )
+    return NULL;
+
+  return node;
+}
+
+/* The event `handle' refers to, or NULL if it has already happened or
+   been cancelled */
+event_t*
+event_pending( const event_handle_t *handle )
+{
+  event_node_t *node = event_handle_node( handle );
+
+  if( !node ) return NULL;
+
+  node->event.tstates = node->time - event_epoch;
+  return &node->event;
+}
+
+/* Drop all the cancelled events from the heap, and put it back in
+   order */
+static void
+event_heap_compact( void )
+{
+  size_t i, j;
+
+  for( i = j = 0; i < event_heap_count; i++ ) {
+    if( ( (event_node_t*)event_heap[i].event )->cancelled ) {
+      event_release( event_heap[i].event );
+    } else {
+      event_heap[ j++ ] = event_heap[i];
+    }
+  }
+
+  event_heap_count = j;
+  for( i = event_heap_count / 2; i > 0; i-- ) event_heap_sift_down( i - 1 );
+
+  event_cancelled = 0;
+  event_update_next();
+}
+
+/* Take a pending event out of the event list. It stays in the heap as a
+   null event until it's due or the heap is next compacted */
+static void
+event_node_cancel( event_node_t *node )
+{
+  if( node->cancelled ) return;
+
+  node->event.type = event_type_null;
+  node->cancelled = 1;
+  event_cancelled++;
+}
+
+/* Compact the heap if at least half of it is cancelled events */
+static void
+event_heap_tidy( void )
+{
+  if( event_cancelled >= EVENT_COMPACT_MIN &&
+      event_cancelled * 2 >= event_heap_count )
+    event_heap_compact();
+}
+
+/* Cancel the event `handle' refers to, if it's still pending */
+void
+event_cancel( event_handle_t *handle )
+{
+  event_node_t *node = event_handle_node( handle );
+
+  if( node ) {
+    event_node_cancel( node );
+    event_heap_tidy();
+  }
+
+  handle->event = NULL;
 }
 
 /* Do all events which have passed */
@@ -122,48 +405,36 @@ event_do_events( void )
 
   while(event_next_event <= tstates) {
     event_descriptor_t descriptor;
-    ptr = event_list->data;
+    event_node_t *node;
+
+    ptr = event_heap_event( &event_heap[0] );
     descriptor =
       g_array_index( registered_events, event_descriptor_t, ptr->type );
 
-    /* Remove the event from the list *before* processing */
-    event_list = g_slist_remove( event_list, ptr );
+    node = (event_node_t*)ptr;
+    node->pending = 0;
+    if( node->cancelled ) event_cancelled--;
 
-    if( event_list == NULL ) {
-      event_next_event = event_no_events;
-    } else {
-      event_next_event = ((event_t*)(event_list->data))->tstates;
-    }
+    /* Remove the event from the heap *before* processing */
+    event_heap[0] = event_heap[ --event_heap_count ];
+    if( event_heap_count ) event_heap_sift_down( 0 );
+    event_update_next();
 
     if( descriptor.fn ) descriptor.fn( ptr->tstates, ptr->type, ptr->user_data );
 
-    if( event_free ) {
-      libspectrum_free( ptr );
-    } else {
-      event_free = ptr;
-    }
+    event_release( ptr );
   }
 
   return 0;
 }
 
-static void
-event_reduce_tstates( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-  libspectrum_dword *tstates_per_frame = user_data;
-
-  ptr->tstates -= *tstates_per_frame;
-}
-
-/* Called at end of frame to reduce T-state count of all entries */
+/* Called at end of frame to reduce T-state count of all entries. This
+   just moves the epoch on; the entries themselves are untouched */
 void
 event_frame( libspectrum_dword tstates_per_frame )
 {
-  g_slist_foreach( event_list, event_reduce_tstates, &tstates_per_frame );
-
-  event_next_event = event_list ?
-    ((event_t*)(event_list->data))->tstates : event_no_events;
+  event_epoch += tstates_per_frame;
+  event_update_next();
 }
 
 /* Do all events that would happen between the current time and when
@@ -183,69 +454,142 @@ event_force_events( void )
   }
 }
 
-static void
-set_event_null( gpointer data, gpointer user_data )
+/* Remove all events of a specific type from the stack */
+void
+event_remove_type( int type )
 {
-  event_t *ptr = data;
-  int *type = user_data;
+  size_t i;
+
+  for( i = 0; i < event_heap_count; i++ ) {
+    event_t *event = event_heap[i].event;
+    if( event->type == type ) event_node_cancel( (event_node_t*)event );
+  }
 
-  if( ptr->type == *type ) ptr->type = event_type_null;
+  event_heap_tidy();
 }
 
-static void
-set_event_null_with_user_data( gpointer data, gpointer user_data )
+/* Remove all events of a specific type and user data from the stack */
+void
+event_remove_type_user_data( int type, gpointer user_data )
 {
-  event_t *event = data;
-  event_t *template = user_data;
+  size_t i;
+
+  for( i = 0; i < event_heap_count; i++ ) {
+    event_t *event = event_heap[i].event;
+    if( event->type == type && event->user_data == user_data )
+      event_node_cancel( (event_node_t*)event );
+  }
 
-  if( event->type == template->type && event->user_data == template->user_data )
-    event->type = event_type_null;
+  event_heap_tidy();
 }
 
-/* Remove all events of a specific type from the stack */
+/* Clear the event stack */
 void
-event_remove_type( int type )
+event_reset( void )
 {
-  g_slist_foreach( event_list, set_event_null, &type );
+  size_t i;
+
+  for( i = 0; i < event_heap_count; i++ )
+    event_release( event_heap[i].event );
+  event_heap_count = 0;
+  event_epoch = 0;
+  event_cancelled = 0;
+
+  event_next_event = event_no_events;
 }
 
-/* Remove all events of a specific type and user data from the stack */
-void
-event_remove_type_user_data( int type, gpointer user_data )
+/* The pending events go into an in-memory state in heap order, so
+   putting them back doesn't need any sorting */
+static void
+event_state_to( module_state_t *state )
 {
-  event_t template;
+  size_t i;
 
-  template.type = type;
-  template.user_data = user_data;
-  g_slist_foreach( event_list, set_event_null_with_user_data, &template );
+  module_state_write( state, &event_epoch, sizeof( event_epoch ) );
+  module_state_write( state, &event_sequence, sizeof( event_sequence ) );
+  module_state_write( state, &event_heap_count, sizeof( event_heap_count ) );
+
+  for( i = 0; i < event_heap_count; i++ ) {
+    module_state_write( state, &event_heap[i], sizeof( event_heap[i] ) );
+    module_state_write( state, event_heap[i].event, sizeof( event_t ) );
+  }
 }
 
-/* Free the memory used by a specific entry */
+/* The events come back in new nodes, so any event_handle_t still held
+   is left pointing at a released node and has to be treated as gone.
+   Nothing re-maps them: restores are refused while the tape or a disk
+   is active (see runahead_state_complete()), and those are the only
+   holders of handles */
 static void
-event_free_entry( gpointer data, gpointer user_data GCC_UNUSED )
+event_state_from( module_state_t *state )
 {
-  libspectrum_free( data );
+  size_t i, count;
+
+  for( i = 0; i < event_heap_count; i++ )
+    event_release( event_heap[i].event );
+  event_heap_count = 0;
+  event_cancelled = 0;
+
+  module_state_read( state, &event_epoch, sizeof( event_epoch ) );
+  module_state_read( state, &event_sequence, sizeof( event_sequence ) );
+  module_state_read( state, &count, sizeof( count ) );
+  if( state->error ) count = 0;
+
+  if( event_heap_allocated < count ) {
+    event_heap_allocated = count;
+    event_heap = libspectrum_renew( event_heap_entry_t, event_heap,
+                                    event_heap_allocated );
+    event_stats.heap_allocations++;
+  }
+
+  for( i = 0; i < count && !state->error; i++ ) {
+    event_heap_entry_t *entry = &event_heap[ event_heap_count++ ];
+
+    event_node_t *node;
+
+    module_state_read( state, entry, sizeof( *entry ) );
+    entry->event = event_alloc();
+    module_state_read( state, entry->event, sizeof( event_t ) );
+
+    node = (event_node_t*)entry->event;
+    node->time = entry->time;
+    node->sequence = entry->sequence;
+    node->pending = 1;
+  }
+
+  event_update_next();
 }
 
-/* Clear the event stack */
+/* Get the allocation counters for the event pool */
 void
-event_reset( void )
+event_pool_stats( event_pool_stats_t *stats )
 {
-  g_slist_foreach( event_list, event_free_entry, NULL );
-  g_slist_free( event_list );
-  event_list = NULL;
+  *stats = event_stats;
+}
 
-  event_next_event = event_no_events;
+/* Give all the slabs back to the system */
+static void
+event_slabs_free( void )
+{
+  while( event_slabs ) {
+    event_slab_t *next = event_slabs->next;
+    libspectrum_free( event_slabs );
+    event_slabs = next;
+  }
 
-  libspectrum_free( event_free );
   event_free = NULL;
+  event_stats.slabs = event_stats.capacity = 0;
 }
 
-/* Call a user-supplied function for every event in the current list */
+/* Call a user-supplied function for every event in the current list. The
+   events are visited in heap order, not time order */
 void
 event_foreach( GFunc function, gpointer user_data )
 {
-  g_slist_foreach( event_list, function, user_data );
+  size_t i;
+
+  for( i = 0; i < event_heap_count; i++ )
+    function( event_heap_event( &event_heap[i] ), user_data );
 }
 
 /* A textual representation of each event type */
@@ -278,6 +622,12 @@ event_end( void )
 {
   event_reset();
   registered_events_free();
+
+  libspectrum_free( event_heap );
+  event_heap = NULL;
+  event_heap_allocated = 0;
+
+  event_slabs_free();
 }
 
 void
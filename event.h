@@ -32,7 +32,8 @@
 
 /* Information about an event */
 typedef struct event_t {
-  libspectrum_dword tstates;
+  libspectrum_dword tstates;	/* Relative to the start of the current frame;
+				   only valid when handed out by event.c */
   int type;
   void *user_data;
 } event_t;
@@ -49,16 +50,31 @@ extern libspectrum_dword event_next_event;
 /* Register a new event type */
 int event_register( event_fn_t fn, const char *description );
 
+/* A handle on an added event, with which it can be found or cancelled
+   without searching the event list. An all-zero handle refers to no
+   event, and a handle goes stale once its event has happened */
+typedef struct event_handle_t {
+  event_t *event;
+  libspectrum_dword sequence;
+} event_handle_t;
+
 /* Add an event at the correct place in the event list */
-void event_add_with_data( libspectrum_dword event_time, int type,
-			  void *user_data );
+event_handle_t event_add_with_data( libspectrum_dword event_time, int type,
+				    void *user_data );
 
-static inline void
+static inline event_handle_t
 event_add( libspectrum_dword event_time, int type )
 {
-  event_add_with_data( event_time, type, NULL );
+  return event_add_with_data( event_time, type, NULL );
 }
 
+/* The event `handle' refers to, or NULL if it has already happened or
+   been cancelled */
+event_t* event_pending( const event_handle_t *handle );
+
+/* Cancel the event `handle' refers to, if it's still pending */
+void event_cancel( event_handle_t *handle );
+
 /* Do all events which have passed */
 int event_do_events(void);
 
@@ -80,6 +96,18 @@ void event_reset( void );
 /* Call a user-supplied function for every event in the current list */
 void event_foreach( GFunc function, gpointer user_data );
 
+/* Allocation counters for the event pool */
+typedef struct event_pool_stats_t {
+  size_t slabs;			/* Slabs allocated */
+  size_t capacity;		/* Events those slabs can hold */
+  size_t in_use;		/* Events currently pending */
+  size_t peak;			/* Most events ever pending at once */
+  size_t heap_allocations;	/* Trips to the system allocator */
+} event_pool_stats_t;
+
+/* Get the allocation counters for the event pool */
+void event_pool_stats( event_pool_stats_t *stats );
+
 /* A textual representation of each event type */
 const char *event_name( int type );
 
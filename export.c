@@ -0,0 +1,326 @@
+/* export.c: play an RZX file back headless into video and audio files
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* The RZX file given by --playback is run flat out with no sound device
+   and nothing waiting for the timer, so it goes as fast as the host
+   allows. Each frame is written to --export-video as YUV4MPEG2 (4:4:4,
+   so no colour is lost to subsampling) and the sound to --export-audio
+   as 16 bit PCM WAV; either may be `-' for the standard output, so it
+   can be piped straight into an encoder.
+
+   Nothing is shared between one export and another, so any number of
+   them can be run at once, each in a process of its own. The null UI
+   keeps the host display out of it altogether */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "display.h"
+#include "event.h"
+#include "export.h"
+#include "fuse.h"
+#include "machine.h"
+#include "rzx.h"
+#include "settings.h"
+#include "sound.h"
+#include "ui/ui.h"
+#include "z80/z80.h"
+
+int export_active = 0;
+
+static FILE *video_file, *audio_file;
+
+/* The size of the video, fixed when the export starts; a machine with a
+   different size screen is scaled to fit */
+static int video_width, video_height, video_scale;
+
+/* One frame's Y, U and V planes */
+static libspectrum_byte *video_frame;
+
+/* The Spectrum's colours as YUV */
+static libspectrum_byte video_yuv[16][3];
+
+/* How much sound has been written */
+static libspectrum_dword audio_bytes;
+static int audio_channels;
+
+static FILE*
+open_output( const char *filename )
+{
+  FILE *f;
+
+  if( !strcmp( filename, "-" ) ) return stdout;
+
+  f = fopen( filename, "wb" );
+  if( !f )
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s' for writing", filename );
+
+  return f;
+}
+
+static void
+close_output( FILE *f )
+{
+  if( !f ) return;
+
+  if( f == stdout ) {
+    fflush( f );
+  } else {
+    fclose( f );
+  }
+}
+
+static void
+set_yuv_palette( void )
+{
+  size_t i;
+
+  static const			      /*  R    G    B */
+  libspectrum_byte palette[16][3] = { {   0,   0,   0 },
+				      {   0,   0, 192 },
+				      { 192,   0,   0 },
+				      { 192,   0, 192 },
+				      {   0, 192,   0 },
+				      {   0, 192, 192 },
+				      { 192, 192,   0 },
+				      { 192, 192, 192 },
+				      {   0,   0,   0 },
+				      {   0,   0, 255 },
+				      { 255,   0,   0 },
+				      { 255,   0, 255 },
+				      {   0, 255,   0 },
+				      {   0, 255, 255 },
+				      { 255, 255,   0 },
+				      { 255, 255, 255 } };
+
+  /* ITU-R BT.601, studio range. Addition of 0.5 is to avoid rounding
+     errors */
+  for( i = 0; i < 16; i++ ) {
+    double r = palette[i][0], g = palette[i][1], b = palette[i][2];
+
+    video_yuv[i][0] = 16 + ( 65.481 * r + 128.553 * g + 24.966 * b ) / 255
+                      + 0.5;
+
+    if( settings_current.bw_tv ) {
+      video_yuv[i][1] = video_yuv[i][2] = 128;
+    } else {
+      video_yuv[i][1] = 128 + ( -37.797 * r - 74.203 * g + 112.0 * b ) / 255
+                        + 0.5;
+      video_yuv[i][2] = 128 + ( 112.0 * r - 93.786 * g - 18.214 * b ) / 255
+                        + 0.5;
+    }
+  }
+}
+
+static int
+video_start( void )
+{
+  size_t size;
+
+  video_scale = machine_current->timex ? 2 : 1;
+  video_width = DISPLAY_ASPECT_WIDTH * video_scale;
+  video_height = DISPLAY_SCREEN_HEIGHT * video_scale;
+
+  set_yuv_palette();
+
+  size = (size_t)video_width * video_height;
+  video_frame = libspectrum_new( libspectrum_byte, size * 3 );
+
+  /* The frame rate is exactly that of the machine, not 50Hz */
+  fprintf( video_file, "YUV4MPEG2 W%d H%d F%lu:%lu Ip A1:1 C444\n",
+           video_width, video_height,
+           (unsigned long)machine_current->timings.processor_speed,
+           (unsigned long)machine_current->timings.tstates_per_frame );
+
+  return ferror( video_file );
+}
+
+void
+export_frame( void )
+{
+  size_t plane = (size_t)video_width * video_height;
+  libspectrum_byte *y, *u, *v;
+  int scale, i, j;
+
+  if( !video_file ) return;
+
+  /* Pixel positions on the screen as it is now */
+  scale = machine_current->timex ? 2 : 1;
+
+  y = video_frame; u = y + plane; v = u + plane;
+
+  for( j = 0; j < video_height; j++ ) {
+    int sy = j * scale / video_scale;
+
+    for( i = 0; i < video_width; i++ ) {
+      int colour = display_getpixel( i * scale / video_scale, sy );
+
+      *y++ = video_yuv[ colour ][0];
+      *u++ = video_yuv[ colour ][1];
+      *v++ = video_yuv[ colour ][2];
+    }
+  }
+
+  fputs( "FRAME\n", video_file );
+  fwrite( video_frame, 1, plane * 3, video_file );
+}
+
+static void
+write_dword( libspectrum_byte *p, libspectrum_dword d )
+{
+  p[0] = d & 0xff; p[1] = ( d >> 8 ) & 0xff;
+  p[2] = ( d >> 16 ) & 0xff; p[3] = d >> 24;
+}
+
+static int
+audio_header( void )
+{
+  libspectrum_byte header[44];
+  libspectrum_dword block_align = audio_channels * 2;
+
+  /* A stream whose length isn't known yet says it is as long as can be,
+     as most readers of piped WAVs expect */
+  libspectrum_dword data = audio_file == stdout ? 0xffffffff - 36
+                                                : audio_bytes;
+
+  memcpy( header, "RIFF", 4 );
+  write_dword( header + 4, 36 + data );
+  memcpy( header + 8, "WAVEfmt ", 8 );
+  write_dword( header + 16, 16 );
+  header[20] = 1; header[21] = 0;			/* PCM */
+  header[22] = audio_channels; header[23] = 0;
+  write_dword( header + 24, sound_freq );
+  write_dword( header + 28, sound_freq * block_align );
+  header[32] = block_align; header[33] = 0;
+  header[34] = 16; header[35] = 0;			/* Bits per sample */
+  memcpy( header + 36, "data", 4 );
+  write_dword( header + 40, data );
+
+  fwrite( header, 1, sizeof( header ), audio_file );
+
+  return ferror( audio_file );
+}
+
+void
+export_add_sound( const libspectrum_signed_word *buf, size_t count )
+{
+  libspectrum_byte out[ 1024 ];
+  size_t i, n;
+
+  if( !audio_file ) return;
+
+  /* WAV is little endian whatever the host is */
+  while( count ) {
+    n = count > sizeof( out ) / 2 ? sizeof( out ) / 2 : count;
+
+    for( i = 0; i < n; i++ ) {
+      out[ 2 * i ] = buf[i] & 0xff;
+      out[ 2 * i + 1 ] = ( buf[i] >> 8 ) & 0xff;
+    }
+
+    fwrite( out, 2, n, audio_file );
+    audio_bytes += n * 2;
+    buf += n; count -= n;
+  }
+}
+
+static int
+audio_end( void )
+{
+  if( audio_file == stdout ) return 0;
+
+  /* Now the length is known, go back and fill it in */
+  if( fseek( audio_file, 0, SEEK_SET ) ) return 1;
+
+  return audio_header();
+}
+
+int
+export_run( void )
+{
+  const char *video = settings_current.export_video,
+    *audio = settings_current.export_audio;
+  int error = 0;
+
+  if( !rzx_playback ) {
+    ui_error( UI_ERROR_ERROR, "exporting needs an RZX file to play back" );
+    return 1;
+  }
+
+  if( video && *video && audio && *audio &&
+      !strcmp( video, "-" ) && !strcmp( audio, "-" ) ) {
+    ui_error( UI_ERROR_ERROR,
+              "video and audio can't both go to the standard output" );
+    return 1;
+  }
+
+  video_file = audio_file = NULL;
+  audio_bytes = 0;
+
+  /* Make the sound without a device to play it on */
+  sound_end();
+  export_active = 1;
+  sound_init( settings_current.sound_device );
+
+  if( video && *video ) {
+    video_file = open_output( video );
+    if( !video_file || video_start() ) error = 1;
+  }
+
+  if( !error && audio && *audio ) {
+    if( !sound_enabled ) {
+      ui_error( UI_ERROR_ERROR, "couldn't make any sound to export" );
+      error = 1;
+    } else {
+      audio_channels = sound_stereo_ay != SOUND_STEREO_AY_NONE ? 2 : 1;
+      audio_file = open_output( audio );
+      if( !audio_file || audio_header() ) error = 1;
+    }
+  }
+
+  while( !error && !fuse_exiting && rzx_playback ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  if( video_file && ferror( video_file ) ) error = 1;
+  if( audio_file && ( ferror( audio_file ) || audio_end() ) ) error = 1;
+
+  if( error ) ui_error( UI_ERROR_ERROR, "exporting failed" );
+
+  close_output( video_file );
+  close_output( audio_file );
+  video_file = audio_file = NULL;
+
+  libspectrum_free( video_frame );
+  video_frame = NULL;
+
+  sound_end();
+  export_active = 0;
+
+  return error;
+}
@@ -0,0 +1,47 @@
+/* export.h: play an RZX file back headless into video and audio files
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_EXPORT_H
+#define FUSE_EXPORT_H
+
+#include <libspectrum.h>
+
+/* Non-zero while an RZX file is being exported */
+extern int export_active;
+
+/* Play back the RZX file given by --playback flat out, writing its
+   frames to --export-video and its sound to --export-audio. Returns
+   non-zero on error */
+int
+export_run( void );
+
+/* Called at the end of each frame, after the display has been updated */
+void
+export_frame( void );
+
+/* Called with each frame's sound once it has been made; `count' is the
+   number of samples over all the channels */
+void
+export_add_sound( const libspectrum_signed_word *buf, size_t count );
+
+#endif				/* #ifndef FUSE_EXPORT_H */
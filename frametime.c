@@ -0,0 +1,315 @@
+/* frametime.c: host-side per-frame timing probes
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#ifdef FRAME_TIMING
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "frametime.h"
+#include "infrastructure/startup_manager.h"
+#include "settings.h"
+#include "sound.h"
+#include "thread_sched.h"
+#include "ui/ui.h"
+
+static const char * const probe_names[ FRAMETIME_PROBE_COUNT ] = {
+  "other", "z80", "events", "display", "uidisplay", "sound", "ay", "sleep",
+};
+
+/* The single letters used in the on-screen summary; "other" isn't
+   shown there */
+static const char probe_letters[ FRAMETIME_PROBE_COUNT ] = {
+  0, 'Z', 'E', 'D', 'U', 'S', 'A', 'W',
+};
+
+/* The probes currently active; the bottom entry is always "other" */
+#define FRAMETIME_STACK_DEPTH 8
+
+static frametime_probe probe_stack[ FRAMETIME_STACK_DEPTH ] = {
+  FRAMETIME_PROBE_OTHER
+};
+static size_t probe_depth = 1;
+static size_t probe_overflow;
+
+/* Time charged to each probe so far this frame, in seconds */
+static double frame_time[ FRAMETIME_PROBE_COUNT ];
+
+static double last_mark;
+
+/* The timer's lateness for this frame, or negative if it hasn't paced it */
+static double frame_lateness = -1;
+
+/* The last minute or so of frames, in microseconds */
+#define FRAMETIME_HISTORY 3000
+
+typedef struct frametime_record {
+
+  libspectrum_dword frame;
+  libspectrum_dword us[ FRAMETIME_PROBE_COUNT ];
+
+  /* The sound device's running totals at the end of the frame */
+  libspectrum_dword underruns, overruns;
+
+  /* How late the timer was for the frame's deadline in microseconds, if
+     it was pacing the frame at all */
+  int paced;
+  libspectrum_dword late_us;
+
+  /* How many times the emulation thread had been switched out against
+     its will by the end of the frame */
+  libspectrum_dword preemptions;
+
+} frametime_record;
+
+static frametime_record history[ FRAMETIME_HISTORY ];
+static size_t history_next, history_count;
+static libspectrum_dword frames_done;
+
+/* The number of frames averaged over for the summary */
+#define FRAMETIME_SUMMARY_FRAMES 50
+
+static void
+mark( void )
+{
+  double now = compat_timer_get_time();
+  if( now < 0 ) return;
+
+  frame_time[ probe_stack[ probe_depth - 1 ] ] += now - last_mark;
+  last_mark = now;
+}
+
+void
+frametime_enter( frametime_probe probe )
+{
+  mark();
+
+  if( probe_depth == FRAMETIME_STACK_DEPTH ) {
+    probe_overflow++;
+    return;
+  }
+
+  probe_stack[ probe_depth++ ] = probe;
+}
+
+void
+frametime_leave( void )
+{
+  mark();
+
+  if( probe_overflow ) {
+    probe_overflow--;
+  } else if( probe_depth > 1 ) {
+    probe_depth--;
+  }
+}
+
+void
+frametime_frame( void )
+{
+  frametime_record *record = &history[ history_next ];
+  size_t i;
+
+  mark();
+
+  record->frame = frames_done++;
+  for( i = 0; i < FRAMETIME_PROBE_COUNT; i++ ) {
+    record->us[i] = frame_time[i] * 1e6 + 0.5;
+    frame_time[i] = 0;
+  }
+  record->underruns = sound_stats.underruns;
+  record->overruns = sound_stats.overruns;
+  record->preemptions = thread_sched_preemptions();
+
+  record->paced = frame_lateness >= 0;
+  record->late_us = record->paced ? frame_lateness * 1e6 + 0.5 : 0;
+  frame_lateness = -1;
+
+  history_next = ( history_next + 1 ) % FRAMETIME_HISTORY;
+  if( history_count < FRAMETIME_HISTORY ) history_count++;
+}
+
+void
+frametime_pacing( double lateness )
+{
+  frame_lateness = lateness < 0 ? 0 : lateness;
+}
+
+size_t
+frametime_pacing_histogram( libspectrum_dword *buckets, size_t frames )
+{
+  size_t i, bucket, paced = 0;
+
+  memset( buckets, 0, FRAMETIME_PACING_BUCKETS * sizeof( *buckets ) );
+
+  if( frames > history_count ) frames = history_count;
+
+  for( i = 0; i < frames; i++ ) {
+    const frametime_record *record =
+      &history[ ( history_next + FRAMETIME_HISTORY - 1 - i ) %
+                FRAMETIME_HISTORY ];
+    if( !record->paced ) continue;
+
+    bucket = record->late_us / FRAMETIME_PACING_STEP;
+    if( bucket >= FRAMETIME_PACING_BUCKETS )
+      bucket = FRAMETIME_PACING_BUCKETS - 1;
+
+    buckets[ bucket ]++;
+    paced++;
+  }
+
+  return paced;
+}
+
+void
+frametime_summary( char *buffer, size_t length )
+{
+  libspectrum_dword total[ FRAMETIME_PROBE_COUNT ];
+  libspectrum_dword pacing[ FRAMETIME_PACING_BUCKETS ];
+  const frametime_record *newest, *oldest;
+  libspectrum_dword glitches;
+  size_t frames, paced, i, j, used;
+
+  frames = history_count < FRAMETIME_SUMMARY_FRAMES ?
+           history_count : FRAMETIME_SUMMARY_FRAMES;
+
+  if( !length ) return;
+  buffer[0] = '\0';
+  if( !frames ) return;
+
+  memset( total, 0, sizeof( total ) );
+  for( i = 0; i < frames; i++ ) {
+    const frametime_record *record =
+      &history[ ( history_next + FRAMETIME_HISTORY - 1 - i ) %
+                FRAMETIME_HISTORY ];
+    for( j = 0; j < FRAMETIME_PROBE_COUNT; j++ ) total[j] += record->us[j];
+  }
+
+  used = 0;
+  for( j = 0; j < FRAMETIME_PROBE_COUNT && used < length; j++ ) {
+    if( !probe_letters[j] ) continue;
+    used += snprintf( buffer + used, length - used, "%s%c%.1f",
+                      used ? " " : "", probe_letters[j],
+                      total[j] / 1000.0 / frames );
+  }
+
+  /* Only mention the sound device if it's been having trouble */
+  newest = &history[ ( history_next + FRAMETIME_HISTORY - 1 ) %
+                     FRAMETIME_HISTORY ];
+  oldest = &history[ ( history_next + FRAMETIME_HISTORY - frames ) %
+                     FRAMETIME_HISTORY ];
+  glitches = ( newest->underruns - oldest->underruns ) +
+             ( newest->overruns - oldest->overruns );
+  if( glitches && used < length )
+    used += snprintf( buffer + used, length - used, " X%lu",
+                      (unsigned long)glitches );
+
+  /* Likewise the host taking the CPU away from us */
+  if( newest->preemptions != oldest->preemptions && used < length )
+    used += snprintf( buffer + used, length - used, " P%lu",
+                      (unsigned long)( newest->preemptions -
+                                       oldest->preemptions ) );
+
+  /* And how late the timer was for all but the worst twentieth of the
+     frames it paced */
+  paced = frametime_pacing_histogram( pacing, frames );
+  if( paced && used < length ) {
+    for( i = 0, j = 0; i < FRAMETIME_PACING_BUCKETS - 1; i++ ) {
+      j += pacing[i];
+      if( j * 20 >= paced * 19 ) break;
+    }
+    snprintf( buffer + used, length - used, " L%.2f",
+              ( i + 1 ) * FRAMETIME_PACING_STEP / 1000.0 );
+  }
+}
+
+static void
+write_csv( const char *filename )
+{
+  FILE *f;
+  size_t i, j;
+
+  f = fopen( filename, "w" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "unable to open frame timing file '%s' for writing",
+              filename );
+    return;
+  }
+
+  fprintf( f, "frame" );
+  for( j = 0; j < FRAMETIME_PROBE_COUNT; j++ )
+    fprintf( f, ",%s_us", probe_names[j] );
+  fprintf( f, ",sound_underruns,sound_overruns,pacing_late_us,"
+           "preemptions\n" );
+
+  for( i = 0; i < history_count; i++ ) {
+    const frametime_record *record =
+      &history[ ( history_next + FRAMETIME_HISTORY - history_count + i ) %
+                FRAMETIME_HISTORY ];
+
+    fprintf( f, "%lu", (unsigned long)record->frame );
+    for( j = 0; j < FRAMETIME_PROBE_COUNT; j++ )
+      fprintf( f, ",%lu", (unsigned long)record->us[j] );
+    fprintf( f, ",%lu,%lu,", (unsigned long)record->underruns,
+             (unsigned long)record->overruns );
+    if( record->paced ) fprintf( f, "%lu", (unsigned long)record->late_us );
+    fprintf( f, ",%lu\n", (unsigned long)record->preemptions );
+  }
+
+  fclose( f );
+}
+
+static int
+frametime_init( void *context )
+{
+  last_mark = compat_timer_get_time(); if( last_mark < 0 ) return 1;
+
+  return 0;
+}
+
+static void
+frametime_end( void )
+{
+  if( settings_current.frame_timing_file &&
+      *settings_current.frame_timing_file )
+    write_csv( settings_current.frame_timing_file );
+}
+
+void
+frametime_register_startup( void )
+{
+  /* Depend on the settings, so the CSV is written before they're freed */
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_SETTINGS_END,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_FRAMETIME, dependencies,
+                            ARRAY_SIZE( dependencies ), frametime_init, NULL,
+                            frametime_end );
+}
+
+#endif				/* #ifdef FRAME_TIMING */
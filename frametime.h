@@ -0,0 +1,94 @@
+/* frametime.h: host-side per-frame timing probes
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_FRAMETIME_H
+#define FUSE_FRAMETIME_H
+
+#include <stddef.h>
+
+#include <libspectrum.h>
+
+/* The parts of a frame we account host time to. Probes nest, and time
+   is only ever charged to the innermost one active */
+typedef enum frametime_probe {
+
+  FRAMETIME_PROBE_OTHER,	/* Not inside any probe */
+  FRAMETIME_PROBE_Z80,
+  FRAMETIME_PROBE_EVENTS,
+  FRAMETIME_PROBE_DISPLAY,
+  FRAMETIME_PROBE_UIDISPLAY,
+  FRAMETIME_PROBE_SOUND,
+  FRAMETIME_PROBE_AY,
+  FRAMETIME_PROBE_SLEEP,
+
+  FRAMETIME_PROBE_COUNT,	/* End marker */
+
+} frametime_probe;
+
+#ifdef FRAME_TIMING
+
+void frametime_register_startup( void );
+
+/* Start charging time to `probe' */
+void frametime_enter( frametime_probe probe );
+
+/* Go back to charging time to whatever was active before the matching
+   frametime_enter() */
+void frametime_leave( void );
+
+/* Called at the end of each emulated frame to close off its record */
+void frametime_frame( void );
+
+/* Called by the timer when it has finished waiting for a frame's
+   deadline; `lateness' is how far past the deadline it was, in seconds */
+void frametime_pacing( double lateness );
+
+/* How late the timer has been over the last `frames' paced frames, as
+   counts of frames in steps of FRAMETIME_PACING_STEP microseconds; the
+   last bucket has everything later than that. Returns the number of
+   frames counted */
+#define FRAMETIME_PACING_BUCKETS 16
+#define FRAMETIME_PACING_STEP 250
+
+size_t frametime_pacing_histogram( libspectrum_dword *buckets, size_t frames );
+
+/* Write the average time per frame for each probe over the last second
+   into `buffer', followed by the number of sound underruns and overruns
+   and of times the emulation thread was preempted over the same time if
+   there were any, and how late the timer's been if it's been pacing the
+   frames */
+void frametime_summary( char *buffer, size_t length );
+
+#define FRAMETIME_ENTER( probe ) frametime_enter( probe )
+#define FRAMETIME_LEAVE() frametime_leave()
+#define FRAMETIME_PACING( lateness ) frametime_pacing( lateness )
+
+#else				/* #ifdef FRAME_TIMING */
+
+#define FRAMETIME_ENTER( probe )
+#define FRAMETIME_LEAVE()
+#define FRAMETIME_PACING( lateness )
+
+#endif				/* #ifdef FRAME_TIMING */
+
+#endif				/* #ifndef FUSE_FRAMETIME_H */
@@ -45,14 +45,6 @@
 #include "compat.h"
 #endif
 
-/* We need to include SDL.h on Mac O X and Windows to do some magic
-   bootstrapping by redefining main. As we now allow SDL joystick code to be
-   used in the GTK+ and Xlib UIs we need to also do the magic when that code is
-   in use, feel free to look away for the next line */
-#if defined UI_SDL || (defined USE_JOYSTICK && !defined HAVE_JSW_H && (defined UI_X || defined UI_GTK) )
-#include <SDL.h>		/* Needed on MacOS X and Windows */
-#endif /* #if defined UI_SDL || (defined USE_JOYSTICK && !defined HAVE_JSW_H && (defined UI_X || defined UI_GTK) ) */
-
 #ifdef GEKKO
 #include <fat.h>
 #endif				/* #ifdef GEKKO */
@@ -61,18 +53,26 @@
 #include <libxml/encoding.h>
 #endif
 
+#include "batch.h"
+#include "bench.h"
+#include "export.h"
+#include "config_write.h"
 #include "debugger/debugger.h"
 #include "display.h"
 #include "event.h"
+#include "frametime.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
+#include "input.h"
 #include "keyboard.h"
+#include "library.h"
 #include "machine.h"
 #include "machines/machines_periph.h"
 #include "memory_pages.h"
 #include "module.h"
 #include "movie.h"
 #include "mempool.h"
+#include "netplay.h"
 #include "peripherals/ay.h"
 #include "peripherals/dck.h"
 #include "peripherals/disk/beta.h"
@@ -102,14 +102,20 @@
 #include "pokefinder/pokemem.h"
 #include "profile.h"
 #include "psg.h"
+#include "rewind.h"
+#include "runahead.h"
 #include "rzx.h"
 #include "screenshot.h"
+#include "session.h"
 #include "settings.h"
+#include "shmexport.h"
 #include "slt.h"
 #include "snapshot.h"
 #include "sound.h"
+#include "soundrec.h"
 #include "spectrum.h"
 #include "tape.h"
+#include "thread_sched.h"
 #include "timer/timer.h"
 #include "ui/scaler/scaler.h"
 #include "ui/ui.h"
@@ -118,9 +124,11 @@
 #include "utils.h"
 #ifdef GCWZERO
 #include "controlmapping/controlmapping.h"
+#include "savestates/savestates.h"
 #endif
 
 #include "z80/z80.h"
+#include "zip.h"
 
 /* What name were we called under? */
 const char *fuse_progname;
@@ -166,8 +174,6 @@ typedef struct start_files_t {
 /* Context for the display startup routine */
 static display_startup_context display_context;
 
-static int fuse_init(int argc, char **argv);
-
 static void creator_register_startup( void );
 
 static void fuse_show_copyright(void);
@@ -178,14 +184,9 @@ static int setup_start_files( start_files_t *start_files );
 static int parse_nonoption_args( int argc, char **argv, int first_arg,
 				 start_files_t *start_files );
 static int do_start_files( start_files_t *start_files );
+static int start_files_given( start_files_t *start_files );
 
-static int fuse_end(void);
-
-#ifdef UI_WIN32
 int fuse_main(int argc, char **argv)
-#else
-int main(int argc, char **argv)
-#endif
 {
   int r;
 
@@ -207,14 +208,33 @@ int main(int argc, char **argv)
 
   if( settings_current.unittests ) {
     r = unittests_run();
+  } else if( settings_current.batch && *settings_current.batch ) {
+    r = batch_run( settings_current.batch );
+  } else if( settings_current.bench_frames > 0 ) {
+    r = bench_run( settings_current.bench_frames );
+  } else if( settings_current.bench_scalers > 0 ) {
+    r = bench_scalers_run( settings_current.bench_scalers );
+  } else if( settings_current.bench_media ) {
+    r = bench_media_run( settings_current.bench_media );
+  } else if( settings_current.export_video || settings_current.export_audio ) {
+    r = export_run();
   } else {
     while( !fuse_exiting ) {
+      FRAMETIME_ENTER( FRAMETIME_PROBE_Z80 );
       z80_do_opcodes();
+      FRAMETIME_LEAVE();
+      FRAMETIME_ENTER( FRAMETIME_PROBE_EVENTS );
       event_do_events();
+      FRAMETIME_LEAVE();
+      netplay_run();
+      runahead_run();
     }
     r = debugger_get_exit_code();
   }
 
+  if( settings_current.screen_hash )
+    printf( "screen_hash: %08lx\n", (unsigned long)display_screen_hash() );
+
   fuse_end();
   
   return r;
@@ -308,6 +328,7 @@ run_startup_manager( int *argc, char ***argv )
   ay_register_startup();
   beta_register_startup();
   creator_register_startup();
+  config_write_register_startup();
   covox_register_startup();
   debugger_register_startup();
   didaktik80_register_startup();
@@ -317,12 +338,17 @@ run_startup_manager( int *argc, char ***argv )
   divmmc_register_startup();
   event_register_startup();
   fdd_register_startup();
+#ifdef FRAME_TIMING
+  frametime_register_startup();
+#endif				/* #ifdef FRAME_TIMING */
   fuller_register_startup();
   if1_register_startup();
   if2_register_startup();
+  input_register_startup();
   joystick_register_startup();
   kempmouse_register_startup();
   keyboard_register_startup();
+  library_register_startup();
   libspectrum_register_startup();
   libxml2_register_startup();
   machine_register_startup();
@@ -331,20 +357,25 @@ run_startup_manager( int *argc, char ***argv )
   memory_register_startup();
   mempool_register_startup();
   multiface_register_startup();
+  netplay_register_startup();
   opus_register_startup();
   phantom_typist_register_startup();
   plusd_register_startup();
   printer_register_startup();
   profile_register_startup();
   psg_register_startup();
+  rewind_register_startup();
+  runahead_register_startup();
   rzx_register_startup();
   scld_register_startup();
   screenshot_register_startup();
   settings_register_startup();
   setuid_register_startup();
+  shmexport_register_startup();
   simpleide_register_startup();
   slt_register_startup();
   sound_register_startup();
+  soundrec_register_startup();
   speccyboot_register_startup();
   specdrum_register_startup();
   spectranet_register_startup();
@@ -355,20 +386,38 @@ run_startup_manager( int *argc, char ***argv )
   ula_register_startup();
   usource_register_startup();
   z80_register_startup();
+  zip_register_startup();
   zxatasp_register_startup();
   zxcf_register_startup();
   zxmmc_register_startup();
 #ifdef GCWZERO
   controlmapping_register_startup();
+  savestate_register_startup();
 #endif
 
   return startup_manager_run();
 }
 
-static int fuse_init(int argc, char **argv)
+/* With --startup-profile, note how long the startup step `name' took
+   since `*start', and start timing the next one */
+static void
+profile_step( const char *name, double *start )
+{
+  double now;
+
+  if( !settings_current.startup_profile ) return;
+
+  now = compat_timer_get_time();
+  if( *start >= 0 && now >= 0 )
+    startup_manager_profile_add( name, now - *start );
+  *start = now;
+}
+
+int fuse_init(int argc, char **argv)
 {
   int error, first_arg;
   char *start_scaler;
+  double profile_start;
   start_files_t start_files;
 
   /* Seed the bad but widely-available random number
@@ -381,6 +430,7 @@ static int fuse_init(int argc, char **argv)
   else
     fuse_progname = "fuse";
   
+  ui_error_init();
   libspectrum_error_function = ui_libspectrum_error;
 
 #ifdef GEKKO
@@ -405,15 +455,23 @@ static int fuse_init(int argc, char **argv)
 
   if( run_startup_manager( &argc, &argv ) ) return 1;
 
+  profile_start = compat_timer_get_time();
+
   error = machine_select_id( settings_current.start_machine );
   if( error ) return error;
+  profile_step( "machine_select", &profile_start );
 
   error = scaler_select_id( start_scaler ); libspectrum_free( start_scaler );
   if( error ) return error;
+  profile_step( "scaler_select", &profile_start );
 
   if( setup_start_files( &start_files ) ) return 1;
   if( parse_nonoption_args( argc, argv, first_arg, &start_files ) ) return 1;
   if( do_start_files( &start_files ) ) return 1;
+  if( !start_files_given( &start_files ) ) session_resume();
+  profile_step( "start_files", &profile_start );
+
+  startup_manager_profile_report();
 
   /* Must do this after all subsytems are initialised */
   debugger_command_evaluate( settings_current.debugger_command );
@@ -423,6 +481,10 @@ static int fuse_init(int argc, char **argv)
   fuse_emulation_paused = 0;
   movie_init();
 
+  /* Left until now so the threads the modules have started don't
+     inherit it */
+  thread_sched_apply( THREAD_SCHED_EMULATION );
+
   return 0;
 }
 
@@ -791,6 +853,27 @@ parse_nonoption_args( int argc, char **argv, int first_arg,
   return 0;
 }
 
+/* Was a machine state or removable media asked for on the command
+   line or in the configuration? If not, the last session can be
+   resumed */
+static int
+start_files_given( start_files_t *start_files )
+{
+  size_t i;
+
+  if( start_files->disk_plus3 || start_files->disk_opus ||
+      start_files->disk_plusd || start_files->disk_beta ||
+      start_files->disk_didaktik80 || start_files->disk_disciple ||
+      start_files->dock || start_files->if2 || start_files->playback ||
+      start_files->recording || start_files->snapshot || start_files->tape )
+    return 1;
+
+  for( i = 0; i < ARRAY_SIZE( start_files->mdr ); i++ )
+    if( start_files->mdr[i] ) return 1;
+
+  return 0;
+}
+
 static int
 do_start_files( start_files_t *start_files )
 {
@@ -974,10 +1057,13 @@ do_start_files( start_files_t *start_files )
 }
 
 /* Tidy-up function called at end of emulation */
-static int fuse_end(void)
+int fuse_end(void)
 {
   movie_stop();		/* stop movie recording */
 
+  /* Only a session the user chose to leave is worth coming back to */
+  if( fuse_exiting ) session_save();
+
   startup_manager_run_end();
 
   periph_end();
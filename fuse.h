@@ -38,9 +38,10 @@ extern int fuse_emulation_paused;	/* Is Spectrum emulation paused? */
 int fuse_emulation_pause(void);		/* Stop and start emulation */
 int fuse_emulation_unpause(void);
 
-#ifdef UI_WIN32
-int fuse_main(int argc, char **argv);
-#endif
+int fuse_main(int argc, char **argv);	/* What main() calls */
+
+int fuse_init(int argc, char **argv);	/* Start up everything */
+int fuse_end(void);			/* And shut it all down again */
 
 void fuse_abort( void ) GCC_NORETURN;	/* Emergency shutdown */
 
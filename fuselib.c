@@ -0,0 +1,142 @@
+/* fuselib.c: Driving the emulation from another program
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "fuse.h"
+#include "fuselib.h"
+#include "machine.h"
+#include "settings.h"
+#include "sound.h"
+#include "spectrum.h"
+#include "utils.h"
+#include "z80/z80.h"
+
+int fuselib_active = 0;
+
+#ifdef FUSE_LIBRARY
+
+libspectrum_byte
+  fuselib_image[ 2 * DISPLAY_SCREEN_HEIGHT ][ DISPLAY_SCREEN_WIDTH ];
+
+static libspectrum_dword frames_done;
+
+static void
+fuselib_frame_end( void )
+{
+  frames_done++;
+}
+
+int
+fuselib_init( int argc, char **argv )
+{
+  if( fuse_init( argc, argv ) ) return 1;
+
+  /* Nothing is listening, so don't spend time making sound; this also
+     stops the timer pacing the frames to the sound device */
+  sound_end();
+  settings_current.sound = 0;
+
+  frames_done = 0;
+
+  return 0;
+}
+
+int
+fuselib_load( const char *filename )
+{
+  return utils_open_file( filename, settings_current.auto_load, NULL );
+}
+
+void
+fuselib_key( keyboard_key_name key, int pressed )
+{
+  if( pressed ) {
+    keyboard_press( key );
+  } else {
+    keyboard_release( key );
+  }
+}
+
+void
+fuselib_joystick( int which, joystick_button button, int pressed )
+{
+  joystick_press( which, button, pressed );
+}
+
+int
+fuselib_frame( void )
+{
+  libspectrum_dword target = frames_done + 1;
+
+  fuselib_active = 1;
+  spectrum_frame_subscribe( fuselib_frame_end );
+
+  while( !fuse_exiting && frames_done < target ) {
+    z80_do_opcodes();
+    event_do_events();
+  }
+
+  spectrum_frame_unsubscribe( fuselib_frame_end );
+  fuselib_active = 0;
+
+  return fuse_exiting;
+}
+
+libspectrum_dword
+fuselib_frames( void )
+{
+  return frames_done;
+}
+
+const libspectrum_byte*
+fuselib_ram_page( int page )
+{
+  if( page < 0 || page >= machine_current->ram.valid_pages ) return NULL;
+  return RAM[ page ];
+}
+
+const libspectrum_byte*
+fuselib_screen( int *width, int *height, int *pitch )
+{
+  int scale = machine_current->timex ? 2 : 1;
+
+  *width = scale * DISPLAY_ASPECT_WIDTH;
+  *height = scale * DISPLAY_SCREEN_HEIGHT;
+  *pitch = DISPLAY_SCREEN_WIDTH;
+
+  return &fuselib_image[0][0];
+}
+
+void
+fuselib_end( void )
+{
+  fuse_end();
+}
+
+#endif				/* #ifdef FUSE_LIBRARY */
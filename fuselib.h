@@ -0,0 +1,81 @@
+/* fuselib.h: Driving the emulation from another program
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_FUSELIB_H
+#define FUSE_FUSELIB_H
+
+#include <libspectrum.h>
+
+#include "display.h"
+#include "keyboard.h"
+#include "peripherals/joystick.h"
+
+/* Non-zero while fuselib_frame() is running the emulation */
+extern int fuselib_active;
+
+/* Only available from a build configured with --enable-library (which
+   also needs --with-null-ui); the program links against libfuse.a in
+   place of fuse's own main() */
+
+#ifdef FUSE_LIBRARY
+
+/* Start the emulation as `fuse' would with the same arguments, but
+   without sound. Returns non-zero on error */
+int fuselib_init( int argc, char **argv );
+
+/* Open a snapshot, tape, disk or other file as if given on the command
+   line or via File/Open. Returns non-zero on error */
+int fuselib_load( const char *filename );
+
+/* Press or release a Spectrum key, or a button on emulated joystick
+   `which' (0 or 1); inputs stay as set until changed */
+void fuselib_key( keyboard_key_name key, int pressed );
+void fuselib_joystick( int which, joystick_button button, int pressed );
+
+/* Run the emulation flat out until the end of the next frame. Returns
+   non-zero on error, or if the emulation has asked to exit */
+int fuselib_frame( void );
+
+/* The number of frames emulated since fuselib_init() */
+libspectrum_dword fuselib_frames( void );
+
+/* The 16Kb RAM page `page', or NULL if there's no such page */
+const libspectrum_byte* fuselib_ram_page( int page );
+
+/* The screen as it stands after the last frame, one byte per pixel
+   holding a Spectrum colour (0-7, or 8-15 if bright). Each row is
+   `*pitch' bytes long; `*width' and `*height' are 320x240, or 640x480
+   for a Timex machine */
+const libspectrum_byte* fuselib_screen( int *width, int *height,
+                                        int *pitch );
+
+/* Shut everything down again */
+void fuselib_end( void );
+
+/* Where the null UI draws the screen for fuselib_screen() */
+extern libspectrum_byte
+  fuselib_image[ 2 * DISPLAY_SCREEN_HEIGHT ][ DISPLAY_SCREEN_WIDTH ];
+
+#endif				/* #ifdef FUSE_LIBRARY */
+
+#endif				/* #ifndef FUSE_FUSELIB_H */
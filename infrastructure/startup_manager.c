@@ -27,11 +27,84 @@
 #include <glib.h>
 #endif				/* #ifdef HAVE_LIB_GLIB */
 
+#include <stdio.h>
+
 #include <libspectrum.h>
 
+#include "compat.h"
+#include "settings.h"
 #include "startup_manager.h"
 #include "ui/ui.h"
 
+/* Must be kept in the same order as startup_manager_module */
+static const char * const module_names[] = {
+  "ay",
+  "beta",
+  "config_write",
+  "covox",
+  "creator",
+  "debugger",
+  "didaktik",
+  "disciple",
+  "display",
+  "divide",
+  "divmmc",
+  "event",
+  "fdd",
+  "frametime",
+  "fuller",
+  "if1",
+  "if2",
+  "input",
+  "joystick",
+  "kempmouse",
+  "keyboard",
+  "library",
+  "libspectrum",
+  "libxml2",
+  "machine",
+  "machines_periph",
+  "melodik",
+  "memory",
+  "mempool",
+  "multiface",
+  "netplay",
+  "opus",
+  "phantom_typist",
+  "plusd",
+  "printer",
+  "profile",
+  "psg",
+  "rewind",
+  "runahead",
+  "rzx",
+  "scld",
+  "screenshot",
+  "settings_end",
+  "setuid",
+  "simpleide",
+  "slt",
+  "sound",
+  "speccyboot",
+  "specdrum",
+  "spectranet",
+  "spectrum",
+  "tape",
+  "ttx2000s",
+  "timer",
+  "ula",
+  "usource",
+  "z80",
+  "zip",
+  "zxatasp",
+  "zxcf",
+  "zxmmc",
+#ifdef GCWZERO
+  "control_mapping_end",
+  "savestates",
+#endif
+};
+
 typedef struct registered_module_t {
   startup_manager_module module;
   GArray *dependencies;
@@ -44,6 +117,66 @@ static GArray *registered_modules;
 
 static GArray *end_functions;
 
+/* How long each step of startup took, for --startup-profile */
+typedef struct profile_entry_t {
+  const char *name;
+  double seconds;
+} profile_entry_t;
+
+static GArray *profile_entries;
+
+void
+startup_manager_profile_add( const char *name, double seconds )
+{
+  profile_entry_t entry;
+
+  if( !settings_current.startup_profile ) return;
+
+  if( !profile_entries )
+    profile_entries = g_array_new( FALSE, FALSE, sizeof( profile_entry_t ) );
+
+  entry.name = name;
+  entry.seconds = seconds;
+  g_array_append_val( profile_entries, entry );
+}
+
+void
+startup_manager_profile_report( void )
+{
+  double total = 0;
+  guint i;
+
+  if( !profile_entries ) return;
+
+  for( i = 0; i < profile_entries->len; i++ ) {
+    profile_entry_t *entry =
+      &g_array_index( profile_entries, profile_entry_t, i );
+    printf( "startup_%s_ms: %.1f\n", entry->name, entry->seconds * 1000 );
+    total += entry->seconds;
+  }
+  printf( "startup_total_ms: %.1f\n", total * 1000 );
+
+  g_array_free( profile_entries, TRUE );
+  profile_entries = NULL;
+}
+
+static int
+run_init( registered_module_t *registered_module )
+{
+  double start = 0;
+  int error;
+
+  if( settings_current.startup_profile ) start = compat_timer_get_time();
+
+  error = registered_module->init_fn( registered_module->init_context );
+
+  if( settings_current.startup_profile && start >= 0 )
+    startup_manager_profile_add( module_names[ registered_module->module ],
+                                 compat_timer_get_time() - start );
+
+  return error;
+}
+
 void
 startup_manager_init( void )
 {
@@ -135,9 +268,7 @@ startup_manager_run( void )
       if( registered_module->dependencies->len == 0 ) {
 
         if( registered_module->init_fn ) {
-          error = registered_module->init_fn(
-            registered_module->init_context
-          );
+          error = run_init( registered_module );
           if( error ) return error;
         }
 
@@ -24,11 +24,13 @@
 #ifndef FUSE_STARTUP_MANAGER_H
 #define FUSE_STARTUP_MANAGER_H
 
-/* The modules the startup manager knows about */
+/* The modules the startup manager knows about; their names for
+   --startup-profile are in startup_manager.c */
 typedef enum startup_manager_module {
 
   STARTUP_MANAGER_MODULE_AY,
   STARTUP_MANAGER_MODULE_BETA,
+  STARTUP_MANAGER_MODULE_CONFIG_WRITE,
   STARTUP_MANAGER_MODULE_COVOX,
   STARTUP_MANAGER_MODULE_CREATOR,
   STARTUP_MANAGER_MODULE_DEBUGGER,
@@ -39,12 +41,15 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_DIVMMC,
   STARTUP_MANAGER_MODULE_EVENT,
   STARTUP_MANAGER_MODULE_FDD,
+  STARTUP_MANAGER_MODULE_FRAMETIME,
   STARTUP_MANAGER_MODULE_FULLER,
   STARTUP_MANAGER_MODULE_IF1,
   STARTUP_MANAGER_MODULE_IF2,
+  STARTUP_MANAGER_MODULE_INPUT,
   STARTUP_MANAGER_MODULE_JOYSTICK,
   STARTUP_MANAGER_MODULE_KEMPMOUSE,
   STARTUP_MANAGER_MODULE_KEYBOARD,
+  STARTUP_MANAGER_MODULE_LIBRARY,
   STARTUP_MANAGER_MODULE_LIBSPECTRUM,
   STARTUP_MANAGER_MODULE_LIBXML2,
   STARTUP_MANAGER_MODULE_MACHINE,
@@ -53,20 +58,25 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_MEMORY,
   STARTUP_MANAGER_MODULE_MEMPOOL,
   STARTUP_MANAGER_MODULE_MULTIFACE,
+  STARTUP_MANAGER_MODULE_NETPLAY,
   STARTUP_MANAGER_MODULE_OPUS,
   STARTUP_MANAGER_MODULE_PHANTOM_TYPIST,
   STARTUP_MANAGER_MODULE_PLUSD,
   STARTUP_MANAGER_MODULE_PRINTER,
   STARTUP_MANAGER_MODULE_PROFILE,
   STARTUP_MANAGER_MODULE_PSG,
+  STARTUP_MANAGER_MODULE_REWIND,
+  STARTUP_MANAGER_MODULE_RUNAHEAD,
   STARTUP_MANAGER_MODULE_RZX,
   STARTUP_MANAGER_MODULE_SCLD,
   STARTUP_MANAGER_MODULE_SCREENSHOT,
   STARTUP_MANAGER_MODULE_SETTINGS_END,
   STARTUP_MANAGER_MODULE_SETUID,
+  STARTUP_MANAGER_MODULE_SHMEXPORT,
   STARTUP_MANAGER_MODULE_SIMPLEIDE,
   STARTUP_MANAGER_MODULE_SLT,
   STARTUP_MANAGER_MODULE_SOUND,
+  STARTUP_MANAGER_MODULE_SOUNDREC,
   STARTUP_MANAGER_MODULE_SPECCYBOOT,
   STARTUP_MANAGER_MODULE_SPECDRUM,
   STARTUP_MANAGER_MODULE_SPECTRANET,
@@ -77,11 +87,13 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_ULA,
   STARTUP_MANAGER_MODULE_USOURCE,
   STARTUP_MANAGER_MODULE_Z80,
+  STARTUP_MANAGER_MODULE_ZIP,
   STARTUP_MANAGER_MODULE_ZXATASP,
   STARTUP_MANAGER_MODULE_ZXCF,
   STARTUP_MANAGER_MODULE_ZXMMC,
 #ifdef GCWZERO
   STARTUP_MANAGER_MODULE_CONTROL_MAPPING_END,
+  STARTUP_MANAGER_MODULE_SAVESTATES,
 #endif
 
 } startup_manager_module;
@@ -112,4 +124,11 @@ int startup_manager_run( void );
 /* Run all the end functions in inverse order of the init functions */
 void startup_manager_run_end( void );
 
+/* With --startup-profile, note that the startup step `name', which must
+   not be freed, took `seconds' */
+void startup_manager_profile_add( const char *name, double seconds );
+
+/* Print how long each step of startup took and forget about them */
+void startup_manager_profile_report( void );
+
 #endif				/* #ifndef FUSE_STARTUP_MANAGER_H */
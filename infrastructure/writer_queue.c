@@ -0,0 +1,281 @@
+/* writer_queue.c: write files out on a background thread
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * Recordings, savestates, screenshots and configuration files are all
+ * written out away from the emulation: the main thread hands over a
+ * job and carries on, a writer thread does the slow part, and anything
+ * which has to be reported is passed back to the main thread when it
+ * next looks. Each user has a queue, and so a thread, of its own.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "fuse.h"
+#include "thread_sched.h"
+#include "writer_queue.h"
+
+#ifdef HAVE_PTHREAD
+
+typedef struct writer_queue_entry {
+  void *job;
+  size_t size;
+  struct writer_queue_entry *next;
+} writer_queue_entry;
+
+struct writer_queue {
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  writer_queue_write_fn write_fn;
+  writer_queue_done_fn done_fn;
+  size_t limit;
+
+  /* Everything below is protected by the mutex */
+  int quit;
+
+  /* The jobs waiting to be written, oldest first */
+  writer_queue_entry *head, *tail;
+
+  /* The size of the jobs waiting or being written */
+  size_t queued;
+  int busy;
+
+  /* The jobs written but not yet passed to the done function */
+  writer_queue_entry *done_head, *done_tail;
+
+};
+
+static void*
+writer_queue_thread_fn( void *arg )
+{
+  writer_queue *queue = arg;
+  writer_queue_entry *entry;
+
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+  pthread_mutex_lock( &queue->mutex );
+
+  while( 1 ) {
+
+    while( !queue->head && !queue->quit )
+      pthread_cond_wait( &queue->cond, &queue->mutex );
+
+    /* Write everything we've been given before quitting */
+    if( !queue->head ) break;
+
+    entry = queue->head;
+    queue->head = entry->next;
+    if( !queue->head ) queue->tail = NULL;
+    queue->busy = 1;
+
+    pthread_mutex_unlock( &queue->mutex );
+
+    queue->write_fn( entry->job );
+
+    pthread_mutex_lock( &queue->mutex );
+
+    queue->busy = 0;
+    queue->queued -= entry->size;
+
+    if( queue->done_fn ) {
+      entry->next = NULL;
+      if( queue->done_tail ) queue->done_tail->next = entry;
+      else queue->done_head = entry;
+      queue->done_tail = entry;
+    } else {
+      libspectrum_free( entry );
+    }
+
+    pthread_cond_broadcast( &queue->cond );
+  }
+
+  pthread_mutex_unlock( &queue->mutex );
+
+  return NULL;
+}
+
+writer_queue*
+writer_queue_start( const char *name, writer_queue_write_fn write_fn,
+                    writer_queue_done_fn done_fn, size_t limit )
+{
+  writer_queue *queue = libspectrum_new0( writer_queue, 1 );
+
+  queue->write_fn = write_fn;
+  queue->done_fn = done_fn;
+  queue->limit = limit;
+  pthread_mutex_init( &queue->mutex, NULL );
+  pthread_cond_init( &queue->cond, NULL );
+
+  if( pthread_create( &queue->thread, NULL, writer_queue_thread_fn,
+                      queue ) ) {
+    fprintf( stderr, "%s: couldn't start %s writer thread\n", fuse_progname,
+             name );
+    pthread_cond_destroy( &queue->cond );
+    pthread_mutex_destroy( &queue->mutex );
+    libspectrum_free( queue );
+    return NULL;
+  }
+
+  return queue;
+}
+
+int
+writer_queue_push( writer_queue *queue, void *job, size_t size, int wait )
+{
+  writer_queue_entry *entry;
+
+  pthread_mutex_lock( &queue->mutex );
+
+  /* A job bigger than the limit still goes in once the queue is empty */
+  while( queue->limit && queue->queued &&
+         queue->queued + size > queue->limit ) {
+    if( !wait ) {
+      pthread_mutex_unlock( &queue->mutex );
+      return 1;
+    }
+    pthread_cond_wait( &queue->cond, &queue->mutex );
+  }
+
+  entry = libspectrum_new( writer_queue_entry, 1 );
+  entry->job = job;
+  entry->size = size;
+  entry->next = NULL;
+
+  if( queue->tail ) queue->tail->next = entry; else queue->head = entry;
+  queue->tail = entry;
+  queue->queued += size;
+
+  pthread_cond_broadcast( &queue->cond );
+  pthread_mutex_unlock( &queue->mutex );
+
+  return 0;
+}
+
+/* Pass each of `entry' and those after it to `done_fn', freeing them */
+static void
+writer_queue_finish( writer_queue_entry *entry, writer_queue_done_fn done_fn )
+{
+  writer_queue_entry *next;
+
+  for( ; entry; entry = next ) {
+    next = entry->next;
+    done_fn( entry->job );
+    libspectrum_free( entry );
+  }
+}
+
+void
+writer_queue_poll( writer_queue *queue )
+{
+  writer_queue_entry *done;
+
+  if( !queue->done_fn ) return;
+
+  pthread_mutex_lock( &queue->mutex );
+  done = queue->done_head;
+  queue->done_head = queue->done_tail = NULL;
+  pthread_mutex_unlock( &queue->mutex );
+
+  writer_queue_finish( done, queue->done_fn );
+}
+
+void
+writer_queue_wait( writer_queue *queue )
+{
+  pthread_mutex_lock( &queue->mutex );
+  while( queue->head || queue->busy )
+    pthread_cond_wait( &queue->cond, &queue->mutex );
+  pthread_mutex_unlock( &queue->mutex );
+
+  writer_queue_poll( queue );
+}
+
+void
+writer_queue_stop( writer_queue *queue, writer_queue_done_fn discard_fn )
+{
+  pthread_mutex_lock( &queue->mutex );
+  queue->quit = 1;
+  pthread_cond_broadcast( &queue->cond );
+  pthread_mutex_unlock( &queue->mutex );
+
+  pthread_join( queue->thread, NULL );
+
+  if( queue->done_fn )
+    writer_queue_finish( queue->done_head,
+                         discard_fn ? discard_fn : queue->done_fn );
+
+  pthread_cond_destroy( &queue->cond );
+  pthread_mutex_destroy( &queue->mutex );
+  libspectrum_free( queue );
+}
+
+#else			/* #ifdef HAVE_PTHREAD */
+
+/* Without threads there's never a queue, so everything is written
+   by whoever asked for it */
+
+writer_queue*
+writer_queue_start( const char *name GCC_UNUSED,
+                    writer_queue_write_fn write_fn GCC_UNUSED,
+                    writer_queue_done_fn done_fn GCC_UNUSED,
+                    size_t limit GCC_UNUSED )
+{
+  return NULL;
+}
+
+int
+writer_queue_push( writer_queue *queue GCC_UNUSED, void *job GCC_UNUSED,
+                   size_t size GCC_UNUSED, int wait GCC_UNUSED )
+{
+  return 1;
+}
+
+void
+writer_queue_poll( writer_queue *queue GCC_UNUSED )
+{
+}
+
+void
+writer_queue_wait( writer_queue *queue GCC_UNUSED )
+{
+}
+
+void
+writer_queue_stop( writer_queue *queue GCC_UNUSED,
+                   writer_queue_done_fn discard_fn GCC_UNUSED )
+{
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
@@ -0,0 +1,68 @@
+/* writer_queue.h: write files out on a background thread
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_WRITER_QUEUE_H
+#define FUSE_WRITER_QUEUE_H
+
+#include <stdlib.h>
+
+typedef struct writer_queue writer_queue;
+
+/* Does the work for one job. Runs on the writer thread, so mustn't
+   touch the UI or the emulation. If the queue has no done function,
+   this must also free the job */
+typedef void (*writer_queue_write_fn)( void *job );
+
+/* Called on the main thread for each job once it has been written, from
+   writer_queue_poll(), writer_queue_wait() or writer_queue_stop(); the
+   job is its to report on and free */
+typedef void (*writer_queue_done_fn)( void *job );
+
+/* Start a writer thread for jobs done by `write_fn' and then passed to
+   `done_fn', which may be NULL. While more than `limit' bytes of jobs
+   are waiting, the queue counts as full; 0 for no limit. Returns NULL
+   if there's no thread to be had, in which case the caller should do
+   its writing itself */
+writer_queue*
+writer_queue_start( const char *name, writer_queue_write_fn write_fn,
+                    writer_queue_done_fn done_fn, size_t limit );
+
+/* Queue `job', of `size' bytes. If the queue is full, either wait for
+   it to drain or, if `wait' isn't set, return non-zero without queuing
+   the job. May be called from any thread */
+int writer_queue_push( writer_queue *queue, void *job, size_t size,
+                       int wait );
+
+/* Pass any jobs which have been written to the done function */
+void writer_queue_poll( writer_queue *queue );
+
+/* Wait for every queued job to be written, then poll */
+void writer_queue_wait( writer_queue *queue );
+
+/* Write everything still queued and stop the thread. Jobs which haven't
+   been polled are passed to `discard_fn' if it's given, or the done
+   function otherwise. Frees the queue */
+void writer_queue_stop( writer_queue *queue,
+                        writer_queue_done_fn discard_fn );
+
+#endif			/* #ifndef FUSE_WRITER_QUEUE_H */
@@ -23,16 +23,68 @@
 
 #include <config.h>
 
+#include "compat.h"
+#include "event.h"
 #include "fuse.h"
+#include "infrastructure/startup_manager.h"
 #include "input.h"
 #include "keyboard.h"
+#include "machine.h"
 #include "peripherals/joystick.h"
+#include "runahead.h"
+#include "rzx.h"
 #include "settings.h"
 #include "snapshot.h"
 #include "tape.h"
 #include "ui/ui.h"
+#include "ui/uijoystick.h"
 #include "utils.h"
 
+/* Has input been read part way through this frame? */
+static int late_polled = 0;
+
+/* Non-zero while input is being read or applied part way through a
+   frame; the emulation is then in the middle of an instruction or an
+   event, so anything which would hand control to the UI has to wait
+   until the end of the frame */
+static int mid_frame = 0;
+
+#define INPUT_DEFERRED_MAX 16
+
+typedef struct input_deferred_t {
+  int popup;			/* Just pass `native_key' to ui_popup_menu()? */
+  input_event_t event;
+} input_deferred_t;
+
+static input_deferred_t deferred[ INPUT_DEFERRED_MAX ];
+static size_t deferred_count = 0;
+
+/* With --timed-input, the events received during each frame, stamped
+   with when they (probably) happened */
+#define INPUT_TIMED_MAX 64
+
+typedef struct input_timed_t {
+  input_event_t event;
+  double time;
+  libspectrum_dword tstates;	/* When to deliver it in the next frame */
+} input_timed_t;
+
+static input_timed_t received[ INPUT_TIMED_MAX ];
+static size_t received_count = 0;
+
+/* Those from the last frame, being delivered during this one */
+static input_timed_t due[ INPUT_TIMED_MAX ];
+static size_t due_count = 0, due_next = 0;
+
+/* When input was last read, and when the last frame ended */
+static double last_poll_time = -1, last_frame_time = -1;
+
+static int input_timed_event;
+
+static void defer( const input_event_t *event, int popup );
+static int apply_event( const input_event_t *event );
+static void polled( void );
+static void popup_menu( int native_key );
 static int keypress( const input_event_key_t *event );
 static int keyrelease( const input_event_key_t *event );
 static int do_joystick( const input_event_joystick_t *joystick_event,
@@ -296,7 +348,42 @@ input_event_gcw0( const input_event_t *event ) {
 int
 input_event( const input_event_t *event )
 {
+  int ui_active = 0;
+
+#ifdef USE_WIDGET
+  ui_active = ui_widget_level >= 0;
+#endif
+#if VKEYBOARD
+  ui_active = ui_active || vkeyboard_enabled;
+#endif
+
+  if( mid_frame && ui_active ) {
+    defer( event, 0 );
+    return 0;
+  }
+
+  if( settings_current.timed_input && !ui_active && !rzx_playback &&
+      received_count < INPUT_TIMED_MAX ) {
+    double now = compat_timer_get_time();
+
+    if( now >= 0 ) {
+      received[ received_count ].event = *event;
+
+      /* It happened some time since input was last read */
+      received[ received_count ].time =
+        last_poll_time >= 0 ? ( last_poll_time + now ) / 2 : now;
+
+      received_count++;
+      return 0;
+    }
+  }
 
+  return apply_event( event );
+}
+
+static int
+apply_event( const input_event_t *event )
+{
 #ifdef GCWZERO
   if ( !input_event_gcw0(event) ) return 0;
 #endif
@@ -540,7 +627,7 @@ keypress( const input_event_key_t *event )
     send_keyboard_press( event->spectrum_key );
   }
 
-  ui_popup_menu( event->native_key );
+  popup_menu( event->native_key );
 
   return 0;
 }
@@ -653,7 +740,7 @@ do_joystick( const input_event_joystick_t *joystick_event, int press )
 #ifndef GEKKO /* Home button opens the menu on Wii */
   switch( joystick_event->button ) {
   case INPUT_JOYSTICK_FIRE_2:
-    if( press ) ui_popup_menu( INPUT_KEY_F1 );
+    if( press ) popup_menu( INPUT_KEY_F1 );
     break;
 
   default: break;		/* Remove gcc warning */
@@ -704,3 +791,177 @@ do_joystick( const input_event_joystick_t *joystick_event, int press )
 
   return 0;
 }
+
+static void
+defer( const input_event_t *event, int popup )
+{
+  if( deferred_count == INPUT_DEFERRED_MAX ) return;
+
+  deferred[ deferred_count ].popup = popup;
+  deferred[ deferred_count ].event = *event;
+  deferred_count++;
+}
+
+static void
+popup_menu( int native_key )
+{
+  input_event_t event;
+
+  if( !mid_frame ) {
+    ui_popup_menu( native_key );
+    return;
+  }
+
+  event.type = INPUT_EVENT_KEYPRESS;
+  event.types.key.native_key = native_key;
+  event.types.key.spectrum_key = INPUT_KEY_NONE;
+  defer( &event, 1 );
+}
+
+void
+input_poll_late( void )
+{
+  if( !settings_current.late_input || late_polled ) return;
+  late_polled = 1;
+
+  /* Frames run ahead must see the same input as the real frame, and a
+     recording being played back brings its own */
+  if( runahead_active || rzx_playback ) return;
+
+  mid_frame = 1;
+  ui_joystick_poll();
+  ui_event_input();
+  mid_frame = 0;
+
+  polled();
+}
+
+void
+input_poll_idle( void )
+{
+  if( !settings_current.timed_input || rzx_playback ) return;
+
+  mid_frame = 1;
+  ui_joystick_poll();
+  ui_event_input();
+  mid_frame = 0;
+
+  polled();
+}
+
+static void
+polled( void )
+{
+  double now = compat_timer_get_time();
+  if( now >= 0 ) last_poll_time = now;
+}
+
+/* Deliver every timed event due by `tstates' */
+static void
+deliver_due( libspectrum_dword tstates )
+{
+  mid_frame = 1;
+  while( due_next < due_count && due[ due_next ].tstates <= tstates )
+    apply_event( &due[ due_next++ ].event );
+  mid_frame = 0;
+}
+
+static void
+input_timed_event_fn( libspectrum_dword last_tstates, int type,
+                      void *user_data )
+{
+  /* Frames run ahead use the input as it is at the start of the frame */
+  if( runahead_active ) return;
+
+  deliver_due( last_tstates );
+}
+
+/* Spread the events received during the last frame over the next one,
+   at the same points they came in relative to the frame's start */
+static void
+schedule_received( void )
+{
+  libspectrum_dword frame_length = machine_current->timings.tstates_per_frame;
+  double now, length;
+  size_t i;
+
+  now = compat_timer_get_time();
+
+  /* Anything still to come from the last frame (say, if the machine was
+     reset) goes in now */
+  deliver_due( (libspectrum_dword)-1 );
+  due_count = due_next = 0;
+
+  if( now < 0 || last_frame_time < 0 || now <= last_frame_time ) {
+    for( i = 0; i < received_count; i++ ) apply_event( &received[i].event );
+    received_count = 0;
+    if( now >= 0 ) last_frame_time = now;
+    return;
+  }
+
+  length = now - last_frame_time;
+
+  for( i = 0; i < received_count; i++ ) {
+    double position = ( received[i].time - last_frame_time ) / length;
+
+    if( position < 0 ) position = 0;
+    if( position > 1 ) position = 1;
+
+    due[i] = received[i];
+    due[i].tstates = position * ( frame_length - 1 );
+
+    /* The events arrive in order, so only the first of each run needs
+       an event of its own */
+    if( !i || due[i].tstates != due[i - 1].tstates )
+      event_add( due[i].tstates, input_timed_event );
+  }
+
+  due_count = received_count;
+  received_count = 0;
+  last_frame_time = now;
+}
+
+void
+input_frame( void )
+{
+  size_t i, count = deferred_count;
+
+  late_polled = 0;
+  deferred_count = 0;
+
+  for( i = 0; i < count; i++ ) {
+    if( deferred[i].popup ) {
+      ui_popup_menu( deferred[i].event.types.key.native_key );
+    } else {
+      input_event( &deferred[i].event );
+    }
+  }
+
+  polled();
+
+  if( settings_current.timed_input || received_count || due_count ) {
+    schedule_received();
+  } else {
+    last_frame_time = -1;
+  }
+}
+
+static int
+input_init( void *context )
+{
+  input_timed_event = event_register( input_timed_event_fn, "Timed input" );
+
+  return 0;
+}
+
+void
+input_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_EVENT,
+    STARTUP_MANAGER_MODULE_SETUID,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_INPUT, dependencies,
+                            ARRAY_SIZE( dependencies ), input_init, NULL,
+                            NULL );
+}
@@ -243,4 +243,19 @@ typedef struct input_event_t {
 
 int input_event( const input_event_t *event );
 
+/* Called when the emulated machine reads the keyboard or a joystick; with
+   --late-input, reads the host's input the first time this happens in
+   each frame rather than leaving it until the end of the frame */
+void input_poll_late( void );
+
+/* Called at the end of every frame, once the input has been read as
+   normal */
+void input_frame( void );
+
+/* Called while waiting for the next frame; with --timed-input, reads the
+   host's input so it can be given a more accurate time */
+void input_poll_idle( void );
+
+void input_register_startup( void );
+
 #endif			/* #ifndef FUSE_INPUT_H */
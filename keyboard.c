@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #ifdef HAVE_LIB_GLIB
 #include <glib.h>
 #endif				/* #ifdef HAVE_LIB_GLIB */
@@ -31,6 +33,7 @@
 
 #include "infrastructure/startup_manager.h"
 #include "keyboard.h"
+#include "netplay.h"
 #include "ui/ui.h"
 
 /* Bit masks for each of the eight keyboard half-rows; `AND' the selected
@@ -38,6 +41,11 @@
 */
 libspectrum_byte keyboard_return_values[8];
 
+/* What keyboard_read() returns for each high byte of the port, worked
+   out when first needed; anything over 0xff hasn't been yet. Forgotten
+   whenever a key is pressed or released */
+static libspectrum_word read_cache[256];
+
 /* The hash used for storing the UI -> Fuse input layer key mappings */
 static GHashTable *keysyms_hash;
 
@@ -325,17 +333,41 @@ keyboard_register_startup( void )
                             keyboard_end, NULL );
 }
 
-libspectrum_byte
-keyboard_read( libspectrum_byte porth )
+static void
+read_cache_clear( void )
+{
+  memset( read_cache, 0xff, sizeof( read_cache ) );
+}
+
+static libspectrum_byte
+read_half_rows( const libspectrum_byte *values, libspectrum_byte porth )
 {
   libspectrum_byte data = 0xff; int i;
 
   for( i=0; i<8; i++,porth>>=1 ) {
-    if(! (porth&0x01) ) data &= keyboard_return_values[i];
+    if(! (porth&0x01) ) data &= values[i];
   }
 
   return data;
+}
 
+libspectrum_byte
+keyboard_read( libspectrum_byte porth )
+{
+  libspectrum_word cached;
+
+  /* The other player's keys change every frame, so aren't worth
+     remembering */
+  if( netplay_active )
+    return read_half_rows( netplay_machine_input.keyboard, porth );
+
+  cached = read_cache[ porth ];
+  if( cached > 0xff ) {
+    cached = read_half_rows( keyboard_return_values, porth );
+    read_cache[ porth ] = cached;
+  }
+
+  return cached;
 }
 
 void
@@ -345,7 +377,10 @@ keyboard_press( keyboard_key_name key )
 
   ptr = g_hash_table_lookup( keyboard_data, &key );
 
-  if( ptr ) keyboard_return_values[ ptr->port ] &= ~( ptr->bit );
+  if( ptr ) {
+    keyboard_return_values[ ptr->port ] &= ~( ptr->bit );
+    read_cache_clear();
+  }
 }
 
 void
@@ -355,7 +390,10 @@ keyboard_release( keyboard_key_name key )
 
   ptr = g_hash_table_lookup( keyboard_data, &key );
 
-  if( ptr ) keyboard_return_values[ ptr->port ] |= ptr->bit;
+  if( ptr ) {
+    keyboard_return_values[ ptr->port ] |= ptr->bit;
+    read_cache_clear();
+  }
 }
 
 int keyboard_release_all( void )
@@ -363,6 +401,7 @@ int keyboard_release_all( void )
   int i;
 
   for( i=0; i<8; i++ ) keyboard_return_values[i] = 0xff;
+  read_cache_clear();
 
   return 0;
 }
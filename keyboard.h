@@ -29,6 +29,9 @@
 #include "input.h"
 
 extern libspectrum_byte keyboard_default_value;
+/* Which keys are down in each half-row; change only through
+   keyboard_press(), keyboard_release() and keyboard_release_all(), which
+   keep keyboard_read()'s cache up to date */
 extern libspectrum_byte keyboard_return_values[8];
 
 /* A numeric identifier for each Spectrum key. Chosen to map to ASCII in
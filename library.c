@@ -0,0 +1,783 @@
+/* library.c: Index of the games in the library directories
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * Finding a game by walking the file selector through a collection of
+ * tens of thousands of files is slow, so the library directories
+ * (settings_current.library_directories, or the current directory if
+ * that's not set) are crawled once a session on a background thread,
+ * noting what each Spectrum file is, the machine it needs, its size and,
+ * for snapshots, a thumbnail of the screen. Everything found is kept in
+ * one file, "library.dat" in the configuration directory, so the library
+ * can be searched straight away next time while the crawl just looks for
+ * files which have been added, changed or removed since.
+ *
+ * The database is "FLIB", a dword version (1) and a dword count of
+ * entries. Each entry is a word length and then the path, the file's
+ * size and mtime as dwords, its class as a byte, its type as a word, the
+ * machine as a byte, then a flags byte; if bit 0 of that is set, the
+ * thumbnail follows.
+ */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_STRCASECMP
+#include <strings.h>
+#endif      /* #ifdef HAVE_STRINGS_STRCASECMP */
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "library.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "thread_sched.h"
+#include "utils.h"
+
+#define LIBRARY_DATABASE "library.dat"
+#define LIBRARY_VERSION 1
+
+#define LIBRARY_FLAG_THUMBNAIL 0x01
+
+#ifdef WIN32
+#define LIBRARY_DIRECTORY_SEPARATOR ';'
+#else
+#define LIBRARY_DIRECTORY_SEPARATOR ':'
+#endif
+
+/* Don't go further down than this, which also stops symlink loops */
+#define LIBRARY_MAX_DEPTH 8
+
+/* Anything bigger than this is a hard disk image or not a Spectrum file
+   at all; it's noted, but not read */
+#define LIBRARY_MAX_LENGTH ( 4 * 1024 * 1024 )
+
+/* How nice the crawling thread is, where that can be set for one thread */
+#define LIBRARY_NICENESS 19
+
+/* Only files with these extensions are looked at, as reading everything
+   in a home directory would take far too long */
+static const char * const library_extensions[] = {
+  ".csw", ".d40", ".d80", ".dck", ".dsk", ".fdi", ".img", ".ltp", ".mdr",
+  ".mgt", ".mgtsnp", ".opd", ".opu", ".pzx", ".rzx", ".sad", ".scl",
+  ".slt", ".sna", ".snp", ".sp", ".spc", ".sta", ".szx", ".tap", ".td0",
+  ".trd", ".tzx", ".udi", ".z80", ".zx-state", ".zxs", NULL
+};
+
+/* What's in the library, in no particular order. The array and the
+   counts belong to whoever holds `library_mutex'; the entries themselves
+   don't change once they're in here */
+static library_entry **entries = NULL;
+static size_t entry_count = 0, entry_allocated = 0;
+
+/* Entries which have been replaced or removed, kept until library_end()
+   in case a search is still pointing at them */
+static library_entry **retired = NULL;
+static size_t retired_count = 0, retired_allocated = 0;
+
+static unsigned long generation = 0;
+
+static int updating = 0;	/* Is a crawl running? */
+static int updated = 0;		/* Has one been started this session? */
+static size_t files_seen = 0;
+
+/* Copied at the start of an update, so the crawl doesn't need to touch
+   anything which belongs to the rest of Fuse */
+static char *directories = NULL;
+static char *database = NULL;
+
+/* Only used by the crawl: where each path is in `entries', plus one, and
+   whether each entry has been found this time */
+static GHashTable *paths = NULL;
+static char *seen = NULL;
+static size_t seen_count = 0;
+
+#ifdef HAVE_PTHREAD
+
+static pthread_t library_thread;
+static pthread_mutex_t library_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int library_running = 0;
+static int library_quit = 0;
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+static void
+library_lock( void )
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &library_mutex );
+#endif
+}
+
+static void
+library_unlock( void )
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock( &library_mutex );
+#endif
+}
+
+/* Should the crawl stop now? */
+static int
+library_stopping( void )
+{
+#ifdef HAVE_PTHREAD
+  int quit;
+
+  library_lock();
+  quit = library_quit;
+  library_unlock();
+
+  return quit;
+#else
+  return 0;
+#endif
+}
+
+static void
+library_entry_free( library_entry *entry )
+{
+  libspectrum_free( entry->path );
+  libspectrum_free( entry->thumbnail );
+  libspectrum_free( entry );
+}
+
+static void
+library_set_path( library_entry *entry, const char *path )
+{
+  const char *name;
+
+  entry->path = utils_safe_strdup( path );
+  name = strrchr( entry->path, FUSE_DIR_SEP_CHR );
+  entry->name = name ? name + 1 : entry->path;
+}
+
+/* Make the thumbnail for `screen'. Each pixel is a 4x4 block of the
+   screen, taking the ink colour if at least half the block is ink */
+static libspectrum_byte*
+library_thumbnail( const libspectrum_byte *screen )
+{
+  libspectrum_byte *thumbnail, attr, colour;
+  int x, y, i, j, count, line;
+
+  thumbnail = libspectrum_new( libspectrum_byte, LIBRARY_THUMBNAIL_LENGTH );
+  memset( thumbnail, 0, LIBRARY_THUMBNAIL_LENGTH );
+
+  for( y = 0; y < LIBRARY_THUMBNAIL_HEIGHT; y++ ) {
+    for( x = 0; x < LIBRARY_THUMBNAIL_WIDTH; x++ ) {
+
+      count = 0;
+      for( j = 0; j < 4; j++ ) {
+        line = y * 4 + j;
+        for( i = 0; i < 4; i++ ) {
+          size_t offset = ( ( line & 0xc0 ) << 5 ) | ( ( line & 0x07 ) << 8 ) |
+                          ( ( line & 0x38 ) << 2 ) | ( ( x * 4 + i ) >> 3 );
+          if( screen[ offset ] & ( 0x80 >> ( ( x * 4 + i ) & 0x07 ) ) )
+            count++;
+        }
+      }
+
+      attr = screen[ 6144 + ( y / 2 ) * 32 + x / 2 ];
+      colour = count >= 8 ? attr & 0x07 : ( attr >> 3 ) & 0x07;
+      if( attr & 0x40 ) colour |= 0x08;
+
+      thumbnail[ ( y * LIBRARY_THUMBNAIL_WIDTH + x ) / 2 ] |=
+        x & 1 ? colour : colour << 4;
+    }
+  }
+
+  return thumbnail;
+}
+
+/* Find out what the file at `path' is. Runs on the crawling thread, so
+   doesn't touch the UI */
+static library_entry*
+library_entry_new( const char *path, const struct stat *info )
+{
+  libspectrum_byte screen[ SNAPSHOT_SCREEN_LENGTH ];
+  library_entry *entry;
+  utils_file file;
+
+  entry = libspectrum_new( library_entry, 1 );
+
+  library_set_path( entry, path );
+  entry->size = info->st_size;
+  entry->mtime = info->st_mtime;
+  entry->class = LIBSPECTRUM_CLASS_UNKNOWN;
+  entry->type = LIBSPECTRUM_ID_UNKNOWN;
+  entry->machine = LIBSPECTRUM_MACHINE_UNKNOWN;
+  entry->thumbnail = NULL;
+
+  if( info->st_size > LIBRARY_MAX_LENGTH ) return entry;
+  if( utils_read_file( path, &file ) ) return entry;
+
+  if( libspectrum_identify_file_with_class( &entry->type, &entry->class,
+                                            path, file.buffer,
+                                            file.length ) ) {
+    entry->class = LIBSPECTRUM_CLASS_UNKNOWN;
+    entry->type = LIBSPECTRUM_ID_UNKNOWN;
+    utils_close_file( &file );
+    return entry;
+  }
+
+  switch( entry->class ) {
+
+  case LIBSPECTRUM_CLASS_SNAPSHOT:
+    if( !snapshot_read_screen_buffer( file.buffer, file.length, path, screen,
+                                      &entry->machine ) )
+      entry->thumbnail = library_thumbnail( screen );
+    break;
+
+  case LIBSPECTRUM_CLASS_DISK_PLUS3:
+    entry->machine = LIBSPECTRUM_MACHINE_PLUS3; break;
+
+  case LIBSPECTRUM_CLASS_DISK_TRDOS:
+    entry->machine = LIBSPECTRUM_MACHINE_PENT; break;
+
+  case LIBSPECTRUM_CLASS_CARTRIDGE_TIMEX:
+    entry->machine = LIBSPECTRUM_MACHINE_TC2068; break;
+
+  default:
+    break;
+
+  }
+
+  utils_close_file( &file );
+
+  return entry;
+}
+
+/* Add `entry' to the library, or put it in place of the entry at
+   `replace' - 1 if that's not zero */
+static void
+library_publish( library_entry *entry, size_t replace )
+{
+  library_lock();
+
+  if( replace ) {
+
+    if( retired_count == retired_allocated ) {
+      retired_allocated = retired_allocated ? 2 * retired_allocated : 64;
+      retired = libspectrum_renew( library_entry*, retired,
+                                   retired_allocated );
+    }
+    retired[ retired_count++ ] = entries[ replace - 1 ];
+    entries[ replace - 1 ] = entry;
+
+  } else {
+
+    if( entry_count == entry_allocated ) {
+      entry_allocated = entry_allocated ? 2 * entry_allocated : 256;
+      entries = libspectrum_renew( library_entry*, entries, entry_allocated );
+    }
+    entries[ entry_count++ ] = entry;
+
+  }
+
+  files_seen++;
+  generation++;
+
+  library_unlock();
+}
+
+/* Note that the entry at `position' - 1 has been found in this crawl */
+static void
+library_mark_seen( size_t position )
+{
+  if( position > seen_count ) {
+    size_t old_count = seen_count;
+    seen_count = entry_allocated;
+    seen = libspectrum_renew( char, seen, seen_count );
+    memset( seen + old_count, 0, seen_count - old_count );
+  }
+  seen[ position - 1 ] = 1;
+}
+
+static int
+library_is_candidate( const char *name )
+{
+  const char *dot, *end;
+  size_t i, length;
+
+  /* Look past any compression to what's inside */
+  end = name + strlen( name );
+  dot = strrchr( name, '.' );
+  if( dot && ( !strcasecmp( dot, ".gz" ) || !strcasecmp( dot, ".bz2" ) ) ) {
+    end = dot;
+    for( dot = end - 1; dot >= name && *dot != '.'; dot-- )
+      ;
+    if( dot < name ) return 0;
+  }
+  if( !dot || dot == name ) return 0;
+
+  length = end - dot;
+  for( i = 0; library_extensions[i]; i++ )
+    if( strlen( library_extensions[i] ) == length &&
+        !strncasecmp( dot, library_extensions[i], length ) )
+      return 1;
+
+  return 0;
+}
+
+/* Look at one file, adding it to the library if it's new or has changed */
+static int
+library_crawl_file( const char *path, const struct stat *info )
+{
+  library_entry *entry;
+  size_t position;
+
+  position = GPOINTER_TO_INT( g_hash_table_lookup( paths, path ) );
+
+  if( position ) {
+    /* Only the crawl changes `entries', so no need to lock to read it */
+    entry = entries[ position - 1 ];
+    library_mark_seen( position );
+    if( entry->size == (libspectrum_dword)info->st_size &&
+        entry->mtime == (libspectrum_dword)info->st_mtime ) {
+      library_lock(); files_seen++; library_unlock();
+      return 0;
+    }
+  }
+
+  entry = library_entry_new( path, info );
+  library_publish( entry, position );
+
+  if( !position ) {
+    position = entry_count;
+    library_mark_seen( position );
+    g_hash_table_insert( paths, entry->path, GINT_TO_POINTER( position ) );
+  }
+
+  return 1;
+}
+
+/* Look through the directory `path'. Returns non-zero if anything in
+   the library changed */
+static int
+library_crawl_directory( const char *path, int depth )
+{
+  char name[ PATH_MAX ], child[ PATH_MAX ];
+  compat_dir directory;
+  compat_dir_result_t result;
+  struct stat info;
+  int changed = 0;
+
+  if( depth > LIBRARY_MAX_DEPTH ) return 0;
+
+  directory = compat_opendir( path );
+  if( !directory ) return 0;
+
+  while( !library_stopping() ) {
+
+    result = compat_readdir( directory, name, sizeof( name ) );
+    if( result != COMPAT_DIR_RESULT_OK ) break;
+
+    /* Skip hidden files, and the current and parent directories */
+    if( name[0] == '.' ) continue;
+
+    if( snprintf( child, sizeof( child ), "%s" FUSE_DIR_SEP_STR "%s", path,
+                  name ) >= (int)sizeof( child ) )
+      continue;
+
+    if( stat( child, &info ) ) continue;
+
+    if( S_ISDIR( info.st_mode ) ) {
+      changed |= library_crawl_directory( child, depth + 1 );
+    } else if( S_ISREG( info.st_mode ) && library_is_candidate( name ) ) {
+      changed |= library_crawl_file( child, &info );
+    }
+  }
+
+  compat_closedir( directory );
+
+  return changed;
+}
+
+/* Drop everything which wasn't found by the crawl */
+static int
+library_prune( void )
+{
+  size_t i, kept;
+  int changed = 0;
+
+  library_lock();
+
+  for( i = 0, kept = 0; i < entry_count; i++ ) {
+    if( i < seen_count && seen[i] ) {
+      entries[ kept++ ] = entries[i];
+      continue;
+    }
+
+    if( retired_count == retired_allocated ) {
+      retired_allocated = retired_allocated ? 2 * retired_allocated : 64;
+      retired = libspectrum_renew( library_entry*, retired,
+                                   retired_allocated );
+    }
+    retired[ retired_count++ ] = entries[i];
+    changed = 1;
+  }
+
+  entry_count = kept;
+  if( changed ) generation++;
+
+  library_unlock();
+
+  return changed;
+}
+
+static int
+library_read_database( void )
+{
+  utils_file file;
+  const libspectrum_byte *ptr, *end;
+  libspectrum_dword count, i;
+  libspectrum_word length;
+  char path[ PATH_MAX ];
+  library_entry *entry;
+  int flags;
+
+  if( !compat_file_exists( database ) ) return 0;
+  if( utils_read_file( database, &file ) ) return 1;
+
+  ptr = file.buffer; end = file.buffer + file.length;
+
+  if( file.length < 12 || memcmp( ptr, "FLIB", 4 ) ) {
+    utils_close_file( &file );
+    return 1;
+  }
+  ptr += 4;
+
+  if( libspectrum_read_dword( &ptr ) != LIBRARY_VERSION ) {
+    utils_close_file( &file );
+    return 0;
+  }
+
+  count = libspectrum_read_dword( &ptr );
+
+  for( i = 0; i < count; i++ ) {
+
+    if( end - ptr < 2 ) break;
+    length = libspectrum_read_word( &ptr );
+    if( length >= sizeof( path ) || end - ptr < length + 13 ) break;
+
+    memcpy( path, ptr, length ); path[ length ] = '\0'; ptr += length;
+
+    entry = libspectrum_new( library_entry, 1 );
+    library_set_path( entry, path );
+    entry->size = libspectrum_read_dword( &ptr );
+    entry->mtime = libspectrum_read_dword( &ptr );
+    entry->class = *ptr++;
+    entry->type = libspectrum_read_word( &ptr );
+    entry->machine = *ptr++;
+    flags = *ptr++;
+    entry->thumbnail = NULL;
+
+    if( flags & LIBRARY_FLAG_THUMBNAIL ) {
+      if( end - ptr < LIBRARY_THUMBNAIL_LENGTH ) {
+        library_entry_free( entry );
+        break;
+      }
+      entry->thumbnail =
+        libspectrum_new( libspectrum_byte, LIBRARY_THUMBNAIL_LENGTH );
+      memcpy( entry->thumbnail, ptr, LIBRARY_THUMBNAIL_LENGTH );
+      ptr += LIBRARY_THUMBNAIL_LENGTH;
+    }
+
+    library_publish( entry, 0 );
+  }
+
+  utils_close_file( &file );
+
+  return 0;
+}
+
+static int
+library_write_entry( FILE *f, const library_entry *entry )
+{
+  libspectrum_byte buffer[ 16 ], *ptr = buffer;
+  size_t length = strlen( entry->path );
+
+  libspectrum_write_word( &ptr, length );
+  if( fwrite( buffer, 1, ptr - buffer, f ) != (size_t)( ptr - buffer ) ||
+      fwrite( entry->path, 1, length, f ) != length )
+    return 1;
+
+  ptr = buffer;
+  libspectrum_write_dword( &ptr, entry->size );
+  libspectrum_write_dword( &ptr, entry->mtime );
+  *ptr++ = entry->class;
+  libspectrum_write_word( &ptr, entry->type );
+  *ptr++ = entry->machine;
+  *ptr++ = entry->thumbnail ? LIBRARY_FLAG_THUMBNAIL : 0;
+  if( fwrite( buffer, 1, ptr - buffer, f ) != (size_t)( ptr - buffer ) )
+    return 1;
+
+  if( entry->thumbnail &&
+      fwrite( entry->thumbnail, 1, LIBRARY_THUMBNAIL_LENGTH, f ) !=
+        LIBRARY_THUMBNAIL_LENGTH )
+    return 1;
+
+  return 0;
+}
+
+/* Write the database to a temporary file and rename it into place, so
+   a half-written database is never read. Only the crawl changes
+   `entries', so it doesn't need to lock to read it */
+static int
+library_write_database( void )
+{
+  char tmpname[ PATH_MAX ];
+  libspectrum_byte header[ 12 ], *ptr = header;
+  FILE *f;
+  size_t i;
+  int error;
+
+  snprintf( tmpname, sizeof( tmpname ), "%s.tmp", database );
+  f = fopen( tmpname, "wb" );
+  if( !f ) {
+    fprintf( stderr, "%s: couldn't write library to '%s'\n", fuse_progname,
+             tmpname );
+    return 1;
+  }
+
+  memcpy( ptr, "FLIB", 4 ); ptr += 4;
+  libspectrum_write_dword( &ptr, LIBRARY_VERSION );
+  libspectrum_write_dword( &ptr, entry_count );
+
+  error = fwrite( header, 1, sizeof( header ), f ) != sizeof( header );
+  for( i = 0; !error && i < entry_count; i++ )
+    error = library_write_entry( f, entries[i] );
+
+  if( fclose( f ) || error || compat_file_replace( tmpname, database ) ) {
+    fprintf( stderr, "%s: couldn't write library to '%s'\n", fuse_progname,
+             database );
+    unlink( tmpname );
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Bring the library up to date with the library directories */
+static void
+library_crawl( void )
+{
+  char *directory, *next;
+  size_t i;
+  int changed;
+
+  library_lock();
+  updating = 1; files_seen = 0;
+  library_unlock();
+
+  library_read_database();
+
+  library_lock();
+  files_seen = 0;
+  library_unlock();
+
+  paths = g_hash_table_new( g_str_hash, g_str_equal );
+  for( i = 0; i < entry_count; i++ )
+    g_hash_table_insert( paths, entries[i]->path, GINT_TO_POINTER( i + 1 ) );
+
+  changed = 0;
+  for( directory = directories; directory && !library_stopping();
+       directory = next ) {
+    next = strchr( directory, LIBRARY_DIRECTORY_SEPARATOR );
+    if( next ) *next++ = '\0';
+    if( *directory ) changed |= library_crawl_directory( directory, 0 );
+  }
+
+  /* If the crawl was stopped part way through, anything it didn't get to
+     may well still be there */
+  if( !library_stopping() ) changed |= library_prune();
+
+  if( changed ) library_write_database();
+
+  g_hash_table_destroy( paths ); paths = NULL;
+  libspectrum_free( seen ); seen = NULL; seen_count = 0;
+
+  library_lock();
+  updating = 0;
+  generation++;
+  library_unlock();
+}
+
+#ifdef HAVE_PTHREAD
+
+static void*
+library_thread_fn( void *arg GCC_UNUSED )
+{
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+#ifdef __linux__
+  /* On Linux, this affects just this thread rather than all of Fuse */
+  setpriority( PRIO_PROCESS, 0, LIBRARY_NICENESS );
+#endif
+
+  library_crawl();
+
+  return NULL;
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+void
+library_update( void )
+{
+  char buffer[ PATH_MAX ];
+
+  if( updated ) return;
+  updated = 1;
+
+  if( settings_current.library_directories &&
+      *settings_current.library_directories ) {
+    directories = utils_safe_strdup( settings_current.library_directories );
+  } else if( getcwd( buffer, sizeof( buffer ) ) ) {
+    directories = utils_safe_strdup( buffer );
+  }
+
+  snprintf( buffer, sizeof( buffer ), "%s" FUSE_DIR_SEP_STR LIBRARY_DATABASE,
+            compat_get_config_path() );
+  database = utils_safe_strdup( buffer );
+
+#ifdef HAVE_PTHREAD
+  library_quit = 0;
+  if( !pthread_create( &library_thread, NULL, library_thread_fn, NULL ) ) {
+    library_running = 1;
+    return;
+  }
+  fprintf( stderr, "%s: couldn't start library thread\n", fuse_progname );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  /* No thread, so do it now */
+  library_crawl();
+}
+
+int
+library_updating( size_t *files )
+{
+  int result;
+
+  library_lock();
+  result = updating;
+  *files = files_seen;
+  library_unlock();
+
+  return result;
+}
+
+unsigned long
+library_generation( void )
+{
+  unsigned long result;
+
+  library_lock();
+  result = generation;
+  library_unlock();
+
+  return result;
+}
+
+static int
+library_compare( const void *a, const void *b )
+{
+  const library_entry *entry1 = *(const library_entry * const *)a;
+  const library_entry *entry2 = *(const library_entry * const *)b;
+  int result;
+
+  result = strcasecmp( entry1->name, entry2->name );
+  return result ? result : strcmp( entry1->path, entry2->path );
+}
+
+size_t
+library_search( const char *text, library_entry ***results )
+{
+  size_t i, count = 0;
+
+  library_lock();
+
+  *results = libspectrum_new( library_entry*, entry_count ? entry_count : 1 );
+
+  for( i = 0; i < entry_count; i++ ) {
+    if( entries[i]->class == LIBSPECTRUM_CLASS_UNKNOWN ) continue;
+    if( utils_name_contains( entries[i]->name, text ) )
+      (*results)[ count++ ] = entries[i];
+  }
+
+  library_unlock();
+
+  qsort( *results, count, sizeof( **results ), library_compare );
+
+  return count;
+}
+
+static void
+library_end( void )
+{
+  size_t i;
+
+#ifdef HAVE_PTHREAD
+  if( library_running ) {
+    library_lock();
+    library_quit = 1;
+    library_unlock();
+
+    pthread_join( library_thread, NULL );
+    library_running = 0;
+  }
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  for( i = 0; i < entry_count; i++ ) library_entry_free( entries[i] );
+  for( i = 0; i < retired_count; i++ ) library_entry_free( retired[i] );
+  libspectrum_free( entries ); entries = NULL;
+  libspectrum_free( retired ); retired = NULL;
+  entry_count = entry_allocated = retired_count = retired_allocated = 0;
+
+  libspectrum_free( directories ); directories = NULL;
+  libspectrum_free( database ); database = NULL;
+}
+
+void
+library_register_startup( void )
+{
+  startup_manager_register_no_dependencies( STARTUP_MANAGER_MODULE_LIBRARY,
+                                            NULL, NULL, library_end );
+}
@@ -0,0 +1,78 @@
+/* library.h: Index of the games in the library directories
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_LIBRARY_H
+#define FUSE_LIBRARY_H
+
+#include <stdlib.h>
+
+#include <libspectrum.h>
+
+/* A quarter size copy of a snapshot's screen, two pixels to a byte with
+   the leftmost in the high nibble, each pixel being a colour from 0 to
+   15 as for uidisplay_putpixel() */
+#define LIBRARY_THUMBNAIL_WIDTH 64
+#define LIBRARY_THUMBNAIL_HEIGHT 48
+#define LIBRARY_THUMBNAIL_LENGTH \
+  ( LIBRARY_THUMBNAIL_WIDTH * LIBRARY_THUMBNAIL_HEIGHT / 2 )
+
+/* What's known about one file. Entries never change once they're in the
+   library, and stay around until library_end(), so the pointers from
+   library_search() can be kept while the library is updated */
+typedef struct library_entry {
+
+  char *path;
+  const char *name;		/* The leafname, pointing into `path' */
+
+  libspectrum_dword size;
+  libspectrum_dword mtime;
+
+  libspectrum_class_t class;
+  libspectrum_id_t type;
+  libspectrum_machine machine;	/* LIBSPECTRUM_MACHINE_UNKNOWN if the
+				   file will run on anything */
+
+  libspectrum_byte *thumbnail;	/* NULL if there's no screen */
+
+} library_entry;
+
+void library_register_startup( void );
+
+/* Start bringing the library up to date with the files in the library
+   directories, if that hasn't been done yet. With threads, this happens
+   in the background; without, it's done before returning */
+void library_update( void );
+
+/* Is the library being brought up to date, and how many files have been
+   looked at so far? */
+int library_updating( size_t *files );
+
+/* Bumped each time the library changes, so a view of it can tell when it
+   needs searching again */
+unsigned long library_generation( void );
+
+/* The files whose names contain `text', ignoring case, sorted by name.
+   `*results' is allocated with libspectrum_new() */
+size_t library_search( const char *text, library_entry ***results );
+
+#endif			/* #ifndef FUSE_LIBRARY_H */
@@ -26,11 +26,15 @@
 #include "event.h"
 #include "loader.h"
 #include "memory_pages.h"
+#include "runahead.h"
 #include "rzx.h"
 #include "settings.h"
 #include "spectrum.h"
 #include "tape.h"
 #include "z80/z80.h"
+#ifdef GCWZERO
+#include "savestates/savestates.h"
+#endif
 
 static int successive_reads = 0;
 static libspectrum_signed_dword last_tstates_read = -100000;
@@ -47,6 +51,32 @@ typedef enum acceleration_mode_t {
 static acceleration_mode_t acceleration_mode;
 static size_t acceleration_pc;
 
+/* Edge skipping, for edge-finding loops acceleration_detector() doesn't
+   recognise: if the same IN is executed over and over at a constant
+   rate, with nothing changing but B, we can run many iterations of the
+   loop at once, stopping just short of the next event (which will often
+   be the next tape edge) */
+
+/* Skip only once the loop has gone round this many times unchanged */
+#define EDGE_SKIP_MIN_ITERATIONS 4
+
+/* Anything slower than this isn't a tight loop */
+#define EDGE_SKIP_MAX_PERIOD 256
+
+typedef struct edge_skip_state_t {
+  libspectrum_word pc;
+  libspectrum_dword period;
+  libspectrum_byte b_step;	/* B changes by this each time round */
+  libspectrum_word r_step;	/* And R by this */
+  libspectrum_word r;
+  regpair de, hl, ix, iy, sp, af_, bc_, de_, hl_;
+  libspectrum_byte c;
+  int microphone;
+  int iterations;
+} edge_skip_state_t;
+
+static edge_skip_state_t edge_skip;
+
 void
 loader_frame( libspectrum_dword frame_length )
 {
@@ -60,6 +90,7 @@ loader_tape_play( void )
 {
   successive_reads = 0;
   acceleration_mode = ACCELERATION_MODE_NONE;
+  edge_skip.iterations = 0;
 }
 
 void
@@ -67,6 +98,7 @@ loader_tape_stop( void )
 {
   successive_reads = 0;
   acceleration_mode = ACCELERATION_MODE_NONE;
+  edge_skip.iterations = 0;
 }
 
 static void
@@ -91,7 +123,7 @@ do_acceleration( void )
     z80.pc.b.l = readbyte_internal( z80.sp.w ); z80.sp.w++;
     z80.pc.b.h = readbyte_internal( z80.sp.w ); z80.sp.w++;
 
-    event_remove_type( tape_edge_event );
+    event_cancel( &tape_edge_handle );
     tape_next_edge( tstates, 1 );
 
     successive_reads = 0;
@@ -385,6 +417,106 @@ acceleration_detector( libspectrum_word pc )
 
 }      
 
+/* Does the code after the IN at `pc' test the EAR bit, either directly or
+   after an RRA? */
+static int
+edge_skip_tests_ear( libspectrum_word pc )
+{
+  int i;
+
+  for( i = 0; i < 10; i++, pc++ ) {
+    libspectrum_byte b = readbyte_internal( pc ),
+      next = readbyte_internal( pc + 1 );
+
+    if( b == 0xe6 && ( next == 0x40 || next == 0x20 ) ) return 1; /* AND nn */
+    if( b == 0xcb && next == 0x77 ) return 1;			/* BIT 6,A */
+  }
+
+  return 0;
+}
+
+static void
+edge_skip_remember( void )
+{
+  edge_skip.pc = z80.pc.w;
+  edge_skip.r = z80.r;
+  edge_skip.de = z80.de; edge_skip.hl = z80.hl;
+  edge_skip.ix = z80.ix; edge_skip.iy = z80.iy; edge_skip.sp = z80.sp;
+  edge_skip.af_ = z80.af_; edge_skip.bc_ = z80.bc_;
+  edge_skip.de_ = z80.de_; edge_skip.hl_ = z80.hl_;
+  edge_skip.c = z80.bc.b.l;
+  edge_skip.microphone = tape_microphone;
+}
+
+/* Has nothing but B, R, A and F changed since the last time round? */
+static int
+edge_skip_unchanged( void )
+{
+  return edge_skip.pc == z80.pc.w &&
+         edge_skip.de.w == z80.de.w && edge_skip.hl.w == z80.hl.w &&
+         edge_skip.ix.w == z80.ix.w && edge_skip.iy.w == z80.iy.w &&
+         edge_skip.sp.w == z80.sp.w &&
+         edge_skip.af_.w == z80.af_.w && edge_skip.bc_.w == z80.bc_.w &&
+         edge_skip.de_.w == z80.de_.w && edge_skip.hl_.w == z80.hl_.w &&
+         edge_skip.c == z80.bc.b.l &&
+         edge_skip.microphone == tape_microphone;
+}
+
+static void
+check_for_edge_skip( libspectrum_dword tstates_diff, libspectrum_byte b_diff )
+{
+  libspectrum_dword iterations, remaining;
+  libspectrum_word r_diff = z80.r - edge_skip.r;
+
+  if( !edge_skip_unchanged() || tstates_diff > EDGE_SKIP_MAX_PERIOD ||
+      ( b_diff != 0 && b_diff != 1 && b_diff != 0xff ) ||
+      ( edge_skip.iterations &&
+        ( tstates_diff != edge_skip.period || b_diff != edge_skip.b_step ||
+          r_diff != edge_skip.r_step ) ) ) {
+    edge_skip.iterations = 0;
+    edge_skip_remember();
+    return;
+  }
+
+  edge_skip_remember();
+
+  if( !edge_skip.iterations ) {
+    if( !edge_skip_tests_ear( z80.pc.w ) ) return;
+    edge_skip.period = tstates_diff;
+    edge_skip.b_step = b_diff;
+    edge_skip.r_step = r_diff;
+  }
+
+  if( ++edge_skip.iterations < EDGE_SKIP_MIN_ITERATIONS ) return;
+
+  /* Go round as many times as we can without reaching the next event,
+     leaving the last time round to be run normally */
+  if( event_next_event <= tstates ) return;
+  iterations = ( event_next_event - tstates ) / edge_skip.period;
+  if( iterations < 2 ) return;
+  iterations--;
+
+  /* and without letting B reach the loop's timeout */
+  if( b_diff == 1 ) {
+    remaining = 0xff - z80.bc.b.h;
+    if( remaining < iterations ) iterations = remaining;
+  } else if( b_diff == 0xff ) {
+    remaining = z80.bc.b.h ? z80.bc.b.h - 1 : 0;
+    if( remaining < iterations ) iterations = remaining;
+  }
+  if( !iterations ) return;
+
+  tstates += iterations * edge_skip.period;
+  z80.bc.b.h += iterations * b_diff;
+  z80.r += iterations * edge_skip.r_step;
+
+  last_tstates_read = tstates;
+  last_b_read = z80.bc.b.h;
+
+  edge_skip.iterations = 0;
+  edge_skip_remember();
+}
+
 static void
 check_for_acceleration( void )
 {
@@ -399,7 +531,10 @@ check_for_acceleration( void )
     acceleration_pc = z80.pc.w;
   }
 
-  if( acceleration_mode ) do_acceleration();
+  if( acceleration_mode ) {
+    do_acceleration();
+    edge_skip.iterations = 0;
+  }
 }
 
 void
@@ -408,6 +543,9 @@ loader_detect_loader( void )
   libspectrum_dword tstates_diff = tstates - last_tstates_read;
   libspectrum_byte b_diff = z80.bc.b.h - last_b_read;
 
+  /* Don't start or stop the tape from a frame which will be thrown away */
+  if( runahead_active ) return;
+
   last_tstates_read = tstates;
   last_b_read = z80.bc.b.h;
 
@@ -419,6 +557,9 @@ loader_detect_loader( void )
 	successive_reads++;
 	if( successive_reads >= 2 ) {
 	  tape_stop();
+#ifdef GCWZERO
+	  savestate_tape_ready_stopped();
+#endif
 	}
       } else {
 	successive_reads = 0;
@@ -441,9 +582,14 @@ loader_detect_loader( void )
   }
 
   if( settings_current.accelerate_loader && tape_is_playing() &&
-      !rzx_recording )
+      !rzx_recording ) {
     check_for_acceleration();
 
+    /* Changing the emulated time would desynchronise an RZX file */
+    if( !acceleration_mode && !rzx_playback )
+      check_for_edge_skip( tstates_diff, b_diff );
+  }
+
 }
 
 void
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "compat.h"
 #include "event.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
@@ -58,6 +59,23 @@ fuse_machine_info *machine_current = NULL; /* The currently selected machine */
 static int machine_location;	/* Where is the current machine in
 				   machine_types[...]? */
 
+/* The size the UI's display was last set up for */
+static int machine_display_width = 0, machine_display_height = 0;
+
+/* Every ROM file read since startup, so switching machines or resetting
+   doesn't need to read them again */
+typedef struct rom_cache_entry {
+
+  char *filename;		/* The name the ROM was asked for by */
+  char path[ PATH_MAX ];	/* Where it was found */
+  time_t mtime;			/* When the file was last changed */
+  utils_file file;
+
+} rom_cache_entry;
+
+static rom_cache_entry *rom_cache = NULL;
+static size_t rom_cache_count = 0;
+
 static int machine_add_machine( int (*init_function)(fuse_machine_info *machine) );
 static int machine_select_machine( fuse_machine_info *machine );
 static void machine_set_const_timings( fuse_machine_info *machine );
@@ -216,10 +234,6 @@ machine_select_machine( fuse_machine_info *machine )
   event_add( 0, timer_event );
   event_add( machine->timings.tstates_per_frame, spectrum_frame_event );
 
-  sound_end();
-
-  if( uidisplay_end() ) return 1;
-
   capabilities = libspectrum_machine_capabilities( machine->machine );
 
   /* Set screen sizes here */
@@ -231,9 +245,14 @@ machine_select_machine( fuse_machine_info *machine )
     height = DISPLAY_SCREEN_HEIGHT;
   }
 
-  if( uidisplay_init( width, height ) ) return 1;
+  /* Only rebuild the display if it's changing size */
+  if( width != machine_display_width || height != machine_display_height ) {
+    if( uidisplay_end() ) return 1;
+    if( uidisplay_init( width, height ) ) return 1;
+    machine_display_width = width; machine_display_height = height;
+  }
 
-  sound_init( settings_current.sound_device );
+  sound_machine_changed();
 
   /* Do a hard reset */
   if( machine_reset( 1 ) ) return 1;
@@ -249,16 +268,13 @@ machine_select_machine( fuse_machine_info *machine )
   return 0;
 }
 
-int
-machine_load_rom_bank_from_buffer( memory_page* bank_map, int page_num,
-  unsigned char *buffer, size_t length, int custom )
+static void
+map_rom_bank( memory_page* bank_map, int page_num, libspectrum_byte *data,
+              size_t length, int custom )
 {
   size_t offset;
-  libspectrum_byte *data = memory_pool_allocate( length );
   memory_page *page;
 
-  memcpy( data, buffer, length );
-
   for( page = &bank_map[ page_num * MEMORY_PAGES_IN_16K ], offset = 0;
        offset < length;
        page++, offset += MEMORY_PAGE_SIZE ) {
@@ -268,39 +284,119 @@ machine_load_rom_bank_from_buffer( memory_page* bank_map, int page_num,
     page->writable = 0;
     page->save_to_snapshot = custom;
   }
+}
+
+int
+machine_load_rom_bank_from_buffer( memory_page* bank_map, int page_num,
+  unsigned char *buffer, size_t length, int custom )
+{
+  libspectrum_byte *data = memory_pool_allocate( length );
+
+  memcpy( data, buffer, length );
+  map_rom_bank( bank_map, page_num, data, length, custom );
 
   return 0;
 }
 
+/* Find the ROM file called `filename' in the cache, reading it in if it
+   isn't there or the file has changed since it was read */
+static rom_cache_entry*
+rom_cache_get( const char *filename )
+{
+  rom_cache_entry *entry = NULL;
+  char path[ PATH_MAX ];
+  time_t mtime;
+  off_t length;
+  size_t i;
+
+  for( i = 0; i < rom_cache_count; i++ ) {
+    if( !strcmp( rom_cache[i].filename, filename ) ) {
+      entry = &rom_cache[i];
+      break;
+    }
+  }
+
+  /* The file has already been found once, so just check it's the same */
+  if( entry && !compat_file_get_info( entry->path, &mtime, &length ) &&
+      mtime == entry->mtime && length == entry->file.length )
+    return entry;
+
+  if( utils_find_file_path( filename, path, UTILS_AUXILIARY_ROM ) ||
+      compat_file_get_info( path, &mtime, &length ) ) {
+    ui_error( UI_ERROR_ERROR, "couldn't find ROM '%s'", filename );
+    return NULL;
+  }
+
+  if( !entry ) {
+    rom_cache = libspectrum_renew( rom_cache_entry, rom_cache,
+                                   rom_cache_count + 1 );
+    entry = &rom_cache[ rom_cache_count++ ];
+    entry->filename = utils_safe_strdup( filename );
+  } else {
+    utils_close_file( &entry->file );
+  }
+
+  if( utils_read_file( path, &entry->file ) ) {
+    libspectrum_free( entry->filename );
+    *entry = rom_cache[ --rom_cache_count ];
+    return NULL;
+  }
+
+  memcpy( entry->path, path, sizeof( entry->path ) );
+  entry->mtime = mtime;
+
+  return entry;
+}
+
+static void
+rom_cache_free( void )
+{
+  size_t i;
+
+  for( i = 0; i < rom_cache_count; i++ ) {
+    libspectrum_free( rom_cache[i].filename );
+    utils_close_file( &rom_cache[i].file );
+  }
+
+  libspectrum_free( rom_cache );
+  rom_cache = NULL;
+  rom_cache_count = 0;
+}
+
 static int
 machine_load_rom_bank_from_file( memory_page* bank_map, int page_num,
   const char *filename, size_t expected_length, int custom )
 {
-  int error;
-  utils_file rom;
+  rom_cache_entry *rom;
 
-  error = utils_read_auxiliary_file( filename, &rom, UTILS_AUXILIARY_ROM );
-  if( error == -1 ) {
-    ui_error( UI_ERROR_ERROR, "couldn't find ROM '%s'", filename );
-    return 1;
-  }
-  if( error ) return error;
-  
-  if( rom.length != expected_length ) {
+  rom = rom_cache_get( filename ); if( !rom ) return 1;
+
+  if( rom->file.length != expected_length ) {
     ui_error( UI_ERROR_ERROR,
 	      "ROM '%s' is %ld bytes long; expected %ld bytes",
-	      filename, (unsigned long)rom.length,
+	      filename, (unsigned long)rom->file.length,
 	      (unsigned long)expected_length );
-    utils_close_file( &rom );
     return 1;
   }
 
-  error = machine_load_rom_bank_from_buffer( bank_map, page_num, rom.buffer,
-    rom.length, custom );
+  /* The cached file won't change until the next reset, so there's no
+     need for a copy of it */
+  map_rom_bank( bank_map, page_num, rom->file.buffer, rom->file.length,
+                custom );
 
-  utils_close_file( &rom );
+  return 0;
+}
 
-  return error;
+void
+machine_rom_written( const libspectrum_byte *memory )
+{
+  size_t i;
+
+  /* Make the next rom_cache_get() read the file again */
+  for( i = 0; i < rom_cache_count; i++ )
+    if( memory >= rom_cache[i].file.buffer &&
+        memory < rom_cache[i].file.buffer + rom_cache[i].file.length )
+      rom_cache[i].mtime = 0;
 }
 
 int
@@ -331,7 +427,6 @@ machine_load_rom( int page_num, const char *filename, const char *fallback,
 int
 machine_reset( int hard_reset )
 {
-  size_t i;
   int error;
 
   /* Clear poke list (undoes effects of active pokes on Spectrum memory) */
@@ -356,12 +451,6 @@ machine_reset( int hard_reset )
 
   error = machine_current->memory_map(); if( error ) return error;
 
-  /* Set up the contention array */
-  for( i = 0; i < machine_current->timings.tstates_per_frame; i++ ) {
-    ula_contention[ i ] = machine_current->ram.contend_delay( i );
-    ula_contention_no_mreq[ i ] = machine_current->ram.contend_delay_no_mreq( i );
-  }
-
   /* Update the disk menu items */
   ui_menu_disk_update();
 
@@ -422,6 +511,10 @@ machine_set_variable_timings( fuse_machine_info *machine )
     machine->line_times[y] = machine->line_times[y-1] + 
                              machine->timings.tstates_per_line;
   }
+
+  /* And everything else which depends on when things happen in the
+     frame */
+  ula_timing_setup();
 }
 
 static void
@@ -429,6 +522,8 @@ machine_end( void )
 {
   int i;
 
+  rom_cache_free();
+
   for( i=0; i<machine_count; i++ ) {
     if( machine_types[i]->shutdown ) machine_types[i]->shutdown();
     libspectrum_free( machine_types[i] );
@@ -106,6 +106,11 @@ int machine_load_rom_bank( memory_page* bank_map, int page_num,
 int machine_load_rom( int page_num, const char *filename, const char *fallback,
   size_t expected_length );
 
+/* ROMs loaded from files are mapped straight from the copy kept in memory;
+   called when `memory' is written to through a ROM page, so that copy
+   isn't used again */
+void machine_rom_written( const libspectrum_byte *memory );
+
 int machine_reset( int hard_reset );
 
 #endif			/* #ifndef FUSE_MACHINE_H */
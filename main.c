@@ -0,0 +1,46 @@
+/* main.c: Where it all starts
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+/* We need to include SDL.h on Mac O X and Windows to do some magic
+   bootstrapping by redefining main. As we now allow SDL joystick code to be
+   used in the GTK+ and Xlib UIs we need to also do the magic when that code is
+   in use, feel free to look away for the next line */
+#if defined UI_SDL || (defined USE_JOYSTICK && !defined HAVE_JSW_H && (defined UI_X || defined UI_GTK) )
+#include <SDL.h>		/* Needed on MacOS X and Windows */
+#endif /* #if defined UI_SDL || (defined USE_JOYSTICK && !defined HAVE_JSW_H && (defined UI_X || defined UI_GTK) ) */
+
+#include "fuse.h"
+
+/* Kept apart from everything else so that can go into libfuse.a for
+   programs with their own main(); the Win32 UI has WinMain() instead */
+#ifndef UI_WIN32
+
+int
+main( int argc, char **argv )
+{
+  return fuse_main( argc, argv );
+}
+
+#endif				/* #ifndef UI_WIN32 */
@@ -36,10 +36,12 @@
 #include "display.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
+#include "machine.h"
 #include "machines/pentagon.h"
 #include "machines/spec128.h"
 #include "machines/specplus3.h"
 #include "memory_pages.h"
+#include "memory_usage.h"
 #include "module.h"
 #include "peripherals/disk/opus.h"
 #include "peripherals/spectranet.h"
@@ -65,6 +67,11 @@ int memory_source_none; /* No memory attached here */
 memory_page memory_map_read[MEMORY_PAGES_IN_64K];
 memory_page memory_map_write[MEMORY_PAGES_IN_64K];
 
+/* Which chunks have a memory-mapped peripheral overlaid on them, and so
+   need to take the slow path through readbyte() and writebyte_internal() */
+libspectrum_byte memory_overlay_read[MEMORY_PAGES_IN_64K];
+libspectrum_byte memory_overlay_write[MEMORY_PAGES_IN_64K];
+
 /* Standard mappings for the 'normal' RAM */
 memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 
@@ -75,19 +82,32 @@ memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 typedef struct memory_pool_entry_t {
   int persistent;
   libspectrum_byte *memory;
+  size_t length;
 } memory_pool_entry_t;
 
 /* All the memory we've allocated for this machine */
 static GSList *pool;
 
+/* Should the RAM be copied into snapshots? */
+int memory_snapshot_ram = 1;
+
 /* Which RAM page contains the current screen */
 int memory_current_screen;
 
 /* Which bits to look at when working out where the screen is */
 libspectrum_word memory_screen_mask;
 
+/* The generation in which each 2K chunk of RAM was last written to. Every
+   in-memory state saved or restored starts a new generation, and holds an
+   up to date copy of each chunk last written to no later than its own */
+static libspectrum_dword ram_written[ SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K ];
+static libspectrum_dword ram_generation = 1;
+
 static void memory_from_snapshot( libspectrum_snap *snap );
 static void memory_to_snapshot( libspectrum_snap *snap );
+static size_t memory_state_pages( void );
+static void memory_state_to( module_state_t *state );
+static void memory_state_from( module_state_t *state );
 
 static module_info_t memory_module_info = {
 
@@ -96,6 +116,8 @@ static module_info_t memory_module_info = {
   NULL,
   memory_from_snapshot,
   memory_to_snapshot,
+  memory_state_to,
+  memory_state_from,
 
 };
 
@@ -118,6 +140,7 @@ memory_init( void *context )
 
   /* Nothing in the memory pool as yet */
   pool = NULL;
+  memory_usage_set( MEMORY_USAGE_RAM, sizeof( RAM ) );
 
   for( i = 0; i < SPECTRUM_ROM_PAGES; i++ )
     for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
@@ -146,6 +169,7 @@ static void
 memory_pool_free_entry( gpointer data, gpointer user_data GCC_UNUSED )
 {
   memory_pool_entry_t *entry = data;
+  memory_usage_remove( MEMORY_USAGE_RAM, entry->length );
   libspectrum_free( entry->memory );
   libspectrum_free( entry );
 }
@@ -227,19 +251,28 @@ memory_pool_allocate( size_t length )
 libspectrum_byte*
 memory_pool_allocate_persistent( size_t length, int persistent )
 {
-  memory_pool_entry_t *entry;
-  libspectrum_byte *memory;
+  libspectrum_byte *memory = libspectrum_new( libspectrum_byte, length );
 
-  memory = libspectrum_new( libspectrum_byte, length );
+  memory_pool_adopt( memory, length, persistent );
+
+  return memory;
+}
+
+/* Add `length' bytes of memory from libspectrum_new() to the pool, which
+   will free it when it frees everything else */
+void
+memory_pool_adopt( libspectrum_byte *memory, size_t length, int persistent )
+{
+  memory_pool_entry_t *entry;
 
   entry = libspectrum_new( memory_pool_entry_t, 1 );
 
   entry->persistent = persistent;
   entry->memory = memory;
+  entry->length = length;
+  memory_usage_add( MEMORY_USAGE_RAM, length );
 
   pool = g_slist_prepend( pool, entry );
-
-  return memory;
 }
 
 static gint
@@ -258,6 +291,7 @@ memory_pool_free( void )
   while( ( ptr = g_slist_find_custom( pool, NULL, find_non_persistent ) ) != NULL )
   {
     memory_pool_entry_t *entry = ptr->data;
+    memory_usage_remove( MEMORY_USAGE_RAM, entry->length );
     libspectrum_free( entry->memory );
     pool = g_slist_remove( pool, entry );
     libspectrum_free( entry );
@@ -274,6 +308,21 @@ memory_ram_set_16k_contention( int page_num, int contended )
     memory_map_ram[ page_num * MEMORY_PAGES_IN_16K + i ].contended = contended;
 }
 
+/* Map `count' chunks from `source' starting at `address'. The chunks of
+   each bank are kept in order in the source arrays, just as they appear
+   in the memory map, so this is a straight copy of them */
+static void
+memory_map_chunks( libspectrum_word address, const memory_page *source,
+                   size_t count, int map_read, int map_write )
+{
+  size_t first = address >> MEMORY_PAGE_SIZE_LOGARITHM;
+
+  if( map_read )
+    memcpy( &memory_map_read[ first ], source, count * sizeof( *source ) );
+  if( map_write )
+    memcpy( &memory_map_write[ first ], source, count * sizeof( *source ) );
+}
+
 /* Map 16K of memory */
 void
 memory_map_16k( libspectrum_word address, memory_page source[], int page_num )
@@ -286,10 +335,8 @@ void
 memory_map_16k_read_write( libspectrum_word address, memory_page source[],
 		           int page_num, int map_read, int map_write )
 {
-  memory_map_8k_read_write( address, source, page_num * 2, map_read,
-		            map_write );
-  memory_map_8k_read_write( address + 0x2000, source, page_num * 2 + 1,
-		            map_read, map_write );
+  memory_map_chunks( address, &source[ page_num * MEMORY_PAGES_IN_16K ],
+                     MEMORY_PAGES_IN_16K, map_read, map_write );
 }
 
 /* Map 8K of memory */
@@ -304,9 +351,8 @@ void
 memory_map_8k_read_write( libspectrum_word address, memory_page source[],
 		          int page_num, int map_read, int map_write )
 {
-  memory_map_4k_read_write( address, source, page_num * 2, map_read, map_write );
-  memory_map_4k_read_write( address + 0x1000, source, page_num * 2 + 1,
-		  	    map_read, map_write );
+  memory_map_chunks( address, &source[ page_num * MEMORY_PAGES_IN_8K ],
+                     MEMORY_PAGES_IN_8K, map_read, map_write );
 }
 
 /* Map 4K of memory for either reading, writing or both */
@@ -314,9 +360,8 @@ void
 memory_map_4k_read_write( libspectrum_word address, memory_page source[],
 		          int page_num, int map_read, int map_write )
 {
-  memory_map_2k_read_write( address, source, page_num * 2, map_read, map_write );
-  memory_map_2k_read_write( address + 0x0800, source, page_num * 2 + 1,
-		  	    map_read, map_write );
+  memory_map_chunks( address, &source[ page_num * MEMORY_PAGES_IN_4K ],
+                     MEMORY_PAGES_IN_4K, map_read, map_write );
 }
 
 /* Map 2K of memory for either reading, writing or both */
@@ -324,14 +369,8 @@ void
 memory_map_2k_read_write( libspectrum_word address, memory_page source[],
 		          int page_num, int map_read, int map_write )
 {
-  int i;
-
-  for( i = 0; i < MEMORY_PAGES_IN_2K; i++ ) {
-    int page_offset = ( address >> MEMORY_PAGE_SIZE_LOGARITHM ) + i;
-    memory_page *page = &source[ page_num * MEMORY_PAGES_IN_2K + i ];
-    if( map_read ) memory_map_read[ page_offset ] = *page;
-    if( map_write ) memory_map_write[ page_offset ] = *page;
-  }
+  memory_map_chunks( address, &source[ page_num * MEMORY_PAGES_IN_2K ],
+                     MEMORY_PAGES_IN_2K, map_read, map_write );
 }
 
 /* Map one page of memory */
@@ -370,21 +409,61 @@ memory_map_romcs_2k( libspectrum_word address, memory_page source[] )
   memory_map_2k_read_write( address, source, 0, 1, 1 );
 }
 
-libspectrum_byte
-readbyte( libspectrum_word address )
+/* Mark the chunks covering [start, end) as overlaid */
+static void
+memory_overlay_set( libspectrum_byte *overlay, libspectrum_word start,
+                    libspectrum_dword end )
 {
-  libspectrum_word bank;
-  memory_page *mapping;
+  libspectrum_dword address;
 
-  bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
-  mapping = &memory_map_read[ bank ];
+  for( address = start; address < end; address += MEMORY_PAGE_SIZE )
+    overlay[ address >> MEMORY_PAGE_SIZE_LOGARITHM ] = 1;
+}
 
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
-    debugger_check( DEBUGGER_BREAKPOINT_TYPE_READ, address );
+/* Work out which chunks currently have a peripheral overlaid on them. Must
+   be called whenever any of opus_active, spectranet_paged,
+   spectranet_w5100_paged_a/b, spectranet_flash_paged_a/b or ttx2000s_paged
+   changes */
+void
+memory_overlay_update( void )
+{
+  memset( memory_overlay_read, 0, sizeof( memory_overlay_read ) );
+  memset( memory_overlay_write, 0, sizeof( memory_overlay_write ) );
 
-  if( mapping->contended ) tstates += ula_contention[ tstates ];
-  tstates += 3;
+  if( opus_active ) {
+    memory_overlay_set( memory_overlay_read, 0x2800, 0x3800 );
+    memory_overlay_set( memory_overlay_write, 0x2800, 0x3800 );
+  }
+
+  if( spectranet_paged ) {
+    /* Writes to the flash ROM need to be seen by its command state
+       machine; 0x0000-0x0fff is always flash page 0 */
+    memory_overlay_set( memory_overlay_write, 0x0000, 0x1000 );
+    if( spectranet_flash_paged_a )
+      memory_overlay_set( memory_overlay_write, 0x1000, 0x2000 );
+    if( spectranet_flash_paged_b )
+      memory_overlay_set( memory_overlay_write, 0x2000, 0x3000 );
+
+    if( spectranet_w5100_paged_a ) {
+      memory_overlay_set( memory_overlay_read, 0x1000, 0x2000 );
+      memory_overlay_set( memory_overlay_write, 0x1000, 0x2000 );
+    }
+    if( spectranet_w5100_paged_b ) {
+      memory_overlay_set( memory_overlay_read, 0x2000, 0x3000 );
+      memory_overlay_set( memory_overlay_write, 0x2000, 0x3000 );
+    }
+  }
 
+  if( ttx2000s_paged ) {
+    memory_overlay_set( memory_overlay_read, 0x2000, 0x4000 );
+    memory_overlay_set( memory_overlay_write, 0x2000, 0x4000 );
+  }
+}
+
+/* Read a byte from a chunk with a peripheral overlaid on it */
+static libspectrum_byte
+readbyte_overlay( memory_page *mapping, libspectrum_word address )
+{
   if( opus_active && address >= 0x2800 && address < 0x3800 )
     return opus_read( address );
 
@@ -403,25 +482,103 @@ readbyte( libspectrum_word address )
   return mapping->page[ address & MEMORY_PAGE_SIZE_MASK ];
 }
 
-void
-writebyte( libspectrum_word address, libspectrum_byte b )
+/* The memory accessors come in two versions: the normal ones, and ones
+   which check for debugger breakpoints first. readbyte and writebyte point
+   to whichever is appropriate, so the checks cost nothing when the
+   debugger is inactive */
+
+static libspectrum_byte
+readbyte_nodebugger( libspectrum_word address )
 {
   libspectrum_word bank;
   memory_page *mapping;
 
   bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
-  mapping = &memory_map_write[ bank ];
+  mapping = &memory_map_read[ bank ];
+
+  if( mapping->contended ) tstates += ula_timing[ tstates ].contention;
+  tstates += 3;
+
+  if( memory_overlay_read[ bank ] ) return readbyte_overlay( mapping, address );
+
+  return mapping->page[ address & MEMORY_PAGE_SIZE_MASK ];
+}
+
+static libspectrum_byte
+readbyte_debugger( libspectrum_word address )
+{
+  debugger_check( DEBUGGER_BREAKPOINT_TYPE_READ, address );
+  return readbyte_nodebugger( address );
+}
+
+/* Operands are nearly always in a page of their own which isn't
+   contended and has nothing overlaid, so both bytes can be read at once
+   and the timings don't depend on when the reads happen */
+static libspectrum_word
+readword_nodebugger( libspectrum_word address )
+{
+  libspectrum_word bank, offset;
+  memory_page *mapping;
+  libspectrum_byte low;
+
+  bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
+  offset = address & MEMORY_PAGE_SIZE_MASK;
+  mapping = &memory_map_read[ bank ];
+
+  if( offset != MEMORY_PAGE_SIZE_MASK && !mapping->contended &&
+      !memory_overlay_read[ bank ] ) {
+    tstates += 6;
+    return mapping->page[ offset ] | ( mapping->page[ offset + 1 ] << 8 );
+  }
+
+  low = readbyte_nodebugger( address );
+  return low | ( readbyte_nodebugger( address + 1 ) << 8 );
+}
+
+static libspectrum_word
+readword_debugger( libspectrum_word address )
+{
+  libspectrum_byte low = readbyte_debugger( address );
+  return low | ( readbyte_debugger( address + 1 ) << 8 );
+}
+
+static void
+writebyte_nodebugger( libspectrum_word address, libspectrum_byte b )
+{
+  libspectrum_word bank;
+  memory_page *mapping;
 
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
-    debugger_check( DEBUGGER_BREAKPOINT_TYPE_WRITE, address );
+  bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
+  mapping = &memory_map_write[ bank ];
 
-  if( mapping->contended ) tstates += ula_contention[ tstates ];
+  if( mapping->contended ) tstates += ula_timing[ tstates ].contention;
 
   tstates += 3;
 
   writebyte_internal( address, b );
 }
 
+static void
+writebyte_debugger( libspectrum_word address, libspectrum_byte b )
+{
+  debugger_check( DEBUGGER_BREAKPOINT_TYPE_WRITE, address );
+  writebyte_nodebugger( address, b );
+}
+
+memory_readbyte_fn readbyte = readbyte_nodebugger;
+memory_writebyte_fn writebyte = writebyte_nodebugger;
+memory_readword_fn readword = readword_nodebugger;
+
+/* Select the memory accessors according to whether the debugger is
+   active or not */
+void
+memory_set_debugger_accessors( int debugger_active )
+{
+  readbyte = debugger_active ? readbyte_debugger : readbyte_nodebugger;
+  writebyte = debugger_active ? writebyte_debugger : writebyte_nodebugger;
+  readword = debugger_active ? readword_debugger : readword_nodebugger;
+}
+
 void
 memory_display_dirty_pentagon_16_col( libspectrum_word address,
                                       libspectrum_byte b )
@@ -438,14 +595,13 @@ memory_display_dirty_pentagon_16_col( libspectrum_word address,
      the destination), redraw that bit.
      The trick here is that we need to check the home bank screen areas in
      page 5 and 4 (if screen 1 is in use), and page 7 & 6 (if screen 2 is in
-     use) and both the standard and ALTDFILE areas of those pages
+     use), which are the pages which are the current screen with bit 0 set,
+     and both the standard and ALTDFILE areas of those pages. Attributes
+     aren't used in this mode, so only the pixel data matters
    */
   if( mapping->source == memory_source_ram && 
-      ( ( memory_current_screen  == 5 &&
-          ( mapping->page_num == 5 || mapping->page_num == 4 ) ) ||
-        ( memory_current_screen  == 7 &&
-          ( mapping->page_num == 7 || mapping->page_num == 6 ) ) ) &&
-      ( offset2 & 0xdfff ) < 0x1b00 &&
+      ( mapping->page_num | 1 ) == memory_current_screen &&
+      ( offset2 & 0xdfff ) < 0x1800 &&
       memory[ offset ] != b )
     display_dirty_pentagon_16_col( offset2 );
 }
@@ -472,47 +628,83 @@ memory_display_dirty_sinclair( libspectrum_word address, libspectrum_byte b ) \
 
 memory_display_dirty_fn memory_display_dirty;
 
-void
-writebyte_internal( libspectrum_word address, libspectrum_byte b )
+/* Write a byte to a chunk with a peripheral overlaid on it. Returns
+   non-zero if the peripheral has dealt with the write */
+static int
+writebyte_overlay( memory_page *mapping, libspectrum_word address,
+                   libspectrum_byte b )
 {
-  libspectrum_word bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
-  memory_page *mapping = &memory_map_write[ bank ];
-  
   if( spectranet_paged ) {
-    /* all writes need to be parsed by the flash rom emulation */
-    spectranet_flash_rom_write(address, b);
-    
+    /* only writes which reach the flash chip are parsed by the flash
+       rom emulation */
+    if( address < 0x1000 ||
+        ( spectranet_flash_paged_a && address < 0x2000 ) ||
+        ( spectranet_flash_paged_b && address >= 0x2000 && address < 0x3000 ) )
+      spectranet_flash_rom_write(address, b);
+
     if( spectranet_w5100_paged_a && address >= 0x1000 && address < 0x2000 ) {
       spectranet_w5100_write( mapping, address, b );
-      return;
+      return 1;
     }
     if( spectranet_w5100_paged_b && address >= 0x2000 && address < 0x3000 ) {
       spectranet_w5100_write( mapping, address, b );
-      return;
+      return 1;
     }
   }
   
   if( ttx2000s_paged ) {
     if( address >= 0x2000 && address < 0x4000 ) {
       ttx2000s_sram_write( address, b );
-      return;
+      return 1;
     }
   }
 
   if( opus_active && address >= 0x2800 && address < 0x3800 ) {
     opus_write( address, b );
-  } else if( mapping->writable ||
-             (mapping->source != memory_source_none &&
-              settings_current.writable_roms) ) {
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+writebyte_internal( libspectrum_word address, libspectrum_byte b )
+{
+  libspectrum_word bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
+  memory_page *mapping = &memory_map_write[ bank ];
+
+  if( memory_overlay_write[ bank ] &&
+      writebyte_overlay( mapping, address, b ) )
+    return;
+
+  if( mapping->writable ||
+      (mapping->source != memory_source_none &&
+       settings_current.writable_roms) ) {
     libspectrum_word offset = address & MEMORY_PAGE_SIZE_MASK;
     libspectrum_byte *memory = mapping->page;
 
     memory_display_dirty( address, b );
 
+    if( mapping->source == memory_source_ram )
+      ram_written[ mapping->page_num * MEMORY_PAGES_IN_16K +
+                   ( mapping->offset >> MEMORY_PAGE_SIZE_LOGARITHM ) ] =
+        ram_generation;
+    else if( !mapping->writable )
+      machine_rom_written( memory );
+
     memory[ offset ] = b;
   }
 }
 
+void
+memory_ram_changed( void )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( ram_written ); i++ )
+    ram_written[i] = ram_generation;
+}
+
 void
 memory_romcs_map( void )
 {
@@ -562,9 +754,24 @@ memory_from_snapshot( libspectrum_snap *snap )
       );
   }
 
-  for( i = 0; i < 64; i++ )
-    if( libspectrum_snap_pages( snap, i ) )
-      memcpy( RAM[i], libspectrum_snap_pages( snap, i ), 0x4000 );
+  /* Reloading a state usually leaves most of the RAM as it was, so only
+     the parts which differ are copied and marked as written */
+  for( i = 0; i < 64; i++ ) {
+    const libspectrum_byte *data = libspectrum_snap_pages( snap, i );
+    size_t j;
+
+    if( !data ) continue;
+
+    for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
+      libspectrum_byte *page = &RAM[i][ j * MEMORY_PAGE_SIZE ];
+      const libspectrum_byte *source = &data[ j * MEMORY_PAGE_SIZE ];
+
+      if( !memcmp( page, source, MEMORY_PAGE_SIZE ) ) continue;
+
+      memcpy( page, source, MEMORY_PAGE_SIZE );
+      ram_written[ i * MEMORY_PAGES_IN_16K + j ] = ram_generation;
+    }
+  }
 
   if( libspectrum_snap_custom_rom( snap ) ) {
     for( i = 0; i < libspectrum_snap_custom_rom_pages( snap ) && i < 4; i++ ) {
@@ -608,6 +815,9 @@ memory_reset( void )
 
   for( i = 0; i < SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K; i++ )
     memory_map_rom[ i ].save_to_snapshot = 0;
+
+  /* The machine's reset may do anything to the RAM */
+  memory_ram_changed();
 }
 
 static void
@@ -666,19 +876,98 @@ memory_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_out_plus3_memoryport( snap,
 					     machine_current->ram.last_byte2 );
 
-  for( i = 0; i < 64; i++ ) {
-    if( RAM[i] != NULL ) {
+  /* Pages the machine doesn't have are never touched, so the host
+     never has to give them any memory; don't change that by copying
+     them */
+  for( i = 0; i < memory_state_pages() && memory_snapshot_ram; i++ ) {
+    buffer = libspectrum_new( libspectrum_byte, 0x4000 );
 
-      buffer = libspectrum_new( libspectrum_byte, 0x4000 );
-
-      memcpy( buffer, RAM[i], 0x4000 );
-      libspectrum_snap_set_pages( snap, i, buffer );
-    }
+    memcpy( buffer, RAM[i], 0x4000 );
+    libspectrum_snap_set_pages( snap, i, buffer );
   }
 
   memory_rom_to_snapshot( snap );
 }
 
+/* How many RAM pages go into a state. The 16K and 48K machines use pages
+   from the 128K's numbering, so everything up to page 7 is always
+   included */
+static size_t
+memory_state_pages( void )
+{
+  return machine_current->ram.valid_pages > 8 ?
+         machine_current->ram.valid_pages : 8;
+}
+
+/* The paging goes in as it stands and the RAM into the state's own copy;
+   the ROMs can't change without a reset, so are left out */
+static void
+memory_state_to( module_state_t *state )
+{
+  size_t length, i;
+  int all = 0;
+
+  module_state_write( state, &machine_current->ram,
+                      sizeof( machine_current->ram ) );
+  module_state_write( state, memory_map_read, sizeof( memory_map_read ) );
+  module_state_write( state, memory_map_write, sizeof( memory_map_write ) );
+  module_state_write( state, memory_overlay_read,
+                      sizeof( memory_overlay_read ) );
+  module_state_write( state, memory_overlay_write,
+                      sizeof( memory_overlay_write ) );
+  module_state_write( state, &memory_current_screen,
+                      sizeof( memory_current_screen ) );
+
+  /* Only the chunks written to since the state's copy of the RAM was last
+     up to date need copying */
+  length = memory_state_pages() * sizeof( RAM[0] );
+  if( state->ram_length != length ) {
+    state->ram = libspectrum_renew( libspectrum_byte, state->ram, length );
+    state->ram_length = length;
+    all = 1;
+  }
+
+  for( i = 0; i < length / MEMORY_PAGE_SIZE; i++ )
+    if( all || ram_written[i] > state->ram_generation )
+      memcpy( state->ram + i * MEMORY_PAGE_SIZE, RAM[0] + i * MEMORY_PAGE_SIZE,
+              MEMORY_PAGE_SIZE );
+
+  state->ram_generation = ram_generation++;
+}
+
+static void
+memory_state_from( module_state_t *state )
+{
+  size_t i;
+
+  module_state_read( state, &machine_current->ram,
+                     sizeof( machine_current->ram ) );
+  module_state_read( state, memory_map_read, sizeof( memory_map_read ) );
+  module_state_read( state, memory_map_write, sizeof( memory_map_write ) );
+  module_state_read( state, memory_overlay_read,
+                     sizeof( memory_overlay_read ) );
+  module_state_read( state, memory_overlay_write,
+                     sizeof( memory_overlay_write ) );
+  module_state_read( state, &memory_current_screen,
+                     sizeof( memory_current_screen ) );
+  if( state->error ) return;
+
+  if( state->ram_length != memory_state_pages() * sizeof( RAM[0] ) ) {
+    state->error = 1;
+    return;
+  }
+
+  /* The chunks copied back now match this state, but not any other */
+  for( i = 0; i < state->ram_length / MEMORY_PAGE_SIZE; i++ )
+    if( ram_written[i] > state->ram_generation ) {
+      memcpy( RAM[0] + i * MEMORY_PAGE_SIZE, state->ram + i * MEMORY_PAGE_SIZE,
+              MEMORY_PAGE_SIZE );
+      ram_written[i] = ram_generation;
+    }
+
+  state->ram_generation = ram_generation++;
+}
+
 /* Check whether we're actually in the right ROM when a tape or other traps
    hit */
 int
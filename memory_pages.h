@@ -44,19 +44,23 @@ extern int memory_source_exrom; /* Timex EXROM */
 extern int memory_source_any; /* Used by the debugger to signify an absolute address */
 extern int memory_source_none; /* No memory attached here */
 
+/* The fields used on every memory access come first and the flags are
+   bytes, so that the entries are small and readbyte() only has to touch
+   the start of one */
 typedef struct memory_page {
 
   libspectrum_byte *page;	/* The data for this page */
-  int writable;			/* Can we write to this data? */
-  int contended;		/* Are reads/writes to this page contended? */
+  libspectrum_byte contended;	/* Are reads/writes to this page contended? */
+  libspectrum_byte writable;	/* Can we write to this data? */
 
-  int source;	                /* Where did this page come from? */
-  int save_to_snapshot;         /* Set if this page should be saved snapshots
-                                   (set only if this page would not normally be
-                                    saved; things like RAM are always saved) */
+  libspectrum_byte save_to_snapshot; /* Set if this page should be saved
+                                        snapshots (set only if this page
+                                        would not normally be saved; things
+                                        like RAM are always saved) */
 
-  int page_num;			/* Which page from the source */
   libspectrum_word offset;	/* How far into the page this chunk starts */
+  int source;	                /* Where did this page come from? */
+  int page_num;			/* Which page from the source */
 
 } memory_page;
 
@@ -100,6 +104,14 @@ typedef struct memory_page {
 extern memory_page memory_map_read[MEMORY_PAGES_IN_64K];
 extern memory_page memory_map_write[MEMORY_PAGES_IN_64K];
 
+/* Which chunks have a memory-mapped peripheral overlaid on them */
+extern libspectrum_byte memory_overlay_read[MEMORY_PAGES_IN_64K];
+extern libspectrum_byte memory_overlay_write[MEMORY_PAGES_IN_64K];
+
+/* Work out which chunks have a peripheral overlaid on them; to be called
+   whenever a memory-mapped peripheral is paged in or out */
+void memory_overlay_update( void );
+
 /* The number of 16Kb RAM pages we support: 1040 Kb needed for the Pentagon 1024 */
 #define SPECTRUM_RAM_PAGES 65
 
@@ -109,6 +121,10 @@ extern memory_page memory_map_write[MEMORY_PAGES_IN_64K];
 extern memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 extern memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 
+/* Should the RAM be copied into snapshots? Cleared by in-memory states
+   which keep their own copy of the RAM */
+extern int memory_snapshot_ram;
+
 /* Which RAM page contains the current screen */
 extern int memory_current_screen;
 
@@ -119,6 +135,8 @@ void memory_register_startup( void );
 libspectrum_byte *memory_pool_allocate( size_t length );
 libspectrum_byte *memory_pool_allocate_persistent( size_t length,
                                                    int persistent );
+void memory_pool_adopt( libspectrum_byte *memory, size_t length,
+                        int persistent );
 void memory_pool_free( void );
 
 /* Map in alternate bank if ROMCS is set */
@@ -173,7 +191,34 @@ void memory_map_romcs_4k( libspectrum_word address, memory_page source[] );
 /* Page in 2K from /ROMCS */
 void memory_map_romcs_2k( libspectrum_word address, memory_page source[] );
 
+/* Use function pointers for the main memory accessors so they can be
+   switched to versions which check for breakpoints only while the
+   debugger is active, but functions for flexibility in the core tester */
+
+#ifndef CORETEST
+
+typedef libspectrum_byte (*memory_readbyte_fn)( libspectrum_word address );
+typedef void (*memory_writebyte_fn)( libspectrum_word address,
+                                     libspectrum_byte b );
+typedef libspectrum_word (*memory_readword_fn)( libspectrum_word address );
+
+extern memory_readbyte_fn readbyte;
+extern memory_writebyte_fn writebyte;
+
+/* Two readbyte()s, low byte first, in one go where possible */
+extern memory_readword_fn readword;
+
+/* Select the memory accessors according to whether the debugger is
+   active or not */
+void memory_set_debugger_accessors( int debugger_active );
+
+#else				/* #ifndef CORETEST */
+
 libspectrum_byte readbyte( libspectrum_word address );
+void writebyte( libspectrum_word address, libspectrum_byte b );
+libspectrum_word readword( libspectrum_word address );
+
+#endif				/* #ifndef CORETEST */
 
 /* Use a macro for performance in the main core, but a function for
    flexibility in the core tester */
@@ -189,9 +234,12 @@ libspectrum_byte readbyte_internal( libspectrum_word address );
 
 #endif				/* #ifndef CORETEST */
 
-void writebyte( libspectrum_word address, libspectrum_byte b );
 void writebyte_internal( libspectrum_word address, libspectrum_byte b );
 
+/* To be called after changing RAM[] other than via writebyte_internal(),
+   so in-memory states don't miss the change */
+void memory_ram_changed( void );
+
 typedef void (*memory_display_dirty_fn)( libspectrum_word address,
                                          libspectrum_byte b );
 extern memory_display_dirty_fn memory_display_dirty;
@@ -0,0 +1,126 @@
+/* memory_usage.c: keeping track of where the host's memory goes
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * Each subsystem which holds on to a significant amount of memory tells
+ * us as its buffers come and go, so that the current and peak use of
+ * each can be shown by the debugger's `memory' command or the widget
+ * UI's memory usage page. The figures are for the buffers themselves;
+ * allocator overheads and libspectrum's own bookkeeping aren't counted.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#include "memory_usage.h"
+
+typedef struct memory_usage_t {
+  size_t current, peak;
+} memory_usage_t;
+
+static memory_usage_t usage[ MEMORY_USAGE_TYPES ];
+
+static const char * const names[ MEMORY_USAGE_TYPES ] = {
+  "RAM pages",
+  "Disk tracks",
+  "Tape data",
+  "RZX frames",
+  "Rewind states",
+  "Scaler surfaces",
+  "Sound buffers",
+  "Memory pools",
+};
+
+void
+memory_usage_add( memory_usage_type type, size_t bytes )
+{
+  memory_usage_set( type, usage[ type ].current + bytes );
+}
+
+void
+memory_usage_remove( memory_usage_type type, size_t bytes )
+{
+  usage[ type ].current -=
+    bytes < usage[ type ].current ? bytes : usage[ type ].current;
+}
+
+void
+memory_usage_set( memory_usage_type type, size_t bytes )
+{
+  usage[ type ].current = bytes;
+  if( bytes > usage[ type ].peak ) usage[ type ].peak = bytes;
+}
+
+size_t
+memory_usage_current( memory_usage_type type )
+{
+  return usage[ type ].current;
+}
+
+size_t
+memory_usage_peak( memory_usage_type type )
+{
+  return usage[ type ].peak;
+}
+
+const char*
+memory_usage_name( memory_usage_type type )
+{
+  return names[ type ];
+}
+
+void
+memory_usage_describe( char *buffer, size_t length, size_t bytes )
+{
+  if( bytes < 10 * 1024 )
+    snprintf( buffer, length, "%luB", (unsigned long)bytes );
+  else if( bytes < 10 * 1024 * 1024 )
+    snprintf( buffer, length, "%luK", (unsigned long)( bytes / 1024 ) );
+  else
+    snprintf( buffer, length, "%.1fM", bytes / ( 1024.0 * 1024.0 ) );
+}
+
+void
+memory_usage_print( void )
+{
+  char current[16], peak[16];
+  size_t total = 0, total_peak = 0;
+  int i;
+
+  printf( "%-16s %9s %9s\n", "", "Current", "Peak" );
+
+  for( i = 0; i < MEMORY_USAGE_TYPES; i++ ) {
+    memory_usage_describe( current, sizeof( current ), usage[i].current );
+    memory_usage_describe( peak, sizeof( peak ), usage[i].peak );
+    printf( "%-16s %9s %9s\n", names[i], current, peak );
+    total += usage[i].current;
+    total_peak += usage[i].peak;
+  }
+
+  /* The peaks may not all have happened at once, so their sum is only an
+     upper bound */
+  memory_usage_describe( current, sizeof( current ), total );
+  memory_usage_describe( peak, sizeof( peak ), total_peak );
+  printf( "%-16s %9s %9s\n", "Total", current, peak );
+}
@@ -0,0 +1,58 @@
+/* memory_usage.h: keeping track of where the host's memory goes
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_MEMORY_USAGE_H
+#define FUSE_MEMORY_USAGE_H
+
+#include <stdlib.h>
+
+typedef enum memory_usage_type {
+
+  MEMORY_USAGE_RAM,		/* RAM pages, ROMs and peripheral memory */
+  MEMORY_USAGE_DISK,		/* Disk tracks */
+  MEMORY_USAGE_TAPE,		/* Tape data */
+  MEMORY_USAGE_RZX,		/* RZX frames and autosaves */
+  MEMORY_USAGE_REWIND,		/* Rewind states */
+  MEMORY_USAGE_SCALER,		/* Display and scaler surfaces */
+  MEMORY_USAGE_SOUND,		/* Sound buffers */
+  MEMORY_USAGE_POOLS,		/* Memory pools (the debugger's) */
+
+  MEMORY_USAGE_TYPES		/* End marker */
+
+} memory_usage_type;
+
+void memory_usage_add( memory_usage_type type, size_t bytes );
+void memory_usage_remove( memory_usage_type type, size_t bytes );
+void memory_usage_set( memory_usage_type type, size_t bytes );
+
+size_t memory_usage_current( memory_usage_type type );
+size_t memory_usage_peak( memory_usage_type type );
+const char* memory_usage_name( memory_usage_type type );
+
+/* Write `bytes' in a short human readable form */
+void memory_usage_describe( char *buffer, size_t length, size_t bytes );
+
+/* Print the current and peak use of everything to standard output */
+void memory_usage_print( void );
+
+#endif			/* #ifndef FUSE_MEMORY_USAGE_H */
@@ -23,6 +23,7 @@
 
 #include <config.h>
 
+#include <stddef.h>
 #include <string.h>
 
 #ifdef HAVE_LIB_GLIB
@@ -34,6 +35,45 @@
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "mempool.h"
+#include "memory_usage.h"
+
+/* Each pool is an arena: allocations are carved off the front of a block
+   in turn, and freeing the pool just frees the blocks rather than every
+   allocation made from them */
+
+/* The size of the blocks most allocations are carved from */
+#define MEMPOOL_BLOCK_SIZE 4096
+
+/* Allocations bigger than this get a block to themselves, so they don't
+   waste the rest of the current block */
+#define MEMPOOL_LARGE ( MEMPOOL_BLOCK_SIZE / 4 )
+
+/* Allocations are rounded up to a multiple of this so they stay aligned
+   for anything which could be stored in them */
+typedef union mempool_align {
+  long l;
+  double d;
+  void *p;
+} mempool_align;
+
+#define MEMPOOL_ALIGN( size ) \
+  ( ( (size) + sizeof( mempool_align ) - 1 ) & ~( sizeof( mempool_align ) - 1 ) )
+
+typedef struct mempool_block {
+
+  struct mempool_block *next;
+  size_t size, used;
+
+  mempool_align data[1];	/* The memory itself; really `size' bytes */
+
+} mempool_block;
+
+typedef struct mempool {
+
+  mempool_block *blocks;	/* The block being carved from is first */
+  size_t allocations;		/* Number made since the pool was last freed */
+
+} mempool;
 
 static GArray *memory_pools;
 
@@ -42,7 +82,7 @@ const int MEMPOOL_UNTRACKED = -1;
 static int
 mempool_init( void *context )
 {
-  memory_pools = g_array_new( FALSE, FALSE, sizeof( GArray* ) );
+  memory_pools = g_array_new( FALSE, FALSE, sizeof( mempool* ) );
 
   return 0;
 }
@@ -50,45 +90,90 @@ mempool_init( void *context )
 int
 mempool_register_pool( void )
 {
-  GArray *pool = g_array_new( FALSE, FALSE, sizeof( void* ) );
+  mempool *pool = libspectrum_new( mempool, 1 );
+
+  pool->blocks = NULL;
+  pool->allocations = 0;
 
   g_array_append_val( memory_pools, pool );
 
   return memory_pools->len - 1;
 }
 
-void*
-mempool_malloc( int pool, size_t size )
+static mempool_block*
+block_new( size_t size )
 {
-  void *ptr;
+  mempool_block *block =
+    libspectrum_malloc( offsetof( mempool_block, data ) + size );
 
-  if( pool == MEMPOOL_UNTRACKED ) return libspectrum_malloc( size );
+  block->size = size;
+  block->used = 0;
+
+  memory_usage_add( MEMORY_USAGE_POOLS, size );
+
+  return block;
+}
+
+static void*
+pool_alloc( int pool, size_t size )
+{
+  mempool *p;
+  mempool_block *block;
+  void *ptr;
 
   if( pool < 0 || pool >= memory_pools->len ) return NULL;
 
-  ptr = libspectrum_malloc( size );
-  if( !ptr ) return NULL;
+  p = g_array_index( memory_pools, mempool*, pool );
+  size = MEMPOOL_ALIGN( size ? size : 1 );
+
+  if( size > MEMPOOL_LARGE ) {
+
+    /* Put it behind the current block, which can carry on being used */
+    block = block_new( size );
+    block->used = size;
+    if( p->blocks ) {
+      block->next = p->blocks->next;
+      p->blocks->next = block;
+    } else {
+      block->next = NULL;
+      p->blocks = block;
+    }
+
+  } else {
 
-  g_array_append_val( g_array_index( memory_pools, GArray*, pool ), ptr );
+    block = p->blocks;
+    if( !block || block->size - block->used < size ) {
+      block = block_new( MEMPOOL_BLOCK_SIZE );
+      block->next = p->blocks;
+      p->blocks = block;
+    }
+
+    block->used += size;
+
+  }
+
+  ptr = (libspectrum_byte*)block->data + block->used - size;
+  p->allocations++;
 
   return ptr;
 }
 
+void*
+mempool_malloc( int pool, size_t size )
+{
+  if( pool == MEMPOOL_UNTRACKED ) return libspectrum_malloc( size );
+
+  return pool_alloc( pool, size );
+}
+
 void *
 mempool_malloc_n( int pool, size_t nmemb, size_t size )
 {
-  void *ptr;
-
   if( pool == MEMPOOL_UNTRACKED ) return libspectrum_malloc_n( nmemb, size );
 
-  if( pool < 0 || pool >= memory_pools->len ) return NULL;
+  if( nmemb && size > (size_t)-1 / nmemb ) return NULL;
 
-  ptr = libspectrum_malloc_n( nmemb, size );
-  if( !ptr ) return NULL;
-
-  g_array_append_val( g_array_index( memory_pools, GArray*, pool ), ptr );
-
-  return ptr;
+  return pool_alloc( pool, nmemb * size );
 }
 
 char*
@@ -104,17 +189,37 @@ mempool_strdup( int pool, const char *string )
   return ptr;
 }
 
-void
-mempool_free( int pool )
+static void
+free_blocks( mempool_block *block )
 {
-  size_t i;
+  mempool_block *next;
 
-  GArray *p = g_array_index( memory_pools, GArray*, pool );
+  for( ; block; block = next ) {
+    next = block->next;
+    memory_usage_remove( MEMORY_USAGE_POOLS, block->size );
+    libspectrum_free( block );
+  }
+}
 
-  for( i = 0; i < p->len; i++ )
-    libspectrum_free( g_array_index( p, void*, i ) );
+void
+mempool_free( int pool )
+{
+  mempool *p = g_array_index( memory_pools, mempool*, pool );
+  mempool_block *keep = p->blocks;
+
+  /* Keep the current block for next time if it's an ordinary one; the
+     debugger's pool is emptied after every command, and this saves going
+     back to the system allocator each time */
+  if( keep && keep->size == MEMPOOL_BLOCK_SIZE ) {
+    free_blocks( keep->next );
+    keep->next = NULL;
+    keep->used = 0;
+  } else {
+    free_blocks( keep );
+    p->blocks = NULL;
+  }
 
-  g_array_set_size( p, 0 );
+  p->allocations = 0;
 }
 
 /* Tidy-up function called at end of emulation */
@@ -122,14 +227,15 @@ static void
 mempool_end( void )
 {
   int i;
-  GArray *pool;
+  mempool *pool;
 
   if( !memory_pools ) return;
 
   for( i = 0; i < memory_pools->len; i++ ) {
-    pool = g_array_index( memory_pools, GArray *, i );
+    pool = g_array_index( memory_pools, mempool*, i );
 
-    g_array_free( pool, TRUE );
+    free_blocks( pool->blocks );
+    libspectrum_free( pool );
   }
 
   g_array_free( memory_pools, TRUE );
@@ -156,5 +262,5 @@ mempool_get_pools( void )
 int
 mempool_get_pool_size( int pool )
 {
-  return g_array_index( memory_pools, GArray*, pool )->len;
+  return g_array_index( memory_pools, mempool*, pool )->allocations;
 }
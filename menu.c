@@ -54,8 +54,10 @@
 #include "psg.h"
 #include "rzx.h"
 #include "screenshot.h"
+#include "session.h"
 #include "settings.h"
 #include "snapshot.h"
+#include "soundrec.h"
 #include "svg.h"
 #include "tape.h"
 #include "ui/scaler/scaler.h"
@@ -97,23 +99,11 @@ MENU_CALLBACK( menu_file_open )
 
 MENU_CALLBACK( menu_file_recording_insertsnapshot )
 {
-  libspectrum_snap *snap;
-  libspectrum_error error;
-
   if( !rzx_recording ) return;
 
   ui_widget_finish();
 
-  libspectrum_rzx_stop_input( rzx );
-
-  snap = libspectrum_snap_alloc();
-
-  error = snapshot_copy_to( snap );
-  if( error ) { libspectrum_snap_free( snap ); return; }
-
-  libspectrum_rzx_add_snap( rzx, snap, 0 );
-
-  libspectrum_rzx_start_input( rzx, tstates );
+  rzx_insert_snapshot();
 }
 
 MENU_CALLBACK( menu_file_recording_rollback )
@@ -224,6 +214,16 @@ MENU_CALLBACK( menu_file_aylogging_stop )
   ui_menu_activate( UI_MENU_ITEM_AY_LOGGING, 0 );
 }
 
+MENU_CALLBACK( menu_file_soundrecording_stop )
+{
+  if ( !soundrec_recording ) return;
+
+  ui_widget_finish();
+
+  soundrec_stop();
+  ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 0 );
+}
+
 MENU_CALLBACK( menu_file_screenshot_openscrscreenshot )
 {
   char *filename;
@@ -1154,8 +1154,32 @@ MENU_CALLBACK( menu_file_aylogging_record )
   fuse_emulation_unpause();
 }
 
-int
-menu_check_media_changed( void )
+MENU_CALLBACK( menu_file_soundrecording_record )
+{
+  char *filename;
+
+  if( soundrec_recording ) return;
+
+  fuse_emulation_pause();
+
+#if USE_WIDGET && GCWZERO
+  ui_widget_set_file_filter_for_class( FILTER_CLASS_SOUND_RECORDING, 1 );
+#endif
+  filename = ui_get_save_filename( "Fuse - Record Sound" );
+  if( !filename ) { fuse_emulation_unpause(); return; }
+
+  if( !soundrec_start( filename ) )
+    ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 1 );
+
+  libspectrum_free( filename );
+
+  display_refresh_all();
+
+  fuse_emulation_unpause();
+}
+
+static int
+menu_eject_media( void )
 {
   int confirm, i;
 
@@ -1216,6 +1240,20 @@ menu_check_media_changed( void )
   return 0;
 }
 
+int
+menu_check_media_changed( void )
+{
+  /* The session has to be taken while everything is still inserted */
+  session_save();
+
+  if( menu_eject_media() ) {
+    session_discard();
+    return 1;
+  }
+
+  return 0;
+}
+
 static int
 menu_select_machine_roms( libspectrum_machine machine, size_t start, size_t n )
 {
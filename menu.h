@@ -54,6 +54,9 @@
  */
 
 MENU_CALLBACK( menu_file_open );
+#ifdef USE_WIDGET
+MENU_CALLBACK( menu_file_library );
+#endif
 MENU_CALLBACK( menu_file_recording_continuerecording );
 MENU_CALLBACK( menu_file_recording_insertsnapshot );
 MENU_CALLBACK( menu_file_recording_rollback );
@@ -62,6 +65,7 @@ MENU_CALLBACK( menu_file_recording_play );
 MENU_CALLBACK( menu_file_recording_stop );
 MENU_CALLBACK( menu_file_recording_finalise );
 MENU_CALLBACK( menu_file_aylogging_stop );
+MENU_CALLBACK( menu_file_soundrecording_stop );
 MENU_CALLBACK( menu_file_screenshot_openscrscreenshot );
 MENU_CALLBACK( menu_file_screenshot_openmltscreenshot );
 
@@ -129,6 +133,7 @@ MENU_CALLBACK( menu_file_savebinarydata );
 MENU_CALLBACK( menu_file_exit );
 
 MENU_CALLBACK( menu_file_aylogging_record );
+MENU_CALLBACK( menu_file_soundrecording_record );
 
 MENU_CALLBACK( menu_file_screenshot_savescreenasscr );
 MENU_CALLBACK( menu_file_screenshot_savescreenaspng );
@@ -202,6 +207,9 @@ MENU_CALLBACK( menu_machine_debugger );
 MENU_CALLBACK( menu_machine_pokefinder );
 MENU_CALLBACK( menu_machine_pokememory );
 MENU_CALLBACK( menu_machine_memorybrowser );
+#ifdef USE_WIDGET
+MENU_CALLBACK( menu_machine_memoryusage );
+#endif
 
 MENU_CALLBACK( menu_help_keyboard );
 MENU_CALLBACK( menu_help_about );
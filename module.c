@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #ifdef HAVE_LIB_GLIB
 #include <glib.h>
 #endif				/* #ifdef HAVE_LIB_GLIB */
@@ -30,6 +32,7 @@
 #include <libspectrum.h>
 
 #include "compat.h"
+#include "machine.h"
 #include "module.h"
 
 static GSList *registered_modules = NULL;
@@ -122,3 +125,108 @@ module_snapshot_to( libspectrum_snap *snap )
 {
   g_slist_foreach( registered_modules, snapshot_to, snap );
 }
+
+void
+module_state_init( module_state_t *state )
+{
+  state->buffer = NULL;
+  state->length = state->allocated = state->position = 0;
+  state->error = 0;
+  state->ram = NULL;
+  state->ram_length = 0;
+  state->ram_generation = 0;
+}
+
+void
+module_state_free( module_state_t *state )
+{
+  libspectrum_free( state->buffer );
+  libspectrum_free( state->ram );
+  module_state_init( state );
+}
+
+void
+module_state_write( module_state_t *state, const void *data, size_t length )
+{
+  if( state->allocated - state->length < length ) {
+    size_t needed = state->length + length;
+
+    state->allocated = state->allocated ? state->allocated : 0x1000;
+    while( state->allocated < needed ) state->allocated *= 2;
+    state->buffer = libspectrum_renew( libspectrum_byte, state->buffer,
+                                       state->allocated );
+  }
+
+  memcpy( state->buffer + state->length, data, length );
+  state->length += length;
+}
+
+void
+module_state_read( module_state_t *state, void *data, size_t length )
+{
+  if( state->length - state->position < length ) {
+    state->error = 1;
+    memset( data, 0, length );
+    return;
+  }
+
+  memcpy( data, state->buffer + state->position, length );
+  state->position += length;
+}
+
+/* What comes before the modules' own state */
+typedef struct module_state_header_t {
+  libspectrum_dword version;
+  int machine;
+} module_state_header_t;
+
+static void
+state_to( gpointer data, gpointer user_data )
+{
+  const module_info_t *module = data;
+  module_state_t *state = user_data;
+
+  if( module->state_to ) module->state_to( state );
+}
+
+void
+module_state_save( module_state_t *state )
+{
+  module_state_header_t header;
+
+  memset( &header, 0, sizeof( header ) );
+  header.version = MODULE_STATE_VERSION;
+  header.machine = machine_current->machine;
+
+  state->length = 0;
+  module_state_write( state, &header, sizeof( header ) );
+
+  g_slist_foreach( registered_modules, state_to, state );
+}
+
+static void
+state_from( gpointer data, gpointer user_data )
+{
+  const module_info_t *module = data;
+  module_state_t *state = user_data;
+
+  if( module->state_from && !state->error ) module->state_from( state );
+}
+
+int
+module_state_restore( module_state_t *state )
+{
+  module_state_header_t header;
+
+  state->position = 0;
+  state->error = 0;
+
+  module_state_read( state, &header, sizeof( header ) );
+  if( state->error || header.version != MODULE_STATE_VERSION ||
+      header.machine != machine_current->machine )
+    return 1;
+
+  g_slist_foreach( registered_modules, state_from, state );
+
+  return state->error || state->position != state->length;
+}
@@ -32,6 +32,35 @@ typedef void (*module_snapshot_enabled_fn)( libspectrum_snap *snap );
 typedef void (*module_snapshot_from_fn)( libspectrum_snap *snap );
 typedef void (*module_snapshot_to_fn)( libspectrum_snap *snap );
 
+/* A compact in-memory copy of the machine state. Each module writes its
+   raw state into the buffer with module_state_write() and reads it back
+   in the same order with module_state_read(); this is much quicker than
+   going via a libspectrum_snap, but a state can only be restored in the
+   same run of Fuse on the same machine it was saved from. The buffer is
+   kept from one save to the next, so after the first save no memory is
+   allocated.
+
+   The RAM is kept apart from the buffer: the memory code tracks which 2K
+   chunks have been written to, so saving into a state or restoring from
+   it only copies the chunks which differ from the last time the state
+   and the RAM matched */
+typedef struct module_state_t {
+
+  libspectrum_byte *buffer;
+  size_t length;		/* Bytes written */
+  size_t allocated;		/* Bytes available */
+  size_t position;		/* Where the next read comes from */
+  int error;			/* Set if a read ran past the end */
+
+  libspectrum_byte *ram;	/* The copy of the RAM */
+  size_t ram_length;
+  libspectrum_dword ram_generation; /* When the RAM last matched `ram' */
+
+} module_state_t;
+
+typedef void (*module_state_to_fn)( module_state_t *state );
+typedef void (*module_state_from_fn)( module_state_t *state );
+
 typedef struct module_info_t
 {
 
@@ -40,6 +69,8 @@ typedef struct module_info_t
   module_snapshot_enabled_fn snapshot_enabled;
   module_snapshot_from_fn snapshot_from;
   module_snapshot_to_fn snapshot_to;
+  module_state_to_fn state_to;
+  module_state_from_fn state_from;
 
 } module_info_t;
 
@@ -52,4 +83,22 @@ void module_snapshot_enabled( libspectrum_snap *snap );
 void module_snapshot_from( libspectrum_snap *snap );
 void module_snapshot_to( libspectrum_snap *snap );
 
+/* Bump whenever what any module writes into a state changes */
+#define MODULE_STATE_VERSION 1
+
+void module_state_init( module_state_t *state );
+void module_state_free( module_state_t *state );
+
+void module_state_write( module_state_t *state, const void *data,
+                         size_t length );
+void module_state_read( module_state_t *state, void *data, size_t length );
+
+/* Save the state of every module into `state', replacing whatever was
+   there before */
+void module_state_save( module_state_t *state );
+
+/* Put every module back as it was in `state'. Returns non-zero if the
+   state came from a different version or machine, or is damaged */
+int module_state_restore( module_state_t *state );
+
 #endif			/* #ifndef FUSE_MODULE_H */
@@ -39,6 +39,7 @@
 
 #include "display.h"
 #include "fuse.h"
+#include "infrastructure/writer_queue.h"
 #include "machine.h"
 #include "movie.h"
 #include "movie_tables.h"
@@ -138,6 +139,23 @@ static unsigned char zbuf_o[ ZBUF_SIZE ];
 
 static unsigned char alaw_table[2048 + 1] = { ALAW_ENC_TAB };
 
+/* Everything written during a frame is gathered up here, and written
+   out, compressed, at the start of the next frame */
+static libspectrum_byte *packet = NULL;
+static size_t packet_length, packet_allocated;
+
+/* The compression and writing is done on a writer thread, if there is
+   one. If it gets more than this far behind, the emulation waits for it
+   to catch up */
+#define MOVIE_QUEUE_LIMIT ( 4 * 1024 * 1024 )
+
+typedef struct movie_packet {
+  libspectrum_byte *data;
+  size_t length;
+} movie_packet;
+
+static writer_queue *movie_writer = NULL;
+
 void movie_start_frame( void );
 void movie_init_sound( int f, int s );
 
@@ -186,14 +204,16 @@ get_screentype( void )
   return '$';	/* STANDARD screen */
 }
 
+/* Write a packet out to the file; runs on the writer thread if there
+   is one */
 #ifdef HAVE_ZLIB_H
 static void
-fwrite_compr( const void *b, size_t n, size_t m, FILE *f )
+write_compr( const void *b, size_t n )
 {
   if( fmf_compr == 0 ) {
-    fwrite( b, n, m, f );
+    fwrite( b, n, 1, of );
   } else {
-    zstream.avail_in = n * m;
+    zstream.avail_in = n;
     zstream.next_in = b;
     zstream.avail_out = ZBUF_SIZE;
     zstream.next_out = zbuf_o;
@@ -209,9 +229,60 @@ fwrite_compr( const void *b, size_t n, size_t m, FILE *f )
   }
 }
 #else	/* HAVE_ZLIB_H */
-#define fwrite_compr fwrite
+static void
+write_compr( const void *b, size_t n )
+{
+  fwrite( b, n, 1, of );
+}
 #endif	/* HAVE_ZLIB_H */
 
+/* Add data to the current frame's packet */
+static void
+fwrite_compr( const void *b, size_t n, size_t m, FILE *f GCC_UNUSED )
+{
+  if( packet_allocated - packet_length < n * m ) {
+    packet_allocated = packet_length + n * m + 0x4000;
+    packet = libspectrum_renew( libspectrum_byte, packet, packet_allocated );
+  }
+
+  memcpy( packet + packet_length, b, n * m );
+  packet_length += n * m;
+}
+
+/* Write a queued packet; runs on the writer thread */
+static void
+movie_write_packet( void *job )
+{
+  movie_packet *p = job;
+
+  write_compr( p->data, p->length );
+
+  libspectrum_free( p->data );
+  libspectrum_free( p );
+}
+
+/* Hand the current frame's packet over to be written */
+static void
+movie_flush( void )
+{
+  if( !packet_length ) return;
+
+  if( movie_writer ) {
+    movie_packet *p = libspectrum_new( movie_packet, 1 );
+
+    p->data = packet;
+    p->length = packet_length;
+    writer_queue_push( movie_writer, p, p->length, 1 );
+
+    packet = NULL;
+    packet_length = packet_allocated = 0;
+    return;
+  }
+
+  write_compr( packet, packet_length );
+  packet_length = 0;
+}
+
 static void
 movie_compress_area( int x, int y, int w, int h, int s )
 {
@@ -322,7 +393,7 @@ movie_start_fmf( const char *name )
 #else	/* HAVE_ZLIB_H */
   fwrite( "U", 1, 1, of );		/* cannot be compressed */
 #endif	/* HAVE_ZLIB_H */
-  movie_init_sound( settings_current.sound_freq,
+  movie_init_sound( sound_freq,
                     sound_stereo_ay != SOUND_STEREO_AY_NONE );
   head[0] = settings_current.frame_rate;
   head[1] = get_screentype();
@@ -333,6 +404,8 @@ movie_start_fmf( const char *name )
   head[6] = stereo;
   head[7] = '\n';	/* padding */
   fwrite( head, 8, 1, of );		/* write initial params */
+  movie_writer = writer_queue_start( "movie", movie_write_packet, NULL,
+                                     MOVIE_QUEUE_LIMIT );
   movie_add_area( 0, 0, 40, 240 );
 }
 
@@ -355,6 +428,14 @@ movie_stop( void )
   if( !movie_paused && !movie_recording ) return;
 
   fwrite_compr( "X", 1, 1, of );	/* End of Recording! */
+  movie_flush();
+  if( movie_writer ) {
+    writer_queue_stop( movie_writer, NULL );
+    movie_writer = NULL;
+  }
+  libspectrum_free( packet );
+  packet = NULL;
+  packet_length = packet_allocated = 0;
 #ifdef HAVE_ZLIB_H
   {
     if( fmf_compr != 0 ) {		/* close zlib */
@@ -467,6 +548,9 @@ movie_add_sound( libspectrum_signed_word *buff, int len )
 void
 movie_start_frame( void )
 {
+  /* The last frame is complete, so it can go out now */
+  movie_flush();
+
   /* $ - ZX$, T - TX$, C - HiCol, R - HiRes */
   head[0] = 'N';
   head[1] = settings_current.frame_rate;
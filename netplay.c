@@ -0,0 +1,635 @@
+/* netplay.c: two player emulation over the network
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* With --netplay-peer host, two copies of Fuse started with the same
+   machine and the same file emulate the same machine in step. This rests
+   on what RZX playback already relies on: given the same starting state,
+   the emulation is entirely determined by what the keyboard and joystick
+   ports return. So the keyboard half-rows and joystick values are the
+   only things the two sides swap, once a frame, over UDP; while playing,
+   the machine sees both players' input combined, as if they were sitting
+   at the same keyboard.
+
+   Rather than waiting every frame for the other side's input, each side
+   goes ahead using the last input it had from the other, saving the
+   machine state at the start of every frame with the modules' in-memory
+   states as running ahead does. When the other side's input turns up
+   and differs from the guess, the machine goes back to the first frame
+   which was wrong and does the frames since again, silently, with the
+   right input. Only if one side gets more than --netplay-frames frames
+   ahead of the input it has from the other does it stop and wait.
+
+   Packets are received on a thread of their own, so that nothing which
+   arrives while the emulation is busy is lost. Every packet carries all
+   the input the other side hasn't yet said it has, so lost packets need
+   no special handling. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef BUILD_NETPLAY
+#include <pthread.h>
+#endif				/* #ifdef BUILD_NETPLAY */
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "keyboard.h"
+#include "module.h"
+#include "netplay.h"
+#include "runahead.h"
+#include "settings.h"
+#include "thread_sched.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "utils.h"
+
+int netplay_active = 0;
+
+netplay_input_t netplay_machine_input;
+
+#ifdef BUILD_NETPLAY
+
+/* How many frames of input and state are kept */
+#define NETPLAY_FRAMES 32
+
+/* The most frames either side can go ahead of the other. Frames back to
+   twice this can be waiting to be acknowledged, so it must be well
+   inside NETPLAY_FRAMES */
+#define NETPLAY_MAX_AHEAD 12
+
+/* How long to wait for the other side before giving up, in seconds */
+#define NETPLAY_TIMEOUT 30
+
+/* Each packet is the magic, the number of frames of input the sender has
+   from us, the first frame it carries input for and how many frames
+   there are, followed by the input itself */
+static const libspectrum_byte netplay_magic[4] = { 'F', 'N', 'P', '1' };
+
+#define NETPLAY_HEADER_LENGTH 13
+#define NETPLAY_INPUT_LENGTH 12
+#define NETPLAY_PACKET_LENGTH \
+  ( NETPLAY_HEADER_LENGTH + NETPLAY_FRAMES * NETPLAY_INPUT_LENGTH )
+
+typedef struct netplay_frame_t {
+
+  module_state_t state;		/* The machine as the frame started */
+  netplay_input_t local;
+  netplay_input_t remote;	/* Maybe only a guess */
+
+} netplay_frame_t;
+
+static netplay_frame_t frames[ NETPLAY_FRAMES ];
+
+/* The next frame to be emulated, counting from when play started */
+static libspectrum_dword next_frame;
+
+/* Frames before this were emulated with the right input from the other
+   side */
+static libspectrum_dword confirmed;
+
+static int started;
+
+/* Will this frame need netplay_run() at its end? */
+static int pending;
+
+/* Where a going back started */
+static libspectrum_dword replay_start;
+
+static int ahead;
+
+static compat_socket_t netplay_socket;
+static struct addrinfo *peer_address;
+
+static pthread_t receiver_thread;
+static compat_socket_selfpipe_t *selfpipe;
+static volatile int stop_receiver;
+
+/* Everything after here is shared with the receiver thread */
+static pthread_mutex_t receiver_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The input the other side has sent */
+static netplay_input_t remote_input[ NETPLAY_FRAMES ];
+
+/* Frames before this have arrived from the other side */
+static libspectrum_dword remote_received;
+
+/* Frames before this have been copied out of `remote_input' */
+static libspectrum_dword remote_consumed;
+
+/* Frames before this have arrived at the other side */
+static libspectrum_dword local_acknowledged;
+
+/* When anything last arrived from the other side */
+static double last_heard;
+
+static void
+input_idle( netplay_input_t *input )
+{
+  memset( input->keyboard, 0xff, sizeof( input->keyboard ) );
+  input->joystick.kempston = 0x00;
+  input->joystick.timex1 = input->joystick.timex2 = 0x00;
+  input->joystick.fuller = 0xff;
+}
+
+static void
+input_write( libspectrum_byte **ptr, const netplay_input_t *input )
+{
+  memcpy( *ptr, input->keyboard, sizeof( input->keyboard ) );
+  *ptr += sizeof( input->keyboard );
+  *(*ptr)++ = input->joystick.kempston;
+  *(*ptr)++ = input->joystick.timex1;
+  *(*ptr)++ = input->joystick.timex2;
+  *(*ptr)++ = input->joystick.fuller;
+}
+
+static void
+input_read( const libspectrum_byte **ptr, netplay_input_t *input )
+{
+  memcpy( input->keyboard, *ptr, sizeof( input->keyboard ) );
+  *ptr += sizeof( input->keyboard );
+  input->joystick.kempston = *(*ptr)++;
+  input->joystick.timex1 = *(*ptr)++;
+  input->joystick.timex2 = *(*ptr)++;
+  input->joystick.fuller = *(*ptr)++;
+}
+
+static void
+receive_packet( const libspectrum_byte *buffer, size_t length )
+{
+  libspectrum_dword acknowledged, first, frame;
+  size_t count, i;
+  netplay_input_t input;
+
+  if( length < NETPLAY_HEADER_LENGTH ||
+      memcmp( buffer, netplay_magic, sizeof( netplay_magic ) ) )
+    return;
+  buffer += sizeof( netplay_magic );
+
+  acknowledged = libspectrum_read_dword( &buffer );
+  first = libspectrum_read_dword( &buffer );
+  count = *buffer++;
+
+  if( length != NETPLAY_HEADER_LENGTH + count * NETPLAY_INPUT_LENGTH ) return;
+
+  pthread_mutex_lock( &receiver_mutex );
+
+  last_heard = timer_get_time();
+
+  if( acknowledged > local_acknowledged ) local_acknowledged = acknowledged;
+
+  for( i = 0; i < count; i++ ) {
+    input_read( &buffer, &input );
+    frame = first + i;
+
+    /* Only the next frame wanted is any use; the rest will come again */
+    if( frame != remote_received ||
+        frame >= remote_consumed + NETPLAY_FRAMES ) continue;
+
+    remote_input[ frame % NETPLAY_FRAMES ] = input;
+    remote_received++;
+  }
+
+  pthread_mutex_unlock( &receiver_mutex );
+}
+
+static void*
+receiver_thread_fn( void *arg GCC_UNUSED )
+{
+  libspectrum_byte buffer[ NETPLAY_PACKET_LENGTH ];
+  compat_socket_t selfpipe_socket =
+    compat_socket_selfpipe_get_read_fd( selfpipe );
+  int max_fd = netplay_socket > selfpipe_socket ? netplay_socket :
+                                                  selfpipe_socket;
+
+  thread_sched_apply( THREAD_SCHED_IO );
+
+  while( !stop_receiver ) {
+    fd_set readfds;
+    ssize_t length;
+
+    FD_ZERO( &readfds );
+    FD_SET( netplay_socket, &readfds );
+    FD_SET( selfpipe_socket, &readfds );
+
+    if( select( max_fd + 1, &readfds, NULL, NULL, NULL ) == -1 ) continue;
+
+    if( FD_ISSET( selfpipe_socket, &readfds ) )
+      compat_socket_selfpipe_discard_data( selfpipe );
+
+    if( FD_ISSET( netplay_socket, &readfds ) ) {
+      length = recv( netplay_socket, (char*)buffer, sizeof( buffer ), 0 );
+      if( length > 0 ) receive_packet( buffer, length );
+    }
+  }
+
+  return NULL;
+}
+
+/* Send the other side all the input it hasn't said it has */
+static void
+send_input( void )
+{
+  libspectrum_byte buffer[ NETPLAY_PACKET_LENGTH ], *ptr = buffer;
+  libspectrum_dword first, acknowledged, frame;
+
+  pthread_mutex_lock( &receiver_mutex );
+  first = local_acknowledged;
+  acknowledged = remote_received;
+  pthread_mutex_unlock( &receiver_mutex );
+
+  if( next_frame + 1 - first > NETPLAY_FRAMES )
+    first = next_frame + 1 - NETPLAY_FRAMES;
+
+  memcpy( ptr, netplay_magic, sizeof( netplay_magic ) );
+  ptr += sizeof( netplay_magic );
+  libspectrum_write_dword( &ptr, acknowledged );
+  libspectrum_write_dword( &ptr, first );
+  *ptr++ = next_frame + 1 - first;
+
+  for( frame = first; frame <= next_frame; frame++ )
+    input_write( &ptr, &frames[ frame % NETPLAY_FRAMES ].local );
+
+  sendto( netplay_socket, (const char*)buffer, ptr - buffer, 0,
+          peer_address->ai_addr, peer_address->ai_addrlen );
+}
+
+static void
+netplay_stop( void )
+{
+  netplay_active = 0;
+  pending = 0;
+}
+
+/* Give the machine both players' input for `frame' */
+static void
+apply_input( libspectrum_dword frame )
+{
+  const netplay_frame_t *f = &frames[ frame % NETPLAY_FRAMES ];
+  netplay_input_t *input = &netplay_machine_input;
+  size_t i;
+
+  for( i = 0; i < sizeof( input->keyboard ); i++ )
+    input->keyboard[i] = f->local.keyboard[i] & f->remote.keyboard[i];
+
+  input->joystick.kempston = f->local.joystick.kempston |
+                             f->remote.joystick.kempston;
+  input->joystick.timex1 = f->local.joystick.timex1 |
+                           f->remote.joystick.timex1;
+  input->joystick.timex2 = f->local.joystick.timex2 |
+                           f->remote.joystick.timex2;
+  input->joystick.fuller = f->local.joystick.fuller &
+                           f->remote.joystick.fuller;
+}
+
+/* The best there is for the other side's input for `frame': what they
+   sent if it's here, or else the last thing they sent */
+static void
+remote_best( libspectrum_dword frame, libspectrum_dword received,
+             netplay_input_t *input )
+{
+  if( frame < received ) {
+    *input = remote_input[ frame % NETPLAY_FRAMES ];
+  } else if( received ) {
+    *input = remote_input[ ( received - 1 ) % NETPLAY_FRAMES ];
+  } else {
+    input_idle( input );
+  }
+}
+
+/* Returns non-zero if play has stopped */
+static int
+wait_for_peer( void )
+{
+  libspectrum_dword received;
+  double heard;
+  int waited = 0;
+
+  while( 1 ) {
+
+    pthread_mutex_lock( &receiver_mutex );
+    received = remote_received;
+    heard = last_heard;
+    pthread_mutex_unlock( &receiver_mutex );
+
+    if( received >= next_frame ||
+        next_frame - received <= (libspectrum_dword)ahead ) break;
+
+    if( timer_get_time() - heard > NETPLAY_TIMEOUT ) {
+      ui_error( UI_ERROR_ERROR, "netplay: nothing heard from %s for %d seconds",
+                settings_current.netplay_peer, NETPLAY_TIMEOUT );
+      netplay_stop();
+      return 1;
+    }
+
+    /* Our last packet may have been lost */
+    send_input();
+
+    ui_event();
+    if( fuse_exiting ) return 1;
+
+    timer_sleep( 5 );
+    waited = 1;
+  }
+
+  /* Don't try to catch up on the time spent waiting */
+  if( waited ) timer_estimate_reset();
+
+  return 0;
+}
+
+static void
+replay_frame( int frame )
+{
+  libspectrum_dword number = replay_start + frame;
+
+  if( frame ) module_state_save( &frames[ number % NETPLAY_FRAMES ].state );
+  apply_input( number );
+}
+
+/* Go back to the first frame emulated with the wrong input from the other
+   side, if there is one, and do it and the frames since again */
+static int
+replay( void )
+{
+  libspectrum_dword received, frame, wrong = next_frame;
+  netplay_input_t input;
+
+  pthread_mutex_lock( &receiver_mutex );
+
+  received = remote_received;
+
+  for( frame = confirmed; frame < next_frame; frame++ ) {
+    netplay_input_t *remote = &frames[ frame % NETPLAY_FRAMES ].remote;
+
+    remote_best( frame, received, &input );
+    if( memcmp( remote, &input, sizeof( input ) ) ) {
+      *remote = input;
+      if( wrong == next_frame ) wrong = frame;
+    }
+  }
+
+  confirmed = received < next_frame ? received : next_frame;
+  remote_consumed = confirmed;
+
+  pthread_mutex_unlock( &receiver_mutex );
+
+  if( wrong == next_frame ) return 0;
+
+  if( module_state_restore( &frames[ wrong % NETPLAY_FRAMES ].state ) ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't go back to frame %lu",
+              (unsigned long)wrong );
+    return 1;
+  }
+
+  replay_start = wrong;
+  runahead_emulate( next_frame - wrong, replay_frame );
+
+  return 0;
+}
+
+void
+netplay_frame( void )
+{
+  if( netplay_active && !runahead_active ) pending = 1;
+}
+
+void
+netplay_run( void )
+{
+  netplay_frame_t *frame;
+  libspectrum_dword received;
+
+  if( !pending ) return;
+  pending = 0;
+
+  if( fuse_exiting ) return;
+
+  if( !runahead_state_complete() ) {
+    ui_error( UI_ERROR_ERROR,
+              "netplay: this machine can't be played over the network; "
+              "stopping" );
+    netplay_stop();
+    return;
+  }
+
+  if( started ) {
+    next_frame++;
+  } else {
+    started = 1;
+  }
+
+  if( wait_for_peer() ) return;
+
+  if( replay() ) {
+    netplay_stop();
+    return;
+  }
+
+  frame = &frames[ next_frame % NETPLAY_FRAMES ];
+
+  memcpy( frame->local.keyboard, keyboard_return_values,
+          sizeof( frame->local.keyboard ) );
+  joystick_get_values( &frame->local.joystick );
+
+  pthread_mutex_lock( &receiver_mutex );
+  received = remote_received;
+  remote_best( next_frame, received, &frame->remote );
+  pthread_mutex_unlock( &receiver_mutex );
+
+  module_state_save( &frame->state );
+  apply_input( next_frame );
+
+  send_input();
+}
+
+static int
+open_socket( void )
+{
+  struct addrinfo hints, *local_address;
+  char port[16];
+  int error, peer_port;
+
+  peer_port = settings_current.netplay_peer_port ?
+              settings_current.netplay_peer_port :
+              settings_current.netplay_port;
+
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  snprintf( port, sizeof( port ), "%d", peer_port );
+  error = getaddrinfo( settings_current.netplay_peer, port, &hints,
+                       &peer_address );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't find %s: %s",
+              settings_current.netplay_peer, gai_strerror( error ) );
+    return 1;
+  }
+
+  hints.ai_family = peer_address->ai_family;
+  hints.ai_flags = AI_PASSIVE;
+
+  snprintf( port, sizeof( port ), "%d", settings_current.netplay_port );
+  error = getaddrinfo( NULL, port, &hints, &local_address );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't find local port %s: %s",
+              port, gai_strerror( error ) );
+    freeaddrinfo( peer_address ); peer_address = NULL;
+    return 1;
+  }
+
+  netplay_socket = socket( local_address->ai_family, SOCK_DGRAM, 0 );
+  if( netplay_socket == compat_socket_invalid ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't open socket: %s",
+              compat_socket_get_strerror() );
+    freeaddrinfo( local_address );
+    freeaddrinfo( peer_address ); peer_address = NULL;
+    return 1;
+  }
+
+  if( bind( netplay_socket, local_address->ai_addr,
+            local_address->ai_addrlen ) ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't use port %s: %s", port,
+              compat_socket_get_strerror() );
+    compat_socket_close( netplay_socket );
+    freeaddrinfo( local_address );
+    freeaddrinfo( peer_address ); peer_address = NULL;
+    return 1;
+  }
+
+  freeaddrinfo( local_address );
+
+  return 0;
+}
+
+static int
+netplay_init( void *context )
+{
+  size_t i;
+
+  input_idle( &netplay_machine_input );
+
+  if( !settings_current.netplay_peer || !*settings_current.netplay_peer )
+    return 0;
+
+  ahead = settings_current.netplay_frames;
+  if( ahead < 1 ) ahead = 1;
+  if( ahead > NETPLAY_MAX_AHEAD ) ahead = NETPLAY_MAX_AHEAD;
+
+  utils_networking_init();
+
+  if( open_socket() ) {
+    utils_networking_end();
+    return 0;
+  }
+
+  for( i = 0; i < NETPLAY_FRAMES; i++ ) module_state_init( &frames[i].state );
+
+  next_frame = confirmed = 0;
+  remote_received = remote_consumed = local_acknowledged = 0;
+  last_heard = timer_get_time();
+  started = pending = 0;
+
+  selfpipe = compat_socket_selfpipe_alloc();
+  stop_receiver = 0;
+
+  if( pthread_create( &receiver_thread, NULL, receiver_thread_fn, NULL ) ) {
+    ui_error( UI_ERROR_ERROR, "netplay: couldn't start receiver thread" );
+    compat_socket_selfpipe_free( selfpipe );
+    compat_socket_close( netplay_socket );
+    freeaddrinfo( peer_address ); peer_address = NULL;
+    for( i = 0; i < NETPLAY_FRAMES; i++ )
+      module_state_free( &frames[i].state );
+    utils_networking_end();
+    return 0;
+  }
+
+  /* Until play starts, the machine sees no input from either side */
+  netplay_active = 1;
+
+  return 0;
+}
+
+static void
+netplay_end( void )
+{
+  size_t i;
+
+  if( !peer_address ) return;
+
+  stop_receiver = 1;
+  compat_socket_selfpipe_wake( selfpipe );
+  pthread_join( receiver_thread, NULL );
+  compat_socket_selfpipe_free( selfpipe );
+
+  compat_socket_close( netplay_socket );
+  freeaddrinfo( peer_address ); peer_address = NULL;
+
+  for( i = 0; i < NETPLAY_FRAMES; i++ ) module_state_free( &frames[i].state );
+
+  utils_networking_end();
+
+  netplay_stop();
+}
+
+#else				/* #ifdef BUILD_NETPLAY */
+
+void
+netplay_frame( void )
+{
+}
+
+void
+netplay_run( void )
+{
+}
+
+static int
+netplay_init( void *context )
+{
+  if( settings_current.netplay_peer && *settings_current.netplay_peer )
+    ui_error( UI_ERROR_WARNING,
+              "netplay: not supported in this build of Fuse" );
+
+  return 0;
+}
+
+static void
+netplay_end( void )
+{
+}
+
+#endif				/* #ifdef BUILD_NETPLAY */
+
+void
+netplay_register_startup( void )
+{
+  startup_manager_register_no_dependencies( STARTUP_MANAGER_MODULE_NETPLAY,
+                                            netplay_init, NULL,
+                                            netplay_end );
+}
@@ -0,0 +1,58 @@
+/* netplay.h: two player emulation over the network
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_NETPLAY_H
+#define FUSE_NETPLAY_H
+
+#include <libspectrum.h>
+
+#include "peripherals/joystick.h"
+
+/* Everything one player can do to the machine in a frame */
+typedef struct netplay_input_t {
+
+  libspectrum_byte keyboard[8];
+  joystick_values_t joystick;
+
+} netplay_input_t;
+
+/* Non-zero while the machine is being played over the network. The
+   keyboard and joysticks then read `netplay_machine_input' rather than
+   what the local user has pressed */
+extern int netplay_active;
+
+/* Both players' input for the frame being emulated */
+extern netplay_input_t netplay_machine_input;
+
+void netplay_register_startup( void );
+
+/* Called from spectrum_frame() at the end of every frame */
+void netplay_frame( void );
+
+/* Called from the main loop once the events at the end of a frame have
+   been done; swaps input with the other player, goes back and does again
+   any frames for which their input was guessed wrongly, and sets up the
+   input for the next frame */
+void netplay_run( void );
+
+#endif			/* #ifndef FUSE_NETPLAY_H */
@@ -24,6 +24,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "debugger/debugger.h"
@@ -64,6 +66,118 @@ typedef struct periph_port_private_t {
 /* The list of currently active ports */
 static GSList *ports = NULL;
 
+/* The port decode cache. Rather than testing every active port response on
+   every IN or OUT, the responses which match each port address are worked
+   out the first time that address is used and stored as a "chain" of
+   handlers. port_read_cache and port_write_cache map each port address to
+   (index + 1) of its chain, with 0 meaning not yet decoded. The whole
+   cache is thrown away whenever the list of active ports changes */
+typedef struct port_chain_t {
+  size_t start;			/* Index of the first handler in port_handlers */
+  size_t length;		/* Number of handlers */
+} port_chain_t;
+
+static libspectrum_word port_read_cache[ 0x10000 ];
+static libspectrum_word port_write_cache[ 0x10000 ];
+
+static GArray *port_chains = NULL;	/* port_chain_t */
+static GArray *port_handlers = NULL;	/* const periph_port_t* */
+static GArray *port_scratch = NULL;	/* const periph_port_t* */
+
+/* Throw away the port decode cache */
+static void
+port_cache_invalidate( void )
+{
+  memset( port_read_cache, 0, sizeof( port_read_cache ) );
+  memset( port_write_cache, 0, sizeof( port_write_cache ) );
+
+  if( port_chains ) g_array_set_size( port_chains, 0 );
+  if( port_handlers ) g_array_set_size( port_handlers, 0 );
+}
+
+static void
+port_cache_free( void )
+{
+  port_cache_invalidate();
+
+  if( port_chains ) g_array_free( port_chains, TRUE );
+  if( port_handlers ) g_array_free( port_handlers, TRUE );
+  if( port_scratch ) g_array_free( port_scratch, TRUE );
+  port_chains = port_handlers = port_scratch = NULL;
+}
+
+/* Work out which port responses handle reads from (or writes to) `port',
+   and return the (index + 1) of that chain, reusing an existing chain if
+   another address has the same set of handlers */
+static libspectrum_word
+port_chain_build( libspectrum_word port, int write )
+{
+  GSList *ptr;
+  size_t i;
+  port_chain_t chain;
+
+  if( !port_chains ) {
+    port_chains = g_array_new( FALSE, FALSE, sizeof( port_chain_t ) );
+    port_handlers = g_array_new( FALSE, FALSE, sizeof( const periph_port_t* ) );
+    port_scratch = g_array_new( FALSE, FALSE, sizeof( const periph_port_t* ) );
+  }
+
+  /* Chain indices have to fit in the cache; in the very unlikely event
+     we run out, just start again */
+  if( port_chains->len >= 0xffff ) port_cache_invalidate();
+
+  g_array_set_size( port_scratch, 0 );
+
+  for( ptr = ports; ptr; ptr = ptr->next ) {
+    const periph_port_t *response = &( (periph_port_private_t*)ptr->data )->port;
+
+    if( ( port & response->mask ) != response->value ) continue;
+    if( write ? !response->write : !response->read ) continue;
+
+    g_array_append_val( port_scratch, response );
+  }
+
+  for( i = 0; i < port_chains->len; i++ ) {
+    port_chain_t *existing = &g_array_index( port_chains, port_chain_t, i );
+
+    if( existing->length == port_scratch->len &&
+        !memcmp( &g_array_index( port_handlers, const periph_port_t*,
+                                 existing->start ),
+                 port_scratch->data,
+                 port_scratch->len * sizeof( const periph_port_t* ) ) )
+      return i + 1;
+  }
+
+  chain.start = port_handlers->len;
+  chain.length = port_scratch->len;
+  g_array_append_vals( port_handlers, port_scratch->data, port_scratch->len );
+  g_array_append_val( port_chains, chain );
+
+  return port_chains->len;
+}
+
+/* Get the chain of handlers for reads from `port' */
+static inline port_chain_t
+port_read_chain( libspectrum_word port )
+{
+  if( !port_read_cache[ port ] )
+    port_read_cache[ port ] = port_chain_build( port, 0 );
+
+  return g_array_index( port_chains, port_chain_t,
+                        port_read_cache[ port ] - 1 );
+}
+
+/* Get the chain of handlers for writes to `port' */
+static inline port_chain_t
+port_write_chain( libspectrum_word port )
+{
+  if( !port_write_cache[ port ] )
+    port_write_cache[ port ] = port_chain_build( port, 1 );
+
+  return g_array_index( port_chains, port_chain_t,
+                        port_write_cache[ port ] - 1 );
+}
+
 /* The strings used for debugger events */
 static const char * const page_event_string = "page",
   * const unpage_event_string = "unpage";
@@ -80,6 +194,8 @@ port_register( periph_type type, const periph_port_t *port )
   private->port = *port;
 
   ports = g_slist_append( ports, private );
+
+  port_cache_invalidate();
 }
 
 /* Register a peripheral with the system */
@@ -134,8 +250,12 @@ periph_activate_type( periph_type type, int active )
       port_register( type, ptr );
   } else {
     GSList *found;
-    while( ( found = g_slist_find_custom( ports, GINT_TO_POINTER( type ), find_by_type ) ) != NULL )
-      ports = g_slist_remove( ports, found->data );
+    while( ( found = g_slist_find_custom( ports, GINT_TO_POINTER( type ), find_by_type ) ) != NULL ) {
+      periph_port_private_t *private = found->data;
+      ports = g_slist_remove( ports, private );
+      libspectrum_free( private );
+    }
+    port_cache_invalidate();
   }
 
   return 1;
@@ -238,6 +358,7 @@ periph_clear( void )
   g_slist_foreach( ports, free_peripheral, NULL );
   g_slist_free( ports );
   ports = NULL;
+  port_cache_invalidate();
   set_types_inactive();
 }
 
@@ -248,6 +369,7 @@ periph_end( void )
   g_slist_foreach( ports, free_peripheral, NULL );
   g_slist_free( ports );
   ports = NULL;
+  port_cache_free();
 
   g_hash_table_destroy( peripherals );
   peripherals = NULL;
@@ -257,15 +379,6 @@ periph_end( void )
  * The actual routines to read and write a port
  */
 
-/* Internal type used for passing to read_peripheral and write_peripheral */
-struct peripheral_data_t {
-
-  libspectrum_word port;
-
-  libspectrum_byte attached;
-  libspectrum_byte value;
-};
-
 /* Read a byte from a port, taking the appropriate time */
 libspectrum_byte
 readport( libspectrum_word port )
@@ -288,34 +401,17 @@ readport( libspectrum_word port )
   return b;
 }
 
-/* Read a byte from a specific port response */
-static void
-read_peripheral( gpointer data, gpointer user_data )
-{
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
-  libspectrum_byte last_attached;
-
-  periph_port_t *port = &( private->port );
-
-  if( port->read &&
-      ( ( callback_info->port & port->mask ) == port->value ) ) {
-    last_attached = callback_info->attached;
-    callback_info->value &= (   port->read( callback_info->port,
-					    &( callback_info->attached ) )
-			      | last_attached );
-  }
-}
+/* As with readbyte() and writebyte(), readport_internal() and
+   writeport_internal() point to versions which check for debugger
+   breakpoints only while the debugger is active */
 
 /* Read a byte from a port, taking no time */
-libspectrum_byte
-readport_internal( libspectrum_word port )
+static libspectrum_byte
+readport_internal_nodebugger( libspectrum_word port )
 {
-  struct peripheral_data_t callback_info;
-
-  /* Trigger the debugger if wanted */
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
-    debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_READ, port );
+  libspectrum_byte attached, value;
+  port_chain_t chain;
+  size_t i;
 
   /* If we're doing RZX playback, get a byte from the RZX file */
   if( rzx_playback ) {
@@ -337,25 +433,46 @@ readport_internal( libspectrum_word port )
   }
 
   /* If we're not doing RZX playback, get the byte normally */
-  callback_info.port = port;
-  callback_info.attached = 0x00;
-  callback_info.value = 0xff;
+  attached = 0x00;
+  value = 0xff;
+
+  chain = port_read_chain( port );
+
+  /* Most ports, and in particular the data ports of the SPI interfaces
+     which are read many thousands of times when loading a file, have only
+     one handler; call it directly */
+  if( chain.length == 1 ) {
+    const periph_port_t *response =
+      g_array_index( port_handlers, const periph_port_t*, chain.start );
+
+    value = response->read( port, &attached );
+
+  } else {
+
+    /* The handler array is re-read each time round as a handler may cause
+       another port to be decoded, which can move it */
+    for( i = chain.start; i < chain.start + chain.length; i++ ) {
+      const periph_port_t *response =
+        g_array_index( port_handlers, const periph_port_t*, i );
+      libspectrum_byte last_attached = attached;
 
-  g_slist_foreach( ports, read_peripheral, &callback_info );
+      value &= response->read( port, &attached ) | last_attached;
+    }
+
+  }
 
-  if( callback_info.attached != 0xff )
-    callback_info.value =
-      periph_merge_floating_bus( callback_info.value, callback_info.attached,
-                                 machine_current->unattached_port() );
+  if( attached != 0xff )
+    value = periph_merge_floating_bus( value, attached,
+                                       machine_current->unattached_port() );
 
   /* If we're RZX recording, store this byte */
-  if( rzx_recording ) rzx_store_byte( callback_info.value );
+  if( rzx_recording ) rzx_store_byte( value );
 
-  return callback_info.value;
+  return value;
 }
 
-/* Merge the read value with the floating bus. Deliberately doesn't take
-   a callback_info structure to enable it to be unit tested */
+/* Merge the read value with the floating bus. Kept separate from
+   readport_internal() to enable it to be unit tested */
 libspectrum_byte
 periph_merge_floating_bus( libspectrum_byte value, libspectrum_byte attached,
 			   libspectrum_byte floating_bus )
@@ -372,34 +489,53 @@ writeport( libspectrum_word port, libspectrum_byte b )
   ula_contend_port_late( port ); tstates++;
 }
 
-/* Write a byte to a specific port response */
+/* Write a byte to a port, taking no time */
 static void
-write_peripheral( gpointer data, gpointer user_data )
+writeport_internal_nodebugger( libspectrum_word port, libspectrum_byte b )
 {
-  periph_port_private_t *private = data;
-  struct peripheral_data_t *callback_info = user_data;
+  port_chain_t chain;
+  size_t i;
 
-  periph_port_t *port = &( private->port );
-  
-  if( port->write &&
-      ( ( callback_info->port & port->mask ) == port->value ) )
-    port->write( callback_info->port, callback_info->value );
+  chain = port_write_chain( port );
+
+  if( chain.length == 1 ) {
+    g_array_index( port_handlers, const periph_port_t*,
+                   chain.start )->write( port, b );
+    return;
+  }
+
+  for( i = chain.start; i < chain.start + chain.length; i++ )
+    g_array_index( port_handlers, const periph_port_t*, i )->write( port, b );
 }
 
-/* Write a byte to a port, taking no time */
-void
-writeport_internal( libspectrum_word port, libspectrum_byte b )
+/* Trigger the debugger, then read or write the port as normal */
+
+static libspectrum_byte
+readport_internal_debugger( libspectrum_word port )
 {
-  struct peripheral_data_t callback_info;
+  debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_READ, port );
+  return readport_internal_nodebugger( port );
+}
 
-  /* Trigger the debugger if wanted */
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
-    debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE, port );
+static void
+writeport_internal_debugger( libspectrum_word port, libspectrum_byte b )
+{
+  debugger_check( DEBUGGER_BREAKPOINT_TYPE_PORT_WRITE, port );
+  writeport_internal_nodebugger( port, b );
+}
+
+periph_readport_fn readport_internal = readport_internal_nodebugger;
+periph_writeport_fn writeport_internal = writeport_internal_nodebugger;
 
-  callback_info.port = port;
-  callback_info.value = b;
-  
-  g_slist_foreach( ports, write_peripheral, &callback_info );
+/* Select the port accessors according to whether the debugger is active
+   or not */
+void
+periph_set_debugger_accessors( int debugger_active )
+{
+  readport_internal = debugger_active ? readport_internal_debugger
+                                      : readport_internal_nodebugger;
+  writeport_internal = debugger_active ? writeport_internal_debugger
+                                       : writeport_internal_nodebugger;
 }
 
 /*
@@ -150,11 +150,30 @@ void periph_end( void );
  */
 
 libspectrum_byte readport( libspectrum_word port );
-libspectrum_byte readport_internal( libspectrum_word port );
-
 void writeport( libspectrum_word port, libspectrum_byte b );
+
+#ifndef CORETEST
+
+typedef libspectrum_byte (*periph_readport_fn)( libspectrum_word port );
+typedef void (*periph_writeport_fn)( libspectrum_word port,
+                                     libspectrum_byte b );
+
+/* Read or write a port, taking no time. These point to versions which
+   check for debugger breakpoints only while the debugger is active */
+extern periph_readport_fn readport_internal;
+extern periph_writeport_fn writeport_internal;
+
+/* Select the port accessors according to whether the debugger is active
+   or not */
+void periph_set_debugger_accessors( int debugger_active );
+
+#else				/* #ifndef CORETEST */
+
+libspectrum_byte readport_internal( libspectrum_word port );
 void writeport_internal( libspectrum_word port, libspectrum_byte b );
 
+#endif				/* #ifndef CORETEST */
+
 /*
  * The more Fuse-specific peripheral handling routines
  */
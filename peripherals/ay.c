@@ -48,6 +48,8 @@ static const libspectrum_byte mask[ AY_REGISTERS ] = {
 static void ay_reset( int hard_reset );
 static void ay_from_snapshot( libspectrum_snap *snap );
 static void ay_to_snapshot( libspectrum_snap *snap );
+static void ay_state_to( module_state_t *state );
+static void ay_state_from( module_state_t *state );
 static libspectrum_dword get_current_register( void );
 static void set_current_register( libspectrum_dword value );
 
@@ -58,6 +60,8 @@ static module_info_t ay_module_info = {
   /* .snapshot_enabled = */ NULL,
   /* .snapshot_from = */ ay_from_snapshot,
   /* .snapshot_to = */ ay_to_snapshot,
+  /* .state_to = */ ay_state_to,
+  /* .state_from = */ ay_state_from,
 
 };
 
@@ -247,6 +251,22 @@ ay_to_snapshot( libspectrum_snap *snap )
 				       machine_current->ay.registers[i] );
 }
 
+/* Unlike a snapshot, restoring a state doesn't pass the registers on to
+   the sound code, which carries on with what it last had */
+static void
+ay_state_to( module_state_t *state )
+{
+  module_state_write( state, &machine_current->ay,
+                      sizeof( machine_current->ay ) );
+}
+
+static void
+ay_state_from( module_state_t *state )
+{
+  module_state_read( state, &machine_current->ay,
+                     sizeof( machine_current->ay ) );
+}
+
 static libspectrum_dword
 get_current_register( void )
 {
@@ -124,9 +124,7 @@ dck_reset( void )
 
   utils_close_file( &file );
 
-  while( dck->dck[num_block] != NULL ) {
-    memory_page *page;
-    int i;
+  for( num_block = 0; dck->dck[num_block] != NULL; num_block++ ) {
     libspectrum_dck_bank dck_bank = dck->dck[num_block]->bank;
 
     if( dck_bank != LIBSPECTRUM_DCK_BANK_HOME &&
@@ -137,20 +135,29 @@ dck_reset( void )
       libspectrum_dck_free( dck, 0 );
       return 1;
     }
+  }
+
+  /* The file is read again on every reset, so the pages libspectrum has
+     just allocated can be mapped in as they are; they're handed over to
+     the memory pool, and anything not mapped is freed here */
+  for( num_block = 0; dck->dck[num_block] != NULL; num_block++ ) {
+    memory_page *page;
+    int i;
+    libspectrum_dck_bank dck_bank = dck->dck[num_block]->bank;
 
     for( i = 0; i < 8; i++ ) {
 
-      libspectrum_byte *data;
+      libspectrum_byte *data = dck->dck[num_block]->pages[i];
       int j;
 
       switch( dck->dck[num_block]->access[i] ) {
 
       case LIBSPECTRUM_DCK_PAGE_NULL:
+        libspectrum_free( data );
         break;
 
       case LIBSPECTRUM_DCK_PAGE_ROM:
-        data = memory_pool_allocate( 0x2000 );
-	memcpy( data, dck->dck[num_block]->pages[i], 0x2000 );
+        memory_pool_adopt( data, 0x2000, 0 );
         for( j = 0; j < MEMORY_PAGES_IN_8K; j++ ) {
           page = dck_get_memory_page( dck_bank, i * MEMORY_PAGES_IN_8K + j);
           page->offset = j * MEMORY_PAGE_SIZE;
@@ -165,26 +172,27 @@ dck_reset( void )
 	/* Because the scr and snapshot code depends on the standard
 	   memory map being in the RAM[] array, we just copy RAM
 	   blocks from the HOME bank into the appropriate page; in
-	   other cases, we allocate ourselves a new page to store the
-	   contents in */
+	   other cases, the page from the file is used as it is */
         if( dck_bank == LIBSPECTRUM_DCK_BANK_HOME && i>1 ) {
           for( j = 0; j < MEMORY_PAGES_IN_8K; j++ ) {
             page = dck_get_memory_page( dck_bank, i * MEMORY_PAGES_IN_8K + j);
             if( dck->dck[num_block]->access[i] == LIBSPECTRUM_DCK_PAGE_RAM ) {
-              memcpy( page->page,
-                dck->dck[num_block]->pages[i] + j * MEMORY_PAGE_SIZE,
-                MEMORY_PAGE_SIZE );
+              memcpy( page->page, data + j * MEMORY_PAGE_SIZE,
+                      MEMORY_PAGE_SIZE );
             } else {
               memset( page->page, 0, MEMORY_PAGE_SIZE );
             }
           }
+          libspectrum_free( data );
         } else {
-          data = memory_pool_allocate( 0x2000 );
-          if( dck->dck[num_block]->access[i] == LIBSPECTRUM_DCK_PAGE_RAM ) {
-            memcpy( data, dck->dck[num_block]->pages[i], 0x2000 );
-          } else {
+          if( !data ) {
+            data = libspectrum_new( libspectrum_byte, 0x2000 );
+            memset( data, 0, 0x2000 );
+          } else if( dck->dck[num_block]->access[i] ==
+                     LIBSPECTRUM_DCK_PAGE_RAM_EMPTY ) {
             memset( data, 0, 0x2000 );
           }
+          memory_pool_adopt( data, 0x2000, 0 );
           for( j = 0; j < MEMORY_PAGES_IN_8K; j++ ) {
             page = dck_get_memory_page( dck_bank, i * MEMORY_PAGES_IN_8K + j);
             page->offset = j * MEMORY_PAGE_SIZE;
@@ -197,7 +205,6 @@ dck_reset( void )
 
       }
     }
-    num_block++;
   }
 
   dck_active = 1;
@@ -208,5 +215,5 @@ dck_reset( void )
   /* Make the menu item to eject the cartridge active */
   ui_menu_activate( UI_MENU_ITEM_MEDIA_CARTRIDGE_DOCK_EJECT, 1 );
 
-  return libspectrum_dck_free( dck, 0 );
+  return libspectrum_dck_free( dck, 1 );
 }
@@ -36,6 +36,7 @@
 #include "bitmap.h"
 #include "crc.h"
 #include "disk.h"
+#include "memory_usage.h"
 #include "settings.h"
 #include "trdos.h"
 #include "ui/ui.h"
@@ -104,7 +105,32 @@ typedef struct buffer_t {		/* to store buffer data */
   size_t index;
 } buffer_t;
 
+/* Where each track's sectors are in an image which is just the sectors
+   of each track one after another */
+typedef struct disk_layout_t {
+  disk_type_t type;		/* the format of the image file */
+  size_t offset;		/* where the first track's sectors are */
+  int side_major;		/* all of side 0 comes before side 1 */
+  int sector_base, sectors, sector_length;
+} disk_layout_t;
+
+/* Such images have their tracks generated the first time they're used,
+   rather than all when the image is opened; the image file is kept open
+   until then */
+typedef struct disk_lazy_t {
+  buffer_t buffer;		/* the image file */
+  int preindex, gap, interleave, autofill;
+  libspectrum_byte *done;	/* which tracks have been generated */
+  int remaining;
+} disk_lazy_t;
+
 void disk_update_tlens( disk_t *d );
+static int disk_lazy_open( disk_t *d, buffer_t *buffer, int side_major,
+                           int sector_base, int sectors, int sector_length,
+                           int preindex, int gap, int interleave,
+                           int autofill );
+static void disk_lazy_finish( disk_t *d );
+static int disk_load_track_idx( disk_t *d, int idx );
 
 const char *
 disk_strerror( int error )
@@ -317,31 +343,45 @@ guess_track_geom( disk_t *d, int head, int track, int *sector_base,
   return r;
 }
 
+/* is track `idx' still to be generated? */
+static int
+track_pending( disk_t *d, int idx )
+{
+  return d->lazy && !d->lazy->done[ idx ];
+}
+
 static void
-update_tracks_mode( disk_t *d )
+update_track_mode( disk_t *d, int idx )
 {
-  int i, j, bpt;
+  int j, bpt;
   int mfm, fm, weak;
 
-  for( i = 0; i < d->cylinders * d->sides; i++ ) {
-    DISK_SET_TRACK_IDX( d, i );
-    mfm = 0, fm = 0, weak = 0;
-    bpt = d->track[-3] + 256 * d->track[-2];
-    for( j = DISK_CLEN( bpt ) - 1; j >= 0; j-- ) {
-      mfm  |= ~d->fm[j];
-      fm   |= d->fm[j];
-      weak |= d->weak[j];
-    }
-    if( mfm && !fm ) d->track[-1] = 0x00;
-    if( !mfm && fm ) d->track[-1] = 0x01;
-    if( mfm &&  fm ) d->track[-1] = 0x02;
-    if( weak ) {
-      d->track[-1] |= 0x80;
-      d->have_weak = 1;
-    }
+  DISK_SET_TRACK_IDX( d, idx );
+  mfm = 0, fm = 0, weak = 0;
+  bpt = d->track[-3] + 256 * d->track[-2];
+  for( j = DISK_CLEN( bpt ) - 1; j >= 0; j-- ) {
+    mfm  |= ~d->fm[j];
+    fm   |= d->fm[j];
+    weak |= d->weak[j];
+  }
+  if( mfm && !fm ) d->track[-1] = 0x00;
+  if( !mfm && fm ) d->track[-1] = 0x01;
+  if( mfm &&  fm ) d->track[-1] = 0x02;
+  if( weak ) {
+    d->track[-1] |= 0x80;
+    d->have_weak = 1;
   }
 }
 
+static void
+update_tracks_mode( disk_t *d )
+{
+  int i;
+
+  for( i = 0; i < d->cylinders * d->sides; i++ )
+    if( !track_pending( d, i ) ) update_track_mode( d, i );
+}
+
 static int
 check_disk_geom( disk_t *d, int *sector_base, int *sectors,
 		 int *seclen, int *mfm, int *unf )
@@ -689,11 +729,24 @@ trackgen( disk_t *d, buffer_t *buffer, int head, int track,
   return gap4_add( d, gap );
 }
 
+/* The memory taken by disk_alloc() for the tracks and their dirty flags */
+static size_t
+disk_data_size( const disk_t *d )
+{
+  return (size_t)d->sides * d->cylinders * ( d->tlen + 1 );
+}
+
 /* close and destroy a disk structure and data */
 void
 disk_close( disk_t *d )
 {
+  disk_lazy_finish( d );
+  libspectrum_free( d->layout );
+  d->layout = NULL;
+  libspectrum_free( d->dirty_tracks );
+  d->dirty_tracks = NULL;
   if( d->data != NULL ) {
+    memory_usage_remove( MEMORY_USAGE_DISK, disk_data_size( d ) );
     libspectrum_free( d->data );
     d->data = NULL;
   }
@@ -746,6 +799,8 @@ disk_alloc( disk_t *d )
   if( dlen == 0 ) return d->status = DISK_GEOM;
 
   d->data = libspectrum_new0( libspectrum_byte, dlen );
+  d->dirty_tracks = libspectrum_new0( libspectrum_byte, d->sides * d->cylinders );
+  memory_usage_add( MEMORY_USAGE_DISK, disk_data_size( d ) );
 
   return d->status = DISK_OK;
 }
@@ -763,6 +818,8 @@ disk_new( disk_t *d, int sides, int cylinders,
     return d->status = DISK_GEOM;
 
   d->type = type;
+  d->lazy = NULL;
+  d->layout = NULL;
   d->density = density == DISK_DENS_AUTO ? DISK_DD : density;
   d->sides = sides;
   d->cylinders = cylinders;
@@ -1124,7 +1181,7 @@ open_udi( buffer_t *buffer, disk_t *d )
 static int
 open_img_mgt_opd( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   buffer->index = 0;
 
@@ -1157,32 +1214,21 @@ open_img_mgt_opd( buffer_t *buffer, disk_t *d )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  if( d->type == DISK_IMG ) {	/* IMG out-out */
-    for( j = 0; j < d->sides; j++ ) {
-      for( i = 0; i < d->cylinders; i++ ) {
-	if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-    }
-  } else {			/* MGT / OPD alt */
-    for( i = 0; i < d->cylinders; i++ ) {
-      for( j = 0; j < d->sides; j++ ) {
-        if( trackgen( d, buffer, j, i, d->type == DISK_MGT ? 1 : 0, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD,
-		      d->type == DISK_MGT ? NO_INTERLEAVE : INTERLEAVE_OPUS, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-    }
-  }
+  if( d->type == DISK_IMG )	/* IMG out-out */
+    return disk_lazy_open( d, buffer, 1, 1, sectors, seclen, NO_PREINDEX,
+                           GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL );
 
-  return d->status = DISK_OK;
+  /* MGT / OPD alt */
+  return disk_lazy_open( d, buffer, 0, d->type == DISK_MGT ? 1 : 0, sectors,
+                         seclen, NO_PREINDEX, GAP_MGT_PLUSD,
+                         d->type == DISK_MGT ? NO_INTERLEAVE : INTERLEAVE_OPUS,
+                         NO_AUTOFILL );
 }
 
 static int
 open_d40_d80( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   if( buffavail( buffer ) < 180 )
     return d->status = DISK_OPEN;
@@ -1204,21 +1250,14 @@ open_d40_d80( buffer_t *buffer, disk_t *d )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  for( i = 0; i < d->cylinders; i++ ) {
-      for( j = 0; j < d->sides; j++ ) {
-        if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-		      NO_PREINDEX, GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	  return d->status = DISK_GEOM;
-      }
-  }
-
-  return d->status = DISK_OK;
+  return disk_lazy_open( d, buffer, 0, 1, sectors, seclen, NO_PREINDEX,
+                         GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL );
 }
 
 static int
 open_sad( buffer_t *buffer, disk_t *d, int preindex )
 {
-  int i, j, sectors, seclen;
+  int sectors, seclen;
 
   d->sides = buff[18];
   d->cylinders = buff[19];
@@ -1232,15 +1271,8 @@ open_sad( buffer_t *buffer, disk_t *d, int preindex )
   if( disk_alloc( d ) != DISK_OK )
     return d->status;
 
-  for( j = 0; j < d->sides; j++ ) {
-    for( i = 0; i < d->cylinders; i++ ) {
-      if( trackgen( d, buffer, j, i, 1, sectors, seclen, preindex, 
-		    GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL ) )
-	return d->status = DISK_GEOM;
-    }
-  }
-
-  return d->status = DISK_OK;
+  return disk_lazy_open( d, buffer, 1, 1, sectors, seclen, preindex,
+                         GAP_MGT_PLUSD, NO_INTERLEAVE, NO_AUTOFILL );
 }
 
 /* 1 RANDOMIZE USR 15619: REM : RUN "        " */
@@ -1285,6 +1317,7 @@ trdos_insert_basic_file( disk_t *d, trdos_spec_t *spec,
   n_copied = 0;
   s = spec->first_free_sector;
   t = spec->first_free_track;
+  disk_load_track_idx( d, t );
   DISK_SET_TRACK_IDX( d, t );
 
   for( i = 0; i < n_sec; i++ ) {
@@ -1320,6 +1353,7 @@ trdos_insert_basic_file( disk_t *d, trdos_spec_t *spec,
     if( s == 0 ) {
       t = t + 1;
       if( t >= d->cylinders ) return DISK_UNSUP;
+      disk_load_track_idx( d, t );
       DISK_SET_TRACK_IDX( d, t );
     }
   }
@@ -1411,7 +1445,7 @@ trdos_insert_boot_loader( disk_t *d )
 static int
 open_trd( buffer_t *buffer, disk_t *d )
 {
-  int i, j, sectors, seclen;
+  int i, sectors, seclen;
   disk_position_context_t context;
 
   if( buffseek( buffer, 8*256, SEEK_CUR ) == -1 )
@@ -1440,14 +1474,10 @@ open_trd( buffer_t *buffer, disk_t *d )
     return d->status;
 
   buffer->index = 0;
-  for( i = 0; i < d->cylinders; i++ ) {
-    for( j = 0; j < d->sides; j++ ) {
-      if( trackgen( d, buffer, j, i, 1, sectors, seclen,
-                    NO_PREINDEX, GAP_TRDOS, INTERLEAVE_2, 0x00 ) )
-        return d->status = DISK_GEOM;
-    }
-  }
-  
+  if( disk_lazy_open( d, buffer, 0, 1, sectors, seclen, NO_PREINDEX,
+                      GAP_TRDOS, INTERLEAVE_2, 0x00 ) )
+    return d->status;
+
   if( settings_current.auto_load ) {
     position_context_save( d, &context );
     trdos_insert_boot_loader( d );
@@ -2068,19 +2098,261 @@ open_td0( buffer_t *buffer, disk_t *d, int preindex )
   return d->status = DISK_OK;
 }
 
+static void
+update_track_tlen( disk_t *d, int idx )
+{
+  DISK_SET_TRACK_IDX( d, idx );
+  if( d->track[-3] + 256 * d->track[-2] == 0 ) {
+    d->track[-3] = d->bpt & 0xff;
+    d->track[-2] = ( d->bpt >> 8 ) & 0xff;
+  }
+}
+
 /* update tracks TLEN */
 void
 disk_update_tlens( disk_t *d )
 {
   int i;
 
-  for( i = 0; i < d->sides * d->cylinders; i++ ) {	/* check tracks */
-    DISK_SET_TRACK_IDX( d, i );
-    if( d->track[-3] + 256 * d->track[-2] == 0 ) {
-      d->track[-3] = d->bpt & 0xff;
-      d->track[-2] = ( d->bpt >> 8 ) & 0xff;
+  for( i = 0; i < d->sides * d->cylinders; i++ )	/* check tracks */
+    if( !track_pending( d, i ) ) update_track_tlen( d, i );
+}
+
+/* Open `d' so that its tracks are generated as they're needed. The sectors
+   start at buffer->index; `buffer' is taken over by the disk */
+static int
+disk_lazy_open( disk_t *d, buffer_t *buffer, int side_major, int sector_base,
+                int sectors, int sector_length, int preindex, int gap,
+                int interleave, int autofill )
+{
+  disk_lazy_t *lazy;
+  size_t tracks = d->sides * d->cylinders;
+
+  /* Without autofill, every sector must be there */
+  if( autofill < 0 &&
+      buffavail( buffer ) < tracks * sectors * sector_length )
+    return d->status = DISK_GEOM;
+
+  d->layout = libspectrum_new( disk_layout_t, 1 );
+  d->layout->type = d->type;
+  d->layout->offset = buffer->index;
+  d->layout->side_major = side_major;
+  d->layout->sector_base = sector_base;
+  d->layout->sectors = sectors;
+  d->layout->sector_length = sector_length;
+
+  lazy = libspectrum_new( disk_lazy_t, 1 );
+  lazy->buffer = *buffer;
+  lazy->preindex = preindex;
+  lazy->gap = gap;
+  lazy->interleave = interleave;
+  lazy->autofill = autofill;
+  lazy->done = libspectrum_new0( libspectrum_byte, tracks );
+  lazy->remaining = tracks;
+  d->lazy = lazy;
+
+  /* The file now belongs to the disk */
+  buffer->file.buffer = NULL;
+  buffer->file.length = 0;
+  buffer->file.mapped = 0;
+
+  /* All the tracks are the same shape, so generating one checks the
+     geometry for all of them */
+  if( disk_load_track_idx( d, 0 ) ) return d->status = DISK_GEOM;
+
+  return d->status = DISK_OK;
+}
+
+/* The offset of track `idx' in the image file */
+static size_t
+layout_track_offset( disk_t *d, int idx )
+{
+  disk_layout_t *layout = d->layout;
+  int head = idx % d->sides, cylinder = idx / d->sides;
+  size_t n = layout->side_major ? head * d->cylinders + cylinder : idx;
+
+  return layout->offset + n * layout->sectors * layout->sector_length;
+}
+
+static int
+disk_load_track_idx( disk_t *d, int idx )
+{
+  disk_lazy_t *lazy = d->lazy;
+  disk_layout_t *layout = d->layout;
+  disk_position_context_t context;
+  int error;
+
+  if( !track_pending( d, idx ) ) return 0;
+
+  position_context_save( d, &context );
+
+  lazy->buffer.index = layout_track_offset( d, idx );
+  if( lazy->buffer.index > lazy->buffer.file.length )
+    lazy->buffer.index = lazy->buffer.file.length;
+
+  error = trackgen( d, &lazy->buffer, idx % d->sides, idx / d->sides,
+                    layout->sector_base, layout->sectors,
+                    layout->sector_length, lazy->preindex, lazy->gap,
+                    lazy->interleave, lazy->autofill );
+
+  lazy->done[ idx ] = 1;
+  update_track_tlen( d, idx );
+  update_track_mode( d, idx );
+
+  position_context_restore( d, &context );
+
+  if( !--lazy->remaining ) disk_lazy_finish( d );
+
+  return error;
+}
+
+void
+disk_load_track( disk_t *d, int head, int cylinder )
+{
+  disk_load_track_idx( d, d->sides * cylinder + head );
+}
+
+/* Stop generating tracks lazily, and close the image file */
+static void
+disk_lazy_finish( disk_t *d )
+{
+  if( !d->lazy ) return;
+
+  utils_close_file( &d->lazy->buffer.file );
+  libspectrum_free( d->lazy->done );
+  libspectrum_free( d->lazy );
+  d->lazy = NULL;
+}
+
+/* Generate every track which hasn't been yet */
+static void
+disk_load_all_tracks( disk_t *d )
+{
+  int i;
+
+  for( i = 0; d->lazy && i < d->sides * d->cylinders; i++ )
+    disk_load_track_idx( d, i );
+}
+
+void
+disk_track_dirty( disk_t *d )
+{
+  d->dirty = 1;
+  d->dirty_tracks[ ( d->track - 3 - d->data ) / d->tlen ] = 1;
+}
+
+/* Copy the sectors of track `idx' to `buffer' as they are in the image
+   file; returns non-zero if the track isn't laid out the way the file
+   needs it to be */
+static int
+layout_track_sectors( disk_t *d, int idx, libspectrum_byte *buffer )
+{
+  disk_layout_t *layout = d->layout;
+  int h, t, s, b, del, sector;
+
+  DISK_SET_TRACK_IDX( d, idx );
+
+  for( sector = 0; sector < layout->sectors; sector++ ) {
+    d->i = 0;
+    do {
+      if( !id_read( d, &h, &t, &s, &b ) ) return 1;
+    } while( s != layout->sector_base + sector );
+
+    if( ( 0x80 << ( b & 0x03 ) ) != layout->sector_length ||
+        !datamark_read( d, &del ) ||
+        d->i + layout->sector_length > d->bpt )
+      return 1;
+
+    memcpy( buffer, d->track + d->i, layout->sector_length );
+    buffer += layout->sector_length;
+  }
+
+  return 0;
+}
+
+int
+disk_writeback_get( disk_t *d, disk_writeback_t *writeback )
+{
+  disk_position_context_t context;
+  size_t length;
+  int i, tracks = d->sides * d->cylinders;
+
+  writeback->count = 0;
+  writeback->offsets = NULL;
+  writeback->data = NULL;
+
+  if( !d->layout || !d->filename || d->wrprot ) return -1;
+
+  length = d->layout->sectors * d->layout->sector_length;
+  writeback->track_length = length;
+
+  for( i = 0; i < tracks; i++ )
+    if( d->dirty_tracks[i] ) writeback->count++;
+  if( !writeback->count ) return 0;
+
+  writeback->offsets = libspectrum_new( size_t, writeback->count );
+  writeback->data = libspectrum_new( libspectrum_byte,
+                                     writeback->count * length );
+  writeback->count = 0;
+
+  position_context_save( d, &context );
+
+  for( i = 0; i < tracks; i++ ) {
+    if( !d->dirty_tracks[i] ) continue;
+
+    if( layout_track_sectors( d, i,
+                              writeback->data + writeback->count * length ) ) {
+      /* The track has been formatted some other way, so from now on
+         only writing the whole image will do */
+      position_context_restore( d, &context );
+      libspectrum_free( d->layout );
+      d->layout = NULL;
+      disk_writeback_free( writeback );
+      return -1;
     }
+
+    writeback->offsets[ writeback->count++ ] = layout_track_offset( d, i );
+  }
+
+  position_context_restore( d, &context );
+
+  memset( d->dirty_tracks, 0, tracks );
+  d->dirty = 0;
+
+  return 0;
+}
+
+int
+disk_writeback_write( const disk_writeback_t *writeback, const char *filename )
+{
+  FILE *file;
+  size_t i;
+  int error = DISK_OK;
+
+  if( ( file = fopen( filename, "r+b" ) ) == NULL )
+    return DISK_WRFILE;
+
+  for( i = 0; i < writeback->count && !error; i++ ) {
+    if( fseek( file, writeback->offsets[i], SEEK_SET ) ||
+        fwrite( writeback->data + i * writeback->track_length,
+                writeback->track_length, 1, file ) != 1 )
+      error = DISK_WRPART;
   }
+
+  if( fclose( file ) == -1 && !error )
+    error = DISK_WRFILE;
+
+  return error;
+}
+
+void
+disk_writeback_free( disk_writeback_t *writeback )
+{
+  libspectrum_free( writeback->offsets );
+  libspectrum_free( writeback->data );
+  writeback->offsets = NULL;
+  writeback->data = NULL;
+  writeback->count = 0;
 }
 
 /* open a disk image file, read and convert to our format
@@ -2102,6 +2374,8 @@ disk_open2( disk_t *d, const char *filename, int preindex )
     d->wrprot = 0;
 #endif			/* #ifdef GEKKO */
 
+  d->lazy = NULL;
+  d->layout = NULL;
   if( utils_read_file( filename, &buffer.file ) )
     return d->status = DISK_OPEN;
 
@@ -2159,8 +2433,15 @@ disk_open2( disk_t *d, const char *filename, int preindex )
     return d->status = DISK_OPEN;
   }
   if( d->status != DISK_OK ) {
-    if( d->data != NULL )
+    disk_lazy_finish( d );
+    libspectrum_free( d->layout );
+    d->layout = NULL;
+    libspectrum_free( d->dirty_tracks );
+    d->dirty_tracks = NULL;
+    if( d->data != NULL ) {
+      memory_usage_remove( MEMORY_USAGE_DISK, disk_data_size( d ) );
       libspectrum_free( d->data );
+    }
     utils_close_file( &buffer.file );
     return d->status;
   }
@@ -2186,6 +2467,11 @@ disk_merge_sides( disk_t *d, disk_t *d1, disk_t *d2, int autofill )
       ( autofill < 0 && d1->cylinders != d2->cylinders ) )
     return DISK_GEOM;
 
+  disk_load_all_tracks( d1 );
+  disk_load_all_tracks( d2 );
+
+  d->lazy = NULL;
+  d->layout = NULL;
   d->wrprot = 0;
   d->dirty = 0;
   d->sides = 2;
@@ -2841,6 +3127,10 @@ disk_write( disk_t *d, const char *filename )
   libspectrum_byte *t, *c, *f, *w;
   int idx;
 
+  /* The image may be written over the file its tracks are still to be
+     generated from */
+  disk_load_all_tracks( d );
+
   if( ( file = fopen( filename, "wb" ) ) == NULL )
     return d->status = DISK_WRFILE;
 
@@ -2933,13 +3223,22 @@ disk_write( disk_t *d, const char *filename )
   d->weak = w;
   d->i = idx;
 
-  if( d->status != DISK_OK ) {
-    fclose( file );
-    return d->status;
-  }
+  if( fclose( file ) == -1 && d->status == DISK_OK )
+    d->status = DISK_WRFILE;
 
-  if( fclose( file ) == -1 )
-    return d->status = DISK_WRFILE;
+  /* Changed tracks can still be written back in place only if the image
+     has been written over itself, in the same format and so with the
+     sectors in the same places */
+  if( d->layout ) {
+    if( d->status != DISK_OK || d->layout->type != d->type ||
+        d->layout->side_major || !d->filename ||
+        strcmp( filename, d->filename ) ) {
+      libspectrum_free( d->layout );
+      d->layout = NULL;
+    } else {
+      memset( d->dirty_tracks, 0, d->sides * d->cylinders );
+    }
+  }
 
-  return d->status = DISK_OK;
+  return d->status;
 }
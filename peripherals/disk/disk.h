@@ -104,6 +104,9 @@ typedef struct disk_t {
   int i;			/* index for track and clocks */
   disk_type_t type;		/* DISK_UDI, ... */
   disk_dens_t density;		/* DISK_SD DISK_DD, or DISK_HD */
+  struct disk_lazy_t *lazy;	/* tracks not yet generated, or NULL */
+  struct disk_layout_t *layout;	/* where tracks are in the file, or NULL */
+  libspectrum_byte *dirty_tracks;	/* tracks changed since last written */
 } disk_t;
 
 /* every track data:
@@ -135,6 +138,28 @@ typedef struct disk_position_context_t {
 } disk_position_context_t;
 
 const char *disk_strerror( int error );
+/* make sure a track has been generated from the image file before it's
+   used; must be called before DISK_SET_TRACK() outside disk.c */
+void disk_load_track( disk_t *d, int head, int cylinder );
+/* mark the current track as changed */
+void disk_track_dirty( disk_t *d );
+
+/* The changed tracks of an image which can be updated in place */
+typedef struct disk_writeback_t {
+  size_t track_length;		/* bytes of each track in the file */
+  size_t count;			/* number of tracks */
+  size_t *offsets;		/* where each track goes in the file */
+  libspectrum_byte *data;	/* count * track_length bytes */
+} disk_writeback_t;
+
+/* copy the tracks changed since the last call, and mark the disk as
+   unchanged; returns -1 if the image file can't be updated in place, in
+   which case the whole disk must be written with disk_write() */
+int disk_writeback_get( disk_t *d, disk_writeback_t *writeback );
+/* write the tracks into the image file; touches nothing but `writeback' */
+int disk_writeback_write( const disk_writeback_t *writeback,
+                          const char *filename );
+void disk_writeback_free( disk_writeback_t *writeback );
 /* create an unformatted disk sides -> (1/2) cylinders -> track/side,
    dens -> 'density' related to unformatted length of a track (SD = 3125,
    DD = 6250, HD = 12500, type -> if write this disk we want to convert
@@ -69,12 +69,52 @@ const fdd_params_t fdd_params[] = {
 
 static void
 fdd_event( libspectrum_dword last_tstates, int event, void *user_data );
+static void fdd_index_schedule( fdd_t *d );
 
 static int motor_event;
 static int index_event;
 
 static int fdd_motor = 0; /* to manage 'disk' icon */
 
+/* Where each spinning disk has got to is worked out from how long it's
+   been turning when something asks, rather than by an event for each
+   edge of the index pulse; the only event is for an FDC waiting for the
+   pulse. That needs a clock which isn't reset at the end of each frame */
+static libspectrum_qword fdd_clock_base = 0;
+
+static libspectrum_qword
+fdd_clock( void )
+{
+  return fdd_clock_base + tstates;
+}
+
+/* One revolution (200ms at 300rpm), and the part of it for which the
+   index hole is over the sensor (10ms) */
+static libspectrum_dword
+fdd_revolution( void )
+{
+  return machine_current->timings.processor_speed / 5;
+}
+
+static libspectrum_dword
+fdd_pulse_length( void )
+{
+  return 10 * machine_current->timings.processor_speed / 1000;
+}
+
+static int
+fdd_spinning( fdd_t *d )
+{
+  return d->motoron && d->loaded;
+}
+
+/* How far through the current revolution the disk is */
+static libspectrum_dword
+fdd_rotation( fdd_t *d )
+{
+  return ( fdd_clock() + d->index_offset ) % fdd_revolution();
+}
+
 static int
 fdd_init_events( void *context )
 {
@@ -132,6 +172,7 @@ fdd_set_data( fdd_t *d, int fact )
     return;
   }
 
+  disk_load_track( &d->disk, head, d->c_cylinder );
   DISK_SET_TRACK( &d->disk, head, d->c_cylinder );
   d->c_bpt = d->disk.track[-3] + 256 * d->disk.track[-2];
   if( fact > 0 ) {
@@ -202,6 +243,8 @@ fdd_motoron( fdd_t *d, int on )
   on = on > 0 ? 1 : 0;
   if( d->motoron == on )
     return;
+  if( !on )		/* remember where the disk stopped */
+    d->index_pulse = fdd_index_pulse( d );
   d->motoron = on;
   fdd_motor += on ? 1 : -1;
   ui_statusbar_update( UI_STATUSBAR_ITEM_DISK,
@@ -219,19 +262,25 @@ fdd_motoron( fdd_t *d, int on )
     Note: Pre-ready is the state that at least one INDEX
 	pulse has been detected after item iii) is satisfied
   */
-  event_remove_type_user_data( motor_event, d );		/* remove pending motor-on event for *this* drive */
+  event_cancel( &d->motor_handle );		/* remove pending motor-on event for *this* drive */
   if( on ) {
-    event_add_with_data( tstates + 4 *			/* 2 revolution: 2 * 200 / 1000 */
-			 machine_current->timings.processor_speed / 10,
-			 motor_event, d );
-    if( d->loaded ) /* index rotating */
-      event_add_with_data( tstates + ( d->index_pulse ? 10 : 190 ) *
-			 machine_current->timings.processor_speed / 1000,
-			 index_event, d );
+    d->motor_handle =
+      event_add_with_data( tstates + 4 *			/* 2 revolution: 2 * 200 / 1000 */
+			   machine_current->timings.processor_speed / 10,
+			   motor_event, d );
+    /* Carry on from wherever the disk stopped; either just at the start
+       of the index pulse, or just after its end */
+    d->index_offset = ( ( d->index_pulse ? 0 : fdd_pulse_length() ) +
+                        fdd_revolution() - fdd_clock() % fdd_revolution() ) %
+                      fdd_revolution();
+    fdd_index_schedule( d );
   } else {
-    event_add_with_data( tstates + 3 *			/* 1.5 revolution */
-			 machine_current->timings.processor_speed / 10,
-			 motor_event, d );
+    fdd_index_schedule( d );
+
+    d->motor_handle =
+      event_add_with_data( tstates + 3 *			/* 1.5 revolution */
+			   machine_current->timings.processor_speed / 10,
+			   motor_event, d );
   }
 }
 
@@ -298,6 +347,7 @@ fdd_load( fdd_t *d, int upsidedown )
   fdd_set_data( d, FDD_LOAD_FACT );
   d->ready = ( d->motoron && d->loaded );
   if( d->disk.density == DISK_HD ) d->hdout = 1;
+  fdd_index_schedule( d );
 
   return d->status = FDD_OK;
 }
@@ -391,7 +441,7 @@ fdd_read_write_data( fdd_t *d, fdd_write_t write )
 #else
     bitmap_reset( d->disk.weak, d->disk.i );
 #endif
-    d->disk.dirty = 1;
+    disk_track_dirty( &d->disk );
   } else {	/* read */
     d->data = d->disk.track[ d->disk.i ];
     if( bitmap_test( d->disk.clocks, d->disk.i ) )
@@ -453,25 +503,74 @@ fdd_wait_index_hole( fdd_t *d )
   d->index = 1;
 }
 
+/* With --fdc-turbo, the controller finds a sector as soon as it is
+   asked for it rather than when the disk has turned to it. The bytes
+   read are the same either way; only disks with weak sectors, which are
+   likely to be copy protected and so may time the disk, always see the
+   real rotation */
+int
+fdd_turbo( fdd_t *d )
+{
+  return settings_current.fdc_turbo && !d->disk.have_weak;
+}
+
+int
+fdd_index_pulse( fdd_t *d )
+{
+  if( !fdd_spinning( d ) ) return d->index_pulse;
+
+  return fdd_rotation( d ) < fdd_pulse_length();
+}
+
+/* If an FDC is waiting for the index pulse, arrange to tell it when
+   the pulse next ends */
+static void
+fdd_index_schedule( fdd_t *d )
+{
+  libspectrum_dword rotation, until;
+
+  event_cancel( &d->index_handle );
+
+  if( !d->fdc || !fdd_spinning( d ) ) return;
+
+  rotation = fdd_rotation( d );
+  until = rotation < fdd_pulse_length() ?
+          fdd_pulse_length() - rotation :
+          fdd_revolution() + fdd_pulse_length() - rotation;
+
+  d->index_handle = event_add_with_data( tstates + until, index_event, d );
+}
+
+void
+fdd_wait_index_pulse( fdd_t *d, void ( *fdc_index )( void *fdc ), void *fdc )
+{
+  d->fdc_index = fdc_index;
+  d->fdc = fdc;
+  fdd_index_schedule( d );
+}
+
+void
+fdd_frame( libspectrum_dword frame_length )
+{
+  fdd_clock_base += frame_length;
+}
+
 static void
 fdd_event( libspectrum_dword last_tstates, int event,
            void *user_data ) 
 {
   fdd_t *d = user_data;
+  void *fdc;
 
   if( event == motor_event ) {
     d->ready = ( d->motoron & d->loaded );	/* 0x01 & 0x01 */
     return;
   }
 
-  d->index_pulse = !d->index_pulse;
-  if( !d->index_pulse && d->fdc ) { /* if d->fdc != NULL fdc wait for index */
-      d->fdc_index( d->fdc );
-      d->fdc = NULL;
+  /* The end of an index pulse which an FDC is waiting for */
+  if( d->fdc && fdd_spinning( d ) ) {
+    fdc = d->fdc;
+    d->fdc = NULL;
+    d->fdc_index( fdc );
   }
-
-  if( d->motoron & d->loaded ) /* keep rotating */
-    event_add_with_data( last_tstates + ( d->index_pulse ? 10 : 190 ) *
-			 machine_current->timings.processor_speed / 1000,
-			 index_event, d );
 }
@@ -104,7 +104,12 @@ typedef struct fdd_t {
   int c_bpt;		/* current track length in bytes */
   int motoron;		/* motor on */
   int loadhead;		/* head loaded */
-  int index_pulse;	/* 'second' index hole, for index status */
+  int index_pulse;	/* 'second' index hole, for index status; only
+			   kept up to date while the motor is off */
+  libspectrum_dword index_offset; /* added to the drives' clock to give
+				    the position within a revolution */
+  event_handle_t motor_handle;	/* pending motor on/off event */
+  event_handle_t index_handle;	/* pending index pulse event */
 } fdd_t;
 
 typedef struct fdd_params_t {
@@ -151,6 +156,15 @@ int fdd_write_data( fdd_t *d );
 void fdd_wrprot( fdd_t *d, int wrprot );
 /* to reach index hole */
 void fdd_wait_index_hole( fdd_t *d );
+/* Is the index hole passing the sensor? */
+int fdd_index_pulse( fdd_t *d );
+/* Call `fdc_index( fdc )' at the end of the next index pulse */
+void fdd_wait_index_pulse( fdd_t *d, void ( *fdc_index )( void *fdc ),
+                           void *fdc );
+/* Keep the drives' clock running across the end of a frame */
+void fdd_frame( libspectrum_dword frame_length );
+/* Can the FDC skip the time the disk takes to turn to a sector? */
+int fdd_turbo( fdd_t *d );
 /* set floppy position ( upsidedown or not )*/
 void fdd_flip( fdd_t *d, int upsidedown );
 
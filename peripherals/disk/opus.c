@@ -34,6 +34,7 @@
 #include "debugger/debugger.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "opus.h"
 #include "peripherals/printer.h"
@@ -101,6 +102,7 @@ void
 opus_page( void )
 {
   opus_active = 1;
+  memory_overlay_update();
   machine_current->ram.romcs = 1;
   machine_current->memory_map();
   debugger_event( page_event );
@@ -110,6 +112,7 @@ void
 opus_unpage( void )
 {
   opus_active = 0;
+  memory_overlay_update();
   machine_current->ram.romcs = 0;
   machine_current->memory_map();
   debugger_event( unpage_event );
@@ -201,6 +204,7 @@ opus_reset( int hard_reset )
 
   opus_active = 0;
   opus_available = 0;
+  memory_overlay_update();
 
   if( !periph_is_active( PERIPH_TYPE_OPUS ) ) {
     return;
@@ -520,7 +520,7 @@ start_read_id( upd_fdc *f )
       f->rev = 0;
     i = f->current_drive->disk.bpt ? 
       ( f->current_drive->disk.i - i ) * 200 / f->current_drive->disk.bpt : 200;
-    if( i > 0 ) {
+    if( i > 0 && !fdd_turbo( f->current_drive ) ) {
       event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			 machine_current->timings.processor_speed / 1000,
 			 fdc_event, f );
@@ -558,7 +558,7 @@ start_read_diag( upd_fdc *f )
       f->rev = 0;
     i = f->current_drive->disk.bpt ? 
       ( f->current_drive->disk.i - i ) * 200 / f->current_drive->disk.bpt : 200;
-    if( i > 0 ) {
+    if( i > 0 && !fdd_turbo( f->current_drive ) ) {
       event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			 machine_current->timings.processor_speed / 1000,
 			 fdc_event, f );
@@ -628,7 +628,7 @@ multi_track_next:
         f->id_mark = UPD_FDC_AM_NONE;
       i = f->current_drive->disk.bpt ? 
           ( f->current_drive->disk.i - i ) * 200 / f->current_drive->disk.bpt : 200;
-      if( i > 0 ) {
+      if( i > 0 && !fdd_turbo( f->current_drive ) ) {
         event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			     machine_current->timings.processor_speed / 1000,
 			     fdc_event, f );
@@ -721,7 +721,7 @@ multi_track_next:
         f->id_mark = UPD_FDC_AM_NONE;
       i = f->current_drive->disk.bpt ? 
           ( f->current_drive->disk.i - i ) * 200 / f->current_drive->disk.bpt : 200;
-      if( i > 0 ) {
+      if( i > 0 && !fdd_turbo( f->current_drive ) ) {
         event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			     machine_current->timings.processor_speed / 1000,
 			     fdc_event, f );
@@ -375,7 +375,7 @@ wd_fdc_sr_read( wd_fdc *f )
 
   if( f->status_type == WD_FDC_STATUS_TYPE1 ) {
     f->status_register &= ~WD_FDC_SR_IDX_DRQ;
-    if( !d->loaded || d->index_pulse )
+    if( !d->loaded || fdd_index_pulse( d ) )
       f->status_register |= WD_FDC_SR_IDX_DRQ;
   }
   if( f->type == WD1773 || f->type == FD1793 || f->type == WD2797 ) {
@@ -412,7 +412,7 @@ wd_fdc_seek_verify_read_id( wd_fdc *f )
       } else
         f->id_mark = WD_FDC_AM_NONE;
       i = d->disk.bpt ? ( d->disk.i - i ) * 200 / d->disk.bpt : 200;
-      if( i > 0 ) {
+      if( i > 0 && !fdd_turbo( d ) ) {
         event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			   machine_current->timings.processor_speed / 1000,
 			   fdc_event, f );
@@ -572,7 +572,7 @@ wd_fdc_type_ii_seek( wd_fdc *f )
       }
       i = d->disk.bpt ?
 	( d->disk.i - i ) * 200 / d->disk.bpt : 200;
-      if( i > 0 ) {
+      if( i > 0 && !fdd_turbo( d ) ) {
         event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			     machine_current->timings.processor_speed / 1000,
 			     fdc_event, f );
@@ -727,7 +727,7 @@ wd_fdc_type_iii( wd_fdc *f )
         read_id( f );
         i = d->disk.bpt ?
 	    ( d->disk.i - i ) * 200 / d->disk.bpt : 200;
-	if( i > 0 ) {
+	if( i > 0 && !fdd_turbo( d ) ) {
           event_add_with_data( tstates + i *		/* i * 1/20 revolution */
 			       machine_current->timings.processor_speed / 1000,
 			       fdc_event, f );
@@ -938,8 +938,7 @@ wd_fdc_cr_write( wd_fdc *f, libspectrum_byte b )
     if( b & 0x08 )
       wd_fdc_set_intrq( f );
     else if( b & 0x04 ) {
-      d->fdc_index = wd_fdc_wait_index;
-      d->fdc = f;
+      fdd_wait_index_pulse( d, wd_fdc_wait_index, f );
     }
 
     if( d->tr00 )
@@ -1087,8 +1086,8 @@ wd_fdc_dr_read( wd_fdc *f )
 	  event_add_with_data( tstates +	 	/* 5 revolutions: 5 * 200 / 1000 */
 			       machine_current->timings.processor_speed,
 			       timeout_event, f );
-	  event_add_with_data( tstates + 2 * 		/* 20 ms delay */
-			       machine_current->timings.processor_speed / 100,
+	  event_add_with_data( tstates + ( fdd_turbo( d ) ? 0 : 2 * 	/* 20 ms delay */
+			       machine_current->timings.processor_speed / 100 ),
 			       fdc_event, f );
 	} else {
 	  f->status_register &= ~WD_FDC_SR_BUSY;
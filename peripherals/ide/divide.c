@@ -123,6 +123,7 @@ static void
 divide_end( void )
 {
   divxxx_free( divide_state );
+  ide_autosave_unregister( divide_idechn0 );
   libspectrum_ide_free( divide_idechn0 );
   libspectrum_ide_free( divide_idechn1 );
 }
@@ -169,6 +170,7 @@ divide_commit( libspectrum_ide_unit unit )
 {
   int error;
 
+  ide_access();
   error = libspectrum_ide_commit( divide_idechn0, unit );
 
   return error;
@@ -218,6 +220,7 @@ divide_ide_read( libspectrum_word port, libspectrum_byte *attached )
   *attached = 0xff; /* TODO: check this */
   ide_register = port_to_ide_register( port );
 
+  ide_access();
   return libspectrum_ide_read( divide_idechn0, ide_register );
 }
 
@@ -228,6 +231,7 @@ divide_ide_write( libspectrum_word port, libspectrum_byte data )
   
   ide_register = port_to_ide_register( port );
   
+  ide_access();
   libspectrum_ide_write( divide_idechn0, ide_register, data );
 }
 
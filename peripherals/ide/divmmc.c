@@ -106,10 +106,14 @@ static const ui_menu_item eject_menu_item = UI_MENU_ITEM_MEDIA_IDE_DIVMMC_EJECT;
 
 /* Housekeeping functions */
 
+static int dirty_fn_wrapper( void *context );
+static libspectrum_error commit_fn_wrapper( void *context );
+
 static int
 divmmc_init( void *context )
 {
   card = libspectrum_mmc_alloc();
+  ide_autosave_register( dirty_fn_wrapper, commit_fn_wrapper, card );
 
   ui_menu_activate( eject_menu_item, 0 );
 
@@ -143,6 +147,7 @@ static void
 divmmc_end( void )
 {
   divxxx_free( divmmc_state );
+  ide_autosave_unregister( card );
   libspectrum_mmc_free( card );
 }
 
@@ -218,6 +223,7 @@ divmmc_insert( const char *filename )
 void
 divmmc_commit( void )
 {
+  ide_access();
   libspectrum_mmc_commit( card );
 }
 
@@ -261,13 +267,19 @@ divmmc_mmc_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff;
 
-  return current_card ? libspectrum_mmc_read( card ) : 0xff;
+  if( !current_card ) return 0xff;
+
+  ide_access();
+  return libspectrum_mmc_read( card );
 }
 
 static void
 divmmc_mmc_write( libspectrum_word port GCC_UNUSED, libspectrum_byte data )
 {
-  if( current_card ) libspectrum_mmc_write( card, data );
+  if( !current_card ) return;
+
+  ide_access();
+  libspectrum_mmc_write( card, data );
 }
 
 void
@@ -23,18 +23,221 @@
 
 #include <config.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libspectrum.h>
 
+#include "fuse.h"
 #include "ide.h"
+#include "machine.h"
+#include "thread_sched.h"
 #include "ui/ui.h"
 #include "settings.h"
 
+/* With --mass-storage-autosave, the changes to a hard disk or card are
+   written back to its image once the interfaces have been left alone for
+   this many seconds. libspectrum keeps changed sectors in memory until
+   they're committed, so this also means there's only ever a few seconds'
+   worth to write when the image is ejected */
+#define IDE_AUTOSAVE_DELAY 2
+
+/* Enough for every interface we emulate */
+#define IDE_AUTOSAVE_MAX_UNITS 8
+
+typedef struct ide_autosave_unit {
+  int (*is_dirty_fn)( void *context );
+  libspectrum_error (*commit_fn)( void *context );
+  void *context;
+} ide_autosave_unit;
+
+static ide_autosave_unit autosave_units[ IDE_AUTOSAVE_MAX_UNITS ];
+static size_t autosave_unit_count = 0;
+
+static int idle_frames = 0;
+
+/* The unit being committed on the writer thread, if any */
+static ide_autosave_unit *autosave_busy = NULL;
+
+#ifdef HAVE_PTHREAD
+
+static pthread_t autosave_thread;
+static int autosave_done;
+static libspectrum_error autosave_error;
+
+static pthread_mutex_t autosave_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t autosave_cond = PTHREAD_COND_INITIALIZER;
+
+static void*
+autosave_thread_fn( void *arg )
+{
+  ide_autosave_unit *unit = arg;
+  libspectrum_error error;
+
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+  error = unit->commit_fn( unit->context );
+
+  pthread_mutex_lock( &autosave_mutex );
+  autosave_error = error;
+  autosave_done = 1;
+  pthread_cond_signal( &autosave_cond );
+  pthread_mutex_unlock( &autosave_mutex );
+
+  return NULL;
+}
+
+/* Collect the writer thread once it's finished; if `wait', wait for it to
+   do so */
+static void
+autosave_finish( int wait )
+{
+  int done;
+
+  if( !autosave_busy ) return;
+
+  pthread_mutex_lock( &autosave_mutex );
+  while( wait && !autosave_done )
+    pthread_cond_wait( &autosave_cond, &autosave_mutex );
+  done = autosave_done;
+  pthread_mutex_unlock( &autosave_mutex );
+
+  if( !done ) return;
+
+  pthread_join( autosave_thread, NULL );
+  autosave_busy = NULL;
+
+  if( autosave_error )
+    ui_error( UI_ERROR_ERROR, "couldn't write changes back to mass storage" );
+}
+
+#else			/* #ifdef HAVE_PTHREAD */
+
+static void autosave_finish( int wait GCC_UNUSED ) {}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+static void
+autosave_start( ide_autosave_unit *unit )
+{
+#ifdef HAVE_PTHREAD
+  autosave_done = 0;
+  if( !pthread_create( &autosave_thread, NULL, autosave_thread_fn, unit ) ) {
+    autosave_busy = unit;
+    return;
+  }
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  /* No thread, so do it now; we're idle anyway */
+  if( unit->commit_fn( unit->context ) )
+    ui_error( UI_ERROR_ERROR, "couldn't write changes back to mass storage" );
+}
+
+void
+ide_autosave_register( int (*is_dirty_fn)( void *context ),
+                       libspectrum_error (*commit_fn)( void *context ),
+                       void *context )
+{
+  ide_autosave_unit *unit;
+  size_t i;
+
+  for( i = 0; i < autosave_unit_count; i++ )
+    if( autosave_units[i].context == context ) return;
+
+  if( autosave_unit_count == IDE_AUTOSAVE_MAX_UNITS ) return;
+
+  unit = &autosave_units[ autosave_unit_count++ ];
+  unit->is_dirty_fn = is_dirty_fn;
+  unit->commit_fn = commit_fn;
+  unit->context = context;
+}
+
+void
+ide_autosave_unregister( void *context )
+{
+  size_t i;
+
+  autosave_finish( 1 );
+
+  for( i = 0; i < autosave_unit_count; i++ ) {
+    if( autosave_units[i].context != context ) continue;
+    autosave_units[i] = autosave_units[ --autosave_unit_count ];
+    break;
+  }
+}
+
+void
+ide_access( void )
+{
+  idle_frames = 0;
+  if( autosave_busy ) autosave_finish( 1 );
+}
+
+void
+ide_frame( void )
+{
+  libspectrum_dword frames_per_second;
+  size_t i;
+
+  autosave_finish( 0 );
+
+  if( !settings_current.mass_storage_autosave || autosave_busy ||
+      !autosave_unit_count ) {
+    idle_frames = 0;
+    return;
+  }
+
+  frames_per_second = machine_current->timings.processor_speed /
+                      machine_current->timings.tstates_per_frame;
+  if( ++idle_frames < IDE_AUTOSAVE_DELAY * frames_per_second ) return;
+
+  /* One unit at a time; the next gets its turn when this one is done */
+  for( i = 0; i < autosave_unit_count; i++ ) {
+    if( autosave_units[i].is_dirty_fn( autosave_units[i].context ) ) {
+      autosave_start( &autosave_units[i] );
+      return;
+    }
+  }
+
+  idle_frames = 0;
+}
+
+static int
+channel_dirty( void *context )
+{
+  libspectrum_ide_channel *chn = context;
+
+  return libspectrum_ide_dirty( chn, LIBSPECTRUM_IDE_MASTER ) ||
+         libspectrum_ide_dirty( chn, LIBSPECTRUM_IDE_SLAVE );
+}
+
+static libspectrum_error
+channel_commit( void *context )
+{
+  libspectrum_ide_channel *chn = context;
+  libspectrum_error error;
+
+  error = libspectrum_ide_commit( chn, LIBSPECTRUM_IDE_MASTER );
+  if( error ) return error;
+
+  return libspectrum_ide_commit( chn, LIBSPECTRUM_IDE_SLAVE );
+}
+
+void
+ide_register_channel( libspectrum_ide_channel *channel )
+{
+  ide_autosave_register( channel_dirty, channel_commit, channel );
+}
+
 static int
 ide_insert_file( libspectrum_ide_channel *channel, libspectrum_ide_unit unit,
 		 const char *filename, ui_menu_item menu_item )
 {
   int error;
 
+  ide_access();
+
   error = libspectrum_ide_insert( channel, unit, filename );
   if( error ) return error;
   return ui_menu_activate( menu_item, 1 );
@@ -50,6 +253,8 @@ ide_init( libspectrum_ide_channel *channel,
   ui_menu_activate( master_menu_item, 0 );
   ui_menu_activate( slave_menu_item, 0 );
 
+  ide_register_channel( channel );
+
   if( master_setting ) {
     error = ide_insert_file( channel, LIBSPECTRUM_IDE_MASTER, master_setting,
 		             master_menu_item );
@@ -148,6 +353,13 @@ ide_eject_mass_storage(
 {
   int error;
 
+  ide_access();
+
+  /* With autosave, just write back whatever is still outstanding */
+  if( settings_current.mass_storage_autosave && is_dirty_fn( context ) ) {
+    error = commit_fn( context ); if( error ) return error;
+  }
+
   if( is_dirty_fn( context ) ) {
     
     ui_confirm_save_t confirm = ui_confirm_save( "%s", message );
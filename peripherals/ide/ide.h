@@ -60,4 +60,22 @@ ide_eject_mass_storage(
     libspectrum_error (*eject_fn)( void *context ),
     void *context, const char *message, char **setting, ui_menu_item item );
 
+/* Write a unit's changes back to its image in the background when the
+   mass storage interfaces are idle, with --mass-storage-autosave.
+   ide_init() does this for the channel it's given */
+void ide_autosave_register( int (*is_dirty_fn)( void *context ),
+                            libspectrum_error (*commit_fn)( void *context ),
+                            void *context );
+void ide_register_channel( libspectrum_ide_channel *channel );
+
+/* Must be called before the unit is freed */
+void ide_autosave_unregister( void *context );
+
+/* Must be called before any access to a unit, as a background write
+   may be in progress */
+void ide_access( void );
+
+/* Called once a frame */
+void ide_frame( void );
+
 #endif			/* #ifndef FUSE_IDE_H */
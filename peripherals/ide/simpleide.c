@@ -94,6 +94,7 @@ simpleide_init( void *context )
 static void
 simpleide_end( void )
 {
+  ide_autosave_unregister( simpleide_idechn );
   libspectrum_ide_free( simpleide_idechn );
 }
 
@@ -131,6 +132,7 @@ simpleide_commit( libspectrum_ide_unit unit )
 {
   int error;
 
+  ide_access();
   error = libspectrum_ide_commit( simpleide_idechn, unit );
 
   return error;
@@ -158,6 +160,7 @@ simpleide_read( libspectrum_word port, libspectrum_byte *attached )
   
   idereg = ( ( port >> 8 ) & 0x01 ) | ( ( port >> 11 ) & 0x06 );
   
+  ide_access();
   return libspectrum_ide_read( simpleide_idechn, idereg ); 
 }  
 
@@ -168,6 +171,7 @@ simpleide_write( libspectrum_word port, libspectrum_byte data )
   
   idereg = ( ( port >> 8 ) & 0x01 ) | ( ( port >> 11 ) & 0x06 );
   
+  ide_access();
   libspectrum_ide_write( simpleide_idechn, idereg, data ); 
 }
 
@@ -198,6 +198,7 @@ zxatasp_init( void *context )
 static void
 zxatasp_end( void )
 {
+  ide_autosave_unregister( zxatasp_idechn0 );
   libspectrum_ide_free( zxatasp_idechn0 );
   libspectrum_ide_free( zxatasp_idechn1 );
 }
@@ -250,6 +251,7 @@ zxatasp_commit( libspectrum_ide_unit unit )
 {
   int error;
 
+  ide_access();
   error = libspectrum_ide_commit( zxatasp_idechn0, unit );
 
   return error;
@@ -441,6 +443,7 @@ zxatasp_readide(libspectrum_ide_channel *chn,
 {
   libspectrum_byte dataHi, dataLo;
   
+  ide_access();
   dataLo = libspectrum_ide_read( chn, idereg );
   
   if( idereg == LIBSPECTRUM_IDE_REGISTER_DATA ) {
@@ -462,6 +465,7 @@ zxatasp_writeide(libspectrum_ide_channel *chn,
   dataLo = ( zxatasp_control & MC8255_PORT_A_IO ) ? 0xff : zxatasp_portA;
   dataHi = ( zxatasp_control & MC8255_PORT_B_IO ) ? 0xff : zxatasp_portB;
   
+  ide_access();
   libspectrum_ide_write( chn, idereg, dataLo );
   
   if( idereg == LIBSPECTRUM_IDE_REGISTER_DATA )
@@ -117,6 +117,7 @@ zxcf_init( void *context )
   last_memctl = 0x00;
                                 
   zxcf_idechn = libspectrum_ide_alloc( LIBSPECTRUM_IDE_DATA16 );
+  ide_register_channel( zxcf_idechn );
 
   ui_menu_activate( UI_MENU_ITEM_MEDIA_IDE_ZXCF_EJECT, 0 );
 
@@ -143,6 +144,7 @@ zxcf_init( void *context )
 static void
 zxcf_end( void )
 {
+  ide_autosave_unregister( zxcf_idechn );
   libspectrum_ide_free( zxcf_idechn );
 }
 
@@ -187,6 +189,7 @@ zxcf_commit( void )
 {
   int error;
 
+  ide_access();
   error = libspectrum_ide_commit( zxcf_idechn, LIBSPECTRUM_IDE_MASTER );
 
   return error;
@@ -265,6 +268,7 @@ zxcf_ide_read( libspectrum_word port, libspectrum_byte *attached )
   
   *attached = 0xff; /* TODO: check this */
 
+  ide_access();
   return libspectrum_ide_read( zxcf_idechn, idereg ); 
 }
 
@@ -274,6 +278,7 @@ zxcf_ide_write( libspectrum_word port, libspectrum_byte data )
   libspectrum_ide_register idereg;
   
   idereg = ( port >> 8 ) & 0x07;
+  ide_access();
   libspectrum_ide_write( zxcf_idechn, idereg, data ); 
 }
 
@@ -83,10 +83,14 @@ static const ui_menu_item eject_menu_item = UI_MENU_ITEM_MEDIA_IDE_ZXMMC_EJECT;
 
 /* Housekeeping functions */
 
+static int dirty_fn_wrapper( void *context );
+static libspectrum_error commit_fn_wrapper( void *context );
+
 static int
 zxmmc_init( void *context )
 {
   card = libspectrum_mmc_alloc();
+  ide_autosave_register( dirty_fn_wrapper, commit_fn_wrapper, card );
 
   ui_menu_activate( eject_menu_item, 0 );
 
@@ -111,6 +115,7 @@ zxmmc_init( void *context )
 static void
 zxmmc_end( void )
 {
+  ide_autosave_unregister( card );
   libspectrum_mmc_free( card );
 }
 
@@ -184,6 +189,7 @@ zxmmc_insert( const char *filename )
 void
 zxmmc_commit( void )
 {
+  ide_access();
   libspectrum_mmc_commit( card );
 }
 
@@ -219,13 +225,19 @@ zxmmc_mmc_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff;
 
-  return current_card ? libspectrum_mmc_read( card ) : 0xff;
+  if( !current_card ) return 0xff;
+
+  ide_access();
+  return libspectrum_mmc_read( card );
 }
 
 static void
 zxmmc_mmc_write( libspectrum_word port GCC_UNUSED, libspectrum_byte data )
 {
-  if( current_card ) libspectrum_mmc_write( card, data );
+  if( !current_card ) return;
+
+  ide_access();
+  libspectrum_mmc_write( card, data );
 }
 
 static void
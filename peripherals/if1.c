@@ -32,6 +32,12 @@
 
 #include <unistd.h>
 
+#if defined( HAVE_PTHREAD ) && !defined( WIN32 )
+#define IF1_IO_THREAD
+#include <pthread.h>
+#include <sys/select.h>
+#endif
+
 #include "compat.h"
 #include "debugger/debugger.h"
 #include "if1.h"
@@ -41,6 +47,7 @@
 #include "module.h"
 #include "periph.h"
 #include "settings.h"
+#include "thread_sched.h"
 #include "utils.h"
 #include "ui/ui.h"
 #include "unittests/unittests.h"
@@ -70,6 +77,7 @@ typedef struct microdrive_t {
   int modified;
   int motor_on;
   int head_pos;
+  int head_len;		/* cartridge length in bytes */
   int transfered;
   int max_bytes;
   libspectrum_byte pream[512];	/* preamble/sync area written */
@@ -77,7 +85,8 @@ typedef struct microdrive_t {
   libspectrum_byte gap;
   libspectrum_byte sync;
 
-  libspectrum_microdrive *cartridge;	/* write protect, len, blocks */
+  libspectrum_microdrive *cartridge;	/* write protect, len, blocks; only
+					   allocated while inserted */
 
 } microdrive_t;
 
@@ -164,7 +173,7 @@ static memory_page if1_memory_map_romcs[MEMORY_PAGES_IN_8K];
 /* IF1 paged out ROM activated? */
 int if1_active = 0;
 int if1_available = 0;
-static int if1_mdr_status = 0;
+static int if1_mdr_status = 0;	/* Is any microdrive motor running? */
 
 int rnd_factor = ( ( RAND_MAX >> 2 ) << 2 ) / 19 + 1;
 
@@ -172,12 +181,127 @@ static microdrive_t microdrive[8];		/* We have 8 microdrive */
 static if1_ula_t if1_ula;
 
 static void microdrives_reset( void );
+static void cartridge_alloc( microdrive_t *mdr );
+static void cartridge_free( microdrive_t *mdr );
 static void microdrives_restart( void );
 static void increment_head( int m );
 
 #define MDR_IN(m) microdrive[m - 1].inserted
 #define MDR_WP(m) libspectrum_microdrive_write_protect( microdrive[m - 1].cartridge )
 
+/* The host side of the RS232 and network links. With threads, an I/O
+   thread moves bytes between the host files and a ring for each
+   direction, so the port handlers don't wait on the host; the raw
+   network mode shares the wire state through a file rather than a
+   stream, so it is still done directly */
+
+#define IF1_LINK_BUFFER 4096
+
+typedef struct if1_link_t {
+  int *fd;		/* descriptor in if1_ula */
+  int output;		/* Fuse writes to the host rather than reads */
+#ifdef IF1_IO_THREAD
+  libspectrum_byte buffer[ IF1_LINK_BUFFER ];
+  int head, tail;	/* waiting bytes are from tail up to head; the
+			   producer only moves head, the consumer tail */
+#endif
+} if1_link_t;
+
+static if1_link_t rs232_in = { &if1_ula.fd_r, 0 };
+static if1_link_t rs232_out = { &if1_ula.fd_t, 1 };
+static if1_link_t net_in = { &if1_ula.fd_net, 0 };
+static if1_link_t net_out = { &if1_ula.fd_net, 1 };
+
+#ifdef IF1_IO_THREAD
+
+static if1_link_t * const links[] = { &rs232_in, &rs232_out, &net_in,
+                                      &net_out };
+
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ) )
+#define LINK_LOAD( x ) __atomic_load_n( &(x), __ATOMIC_ACQUIRE )
+#define LINK_STORE( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELEASE )
+#else
+#define LINK_LOAD( x ) ( *(volatile int *)&(x) )
+#define LINK_STORE( x, v ) ( *(volatile int *)&(x) = (v) )
+#endif
+
+#define LINK_NEXT( i ) ( ( (i) + 1 ) % IF1_LINK_BUFFER )
+
+/* The I/O thread waits at most this long, in case it misses a wakeup */
+#define IF1_IO_TIMEOUT_US 20000
+
+static pthread_t io_thread;
+static int io_running = 0;
+static int io_quit;
+static int io_pipe[2];		/* written to wake the I/O thread */
+
+static void if1_io_start( void );
+static void if1_io_stop( void );
+
+static void
+if1_io_wake( void )
+{
+  const char dummy = 0;
+  ssize_t unused = write( io_pipe[1], &dummy, 1 );
+  (void) unused;
+}
+
+#endif				/* #ifdef IF1_IO_THREAD */
+
+/* Get a byte from the host; returns 1 if there was one */
+static int
+if1_link_read( if1_link_t *link, libspectrum_byte *b )
+{
+#ifdef IF1_IO_THREAD
+  if( io_running ) {
+    int tail = link->tail, head = LINK_LOAD( link->head );
+
+    if( tail == head ) return 0;
+
+    *b = link->buffer[ tail ];
+    LINK_STORE( link->tail, LINK_NEXT( tail ) );
+
+    /* The thread stops reading the host when the ring is full */
+    if( LINK_NEXT( head ) == tail ) if1_io_wake();
+
+    return 1;
+  }
+#endif
+
+  return read( *link->fd, b, 1 ) == 1;
+}
+
+/* Send a byte to the host */
+static void
+if1_link_write( if1_link_t *link, libspectrum_byte b )
+{
+#ifdef IF1_IO_THREAD
+  if( io_running ) {
+    int head = link->head, next = LINK_NEXT( head );
+
+    /* Only wait if the host has stopped taking bytes altogether */
+    while( next == LINK_LOAD( link->tail ) ) {
+      if1_io_wake();
+      usleep( 1000 );
+    }
+
+    link->buffer[ head ] = b;
+    LINK_STORE( link->head, next );
+
+    /* The thread only watches the host when there's something to send */
+    if( head == LINK_LOAD( link->tail ) ) if1_io_wake();
+
+    return;
+  }
+#endif
+
+  do {} while( write( *link->fd, &b, 1 ) != 1 );
+#ifdef HAVE_FSYNC
+  if( link == &net_out ) fsync( *link->fd );
+#endif /* #ifdef HAVE_FSYNC */
+}
+
 enum if1_menu_item {
 
   UMENU_ALL = 0,
@@ -318,7 +442,7 @@ if1_init( void *context )
   if1_ula.esc_in = 0; /* empty */
 
   for( m = 0; m < 8; m++ ) {
-    microdrive[m].cartridge = libspectrum_microdrive_alloc();
+    microdrive[m].cartridge = NULL;
     microdrive[m].inserted = 0;
     microdrive[m].modified = 0;
   }
@@ -359,11 +483,11 @@ if1_end( void )
 {
   int m;
 
-  for( m = 0; m < 8; m++ ) {
-    libspectrum_error error =
-      libspectrum_microdrive_free( microdrive[m].cartridge );
-    if( error ) return;
-  }
+#ifdef IF1_IO_THREAD
+  if1_io_stop();
+#endif
+
+  for( m = 0; m < 8; m++ ) cartridge_free( &microdrive[m] );
 }
 
 void
@@ -558,6 +682,8 @@ port_mdr_in( void )
   libspectrum_byte ret = 0xff;
   int m;
 
+  if( !if1_mdr_status ) return ret;
+
   for( m = 0; m < 8; m++ ) {
 
     microdrive_t *mdr = &microdrive[ m ];
@@ -585,7 +711,7 @@ port_ctr_in( void )
   libspectrum_byte ret = 0xff;
   int m, block;
 
-  for( m = 0; m < 8; m++ ) {
+  for( m = 0; if1_mdr_status && m < 8; m++ ) {
 
     microdrive_t *mdr = &microdrive[ m ];
 
@@ -615,7 +741,7 @@ port_ctr_in( void )
     unsigned char byte;
     int yes = 1;
 
-    while( yes && read( if1_ula.fd_r, &byte, 1 ) == 1 ) {
+    while( yes && if1_link_read( &rs232_in, &byte ) ) {
       if( if1_ula.esc_in == 1 ) {
         if1_ula.esc_in = 0;
 	if( byte == '*' ) {
@@ -661,12 +787,15 @@ port_ctr_in( void )
 static int
 read_rs232( void )
 {
+  libspectrum_byte byte;
+
   if( if1_ula.rs232_buffer <= 0xff ) {	/* we read from the buffer */
     if1_ula.data_in = if1_ula.rs232_buffer;
     if1_ula.rs232_buffer = 0x0100;
     return 1;
   }
-  while( read( if1_ula.fd_r, &if1_ula.data_in, 1 ) == 1 ) {
+  while( if1_link_read( &rs232_in, &byte ) ) {
+    if1_ula.data_in = byte;
     if( if1_ula.esc_in == 1 ) {
       if1_ula.esc_in = 0;
       if( if1_ula.data_in == '*' ) {
@@ -752,7 +881,10 @@ no_rs232_in:
       fprintf( stderr, "NET-STAT(%03d)? We send 0!\n", if1_ula.net_state );
 #endif
     } else if( if1_ula.net_state == 0x0100 ) { /* probably waiting for input */
-      if( read( if1_ula.fd_net, &if1_ula.net_data, 1 ) == 1 ) {
+      libspectrum_byte byte;
+
+      if( if1_link_read( &net_in, &byte ) ) {
+        if1_ula.net_data = byte;
         if1_ula.net_state++;
 	if1_ula.net = 1;	/* Start with __/~~ */
       } 	/* Ok, if have a byte, we send it! */
@@ -805,6 +937,8 @@ port_mdr_out( libspectrum_byte val )
 {
   int m, block;
 
+  if( !if1_mdr_status ) return;
+
   /* allow access to the port only if motor 1 is ON and there's a file open */
   for( m = 0; m < 8; m++ ) {
 
@@ -905,9 +1039,8 @@ port_ctr_out( libspectrum_byte val )
   val = ( val & 0x10 ) ? 1 : 0;
   if( settings_current.rs232_handshake && 
       if1_ula.fd_t != -1 && if1_ula.cts != val ) {
-    char data = val ? 0x03 : 0x02;
-    do {} while( write( if1_ula.fd_t, "", 1 ) != 1 );
-    do {} while( write( if1_ula.fd_t, &data, 1 ) != 1 );
+    if1_link_write( &rs232_out, 0x00 );
+    if1_link_write( &rs232_out, val ? 0x03 : 0x02 );
   }
   if1_ula.cts = val;
     
@@ -956,15 +1089,15 @@ port_net_out( libspectrum_byte val )
     if( if1_ula.count_out == -1 ) {
       if1_ula.count_out = 13;
       if1_ula.data_out = '?';
-      do {} while( write( if1_ula.fd_t, "", 1 ) != 1 );
+      if1_link_write( &rs232_out, 0x00 );
     }
     if( if1_ula.count_out == 13 ) {
         /* Here is the output routine */
       if( if1_ula.data_out == 0x00 ) {
         if1_ula.data_out = '*';
-        do {} while( write( if1_ula.fd_t, "", 1 ) != 1 );
+        if1_link_write( &rs232_out, 0x00 );
       }
-      do {} while( write( if1_ula.fd_t, &if1_ula.data_out, 1 ) != 1 );
+      if1_link_write( &rs232_out, if1_ula.data_out );
       if1_ula.count_out = 0;
     }
     if1_ula.rx = val & 0x01;		/* set rx */
@@ -997,10 +1130,7 @@ port_net_out( libspectrum_byte val )
         
 /*	lseek( if1_ula.fd_net, 0, SEEK_SET );  start a packet */
 		/* first we send the station number */
-        do {} while( write( if1_ula.fd_net, &if1_ula.net_data, 1 ) == -1 );
-#ifdef HAVE_FSYNC
-        fsync( if1_ula.fd_net );
-#endif /* #ifdef HAVE_FSYNC */
+        if1_link_write( &net_out, if1_ula.net_data );
 #ifdef IF1_DEBUG_NET
 	fprintf( stderr, "SC-OUT send network number: %d\n",
 	                                   if1_ula.net_data ^ 0xff );
@@ -1038,22 +1168,28 @@ static void
 increment_head( int m )
 {
   microdrive[m].head_pos++;
-  if( microdrive[m].head_pos >=
-      libspectrum_microdrive_cartridge_len( microdrive[m].cartridge ) *
-      LIBSPECTRUM_MICRODRIVE_BLOCK_LEN )
+  if( microdrive[m].head_pos >= microdrive[m].head_len )
     microdrive[m].head_pos = 0;
 }
 
 static void
 microdrives_restart( void )
 {
-  int m;
+  int m, pos;
 
   for( m = 0; m < 8; m++ ) {
-    while( ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) != 0  &&
-           ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) != LIBSPECTRUM_MICRODRIVE_HEAD_LEN )
-      increment_head( m ); /* put head in the start of a block */
-	
+    if( !microdrive[m].inserted ) continue;
+
+    /* put head in the start of a block */
+    pos = microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN;
+    if( pos != 0 && pos != LIBSPECTRUM_MICRODRIVE_HEAD_LEN ) {
+      microdrive[m].head_pos += pos < LIBSPECTRUM_MICRODRIVE_HEAD_LEN ?
+	LIBSPECTRUM_MICRODRIVE_HEAD_LEN - pos :
+	LIBSPECTRUM_MICRODRIVE_BLOCK_LEN - pos;
+      if( microdrive[m].head_pos >= microdrive[m].head_len )
+	microdrive[m].head_pos = 0;
+    }
+
     microdrive[m].transfered = 0; /* reset current number of bytes written */
 
     if( ( microdrive[m].head_pos % LIBSPECTRUM_MICRODRIVE_BLOCK_LEN ) == 0 ) {
@@ -1067,6 +1203,8 @@ microdrives_restart( void )
 void
 if1_mdr_writeprotect( int drive, int wrprot )
 {
+  if( !microdrive[drive].inserted ) return;
+
   libspectrum_microdrive_set_write_protect( microdrive[drive].cartridge,
 					    wrprot ? 1 : 0 );
   microdrive[drive].modified = 1;
@@ -1074,6 +1212,22 @@ if1_mdr_writeprotect( int drive, int wrprot )
   update_menu( UMENU_MDRV1 + drive );
 }
 
+/* The cartridge image is only held in memory while it is in a drive */
+static void
+cartridge_alloc( microdrive_t *mdr )
+{
+  if( !mdr->cartridge ) mdr->cartridge = libspectrum_microdrive_alloc();
+  mdr->head_pos = 0;
+}
+
+static void
+cartridge_free( microdrive_t *mdr )
+{
+  if( !mdr->cartridge ) return;
+  libspectrum_microdrive_free( mdr->cartridge );
+  mdr->cartridge = NULL;
+}
+
 static void
 if1_mdr_new( microdrive_t *mdr )
 {
@@ -1089,8 +1243,11 @@ if1_mdr_new( microdrive_t *mdr )
     len = settings_current.mdr_len = settings_current.mdr_len < 10 ? 10 : 
 	    settings_current.mdr_len > LIBSPECTRUM_MICRODRIVE_BLOCK_MAX ? LIBSPECTRUM_MICRODRIVE_BLOCK_MAX : settings_current.mdr_len;
   
+  cartridge_alloc( mdr );
+
   /* Erase the entire cartridge */
   libspectrum_microdrive_set_cartridge_len( mdr->cartridge, len );
+  mdr->head_len = len * LIBSPECTRUM_MICRODRIVE_BLOCK_LEN;
 
   for( i = 0; i < len * LIBSPECTRUM_MICRODRIVE_BLOCK_LEN; i++ )
     libspectrum_microdrive_set_data( mdr->cartridge, i, 0xff );
@@ -1153,9 +1310,12 @@ if1_mdr_insert( int which, const char *filename )
     return 1;
   }
 
+  cartridge_alloc( mdr );
+
   if( libspectrum_microdrive_mdr_read( mdr->cartridge, mdr->file.buffer,
 				       mdr->file.length ) ) {
     utils_close_file( &mdr->file );
+    cartridge_free( mdr );
     ui_error( UI_ERROR_ERROR, "Failed to open cartridge image" );
     return 1;
   }
@@ -1165,6 +1325,8 @@ if1_mdr_insert( int which, const char *filename )
   mdr->inserted = 1;
   mdr->modified = 0;
   mdr->filename = utils_safe_strdup( filename );
+  mdr->head_len = libspectrum_microdrive_cartridge_len( mdr->cartridge ) *
+                  LIBSPECTRUM_MICRODRIVE_BLOCK_LEN;
   /* we assume formatted cartridges */
   for( i = libspectrum_microdrive_cartridge_len( mdr->cartridge );
 	i > 0; i-- )
@@ -1209,6 +1371,7 @@ if1_mdr_eject( int which )
   }
 
   mdr->inserted = 0;
+  cartridge_free( mdr );
   if( mdr->filename != NULL ) {
     libspectrum_free( mdr->filename );
     mdr->filename = NULL;
@@ -1218,6 +1381,14 @@ if1_mdr_eject( int which )
   return 0;
 }
 
+const char*
+if1_mdr_filename( int which )
+{
+  if( which < 0 || which >= 8 || !microdrive[ which ].inserted ) return NULL;
+
+  return microdrive[ which ].filename;
+}
+
 int
 if1_mdr_save( int which, int saveas )
 {
@@ -1261,6 +1432,162 @@ if1_mdr_write( int which, const char *filename )
 #define O_NONBLOCK FNDELAY
 #endif
 
+#ifdef IF1_IO_THREAD
+
+/* Is this link serviced by the I/O thread? */
+static int
+if1_link_threaded( if1_link_t *link )
+{
+  if( *link->fd == -1 ) return 0;
+  if( link->fd == &if1_ula.fd_net && if1_ula.s_net_mode == 0 ) return 0;
+  return 1;
+}
+
+static void*
+if1_io_thread_fn( void *arg GCC_UNUSED )
+{
+  size_t i;
+
+  thread_sched_apply( THREAD_SCHED_IO );
+
+  while( !LINK_LOAD( io_quit ) ) {
+    fd_set readfds, writefds;
+    struct timeval timeout;
+    int max_fd = io_pipe[0];
+
+    FD_ZERO( &readfds );
+    FD_ZERO( &writefds );
+    FD_SET( io_pipe[0], &readfds );
+
+    for( i = 0; i < ARRAY_SIZE( links ); i++ ) {
+      if1_link_t *link = links[i];
+      int head = LINK_LOAD( link->head ), tail = LINK_LOAD( link->tail );
+
+      if( !if1_link_threaded( link ) ) continue;
+
+      if( link->output ) {
+        if( head == tail ) continue;	/* nothing to send */
+        FD_SET( *link->fd, &writefds );
+      } else {
+        if( LINK_NEXT( head ) == tail ) continue;	/* no room */
+        FD_SET( *link->fd, &readfds );
+      }
+      if( *link->fd > max_fd ) max_fd = *link->fd;
+    }
+
+    timeout.tv_sec = 0;
+    timeout.tv_usec = IF1_IO_TIMEOUT_US;
+
+    if( select( max_fd + 1, &readfds, &writefds, NULL, &timeout ) <= 0 )
+      continue;
+
+    if( FD_ISSET( io_pipe[0], &readfds ) ) {
+      char bitbucket[16];
+      ssize_t unused = read( io_pipe[0], bitbucket, sizeof( bitbucket ) );
+      (void) unused;
+    }
+
+    for( i = 0; i < ARRAY_SIZE( links ); i++ ) {
+      if1_link_t *link = links[i];
+      int head, tail, length;
+      ssize_t done;
+
+      if( !if1_link_threaded( link ) ) continue;
+
+      head = LINK_LOAD( link->head );
+      tail = LINK_LOAD( link->tail );
+
+      if( link->output ) {
+        if( !FD_ISSET( *link->fd, &writefds ) ) continue;
+
+        /* Send what's contiguous; any more goes next time round */
+        length = ( head >= tail ? head : IF1_LINK_BUFFER ) - tail;
+        done = write( *link->fd, link->buffer + tail, length );
+        if( done <= 0 ) continue;
+#ifdef HAVE_FSYNC
+        if( link == &net_out ) fsync( *link->fd );
+#endif /* #ifdef HAVE_FSYNC */
+        LINK_STORE( link->tail, ( tail + done ) % IF1_LINK_BUFFER );
+      } else {
+        if( !FD_ISSET( *link->fd, &readfds ) ) continue;
+
+        /* Fill up to the end of the buffer, leaving one slot free */
+        length = ( head >= tail ? IF1_LINK_BUFFER : tail ) - head;
+        if( tail == 0 || head < tail ) length--;
+        if( length <= 0 ) continue;
+        done = read( *link->fd, link->buffer + head, length );
+        if( done <= 0 ) continue;
+        LINK_STORE( link->head, ( head + done ) % IF1_LINK_BUFFER );
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Start the I/O thread if any link needs it */
+static void
+if1_io_start( void )
+{
+  size_t i;
+  int needed = 0;
+
+  if( io_running ) return;
+
+  for( i = 0; i < ARRAY_SIZE( links ); i++ )
+    if( if1_link_threaded( links[i] ) ) needed = 1;
+  if( !needed ) return;
+
+  if( pipe( io_pipe ) ) {
+    ui_error( UI_ERROR_ERROR, "if1: couldn't create pipe: %s",
+              strerror( errno ) );
+    return;
+  }
+  fcntl( io_pipe[0], F_SETFL, O_NONBLOCK );
+  fcntl( io_pipe[1], F_SETFL, O_NONBLOCK );
+
+  io_quit = 0;
+
+  if( pthread_create( &io_thread, NULL, if1_io_thread_fn, NULL ) ) {
+    ui_error( UI_ERROR_ERROR, "if1: couldn't create I/O thread" );
+    close( io_pipe[0] ); close( io_pipe[1] );
+    return;
+  }
+
+  io_running = 1;
+}
+
+/* Stop the I/O thread, so the descriptors can be changed. Anything the
+   host hasn't taken yet is sent if it can be without waiting */
+static void
+if1_io_stop( void )
+{
+  size_t i;
+
+  if( !io_running ) return;
+
+  LINK_STORE( io_quit, 1 );
+  if1_io_wake();
+  pthread_join( io_thread, NULL );
+  io_running = 0;
+
+  close( io_pipe[0] ); close( io_pipe[1] );
+
+  for( i = 0; i < ARRAY_SIZE( links ); i++ ) {
+    if1_link_t *link = links[i];
+
+    if( link->output && if1_link_threaded( link ) ) {
+      while( link->tail != link->head &&
+             write( *link->fd, link->buffer + link->tail, 1 ) == 1 )
+        link->tail = LINK_NEXT( link->tail );
+    }
+
+    link->head = link->tail = 0;
+  }
+}
+
+#endif				/* #ifdef IF1_IO_THREAD */
+
 void
 if1_plug( const char *filename, int what )
 {
@@ -1270,6 +1597,10 @@ if1_plug( const char *filename, int what )
 #else
   int fd = -1;
 
+#ifdef IF1_IO_THREAD
+  if1_io_stop();
+#endif
+
   switch( what ) {
   case 1:
     if( if1_ula.fd_r >= 0 )
@@ -1303,10 +1634,16 @@ if1_plug( const char *filename, int what )
   if( fd < 0 ) {
     ui_error( UI_ERROR_ERROR, "Error opening '%s': %s",
 		filename, strerror( errno ) );
+#ifdef IF1_IO_THREAD
+    if1_io_start();
+#endif
     return;
   }
 
   if1_ula.s_net_mode = settings_current.raw_s_net ? 0 : 1;
+#ifdef IF1_IO_THREAD
+  if1_io_start();
+#endif
   update_menu( UMENU_RS232 );
 #endif
 }
@@ -1314,6 +1651,10 @@ if1_plug( const char *filename, int what )
 void
 if1_unplug( int what )
 {
+#ifdef IF1_IO_THREAD
+  if1_io_stop();
+#endif
+
   switch( what ) {
   case 1:
     if( if1_ula.fd_r >= 0 )
@@ -1336,6 +1677,9 @@ if1_unplug( int what )
   if( !settings_current.rs232_handshake && 
 	( if1_ula.fd_t == -1 || if1_ula.fd_r == -1 ) )
     if1_ula.dtr = 0;
+#ifdef IF1_IO_THREAD
+  if1_io_start();
+#endif
   update_menu( UMENU_RS232 );
 }
 
@@ -41,6 +41,9 @@ int if1_mdr_insert( int drive, const char *filename );
 int if1_mdr_write( int drive, const char *filename );
 int if1_mdr_eject( int drive );
 int if1_mdr_save( int drive, int saveas );
+/* The file the cartridge in `drive' came from, or NULL if it's empty or
+   hasn't been saved */
+const char* if1_mdr_filename( int drive );
 void if1_mdr_writeprotect( int drive, int wrprot );
 void if1_plug( const char *filename, int what );
 void if1_unplug( int what );
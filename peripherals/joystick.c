@@ -28,9 +28,11 @@
 
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
+#include "input.h"
 #include "joystick.h"
 #include "keyboard.h"
 #include "module.h"
+#include "netplay.h"
 #include "periph.h"
 #include "rzx.h"
 #include "settings.h"
@@ -253,12 +255,18 @@ libspectrum_byte
 joystick_kempston_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
-  return kempston_value;
+  input_poll_late();
+  return netplay_active ? netplay_machine_input.joystick.kempston :
+                          kempston_value;
 }
 
 libspectrum_byte
 joystick_timex_read( libspectrum_word port GCC_UNUSED, libspectrum_byte which )
 {
+  if( netplay_active )
+    return which ? netplay_machine_input.joystick.timex2 :
+                   netplay_machine_input.joystick.timex1;
+
   return which ? timex2_value : timex1_value;
 }
 
@@ -266,7 +274,17 @@ libspectrum_byte
 joystick_fuller_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
-  return fuller_value;
+  return netplay_active ? netplay_machine_input.joystick.fuller :
+                          fuller_value;
+}
+
+void
+joystick_get_values( joystick_values_t *values )
+{
+  values->kempston = kempston_value;
+  values->timex1 = timex1_value;
+  values->timex2 = timex2_value;
+  values->fuller = fuller_value;
 }
 
 static void
@@ -78,6 +78,17 @@ typedef enum joystick_button {
    pressed */
 int joystick_press( int which, joystick_button button, int press );
 
+/* What each emulated joystick is returning as the user has left it */
+typedef struct joystick_values_t {
+
+  libspectrum_byte kempston;
+  libspectrum_byte timex1, timex2;
+  libspectrum_byte fuller;
+
+} joystick_values_t;
+
+void joystick_get_values( joystick_values_t *values );
+
 /* Interface-specific read functions */
 libspectrum_byte joystick_kempston_read ( libspectrum_word port,
 					  libspectrum_byte *attached );
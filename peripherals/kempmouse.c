@@ -52,11 +52,25 @@ static struct {
   libspectrum_byte buttons;
 } kempmouse = { {0, 0}, 255 };
 
+/* Motion reported by the UI which the Spectrum hasn't seen yet. It's
+   added to the position the next time that is read, so every read in
+   a frame sees the same position however many events the UI got */
+static int pending_dx, pending_dy;
+
+static void
+apply_motion( void )
+{
+  kempmouse.pos.x += pending_dx;
+  kempmouse.pos.y -= pending_dy;
+  pending_dx = pending_dy = 0;
+}
+
 #define READ(name,item) \
   static libspectrum_byte \
   read_##name( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached ) \
   { \
     *attached = 0xff; /* TODO: check this */ \
+    if( pending_dx || pending_dy ) apply_motion(); \
     return kempmouse.item; \
   }
 
@@ -99,8 +113,8 @@ kempmouse_register_startup( void )
 void
 kempmouse_update( int dx, int dy, int btn, int down )
 {
-  kempmouse.pos.x += dx;
-  kempmouse.pos.y -= dy;
+  pending_dx += dx;
+  pending_dy += dy;
   if( btn != -1 ) {
     if( down )
       kempmouse.buttons &= ~(1 << btn);
@@ -31,13 +31,21 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#endif
+
 #include "compat.h"
 #include "enc28j60.h"
 #include "fuse.h"
 #include "settings.h"
+#include "thread_sched.h"
 #include "ui/ui.h"
 
 /* ---------------------------------------------------------------------------
@@ -100,6 +108,24 @@
 #define ETH_STATUS_NEXT_HI              (1)
 #define ETH_STATUS_LENGTH               (6)
 
+/* ---------------------------------------------------------------------------
+ * Frames queued between the emulation and the TAP device
+ * ------------------------------------------------------------------------ */
+
+#ifdef HAVE_PTHREAD
+
+#define FRAME_RING_SIZE                 (16)
+
+/* Slots [head, head + count) hold frames; the other slots belong to
+   whoever is adding frames, so only head and count need the lock */
+typedef struct frame_ring_t {
+  libspectrum_byte data[FRAME_RING_SIZE][ETH_MAX];
+  size_t length[FRAME_RING_SIZE];
+  size_t head, count;
+} frame_ring_t;
+
+#endif
+
 /* ------------------------------------------------------------------------- */
 
 struct nic_enc28j60_t {
@@ -117,6 +143,19 @@ struct nic_enc28j60_t {
   /* TAP file descriptor */
   int tap_fd;
 
+#ifdef HAVE_PTHREAD
+  /* The TAP device is read and written by a separate thread, so the
+     emulation never makes a system call for the network */
+  frame_ring_t rx, tx;
+  pthread_mutex_t mutex;
+  pthread_t thread;
+  int thread_running;
+  int stop_thread;
+
+  /* Written to wake the thread when it has something new to do */
+  int wake_pipe[2];
+#endif
+
   /* ---------------------------------------------------------------------------
    * SPI state
    * ------------------------------------------------------------------------ */
@@ -139,65 +178,264 @@ nic_enc28j60_alloc( void )
 
   self->tap_fd = -1;
   self->spi_state = SPI_IDLE;
+#ifdef HAVE_PTHREAD
+  self->thread_running = 0;
+#endif
   return self;
 }
 
+#ifdef HAVE_PTHREAD
+
+static void
+io_thread_wake( nic_enc28j60_t *self )
+{
+  const char c = 0;
+
+  /* If the pipe is full, the thread has plenty of wake-ups already */
+  if( write( self->wake_pipe[1], &c, 1 ) < 0 ) return;
+}
+
+/* Read as many frames as there is room for */
+static void
+io_thread_receive( nic_enc28j60_t *self )
+{
+  frame_ring_t *ring = &self->rx;
+  size_t count, slot;
+  ssize_t n;
+
+  while( 1 ) {
+    pthread_mutex_lock( &self->mutex );
+    count = ring->count;
+    slot = ( ring->head + count ) % FRAME_RING_SIZE;
+    pthread_mutex_unlock( &self->mutex );
+
+    if( count == FRAME_RING_SIZE ) break;
+
+    n = read( self->tap_fd, ring->data[ slot ], ETH_MAX );
+    if( n <= 0 ) break;
+    ring->length[ slot ] = n;
+
+    pthread_mutex_lock( &self->mutex );
+    ring->count++;
+    pthread_mutex_unlock( &self->mutex );
+  }
+}
+
+/* Write queued frames until the device won't take any more */
+static void
+io_thread_transmit( nic_enc28j60_t *self )
+{
+  frame_ring_t *ring = &self->tx;
+  size_t count;
+  ssize_t n;
+
+  pthread_mutex_lock( &self->mutex );
+  count = ring->count;
+  pthread_mutex_unlock( &self->mutex );
+
+  while( count ) {
+    n = write( self->tap_fd, ring->data[ ring->head ],
+               ring->length[ ring->head ] );
+
+    /* Try again when the device says it's ready; any other failure
+       loses the frame, as it would on the wire */
+    if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) break;
+
+    pthread_mutex_lock( &self->mutex );
+    ring->head = ( ring->head + 1 ) % FRAME_RING_SIZE;
+    count = --ring->count;
+    pthread_mutex_unlock( &self->mutex );
+  }
+}
+
+static void*
+io_thread( void *arg )
+{
+  nic_enc28j60_t *self = arg;
+  struct pollfd fds[2];
+  char discard[64];
+
+  thread_sched_apply( THREAD_SCHED_IO );
+
+  while( !self->stop_thread ) {
+
+    pthread_mutex_lock( &self->mutex );
+    fds[0].events = ( self->rx.count < FRAME_RING_SIZE ? POLLIN : 0 ) |
+                    ( self->tx.count ? POLLOUT : 0 );
+    pthread_mutex_unlock( &self->mutex );
+
+    fds[0].fd = self->tap_fd;
+    fds[1].fd = self->wake_pipe[0];
+    fds[1].events = POLLIN;
+
+    if( poll( fds, 2, -1 ) < 0 ) {
+      if( errno == EINTR ) continue;
+      break;
+    }
+
+    if( fds[1].revents & POLLIN )
+      while( read( self->wake_pipe[0], discard, sizeof( discard ) ) > 0 );
+
+    if( fds[0].revents & POLLIN ) io_thread_receive( self );
+    if( fds[0].revents & POLLOUT ) io_thread_transmit( self );
+
+    if( fds[0].revents & ( POLLERR | POLLNVAL ) ) break;
+  }
+
+  return NULL;
+}
+
+static void
+io_thread_start( nic_enc28j60_t *self )
+{
+  int error;
+
+  if( pipe( self->wake_pipe ) ) {
+    ui_error( UI_ERROR_ERROR, "enc28j60: couldn't create pipe: %s",
+              strerror( errno ) );
+    return;
+  }
+
+  fcntl( self->wake_pipe[0], F_SETFL, O_NONBLOCK );
+  fcntl( self->wake_pipe[1], F_SETFL, O_NONBLOCK );
+
+  self->rx.head = self->rx.count = 0;
+  self->tx.head = self->tx.count = 0;
+  pthread_mutex_init( &self->mutex, NULL );
+  self->stop_thread = 0;
+
+  error = pthread_create( &self->thread, NULL, io_thread, self );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "enc28j60: error %d creating thread", error );
+    pthread_mutex_destroy( &self->mutex );
+    close( self->wake_pipe[0] );
+    close( self->wake_pipe[1] );
+    return;
+  }
+
+  self->thread_running = 1;
+}
+
+static void
+io_thread_stop( nic_enc28j60_t *self )
+{
+  if( !self->thread_running ) return;
+
+  self->stop_thread = 1;
+  io_thread_wake( self );
+  pthread_join( self->thread, NULL );
+  self->thread_running = 0;
+
+  pthread_mutex_destroy( &self->mutex );
+  close( self->wake_pipe[0] );
+  close( self->wake_pipe[1] );
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
 void
 nic_enc28j60_init( nic_enc28j60_t *self )
 {
   self->tap_fd = compat_get_tap( settings_current.speccyboot_tap );
+
+#ifdef HAVE_PTHREAD
+  if( self->tap_fd >= 0 ) io_thread_start( self );
+#endif
 }
 
 void
 nic_enc28j60_free( nic_enc28j60_t *self )
 {
+#ifdef HAVE_PTHREAD
+  io_thread_stop( self );
+#endif
+
   libspectrum_free( self );
 }
 
-/* Poll for received frames. */
+/* Copy the `n' byte frame in eth_rx_buf into the receive FIFO */
+static void
+receive_frame( nic_enc28j60_t *self, size_t n )
+{
+  libspectrum_word erxwrpt = GET_PTR_REG( self, ERXWRPT );
+  libspectrum_word erxst   = GET_PTR_REG( self, ERXST );
+  libspectrum_word erxnd   = GET_PTR_REG( self, ERXND );
+
+  /* Round total_length upwards to an even value */
+  libspectrum_word total_length = (ETH_STATUS_LENGTH + n + 1) & 0x1ffe;
+  libspectrum_word next_addr    = erxwrpt + total_length;
+
+  /* Sanity check */
+  if (erxwrpt > erxnd)
+    return;
+
+  if ( next_addr > erxnd ) {  /* FIFO wrap-around? */  
+    libspectrum_word first_part = (erxnd - erxwrpt) + 1;
+
+    next_addr = (next_addr - erxnd) + erxst;
+        
+    self->eth_rx_buf[ ETH_STATUS_NEXT_LO ] = LOBYTE( next_addr );
+    self->eth_rx_buf[ ETH_STATUS_NEXT_HI ] = HIBYTE( next_addr );
+    
+    memcpy( self->sram + erxwrpt, self->eth_rx_buf, first_part );
+    memcpy( self->sram + erxst, self->eth_rx_buf + first_part, total_length - first_part );
+  } else {         
+    self->eth_rx_buf[ ETH_STATUS_NEXT_LO ] = LOBYTE( next_addr );
+    self->eth_rx_buf[ ETH_STATUS_NEXT_HI ] = HIBYTE( next_addr );
+
+    memcpy( self->sram + erxwrpt, self->eth_rx_buf, total_length );
+  }
+
+  SET_PTR_REG( self, ERXWRPT, next_addr );
+
+  ++EPKTCNT(self);
+}
+
+/* Poll for received frames, taking everything that has arrived since the
+   last poll */
 void
 nic_enc28j60_poll( nic_enc28j60_t *self )
 {
   ssize_t n;
 
-  if ( (ECON1(self) & ECON1_RXEN)     /* Ethernet RX enabled? */
-       && self->tap_fd > 0
-       && (n = read( self->tap_fd,
-                     self->eth_rx_buf + ETH_STATUS_LENGTH,
-                     ETH_MAX )) > 0) {
-    libspectrum_word erxwrpt = GET_PTR_REG( self, ERXWRPT );
-    libspectrum_word erxst   = GET_PTR_REG( self, ERXST );
-    libspectrum_word erxnd   = GET_PTR_REG( self, ERXND );
-
-    /* Round total_length upwards to an even value */
-    libspectrum_word total_length = (ETH_STATUS_LENGTH + n + 1) & 0x1ffe;
-    libspectrum_word next_addr    = erxwrpt + total_length;
-
-    /* Sanity check */
-    if (erxwrpt > erxnd)
-      return;
-
-    if ( next_addr > erxnd ) {  /* FIFO wrap-around? */  
-      libspectrum_word first_part = (erxnd - erxwrpt) + 1;
-
-      next_addr = (next_addr - erxnd) + erxst;
-          
-      self->eth_rx_buf[ ETH_STATUS_NEXT_LO ] = LOBYTE( next_addr );
-      self->eth_rx_buf[ ETH_STATUS_NEXT_HI ] = HIBYTE( next_addr );
-      
-      memcpy( self->sram + erxwrpt, self->eth_rx_buf, first_part );
-      memcpy( self->sram + erxst, self->eth_rx_buf + first_part, total_length - first_part );
-    } else {         
-      self->eth_rx_buf[ ETH_STATUS_NEXT_LO ] = LOBYTE( next_addr );
-      self->eth_rx_buf[ ETH_STATUS_NEXT_HI ] = HIBYTE( next_addr );
-
-      memcpy( self->sram + erxwrpt, self->eth_rx_buf, total_length );
+  if( !( ECON1(self) & ECON1_RXEN ) ||    /* Ethernet RX enabled? */
+      self->tap_fd < 0 )
+    return;
+
+#ifdef HAVE_PTHREAD
+  if( self->thread_running ) {
+    frame_ring_t *ring = &self->rx;
+    size_t count, head, i;
+
+    pthread_mutex_lock( &self->mutex );
+    count = ring->count;
+    head = ring->head;
+    pthread_mutex_unlock( &self->mutex );
+
+    if( !count ) return;
+
+    for( i = 0; i < count; i++ ) {
+      n = ring->length[ head ];
+      memcpy( self->eth_rx_buf + ETH_STATUS_LENGTH, ring->data[ head ], n );
+      receive_frame( self, n );
+      head = ( head + 1 ) % FRAME_RING_SIZE;
     }
 
-    SET_PTR_REG( self, ERXWRPT, next_addr );
+    /* The thread stops reading when the ring is full, so always tell it
+       there's room again */
+    pthread_mutex_lock( &self->mutex );
+    ring->head = head;
+    ring->count -= count;
+    pthread_mutex_unlock( &self->mutex );
+    io_thread_wake( self );
 
-    ++EPKTCNT(self);
+    return;
   }
+#endif
+
+  while( ( n = read( self->tap_fd, self->eth_rx_buf + ETH_STATUS_LENGTH,
+                     ETH_MAX ) ) > 0 )
+    receive_frame( self, n );
 }
 
 /* Writing to some registers produces special side effects. */
@@ -210,8 +448,37 @@ perform_side_effects_for_write( nic_enc28j60_t *self )
 
     if ( frame_end > frame_start && self->tap_fd >= 0) {
       ssize_t length = (frame_end - frame_start) + 1;
-      if ( write( self->tap_fd, self->sram + frame_start, length ) != length )
-        self->tap_fd = -1; /* write failed: disable TAP */
+#ifdef HAVE_PTHREAD
+      if( self->thread_running ) {
+        frame_ring_t *ring = &self->tx;
+        size_t count, slot;
+
+        pthread_mutex_lock( &self->mutex );
+        count = ring->count;
+        slot = ( ring->head + count ) % FRAME_RING_SIZE;
+        pthread_mutex_unlock( &self->mutex );
+
+        /* If the device is this far behind, drop the frame */
+        if( count < FRAME_RING_SIZE && length <= ETH_MAX ) {
+          memcpy( ring->data[ slot ], self->sram + frame_start, length );
+          ring->length[ slot ] = length;
+
+          pthread_mutex_lock( &self->mutex );
+          ring->count++;
+          pthread_mutex_unlock( &self->mutex );
+          io_thread_wake( self );
+        }
+      } else
+#endif
+      {
+        ssize_t written = write( self->tap_fd, self->sram + frame_start,
+                                 length );
+
+        /* write failed: disable TAP, unless it was just busy */
+        if ( written != length &&
+             !( written < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) )
+          self->tap_fd = -1;
+      }
     }
 
     ECON1(self) &= ~ECON1_TXRTS;
@@ -26,12 +26,21 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <pthread.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#elif defined( HAVE_SYS_EVENT_H )
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
 #include "fuse.h"
+#include "thread_sched.h"
 #include "ui/ui.h"
 #include "w5100.h"
 #include "w5100_internals.h"
@@ -83,17 +92,277 @@ nic_w5100_reset( nic_w5100_t *self )
     nic_w5100_socket_reset( &self->socket[i] );
 }
 
+#if defined( W5100_USE_EPOLL ) || defined( W5100_USE_KQUEUE )
+
+/* The host sockets stay registered with the poller between waits and are
+   only touched again when what we're waiting for on them changes. They are
+   registered edge-triggered, so the socket code keeps reading or writing
+   until a host socket has nothing more for it */
+
+#ifdef W5100_USE_EPOLL
+
+/* Identifies the selfpipe in epoll events; sockets use their index */
+#define W5100_POLL_SELFPIPE 4
+
+static int
+w5100_poll_alloc( nic_w5100_t *self )
+{
+  struct epoll_event event;
+
+  self->poll_fd = epoll_create( 5 );
+  if( self->poll_fd == -1 ) return 1;
+
+  /* The selfpipe is level-triggered, as we discard only a byte at a time */
+  memset( &event, 0, sizeof(event) );
+  event.events = EPOLLIN;
+  event.data.u32 = W5100_POLL_SELFPIPE;
+
+  return epoll_ctl( self->poll_fd, EPOLL_CTL_ADD,
+                    compat_socket_selfpipe_get_read_fd( self->selfpipe ),
+                    &event );
+}
+
+/* Register fd for the socket with the given index, or change what it's
+   registered for. old_events is -1 if fd isn't registered yet */
+static int
+w5100_poll_register( nic_w5100_t *self, int which, compat_socket_t fd,
+                     int old_events, int events )
+{
+  struct epoll_event event;
+  int error;
+
+  memset( &event, 0, sizeof(event) );
+  event.events = EPOLLET;
+  if( events & W5100_SOCKET_EVENT_READ ) event.events |= EPOLLIN;
+  if( events & W5100_SOCKET_EVENT_WRITE ) event.events |= EPOLLOUT;
+  event.data.u32 = which;
+
+  error = epoll_ctl( self->poll_fd,
+                     old_events == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd,
+                     &event );
+
+  /* We lose track of a registration if changing it fails */
+  if( error && old_events == -1 && errno == EEXIST )
+    error = epoll_ctl( self->poll_fd, EPOLL_CTL_MOD, fd, &event );
+
+  return error;
+}
+
+/* Wait for something to happen, and mark which sockets it happened on */
+static int
+w5100_poll_wait( nic_w5100_t *self, int *ready )
+{
+  struct epoll_event events[5];
+  int active, i;
+
+  active = epoll_wait( self->poll_fd, events, 5, -1 );
+  if( active == -1 ) return -1;
+
+  for( i = 0; i < active; i++ ) {
+    int which = events[i].data.u32;
+
+    if( which == W5100_POLL_SELFPIPE ) {
+      nic_w5100_debug( "w5100: discarding selfpipe data\n" );
+      compat_socket_selfpipe_discard_data( self->selfpipe );
+      continue;
+    }
+
+    /* Errors and hangups are picked up by trying to read or write */
+    if( events[i].events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) )
+      ready[which] |= W5100_SOCKET_EVENT_READ;
+    if( events[i].events & ( EPOLLOUT | EPOLLERR ) )
+      ready[which] |= W5100_SOCKET_EVENT_WRITE;
+  }
+
+  return active;
+}
+
+#else                           /* #ifdef W5100_USE_EPOLL */
+
+static int
+w5100_poll_alloc( nic_w5100_t *self )
+{
+  struct kevent change;
+
+  self->poll_fd = kqueue();
+  if( self->poll_fd == -1 ) return 1;
+
+  EV_SET( &change, compat_socket_selfpipe_get_read_fd( self->selfpipe ),
+          EVFILT_READ, EV_ADD, 0, 0, 0 );
+
+  return kevent( self->poll_fd, &change, 1, NULL, 0, NULL );
+}
+
+static int
+w5100_poll_register( nic_w5100_t *self, int which, compat_socket_t fd,
+                     int old_events, int events )
+{
+  struct kevent changes[2];
+  int count = 0;
+
+  /* Closing a socket removes its filters, so a new one has none */
+  if( old_events == -1 ) old_events = 0;
+
+  if( ( old_events ^ events ) & W5100_SOCKET_EVENT_READ )
+    EV_SET( &changes[count++], fd, EVFILT_READ,
+            events & W5100_SOCKET_EVENT_READ ? EV_ADD | EV_CLEAR : EV_DELETE,
+            0, 0, 0 );
+
+  if( ( old_events ^ events ) & W5100_SOCKET_EVENT_WRITE )
+    EV_SET( &changes[count++], fd, EVFILT_WRITE,
+            events & W5100_SOCKET_EVENT_WRITE ? EV_ADD | EV_CLEAR : EV_DELETE,
+            0, 0, 0 );
+
+  if( !count ) return 0;
+
+  return kevent( self->poll_fd, changes, count, NULL, 0, NULL );
+}
+
+static int
+w5100_poll_wait( nic_w5100_t *self, int *ready )
+{
+  struct kevent events[9];
+  compat_socket_t selfpipe_socket =
+    compat_socket_selfpipe_get_read_fd( self->selfpipe );
+  int active, i, j;
+
+  active = kevent( self->poll_fd, NULL, 0, events, 9, NULL );
+  if( active == -1 ) return -1;
+
+  for( i = 0; i < active; i++ ) {
+    compat_socket_t fd = events[i].ident;
+
+    if( fd == selfpipe_socket ) {
+      nic_w5100_debug( "w5100: discarding selfpipe data\n" );
+      compat_socket_selfpipe_discard_data( self->selfpipe );
+      continue;
+    }
+
+    for( j = 0; j < 4; j++ ) {
+      if( self->registration[j].fd != fd ) continue;
+
+      ready[j] |= events[i].filter == EVFILT_WRITE ?
+        W5100_SOCKET_EVENT_WRITE : W5100_SOCKET_EVENT_READ;
+    }
+  }
+
+  return active;
+}
+
+#endif                          /* #ifdef W5100_USE_EPOLL */
+
+static void
+w5100_poll_free( nic_w5100_t *self )
+{
+  close( self->poll_fd );
+}
+
+/* Bring what the poller is waiting for on a socket into line with what the
+   socket currently wants */
+static void
+w5100_poll_update( nic_w5100_t *self, int which )
+{
+  nic_w5100_registration_t *registration = &self->registration[which];
+  compat_socket_t fd;
+  int generation, events, old_events;
+
+  events = nic_w5100_socket_prepare_io( &self->socket[which], &fd,
+                                        &generation );
+
+  /* Closing a host socket drops its registration along with it */
+  if( fd == compat_socket_invalid ) {
+    registration->fd = compat_socket_invalid;
+    return;
+  }
+
+  if( registration->fd == fd && registration->generation == generation ) {
+    if( registration->events == events ) return;
+    old_events = registration->events;
+  }
+  else {
+    old_events = -1;
+  }
+
+  if( w5100_poll_register( self, which, fd, old_events, events ) ) {
+    nic_w5100_debug( "w5100: error %d registering fd %d for socket %d: %s\n",
+                     errno, fd, which, strerror( errno ) );
+    registration->fd = compat_socket_invalid;
+    return;
+  }
+
+  nic_w5100_debug( "w5100: socket %d with fd %d now waiting for 0x%x\n",
+                   which, fd, events );
+
+  registration->fd = fd;
+  registration->generation = generation;
+  registration->events = events;
+}
+
+static void*
+w5100_io_thread( void *arg )
+{
+  nic_w5100_t *self = arg;
+  int i;
+
+  thread_sched_apply( THREAD_SCHED_IO );
+
+  for( i = 0; i < 4; i++ )
+    self->registration[i].fd = compat_socket_invalid;
+
+  while( !self->stop_io_thread ) {
+    int ready[4] = { 0, 0, 0, 0 };
+    int active;
+
+    for( i = 0; i < 4; i++ )
+      w5100_poll_update( self, i );
+
+    nic_w5100_debug( "w5100: io thread wait\n" );
+
+    active = w5100_poll_wait( self, ready );
+
+    nic_w5100_debug( "w5100: io thread wake; %d active\n", active );
+
+    if( active != -1 ) {
+      for( i = 0; i < 4; i++ )
+        if( ready[i] )
+          nic_w5100_socket_process_io( &self->socket[i], ready[i] );
+    }
+    else if( errno != EINTR ) {
+      nic_w5100_debug( "w5100: wait returned unexpected errno %d: %s\n",
+                       errno, strerror( errno ) );
+    }
+  }
+
+  return NULL;
+}
+
+#else         /* #if defined( W5100_USE_EPOLL ) || defined( W5100_USE_KQUEUE ) */
+
+static int
+w5100_poll_alloc( nic_w5100_t *self )
+{
+  return 0;
+}
+
+static void
+w5100_poll_free( nic_w5100_t *self )
+{
+}
+
 static void*
 w5100_io_thread( void *arg )
 {
   nic_w5100_t *self = arg;
   int i;
 
+  thread_sched_apply( THREAD_SCHED_IO );
+
   while( !self->stop_io_thread ) {
     fd_set readfds, writefds;
     int active;
     compat_socket_t selfpipe_socket =
       compat_socket_selfpipe_get_read_fd( self->selfpipe );
+    compat_socket_t fd[4];
     int max_fd = selfpipe_socket;
 
     FD_ZERO( &readfds );
@@ -101,9 +370,15 @@ w5100_io_thread( void *arg )
 
     FD_SET( selfpipe_socket, &readfds );
 
-    for( i = 0; i < 4; i++ )
-      nic_w5100_socket_add_to_sets( &self->socket[i], &readfds, &writefds,
-        &max_fd );
+    for( i = 0; i < 4; i++ ) {
+      int generation;
+      int events = nic_w5100_socket_prepare_io( &self->socket[i], &fd[i],
+                                                &generation );
+
+      if( events & W5100_SOCKET_EVENT_READ ) FD_SET( fd[i], &readfds );
+      if( events & W5100_SOCKET_EVENT_WRITE ) FD_SET( fd[i], &writefds );
+      if( events && fd[i] > max_fd ) max_fd = fd[i];
+    }
 
     /* Note that if a socket is closed between when we added it to the sets
        above and when we call select() below, it will cause the select to fail
@@ -123,8 +398,17 @@ w5100_io_thread( void *arg )
         compat_socket_selfpipe_discard_data( self->selfpipe );
       }
 
-      for( i = 0; i < 4; i++ )
-        nic_w5100_socket_process_io( &self->socket[i], readfds, writefds );
+      for( i = 0; i < 4; i++ ) {
+        int events = 0;
+
+        if( fd[i] == compat_socket_invalid ) continue;
+
+        if( FD_ISSET( fd[i], &readfds ) ) events |= W5100_SOCKET_EVENT_READ;
+        if( FD_ISSET( fd[i], &writefds ) ) events |= W5100_SOCKET_EVENT_WRITE;
+
+        if( events )
+          nic_w5100_socket_process_io( &self->socket[i], events );
+      }
     }
     else if( compat_socket_get_error() == compat_socket_EBADF ) {
       /* Do nothing - just loop again */
@@ -139,6 +423,8 @@ w5100_io_thread( void *arg )
   return NULL;
 }
 
+#endif        /* #if defined( W5100_USE_EPOLL ) || defined( W5100_USE_KQUEUE ) */
+
 nic_w5100_t*
 nic_w5100_alloc( void )
 {
@@ -152,6 +438,12 @@ nic_w5100_alloc( void )
 
   self->selfpipe = compat_socket_selfpipe_alloc();
 
+  if( w5100_poll_alloc( self ) ) {
+    ui_error( UI_ERROR_ERROR, "w5100: error %d setting up poller: %s", errno,
+              strerror( errno ) );
+    fuse_abort();
+  }
+
   for( i = 0; i < 4; i++ )
     nic_w5100_socket_init( &self->socket[i], i );
 
@@ -182,6 +474,7 @@ nic_w5100_free( nic_w5100_t *self )
     for( i = 0; i < 4; i++ )
       nic_w5100_socket_end( &self->socket[i] );
 
+    w5100_poll_free( self );
     compat_socket_selfpipe_free( self->selfpipe );
 
     compat_socket_networking_end();
@@ -33,6 +33,14 @@
 #include <sys/select.h>
 #endif
 
+/* Use the host's edge-triggered poller for the I/O thread where there is one,
+   otherwise select() */
+#if defined( HAVE_SYS_EPOLL_H )
+#define W5100_USE_EPOLL 1
+#elif defined( HAVE_SYS_EVENT_H )
+#define W5100_USE_KQUEUE 1
+#endif
+
 typedef enum w5100_socket_mode {
   W5100_SOCKET_MODE_CLOSED = 0x00,
   W5100_SOCKET_MODE_TCP,
@@ -83,6 +91,31 @@ enum w5100_socket_registers {
   W5100_SOCKET_RX_RD1,
 };
 
+/* The ring positions and IR are shared with the I/O thread without the
+   socket lock. Each position is only ever advanced by one side, so acquire
+   and release ordering makes sure the data is in the ring before the other
+   side sees the new position */
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ) )
+#define W5100_LOAD( x ) __atomic_load_n( &(x), __ATOMIC_ACQUIRE )
+#define W5100_STORE( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELEASE )
+#define W5100_SET_BITS( x, v ) \
+  __atomic_fetch_or( &(x), (v), __ATOMIC_ACQ_REL )
+#define W5100_CLEAR_BITS( x, v ) \
+  __atomic_fetch_and( &(x), ~(v), __ATOMIC_ACQ_REL )
+#else
+#define W5100_LOAD( x ) ( x )
+#define W5100_STORE( x, v ) ( (x) = (v) )
+#define W5100_SET_BITS( x, v ) ( (x) |= (v) )
+#define W5100_CLEAR_BITS( x, v ) ( (x) &= ~(v) )
+#endif
+
+/* Things the I/O thread can wait for on a socket */
+enum w5100_socket_events {
+  W5100_SOCKET_EVENT_READ = 1 << 0,
+  W5100_SOCKET_EVENT_WRITE = 1 << 1,
+};
+
 typedef struct nic_w5100_socket_t {
 
   int id; /* For debug use only */
@@ -101,13 +134,14 @@ typedef struct nic_w5100_socket_t {
   libspectrum_byte dip[4];  /* Destination IP address */
   libspectrum_byte dport[2];/* Destination port */
 
-  libspectrum_word tx_rr;   /* Transmit read pointer */
+  libspectrum_word tx_rr;   /* Transmit read pointer; I/O thread only */
   libspectrum_word tx_wr;   /* Transmit write pointer */
 
-  libspectrum_word rx_rsr;  /* Received size */
+  libspectrum_word rx_wr;   /* Received write pointer; I/O thread only */
   libspectrum_word rx_rd;   /* Received read pointer */
 
-  libspectrum_word old_rx_rd; /* Used in RECV command processing */
+  libspectrum_word old_rx_rd; /* Read pointer as of the last RECV command;
+                                 the received size is rx_wr - old_rx_rd */
 
   libspectrum_byte tx_buffer[0x800];  /* Transmit buffer */
   libspectrum_byte rx_buffer[0x800];  /* Received buffer */
@@ -115,16 +149,17 @@ typedef struct nic_w5100_socket_t {
   /* Host properties */
 
   compat_socket_t fd;       /* Socket file descriptor */
+  int fd_generation;        /* Bumped each time fd is given a new socket */
   int bind_count;           /* Number of writes to the Sn_PORTx registers we've received */
   int socket_bound;         /* True once we've bound the socket to a port */
   int write_pending;        /* True if we're waiting to write data on this socket */
 
-  int last_send;            /* The value of Sn_TX_WR when the SEND command was last sent */
+  libspectrum_word last_send; /* The value of Sn_TX_WR when the SEND command was last sent */
   int datagram_lengths[0x20]; /* The lengths of datagrams to be sent */
   int datagram_count;
 
   /* Flag used to indicate that a socket has been closed since we started
-     waiting for it in a select() call and therefore the socket should no
+     waiting for it in the I/O thread and therefore the socket should no
      longer be used */
   int ok_for_io;
 
@@ -132,6 +167,13 @@ typedef struct nic_w5100_socket_t {
 
 } nic_w5100_socket_t;
 
+/* What the I/O thread last registered with the poller for a socket */
+typedef struct nic_w5100_registration_t {
+  compat_socket_t fd;       /* Registered socket, or compat_socket_invalid */
+  int generation;           /* fd_generation of the socket when registered */
+  int events;               /* Events registered for */
+} nic_w5100_registration_t;
+
 struct nic_w5100_t {
   libspectrum_byte gw[4];   /* Gateway IP address */
   libspectrum_byte sub[4];  /* Our subnet mask */
@@ -143,6 +185,11 @@ struct nic_w5100_t {
   pthread_t thread;         /* Thread for doing I/O */
   sig_atomic_t stop_io_thread; /* Flag to stop I/O thread */
   compat_socket_selfpipe_t *selfpipe; /* Device for waking I/O thread */
+
+#if defined( W5100_USE_EPOLL ) || defined( W5100_USE_KQUEUE )
+  int poll_fd;              /* epoll or kqueue descriptor */
+  nic_w5100_registration_t registration[4];
+#endif
 };
 
 void nic_w5100_socket_init( nic_w5100_socket_t *socket, int which );
@@ -156,10 +203,9 @@ void nic_w5100_socket_write( nic_w5100_t *self, libspectrum_word reg, libspectru
 libspectrum_byte nic_w5100_socket_read_rx_buffer( nic_w5100_t *self, libspectrum_word reg );
 void nic_w5100_socket_write_tx_buffer( nic_w5100_t *self, libspectrum_word reg, libspectrum_byte b );
 
-void nic_w5100_socket_add_to_sets( nic_w5100_socket_t *socket, fd_set *readfds,
-  fd_set *writefds, int *max_fd );
-void nic_w5100_socket_process_io( nic_w5100_socket_t *socket, fd_set readfds,
-  fd_set writefds );
+int nic_w5100_socket_prepare_io( nic_w5100_socket_t *socket,
+  compat_socket_t *fd, int *generation );
+void nic_w5100_socket_process_io( nic_w5100_socket_t *socket, int events );
 
 /* Debug routines */
 
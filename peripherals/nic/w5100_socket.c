@@ -38,6 +38,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #include "fuse.h"
@@ -55,6 +56,14 @@ enum w5100_socket_command {
   W5100_SOCKET_COMMAND_RECV = 1 << 6,
 };
 
+/* Where we can, don't let reads and writes on the host sockets block, so the
+   I/O thread can carry on until a socket has nothing more for it */
+#ifdef MSG_DONTWAIT
+#define W5100_IO_FLAGS MSG_DONTWAIT
+#else
+#define W5100_IO_FLAGS 0
+#endif
+
 static void
 w5100_socket_init_common( nic_w5100_socket_t *socket )
 {
@@ -69,6 +78,7 @@ void
 nic_w5100_socket_init( nic_w5100_socket_t *socket, int which )
 {
   socket->id = which;
+  socket->fd_generation = 0;
   w5100_socket_init_common( socket );
   pthread_mutex_init( &socket->lock, NULL );
 }
@@ -110,7 +120,7 @@ w5100_socket_clean( nic_w5100_socket_t *socket )
   memset( socket->dip, 0, sizeof( socket->dip ) );
   memset( socket->dport, 0, sizeof( socket->dport ) );
   socket->tx_rr = socket->tx_wr = 0;
-  socket->rx_rsr = 0;
+  socket->rx_wr = 0;
   socket->old_rx_rd = socket->rx_rd = 0;
 
   socket->last_send = 0;
@@ -201,6 +211,8 @@ w5100_socket_open( nic_w5100_socket_t *socket_obj )
       return;
     }
 
+    socket_obj->fd_generation++;
+
 #ifndef WIN32
     /* Windows warning: this could forcibly bind sockets already in use */
     if( setsockopt( socket_obj->fd, SOL_SOCKET, SO_REUSEADDR, &one,
@@ -339,12 +351,15 @@ w5100_socket_send( nic_w5100_t *self, nic_w5100_socket_t *socket )
         return;
 
     socket->datagram_lengths[socket->datagram_count++] =
-      socket->tx_wr - socket->last_send;
+      (libspectrum_word)( socket->tx_wr - socket->last_send );
     socket->last_send = socket->tx_wr;
     socket->write_pending = 1;
     compat_socket_selfpipe_wake( self->selfpipe );
   }
   else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
+    /* Send only what's been written by now; Sn_TX_WR may be updated again
+       while the I/O thread is sending */
+    socket->last_send = socket->tx_wr;
     socket->write_pending = 1;
     compat_socket_selfpipe_wake( self->selfpipe );
   }
@@ -355,10 +370,9 @@ w5100_socket_recv( nic_w5100_t *self, nic_w5100_socket_t *socket )
 {
   if( socket->state == W5100_SOCKET_STATE_UDP ||
     socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
-    socket->rx_rsr -= socket->rx_rd - socket->old_rx_rd;
-    socket->old_rx_rd = socket->rx_rd;
-    if( socket->rx_rsr != 0 )
-      socket->ir |= 1 << 2;
+    W5100_STORE( socket->old_rx_rd, socket->rx_rd );
+    if( W5100_LOAD( socket->rx_wr ) != socket->rx_rd )
+      W5100_SET_BITS( socket->ir, 1 << 2 );
     compat_socket_selfpipe_wake( self->selfpipe );
   }
 }
@@ -419,10 +433,13 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
   nic_w5100_socket_t *socket = &self->socket[(reg >> 8) - 4];
   int socket_reg = reg & 0xff;
   int reg_offset;
-  libspectrum_word fsr;
+  libspectrum_word fsr, rsr;
   libspectrum_byte b;
 
-  w5100_socket_acquire_lock( socket );
+  /* Nothing here needs the socket lock: the ring positions the I/O thread
+     moves, IR and the state are read atomically and everything else is
+     only changed from this side. The Spectranet polls these registers
+     constantly, so this keeps it from waiting on the I/O thread */
 
   switch( socket_reg ) {
     case W5100_SOCKET_MR:
@@ -430,11 +447,11 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_MR\n", b, socket->id );
       break;
     case W5100_SOCKET_IR:
-      b = socket->ir;
+      b = W5100_LOAD( socket->ir );
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_IR\n", b, socket->id );
       break;
     case W5100_SOCKET_SR:
-      b = socket->state;
+      b = W5100_LOAD( socket->state );
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_SR\n", b, socket->id );
       break;
     case W5100_SOCKET_PORT0: case W5100_SOCKET_PORT1:
@@ -443,13 +460,13 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
     case W5100_SOCKET_TX_FSR0: case W5100_SOCKET_TX_FSR1:
       reg_offset = socket_reg - W5100_SOCKET_TX_FSR0;
-      fsr = 0x0800 - (socket->tx_wr - socket->tx_rr);
+      fsr = 0x0800 - (socket->tx_wr - W5100_LOAD( socket->tx_rr ));
       b = ( fsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_TX_FSR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_TX_RR0: case W5100_SOCKET_TX_RR1:
       reg_offset = socket_reg - W5100_SOCKET_TX_RR0;
-      b = ( socket->tx_rr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
+      b = ( W5100_LOAD( socket->tx_rr ) >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_TX_RR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_TX_WR0: case W5100_SOCKET_TX_WR1:
@@ -459,7 +476,8 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
     case W5100_SOCKET_RX_RSR0: case W5100_SOCKET_RX_RSR1:
       reg_offset = socket_reg - W5100_SOCKET_RX_RSR0;
-      b = ( socket->rx_rsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
+      rsr = W5100_LOAD( socket->rx_wr ) - socket->old_rx_rd;
+      b = ( rsr >> ( 8 * ( 1 - reg_offset ) ) ) & 0xff;
       nic_w5100_debug( "w5100: reading 0x%02x from S%d_RX_RSR%d\n", b, socket->id, reg_offset );
       break;
     case W5100_SOCKET_RX_RD0: case W5100_SOCKET_RX_RD1:
@@ -473,8 +491,6 @@ nic_w5100_socket_read( nic_w5100_t *self, libspectrum_word reg )
       break;
   }
 
-  w5100_socket_release_lock( socket );
-
   return b;
 }
 
@@ -483,8 +499,22 @@ nic_w5100_socket_write( nic_w5100_t *self, libspectrum_word reg, libspectrum_byt
 {
   nic_w5100_socket_t *socket = &self->socket[(reg >> 8) - 4];
   int socket_reg = reg & 0xff;
+  int locked;
 
-  w5100_socket_acquire_lock( socket );
+  /* IR and the pointers the I/O thread doesn't use can be written without
+     the socket lock */
+  switch( socket_reg ) {
+    case W5100_SOCKET_IR:
+    case W5100_SOCKET_TX_WR0: case W5100_SOCKET_TX_WR1:
+    case W5100_SOCKET_RX_RD0: case W5100_SOCKET_RX_RD1:
+      locked = 0;
+      break;
+    default:
+      locked = 1;
+      break;
+  }
+
+  if( locked ) w5100_socket_acquire_lock( socket );
 
   switch( socket_reg ) {
     case W5100_SOCKET_MR:
@@ -495,7 +525,7 @@ nic_w5100_socket_write( nic_w5100_t *self, libspectrum_word reg, libspectrum_byt
       break;
     case W5100_SOCKET_IR:
       nic_w5100_debug( "w5100: writing 0x%02x to S%d_IR\n", b, socket->id );
-      socket->ir &= ~b;
+      W5100_CLEAR_BITS( socket->ir, b );
       break;
     case W5100_SOCKET_PORT0: case W5100_SOCKET_PORT1:
       w5100_write_socket_port( self, socket, socket_reg - W5100_SOCKET_PORT0, b );
@@ -532,7 +562,7 @@ nic_w5100_socket_write( nic_w5100_t *self, libspectrum_word reg, libspectrum_byt
   if( socket_reg != W5100_SOCKET_PORT0 && socket_reg != W5100_SOCKET_PORT1 )
     socket->bind_count = 0;
 
-  w5100_socket_release_lock( socket );
+  if( locked ) w5100_socket_release_lock( socket );
 }
 
 libspectrum_byte
@@ -554,43 +584,73 @@ nic_w5100_socket_write_tx_buffer( nic_w5100_t *self, libspectrum_word reg, libsp
   socket->tx_buffer[offset] = b;
 }
 
-void
-nic_w5100_socket_add_to_sets( nic_w5100_socket_t *socket, fd_set *readfds,
-  fd_set *writefds, int *max_fd )
+/* Free space in the RX buffer; I/O thread only */
+static int
+w5100_socket_rx_free( nic_w5100_socket_t *socket )
+{
+  libspectrum_word rsr = socket->rx_wr - W5100_LOAD( socket->old_rx_rd );
+  return 0x800 - rsr;
+}
+
+/* Returns the W5100_SOCKET_EVENT_* the I/O thread should wait for on this
+   socket; must be called with the socket's lock held */
+static int
+w5100_socket_wanted_events( nic_w5100_socket_t *socket )
+{
+  /* We can process a UDP read if we're in a UDP state and there are at least
+     9 bytes free in our buffer (8 byte UDP header and 1 byte of actual
+     data). */
+  int udp_read = socket->state == W5100_SOCKET_STATE_UDP &&
+    w5100_socket_rx_free( socket ) >= 9;
+  /* We can process a TCP read if we're in the established state and have
+     any room in our buffer (no header necessary for TCP). */
+  int tcp_read = socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
+    w5100_socket_rx_free( socket ) >= 1;
+
+  int tcp_listen = socket->state == W5100_SOCKET_STATE_LISTEN;
+
+  int write = socket->write_pending &&
+    ( socket->state == W5100_SOCKET_STATE_UDP ||
+      socket->state == W5100_SOCKET_STATE_ESTABLISHED );
+
+  int events = 0;
+
+  if( socket->fd == compat_socket_invalid ) return 0;
+
+  if( udp_read || tcp_read || tcp_listen )
+    events |= W5100_SOCKET_EVENT_READ;
+
+  if( write )
+    events |= W5100_SOCKET_EVENT_WRITE;
+
+  return events;
+}
+
+int
+nic_w5100_socket_prepare_io( nic_w5100_socket_t *socket, compat_socket_t *fd,
+  int *generation )
 {
+  int events;
+
   w5100_socket_acquire_lock( socket );
 
-  if( socket->fd != compat_socket_invalid ) {
-    /* We can process a UDP read if we're in a UDP state and there are at least
-       9 bytes free in our buffer (8 byte UDP header and 1 byte of actual
-       data). */
-    int udp_read = socket->state == W5100_SOCKET_STATE_UDP &&
-      0x800 - socket->rx_rsr >= 9;
-    /* We can process a TCP read if we're in the established state and have
-       any room in our buffer (no header necessary for TCP). */
-    int tcp_read = socket->state == W5100_SOCKET_STATE_ESTABLISHED &&
-      0x800 - socket->rx_rsr >= 1;
-
-    int tcp_listen = socket->state == W5100_SOCKET_STATE_LISTEN;
+  *fd = socket->fd;
+  *generation = socket->fd_generation;
 
+  if( socket->fd != compat_socket_invalid )
     socket->ok_for_io = 1;
 
-    if( udp_read || tcp_read || tcp_listen ) {
-      FD_SET( socket->fd, readfds );
-      if( socket->fd > *max_fd )
-        *max_fd = socket->fd;
-      nic_w5100_debug( "w5100: checking for read on socket %d with fd %d; max fd %d\n", socket->id, socket->fd, *max_fd );
-    }
+  events = w5100_socket_wanted_events( socket );
 
-    if( socket->write_pending ) {
-      FD_SET( socket->fd, writefds );
-      if( socket->fd > *max_fd )
-        *max_fd = socket->fd;
-      nic_w5100_debug( "w5100: write pending on socket %d with fd %d; max fd %d\n", socket->id, socket->fd, *max_fd );
-    }
-  }
+  if( events & W5100_SOCKET_EVENT_READ )
+    nic_w5100_debug( "w5100: checking for read on socket %d with fd %d\n", socket->id, socket->fd );
+
+  if( events & W5100_SOCKET_EVENT_WRITE )
+    nic_w5100_debug( "w5100: write pending on socket %d with fd %d\n", socket->id, socket->fd );
 
   w5100_socket_release_lock( socket );
+
+  return events;
 }
 
 static void
@@ -616,14 +676,75 @@ w5100_socket_process_accept( nic_w5100_socket_t *socket )
     nic_w5100_debug( "w5100: error attempting to close fd %d for socket %d\n", socket->fd, socket->id );
 
   socket->fd = new_fd;
-  socket->state = W5100_SOCKET_STATE_ESTABLISHED;
+  socket->fd_generation++;
+  W5100_STORE( socket->state, W5100_SOCKET_STATE_ESTABLISHED );
 }
 
-static void
-w5100_socket_process_read( nic_w5100_socket_t *socket )
+/* Receive from the host socket straight into the RX buffer, starting at
+   offset and wrapping round its end if need be */
+static ssize_t
+w5100_socket_recv_ring( nic_w5100_socket_t *socket, int offset, int length,
+  struct sockaddr_in *sa )
 {
+  int first_chunk = 0x800 - offset;
+#ifndef WIN32
+  struct iovec iov[2];
+  struct msghdr msg;
+
+  memset( &msg, 0, sizeof(msg) );
+
+  iov[0].iov_base = &socket->rx_buffer[offset];
+  iov[0].iov_len = length < first_chunk ? length : first_chunk;
+  iov[1].iov_base = socket->rx_buffer;
+  iov[1].iov_len = length - iov[0].iov_len;
+
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+  if( sa ) {
+    msg.msg_name = sa;
+    msg.msg_namelen = sizeof(*sa);
+  }
+
+  return recvmsg( socket->fd, &msg, W5100_IO_FLAGS );
+#else                           /* #ifndef WIN32 */
+  socklen_t sa_length = sizeof(*sa);
   libspectrum_byte buffer[0x800];
-  int bytes_free = 0x800 - socket->rx_rsr;
+  ssize_t bytes_read;
+
+  if( length <= first_chunk )
+    return sa ?
+      recvfrom( socket->fd, (char*)&socket->rx_buffer[offset], length, 0,
+                (struct sockaddr*)sa, &sa_length ) :
+      recv( socket->fd, (char*)&socket->rx_buffer[offset], length, 0 );
+
+  /* TCP can pick up the rest on the next read... */
+  if( !sa )
+    return recv( socket->fd, (char*)&socket->rx_buffer[offset], first_chunk,
+                 0 );
+
+  /* ...but a datagram has to be received in one go */
+  bytes_read = recvfrom( socket->fd, (char*)buffer, length, 0,
+                         (struct sockaddr*)sa, &sa_length );
+  if( bytes_read > first_chunk ) {
+    memcpy( &socket->rx_buffer[offset], buffer, first_chunk );
+    memcpy( socket->rx_buffer, buffer + first_chunk, bytes_read - first_chunk );
+  }
+  else if( bytes_read > 0 ) {
+    memcpy( &socket->rx_buffer[offset], buffer, bytes_read );
+  }
+
+  return bytes_read;
+#endif                          /* #ifndef WIN32 */
+}
+
+/* Read once from the host socket into the RX buffer. Returns 1 if anything
+   was read, 0 at the end of a TCP stream or if there's nothing to read right
+   now, and -1 on error */
+static int
+w5100_socket_read_once( nic_w5100_socket_t *socket )
+{
+  int bytes_free = w5100_socket_rx_free( socket );
+  int offset = socket->rx_wr & 0x7ff;
   ssize_t bytes_read;
   struct sockaddr_in sa;
 
@@ -632,55 +753,76 @@ w5100_socket_process_read( nic_w5100_socket_t *socket )
 
   nic_w5100_debug( "w5100: reading from socket %d\n", socket->id );
 
-  if( udp ) {
-    socklen_t sa_length = sizeof(sa);
-    bytes_read = recvfrom( socket->fd, (char*)buffer + 8, bytes_free - 8, 0,
-      (struct sockaddr*)&sa, &sa_length );
-  }
+  /* UDP data goes after the W5100's 8 byte header, which is filled in once we
+     know where the datagram came from and how long it was */
+  if( udp )
+    bytes_read = w5100_socket_recv_ring( socket, (offset + 8) & 0x7ff,
+                                         bytes_free - 8, &sa );
   else
-    bytes_read = recv( socket->fd, (char*)buffer, bytes_free, 0 );
+    bytes_read = w5100_socket_recv_ring( socket, offset, bytes_free, NULL );
 
   nic_w5100_debug( "w5100: read 0x%03x bytes from %s socket %d\n", (int)bytes_read, description, socket->id );
 
   if( bytes_read > 0 || (udp && bytes_read == 0) ) {
-    int offset = (socket->old_rx_rd + socket->rx_rsr) & 0x7ff;
-    libspectrum_byte *dest = &socket->rx_buffer[offset];
 
     if( udp ) {
+      libspectrum_byte header[8];
+      int i;
+
       /* Add the W5100's UDP header */
-      memcpy( buffer, &sa.sin_addr.s_addr, 4 );
-      memcpy( buffer + 4, &sa.sin_port, 2 );
-      buffer[6] = (bytes_read >> 8) & 0xff;
-      buffer[7] = bytes_read & 0xff;
+      memcpy( header, &sa.sin_addr.s_addr, 4 );
+      memcpy( header + 4, &sa.sin_port, 2 );
+      header[6] = (bytes_read >> 8) & 0xff;
+      header[7] = bytes_read & 0xff;
+
+      for( i = 0; i < 8; i++ )
+        socket->rx_buffer[(offset + i) & 0x7ff] = header[i];
+
       bytes_read += 8;
     }
 
-    socket->rx_rsr += bytes_read;
-    socket->ir |= 1 << 2;
+    W5100_STORE( socket->rx_wr, socket->rx_wr + bytes_read );
+    W5100_SET_BITS( socket->ir, 1 << 2 );
 
-    if( offset + bytes_read <= 0x800 ) {
-      memcpy( dest, buffer, bytes_read );
-    }
-    else {
-      int first_chunk = 0x800 - offset;
-      memcpy( dest, buffer, first_chunk );
-      memcpy( socket->rx_buffer, buffer + first_chunk, bytes_read - first_chunk );
-    }
+    return 1;
   }
   else if( bytes_read == 0 ) {  /* TCP */
-    socket->state = W5100_SOCKET_STATE_CLOSE_WAIT;
+    W5100_STORE( socket->state, W5100_SOCKET_STATE_CLOSE_WAIT );
     nic_w5100_debug( "w5100: EOF on %s socket %d; errno %d: %s\n",
                      description, socket->id, compat_socket_get_error(),
                      compat_socket_get_strerror() );
+    return 0;
+  }
+  else if( compat_socket_get_error() == COMPAT_EWOULDBLOCK ) {
+    return 0;
   }
   else {
     nic_w5100_debug( "w5100: error %d reading from %s socket %d: %s\n",
                      compat_socket_get_error(), description, socket->id,
                      compat_socket_get_strerror() );
+    return -1;
   }
 }
 
 static void
+w5100_socket_process_read( nic_w5100_socket_t *socket )
+{
+  int result, previous = 0;
+
+  /* An edge-triggered poller tells us about new data only once, so keep
+     reading until the host socket runs dry or the RX buffer is full. Carry
+     on past a single error, as UDP sockets report ICMP errors ahead of any
+     datagrams still queued */
+  do {
+    result = w5100_socket_read_once( socket );
+    if( result == -1 && previous == -1 ) break;
+    previous = result;
+  } while( W5100_IO_FLAGS && result &&
+           ( w5100_socket_wanted_events( socket ) & W5100_SOCKET_EVENT_READ ) );
+}
+
+/* Returns non-zero if a datagram was sent */
+static int
 w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
 {
   ssize_t bytes_sent;
@@ -706,7 +848,7 @@ w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
   memcpy( &sa.sin_port, socket->dport, 2 );
   memcpy( &sa.sin_addr.s_addr, socket->dip, 4 );
 
-  bytes_sent = sendto( socket->fd, (const char*)data, length, 0, (struct sockaddr*)&sa, sizeof(sa) );
+  bytes_sent = sendto( socket->fd, (const char*)data, length, W5100_IO_FLAGS, (struct sockaddr*)&sa, sizeof(sa) );
   nic_w5100_debug( "w5100: sent 0x%03x bytes of 0x%03x to UDP socket %d\n",
                    (int)bytes_sent, length, socket->id );
 
@@ -715,26 +857,31 @@ w5100_socket_process_udp_write( nic_w5100_socket_t *socket )
       memmove( socket->datagram_lengths, &socket->datagram_lengths[1],
         0x1f * sizeof(int) );
 
-    socket->tx_rr += bytes_sent;
+    W5100_STORE( socket->tx_rr, socket->tx_rr + bytes_sent );
     if( socket->datagram_count == 0 ) {
       socket->write_pending = 0;
-      socket->ir |= 1 << 4;
+      W5100_SET_BITS( socket->ir, 1 << 4 );
     }
+
+    return 1;
   }
   else if( bytes_sent != -1 )
     nic_w5100_debug( "w5100: didn't manage to send full datagram to UDP socket %d?\n", socket->id );
-  else
+  else if( compat_socket_get_error() != COMPAT_EWOULDBLOCK )
     nic_w5100_debug( "w5100: error %d writing to UDP socket %d: %s\n",
                      compat_socket_get_error(), socket->id,
                      compat_socket_get_strerror() );
+
+  return 0;
 }
 
-static void
+/* Returns non-zero if any data was sent */
+static int
 w5100_socket_process_tcp_write( nic_w5100_socket_t *socket )
 {
   ssize_t bytes_sent;
   int offset = socket->tx_rr & 0x7ff;
-  libspectrum_word length = socket->tx_wr - socket->tx_rr;
+  libspectrum_word length = socket->last_send - socket->tx_rr;
   libspectrum_byte *data = &socket->tx_buffer[ offset ];
 
   nic_w5100_debug( "w5100: writing to TCP socket %d\n", socket->id );
@@ -743,47 +890,63 @@ w5100_socket_process_tcp_write( nic_w5100_socket_t *socket )
   if( offset + length > 0x800 )
     length = 0x800 - offset;
 
-  bytes_sent = send( socket->fd, (const char*)data, length, 0 );
+  bytes_sent = send( socket->fd, (const char*)data, length, W5100_IO_FLAGS );
   nic_w5100_debug( "w5100: sent 0x%03x bytes of 0x%03x to TCP socket %d\n",
                    (int)bytes_sent, length, socket->id );
 
   if( bytes_sent != -1 ) {
-    socket->tx_rr += bytes_sent;
-    if( socket->tx_rr == socket->tx_wr ) {
+    W5100_STORE( socket->tx_rr, socket->tx_rr + bytes_sent );
+    if( socket->tx_rr == socket->last_send ) {
       socket->write_pending = 0;
-      socket->ir |= 1 << 4;
+      W5100_SET_BITS( socket->ir, 1 << 4 );
     }
+
+    return bytes_sent > 0;
   }
-  else
+  else if( compat_socket_get_error() != COMPAT_EWOULDBLOCK )
     nic_w5100_debug( "w5100: error %d writing to TCP socket %d: %s\n",
                      compat_socket_get_error(), socket->id,
                      compat_socket_get_strerror() );
+
+  return 0;
+}
+
+static void
+w5100_socket_process_write( nic_w5100_socket_t *socket )
+{
+  int udp = socket->state == W5100_SOCKET_STATE_UDP;
+  int sent;
+
+  /* As with reads, keep going until everything has been sent or the host
+     socket won't take any more */
+  do {
+    sent = udp ? w5100_socket_process_udp_write( socket ) :
+                 w5100_socket_process_tcp_write( socket );
+  } while( W5100_IO_FLAGS && sent && socket->write_pending );
 }
 
 void
-nic_w5100_socket_process_io( nic_w5100_socket_t *socket, fd_set readfds,
-  fd_set writefds )
+nic_w5100_socket_process_io( nic_w5100_socket_t *socket, int events )
 {
   w5100_socket_acquire_lock( socket );
 
   /* Process only if we're an open socket, and we haven't been closed and
-     re-opened since the select() started */
+     re-opened since the I/O thread started waiting */
   if( socket->fd != compat_socket_invalid && socket->ok_for_io ) {
-    if( FD_ISSET( socket->fd, &readfds ) ) {
+    /* The poller may report events we've since stopped waiting for */
+    events &= w5100_socket_wanted_events( socket );
+
+    if( events & W5100_SOCKET_EVENT_READ ) {
       if( socket->state == W5100_SOCKET_STATE_LISTEN )
         w5100_socket_process_accept( socket );
       else
         w5100_socket_process_read( socket );
     }
 
-    if( FD_ISSET( socket->fd, &writefds ) ) {
-      if( socket->state == W5100_SOCKET_STATE_UDP ) {
-        w5100_socket_process_udp_write( socket );
-      }
-      else if( socket->state == W5100_SOCKET_STATE_ESTABLISHED ) {
-        w5100_socket_process_tcp_write( socket );
-      }
-    }
+    /* Reading may have found the connection closed */
+    if( events & W5100_SOCKET_EVENT_WRITE &&
+        w5100_socket_wanted_events( socket ) & W5100_SOCKET_EVENT_WRITE )
+      w5100_socket_process_write( socket );
   }
 
   w5100_socket_release_lock( socket );
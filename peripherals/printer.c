@@ -48,6 +48,17 @@ static int printer_text_enabled=0;
 static FILE *printer_graphics_file=NULL;
 static FILE *printer_text_file=NULL;
 
+/* output goes through large stdio buffers, which are flushed once
+ * nothing more has been printed for a second or so. That way a long
+ * printout is written in big chunks, but what's been printed still
+ * turns up in the files shortly after the printer stops.
+ */
+#define PRINTER_BUFFER_SIZE	65536
+#define PRINTER_FLUSH_FRAMES	50
+
+static int printer_output_pending=0;
+static unsigned int printer_last_output_frame=0;
+
 /* for the ZX Printer */
 static int zxpframes,zxpspeed,zxpnewspeed;
 static libspectrum_dword zxpcycles;
@@ -202,6 +213,8 @@ if((printer_graphics_file=fopen(settings_current.printer_graphics_filename,
   return(0);
   }
 
+setvbuf(printer_graphics_file,NULL,_IOFBF,PRINTER_BUFFER_SIZE);
+
 if(overwrite)
   {
   /* we reserve 10 chars for height */
@@ -241,8 +254,7 @@ if((printer_text_file=fopen(settings_current.printer_text_filename,"a"))==NULL)
   return(0);
   }
 
-/* ensure users have immediate access to text file contents */
-setbuf( printer_text_file, NULL );
+setvbuf(printer_text_file,NULL,_IOFBF,PRINTER_BUFFER_SIZE);
 
 return(1);
 }
@@ -261,6 +273,9 @@ if(!printer_text_file && !printer_text_open_file())
   return;
 
 fputc(c,printer_text_file);
+
+printer_output_pending=1;
+printer_last_output_frame=frames;
 }
 
 
@@ -412,6 +427,9 @@ for(i=0;i<32;i++)
   fputc(d,printer_graphics_file);
   }
 
+printer_output_pending=1;
+printer_last_output_frame=frames;
+
 if(zxplineofchar>=8)
   {
   printer_zxp_output_as_text();
@@ -420,12 +438,36 @@ if(zxplineofchar>=8)
 }
 
 
-/* currently just incrs a frame counter we need for ZX Printer.
+/* write out everything printed so far, with the graphics file's
+ * header updated so it's a complete image as it stands.
+ */
+static void printer_flush(void)
+{
+printer_output_pending=0;
+
+if(printer_text_file)
+  fflush(printer_text_file);
+
+if(printer_graphics_file)
+  {
+  printer_zxp_update_header();
+  if(printer_graphics_file)
+    fflush(printer_graphics_file);
+  }
+}
+
+
+/* incrs a frame counter we need for ZX Printer, and flushes
+ * the output files once the printer has gone quiet.
  * can't fail, hence no return value.
  */
 void printer_frame(void)
 {
 frames++;
+
+if(printer_output_pending &&
+   frames-printer_last_output_frame>=PRINTER_FLUSH_FRAMES)
+  printer_flush();
 }
 
 
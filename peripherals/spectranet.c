@@ -69,6 +69,7 @@ int spectranet_available = 0;
 int spectranet_paged;
 int spectranet_paged_via_io;
 int spectranet_w5100_paged_a = 0, spectranet_w5100_paged_b = 0;
+int spectranet_flash_paged_a = 0, spectranet_flash_paged_b = 0;
 
 /* Whether the programmable trap is active */
 int spectranet_programmable_trap_active;
@@ -98,6 +99,7 @@ spectranet_page( int via_io )
 
   spectranet_paged = 1;
   spectranet_paged_via_io = via_io;
+  memory_overlay_update();
   machine_current->ram.romcs = 1;
   machine_current->memory_map();
   debugger_event( page_event );
@@ -118,6 +120,7 @@ spectranet_unpage( void )
 
   spectranet_paged = 0;
   spectranet_paged_via_io = 0;
+  memory_overlay_update();
   machine_current->ram.romcs = 0;
   machine_current->memory_map();
   debugger_event( unpage_event );
@@ -140,6 +143,7 @@ spectranet_map_page( int dest, int source )
 {
   int i;
   int w5100_page = source >= 0x40 && source < 0x48;
+  int flash_page = source < SPECTRANET_ROM_LENGTH / SPECTRANET_PAGE_LENGTH;
 
   for( i = 0; i < MEMORY_PAGES_IN_4K; i++ )
     spectranet_current_map[dest * MEMORY_PAGES_IN_4K + i] =
@@ -147,9 +151,17 @@ spectranet_map_page( int dest, int source )
 
   switch( dest )
   {
-    case 1: spectranet_w5100_paged_a = w5100_page; break;
-    case 2: spectranet_w5100_paged_b = w5100_page; break;
+    case 1:
+      spectranet_w5100_paged_a = w5100_page;
+      spectranet_flash_paged_a = flash_page;
+      break;
+    case 2:
+      spectranet_w5100_paged_b = w5100_page;
+      spectranet_flash_paged_b = flash_page;
+      break;
   }
+
+  memory_overlay_update();
 }
 
 static void
@@ -171,11 +183,13 @@ spectranet_reset( int hard_reset )
   if( !periph_is_active( PERIPH_TYPE_SPECTRANET ) ) {
     spectranet_available = 0;
     spectranet_paged = 0;
+    memory_overlay_update();
     return;
   }
 
   spectranet_available = 1;
   spectranet_paged = !settings_current.spectranet_disable;
+  memory_overlay_update();
 
   if( hard_reset )
     spectranet_hard_reset();
@@ -29,12 +29,20 @@
 #include "module.h"
 #include "periph.h"
 #include "settings.h"
+#include "thread_sched.h"
 #include "unittests/unittests.h"
 #include "ttx2000s.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#ifndef WIN32
+#include <sys/select.h>
+#endif
+#endif
+
 int ttx2000s_paged = 0;
 
 #ifdef BUILD_TTX2000S
@@ -57,7 +65,45 @@ int ttx2000s_line_counter = 0;
 
 int ttx2000s_channel;
 
+/* The packet server sends a field as 16 lines of 42 bytes */
+#define TTX2000S_FIELD_LENGTH ( 16 * 42 )
+
+#ifdef HAVE_PTHREAD
+
+/* With threads, the socket belongs to a receiver thread which puts whole
+   fields into this ring; the field event takes one out each field, so the
+   emulation never waits on the network. The thread only moves ring_write
+   and the emulation only moves ring_read, so no lock is needed */
+#define TTX2000S_RING_FIELDS 8
+
+static libspectrum_byte
+  ttx2000s_ring[ TTX2000S_RING_FIELDS ][ TTX2000S_FIELD_LENGTH ];
+static int ring_read, ring_write;
+
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ) )
+#define RING_LOAD( x ) __atomic_load_n( &(x), __ATOMIC_ACQUIRE )
+#define RING_STORE( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELEASE )
+#else
+#define RING_LOAD( x ) ( *(volatile int *)&(x) )
+#define RING_STORE( x, v ) ( *(volatile int *)&(x) = (v) )
+#endif
+
+static pthread_t receiver_thread;
+static int receiver_running = 0;
+static int receiver_quit;
+static compat_socket_selfpipe_t *receiver_selfpipe;
+
+/* The channel preset the emulation has asked for */
+static int receiver_channel;
+
+static void ttx2000s_receiver_start( int channel );
+static void ttx2000s_receiver_stop( void );
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
 static void ttx2000s_write( libspectrum_word port, libspectrum_byte val );
+static void ttx2000s_select_channel( int channel );
 static void ttx2000s_change_channel( int channel );
 static void ttx2000s_reset( int hard_reset );
 static void ttx2000s_memory_map( void );
@@ -81,6 +127,7 @@ ttx2000s_page( void )
     return;
 
   ttx2000s_paged = 1;
+  memory_overlay_update();
   machine_current->ram.romcs = 1;
   machine_current->memory_map();
   debugger_event( page_event );
@@ -93,6 +140,7 @@ ttx2000s_unpage( void )
     return;
 
   ttx2000s_paged = 0;
+  memory_overlay_update();
   machine_current->ram.romcs = 0;
   machine_current->memory_map();
   debugger_event( unpage_event );
@@ -148,6 +196,10 @@ ttx2000s_init( void *context )
 static void
 ttx2000s_end( void )
 {
+#ifdef HAVE_PTHREAD
+  ttx2000s_receiver_stop();
+#endif
+
   compat_socket_networking_end();
 }
 
@@ -170,8 +222,15 @@ ttx2000s_reset( int hard_reset GCC_UNUSED )
   int i;
 
   ttx2000s_paged = 0;
+  memory_overlay_update();
 
   event_remove_type( field_event );
+
+#ifdef HAVE_PTHREAD
+  /* Take the socket back from the receiver thread */
+  ttx2000s_receiver_stop();
+#endif
+
   if( !periph_is_active( PERIPH_TYPE_TTX2000S ) ) {
     if( teletext_socket != compat_socket_invalid ) {  /* close the socket */
       if( compat_socket_close( teletext_socket ) ) {
@@ -192,7 +251,11 @@ ttx2000s_reset( int hard_reset GCC_UNUSED )
                        field_event, 0 );
 
   ttx2000s_channel = -1; /* force the connection to be reset */
-  ttx2000s_change_channel( 0 );
+#ifdef HAVE_PTHREAD
+  ttx2000s_receiver_start( 0 );
+  if( !receiver_running )
+#endif
+    ttx2000s_change_channel( 0 );
 
   if( machine_load_rom_bank( ttx2000s_memory_map_romcs_rom, 0,
                              settings_current.rom_ttx2000s,
@@ -212,6 +275,7 @@ ttx2000s_reset( int hard_reset GCC_UNUSED )
   }
 
   ttx2000s_paged = 1;
+  memory_overlay_update();
   machine_current->memory_map();
   machine_current->ram.romcs = 1;
 }
@@ -232,7 +296,7 @@ static void
 ttx2000s_write( libspectrum_word port GCC_UNUSED, libspectrum_byte val )
 {
   /* bits 0 and 1 select channel preset */
-  ttx2000s_change_channel( val & 0x03 );
+  ttx2000s_select_channel( val & 0x03 );
   /* bit 2 enables automatic frequency control */
   if( val & 0x08 ) /* bit 3 pages out */
     ttx2000s_unpage();
@@ -342,51 +406,197 @@ ttx2000s_change_channel( int channel )
   }
 }
 
+/* Copy a field into the adapter's RAM, and tell the Z80 about it */
+static void
+ttx2000s_receive_field( const libspectrum_byte *field )
+{
+  int i;
+
+  /* 11 line syncs occur before the first teletext line */
+  ttx2000s_line_counter = ( ttx2000s_line_counter + 11 ) & 0xF;
+  i = 0;
+  while( 1 )
+  {
+    if( field[i * 42] != 0 ) /* packet isn't blank */
+      ttx2000s_ram[ ttx2000s_line_counter << 6 ] = 0x27; /* framing code */
+    memcpy( ttx2000s_ram + (ttx2000s_line_counter << 6) + 1,
+              field + (i * 42), 42 );
+    i++;
+    if( ++ttx2000s_line_counter > 15 )
+      break; /* ignore packets once line counter overflows */
+  }
+
+  /* only generate NMI when ROM is paged in and there is signal */
+  if( ttx2000s_paged )
+    event_add( 0, z80_nmi_event );    /* pull /NMI */
+}
+
+/* Deal with recv() failing on the teletext socket */
+static void
+ttx2000s_recv_error( void )
+{
+  errno = compat_socket_get_error();
+  if( errno == COMPAT_ECONNREFUSED ) {
+    /* the connection was refused */
+    ttx2000s_connected = 0;
+  } else if( errno == COMPAT_ENOTCONN || errno == COMPAT_EWOULDBLOCK ) {
+    /* just ignore if the socket is not connected or recv would block */
+  } else {
+    /* TODO: what should we do when there's an unexpected error */
+    ui_error( UI_ERROR_ERROR,
+              "ttx2000s: recv returned unexpected errno %d: %s\n", errno,
+              compat_socket_get_strerror() );
+    ttx2000s_connected = 0; /* the connection has failed */
+  }
+}
+
+static void
+ttx2000s_select_channel( int channel )
+{
+#ifdef HAVE_PTHREAD
+  if( receiver_running ) {
+    if( channel != receiver_channel ) {
+      RING_STORE( receiver_channel, channel );
+      /* Don't show what's left from the old channel */
+      RING_STORE( ring_read, RING_LOAD( ring_write ) );
+      compat_socket_selfpipe_wake( receiver_selfpipe );
+    }
+    return;
+  }
+#endif
+
+  ttx2000s_change_channel( channel );
+}
+
+#ifdef HAVE_PTHREAD
+
+static void*
+ttx2000s_receiver_thread( void *arg GCC_UNUSED )
+{
+  libspectrum_byte field[ TTX2000S_FIELD_LENGTH ];
+  int field_fill = 0;
+  int bytes_read, channel, next;
+
+  thread_sched_apply( THREAD_SCHED_IO );
+
+  while( !RING_LOAD( receiver_quit ) ) {
+    fd_set readfds;
+    compat_socket_t selfpipe_socket =
+      compat_socket_selfpipe_get_read_fd( receiver_selfpipe );
+    int max_fd = selfpipe_socket;
+    int listening;
+
+    channel = RING_LOAD( receiver_channel );
+    if( channel != ttx2000s_channel ) {
+      ttx2000s_change_channel( channel );
+      field_fill = 0;
+    }
+
+    FD_ZERO( &readfds );
+    FD_SET( selfpipe_socket, &readfds );
+
+    listening = teletext_socket != compat_socket_invalid && ttx2000s_connected;
+    if( listening ) {
+      FD_SET( teletext_socket, &readfds );
+      if( teletext_socket > max_fd ) max_fd = teletext_socket;
+    }
+
+    if( select( max_fd + 1, &readfds, NULL, NULL, NULL ) == -1 ) continue;
+
+    if( FD_ISSET( selfpipe_socket, &readfds ) )
+      compat_socket_selfpipe_discard_data( receiver_selfpipe );
+
+    if( !listening || !FD_ISSET( teletext_socket, &readfds ) ) continue;
+
+    /* Fields can arrive split over several reads */
+    bytes_read = recv( teletext_socket, (char *)field + field_fill,
+                       TTX2000S_FIELD_LENGTH - field_fill, 0 );
+
+    if( bytes_read > 0 ) {
+      field_fill += bytes_read;
+      if( field_fill < TTX2000S_FIELD_LENGTH ) continue;
+      field_fill = 0;
+
+      /* If the emulation has fallen behind, the newest field is lost */
+      next = ( ring_write + 1 ) % TTX2000S_RING_FIELDS;
+      if( next == RING_LOAD( ring_read ) ) continue;
+
+      memcpy( ttx2000s_ring[ ring_write ], field, TTX2000S_FIELD_LENGTH );
+      RING_STORE( ring_write, next );
+    } else if( bytes_read == 0 ) {
+      /* the server has closed the connection */
+      ttx2000s_connected = 0;
+    } else {
+      ttx2000s_recv_error();
+    }
+  }
+
+  return NULL;
+}
+
+static void
+ttx2000s_receiver_start( int channel )
+{
+  int error;
+
+  if( receiver_running ) return;
+
+  receiver_selfpipe = compat_socket_selfpipe_alloc();
+  receiver_quit = 0;
+  receiver_channel = channel;
+  ring_read = ring_write = 0;
+
+  error = pthread_create( &receiver_thread, NULL, ttx2000s_receiver_thread,
+                          NULL );
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "ttx2000s: error %d creating thread", error );
+    compat_socket_selfpipe_free( receiver_selfpipe );
+    return;
+  }
+
+  receiver_running = 1;
+}
+
+static void
+ttx2000s_receiver_stop( void )
+{
+  if( !receiver_running ) return;
+
+  RING_STORE( receiver_quit, 1 );
+  compat_socket_selfpipe_wake( receiver_selfpipe );
+
+  pthread_join( receiver_thread, NULL );
+  receiver_running = 0;
+
+  compat_socket_selfpipe_free( receiver_selfpipe );
+}
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
 static void
 ttx2000s_field_event( libspectrum_dword last_tstates GCC_UNUSED, int event,
                       void *user_data )
 {
   int bytes_read;
-  int i;
-  libspectrum_byte ttx2000s_socket_buffer[672];
-
-  /* do stuff */
+  libspectrum_byte ttx2000s_socket_buffer[ TTX2000S_FIELD_LENGTH ];
+
+#ifdef HAVE_PTHREAD
+  if( receiver_running ) {
+    /* take the next field from the receiver thread, if there is one */
+    if( ring_read != RING_LOAD( ring_write ) ) {
+      ttx2000s_receive_field( ttx2000s_ring[ ring_read ] );
+      RING_STORE( ring_read, ( ring_read + 1 ) % TTX2000S_RING_FIELDS );
+    }
+  } else
+#endif
   if( teletext_socket != compat_socket_invalid && ttx2000s_connected ) {
-    bytes_read =
-      recv( teletext_socket, (char *)ttx2000s_socket_buffer, 672, 0 );
-    /* packet server sends 16 lines of 42 bytes, unused lines are padded with 0x00 */
-    if( bytes_read == 672 ) {
-      /* 11 line syncs occur before the first teletext line */
-      ttx2000s_line_counter = ( ttx2000s_line_counter + 11 ) & 0xF;
-      i = 0;
-      while( 1 )
-      {
-        if( ttx2000s_socket_buffer[i * 42] != 0 ) /* packet isn't blank */
-          ttx2000s_ram[ ttx2000s_line_counter << 6 ] = 0x27; /* framing code */
-        memcpy( ttx2000s_ram + (ttx2000s_line_counter << 6) + 1,
-                  ttx2000s_socket_buffer + (i * 42), 42 );
-        i++;
-        if( ++ttx2000s_line_counter > 15 )
-          break; /* ignore packets once line counter overflows */
-      }
-      
-      /* only generate NMI when ROM is paged in and there is signal */
-      if( ttx2000s_paged )
-        event_add( 0, z80_nmi_event );    /* pull /NMI */
+    bytes_read = recv( teletext_socket, (char *)ttx2000s_socket_buffer,
+                       TTX2000S_FIELD_LENGTH, 0 );
+    /* unused lines are padded with 0x00 */
+    if( bytes_read == TTX2000S_FIELD_LENGTH ) {
+      ttx2000s_receive_field( ttx2000s_socket_buffer );
     } else if( bytes_read == -1 ) {
-      errno = compat_socket_get_error();
-      if( errno == COMPAT_ECONNREFUSED ) {
-        /* the connection was refused */
-        ttx2000s_connected = 0;
-      } else if( errno == COMPAT_ENOTCONN || errno == COMPAT_EWOULDBLOCK ) {
-        /* just ignore if the socket is not connected or recv would block */
-      } else {
-        /* TODO: what should we do when there's an unexpected error */
-        ui_error( UI_ERROR_ERROR,
-                  "ttx2000s: recv returned unexpected errno %d: %s\n", errno,
-                  compat_socket_get_strerror() );
-        ttx2000s_connected = 0; /* the connection has failed */
-      }
+      ttx2000s_recv_error();
     }
   }
 
@@ -447,6 +657,7 @@ ttx2000s_unittest( void )
 
   #ifdef BUILD_TTX2000S
   ttx2000s_paged = 1;
+  memory_overlay_update();
   ttx2000s_memory_map();
   machine_current->ram.romcs = 1;
 
@@ -460,6 +671,7 @@ ttx2000s_unittest( void )
   r += unittests_assert_16k_ram_page( 0xc000, 0 );
 
   ttx2000s_paged = 0;
+  memory_overlay_update();
   machine_current->memory_map();
   machine_current->ram.romcs = 0;
 
@@ -25,10 +25,13 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "compat.h"
 #include "debugger/debugger.h"
+#include "input.h"
 #include "keyboard.h"
 #include "infrastructure/startup_manager.h"
 #include "loader.h"
@@ -46,8 +49,10 @@
 
 static libspectrum_byte last_byte;
 
-libspectrum_byte ula_contention[ ULA_CONTENTION_SIZE ];
-libspectrum_byte ula_contention_no_mreq[ ULA_CONTENTION_SIZE ];
+ula_timing_t ula_timing[ ULA_CONTENTION_SIZE ];
+
+ula_contention_model_t ula_contention_model = ULA_CONTENTION_MODEL_FULL;
+libspectrum_dword ula_contention_end = ULA_CONTENTION_SIZE;
 
 /* What to return if no other input pressed; depends on the last byte
    output to the ULA; see CSS FAQ | Technical Information | Port #FE
@@ -56,6 +61,8 @@ libspectrum_byte ula_default_value;
 
 static void ula_from_snapshot( libspectrum_snap *snap );
 static void ula_to_snapshot( libspectrum_snap *snap );
+static void ula_state_to( module_state_t *state );
+static void ula_state_from( module_state_t *state );
 static libspectrum_byte ula_read( libspectrum_word port, libspectrum_byte *attached );
 static void ula_write( libspectrum_word port, libspectrum_byte b );
 
@@ -66,6 +73,8 @@ static module_info_t ula_module_info = {
   /* .snapshot_enabled = */ NULL,
   /* .snapshot_from = */ ula_from_snapshot,
   /* .snapshot_to = */ ula_to_snapshot,
+  /* .state_to = */ ula_state_to,
+  /* .state_from = */ ula_state_from,
 
 };
 
@@ -188,22 +197,18 @@ ula_read( libspectrum_word port, libspectrum_byte *attached )
 
   r &= phantom_typist_ula_read( port );
 
+  input_poll_late();
   r &= keyboard_read( port >> 8 );
   if( tape_microphone ) r ^= 0x40;
 
   return r;
 }
 
-/* What happens when we write to the ULA? */
+/* Work out what port 0xfe returns with nothing pressed after `b' was
+   written to it */
 static void
-ula_write( libspectrum_word port GCC_UNUSED, libspectrum_byte b )
+update_default_value( libspectrum_byte b )
 {
-  last_byte = b;
-
-  display_set_lores_border( b & 0x07 );
-  sound_beeper( tstates,
-                (!!(b & 0x10) << 1) + ( (!(b & 0x8)) | tape_microphone ) );
-
   /* FIXME: shouldn't really be using the memory capabilities here */
 
   if( machine_current->timex ) {
@@ -225,7 +230,21 @@ ula_write( libspectrum_word port GCC_UNUSED, libspectrum_byte b )
     ula_default_value = b & 0x18 ? 0xff : 0xbf;
 
   }
+}
 
+/* What happens when we write to the ULA? */
+static void
+ula_write( libspectrum_word port GCC_UNUSED, libspectrum_byte b )
+{
+  if( tape_recording ) tape_record_level( tstates, b & 0x8 );
+
+  last_byte = b;
+
+  display_set_lores_border( b & 0x07 );
+  sound_beeper( tstates,
+                (!!(b & 0x10) << 1) + ( (!(b & 0x8)) | tape_microphone ) );
+
+  update_default_value( b );
 }
 
 libspectrum_byte
@@ -256,11 +275,72 @@ ula_to_snapshot( libspectrum_snap *snap )
   libspectrum_snap_set_issue2( snap, settings_current.issue2 );
 }  
 
+/* Restoring a state puts back the last byte written without writing it
+   again, so the border, beeper and tape are left alone */
+static void
+ula_state_to( module_state_t *state )
+{
+  module_state_write( state, &last_byte, sizeof( last_byte ) );
+}
+
+static void
+ula_state_from( module_state_t *state )
+{
+  module_state_read( state, &last_byte, sizeof( last_byte ) );
+  update_default_value( last_byte );
+}
+
+/* Pick the contention model for the current machine and fill in the
+   timing table for it; called whenever the machine's timings are set */
+void
+ula_timing_setup( void )
+{
+  spectrum_raminfo *ram = &machine_current->ram;
+  libspectrum_dword i, frame = machine_current->timings.tstates_per_frame;
+
+  if( frame > ULA_CONTENTION_SIZE ) frame = ULA_CONTENTION_SIZE;
+
+  if( ram->contend_delay == spectrum_contend_delay_none &&
+      ram->contend_delay_no_mreq == spectrum_contend_delay_none ) {
+    ula_contention_model = ULA_CONTENTION_MODEL_NONE;
+  } else if( ram->contend_delay_no_mreq == spectrum_contend_delay_none ) {
+    ula_contention_model = ULA_CONTENTION_MODEL_MREQ;
+  } else {
+    ula_contention_model = ULA_CONTENTION_MODEL_FULL;
+  }
+
+  /* The delays are still filled in for every model so that anything
+     indexing the table directly sees zero rather than stale delays from
+     the previous machine */
+  for( i = 0; i < frame; i++ ) {
+    ula_timing_t *timing = &ula_timing[ i ];
+
+    timing->contention = ula_contention_model == ULA_CONTENTION_MODEL_NONE ?
+                         0 : ram->contend_delay( i );
+    timing->contention_no_mreq =
+      ula_contention_model == ULA_CONTENTION_MODEL_FULL ?
+      ram->contend_delay_no_mreq( i ) : 0;
+    timing->floating_bus = spectrum_floating_bus_offset( i );
+  }
+
+  /* Nothing happens after the end of the frame */
+  for( ; i < ULA_CONTENTION_SIZE; i++ ) {
+    ula_timing[ i ].contention = ula_timing[ i ].contention_no_mreq = 0;
+    ula_timing[ i ].floating_bus = ULA_FLOATING_BUS_IDLE;
+  }
+
+  for( ula_contention_end = frame;
+       ula_contention_end && !ula_timing[ ula_contention_end - 1 ].contention;
+       ula_contention_end-- )
+    ;
+}
+
 void
 ula_contend_port_early( libspectrum_word port )
 {
-  if( memory_map_read[ port >> MEMORY_PAGE_SIZE_LOGARITHM ].contended )
-    tstates += ula_contention_no_mreq[ tstates ];
+  if( ula_contention_model == ULA_CONTENTION_MODEL_FULL &&
+      memory_map_read[ port >> MEMORY_PAGE_SIZE_LOGARITHM ].contended )
+    tstates += ula_timing[ tstates ].contention_no_mreq;
    
   tstates++;
 }
@@ -268,16 +348,23 @@ ula_contend_port_early( libspectrum_word port )
 void
 ula_contend_port_late( libspectrum_word port )
 {
+  /* Without no MREQ contention every delay below is zero, so don't bother
+     asking the machine whether the ULA supplies this port */
+  if( ula_contention_model != ULA_CONTENTION_MODEL_FULL ) {
+    tstates += 2;
+    return;
+  }
+
   if( machine_current->ram.port_from_ula( port ) ) {
 
-    tstates += ula_contention_no_mreq[ tstates ]; tstates += 2;
+    tstates += ula_timing[ tstates ].contention_no_mreq; tstates += 2;
 
   } else {
 
     if( memory_map_read[ port >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) {
-      tstates += ula_contention_no_mreq[ tstates ]; tstates++;
-      tstates += ula_contention_no_mreq[ tstates ]; tstates++;
-      tstates += ula_contention_no_mreq[ tstates ];
+      tstates += ula_timing[ tstates ].contention_no_mreq; tstates++;
+      tstates += ula_timing[ tstates ].contention_no_mreq; tstates++;
+      tstates += ula_timing[ tstates ].contention_no_mreq;
     } else {
       tstates += 2;
     }
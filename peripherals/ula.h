@@ -26,11 +26,44 @@
 
 #define ULA_CONTENTION_SIZE 80000
 
-/* How much contention do we get at every tstate when MREQ is active? */
-extern libspectrum_byte ula_contention[ ULA_CONTENTION_SIZE ];
+/* What the floating bus holds when the ULA isn't fetching from the
+   screen */
+#define ULA_FLOATING_BUS_IDLE 0xffff
 
-/* And how much when it is inactive */
-extern libspectrum_byte ula_contention_no_mreq[ ULA_CONTENTION_SIZE ];
+/* What the ULA is doing at one tstate of the frame. Everything a memory
+   or port access needs is kept together, so it touches one cache line */
+typedef struct ula_timing_t {
+
+  /* How much contention do we get when MREQ is active? */
+  libspectrum_byte contention;
+
+  /* And how much when it is inactive */
+  libspectrum_byte contention_no_mreq;
+
+  /* The offset into the current screen on the floating bus, or
+     ULA_FLOATING_BUS_IDLE */
+  libspectrum_word floating_bus;
+
+} ula_timing_t;
+
+extern ula_timing_t ula_timing[ ULA_CONTENTION_SIZE ];
+
+/* Which family of contention the current machine has; lets the hot paths
+   skip table lookups which can only ever return zero */
+typedef enum ula_contention_model_t {
+
+  ULA_CONTENTION_MODEL_NONE,	/* Pentagon, Scorpion: nothing contended */
+  ULA_CONTENTION_MODEL_MREQ,	/* +2A/+3: MREQ contention only */
+  ULA_CONTENTION_MODEL_FULL,	/* 48K, 128K, Timex: MREQ, no MREQ and I/O */
+
+} ula_contention_model_t;
+
+extern ula_contention_model_t ula_contention_model;
+
+/* The first tstate after which there's no more contention in the frame */
+extern libspectrum_dword ula_contention_end;
+
+void ula_timing_setup( void );
 
 void ula_register_startup( void );
 
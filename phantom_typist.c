@@ -31,9 +31,11 @@
 #include <libspectrum.h>
 
 #include "compat.h"
+#include "display.h"
 #include "infrastructure/startup_manager.h"
 #include "keyboard.h"
 #include "module.h"
+#include "movie.h"
 #include "phantom_typist.h"
 #include "settings.h"
 #include "timer/timer.h"
@@ -208,6 +210,13 @@ static int delay = 0;
 static libspectrum_byte keyboard_ports_read = 0x00;
 static int command_count;
 
+/* The most frames the typist will run without drawing them; if the
+   machine hasn't got as far as reading the keyboard by then, it probably
+   isn't going to, so show what it's doing instead */
+#define MAX_HIDDEN_FRAMES 1000
+
+static int hidden_frames;
+
 static module_info_t phantom_typist_module_info = {
   phantom_typist_reset,
   NULL,
@@ -286,6 +295,7 @@ static void
 set_state_waiting( void )
 {
   command_count = 0;
+  hidden_frames = 0;
   phantom_typist_state = PHANTOM_TYPIST_STATE_WAITING;
   next_phantom_typist_state = PHANTOM_TYPIST_STATE_WAITING;
 
@@ -529,6 +539,13 @@ phantom_typist_is_active( void )
   return phantom_typist_state != PHANTOM_TYPIST_STATE_INACTIVE;
 }
 
+int
+phantom_typist_hides_frames( void )
+{
+  return settings_current.fastload && !movie_recording &&
+         phantom_typist_is_active() && hidden_frames < MAX_HIDDEN_FRAMES;
+}
+
 void
 phantom_typist_frame( void )
 {
@@ -544,9 +561,16 @@ phantom_typist_frame( void )
 
     if( next_phantom_typist_state == PHANTOM_TYPIST_STATE_INACTIVE ) {
       timer_stop_fastloading();
+
+      /* Show the machine as the typist left it */
+      if( hidden_frames && hidden_frames < MAX_HIDDEN_FRAMES )
+        display_refresh_all();
     }
   }
 
+  if( phantom_typist_hides_frames() && ++hidden_frames == MAX_HIDDEN_FRAMES )
+    display_refresh_all();
+
   if( delay > 0 ) {
     delay--;
   }
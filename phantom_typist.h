@@ -48,6 +48,12 @@ phantom_typist_ula_read( libspectrum_word port );
 int
 phantom_typist_is_active( void );
 
+/* Returns non-zero if the phantom typist is active and fast loading is
+   on, in which case the machine runs flat out with nothing drawn until
+   the typist has finished */
+int
+phantom_typist_hides_frames( void );
+
 /* Called each frame to update the phantom typist state */
 void
 phantom_typist_frame( void );
@@ -32,10 +32,56 @@
 #include "pokefinder.h"
 #include "spectrum.h"
 
+/* The searches compare 16 locations at once, giving a mask of those which
+   have failed; with SSE2 or NEON, that's a single vector */
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#define POKEFINDER_SSE2 1
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#include <arm_neon.h>
+#define POKEFINDER_NEON 1
+#endif
+
+/* Locations tested at once */
+#define POKEFINDER_CHUNK 16
+
+/* Chunks of impossible[] skipped with one test when already all set */
+#define POKEFINDER_SKIP_BYTES 8
+
+typedef enum pokefinder_test {
+
+  POKEFINDER_TEST_RANGE,	/* Between two values */
+  POKEFINDER_TEST_INCREMENTED,	/* Bigger than last time */
+  POKEFINDER_TEST_DECREMENTED,	/* Smaller than last time */
+  POKEFINDER_TEST_CHANGED,	/* Different from last time */
+  POKEFINDER_TEST_UNCHANGED,	/* The same as last time */
+
+} pokefinder_test;
+
+/* Once few enough locations are left, they're kept as a sorted list
+   along with what each held last time, and the searches only look at
+   those rather than all of RAM */
+#define POKEFINDER_SPARSE_MAX 4096
+
+typedef struct pokefinder_candidate {
+
+  libspectrum_dword location;	/* page * MEMORY_PAGE_SIZE + offset */
+  libspectrum_word then;	/* The word starting there last time */
+
+} pokefinder_candidate;
+
 libspectrum_byte pokefinder_possible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE ];
 libspectrum_byte pokefinder_impossible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE / 8 ];
 size_t pokefinder_count;
 
+/* The width of the last search, used by the incremented and decremented
+   searches */
+static pokefinder_width search_width = POKEFINDER_WIDTH_BYTE;
+
+static pokefinder_candidate candidates[ POKEFINDER_SPARSE_MAX ];
+static size_t candidate_count;
+static int sparse;
+
 void
 pokefinder_clear( void )
 {
@@ -43,6 +89,8 @@ pokefinder_clear( void )
 
   max_page = MEMORY_PAGES_IN_16K * machine_current->ram.valid_pages;
   pokefinder_count = 0;
+  search_width = POKEFINDER_WIDTH_BYTE;
+  sparse = 0;
   for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; ++page )
     if( page < max_page && memory_map_ram[page].writable ) {
       pokefinder_count += MEMORY_PAGE_SIZE;
@@ -52,71 +100,444 @@ pokefinder_clear( void )
       memset( pokefinder_impossible[page], 255, MEMORY_PAGE_SIZE / 8 );
 }
 
-int
-pokefinder_search( libspectrum_byte value )
+static int
+count_bits( libspectrum_word mask )
 {
-  size_t page, offset;
+#ifdef __GNUC__
+  return __builtin_popcount( mask );
+#else				/* #ifdef __GNUC__ */
+  int count;
 
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+  for( count = 0; mask; count++ ) mask &= mask - 1;
 
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+  return count;
+#endif				/* #ifdef __GNUC__ */
+}
+
+/* Does a location holding `now', and `then' last time, fail? */
+static int
+test_value( pokefinder_test test, libspectrum_word now, libspectrum_word then,
+            libspectrum_word low, libspectrum_word high )
+{
+  switch( test ) {
+  case POKEFINDER_TEST_RANGE:
+    return (libspectrum_word)( now - low ) > (libspectrum_word)( high - low );
+  case POKEFINDER_TEST_INCREMENTED: return now <= then;
+  case POKEFINDER_TEST_DECREMENTED: return now >= then;
+  case POKEFINDER_TEST_CHANGED: return now == then;
+  case POKEFINDER_TEST_UNCHANGED: return now != then;
+  }
+
+  return 1;
+}
+
+/* The failures among the POKEFINDER_CHUNK locations starting at `now' and
+   `then', the current and the last seen memory. For words, one more byte
+   of each is read */
+static libspectrum_word
+test_chunk( pokefinder_test test, pokefinder_width width,
+            const libspectrum_byte *now, const libspectrum_byte *then,
+            libspectrum_word low, libspectrum_word high )
+{
+#if defined( POKEFINDER_SSE2 )
+  __m128i fail;
+
+  if( width == POKEFINDER_WIDTH_BYTE ) {
+    __m128i n = _mm_loadu_si128( (const __m128i*)now );
+    __m128i t = _mm_loadu_si128( (const __m128i*)then );
+    __m128i zero = _mm_setzero_si128();
+
+    switch( test ) {
+    case POKEFINDER_TEST_RANGE:
+      /* n - low wraps round to above high - low when out of range */
+      n = _mm_sub_epi8( n, _mm_set1_epi8( (char)low ) );
+      fail = _mm_subs_epu8( n, _mm_set1_epi8( (char)( high - low ) ) );
+      fail = _mm_xor_si128( _mm_cmpeq_epi8( fail, zero ),
+                            _mm_cmpeq_epi8( zero, zero ) );
+      break;
+    case POKEFINDER_TEST_INCREMENTED:
+      fail = _mm_cmpeq_epi8( _mm_subs_epu8( n, t ), zero );
+      break;
+    case POKEFINDER_TEST_DECREMENTED:
+      fail = _mm_cmpeq_epi8( _mm_subs_epu8( t, n ), zero );
+      break;
+    case POKEFINDER_TEST_CHANGED:
+      fail = _mm_cmpeq_epi8( n, t );
+      break;
+    default:
+      fail = _mm_xor_si128( _mm_cmpeq_epi8( n, t ),
+                            _mm_cmpeq_epi8( zero, zero ) );
+      break;
+    }
+  } else {
+    /* Interleave each byte with the one after it to give the little
+       endian words at each of the 16 locations */
+    __m128i n0 = _mm_loadu_si128( (const __m128i*)now );
+    __m128i n1 = _mm_loadu_si128( (const __m128i*)( now + 1 ) );
+    __m128i nlo = _mm_unpacklo_epi8( n0, n1 ), nhi = _mm_unpackhi_epi8( n0, n1 );
+    __m128i zero = _mm_setzero_si128(), flo, fhi;
+
+    switch( test ) {
+    case POKEFINDER_TEST_RANGE:
+      {
+        __m128i l = _mm_set1_epi16( (short)low );
+        __m128i d = _mm_set1_epi16( (short)( high - low ) );
+        __m128i ones = _mm_cmpeq_epi16( zero, zero );
+
+        flo = _mm_subs_epu16( _mm_sub_epi16( nlo, l ), d );
+        fhi = _mm_subs_epu16( _mm_sub_epi16( nhi, l ), d );
+        flo = _mm_xor_si128( _mm_cmpeq_epi16( flo, zero ), ones );
+        fhi = _mm_xor_si128( _mm_cmpeq_epi16( fhi, zero ), ones );
+      }
+      break;
+    default:
+      {
+        __m128i t0 = _mm_loadu_si128( (const __m128i*)then );
+        __m128i t1 = _mm_loadu_si128( (const __m128i*)( then + 1 ) );
+        __m128i tlo = _mm_unpacklo_epi8( t0, t1 );
+        __m128i thi = _mm_unpackhi_epi8( t0, t1 );
+
+        if( test == POKEFINDER_TEST_INCREMENTED ) {
+          flo = _mm_cmpeq_epi16( _mm_subs_epu16( nlo, tlo ), zero );
+          fhi = _mm_cmpeq_epi16( _mm_subs_epu16( nhi, thi ), zero );
+        } else if( test == POKEFINDER_TEST_DECREMENTED ) {
+          flo = _mm_cmpeq_epi16( _mm_subs_epu16( tlo, nlo ), zero );
+          fhi = _mm_cmpeq_epi16( _mm_subs_epu16( thi, nhi ), zero );
+        } else {
+          flo = _mm_cmpeq_epi16( nlo, tlo );
+          fhi = _mm_cmpeq_epi16( nhi, thi );
+          if( test == POKEFINDER_TEST_UNCHANGED ) {
+            __m128i ones = _mm_cmpeq_epi16( zero, zero );
+
+            flo = _mm_xor_si128( flo, ones );
+            fhi = _mm_xor_si128( fhi, ones );
+          }
+        }
+      }
+      break;
+    }
+
+    /* Each lane is 0 or -1, so the saturating pack keeps it as is */
+    fail = _mm_packs_epi16( flo, fhi );
+  }
+
+  return _mm_movemask_epi8( fail );
+
+#elif defined( POKEFINDER_NEON )
+  static const libspectrum_byte weights[ POKEFINDER_CHUNK ] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+  };
+  uint8x16_t fail;
+  uint8x8_t sum;
+
+  if( width == POKEFINDER_WIDTH_BYTE ) {
+    uint8x16_t n = vld1q_u8( now ), t = vld1q_u8( then );
+
+    switch( test ) {
+    case POKEFINDER_TEST_RANGE:
+      n = vsubq_u8( n, vdupq_n_u8( low ) );
+      fail = vcgtq_u8( n, vdupq_n_u8( high - low ) );
+      break;
+    case POKEFINDER_TEST_INCREMENTED:
+      fail = vcleq_u8( n, t );
+      break;
+    case POKEFINDER_TEST_DECREMENTED:
+      fail = vcgeq_u8( n, t );
+      break;
+    case POKEFINDER_TEST_CHANGED:
+      fail = vceqq_u8( n, t );
+      break;
+    default:
+      fail = vmvnq_u8( vceqq_u8( n, t ) );
+      break;
+    }
+  } else {
+    uint8x16_t n0 = vld1q_u8( now ), n1 = vld1q_u8( now + 1 );
+    uint16x8_t nlo = vreinterpretq_u16_u8( vzipq_u8( n0, n1 ).val[0] );
+    uint16x8_t nhi = vreinterpretq_u16_u8( vzipq_u8( n0, n1 ).val[1] );
+    uint16x8_t flo, fhi;
 
-      if( mapping->page[offset] != value ) {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
+    switch( test ) {
+    case POKEFINDER_TEST_RANGE:
+      {
+        uint16x8_t l = vdupq_n_u16( low ), d = vdupq_n_u16( high - low );
+
+        flo = vcgtq_u16( vsubq_u16( nlo, l ), d );
+        fhi = vcgtq_u16( vsubq_u16( nhi, l ), d );
+      }
+      break;
+    default:
+      {
+        uint8x16_t t0 = vld1q_u8( then ), t1 = vld1q_u8( then + 1 );
+        uint16x8_t tlo = vreinterpretq_u16_u8( vzipq_u8( t0, t1 ).val[0] );
+        uint16x8_t thi = vreinterpretq_u16_u8( vzipq_u8( t0, t1 ).val[1] );
+
+        if( test == POKEFINDER_TEST_INCREMENTED ) {
+          flo = vcleq_u16( nlo, tlo );
+          fhi = vcleq_u16( nhi, thi );
+        } else if( test == POKEFINDER_TEST_DECREMENTED ) {
+          flo = vcgeq_u16( nlo, tlo );
+          fhi = vcgeq_u16( nhi, thi );
+        } else {
+          flo = vceqq_u16( nlo, tlo );
+          fhi = vceqq_u16( nhi, thi );
+          if( test == POKEFINDER_TEST_UNCHANGED ) {
+            flo = vmvnq_u16( flo );
+            fhi = vmvnq_u16( fhi );
+          }
+        }
       }
+      break;
     }
+
+    fail = vcombine_u8( vmovn_u16( flo ), vmovn_u16( fhi ) );
   }
 
-  return 0;
+  /* No movemask on NEON: weight each lane by its bit and add them up */
+  fail = vandq_u8( fail, vld1q_u8( weights ) );
+  sum = vpadd_u8( vget_low_u8( fail ), vget_high_u8( fail ) );
+  sum = vpadd_u8( sum, sum );
+  sum = vpadd_u8( sum, sum );
+
+  return vget_lane_u8( sum, 0 ) | vget_lane_u8( sum, 1 ) << 8;
+
+#else				/* #if defined( POKEFINDER_SSE2 ) */
+  libspectrum_word fail = 0;
+  size_t i;
+
+  for( i = 0; i < POKEFINDER_CHUNK; i++ ) {
+    libspectrum_word n = now[i], t = then[i];
+
+    if( width == POKEFINDER_WIDTH_WORD ) {
+      n |= now[ i + 1 ] << 8;
+      t |= then[ i + 1 ] << 8;
+    }
+
+    if( test_value( test, n, t, low, high ) ) fail |= 1 << i;
+  }
+
+  return fail;
+#endif				/* #if defined( POKEFINDER_SSE2 ) */
 }
 
-int
-pokefinder_incremented( void )
+/* The word starting at `location', either now or as last remembered. A
+   word at the last byte of a page takes its high byte from the next page,
+   but the last byte of each 16K bank can't hold a word */
+static int
+bank_end( libspectrum_dword location )
+{
+  return ( location + 1 ) % ( MEMORY_PAGES_IN_16K * MEMORY_PAGE_SIZE ) == 0;
+}
+
+static libspectrum_word
+location_word( libspectrum_dword location, int remembered )
+{
+  size_t page = location / MEMORY_PAGE_SIZE;
+  size_t offset = location % MEMORY_PAGE_SIZE;
+  const libspectrum_byte *data =
+    remembered ? pokefinder_possible[ page ] : memory_map_ram[ page ].page;
+  libspectrum_word word = data[ offset ];
+
+  if( offset + 1 < MEMORY_PAGE_SIZE ) {
+    word |= data[ offset + 1 ] << 8;
+  } else if( !bank_end( location ) ) {
+    data = remembered ? pokefinder_possible[ page + 1 ] :
+                        memory_map_ram[ page + 1 ].page;
+    word |= data[0] << 8;
+  }
+
+  return word;
+}
+
+static void
+make_impossible( libspectrum_dword location )
+{
+  size_t page = location / MEMORY_PAGE_SIZE;
+  size_t offset = location % MEMORY_PAGE_SIZE;
+
+  pokefinder_impossible[ page ][ offset / 8 ] |= 1 << ( offset & 7 );
+  pokefinder_count--;
+}
+
+/* Switch to keeping a list of the remaining locations */
+static void
+make_sparse( void )
 {
   size_t page, offset;
 
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+  candidate_count = 0;
 
+  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
     for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+      pokefinder_candidate *candidate;
 
-      if( mapping->page[offset] > pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
-      } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
+      if( pokefinder_impossible[ page ][ offset / 8 ] == 0xff ) {
+        offset |= 7;
+        continue;
       }
+      if( pokefinder_impossible[ page ][ offset / 8 ] & 1 << ( offset & 7 ) )
+        continue;
 
+      candidate = &candidates[ candidate_count++ ];
+      candidate->location = page * MEMORY_PAGE_SIZE + offset;
+      candidate->then = location_word( candidate->location, 1 );
     }
   }
 
-  return 0;
+  sparse = 1;
 }
 
-int
-pokefinder_decremented( void )
+static void
+filter_sparse( pokefinder_test test, pokefinder_width width,
+               libspectrum_word low, libspectrum_word high )
 {
-  size_t page, offset;
+  size_t i, kept = 0;
+
+  for( i = 0; i < candidate_count; i++ ) {
+    pokefinder_candidate candidate = candidates[i];
+    libspectrum_word now = location_word( candidate.location, 0 );
+    libspectrum_word n = now, t = candidate.then;
+
+    if( width == POKEFINDER_WIDTH_BYTE ) {
+      n &= 0xff; t &= 0xff;
+    } else if( bank_end( candidate.location ) ) {
+      make_impossible( candidate.location );
+      continue;
+    }
+
+    if( test_value( test, n, t, low, high ) ) {
+      make_impossible( candidate.location );
+      continue;
+    }
+
+    if( test != POKEFINDER_TEST_RANGE ) candidate.then = now;
+    candidates[ kept++ ] = candidate;
+  }
+
+  candidate_count = kept;
+}
+
+/* Run one test over all the possible locations */
+static int
+pokefinder_filter( pokefinder_test test, pokefinder_width width,
+                   libspectrum_word low, libspectrum_word high )
+{
+  static const libspectrum_byte all_impossible[ POKEFINDER_SKIP_BYTES ] = {
+    255, 255, 255, 255, 255, 255, 255, 255,
+  };
+  size_t page, chunk;
+
+  if( sparse ) {
+    filter_sparse( test, width, low, high );
+    return 0;
+  }
 
   for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
+    libspectrum_byte *impossible = pokefinder_impossible[ page ];
+    const libspectrum_byte *now = memory_map_ram[ page ].page;
+    const libspectrum_byte *then = pokefinder_possible[ page ];
+    int bank_end = ( page + 1 ) % MEMORY_PAGES_IN_16K == 0;
+    int any = 0;
 
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
+    for( chunk = 0; chunk < MEMORY_PAGE_SIZE; chunk += POKEFINDER_CHUNK ) {
+      libspectrum_byte *bits = &impossible[ chunk / 8 ];
+      libspectrum_word old, fail;
 
-      if( mapping->page[offset] < pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
+      /* Skip straight over runs where nothing is left */
+      if( chunk % ( POKEFINDER_SKIP_BYTES * 8 ) == 0 &&
+          !memcmp( bits, all_impossible, POKEFINDER_SKIP_BYTES ) ) {
+        chunk += ( POKEFINDER_SKIP_BYTES * 8 ) - POKEFINDER_CHUNK;
+        continue;
+      }
+
+      old = bits[0] | bits[1] << 8;
+      if( old == 0xffff ) continue;
+
+      if( width == POKEFINDER_WIDTH_WORD &&
+          chunk + POKEFINDER_CHUNK == MEMORY_PAGE_SIZE ) {
+        /* The last chunk needs one byte from the next page */
+        libspectrum_byte now_tail[ POKEFINDER_CHUNK + 1 ];
+        libspectrum_byte then_tail[ POKEFINDER_CHUNK + 1 ];
+
+        memcpy( now_tail, now + chunk, POKEFINDER_CHUNK );
+        memcpy( then_tail, then + chunk, POKEFINDER_CHUNK );
+        if( bank_end ) {
+          now_tail[ POKEFINDER_CHUNK ] = then_tail[ POKEFINDER_CHUNK ] = 0;
+        } else {
+          now_tail[ POKEFINDER_CHUNK ] = memory_map_ram[ page + 1 ].page[0];
+          then_tail[ POKEFINDER_CHUNK ] = pokefinder_possible[ page + 1 ][0];
+        }
+
+        fail = test_chunk( test, width, now_tail, then_tail, low, high );
+        if( bank_end ) fail |= 1 << ( POKEFINDER_CHUNK - 1 );
       } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
+        fail = test_chunk( test, width, now + chunk, then + chunk, low, high );
+      }
+
+      fail &= ~old;
+      if( fail ) {
+        bits[0] |= fail & 0xff;
+        bits[1] |= fail >> 8;
+        pokefinder_count -= count_bits( fail );
       }
 
+      if( ( old | fail ) != 0xffff ) any = 1;
+    }
+
+    /* Remember the current values for the next comparison. The first
+       byte is always needed, as the previous page's last word may use it */
+    if( test != POKEFINDER_TEST_RANGE ) {
+      if( any ) {
+        memcpy( pokefinder_possible[ page ], now, MEMORY_PAGE_SIZE );
+      } else if( width == POKEFINDER_WIDTH_WORD ) {
+        pokefinder_possible[ page ][0] = now[0];
+      }
     }
   }
 
+  if( pokefinder_count <= POKEFINDER_SPARSE_MAX ) make_sparse();
+
   return 0;
 }
+
+int
+pokefinder_search( libspectrum_byte value )
+{
+  return pokefinder_search_range( POKEFINDER_WIDTH_BYTE, value, value );
+}
+
+int
+pokefinder_search_range( pokefinder_width width, libspectrum_word low,
+                         libspectrum_word high )
+{
+  if( width == POKEFINDER_WIDTH_BYTE && high > 0xff ) high = 0xff;
+  if( low > high ) return 1;
+
+  search_width = width;
+
+  return pokefinder_filter( POKEFINDER_TEST_RANGE, width, low, high );
+}
+
+int
+pokefinder_incremented( void )
+{
+  return pokefinder_filter( POKEFINDER_TEST_INCREMENTED, search_width, 0, 0 );
+}
+
+int
+pokefinder_decremented( void )
+{
+  return pokefinder_filter( POKEFINDER_TEST_DECREMENTED, search_width, 0, 0 );
+}
+
+int
+pokefinder_changed( void )
+{
+  return pokefinder_filter( POKEFINDER_TEST_CHANGED, search_width, 0, 0 );
+}
+
+int
+pokefinder_unchanged( void )
+{
+  return pokefinder_filter( POKEFINDER_TEST_UNCHANGED, search_width, 0, 0 );
+}
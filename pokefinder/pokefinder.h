@@ -26,13 +26,31 @@
 
 #include <libspectrum.h>
 
+/* The size of the value being searched for; words are little endian, as
+   the Z80 stores them */
+typedef enum pokefinder_width {
+
+  POKEFINDER_WIDTH_BYTE,
+  POKEFINDER_WIDTH_WORD,
+
+} pokefinder_width;
+
 extern libspectrum_byte pokefinder_possible[][ MEMORY_PAGE_SIZE ];
 extern libspectrum_byte pokefinder_impossible[][ MEMORY_PAGE_SIZE / 8 ];
 extern size_t pokefinder_count;
 
 void pokefinder_clear( void );
 int pokefinder_search( libspectrum_byte value );
+
+/* Keep only the locations holding a value from `low' to `high'
+   inclusive. The incremented, decremented, changed and unchanged searches
+   then compare values of the same width */
+int pokefinder_search_range( pokefinder_width width, libspectrum_word low,
+                             libspectrum_word high );
+
 int pokefinder_incremented( void );
 int pokefinder_decremented( void );
+int pokefinder_changed( void );
+int pokefinder_unchanged( void );
 
 #endif				/* #ifndef FUSE_POKEFINDER_H */
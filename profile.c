@@ -23,6 +23,7 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,17 +31,106 @@
 
 #include "event.h"
 #include "infrastructure/startup_manager.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "profile.h"
 #include "ui/ui.h"
+#include "utils.h"
 #include "z80/z80.h"
 
 int profile_active = 0;
 
+/* A full profile is the one started from the menu and written out by
+   profile_finish(); live profiling just keeps the hot spots below up to
+   date, and can run on its own without the full profile's timeline
+   growing for as long as the program runs */
+static int profile_full = 0;
+static int profile_live = 0;
+
 static int total_tstates[ 0x10000 ];
 static libspectrum_word profile_last_pc;
 static libspectrum_dword profile_last_tstates;
 
+/* As well as the flat map above, we keep a shadow of the Z80 call stack
+   and charge time to the calling context it describes.
+
+   There are no hooks in the core for this; instead, the stack is
+   followed from the outside, by looking at what each instruction did to
+   SP. A CALL or RST which dropped SP by two, or an interrupt (IFF1
+   cleared, or PC at the NMI vector, with SP dropped by two) starts a
+   new frame for the routine at the new PC; any frame whose return
+   address has been popped off the Z80 stack has returned. Code which
+   plays games with SP will confuse this, but only to the extent of
+   misattributing time, and things sort themselves out once SP comes
+   back up past the outermost confused frame */
+
+/* The calling context tree: one node for every distinct stack of
+   routines seen. Node 0 is the root, for code outside any routine we
+   saw being called */
+typedef struct profile_node {
+
+  libspectrum_word routine;
+  int parent, child, sibling;
+
+  unsigned long tstates;	/* Exclusive time at this exact stack */
+  unsigned long frame_tstates;	/* The same, in the current frame only */
+
+} profile_node;
+
+static profile_node *profile_nodes;
+static size_t profile_node_count, profile_node_alloc;
+
+typedef struct profile_stack_entry {
+
+  int node;
+  libspectrum_word sp;		/* Where the return address was pushed */
+  unsigned long entry_clock;
+  int outermost;		/* Not already further down the stack */
+
+} profile_stack_entry;
+
+#define PROFILE_STACK_DEPTH 256
+
+static profile_stack_entry profile_stack[ PROFILE_STACK_DEPTH ];
+static size_t profile_stack_depth;	/* Including the root */
+
+/* Per-routine totals, indexed by entry address */
+static unsigned long inclusive_tstates[ 0x10000 ];
+static unsigned long exclusive_tstates[ 0x10000 ];
+static int routine_active[ 0x10000 ];
+
+/* T-states executed since profiling started */
+static unsigned long profile_clock;
+
+static libspectrum_word profile_last_sp;
+static int profile_last_iff1;
+
+/* The timeline: for every frame, the time spent at each stack which was
+   active during that frame */
+typedef struct profile_timeline_entry {
+
+  libspectrum_dword frame;
+  int node;
+  unsigned long tstates;
+
+} profile_timeline_entry;
+
+static profile_timeline_entry *profile_timeline;
+static size_t profile_timeline_count, profile_timeline_alloc;
+
+static int *profile_frame_nodes;
+static size_t profile_frame_node_count, profile_frame_node_alloc;
+
+static libspectrum_dword profile_frame_count;
+
+/* The live hot spots: T-states charged to the routine being run where
+   the shadow stack knows it, or otherwise to the 256-byte region of
+   memory PC was in. Halved every time they're looked at, so they follow
+   what the program is doing now */
+static unsigned long live_routine_tstates[ 0x10000 ];
+static unsigned long live_region_tstates[ 0x100 ];
+static unsigned long live_total_tstates;
+
 static void profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED );
 
 static module_info_t profile_module_info = {
@@ -70,18 +160,121 @@ profile_register_startup( void )
                             NULL );
 }
 
+static int
+new_node( int parent, libspectrum_word routine )
+{
+  profile_node *node;
+
+  if( profile_node_count == profile_node_alloc ) {
+    profile_node_alloc = profile_node_alloc ? 2 * profile_node_alloc : 1024;
+    profile_nodes = libspectrum_renew( profile_node, profile_nodes,
+                                       profile_node_alloc );
+  }
+
+  node = &profile_nodes[ profile_node_count ];
+  node->routine = routine;
+  node->parent = parent;
+  node->child = -1;
+  node->tstates = 0;
+  node->frame_tstates = 0;
+
+  if( parent >= 0 ) {
+    node->sibling = profile_nodes[ parent ].child;
+    profile_nodes[ parent ].child = profile_node_count;
+  } else {
+    node->sibling = -1;
+  }
+
+  return profile_node_count++;
+}
+
+static void
+push_frame( libspectrum_word routine, libspectrum_word sp )
+{
+  profile_stack_entry *entry;
+  int parent, node;
+
+  if( profile_stack_depth == PROFILE_STACK_DEPTH ) return;
+
+  parent = profile_stack[ profile_stack_depth - 1 ].node;
+
+  for( node = profile_nodes[ parent ].child; node != -1;
+       node = profile_nodes[ node ].sibling )
+    if( profile_nodes[ node ].routine == routine ) break;
+
+  if( node == -1 ) node = new_node( parent, routine );
+
+  entry = &profile_stack[ profile_stack_depth++ ];
+  entry->node = node;
+  entry->sp = sp;
+  entry->entry_clock = profile_clock;
+  entry->outermost = !routine_active[ routine ]++;
+}
+
+static void
+pop_frame( void )
+{
+  profile_stack_entry *entry = &profile_stack[ --profile_stack_depth ];
+  libspectrum_word routine = profile_nodes[ entry->node ].routine;
+
+  routine_active[ routine ]--;
+  if( entry->outermost )
+    inclusive_tstates[ routine ] += profile_clock - entry->entry_clock;
+}
+
+static void
+reset_stack( void )
+{
+  while( profile_stack_depth > 1 ) pop_frame();
+}
+
 static void
 init_profiling_counters( void )
 {
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
+  profile_last_sp = z80.sp.w;
+  profile_last_iff1 = z80.iff1;
+}
+
+static void
+free_profiling_data( void )
+{
+  libspectrum_free( profile_nodes ); profile_nodes = NULL;
+  profile_node_count = profile_node_alloc = 0;
+
+  libspectrum_free( profile_timeline ); profile_timeline = NULL;
+  profile_timeline_count = profile_timeline_alloc = 0;
+
+  libspectrum_free( profile_frame_nodes ); profile_frame_nodes = NULL;
+  profile_frame_node_count = profile_frame_node_alloc = 0;
+}
+
+/* Start a new calling context tree, with nothing yet on the stack */
+static void
+start_tree( void )
+{
+  memset( routine_active, 0, sizeof( routine_active ) );
+
+  free_profiling_data();
+
+  profile_stack[ 0 ].node = new_node( -1, 0 );
+  profile_stack[ 0 ].outermost = 0;
+  profile_stack_depth = 1;
 }
 
 void
 profile_start( void )
 {
   memset( total_tstates, 0, sizeof( total_tstates ) );
+  memset( inclusive_tstates, 0, sizeof( inclusive_tstates ) );
+  memset( exclusive_tstates, 0, sizeof( exclusive_tstates ) );
+
+  start_tree();
+  profile_clock = 0;
+  profile_frame_count = 0;
 
+  profile_full = 1;
   profile_active = 1;
   init_profiling_counters();
 
@@ -93,29 +286,226 @@ profile_start( void )
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 1 );
 }
 
+static int
+is_call( libspectrum_byte opcode )
+{
+  return opcode == 0xcd ||		/* CALL nn */
+         ( opcode & 0xc7 ) == 0xc4 ||	/* CALL cc,nn */
+         ( opcode & 0xc7 ) == 0xc7;	/* RST n */
+}
+
+static int
+is_push( libspectrum_word pc )
+{
+  libspectrum_byte opcode = readbyte_internal( pc );
+
+  if( opcode == 0xdd || opcode == 0xfd )
+    return readbyte_internal( pc + 1 ) == 0xe5;
+
+  return ( opcode & 0xcf ) == 0xc5;
+}
+
+/* Work out from the change in SP whether the instruction just executed
+   returned from or called any routines */
+static void
+follow_stack( libspectrum_word pc )
+{
+  libspectrum_word sp = z80.sp.w;
+  libspectrum_word drop = profile_last_sp - sp;
+  libspectrum_word address;
+  int call, interrupt;
+
+  /* Anything whose return address is now above SP has returned */
+  while( profile_stack_depth > 1 ) {
+    libspectrum_word rise = sp - profile_stack[ profile_stack_depth - 1 ].sp;
+    if( rise == 0 || rise >= 0x8000 ) break;
+    pop_frame();
+  }
+
+  if( drop != 2 && drop != 4 ) return;
+
+  call = is_call( readbyte_internal( profile_last_pc ) );
+  interrupt = ( profile_last_iff1 && !z80.iff1 ) || pc == 0x0066;
+
+  if( interrupt ) {
+
+    /* An interrupt straight after a CALL or PUSH */
+    if( drop == 4 ) {
+      if( call ) {
+        address = readbyte_internal( sp + 2 ) |
+                  readbyte_internal( sp + 3 ) << 8;
+        push_frame( address, sp + 2 );
+      } else if( !is_push( profile_last_pc ) ) {
+        return;
+      }
+    }
+
+    push_frame( pc, sp );
+
+  } else if( call && drop == 2 ) {
+
+    push_frame( pc, sp );
+
+  }
+}
+
 void
 profile_map( libspectrum_word pc )
 {
-  total_tstates[ profile_last_pc ] += tstates - profile_last_tstates;
+  libspectrum_dword delta = tstates - profile_last_tstates;
+  profile_node *node = &profile_nodes[
+    profile_stack[ profile_stack_depth - 1 ].node ];
+
+  if( profile_full ) total_tstates[ profile_last_pc ] += delta;
+
+  if( profile_live ) {
+    if( profile_stack_depth > 1 ) {
+      live_routine_tstates[ node->routine ] += delta;
+    } else {
+      live_region_tstates[ profile_last_pc >> 8 ] += delta;
+    }
+    live_total_tstates += delta;
+  }
+
+  if( !node->frame_tstates ) {
+    if( profile_frame_node_count == profile_frame_node_alloc ) {
+      profile_frame_node_alloc = profile_frame_node_alloc ?
+                                 2 * profile_frame_node_alloc : 256;
+      profile_frame_nodes = libspectrum_renew( int, profile_frame_nodes,
+                                               profile_frame_node_alloc );
+    }
+    profile_frame_nodes[ profile_frame_node_count++ ] = node - profile_nodes;
+  }
+  node->tstates += delta;
+  node->frame_tstates += delta;
+  if( profile_stack_depth > 1 ) exclusive_tstates[ node->routine ] += delta;
+  profile_clock += delta;
+
+  follow_stack( z80.pc.w );
 
   profile_last_pc = z80.pc.w;
   profile_last_tstates = tstates;
+  profile_last_sp = z80.sp.w;
+  profile_last_iff1 = z80.iff1;
 }
 
 void
 profile_frame( libspectrum_dword frame_length )
 {
+  size_t i;
+
   profile_last_tstates -= frame_length;
+
+  for( i = 0; i < profile_frame_node_count; i++ ) {
+    profile_node *node = &profile_nodes[ profile_frame_nodes[ i ] ];
+    profile_timeline_entry *entry;
+
+    if( !node->frame_tstates ) continue;
+
+    if( profile_full ) {
+      if( profile_timeline_count == profile_timeline_alloc ) {
+        profile_timeline_alloc = profile_timeline_alloc ?
+                                 2 * profile_timeline_alloc : 4096;
+        profile_timeline = libspectrum_renew( profile_timeline_entry,
+                                              profile_timeline,
+                                              profile_timeline_alloc );
+      }
+
+      entry = &profile_timeline[ profile_timeline_count++ ];
+      entry->frame = profile_frame_count;
+      entry->node = profile_frame_nodes[ i ];
+      entry->tstates = node->frame_tstates;
+    }
+
+    node->frame_tstates = 0;
+  }
+
+  profile_frame_node_count = 0;
+  profile_frame_count++;
 }
 
 /* On snapshot load, PC and the tstate counter will jump so reset our
-   current views of these */
+   current views of these, and forget the old stack */
 static void
 profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
 {
+  if( profile_active ) reset_stack();
   init_profiling_counters();
 }
 
+/* Write the stack for `node' in the semicolon separated form used by
+   flame graph tools */
+static void
+write_stack( FILE *f, int node )
+{
+  if( node == 0 ) {
+    fputs( "(top)", f );
+    return;
+  }
+
+  write_stack( f, profile_nodes[ node ].parent );
+  fprintf( f, ";0x%04x", profile_nodes[ node ].routine );
+}
+
+static FILE*
+open_output( const char *filename, const char *suffix )
+{
+  char *path;
+  FILE *f;
+
+  path = libspectrum_new( char, strlen( filename ) + strlen( suffix ) + 1 );
+  strcpy( path, filename ); strcat( path, suffix );
+
+  f = fopen( path, "w" );
+  if( !f )
+    ui_error( UI_ERROR_ERROR, "unable to open profile output '%s' for writing",
+              path );
+
+  libspectrum_free( path );
+
+  return f;
+}
+
+/* <filename>.routines: inclusive and exclusive time for each routine
+   <filename>.folded: time for each stack, for flame graphs
+   <filename>.timeline.folded: the same, broken down by frame */
+static void
+write_call_graph( const char *filename )
+{
+  FILE *f;
+  size_t i;
+
+  f = open_output( filename, ".routines" );
+  if( f ) {
+    for( i = 0; i < 0x10000; i++ ) {
+      if( !inclusive_tstates[ i ] ) continue;
+      fprintf( f, "0x%04lx,%lu,%lu\n", (unsigned long)i, inclusive_tstates[ i ],
+               exclusive_tstates[ i ] );
+    }
+    fclose( f );
+  }
+
+  f = open_output( filename, ".folded" );
+  if( f ) {
+    for( i = 0; i < profile_node_count; i++ ) {
+      if( !profile_nodes[ i ].tstates ) continue;
+      write_stack( f, i );
+      fprintf( f, " %lu\n", profile_nodes[ i ].tstates );
+    }
+    fclose( f );
+  }
+
+  f = open_output( filename, ".timeline.folded" );
+  if( f ) {
+    for( i = 0; i < profile_timeline_count; i++ ) {
+      fprintf( f, "frame %06lu;", (unsigned long)profile_timeline[ i ].frame );
+      write_stack( f, profile_timeline[ i ].node );
+      fprintf( f, " %lu\n", profile_timeline[ i ].tstates );
+    }
+    fclose( f );
+  }
+}
+
 void
 profile_finish( const char *filename )
 {
@@ -139,7 +529,16 @@ profile_finish( const char *filename )
 
   fclose( f );
 
-  profile_active = 0;
+  /* Close off anything still running, and the partial last frame */
+  reset_stack();
+  profile_frame( 0 );
+  write_call_graph( filename );
+  free_profiling_data();
+
+  /* Live profiling carries on if it's running */
+  profile_full = 0;
+  if( profile_live ) start_tree();
+  profile_active = profile_live;
 
   /* Again, schedule an event to ensure this change is picked up by
      the main loop */
@@ -147,3 +546,114 @@ profile_finish( const char *filename )
 
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 0 );
 }
+
+void
+profile_live_set( int live )
+{
+  live = !!live;
+  if( live == profile_live ) return;
+
+  profile_live = live;
+
+  if( live ) {
+    memset( live_routine_tstates, 0, sizeof( live_routine_tstates ) );
+    memset( live_region_tstates, 0, sizeof( live_region_tstates ) );
+    live_total_tstates = 0;
+  }
+
+  /* A full profile already has everything needed running */
+  if( profile_full ) return;
+
+  if( live ) {
+    start_tree();
+    init_profiling_counters();
+  } else {
+    reset_stack();
+    free_profiling_data();
+  }
+
+  profile_active = live;
+
+  /* As in profile_start(), make sure the main loop notices */
+  event_add( tstates, event_type_null );
+}
+
+/* The number of hot spots shown */
+#define PROFILE_HOTSPOTS 4
+
+typedef struct profile_hotspot {
+
+  int address;			/* Routine address, or region << 8 */
+  int region;
+  unsigned long tstates;
+
+} profile_hotspot;
+
+/* Put `candidate' into its place in `spots', which holds `*count' so far,
+   biggest first */
+static void
+hotspot_add( profile_hotspot *spots, size_t *count,
+             const profile_hotspot *candidate )
+{
+  size_t i;
+
+  if( *count == PROFILE_HOTSPOTS &&
+      candidate->tstates <= spots[ PROFILE_HOTSPOTS - 1 ].tstates )
+    return;
+
+  if( *count < PROFILE_HOTSPOTS ) ( *count )++;
+
+  for( i = *count - 1; i > 0 && spots[ i - 1 ].tstates < candidate->tstates;
+       i-- )
+    spots[i] = spots[ i - 1 ];
+
+  spots[i] = *candidate;
+}
+
+void
+profile_hotspot_summary( char *buffer, size_t length )
+{
+  profile_hotspot spots[ PROFILE_HOTSPOTS ], candidate;
+  size_t count = 0, used = 0, i;
+
+  if( !length ) return;
+  buffer[0] = '\0';
+  if( !profile_live ) return;
+
+  candidate.region = 0;
+  for( i = 0; i < 0x10000; i++ ) {
+    if( !live_routine_tstates[i] ) continue;
+    candidate.address = i;
+    candidate.tstates = live_routine_tstates[i];
+    hotspot_add( spots, &count, &candidate );
+    live_routine_tstates[i] /= 2;
+  }
+
+  candidate.region = 1;
+  for( i = 0; i < 0x100; i++ ) {
+    if( !live_region_tstates[i] ) continue;
+    candidate.address = i << 8;
+    candidate.tstates = live_region_tstates[i];
+    hotspot_add( spots, &count, &candidate );
+    live_region_tstates[i] /= 2;
+  }
+
+  /* Routines by their entry point, regions as "80xx" */
+  for( i = 0; i < count && used < length; i++ ) {
+    unsigned long percent = live_total_tstates ?
+      ( spots[i].tstates * 100 + live_total_tstates / 2 ) /
+      live_total_tstates : 0;
+
+    if( spots[i].region ) {
+      used += snprintf( buffer + used, length - used, "%s%02Xxx %lu%%",
+                        used ? " " : "", (unsigned)spots[i].address >> 8,
+                        percent );
+    } else {
+      used += snprintf( buffer + used, length - used, "%s%04X %lu%%",
+                        used ? " " : "", (unsigned)spots[i].address,
+                        percent );
+    }
+  }
+
+  live_total_tstates /= 2;
+}
@@ -32,4 +32,14 @@ void profile_map( libspectrum_word pc );
 void profile_frame( libspectrum_dword frame_length );
 void profile_finish( const char *filename );
 
+/* Start or stop keeping track of the hot spots, whether or not a full
+   profile is running */
+void profile_live_set( int live );
+
+/* Write the routines and 256-byte regions of memory which have taken the
+   most time recently into `buffer', each with its share of the T-states
+   run, hottest first. The tallies are then halved, so they follow what
+   the program is doing now; calling this once a second is about right */
+void profile_hotspot_summary( char *buffer, size_t length );
+
 #endif			/* #ifndef FUSE_PROFILE_H */
@@ -25,7 +25,9 @@
 
 #include <stdio.h>
 
+#include "fuse.h"
 #include "infrastructure/startup_manager.h"
+#include "infrastructure/writer_queue.h"
 #include "psg.h"
 #include "ui/ui.h"
 
@@ -42,8 +44,75 @@ static int psg_empty_frame_count;
 
 static FILE *psg_file;
 
+/* The file is built up in memory and written out a block at a time, so
+   a long recording doesn't mean lots of tiny writes */
+#define PSG_BLOCK_SIZE 0x10000
+
+static libspectrum_byte *psg_block;
+static size_t psg_block_length;
+
+/* Set if any block couldn't be written */
+static int psg_write_failed;
+
+/* The blocks are written on a writer thread, if there is one */
+typedef struct psg_queued_block {
+  libspectrum_byte *data;
+  size_t length;
+} psg_queued_block;
+
+static writer_queue *psg_writer = NULL;
+
 static int write_frame_separator( void );
 
+/* Write a block out to the file; runs on the writer thread if there is
+   one */
+static void
+write_block( const libspectrum_byte *data, size_t length )
+{
+  if( fwrite( data, 1, length, psg_file ) != length ) psg_write_failed = 1;
+}
+
+/* Write a queued block; runs on the writer thread */
+static void
+psg_write_queued_block( void *job )
+{
+  psg_queued_block *b = job;
+
+  write_block( b->data, b->length );
+
+  libspectrum_free( b->data );
+  libspectrum_free( b );
+}
+
+/* Hand the current block over to be written */
+static void
+psg_flush( void )
+{
+  if( !psg_block_length ) return;
+
+  if( psg_writer ) {
+    psg_queued_block *b = libspectrum_new( psg_queued_block, 1 );
+
+    b->data = psg_block;
+    b->length = psg_block_length;
+    writer_queue_push( psg_writer, b, b->length, 1 );
+
+    psg_block = libspectrum_new( libspectrum_byte, PSG_BLOCK_SIZE );
+    psg_block_length = 0;
+    return;
+  }
+
+  write_block( psg_block, psg_block_length );
+  psg_block_length = 0;
+}
+
+static void
+psg_put( libspectrum_byte b )
+{
+  psg_block[ psg_block_length++ ] = b;
+  if( psg_block_length == PSG_BLOCK_SIZE ) psg_flush();
+}
+
 static int
 psg_init( void *context )
 {
@@ -65,12 +134,15 @@ psg_start_recording( const char *filename )
     return 1;
   }
 
+  psg_block = libspectrum_new( libspectrum_byte, PSG_BLOCK_SIZE );
+  psg_block_length = 0;
+  psg_write_failed = 0;
+
+  psg_writer = writer_queue_start( "PSG", psg_write_queued_block, NULL, 0 );
+
   /* write PSG file header */
-  if( fprintf( psg_file, "PSG\x1a" ) < 0 ) {
-    ui_error( UI_ERROR_ERROR, "unable to write PSG file header" );
-    return 1;
-  }
-  for( i = 0; i < 12; i++ ) putc( 0, psg_file );
+  psg_put( 'P' ); psg_put( 'S' ); psg_put( 'G' ); psg_put( 0x1a );
+  for( i = 0; i < 12; i++ ) psg_put( 0 );
 
   /* begin with no registers written */
   for( i = 0; i < AY_REGISTERS; i++ ) psg_registers_written[i] = 0;
@@ -92,9 +164,24 @@ psg_stop_recording( void )
   /* end file with the appropriate end-frame marker */
   write_frame_separator();
 
-  fclose( psg_file );
+  psg_flush();
+  if( psg_writer ) {
+    writer_queue_stop( psg_writer, NULL );
+    psg_writer = NULL;
+  }
+
+  libspectrum_free( psg_block );
+  psg_block = NULL;
+
+  if( fclose( psg_file ) ) psg_write_failed = 1;
 
   psg_recording = 0;
+
+  if( psg_write_failed ) {
+    ui_error( UI_ERROR_ERROR, "unable to write PSG file" );
+    return 1;
+  }
+
   return 0;
 }
 
@@ -108,14 +195,14 @@ write_frame_separator( void )
     count = psg_empty_frame_count / 4;
     if( count > 0xff ) count = 0xff;
 
-    putc( 0xfe, psg_file );
-    putc( count, psg_file );
+    psg_put( 0xfe );
+    psg_put( count );
 
     psg_empty_frame_count -= 4 * count;
   }
 
   for( ; psg_empty_frame_count; psg_empty_frame_count-- )
-    putc( 0xff, psg_file );
+    psg_put( 0xff );
 
   return 0;
 }
@@ -138,8 +225,8 @@ psg_frame( void )
     write_frame_separator();
     for( i = 0; i < 14; i++ ) {
       if( psg_registers_written[i] ) {
-	putc( i, psg_file );
-	putc( psg_register_values[i], psg_file );
+	psg_put( i );
+	psg_put( psg_register_values[i] );
       }
     }
     psg_empty_frame_count = 1;
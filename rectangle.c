@@ -26,7 +26,9 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
 
+#include "display.h"
 #include "fuse.h"
 #include "rectangle.h"
 #include "settings.h"
@@ -187,3 +189,128 @@ rectangle_end_line( int y )
 
   rectangle_active_count = ptr - rectangle_active;
 }
+
+/* The alternative tracker: rather than building rectangles line by line,
+   just remember which eight-pixel chunks of each line have changed since
+   the last call to rectangle_coalesce(), in the same layout as
+   display_is_dirty. Bit 0 corresponds to pixels 0-7 of the line */
+static libspectrum_qword rectangle_dirty[ DISPLAY_SCREEN_HEIGHT ];
+
+/* Lines are grouped into bands of this many lines, and each band gives
+   at most this many rectangles, so a frame never needs more than
+   ( 296 / 8 ) * 4 = 148 rectangles */
+#define RECTANGLE_BAND_HEIGHT 8
+#define RECTANGLE_BAND_RUNS 4
+
+/* The most runs of set bits a line can hold */
+#define RECTANGLE_MAX_RUNS ( ( DISPLAY_SCREEN_WIDTH_COLS + 1 ) / 2 )
+
+/* Mark the chunks in `mask' on line `y' as changed */
+void
+rectangle_add_line( int y, libspectrum_qword mask )
+{
+  rectangle_dirty[y] |= mask;
+}
+
+static void
+rectangle_append_inactive( int x, int y, int w, int h )
+{
+  struct rectangle *ptr;
+
+  if( ++rectangle_inactive_count > rectangle_inactive_allocated ) {
+
+    size_t new_alloc;
+
+    new_alloc = rectangle_inactive_allocated     ?
+                2 * rectangle_inactive_allocated :
+                8;
+
+    ptr =
+      libspectrum_renew( struct rectangle, rectangle_inactive, new_alloc );
+
+    rectangle_inactive_allocated = new_alloc; rectangle_inactive = ptr;
+  }
+
+  ptr = &rectangle_inactive[ rectangle_inactive_count - 1 ];
+
+  ptr->x = x; ptr->y = y;
+  ptr->w = w; ptr->h = h;
+}
+
+/* Turn the lines changed since the last call into rectangles on the
+   inactive list and clear the bitmap. Each band of lines is covered by
+   the runs of chunks changed anywhere in it; if there are too many runs,
+   the narrowest gaps between them are filled in. A rectangle which lines
+   up with one from the band above is merged into it. The cost depends
+   only on the size of the screen, not on how many writes were made */
+void
+rectangle_coalesce( void )
+{
+  int start[ RECTANGLE_MAX_RUNS ], end[ RECTANGLE_MAX_RUNS ];
+  size_t first = rectangle_inactive_count, k;
+  int y, band;
+
+  for( band = 0; band < DISPLAY_SCREEN_HEIGHT;
+       band += RECTANGLE_BAND_HEIGHT ) {
+
+    libspectrum_qword mask = 0;
+    int top = -1, bottom = 0, runs = 0, x, i;
+
+    for( y = band;
+         y < band + RECTANGLE_BAND_HEIGHT && y < DISPLAY_SCREEN_HEIGHT;
+         y++ ) {
+      if( !rectangle_dirty[y] ) continue;
+      mask |= rectangle_dirty[y];
+      if( top < 0 ) top = y;
+      bottom = y + 1;
+    }
+
+    if( !mask ) continue;
+
+    /* Find the runs of changed chunks */
+    for( x = 0; mask; ) {
+      while( !( mask & 0x01 ) ) { mask >>= 1; x++; }
+      start[ runs ] = x;
+      do { mask >>= 1; x++; } while( mask & 0x01 );
+      end[ runs++ ] = x;
+    }
+
+    /* Close up the narrowest gaps until there are few enough runs */
+    while( runs > RECTANGLE_BAND_RUNS ) {
+      int narrowest = 0;
+
+      for( i = 1; i < runs - 1; i++ )
+        if( start[ i + 1 ] - end[i] <
+            start[ narrowest + 1 ] - end[ narrowest ] )
+          narrowest = i;
+
+      end[ narrowest ] = end[ narrowest + 1 ];
+      for( i = narrowest + 1; i < runs - 1; i++ ) {
+        start[i] = start[ i + 1 ]; end[i] = end[ i + 1 ];
+      }
+      runs--;
+    }
+
+    for( i = 0; i < runs; i++ ) {
+      int merged = 0;
+
+      /* Can we just extend a rectangle from the band above? */
+      for( k = first; k < rectangle_inactive_count; k++ ) {
+        struct rectangle *above = &rectangle_inactive[k];
+
+        if( above->x == start[i] && above->w == end[i] - start[i] &&
+            above->y + above->h == top ) {
+          above->h = bottom - above->y;
+          merged = 1;
+          break;
+        }
+      }
+
+      if( !merged )
+        rectangle_append_inactive( start[i], top, end[i] - start[i],
+                                   bottom - top );
+    }
+  }
+
+  memset( rectangle_dirty, 0, sizeof( rectangle_dirty ) );
+}
@@ -36,4 +36,7 @@ extern size_t rectangle_inactive_count, rectangle_inactive_allocated;
 void rectangle_add( int y, int x, int w );
 void rectangle_end_line( int y );
 
+void rectangle_add_line( int y, libspectrum_qword mask );
+void rectangle_coalesce( void );
+
 #endif				/* #ifndef FUSE_RECTANGLE_H */
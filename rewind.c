@@ -0,0 +1,442 @@
+/* rewind.c: in-memory rewind buffer
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* The rewind buffer is a ring of states, one every --rewind-interval
+   frames. Each state holds everything except the RAM in a
+   libspectrum_snap, and the RAM itself as run-length coded XOR deltas.
+   Every so often a state is a keyframe, coded against zero; the states
+   after it are coded against the RAM as it was at the keyframe, so
+   going back to any state means decoding at most two sets of deltas.
+
+   Each page's deltas are a series of 16-bit little endian pairs: a
+   count of bytes which are unchanged, then a count of bytes which have
+   changed followed by those bytes XORed with the reference. A page's
+   deltas end once the counts reach the end of the page; pages which
+   are unchanged aren't stored at all. */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "display.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "machine.h"
+#include "memory_pages.h"
+#include "memory_usage.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "rzx.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "spectrum.h"
+#include "ui/ui.h"
+
+/* Start a new keyframe every this many states */
+#define REWIND_KEYFRAME_INTERVAL 10
+
+/* Stop a run of changed bytes at a run of at least this many unchanged
+   bytes; any shorter and a new pair of counts would cost more than it
+   saves */
+#define REWIND_MIN_GAP 4
+
+#define REWIND_PAGE_LENGTH 0x4000
+
+/* The most a single page's deltas can take up: a changed byte run is
+   always followed by REWIND_MIN_GAP unchanged bytes (or the end of the
+   page), so the counts never cost more than the unchanged bytes they
+   skip, plus the final count and the page number */
+#define REWIND_MAX_PAGE_DELTA ( REWIND_PAGE_LENGTH + 8 )
+
+typedef libspectrum_byte rewind_page[ REWIND_PAGE_LENGTH ];
+
+typedef struct rewind_state {
+
+  libspectrum_snap *snap;	/* Everything except the RAM */
+
+  libspectrum_byte *ram;	/* The RAM deltas */
+  size_t ram_length;
+
+  int keyframe;			/* Are the deltas against zero? */
+
+} rewind_state;
+
+/* The ring of states */
+static rewind_state *states;
+static size_t states_allocated, states_first, states_count;
+
+/* The number of states since the newest keyframe, inclusive */
+static size_t states_since_keyframe;
+
+/* The RAM as it was at the newest keyframe */
+static rewind_page *reference;
+
+static const rewind_page zero_page;
+
+/* Space to build up a new state's deltas in */
+static libspectrum_byte *work;
+static size_t work_allocated;
+
+static int frames_since_capture;
+
+static void rewind_end( void );
+
+void
+rewind_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_LIBSPECTRUM
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_REWIND, dependencies,
+                            ARRAY_SIZE( dependencies ), NULL, NULL,
+                            rewind_end );
+}
+
+static int
+rewind_interval( void )
+{
+  return settings_current.rewind_interval > 0 ?
+         settings_current.rewind_interval : 1;
+}
+
+/* How many states we need to cover --rewind-length seconds */
+static size_t
+rewind_capacity( void )
+{
+  libspectrum_dword frames_per_second =
+    machine_current->timings.processor_speed /
+    machine_current->timings.tstates_per_frame;
+  size_t capacity =
+    settings_current.rewind_length * frames_per_second / rewind_interval();
+
+  return capacity > 1 ? capacity : 2;
+}
+
+static rewind_state*
+state_at( size_t n )
+{
+  return &states[ ( states_first + n ) % states_allocated ];
+}
+
+static void
+state_free( rewind_state *state )
+{
+  libspectrum_snap_free( state->snap );
+  memory_usage_remove( MEMORY_USAGE_REWIND, state->ram_length );
+  libspectrum_free( state->ram );
+}
+
+/* Remove the oldest state, and any states which depended on it */
+static void
+drop_oldest( void )
+{
+  do {
+    state_free( state_at( 0 ) );
+    states_first = ( states_first + 1 ) % states_allocated;
+    states_count--;
+  } while( states_count && !state_at( 0 )->keyframe );
+
+  if( !states_count ) states_since_keyframe = 0;
+}
+
+static void
+drop_newest( void )
+{
+  rewind_state *state = state_at( states_count - 1 );
+
+  /* Removing a keyframe leaves the reference RAM describing a state we
+     no longer have, so the next state must start a new keyframe */
+  states_since_keyframe = state->keyframe ? 0 : states_since_keyframe - 1;
+
+  state_free( state );
+  states_count--;
+}
+
+void
+rewind_clear( void )
+{
+  while( states_count ) drop_newest();
+  states_first = 0;
+  states_since_keyframe = 0;
+  frames_since_capture = 0;
+}
+
+static void
+rewind_end( void )
+{
+  rewind_clear();
+
+  libspectrum_free( states ); states = NULL; states_allocated = 0;
+  libspectrum_free( reference ); reference = NULL;
+  libspectrum_free( work ); work = NULL; work_allocated = 0;
+
+  memory_usage_set( MEMORY_USAGE_REWIND, 0 );
+}
+
+static void
+put_word( libspectrum_byte *buffer, size_t *length, size_t value )
+{
+  buffer[ (*length)++ ] = value & 0xff;
+  buffer[ (*length)++ ] = value >> 8;
+}
+
+static size_t
+get_word( const libspectrum_byte **buffer )
+{
+  size_t value = (*buffer)[0] | ( (*buffer)[1] << 8 );
+  *buffer += 2;
+  return value;
+}
+
+/* Write the deltas between `page' and `ref' to `buffer', returning their
+   length */
+static size_t
+encode_page( libspectrum_byte *buffer, const libspectrum_byte *page,
+             const libspectrum_byte *ref )
+{
+  size_t pos = 0, length = 0, start, gap;
+
+  while( 1 ) {
+
+    for( start = pos; pos < REWIND_PAGE_LENGTH && page[ pos ] == ref[ pos ];
+         pos++ )
+      ;
+    put_word( buffer, &length, pos - start );
+    if( pos == REWIND_PAGE_LENGTH ) break;
+
+    start = pos;
+    while( pos < REWIND_PAGE_LENGTH ) {
+      if( page[ pos ] != ref[ pos ] ) { pos++; continue; }
+
+      for( gap = pos;
+           gap < REWIND_PAGE_LENGTH && gap - pos < REWIND_MIN_GAP &&
+             page[ gap ] == ref[ gap ];
+           gap++ )
+        ;
+      if( gap - pos == REWIND_MIN_GAP || gap == REWIND_PAGE_LENGTH ) break;
+      pos = gap;
+    }
+
+    put_word( buffer, &length, pos - start );
+    for( ; start < pos; start++ )
+      buffer[ length++ ] = page[ start ] ^ ref[ start ];
+  }
+
+  return length;
+}
+
+/* XOR one page's worth of deltas from `buffer' into `page', returning
+   the start of the next page's deltas */
+static const libspectrum_byte*
+decode_page( libspectrum_byte *page, const libspectrum_byte *buffer )
+{
+  size_t pos = 0, count;
+
+  while( 1 ) {
+    pos += get_word( &buffer );
+    if( pos >= REWIND_PAGE_LENGTH ) break;
+
+    for( count = get_word( &buffer ); count; count-- )
+      page[ pos++ ] ^= *buffer++;
+  }
+
+  return buffer;
+}
+
+void
+rewind_decode_ram( libspectrum_byte *ram, const libspectrum_byte *buffer,
+                   size_t length )
+{
+  const libspectrum_byte *end = buffer + length;
+
+  while( buffer < end ) {
+    libspectrum_byte page = *buffer++;
+    buffer = decode_page( ram + page * REWIND_PAGE_LENGTH, buffer );
+  }
+}
+
+libspectrum_byte*
+rewind_encode_ram( const libspectrum_byte *ref_ram, size_t *ram_length )
+{
+  libspectrum_byte *buffer;
+  size_t i, length = 0;
+
+  for( i = 0; i < SPECTRUM_RAM_PAGES; i++ ) {
+    const libspectrum_byte *ref =
+      ref_ram ? ref_ram + i * REWIND_PAGE_LENGTH : zero_page;
+
+    if( !memcmp( RAM[i], ref, REWIND_PAGE_LENGTH ) ) continue;
+
+    if( work_allocated - length < REWIND_MAX_PAGE_DELTA ) {
+      work_allocated = length + REWIND_MAX_PAGE_DELTA * 4;
+      work = libspectrum_renew( libspectrum_byte, work, work_allocated );
+    }
+
+    work[ length++ ] = i;
+    length += encode_page( work + length, RAM[i], ref );
+  }
+
+  *ram_length = length;
+  buffer = libspectrum_new( libspectrum_byte, length ? length : 1 );
+  memcpy( buffer, work, length );
+
+  return buffer;
+}
+
+/* Code all of the RAM against either the reference or zero */
+static void
+encode_ram( rewind_state *state )
+{
+  state->ram = rewind_encode_ram( state->keyframe ? NULL : reference[0],
+                                  &state->ram_length );
+  memory_usage_add( MEMORY_USAGE_REWIND, state->ram_length );
+}
+
+static int
+capture_state( void )
+{
+  rewind_state *state;
+  libspectrum_snap *snap;
+  int error;
+
+  snap = libspectrum_snap_alloc();
+
+  /* We look after the RAM ourselves */
+  memory_snapshot_ram = 0;
+  error = snapshot_copy_to( snap );
+  memory_snapshot_ram = 1;
+  if( error ) { libspectrum_snap_free( snap ); return error; }
+
+  if( states_count == states_allocated ) drop_oldest();
+
+  state = state_at( states_count++ );
+  state->snap = snap;
+  state->keyframe = !states_since_keyframe ||
+                    states_since_keyframe >= REWIND_KEYFRAME_INTERVAL;
+
+  if( state->keyframe ) {
+    memcpy( reference, RAM, sizeof( RAM ) );
+    states_since_keyframe = 0;
+  }
+  states_since_keyframe++;
+
+  encode_ram( state );
+
+  return 0;
+}
+
+static int
+restore_state( size_t n )
+{
+  size_t keyframe, i;
+  int error;
+
+  for( keyframe = n; !state_at( keyframe )->keyframe; keyframe-- )
+    ;
+
+  error = snapshot_copy_from( state_at( n )->snap );
+  if( error ) return error;
+
+  /* Machine selection and reset may have changed the RAM, so do this
+     last. Only pages which aren't already clear are cleared, so RAM the
+     host has never been asked for stays that way */
+  for( i = 0; i < SPECTRUM_RAM_PAGES; i++ )
+    if( memcmp( RAM[i], zero_page, REWIND_PAGE_LENGTH ) )
+      memset( RAM[i], 0, REWIND_PAGE_LENGTH );
+  rewind_decode_ram( RAM[0], state_at( keyframe )->ram,
+                     state_at( keyframe )->ram_length );
+  if( keyframe != n )
+    rewind_decode_ram( RAM[0], state_at( n )->ram, state_at( n )->ram_length );
+  memory_ram_changed();
+
+  display_refresh_all();
+
+  return 0;
+}
+
+/* (Re)allocate the buffer if it isn't the right size for the current
+   settings */
+static void
+rewind_allocate( void )
+{
+  size_t capacity = rewind_capacity();
+
+  if( states_allocated == capacity ) return;
+
+  rewind_clear();
+
+  memory_usage_remove( MEMORY_USAGE_REWIND,
+                       states_allocated * sizeof( rewind_state ) );
+  states = libspectrum_renew( rewind_state, states, capacity );
+  states_allocated = capacity;
+  memory_usage_add( MEMORY_USAGE_REWIND, capacity * sizeof( rewind_state ) );
+
+  if( !reference ) {
+    reference = libspectrum_new( rewind_page, SPECTRUM_RAM_PAGES );
+    memory_usage_add( MEMORY_USAGE_REWIND,
+                      SPECTRUM_RAM_PAGES * sizeof( rewind_page ) );
+  }
+}
+
+void
+rewind_frame( void )
+{
+  if( !settings_current.rewind ) {
+    if( states ) rewind_end();
+    return;
+  }
+
+  /* Going back in the middle of a recording would break it, as would
+     the machine going back on only one side of netplay */
+  if( rzx_recording || rzx_playback || netplay_active ) return;
+
+  if( ++frames_since_capture < rewind_interval() ) return;
+  frames_since_capture = 0;
+
+  rewind_allocate();
+
+  if( capture_state() )
+    ui_error( UI_ERROR_ERROR, "error taking rewind state" );
+}
+
+int
+rewind_step_back( void )
+{
+  int error;
+
+  if( !states_count || rzx_recording || rzx_playback || netplay_active )
+    return 1;
+
+  /* Going back to a state taken only a moment ago would look like
+     nothing had happened */
+  if( states_count > 1 && frames_since_capture < rewind_interval() / 2 )
+    drop_newest();
+
+  error = restore_state( states_count - 1 );
+  drop_newest();
+  frames_since_capture = 0;
+
+  return error;
+}
@@ -0,0 +1,54 @@
+/* rewind.h: in-memory rewind buffer
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_REWIND_H
+#define FUSE_REWIND_H
+
+#include <libspectrum.h>
+
+void rewind_register_startup( void );
+
+/* Called once a frame; takes a new state every --rewind-interval frames
+   while rewinding is enabled */
+void rewind_frame( void );
+
+/* Go back to the most recent state, which is then removed from the
+   buffer so that the next step goes further back. Returns non-zero if
+   there was nothing to go back to */
+int rewind_step_back( void );
+
+/* Throw away all the states */
+void rewind_clear( void );
+
+/* The delta coding used for the states' RAM, for other in-memory states.
+   rewind_encode_ram() codes all of the RAM against `reference', a copy
+   of SPECTRUM_RAM_PAGES pages, or against zero if that's NULL; the
+   returned buffer must be freed with libspectrum_free().
+   rewind_decode_ram() XORs such deltas into `ram', which is laid out as
+   the reference was */
+libspectrum_byte* rewind_encode_ram( const libspectrum_byte *reference,
+                                     size_t *length );
+void rewind_decode_ram( libspectrum_byte *ram, const libspectrum_byte *deltas,
+                        size_t length );
+
+#endif				/* #ifndef FUSE_REWIND_H */
@@ -0,0 +1,231 @@
+/* runahead.c: emulate frames ahead to cut input latency
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* With --runahead n, each frame is emulated as normal but not drawn.
+   The machine state is then saved, n more frames are emulated with the
+   input as it is now, the last of those is drawn and the state is put
+   back. What's on screen is therefore n frames ahead of the real
+   emulation, which takes n frames off the time it takes a key press to
+   show up, at the cost of emulating n + 1 frames for every one.
+
+   This happens twice a frame, so it can't go through the snapshot code:
+   that resets the machine and reloads the ROMs on every restore. Instead,
+   the modules' in-memory states are used; these cover what a basic
+   machine changes from one frame to the next: the Z80, the paging and
+   RAM, the ULA and AY, the display counters and the pending events.
+   Anything they don't cover (disk interfaces, Timex machines, a playing
+   tape, RZX and so on) turns running ahead off. */
+
+#include <config.h>
+
+#include <libspectrum.h>
+
+#include "batch.h"
+#include "bench.h"
+#include "export.h"
+#include "compat.h"
+#include "debugger/debugger.h"
+#include "event.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "machine.h"
+#include "module.h"
+#include "movie.h"
+#include "netplay.h"
+#include "periph.h"
+#include "phantom_typist.h"
+#include "profile.h"
+#include "psg.h"
+#include "runahead.h"
+#include "rzx.h"
+#include "settings.h"
+#include "sound.h"
+#include "spectrum.h"
+#include "tape.h"
+#include "timer/timer.h"
+#include "ui/ui.h"
+#include "z80/z80.h"
+
+/* The most RAM a machine which can run ahead has */
+#define RUNAHEAD_RAM_PAGES 8
+
+static module_state_t saved;
+
+int runahead_active = 0;
+
+/* Will this frame be followed by frames run ahead? */
+static int pending;
+
+/* How many frames are still to be run ahead, including this one */
+static int frames_left;
+
+/* Set at the end of each frame run ahead */
+static int frame_done;
+
+/* The peripherals whose state is entirely covered by the saved state */
+static int
+periph_supported( periph_type type )
+{
+  switch( type ) {
+
+  case PERIPH_TYPE_128_MEMORY:
+  case PERIPH_TYPE_AY:
+  case PERIPH_TYPE_AY_FULL_DECODE:
+  case PERIPH_TYPE_AY_PLUS3:
+  case PERIPH_TYPE_FULLER:
+  case PERIPH_TYPE_INTERFACE2:
+  case PERIPH_TYPE_KEMPSTON:
+  case PERIPH_TYPE_KEMPSTON_LOOSE:
+  case PERIPH_TYPE_KEMPSTON_MOUSE:
+  case PERIPH_TYPE_MELODIK:
+  case PERIPH_TYPE_PLUS3_MEMORY:
+  case PERIPH_TYPE_ULA:
+  case PERIPH_TYPE_ULA_FULL_DECODE:
+    return 1;
+
+  /* The printers do nothing at all unless printing is enabled, which
+     turns running ahead off anyway */
+  case PERIPH_TYPE_PARALLEL_PRINTER:
+  case PERIPH_TYPE_ZXPRINTER:
+  case PERIPH_TYPE_ZXPRINTER_FULL_DECODE:
+    return 1;
+
+  default:
+    return 0;
+
+  }
+}
+
+int
+runahead_state_complete( void )
+{
+  periph_type type;
+
+  /* Anything which records or plays back the emulation, or which needs
+     every frame to be real */
+  if( rzx_playback || rzx_recording || psg_recording || movie_recording ||
+      bench_active || batch_active || export_active || profile_active ||
+      timer_turbo || debugger_mode != DEBUGGER_MODE_INACTIVE )
+    return 0;
+
+  /* Anything which has effects outside the machine */
+  if( tape_is_playing() || tape_recording || phantom_typist_is_active() ||
+      settings_current.printer )
+    return 0;
+
+  if( machine_current->timex ||
+      machine_current->ram.valid_pages > RUNAHEAD_RAM_PAGES )
+    return 0;
+
+  for( type = PERIPH_TYPE_UNKNOWN + 1;
+       type <= PERIPH_TYPE_ZXPRINTER_FULL_DECODE;
+       type++ )
+    if( periph_is_active( type ) && !periph_supported( type ) ) return 0;
+
+  return 1;
+}
+
+static int
+runahead_possible( void )
+{
+  /* Netplay does its own going back and forth */
+  if( settings_current.runahead <= 0 || netplay_active ) return 0;
+
+  return runahead_state_complete();
+}
+
+void
+runahead_frame( void )
+{
+  if( runahead_active ) {
+    frame_done = 1;
+  } else {
+    pending = runahead_possible();
+  }
+}
+
+int
+runahead_hides_frame( void )
+{
+  return runahead_active ? frames_left > 1 : pending;
+}
+
+void
+runahead_emulate( int frames, runahead_frame_fn before )
+{
+  int frame = 0;
+
+  sound_discard_start();
+  runahead_active = 1;
+
+  for( frames_left = frames; frames_left; frames_left-- ) {
+    if( before ) before( frame++ );
+    frame_done = 0;
+    while( !frame_done ) {
+      z80_do_opcodes();
+      event_do_events();
+    }
+  }
+
+  runahead_active = 0;
+  sound_discard_stop();
+}
+
+void
+runahead_run( void )
+{
+  if( !pending ) return;
+  pending = 0;
+
+  /* The UI may have changed the machine since the end of the frame */
+  if( fuse_exiting || !runahead_possible() ) return;
+
+  module_state_save( &saved );
+
+  runahead_emulate( settings_current.runahead, NULL );
+
+  if( module_state_restore( &saved ) )
+    ui_error( UI_ERROR_ERROR, "couldn't go back after running ahead" );
+}
+
+static int
+runahead_init( void *context )
+{
+  module_state_init( &saved );
+
+  return 0;
+}
+
+static void
+runahead_end( void )
+{
+  module_state_free( &saved );
+}
+
+void
+runahead_register_startup( void )
+{
+  startup_manager_register_no_dependencies( STARTUP_MANAGER_MODULE_RUNAHEAD,
+                                            runahead_init, NULL,
+                                            runahead_end );
+}
@@ -0,0 +1,55 @@
+/* runahead.h: emulate frames ahead to cut input latency
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_RUNAHEAD_H
+#define FUSE_RUNAHEAD_H
+
+/* Non-zero while frames which will be thrown away are being emulated */
+extern int runahead_active;
+
+void runahead_register_startup( void );
+
+/* Called from spectrum_frame() at the end of every frame */
+void runahead_frame( void );
+
+/* Should the frame which has just ended be left undrawn? */
+int runahead_hides_frame( void );
+
+/* Called from the main loop once the events at the end of a frame have
+   been done; runs --runahead frames ahead, shows the last one and then
+   puts everything back */
+void runahead_run( void );
+
+/* Is the machine one whose state is entirely covered by the modules'
+   in-memory states, and is nothing going on which would be upset by
+   going back and forth in time? */
+int runahead_state_complete( void );
+
+/* Emulate `frames' frames which aren't heard and of which only the last
+   is seen. If `before' isn't NULL, it's called before each frame with
+   how many frames have been done so far */
+typedef void (*runahead_frame_fn)( int frame );
+
+void runahead_emulate( int frames, runahead_frame_fn before );
+
+#endif			/* #ifndef FUSE_RUNAHEAD_H */
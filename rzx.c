@@ -34,15 +34,22 @@
 #endif				/* #ifdef WIN32 */
 
 #include "debugger/debugger.h"
+#include "display.h"
 #include "event.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_pages.h"
+#include "memory_usage.h"
 #include "movie.h"
 #include "peripherals/ula.h"
+#include "rewind.h"
 #include "rzx.h"
+#include "rzxstream.h"
 #include "settings.h"
 #include "snapshot.h"
+#include "sound.h"
+#include "spectrum.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "utils.h"
@@ -52,6 +59,10 @@
 #define RZX_SENTINEL_TIME ( ULA_CONTENTION_SIZE - 1000 )
 #define RZX_SENTINEL_TIME_REDUCE 8000
 
+/* How many bytes read via IN to allow for in a frame to start with; a
+   game polling the keyboard in a loop can read hundreds */
+#define RZX_IN_ALLOCATE 1024
+
 /* The offset used to get the count of instructions from the R register;
    (instruction count) = R + rzx_instructions_offset */
 int rzx_instructions_offset;
@@ -77,9 +88,15 @@ int rzx_competition_mode;
 /* The filename we'll save this recording into */
 static char *rzx_filename;
 
+/* Is the recording being written out as it's made? */
+static int rzx_streaming;
+
 /* Are we currently playing back a .rzx file? */
 int rzx_playback;
 
+/* Are we running through a recording to get to a frame? */
+int rzx_seeking;
+
 int sentinel_warning;
 
 /* The number of instructions in the current .rzx playback frame */
@@ -104,6 +121,21 @@ static const float SPEED_TOLERANCE = 5;
 /* How often will we create an autosave file */
 static const size_t AUTOSAVE_INTERVAL = 5 * 50;
 
+/* The snapshots we add to the recording as autosaves don't contain the
+   RAM; that's kept here instead, as deltas against the RAM as it was at
+   the first autosave, and put back into the snapshots only when the
+   recording is written out */
+typedef struct autosave_state_t {
+  libspectrum_snap *snap;	/* The snapshot in the recording */
+  libspectrum_byte *ram;	/* Its RAM deltas */
+  size_t ram_length;
+} autosave_state_t;
+
+/* The autosaves we're holding the RAM for, oldest first */
+static GSList *autosave_states;
+
+static libspectrum_byte *autosave_reference;
+
 /* Debugger events */
 static const char * const event_type_string = "rzx";
 static const char * const end_event_detail_string = "end";
@@ -120,6 +152,23 @@ static void rzx_sentinel( libspectrum_dword ts, int type,
 
 static int sentinel_event;
 
+/* Each input block in the recording being played back: the frame it
+   starts at, and whether it follows a snapshot, so playback can be
+   restarted from there */
+typedef struct seek_point_t {
+  size_t frame;
+  int has_snap;
+} seek_point_t;
+
+static GArray *seek_points;
+
+/* The length of the recording, and how far through it we are */
+static size_t playback_frames, playback_frame_count;
+
+/* The frame we're seeking to, and whether turbo mode was on before */
+static size_t seek_target;
+static int seek_turbo;
+
 static int
 rzx_init( void *context )
 {
@@ -136,6 +185,128 @@ rzx_init( void *context )
   return 0;
 }
 
+static void
+autosave_state_free( gpointer data, gpointer user_data GCC_UNUSED )
+{
+  autosave_state_t *state = data;
+
+  memory_usage_remove( MEMORY_USAGE_RZX, state->ram_length );
+  libspectrum_free( state->ram );
+  libspectrum_free( state );
+}
+
+/* Forget about all the autosaves after `link', or all of them if `link'
+   is NULL */
+static void
+autosave_drop_after( GSList *link )
+{
+  GSList **tail = link ? &link->next : &autosave_states;
+
+  g_slist_foreach( *tail, autosave_state_free, NULL );
+  g_slist_free( *tail );
+  *tail = NULL;
+}
+
+static void
+autosave_clear( void )
+{
+  autosave_drop_after( NULL );
+
+  if( autosave_reference )
+    memory_usage_remove( MEMORY_USAGE_RZX, sizeof( RAM ) );
+  libspectrum_free( autosave_reference );
+  autosave_reference = NULL;
+}
+
+static GSList*
+autosave_find( libspectrum_snap *snap )
+{
+  GSList *link;
+
+  for( link = autosave_states; link; link = link->next )
+    if( ( (autosave_state_t*)link->data )->snap == snap ) return link;
+
+  return NULL;
+}
+
+/* Forget about `snap', which is about to be deleted from the recording */
+static void
+autosave_drop( libspectrum_snap *snap )
+{
+  GSList *link = autosave_find( snap );
+
+  if( !link ) return;
+
+  autosave_state_free( link->data, NULL );
+  autosave_states = g_slist_delete_link( autosave_states, link );
+}
+
+static int
+autosave_add_snap( void )
+{
+  autosave_state_t *state;
+  libspectrum_snap *snap;
+  int error;
+
+  if( !autosave_reference ) {
+    autosave_reference = libspectrum_new( libspectrum_byte, sizeof( RAM ) );
+    memcpy( autosave_reference, RAM, sizeof( RAM ) );
+    memory_usage_add( MEMORY_USAGE_RZX, sizeof( RAM ) );
+  }
+
+  snap = libspectrum_snap_alloc();
+
+  memory_snapshot_ram = 0;
+  error = snapshot_copy_to( snap );
+  memory_snapshot_ram = 1;
+  if( error ) {
+    libspectrum_snap_free( snap );
+    return error;
+  }
+
+  error = libspectrum_rzx_add_snap( rzx, snap, 1 );
+  if( error ) {
+    libspectrum_snap_free( snap );
+    return error;
+  }
+
+  state = libspectrum_new( autosave_state_t, 1 );
+  state->snap = snap;
+  state->ram = rewind_encode_ram( autosave_reference, &state->ram_length );
+  autosave_states = g_slist_append( autosave_states, state );
+  memory_usage_add( MEMORY_USAGE_RZX, state->ram_length );
+
+  return 0;
+}
+
+/* Put the RAM back into all the autosaves' snapshots */
+static void
+autosave_fill_snaps( void )
+{
+  libspectrum_byte *ram, *buffer;
+  GSList *link;
+  size_t i;
+
+  if( !autosave_states ) return;
+
+  ram = libspectrum_new( libspectrum_byte, sizeof( RAM ) );
+
+  for( link = autosave_states; link; link = link->next ) {
+    autosave_state_t *state = link->data;
+
+    memcpy( ram, autosave_reference, sizeof( RAM ) );
+    rewind_decode_ram( ram, state->ram, state->ram_length );
+
+    for( i = 0; i < 64; i++ ) {
+      buffer = libspectrum_new( libspectrum_byte, 0x4000 );
+      memcpy( buffer, ram + i * 0x4000, 0x4000 );
+      libspectrum_snap_set_pages( state->snap, i, buffer );
+    }
+  }
+
+  libspectrum_free( ram );
+}
+
 static int
 rzx_add_snap( libspectrum_rzx *to_rzx, int automatic )
 {
@@ -157,12 +328,40 @@ rzx_add_snap( libspectrum_rzx *to_rzx, int automatic )
   return 0;
 }
 
+static int
+start_streaming( const char *filename, int embed_snapshot )
+{
+  libspectrum_snap *snap = NULL;
+  int error;
+
+  if( embed_snapshot ) {
+    snap = libspectrum_snap_alloc();
+    error = snapshot_copy_to( snap );
+    if( error ) {
+      libspectrum_snap_free( snap );
+      return error;
+    }
+  }
+
+  error = rzx_stream_start( filename, snap );
+  if( error ) return error;
+
+  rzx_streaming = 1;
+  start_recording( NULL, 0 );
+
+  return 0;
+}
+
 int rzx_start_recording( const char *filename, int embed_snapshot )
 {
   int error;
 
   if( rzx_playback ) return 1;
 
+  /* Competition mode files are signed as a whole, so can't be streamed */
+  if( settings_current.rzx_stream && !settings_current.competition_mode )
+    return start_streaming( filename, embed_snapshot );
+
   rzx = libspectrum_rzx_alloc();
 
   /* Store the filename */
@@ -195,9 +394,34 @@ int rzx_stop_recording( void )
   rzx_recording = 0;
   if( settings_current.movie_stop_after_rzx ) movie_stop();
 
+  if( rzx_streaming ) {
+    libspectrum_snap *snap = libspectrum_snap_alloc();
+
+    /* Embed final snapshot */
+    if( snapshot_copy_to( snap ) )
+      libspectrum_snap_free( snap );
+    else
+      rzx_stream_snap( snap );
+
+    rzx_stream_stop();
+    rzx_streaming = 0;
+
+    libspectrum_free( rzx_in_bytes );
+    rzx_in_bytes = NULL;
+    rzx_in_allocated = 0;
+
+    ui_menu_activate( UI_MENU_ITEM_RECORDING, 0 );
+
+    return 0;
+  }
+
   /* Embed final snapshot */
   if( !rzx_competition_mode ) rzx_add_snap( rzx, 0 );
 
+  autosave_fill_snaps();
+  autosave_clear();
+  memory_usage_set( MEMORY_USAGE_RZX, 0 );
+
   libspectrum_free( rzx_in_bytes );
   rzx_in_bytes = NULL;
   rzx_in_allocated = 0;
@@ -274,6 +498,7 @@ int rzx_start_playback( const char *filename, int check_snapshot )
   utils_file file;
   libspectrum_error libspec_error; int error;
   libspectrum_snap* snap;
+  size_t length;
 
   if( rzx_recording ) return 1;
 
@@ -288,6 +513,7 @@ int rzx_start_playback( const char *filename, int check_snapshot )
     return libspec_error;
   }
 
+  length = file.length;
   utils_close_file( &file );
 
   snap = rzx_get_initial_snapshot();
@@ -304,6 +530,10 @@ int rzx_start_playback( const char *filename, int check_snapshot )
     return error;
   }
 
+  /* What libspectrum has read in isn't visible, but it's about the size
+     of the file */
+  memory_usage_set( MEMORY_USAGE_RZX, length );
+
   return 0;
 }
 
@@ -335,9 +565,58 @@ rzx_start_playback_from_buffer( const unsigned char *buffer, size_t length )
     return error;
   }
 
+  memory_usage_set( MEMORY_USAGE_RZX, length );
+
   return 0;
 }
 
+static void
+build_seek_index( libspectrum_rzx *from_rzx )
+{
+  libspectrum_rzx_iterator it;
+  seek_point_t point = { 0, 0 };
+
+  if( seek_points ) g_array_set_size( seek_points, 0 );
+  else seek_points = g_array_new( FALSE, FALSE, sizeof( seek_point_t ) );
+
+  for( it = libspectrum_rzx_iterator_begin( from_rzx );
+       it;
+       it = libspectrum_rzx_iterator_next( it ) ) {
+
+    libspectrum_rzx_block_id id = libspectrum_rzx_iterator_get_type( it );
+
+    switch( id ) {
+
+    case LIBSPECTRUM_RZX_INPUT_BLOCK:
+      g_array_append_val( seek_points, point );
+      point.frame += libspectrum_rzx_iterator_get_frames( it );
+      point.has_snap = 0;
+      break;
+
+    case LIBSPECTRUM_RZX_SNAPSHOT_BLOCK:
+      point.has_snap = 1;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  playback_frames = point.frame;
+  playback_frame_count = 0;
+}
+
+static void
+seek_finish( void )
+{
+  if( !rzx_seeking ) return;
+
+  rzx_seeking = 0;
+  timer_set_turbo( seek_turbo );
+  sound_unpause();
+  display_refresh_all();
+}
+
 static int
 start_playback( libspectrum_rzx *from_rzx )
 {
@@ -347,6 +626,8 @@ start_playback( libspectrum_rzx *from_rzx )
   error = libspectrum_rzx_start_playback( from_rzx, 0, &snap );
   if( error ) return error;
 
+  build_seek_index( from_rzx );
+
   if( snap ) {
     error = snapshot_copy_from( snap );
     if( error ) return error;
@@ -377,6 +658,7 @@ int rzx_stop_playback( int add_interrupt )
   if( !rzx_playback ) return 0;
 
   rzx_playback = 0;
+  seek_finish();
   if( settings_current.movie_stop_after_rzx ) movie_stop();
 
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 0 );
@@ -407,6 +689,7 @@ int rzx_stop_playback( int add_interrupt )
   }
 
   libspec_error = libspectrum_rzx_free( rzx );
+  memory_usage_set( MEMORY_USAGE_RZX, 0 );
   if( libspec_error != LIBSPECTRUM_ERROR_NONE ) return libspec_error;
 
   debugger_event( end_event );
@@ -417,10 +700,11 @@ int rzx_stop_playback( int add_interrupt )
 static void
 start_recording( libspectrum_rzx *to_rzx, int competition_mode )
 {
-  libspectrum_rzx_start_input( to_rzx, tstates );
+  if( to_rzx ) libspectrum_rzx_start_input( to_rzx, tstates );
 
   counter_reset();
   rzx_in_count = 0;
+  if( !rzx_in_allocated ) rzx_in_grow();
   autosave_frame_count = 0;
 
   rzx_recording = 1;
@@ -438,7 +722,9 @@ start_recording( libspectrum_rzx *to_rzx, int competition_mode )
 
   } else {
 
-    ui_menu_activate( UI_MENU_ITEM_RECORDING_ROLLBACK, 1 );
+    /* A streamed recording can't be rolled back */
+    if( !rzx_streaming )
+      ui_menu_activate( UI_MENU_ITEM_RECORDING_ROLLBACK, 1 );
     rzx_competition_mode = 0;
 
   }
@@ -546,6 +832,7 @@ int rzx_frame( void )
 {
   if( rzx_recording ) return recording_frame();
   if( rzx_playback  ) return playback_frame();
+  rzx_stream_poll();
   return 0;
 }
 
@@ -598,9 +885,11 @@ autosave_prune( void )
           save1.frames == 60 * 50 ||
 	  save1.frames == 300 * 50   ) &&
 	save2.frames < 2 * save1.frames
-      )
+      ) {
       /* FIXME: could possibly merge adjacent IRBs here */
+      autosave_drop( libspectrum_rzx_iterator_get_snap( save1.it ) );
       libspectrum_rzx_iterator_delete( rzx, save1.it );
+    }
   }
 
   g_array_free( autosaves, TRUE );
@@ -611,7 +900,7 @@ autosave_frame( void )
 {
   if( ++autosave_frame_count % AUTOSAVE_INTERVAL ) return;
 
-  rzx_add_snap( rzx, 1 );
+  autosave_add_snap();
 
   libspectrum_rzx_start_input( rzx, tstates );
 
@@ -655,11 +944,20 @@ static int recording_frame( void )
 {
   libspectrum_error error;
 
-  error = libspectrum_rzx_store_frame( rzx, R + rzx_instructions_offset,
-				       rzx_in_count, rzx_in_bytes );
-  if( error ) {
-    rzx_stop_recording();
-    return error;
+  if( rzx_streaming ) {
+    rzx_stream_frame( R + rzx_instructions_offset, rzx_in_count,
+                      rzx_in_bytes );
+  } else {
+    error = libspectrum_rzx_store_frame( rzx, R + rzx_instructions_offset,
+                                         rzx_in_count, rzx_in_bytes );
+    if( error ) {
+      rzx_stop_recording();
+      return error;
+    }
+
+    /* Only the input bytes are counted; frames thrown away by a rollback
+       are still counted until the recording stops */
+    memory_usage_add( MEMORY_USAGE_RZX, rzx_in_count );
   }
 
   /* Reset the instruction counter */
@@ -680,7 +978,8 @@ static int recording_frame( void )
 
   }
 
-  if( !rzx_competition_mode && settings_current.rzx_autosaves )
+  if( !rzx_competition_mode && !rzx_streaming &&
+      settings_current.rzx_autosaves )
     autosave_frame();
 
   return 0;
@@ -694,6 +993,9 @@ static int playback_frame( void )
   error = libspectrum_rzx_playback_frame( rzx, &finished, &snap );
   if( error ) return rzx_stop_playback( 0 );
 
+  playback_frame_count++;
+  if( rzx_seeking && playback_frame_count >= seek_target ) seek_finish();
+
   if( finished ) {
     ui_error( UI_ERROR_INFO, "Finished RZX playback" );
     return rzx_stop_playback( 0 );
@@ -728,24 +1030,19 @@ static int counter_reset( void )
   return 0;
 }
 
-int rzx_store_byte( libspectrum_byte value )
+void
+rzx_in_grow( void )
 {
-  /* Get more space if we need it; allocate twice as much as we currently
-     have, with a minimum of 50 */
-  if( rzx_in_count == rzx_in_allocated ) {
-
-    libspectrum_byte *ptr; size_t new_allocated;
-
-    new_allocated = rzx_in_allocated >= 25 ? 2 * rzx_in_allocated : 50;
-    ptr = libspectrum_renew( libspectrum_byte, rzx_in_bytes, new_allocated );
-
-    rzx_in_bytes = ptr;
-    rzx_in_allocated = new_allocated;
-  }
+  size_t new_allocated;
 
-  rzx_in_bytes[ rzx_in_count++ ] = value;
+  /* Allocate twice as much as we currently have, with a minimum of
+     RZX_IN_ALLOCATE */
+  new_allocated = rzx_in_allocated >= RZX_IN_ALLOCATE / 2 ?
+                  2 * rzx_in_allocated : RZX_IN_ALLOCATE;
 
-  return 0;
+  rzx_in_bytes = libspectrum_renew( libspectrum_byte, rzx_in_bytes,
+                                    new_allocated );
+  rzx_in_allocated = new_allocated;
 }
 
 static void
@@ -753,6 +1050,7 @@ rzx_end( void )
 {
   if( rzx_recording ) rzx_stop_recording();
   if( rzx_playback  ) rzx_stop_playback( 0 );
+  rzx_stream_end();
 }
 
 void
@@ -811,11 +1109,25 @@ get_rollback_list( libspectrum_rzx *from_rzx )
 static int
 start_after_rollback( libspectrum_snap *snap )
 {
+  GSList *link;
   int error;
 
+  /* Everything after `snap' has gone from the recording */
+  link = autosave_find( snap );
+  autosave_drop_after( link );
+
   error = snapshot_copy_from( snap );
   if( error ) return error;
 
+  if( link ) {
+    autosave_state_t *state = link->data;
+
+    memcpy( RAM, autosave_reference, sizeof( RAM ) );
+    rewind_decode_ram( RAM[0], state->ram, state->ram_length );
+    memory_ram_changed();
+    display_refresh_all();
+  }
+
   libspectrum_rzx_start_input( rzx, tstates );
 
   error = counter_reset();
@@ -827,12 +1139,39 @@ start_after_rollback( libspectrum_snap *snap )
   return 0;
 }
 
+int
+rzx_insert_snapshot( void )
+{
+  libspectrum_snap *snap;
+  int error;
+
+  if( !rzx_recording ) return 1;
+
+  snap = libspectrum_snap_alloc();
+
+  error = snapshot_copy_to( snap );
+  if( error ) { libspectrum_snap_free( snap ); return error; }
+
+  if( rzx_streaming ) {
+    rzx_stream_snap( snap );
+    return 0;
+  }
+
+  libspectrum_rzx_stop_input( rzx );
+  libspectrum_rzx_add_snap( rzx, snap, 0 );
+  libspectrum_rzx_start_input( rzx, tstates );
+
+  return 0;
+}
+
 int
 rzx_rollback( void )
 {
   libspectrum_snap *snap;
   int error;
 
+  if( rzx_streaming ) return 1;
+
   error = libspectrum_rzx_rollback( rzx, &snap );
   if( error ) return error;
 
@@ -849,6 +1188,8 @@ rzx_rollback_to( void )
   libspectrum_snap *snap;
   int which, error;
 
+  if( rzx_streaming ) return 1;
+
   rollback_points = get_rollback_list( rzx );
 
   which = ui_get_rollback_point( rollback_points );
@@ -864,6 +1205,98 @@ rzx_rollback_to( void )
   return 0;
 }
 
+/* Restart playback from the `which'th input block */
+static int
+seek_restart( size_t which )
+{
+  libspectrum_snap *snap;
+  int error;
+
+  error = libspectrum_rzx_start_playback( rzx, which, &snap );
+  if( error ) return error;
+
+  if( snap ) {
+    error = snapshot_copy_from( snap );
+    if( error ) return error;
+  }
+
+  event_remove_type( spectrum_frame_event );
+  event_remove_type( sentinel_event );
+  event_add( RZX_SENTINEL_TIME, sentinel_event );
+
+  tstates = libspectrum_rzx_tstates( rzx );
+  rzx_instruction_count = libspectrum_rzx_instructions( rzx );
+  counter_reset();
+
+  playback_frame_count =
+    g_array_index( seek_points, seek_point_t, which ).frame;
+
+  return 0;
+}
+
+int
+rzx_seek( size_t frame )
+{
+  size_t i, which = 0;
+  int restart = 0, error;
+
+  if( !rzx_playback || !playback_frames ) return 1;
+
+  if( frame >= playback_frames ) frame = playback_frames - 1;
+
+  /* Find the last point before the frame we can restart from */
+  for( i = 0; i < seek_points->len; i++ ) {
+    seek_point_t *point = &g_array_index( seek_points, seek_point_t, i );
+
+    if( point->frame > frame ) break;
+    if( point->has_snap ) { which = i; restart = 1; }
+  }
+
+  /* Don't restart if we'd get there quicker by carrying on */
+  if( restart && frame >= playback_frame_count &&
+      g_array_index( seek_points, seek_point_t, which ).frame <=
+        playback_frame_count )
+    restart = 0;
+
+  if( restart ) {
+    error = seek_restart( which );
+    if( error ) {
+      rzx_stop_playback( 1 );
+      return error;
+    }
+  } else if( frame < playback_frame_count ) {
+    /* Nothing to go back to */
+    return 1;
+  }
+
+  if( frame > playback_frame_count ) {
+    seek_target = frame;
+    if( !rzx_seeking ) {
+      rzx_seeking = 1;
+      seek_turbo = timer_turbo;
+      timer_set_turbo( 1 );
+      sound_pause();
+    }
+  } else {
+    seek_finish();
+    display_refresh_all();
+  }
+
+  return 0;
+}
+
+size_t
+rzx_playback_position( void )
+{
+  return rzx_playback ? playback_frame_count : 0;
+}
+
+size_t
+rzx_playback_length( void )
+{
+  return rzx_playback ? playback_frames : 0;
+}
+
 static void
 rzx_sentinel( libspectrum_dword ts GCC_UNUSED, int type GCC_UNUSED,
               void *user_data GCC_UNUSED )
@@ -44,6 +44,10 @@ extern int rzx_recording;
 /* Are we currently playing back a .rzx file? */
 extern int rzx_playback;
 
+/* Are we running through a recording to get to a frame? Frames aren't
+   drawn and sound is off while we are */
+extern int rzx_seeking;
+
 /* Is the .rzx file being recorded in competition mode? */
 extern int rzx_competition_mode;
 
@@ -66,9 +70,33 @@ rzx_start_playback_from_buffer( const unsigned char *buffer, size_t length );
 
 int rzx_stop_playback( int add_interrupt );
 
+/* Jump to `frame' of the recording being played back, by restarting
+   from the nearest snapshot before it and running on from there.
+   Returns non-zero if there's no way to get there */
+int rzx_seek( size_t frame );
+
+/* How far through the recording being played back we are, and its
+   length, in frames */
+size_t rzx_playback_position( void );
+size_t rzx_playback_length( void );
+
 int rzx_frame( void );
 
-int rzx_store_byte( libspectrum_byte value );
+/* Make room for at least one more byte in rzx_in_bytes */
+void rzx_in_grow( void );
+
+/* Store a byte read via IN while recording. The buffer is kept from one
+   frame to the next and given to libspectrum once at the end of each,
+   so it only very occasionally needs to grow */
+static inline void
+rzx_store_byte( libspectrum_byte value )
+{
+  if( rzx_in_count == rzx_in_allocated ) rzx_in_grow();
+  rzx_in_bytes[ rzx_in_count++ ] = value;
+}
+
+/* Add a snapshot to the recording at the current point */
+int rzx_insert_snapshot( void );
 
 int rzx_rollback( void );
 
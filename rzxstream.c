@@ -0,0 +1,460 @@
+/* rzxstream.c: streaming .rzx recording
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* A streamed recording is written out as it's made, rather than being
+   held in a libspectrum_rzx until it's finished. The frames are
+   gathered into input recording blocks of RZX_STREAM_BLOCK_FRAMES
+   frames; each full block, and each snapshot, is handed to a writer
+   thread which compresses it and appends it to the file, so the memory
+   used doesn't grow with the length of the recording. */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "fuse.h"
+#include "infrastructure/writer_queue.h"
+#include "rzxstream.h"
+#include "settings.h"
+#include "spectrum.h"
+#include "ui/ui.h"
+#include "utils.h"
+
+/* How many frames go into each input recording block */
+#define RZX_STREAM_BLOCK_FRAMES ( 5 * 50 )
+
+/* The RZX version we write */
+#define RZX_STREAM_MAJOR 0
+#define RZX_STREAM_MINOR 13
+
+#define RZX_BLOCK_CREATOR  0x10
+#define RZX_BLOCK_SNAPSHOT 0x30
+#define RZX_BLOCK_INPUT    0x80
+
+/* The flag marking a block's data as zlib compressed */
+#define RZX_FLAG_COMPRESSED 0x02
+
+/* An IN count meaning "the same as the last frame" */
+#define RZX_REPEAT_FRAME 0xffff
+
+typedef enum rzx_stream_job_type {
+  RZX_STREAM_JOB_INPUT,
+  RZX_STREAM_JOB_SNAPSHOT,
+  RZX_STREAM_JOB_CLOSE,
+} rzx_stream_job_type;
+
+typedef struct rzx_stream_job {
+
+  rzx_stream_job_type type;
+
+  /* Input blocks */
+  libspectrum_byte *data;
+  size_t length;
+  libspectrum_dword frames, tstates;
+
+  /* Snapshots */
+  libspectrum_snap *snap;
+
+} rzx_stream_job;
+
+/* The file being written; owned by the writer once the stream has
+   started */
+static FILE *stream_file;
+static char *stream_filename;
+static int stream_compress;
+
+/* The first error from writing the file, as an errno, or -1 for a
+   libspectrum error */
+static int stream_error;
+
+/* The input block being built up */
+static libspectrum_byte *block;
+static size_t block_length, block_allocated;
+static libspectrum_dword block_frames, block_tstates;
+
+/* Where the last frame's IN bytes are in the block */
+static size_t last_in_offset, last_in_count;
+
+static writer_queue *stream_writer = NULL;
+
+/* Has the file been closed, but the close not reported? */
+static int stream_closed;
+
+static void
+put_dword( libspectrum_byte *buffer, libspectrum_dword value )
+{
+  buffer[0] = value & 0xff;
+  buffer[1] = ( value >> 8 ) & 0xff;
+  buffer[2] = ( value >> 16 ) & 0xff;
+  buffer[3] = value >> 24;
+}
+
+static void
+put_word( libspectrum_byte *buffer, libspectrum_word value )
+{
+  buffer[0] = value & 0xff;
+  buffer[1] = value >> 8;
+}
+
+static void
+stream_write( const libspectrum_byte *buffer, size_t length )
+{
+  if( stream_error ) return;
+
+  if( fwrite( buffer, 1, length, stream_file ) != length )
+    stream_error = errno ? errno : EIO;
+}
+
+/* Compress `data' if we're compressing and it helps; returns the
+   buffer to write, which is either `data' or must be freed */
+static libspectrum_byte*
+stream_compress_data( libspectrum_byte *data, size_t *length, int *flags )
+{
+#ifdef HAVE_ZLIB_H
+  libspectrum_byte *compressed;
+  uLongf compressed_length;
+
+  if( !stream_compress || !*length ) return data;
+
+  compressed_length = compressBound( *length );
+  compressed = libspectrum_new( libspectrum_byte, compressed_length );
+
+  if( compress2( compressed, &compressed_length, data, *length,
+                 Z_BEST_COMPRESSION ) != Z_OK ) {
+    libspectrum_free( compressed );
+    return data;
+  }
+
+  *length = compressed_length;
+  *flags |= RZX_FLAG_COMPRESSED;
+  return compressed;
+#else				/* #ifdef HAVE_ZLIB_H */
+  return data;
+#endif				/* #ifdef HAVE_ZLIB_H */
+}
+
+static void
+write_input_block( rzx_stream_job *job )
+{
+  libspectrum_byte header[18], *data;
+  size_t length = job->length;
+  int flags = 0;
+
+  data = stream_compress_data( job->data, &length, &flags );
+
+  header[0] = RZX_BLOCK_INPUT;
+  put_dword( &header[1], 18 + length );
+  put_dword( &header[5], job->frames );
+  header[9] = 0;
+  put_dword( &header[10], job->tstates );
+  put_dword( &header[14], flags );
+
+  stream_write( header, sizeof( header ) );
+  stream_write( data, length );
+
+  if( data != job->data ) libspectrum_free( data );
+}
+
+static void
+write_snapshot_block( rzx_stream_job *job )
+{
+  libspectrum_byte header[17], *buffer = NULL, *data;
+  size_t length = 0, uncompressed_length;
+  int flags = 0, out_flags;
+
+  if( libspectrum_snap_write( &buffer, &length, &out_flags, job->snap,
+                              LIBSPECTRUM_ID_SNAPSHOT_SZX, fuse_creator,
+                              0 ) ) {
+    if( !stream_error ) stream_error = -1;
+    return;
+  }
+
+  uncompressed_length = length;
+  data = stream_compress_data( buffer, &length, &flags );
+
+  header[0] = RZX_BLOCK_SNAPSHOT;
+  put_dword( &header[1], 17 + length );
+  put_dword( &header[5], flags );
+  memcpy( &header[9], "szx", 4 );
+  put_dword( &header[13], uncompressed_length );
+
+  stream_write( header, sizeof( header ) );
+  stream_write( data, length );
+
+  if( data != buffer ) libspectrum_free( data );
+  libspectrum_free( buffer );
+}
+
+static void
+job_free( rzx_stream_job *job )
+{
+  libspectrum_free( job->data );
+  if( job->snap ) libspectrum_snap_free( job->snap );
+  libspectrum_free( job );
+}
+
+/* Write out one job and let go of its data; runs on the writer thread
+   if we have one, so mustn't touch the UI */
+static void
+job_write( void *data )
+{
+  rzx_stream_job *job = data;
+
+  switch( job->type ) {
+
+  case RZX_STREAM_JOB_INPUT:
+    write_input_block( job );
+    break;
+
+  case RZX_STREAM_JOB_SNAPSHOT:
+    write_snapshot_block( job );
+    break;
+
+  case RZX_STREAM_JOB_CLOSE:
+    if( fclose( stream_file ) && !stream_error )
+      stream_error = errno ? errno : EIO;
+    stream_file = NULL;
+    break;
+
+  }
+
+  libspectrum_free( job->data );
+  job->data = NULL;
+  if( job->snap ) libspectrum_snap_free( job->snap );
+  job->snap = NULL;
+}
+
+/* Called on the main thread once a job has been written */
+static void
+job_done( void *data )
+{
+  rzx_stream_job *job = data;
+
+  if( job->type == RZX_STREAM_JOB_CLOSE ) stream_closed = 1;
+  job_free( job );
+}
+
+static void
+queue_job( rzx_stream_job *job )
+{
+  if( stream_writer ) {
+    writer_queue_push( stream_writer, job, job->length, 1 );
+    return;
+  }
+
+  job_write( job );
+  job_done( job );
+}
+
+static rzx_stream_job*
+job_alloc( rzx_stream_job_type type )
+{
+  rzx_stream_job *job = libspectrum_new( rzx_stream_job, 1 );
+
+  job->type = type;
+  job->data = NULL;
+  job->length = 0;
+  job->frames = job->tstates = 0;
+  job->snap = NULL;
+
+  return job;
+}
+
+/* Hand the current input block, if it has anything in it, to the
+   writer, and start a new one from the current time */
+static void
+flush_block( void )
+{
+  rzx_stream_job *job;
+
+  if( block_frames ) {
+    job = job_alloc( RZX_STREAM_JOB_INPUT );
+    job->data = block;
+    job->length = block_length;
+    job->frames = block_frames;
+    job->tstates = block_tstates;
+    queue_job( job );
+
+    block = NULL;
+    block_allocated = 0;
+  }
+
+  block_length = 0;
+  block_frames = 0;
+  block_tstates = tstates;
+  last_in_count = 0;
+}
+
+static void
+write_header( void )
+{
+  libspectrum_byte header[10], creator[29];
+  const char *program = libspectrum_creator_program( fuse_creator );
+  size_t custom_length = libspectrum_creator_custom_length( fuse_creator );
+
+  memcpy( header, "RZX!", 4 );
+  header[4] = RZX_STREAM_MAJOR;
+  header[5] = RZX_STREAM_MINOR;
+  put_dword( &header[6], 0 );		/* Not signed */
+  stream_write( header, sizeof( header ) );
+
+  creator[0] = RZX_BLOCK_CREATOR;
+  put_dword( &creator[1], 29 + custom_length );
+  memset( &creator[5], 0, 20 );
+  strncpy( (char*)&creator[5], program, 19 );
+  put_word( &creator[25], libspectrum_creator_major( fuse_creator ) );
+  put_word( &creator[27], libspectrum_creator_minor( fuse_creator ) );
+  stream_write( creator, sizeof( creator ) );
+
+  if( custom_length )
+    stream_write( libspectrum_creator_custom( fuse_creator ), custom_length );
+}
+
+int
+rzx_stream_start( const char *filename, libspectrum_snap *snap )
+{
+  /* Make sure any previous recording is finished with */
+  rzx_stream_end();
+
+  stream_file = fopen( filename, "wb" );
+  if( !stream_file ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s' for writing: %s", filename,
+              strerror( errno ) );
+    if( snap ) libspectrum_snap_free( snap );
+    return 1;
+  }
+
+  stream_filename = utils_safe_strdup( filename );
+  stream_compress = settings_current.rzx_compression;
+  stream_error = 0;
+  stream_closed = 0;
+
+  write_header();
+
+  stream_writer = writer_queue_start( "RZX", job_write, job_done, 0 );
+
+  if( snap ) rzx_stream_snap( snap );
+
+  flush_block();
+
+  return 0;
+}
+
+void
+rzx_stream_frame( libspectrum_word instructions, size_t in_count,
+                  const libspectrum_byte *in_bytes )
+{
+  int repeat;
+
+  if( block_allocated - block_length < 4 + in_count ) {
+    block_allocated = block_length + 4 + in_count + 0x1000;
+    block = libspectrum_renew( libspectrum_byte, block, block_allocated );
+  }
+
+  repeat = block_frames && in_count == last_in_count &&
+           !memcmp( block + last_in_offset, in_bytes, in_count );
+
+  put_word( block + block_length, instructions );
+  put_word( block + block_length + 2, repeat ? RZX_REPEAT_FRAME : in_count );
+  block_length += 4;
+
+  if( !repeat ) {
+    memcpy( block + block_length, in_bytes, in_count );
+    last_in_offset = block_length;
+    last_in_count = in_count;
+    block_length += in_count;
+  }
+
+  if( ++block_frames == RZX_STREAM_BLOCK_FRAMES ) flush_block();
+}
+
+void
+rzx_stream_snap( libspectrum_snap *snap )
+{
+  rzx_stream_job *job;
+
+  /* The snapshot goes between the frames before it and those after */
+  flush_block();
+
+  job = job_alloc( RZX_STREAM_JOB_SNAPSHOT );
+  job->snap = snap;
+  queue_job( job );
+}
+
+void
+rzx_stream_stop( void )
+{
+  flush_block();
+
+  libspectrum_free( block );
+  block = NULL;
+  block_allocated = 0;
+
+  queue_job( job_alloc( RZX_STREAM_JOB_CLOSE ) );
+}
+
+void
+rzx_stream_poll( void )
+{
+  if( !stream_filename ) return;
+
+  if( stream_writer ) {
+    writer_queue_poll( stream_writer );
+    if( !stream_closed ) return;
+
+    writer_queue_stop( stream_writer, NULL );
+    stream_writer = NULL;
+  }
+
+  if( !stream_closed ) return;
+
+  if( stream_error > 0 )
+    ui_error( UI_ERROR_ERROR, "error writing '%s': %s", stream_filename,
+              strerror( stream_error ) );
+  else if( stream_error )
+    ui_error( UI_ERROR_ERROR, "error writing '%s'", stream_filename );
+
+  libspectrum_free( stream_filename );
+  stream_filename = NULL;
+}
+
+void
+rzx_stream_end( void )
+{
+  /* The recording has been stopped already, so this just waits for the
+     writer to catch up */
+  if( stream_writer ) {
+    writer_queue_stop( stream_writer, NULL );
+    stream_writer = NULL;
+  }
+
+  rzx_stream_poll();
+}
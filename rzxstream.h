@@ -0,0 +1,52 @@
+/* rzxstream.h: streaming .rzx recording
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_RZXSTREAM_H
+#define FUSE_RZXSTREAM_H
+
+#include <libspectrum.h>
+
+/* Start writing a recording to `filename', embedding `snap' as the
+   initial snapshot if it's non-NULL; the stream takes ownership of
+   `snap' */
+int rzx_stream_start( const char *filename, libspectrum_snap *snap );
+
+/* Add a frame to the recording */
+void rzx_stream_frame( libspectrum_word instructions, size_t in_count,
+                       const libspectrum_byte *in_bytes );
+
+/* Add a snapshot to the recording; the stream takes ownership of
+   `snap' */
+void rzx_stream_snap( libspectrum_snap *snap );
+
+/* Finish the recording. The file is closed in the background; any
+   error is reported from rzx_stream_poll() */
+void rzx_stream_stop( void );
+
+/* Report on a recording which has finished being written */
+void rzx_stream_poll( void );
+
+/* Wait for any recording to finish being written */
+void rzx_stream_end( void );
+
+#endif				/* #ifndef FUSE_RZXSTREAM_H */
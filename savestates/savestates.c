@@ -18,22 +18,31 @@
 #include <config.h>
 
 #include <sys/stat.h>
+#include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include <errno.h>
 #include <mntent.h>
 #include <unistd.h>
 #include <libspectrum.h>
-#include <ctype.h>
 
 #include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "infrastructure/writer_queue.h"
+#include "machine.h"
+#include "memory_pages.h"
 #include "snapshot.h"
 #include "compat.h"
 #include "utils.h"
 #include "settings.h"
 #include "ui/ui.h"
 #include "screenshot.h"
+#include "spectrum.h"
+#include "pokefinder/pokemem.h"
+#include "rzx.h"
 #include "savestates/savestates.h"
+#include "tape.h"
 
 #ifdef GCWZERO
 
@@ -41,9 +50,6 @@ static const char* re_expressions[] = {
     "(([[:space:]]|[-_])*)(([(]|[[])*[[:space:]]*)(disk|tape|side|part)(([[:space:]]|[[:punct:]])*)(([abcd1234])([[:space:]]*of[[:space:]]*[1234])*)([[:space:]]*([)]|[]])*)(([[:space:]]|[-_])*)",
     NULL };
 
-static char* last_check_directory = NULL;
-static int last_check_directory_result = 0;
-
 static int
 check_dir_exist(char* dir)
 {
@@ -62,236 +68,849 @@ check_dir_exist(char* dir)
   return 1;
 }
 
+/* Write `buffer' to a temporary file which is then renamed over
+   `filename', so the file is never left half written. Doesn't touch
+   the UI, as this is also used by the writer thread. Returns 0 or an
+   errno value */
 static int
-savestate_write_internal( int slot )
+savestate_write_file( const char *filename, const unsigned char *buffer,
+                      size_t length, int sync )
 {
-  char* filename;
+  char tmpname[ PATH_MAX ];
+  FILE *f;
+  int error;
 
-  filename = quicksave_get_filename( slot );
-  if ( !filename ) return 1;
+  snprintf( tmpname, PATH_MAX, "%s.tmp", filename );
 
-  if ( quicksave_create_dir() ) return 1;
+  f = fopen( tmpname, "wb" );
+  if ( !f ) return errno;
 
-  int error = snapshot_write( filename );
-  if ( error )
-    ui_error( UI_ERROR_ERROR, "Error saving state to slot %02d", slot );
-  else
-    #ifdef MIYOO    
-    ui_widget_show_msg_update_info( "Saved to slot %02d", slot );
-    #else
-    ui_widget_show_msg_update_info( "Saved to slot %02d (%s)", slot, get_savestate_last_change( slot ) );
-    #endif
+  if ( fwrite( buffer, 1, length, f ) != length || fflush( f )
+#ifdef HAVE_FSYNC
+       || ( sync && fsync( fileno( f ) ) )
+#endif /* #ifdef HAVE_FSYNC */
+     ) {
+    error = errno ? errno : EIO;
+    fclose( f );
+    unlink( tmpname );
+    return error;
+  }
+
+  if ( fclose( f ) || compat_file_replace( tmpname, filename ) ) {
+    error = errno;
+    unlink( tmpname );
+    return error;
+  }
+
+  return 0;
+}
+
+/*
+ * Each savestate directory has an index holding when each slot was
+ * saved and the screen it was saved with, so the savestate selector
+ * can be shown without looking at every slot. The index is rewritten
+ * whenever a state is saved, and rebuilt by looking at every slot if
+ * it's missing or the directory has been changed behind our back.
+ *
+ * The file is the signature, a version byte and a count of slots,
+ * followed by each used slot's number, its time of saving (64-bit
+ * little endian) and its screen
+ */
+
+#define SAVESTATE_INDEX_NAME "index.fsi"
+#define SAVESTATE_INDEX_VERSION 1
+#define SAVESTATE_SCREEN_LENGTH SNAPSHOT_SCREEN_LENGTH
+
+static const char savestate_index_signature[8] = "FUSESTIX";
+
+#define SAVESTATE_INDEX_HEADER_LENGTH ( sizeof( savestate_index_signature ) + 2 )
+#define SAVESTATE_INDEX_ENTRY_LENGTH ( 1 + 8 + SAVESTATE_SCREEN_LENGTH )
+
+typedef struct savestate_index_entry {
+  time_t saved;			/* 0 if the slot is empty */
+  libspectrum_byte *screen;
+} savestate_index_entry;
+
+/* The directory the index describes, and the index file's mtime when we
+   last read or wrote it */
+static char *index_dir = NULL;
+static time_t index_mtime;
+
+static savestate_index_entry index_slots[ MAX_SAVESTATES ];
+
+#ifdef HAVE_PTHREAD
+static void savestate_write_wait( void );
+#endif
+
+static char*
+savestate_index_filename( const char *dir )
+{
+  char buffer[ PATH_MAX ];
+
+  snprintf( buffer, PATH_MAX, "%s"FUSE_DIR_SEP_STR"%s", dir,
+            SAVESTATE_INDEX_NAME );
 
+  return utils_safe_strdup( buffer );
+}
+
+static void
+savestate_index_clear_slots( void )
+{
+  int i;
+
+  for ( i = 0; i < MAX_SAVESTATES; i++ ) {
+    libspectrum_free( index_slots[i].screen );
+    index_slots[i].screen = NULL;
+    index_slots[i].saved = 0;
+  }
+}
+
+static void
+savestate_index_clear( void )
+{
+  savestate_index_clear_slots();
+  libspectrum_free( index_dir ); index_dir = NULL;
+}
+
+/* Forget the index, and remove the file so it will be rebuilt */
+static void
+savestate_index_drop( const char *dir )
+{
+  char *filename = savestate_index_filename( dir );
+
+  unlink( filename );
   libspectrum_free( filename );
 
-  return error;
+  savestate_index_clear();
+}
+
+static libspectrum_byte*
+savestate_index_serialise( size_t *length )
+{
+  libspectrum_byte *buffer, *ptr;
+  int i, count = 0;
+
+  for ( i = 0; i < MAX_SAVESTATES; i++ )
+    if ( index_slots[i].saved ) count++;
+
+  *length = SAVESTATE_INDEX_HEADER_LENGTH +
+            count * SAVESTATE_INDEX_ENTRY_LENGTH;
+  ptr = buffer = libspectrum_new( libspectrum_byte, *length );
+
+  memcpy( ptr, savestate_index_signature, sizeof( savestate_index_signature ) );
+  ptr += sizeof( savestate_index_signature );
+  *ptr++ = SAVESTATE_INDEX_VERSION;
+  *ptr++ = count;
+
+  for ( i = 0; i < MAX_SAVESTATES; i++ ) {
+    libspectrum_qword saved = index_slots[i].saved;
+    int j;
+
+    if ( !saved ) continue;
+
+    *ptr++ = i;
+    for ( j = 0; j < 8; j++ ) *ptr++ = ( saved >> ( 8 * j ) ) & 0xff;
+
+    if ( index_slots[i].screen )
+      memcpy( ptr, index_slots[i].screen, SAVESTATE_SCREEN_LENGTH );
+    else
+      memset( ptr, 0, SAVESTATE_SCREEN_LENGTH );
+    ptr += SAVESTATE_SCREEN_LENGTH;
+  }
+
+  return buffer;
 }
 
 static int
-savestate_read_internal( int slot )
+savestate_index_parse( const utils_file *file )
 {
-  char* filename;
+  const libspectrum_byte *ptr = file->buffer;
+  int i, count;
 
-  /* If don't exist savestate return */
-  if ( !check_current_savestate_exist( slot ) ) return 1;
+  if ( file->length < SAVESTATE_INDEX_HEADER_LENGTH ||
+       memcmp( ptr, savestate_index_signature,
+               sizeof( savestate_index_signature ) ) ||
+       ptr[ sizeof( savestate_index_signature ) ] != SAVESTATE_INDEX_VERSION )
+    return 1;
 
-  filename = quicksave_get_filename( slot );
-  if ( !filename ) return 1;
+  count = ptr[ sizeof( savestate_index_signature ) + 1 ];
+  if ( file->length != SAVESTATE_INDEX_HEADER_LENGTH +
+                       count * SAVESTATE_INDEX_ENTRY_LENGTH )
+    return 1;
 
-  /*
-   * Dirty hack for savesstates.
-   * autoload is set to 9 for load from loadstates and avoid changing last
-   * loaded filename and controlmapping files
-   */
-  int error = utils_open_file( filename, 9, NULL );
-  if (error)
-    ui_error( UI_ERROR_ERROR, "Error loading state from slot %02d", slot );
-  else
-    #ifdef MIYOO    
-    ui_widget_show_msg_update_info( "Loaded slot %02d", slot );
-    #else
-    ui_widget_show_msg_update_info( "Loaded slot %02d (%s)", slot, get_savestate_last_change( slot ) );
-    #endif
+  ptr += SAVESTATE_INDEX_HEADER_LENGTH;
+
+  for ( i = 0; i < count; i++ ) {
+    libspectrum_qword saved = 0;
+    int slot = *ptr++, j;
+
+    if ( slot >= MAX_SAVESTATES ) return 1;
+
+    for ( j = 0; j < 8; j++ ) saved |= (libspectrum_qword)*ptr++ << ( 8 * j );
+
+    index_slots[ slot ].saved = saved;
+    index_slots[ slot ].screen =
+      libspectrum_new( libspectrum_byte, SAVESTATE_SCREEN_LENGTH );
+    memcpy( index_slots[ slot ].screen, ptr, SAVESTATE_SCREEN_LENGTH );
+    ptr += SAVESTATE_SCREEN_LENGTH;
+  }
+
+  return 0;
+}
+
+/* Write the index out from the main thread, and note its mtime */
+static void
+savestate_index_write( void )
+{
+  char *filename = savestate_index_filename( index_dir );
+  libspectrum_byte *buffer;
+  struct stat stat_info;
+  size_t length;
 
+  buffer = savestate_index_serialise( &length );
+
+  index_mtime = 0;
+  if ( !savestate_write_file( filename, buffer, length, 0 ) &&
+       !stat( filename, &stat_info ) )
+    index_mtime = stat_info.st_mtime;
+
+  libspectrum_free( buffer );
   libspectrum_free( filename );
+}
 
-  return error;
+/* Look at every slot; only done when there's no usable index */
+static void
+savestate_index_rebuild( void )
+{
+  struct stat stat_info;
+  char buffer[ PATH_MAX ];
+  int i;
+
+  for ( i = 0; i < MAX_SAVESTATES; i++ ) {
+    snprintf( buffer, PATH_MAX, "%s"FUSE_DIR_SEP_STR"%02d%s", index_dir, i,
+              settings_current.od_quicksave_format );
+
+    if ( stat( buffer, &stat_info ) ) continue;
+
+    index_slots[i].saved = stat_info.st_mtime ? stat_info.st_mtime : 1;
+    index_slots[i].screen =
+      libspectrum_new( libspectrum_byte, SAVESTATE_SCREEN_LENGTH );
+    snapshot_read_screen( buffer, index_slots[i].screen );
+  }
+
+  savestate_index_write();
 }
 
+/* Is the index we hold still a true picture of `dir'? Anything else
+   changing the directory will have left it newer than the index; our
+   own saves rename the index into place just after the state, so allow
+   a little slack */
 static int
-is_savestate_name( const char* name )
+savestate_index_current( const char *dir, const char *filename )
 {
-  char* filename;
-  char* extension;
+  struct stat dir_info, index_info;
 
-  if ( !name ) return 0;
+  if ( stat( filename, &index_info ) || stat( dir, &dir_info ) ) return 0;
 
-  /* Compare if name is valid */
-  filename = utils_last_filename( name, 0 );
-  if ( !filename ) return 0;
+  return dir_info.st_mtime <= index_info.st_mtime + 2 &&
+         ( !index_dir || index_info.st_mtime == index_mtime );
+}
 
-  /* nn.xxx */
-  if ( strlen( filename ) != 6 ) {
+int
+savestate_index_refresh( void )
+{
+  char *dir, *filename;
+  utils_file file;
+
+#ifdef HAVE_PTHREAD
+  /* The writer thread may be about to replace the index */
+  savestate_write_wait();
+#endif
+
+  dir = quicksave_get_current_dir();
+  if ( !dir ) {
+    savestate_index_clear();
+    return 1;
+  }
+
+  filename = savestate_index_filename( dir );
+
+  if ( index_dir && !strcmp( dir, index_dir ) &&
+       savestate_index_current( dir, filename ) ) {
     libspectrum_free( filename );
+    libspectrum_free( dir );
     return 0;
   }
 
-  /* Verify that extension is the configured for savestates */
-  extension = strrchr( filename, '.' );
-  if ( extension ) {
-    if ( strncmp( extension, settings_current.od_quicksave_format, 4 ) ) {
-      libspectrum_free( filename );
-      return 0;
+  savestate_index_clear();
+  index_dir = dir;
+
+  if ( check_dir_exist( dir ) != 1 ) {
+    /* Nothing saved for this program yet */
+    index_mtime = 0;
+  } else if ( savestate_index_current( dir, filename ) &&
+              !utils_read_file( filename, &file ) ) {
+    struct stat stat_info;
+
+    if ( savestate_index_parse( &file ) ) {
+      savestate_index_clear_slots();
+      savestate_index_rebuild();
+    } else if ( !stat( filename, &stat_info ) ) {
+      index_mtime = stat_info.st_mtime;
     }
+    utils_close_file( &file );
   } else {
-    libspectrum_free( filename );
-    return 0;
+    savestate_index_rebuild();
   }
 
-  /* Verify that the name are digits */
-  if ( !isdigit( filename[0] ) || !isdigit( filename[1]) ) {
-    libspectrum_free( filename );
-    return 0;
-  }
+  libspectrum_free( filename );
+
+  return 0;
+}
+
+/* Note in the index that `slot' has just been saved with the current
+   screen. Returns the new index to write out, or NULL if the index had
+   to be dropped */
+static libspectrum_byte*
+savestate_index_saved( int slot, size_t *length )
+{
+  char *dir, *filename;
+  int current;
+
+  dir = quicksave_get_current_dir();
+  if ( !dir ) return NULL;
 
+  filename = savestate_index_filename( dir );
+  current = index_dir && !strcmp( dir, index_dir ) &&
+            ( !index_mtime || savestate_index_current( dir, filename ) );
   libspectrum_free( filename );
 
-  /* Name is OK */
-  return 1;
+  /* If we don't hold the index for this directory, don't go and build
+     it now; just make sure it's rebuilt next time it's needed */
+  if ( !current ) {
+    savestate_index_drop( dir );
+    libspectrum_free( dir );
+    return NULL;
+  }
+  libspectrum_free( dir );
+
+  index_slots[ slot ].saved = time( NULL );
+  if ( !index_slots[ slot ].screen )
+    index_slots[ slot ].screen =
+      libspectrum_new( libspectrum_byte, SAVESTATE_SCREEN_LENGTH );
+  memcpy( index_slots[ slot ].screen, RAM[ memory_current_screen ],
+          SAVESTATE_SCREEN_LENGTH );
+
+  return savestate_index_serialise( length );
+}
+
+int
+savestate_slot_used( int slot )
+{
+  return slot >= 0 && slot < MAX_SAVESTATES && index_slots[ slot ].saved;
+}
+
+char*
+savestate_slot_last_change( int slot )
+{
+  char last_change[26];
+  time_t saved;
+
+  if ( !savestate_slot_used( slot ) ) return NULL;
+
+  saved = index_slots[ slot ].saved;
+  ctime_r( &saved, last_change );
+
+  /* Get rid of \n */
+  last_change[ strlen( last_change ) - 1 ] = '\0';
+
+  return utils_safe_strdup( last_change );
 }
 
+/* With od_quicksave_compress off, RAM pages are stored as they are. The
+   files are bigger, but deflating the RAM is most of the time taken to
+   save a state, and inflating it much of the time taken to load one */
 static int
-scan_directory_for_savestates( const char* dir, int (*check_fn)(const char*) )
+savestate_write_flags( void )
 {
-  compat_dir directory;
-  int done = 0;
-  int exist = 0;
+  return settings_current.od_quicksave_compress ?
+         0 : LIBSPECTRUM_FLAG_SNAPSHOT_NO_COMPRESSION;
+}
 
-  if ( !dir ) return 0;
+static void
+savestate_write_done( int slot, int error )
+{
+  if ( error )
+    ui_error( UI_ERROR_ERROR, "Error saving state to slot %02d", slot );
+  else
+    #ifdef MIYOO    
+    ui_widget_show_msg_update_info( "Saved to slot %02d", slot );
+    #else
+    ui_widget_show_msg_update_info( "Saved to slot %02d (%s)", slot, get_savestate_last_change( slot ) );
+    #endif
+}
 
-  directory = compat_opendir( dir );
-  if( !directory ) return 0;
+/*
+ * The last few states loaded or saved are kept decoded in memory, so
+ * that flipping between slots doesn't mean reading and decompressing
+ * the file every time. An entry is only used while the file's size and
+ * modification time are as they were when it was cached
+ */
 
-  while( !done ) {
-    char name[ PATH_MAX ];
+#define SAVESTATE_CACHE_SIZE 3
 
-    compat_dir_result_t result = compat_readdir( directory, name, sizeof( name ) );
+typedef struct savestate_cache_entry {
 
-    switch( result ) {
-    case COMPAT_DIR_RESULT_OK:
-      if ( check_fn( name ) ) {
-        exist = 1;
-        done = 1;
-      }
-      break;
+  char *filename;
+  time_t mtime;
+  off_t size;
 
-    case COMPAT_DIR_RESULT_END:
-      done = 1;
-      break;
+  libspectrum_snap *snap;
+  unsigned long last_used;
 
-    case COMPAT_DIR_RESULT_ERROR:
-      compat_closedir( directory );
-      return 0;
-    }
+} savestate_cache_entry;
+
+static savestate_cache_entry savestate_cache[ SAVESTATE_CACHE_SIZE ];
+static unsigned long savestate_cache_clock = 0;
+
+static void
+savestate_cache_free_entry( savestate_cache_entry *entry )
+{
+  if ( entry->snap ) libspectrum_snap_free( entry->snap );
+  libspectrum_free( entry->filename );
+  entry->snap = NULL;
+  entry->filename = NULL;
+}
+
+static void
+savestate_cache_clear( void )
+{
+  size_t i;
+
+  for ( i = 0; i < SAVESTATE_CACHE_SIZE; i++ )
+    savestate_cache_free_entry( &savestate_cache[i] );
+}
+
+static savestate_cache_entry*
+savestate_cache_find( const char *filename )
+{
+  size_t i;
+
+  for ( i = 0; i < SAVESTATE_CACHE_SIZE; i++ )
+    if ( savestate_cache[i].snap &&
+         !strcmp( savestate_cache[i].filename, filename ) )
+      return &savestate_cache[i];
+
+  return NULL;
+}
+
+/* Forget about `filename', which is about to be rewritten */
+static void
+savestate_cache_drop( const char *filename )
+{
+  savestate_cache_entry *entry = savestate_cache_find( filename );
+
+  if ( entry ) savestate_cache_free_entry( entry );
+}
+
+/* Return our copy of `filename' if it's still what's on disk */
+static libspectrum_snap*
+savestate_cache_lookup( const char *filename, const struct stat *stat_info )
+{
+  savestate_cache_entry *entry = savestate_cache_find( filename );
+
+  if ( !entry ) return NULL;
+
+  if ( entry->mtime != stat_info->st_mtime ||
+       entry->size != stat_info->st_size ) {
+    savestate_cache_free_entry( entry );
+    return NULL;
   }
 
-  if( compat_closedir( directory ) )
-    return 0;
+  entry->last_used = ++savestate_cache_clock;
 
-  return exist;
+  return entry->snap;
 }
 
+/* Keep `snap' as the contents of `filename', replacing the least
+   recently used entry if need be; the cache takes ownership of `snap' */
+static void
+savestate_cache_insert( const char *filename, const struct stat *stat_info,
+                        libspectrum_snap *snap )
+{
+  savestate_cache_entry *entry;
+  size_t i;
+
+  entry = savestate_cache_find( filename );
+  if ( !entry ) {
+    entry = &savestate_cache[0];
+    for ( i = 1; i < SAVESTATE_CACHE_SIZE && entry->snap; i++ )
+      if ( !savestate_cache[i].snap ||
+           savestate_cache[i].last_used < entry->last_used )
+        entry = &savestate_cache[i];
+  }
+
+  savestate_cache_free_entry( entry );
+
+  entry->filename = utils_safe_strdup( filename );
+  entry->mtime = stat_info->st_mtime;
+  entry->size = stat_info->st_size;
+  entry->snap = snap;
+  entry->last_used = ++savestate_cache_clock;
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * Savestates are written on a background thread: the machine state,
+ * RAM included, is copied into a libspectrum_snap in-frame, and the
+ * serialisation, compression and write to the card happen while the
+ * emulation carries on. The confirmation is shown from
+ * savestate_frame() once the write has finished
+ */
+
+typedef struct savestate_job {
+
+  libspectrum_snap *snap;
+  libspectrum_id_t type;
+  char *filename;
+  int slot;
+
+  int write_flags;		/* Passed on to libspectrum */
+  int flags;			/* Information lost in conversion */
+  int error;			/* 0, -1 for a libspectrum error, or errno */
+
+  libspectrum_byte *index;	/* The index to write afterwards, if any */
+  size_t index_length;
+  char *index_filename;
+  int index_error;
+
+} savestate_job;
+
+static writer_queue *savestate_writer = NULL;
+
+/* Serialise a job and write it out, followed by the index; runs on
+   the writer thread, so mustn't touch the UI */
 static int
-savetate_read_snapshot( char* snapshot, libspectrum_snap *snap, utils_file* file )
+savestate_write_job( savestate_job *job )
 {
+  unsigned char *buffer = NULL;
+  size_t length = 0;
   int error;
 
-  if ( !snapshot || !compat_file_exists( snapshot ))
-    return 1;
+  error = libspectrum_snap_write( &buffer, &length, &job->flags, job->snap,
+                                  job->type, fuse_creator, job->write_flags );
+  if ( error ) return -1;
 
-  error = utils_read_file( snapshot, file );
-  if( error )
-    return error;
+  error = savestate_write_file( job->filename, buffer, length, 1 );
+  libspectrum_free( buffer );
+  if ( error ) return error;
 
-  error = libspectrum_snap_read( snap, file->buffer, file->length,
-                         LIBSPECTRUM_ID_UNKNOWN, snapshot );
-  if( error ) {
-    utils_close_file( file );
-    return error;
+  if ( job->index )
+    job->index_error = savestate_write_file( job->index_filename, job->index,
+                                             job->index_length, 0 );
+
+  return 0;
+}
+
+static void
+savestate_job_write( void *data )
+{
+  savestate_job *job = data;
+
+  job->error = savestate_write_job( job );
+}
+
+static void
+savestate_job_free( savestate_job *job )
+{
+  if ( job->snap ) libspectrum_snap_free( job->snap );
+  libspectrum_free( job->filename );
+  libspectrum_free( job->index );
+  libspectrum_free( job->index_filename );
+  libspectrum_free( job );
+}
+
+static void
+savestate_job_report( savestate_job *job )
+{
+  struct stat stat_info;
+
+  /* The index we wrote claims the state was saved, so if it wasn't, or
+     the index couldn't be written, start again from what's on disk */
+  if ( job->index ) {
+    if ( job->error || job->index_error ||
+         stat( job->index_filename, &stat_info ) )
+      savestate_index_clear();
+    else
+      index_mtime = stat_info.st_mtime;
   }
 
-  utils_close_file( file );
+  if ( job->error > 0 )
+    ui_error( UI_ERROR_ERROR, "couldn't write '%s': %s", job->filename,
+              strerror( job->error ) );
+
+  /* What we wrote is what we'd read back, unless something was lost on
+     the way */
+  if ( !job->error && !job->flags && !stat( job->filename, &stat_info ) ) {
+    savestate_cache_insert( job->filename, &stat_info, job->snap );
+    job->snap = NULL;
+  }
+
+  if ( job->flags & LIBSPECTRUM_FLAG_SNAPSHOT_MAJOR_INFO_LOSS ) {
+    ui_error(
+      UI_ERROR_WARNING,
+      "A large amount of information has been lost in conversion; the snapshot probably won't work"
+    );
+  } else if ( job->flags & LIBSPECTRUM_FLAG_SNAPSHOT_MINOR_INFO_LOSS ) {
+    ui_error(
+      UI_ERROR_WARNING,
+      "Some information has been lost in conversion; the snapshot may not work"
+    );
+  }
+
+  savestate_write_done( job->slot, job->error );
+
+  savestate_job_free( job );
+}
+
+static void
+savestate_job_done( void *job )
+{
+  savestate_job_report( job );
+}
+
+static void
+savestate_job_discard( void *job )
+{
+  savestate_job_free( job );
+}
+
+/* Wait for any write in progress to finish, and report on it */
+static void
+savestate_write_wait( void )
+{
+  if ( savestate_writer ) writer_queue_wait( savestate_writer );
+}
+
+/* Copy the current state and hand it to the writer thread. Returns
+   non-zero if the thread isn't available */
+static int
+savestate_write_start( int slot, const char *filename )
+{
+  libspectrum_class_t class;
+  savestate_job *job;
+  int error;
+
+  savestate_write_wait();
+
+  if ( !savestate_writer ) {
+    savestate_writer = writer_queue_start( "savestate", savestate_job_write,
+                                           savestate_job_done, 0 );
+    if ( !savestate_writer ) return 1;
+  }
+
+  savestate_cache_drop( filename );
+
+  job = libspectrum_new( savestate_job, 1 );
+  job->slot = slot;
+  job->write_flags = savestate_write_flags();
+  job->flags = 0;
+  job->error = 0;
+  job->filename = utils_safe_strdup( filename );
+
+  job->index = savestate_index_saved( slot, &job->index_length );
+  job->index_filename = job->index ? savestate_index_filename( index_dir )
+                                   : NULL;
+  job->index_error = 0;
+
+  /* As snapshot_write(), default to .szx if we can't tell from the name */
+  error = libspectrum_identify_file_with_class( &job->type, &class, filename,
+                                                NULL, 0 );
+  if ( error || class != LIBSPECTRUM_CLASS_SNAPSHOT ||
+       job->type == LIBSPECTRUM_ID_UNKNOWN )
+    job->type = LIBSPECTRUM_ID_SNAPSHOT_SZX;
+
+  job->snap = libspectrum_snap_alloc();
+  error = snapshot_copy_to( job->snap );
+  if ( error ) {
+    if ( job->index ) savestate_index_clear();
+    savestate_job_free( job );
+    ui_error( UI_ERROR_ERROR, "Error saving state to slot %02d", slot );
+    return 0;
+  }
+
+  writer_queue_push( savestate_writer, job, 0, 1 );
 
   return 0;
 }
 
-int
-savestate_get_screen_for_slot( int slot, utils_file* screen )
+static void
+savestate_writer_end( void )
 {
-  utils_file file;
-  char* savestate;
+  if ( !savestate_writer ) return;
+
+  writer_queue_stop( savestate_writer, savestate_job_discard );
+  savestate_writer = NULL;
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+static void
+savestate_end( void )
+{
+#ifdef HAVE_PTHREAD
+  savestate_writer_end();
+#endif
+  savestate_cache_clear();
+  savestate_tape_ready_forget();
+}
+
+static int
+savestate_write_internal( int slot )
+{
+  char* filename;
+  libspectrum_byte *index;
+  size_t index_length;
   int error;
+
+  filename = quicksave_get_filename( slot );
+  if ( !filename ) return 1;
+
+  if ( quicksave_create_dir() ) return 1;
+
+#ifdef HAVE_PTHREAD
+  if ( !savestate_write_start( slot, filename ) ) {
+    libspectrum_free( filename );
+    return 0;
+  }
+#endif
+
+  /* Check the index before the directory changes under it */
+  index = savestate_index_saved( slot, &index_length );
+
+  savestate_cache_drop( filename );
+  error = snapshot_write_flags( filename, savestate_write_flags() );
+  if ( index ) {
+    if ( error )
+      savestate_index_clear();
+    else
+      savestate_index_write();
+    libspectrum_free( index );
+  }
+
+  savestate_write_done( slot, error );
+
+  libspectrum_free( filename );
+
+  return error;
+}
+
+/* Load `filename', from the cache if we can */
+static int
+savestate_load_file( const char *filename )
+{
+  struct stat stat_info;
   libspectrum_snap *snap;
-  int page;
+  utils_file file;
+  int error = 0;
 
-  /* Initialize screenshot to black */
-  screen->length = 6912;
-  screen->buffer = libspectrum_new( unsigned char, screen->length );
-  memset( screen->buffer, 0, screen->length );
+  if( rzx_recording ) error = rzx_stop_recording();
+  if( rzx_playback  ) error = rzx_stop_playback( 1 );
+  if( error ) return error;
+
+  if ( stat( filename, &stat_info ) ) return 1;
 
-  savestate = quicksave_get_filename( slot );
+  snap = savestate_cache_lookup( filename, &stat_info );
+  if ( snap ) {
+    error = snapshot_copy_from( snap );
+    if ( error ) return error;
+    pokemem_find_pokfile( filename );
+    return 0;
+  }
+
+  if ( utils_read_file( filename, &file ) ) return 1;
 
   snap = libspectrum_snap_alloc();
+  error = libspectrum_snap_read( snap, file.buffer, file.length,
+                                 LIBSPECTRUM_ID_UNKNOWN, filename );
+  utils_close_file( &file );
+  if ( error ) { libspectrum_snap_free( snap ); return error; }
 
-  error = savetate_read_snapshot( savestate, snap, &file );
+  error = snapshot_copy_from( snap );
+  if ( error ) { libspectrum_snap_free( snap ); return error; }
 
-  libspectrum_free( savestate );
+  savestate_cache_insert( filename, &stat_info, snap );
+  pokemem_find_pokfile( filename );
 
-  if( error ) {
-    libspectrum_snap_free( snap );
-    return error;
-  }
+  return 0;
+}
 
-  switch ( libspectrum_snap_machine( snap ) ) {
-  case LIBSPECTRUM_MACHINE_PENT:
-  case LIBSPECTRUM_MACHINE_PENT512:
-  case LIBSPECTRUM_MACHINE_PENT1024:
-  case LIBSPECTRUM_MACHINE_SCORP:
-  case LIBSPECTRUM_MACHINE_PLUS3E:
-  case LIBSPECTRUM_MACHINE_PLUS2A:
-  case LIBSPECTRUM_MACHINE_PLUS3:
-  case LIBSPECTRUM_MACHINE_PLUS2:
-  case LIBSPECTRUM_MACHINE_128:
-  case LIBSPECTRUM_MACHINE_128E:
-  case LIBSPECTRUM_MACHINE_SE:
-    page = libspectrum_snap_out_128_memoryport( snap ) & 0x08 ? 7 : 5;
-    break;
-  default:
-    page = 5;
-    break;
-  }
-  memcpy(screen->buffer, libspectrum_snap_pages( snap, page ), screen->length);
+static int
+savestate_read_internal( int slot )
+{
+  char* filename;
 
-  error = libspectrum_snap_free( snap );
-  if( error )
-    return error;
+#ifdef HAVE_PTHREAD
+  /* Make sure we load what was last saved */
+  savestate_write_wait();
+#endif
+
+  /* If don't exist savestate return */
+  if ( !check_current_savestate_exist( slot ) ) return 1;
+
+  filename = quicksave_get_filename( slot );
+  if ( !filename ) return 1;
+
+  /* Not through utils_open_file(), so the last loaded filename and
+     control mapping files are left alone */
+  int error = savestate_load_file( filename );
+  if (error)
+    ui_error( UI_ERROR_ERROR, "Error loading state from slot %02d", slot );
+  else
+    #ifdef MIYOO    
+    ui_widget_show_msg_update_info( "Loaded slot %02d", slot );
+    #else
+    ui_widget_show_msg_update_info( "Loaded slot %02d (%s)", slot, get_savestate_last_change( slot ) );
+    #endif
+
+  libspectrum_free( filename );
+
+  return error;
+}
+
+/* Get the screen for a slot from the index; savestate_index_refresh()
+   must have been called first */
+int
+savestate_get_screen_for_slot( int slot, utils_file* screen )
+{
+  /* Initialize screenshot to black */
+  screen->length = SAVESTATE_SCREEN_LENGTH;
+  screen->mapped = 0;
+  screen->buffer = libspectrum_new( unsigned char, screen->length );
+  memset( screen->buffer, 0, screen->length );
+
+  if ( !savestate_slot_used( slot ) || !index_slots[ slot ].screen )
+    return 1;
+
+  memcpy( screen->buffer, index_slots[ slot ].screen, screen->length );
 
   return 0;
 }
 
-char*
-quicksave_get_current_dir(void)
+/* The savestate directory for the program in `loaded' */
+static char*
+savestate_get_dir( const char *loaded )
 {
   const char* cfgdir;
   char buffer[ PATH_MAX ];
   char* filename;
 
-  if ( !last_filename ) return NULL;
-
   /* Don't exist config path, no error but do nothing */
   cfgdir = compat_get_config_path(); if( !cfgdir ) return NULL;
 
-  filename = quicksave_get_current_program();
+  filename = compat_chop_expressions( re_expressions,
+                                      utils_last_filename( loaded, 1 ) );
 
   if (settings_current.od_quicksave_per_machine) {
       snprintf( buffer, PATH_MAX, "%s"FUSE_DIR_SEP_STR"%s"FUSE_DIR_SEP_STR"%s"FUSE_DIR_SEP_STR"%s",
@@ -306,15 +925,17 @@ quicksave_get_current_dir(void)
   return utils_safe_strdup( buffer );
 }
 
-int
-quicksave_create_dir(void)
+char*
+quicksave_get_current_dir(void)
 {
-  char* savestate_dir;
+  if ( !last_filename ) return NULL;
 
-  /* Can not determine savestate_dir */
-  savestate_dir = quicksave_get_current_dir();
-  if( !savestate_dir ) return 1;
+  return savestate_get_dir( last_filename );
+}
 
+static int
+savestate_create_dir( char *savestate_dir )
+{
   /* Create if don't exist */
   int exist = check_dir_exist( savestate_dir );
   if( !exist ) {
@@ -327,9 +948,24 @@ quicksave_create_dir(void)
      return 1;
   }
 
+  return 0;
+}
+
+int
+quicksave_create_dir(void)
+{
+  char* savestate_dir;
+  int error;
+
+  /* Can not determine savestate_dir */
+  savestate_dir = quicksave_get_current_dir();
+  if( !savestate_dir ) return 1;
+
+  error = savestate_create_dir( savestate_dir );
+
   libspectrum_free( savestate_dir );
 
-  return 0;
+  return error;
 }
 
 char*
@@ -400,29 +1036,14 @@ check_current_savestate_exist_savename( char* savename )
 int
 check_any_savestate_exist(void)
 {
-  char* savestate_dir;
-
-  /* Can not determine savestate_dir */
-  savestate_dir = quicksave_get_current_dir();
-  if( !savestate_dir ) return 0;
+  int i;
 
-  if ( !check_dir_exist( savestate_dir ) ) {
-    libspectrum_free(savestate_dir);
-    return 0;
-  }
+  if ( savestate_index_refresh() ) return 0;
 
-  /* Is directory previously checked? */
-  if ( !last_check_directory || strcmp( savestate_dir, last_check_directory ) ) {
-    last_check_directory = utils_safe_strdup( savestate_dir );
-    last_check_directory_result = 0;
-  /* If directory contain savestates previously */
-  } else if ( !last_check_directory_result ) {
-    last_check_directory_result = scan_directory_for_savestates( savestate_dir, is_savestate_name );
-  }
+  for ( i = 0; i < MAX_SAVESTATES; i++ )
+    if ( savestate_slot_used( i ) ) return 1;
 
-  libspectrum_free( savestate_dir );
-
-  return last_check_directory_result;
+  return 0;
 }
 
 int
@@ -461,6 +1082,15 @@ get_savestate_last_change(int slot) {
   compat_fd save_state_fd;
   char* last_change;
   char* filename;
+  char* dir;
+  int indexed;
+
+  /* Use the index if we have it, but don't go and build it just for
+     this */
+  dir = quicksave_get_current_dir();
+  indexed = dir && index_dir && !strcmp( dir, index_dir );
+  libspectrum_free( dir );
+  if ( indexed ) return savestate_slot_last_change( slot );
 
   if ( !check_current_savestate_exist( slot ) )
     return NULL;
@@ -499,9 +1129,194 @@ quicksave_load(void)
   return error;
 }
 
+/*
+ * With od_tape_ready_cache, the state of the machine once an autoloaded
+ * tape has finished loading is saved in the program's savestate
+ * directory, so the next time the same tape is autoloaded it starts
+ * straight away. A tape counts as loaded once it has been stopped by
+ * the loader detection, the tape itself or a handover to the ROM loader
+ * traps, and then not started again for a couple of seconds. The state
+ * is keyed on a hash of the tape, the machine and its ROMs, and next to
+ * it is kept the tape block to carry on from
+ */
+
+/* How many frames a tape must stay stopped before it counts as loaded */
+#define SAVESTATE_READY_FRAMES 100
+
+/* Where the state for the tape being watched goes; NULL if none is */
+static char *ready_state;
+static int ready_frames_left;
+
+static libspectrum_qword
+savestate_ready_hash( libspectrum_qword hash, const libspectrum_byte *data,
+                      size_t length )
+{
+  while ( length-- ) {
+    hash ^= *data++;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+/* The ready state for this tape on this machine, or NULL if it isn't
+   known where it would go */
+static char*
+savestate_ready_filename( const char *filename, const libspectrum_byte *buffer,
+                          size_t length )
+{
+  libspectrum_qword hash = 0xcbf29ce484222325ULL;
+  libspectrum_byte machine;
+  char *dir, path[ PATH_MAX ];
+  size_t i;
+
+  if ( !filename ) return NULL;
+
+  dir = savestate_get_dir( filename );
+  if ( !dir ) return NULL;
+
+  hash = savestate_ready_hash( hash, buffer, length );
+
+  machine = machine_current->machine;
+  hash = savestate_ready_hash( hash, &machine, 1 );
+
+  for ( i = 0; i < SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K; i++ )
+    if ( memory_map_rom[ i ].page )
+      hash = savestate_ready_hash( hash, memory_map_rom[ i ].page,
+                                   MEMORY_PAGE_SIZE );
+
+  snprintf( path, PATH_MAX, "%s"FUSE_DIR_SEP_STR"ready-%016llx",
+            dir, (unsigned long long)hash );
+
+  libspectrum_free( dir );
+
+  return utils_safe_strdup( path );
+}
+
+int
+savestate_tape_ready_restore( const char *filename,
+                              const libspectrum_byte *buffer, size_t length )
+{
+  char *base, state[ PATH_MAX ], position[ PATH_MAX ];
+  utils_file file;
+  int block = 0;
+
+  savestate_tape_ready_forget();
+
+  if ( !settings_current.od_tape_ready_cache || rzx_recording ||
+       rzx_playback )
+    return 1;
+
+  base = savestate_ready_filename( filename, buffer, length );
+  if ( !base ) return 1;
+
+  snprintf( state, PATH_MAX, "%s.szx", base );
+  snprintf( position, PATH_MAX, "%s.pos", base );
+  libspectrum_free( base );
+
+  if ( compat_file_exists( state ) && compat_file_exists( position ) &&
+       !utils_read_file( position, &file ) ) {
+
+    if ( file.length < 16 ) {
+      char text[ 16 ];
+      memcpy( text, file.buffer, file.length ); text[ file.length ] = '\0';
+      block = atoi( text );
+    }
+    utils_close_file( &file );
+
+    if ( !savestate_load_file( state ) ) {
+      if ( block > 0 ) tape_select_block( block );
+      return 0;
+    }
+  }
+
+  /* Not cached yet; save it once this load has finished */
+  ready_state = utils_safe_strdup( state );
+  ready_frames_left = 0;
+
+  return 1;
+}
+
+void
+savestate_tape_ready_forget( void )
+{
+  libspectrum_free( ready_state );
+  ready_state = NULL;
+  ready_frames_left = 0;
+}
+
+void
+savestate_tape_ready_stopped( void )
+{
+  if ( ready_state ) ready_frames_left = SAVESTATE_READY_FRAMES;
+}
+
+void
+savestate_tape_ready_started( void )
+{
+  ready_frames_left = 0;
+}
+
+static void
+savestate_tape_ready_save( void )
+{
+  char *dir, position[ PATH_MAX ], text[ 16 ];
+  int error;
+
+  dir = utils_safe_strdup( ready_state );
+  *strrchr( dir, FUSE_DIR_SEP_CHR ) = '\0';
+  error = savestate_create_dir( dir );
+  libspectrum_free( dir );
+
+  if ( !error ) error = snapshot_write( ready_state );
+
+  if ( !error ) {
+    snprintf( position, PATH_MAX, "%.*s.pos",
+              (int)( strlen( ready_state ) - 4 ), ready_state );
+    snprintf( text, sizeof( text ), "%d\n", tape_get_current_block() );
+    error = savestate_write_file( position, (unsigned char*)text,
+                                  strlen( text ), 0 );
+    if ( error ) unlink( ready_state );
+  }
+
+  if ( error )
+    ui_error( UI_ERROR_WARNING, "couldn't save the loaded state of the tape" );
+
+  savestate_tape_ready_forget();
+}
+
+void
+savestate_register_startup( void )
+{
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_LIBSPECTRUM
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_SAVESTATES, dependencies,
+                            ARRAY_SIZE( dependencies ), NULL, NULL,
+                            savestate_end );
+}
+
+void
+savestate_frame( void )
+{
+  if ( ready_frames_left && !--ready_frames_left && ready_state &&
+       !tape_is_playing() && !rzx_recording && !rzx_playback )
+    savestate_tape_ready_save();
+
+#ifdef HAVE_PTHREAD
+  if ( savestate_writer ) writer_queue_poll( savestate_writer );
+#endif
+}
+
 int
 quicksave_save(void)
 {
+#ifdef HAVE_PTHREAD
+  /* The state is copied in-frame and written out in the background, so
+     there's no need to stop the emulation */
+  return savestate_write_internal( settings_current.od_quicksave_slot );
+#endif
+
   fuse_emulation_pause();
 
   int error = savestate_write_internal( settings_current.od_quicksave_slot );
@@ -25,6 +25,19 @@
 
 #define MAX_SAVESTATES 100
 
+void savestate_register_startup( void );
+
+/* Called once a frame from the UI to report on savestates which have
+   finished being written in the background */
+void savestate_frame( void );
+
+/* Make sure the savestate index describes the current savestate
+   directory; savestate_slot_used(), savestate_slot_last_change() and
+   savestate_get_screen_for_slot() look only at the index */
+int savestate_index_refresh( void );
+int savestate_slot_used( int slot );
+char* savestate_slot_last_change( int slot );
+
 int quicksave_create_dir(void);
 char* quicksave_get_filename(int slot);
 char* quicksave_get_current_program(void);
@@ -41,4 +54,16 @@ int savestate_write( const char *savestate );
 int savestate_read( const char *savestate );
 int savestate_get_screen_for_slot( int slot, utils_file* screen );
 
+/* The state an autoloaded tape reaches once it has loaded. Restoring
+   returns 0 if the state for this tape was there and has been loaded;
+   otherwise it's saved once this load finishes. The tape code says when
+   the tape is started or stopped automatically, and forgets about the
+   load when the tape is closed */
+int savestate_tape_ready_restore( const char *filename,
+                                  const libspectrum_byte *buffer,
+                                  size_t length );
+void savestate_tape_ready_forget( void );
+void savestate_tape_ready_started( void );
+void savestate_tape_ready_stopped( void );
+
 #endif /* FUSE_SAVESTATES_H */
\ No newline at end of file
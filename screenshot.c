@@ -25,12 +25,15 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <libspectrum.h>
 
 #include "display.h"
+#include "fuse.h"
 #include "infrastructure/startup_manager.h"
+#include "infrastructure/writer_queue.h"
 #include "machine.h"
 #include "peripherals/scld.h"
 #include "screenshot.h"
@@ -53,8 +56,32 @@
 #include <zlib.h>
 #endif				/* #ifdef HAVE_ZLIB_H */
 
-static int get_rgb32_data( libspectrum_byte *rgb32_data, size_t stride,
-			   size_t height, size_t width );
+/* A screenshot waiting to be, or being, written. The screen is captured
+   as palette indices; everything after that can be done away from the
+   emulation */
+typedef struct screenshot_job {
+
+  char *filename;
+  scaler_type scaler;
+  int bw_tv;
+
+  libspectrum_byte *pixels;
+  size_t width, height;
+
+  enum {
+    SCREENSHOT_OK,
+    SCREENSHOT_ERROR_OPEN,
+    SCREENSHOT_ERROR_PNG_PTR,
+    SCREENSHOT_ERROR_INFO_PTR,
+    SCREENSHOT_ERROR_LIBPNG,
+    SCREENSHOT_ERROR_CLOSE,
+  } error;
+  int error_errno;
+
+} screenshot_job;
+
+static void get_rgb32_data( libspectrum_byte *rgb32_data, size_t stride,
+                            const screenshot_job *job );
 static int rgb32_to_rgb24( libspectrum_byte *rgb24_data, size_t rgb24_stride,
 			   libspectrum_byte *rgb32_data, size_t rgb32_stride,
 			   size_t height, size_t width );
@@ -74,8 +101,12 @@ static libspectrum_byte *rgb_data = NULL;
 static libspectrum_byte *scaled_data;
 static libspectrum_byte *png_data = NULL;
 
-int
-screenshot_write( const char *filename, scaler_type scaler )
+static writer_queue *screenshot_writer = NULL;
+
+/* Scale and compress a captured screen and write it out; may run on the
+   writer thread, so mustn't touch the UI or the emulation */
+static void
+screenshot_encode( screenshot_job *job )
 {
   FILE *f;
 
@@ -87,16 +118,7 @@ screenshot_write( const char *filename, scaler_type scaler )
   size_t rgb_stride = ( DISPLAY_ASPECT_WIDTH + K_MARGIN * 2 ) * 4,
          scaled_stride = MAX_SIZE * DISPLAY_ASPECT_WIDTH * 4,
          png_stride = MAX_SIZE * DISPLAY_ASPECT_WIDTH * 3;
-  size_t y, base_height, base_width, height, width;
-  int error;
-
-  if( machine_current->timex ) {
-    base_height = 2 * DISPLAY_SCREEN_HEIGHT;
-    base_width = DISPLAY_SCREEN_WIDTH; 
-  } else {
-    base_height = DISPLAY_SCREEN_HEIGHT;
-    base_width = DISPLAY_ASPECT_WIDTH;
-  }
+  size_t y, base_height = job->height, base_width = job->width, height, width;
 
   /* Allocate buffers on demand */
   if( !rgb_data )
@@ -117,59 +139,57 @@ screenshot_write( const char *filename, scaler_type scaler )
   rgb_data_centered = rgb_data + K_MARGIN * rgb_stride + K_MARGIN * 4;
 
   /* Change from paletted data to RGB data */
-  error = get_rgb32_data( rgb_data_centered, rgb_stride, base_height,
-                          base_width );
-  if( error ) return error;
+  get_rgb32_data( rgb_data_centered, rgb_stride, job );
 
   /* Initialise margin for scalers that "smear" the screen */
-  if( scaler_get_flags( scaler ) & SCALER_FLAGS_EXPAND )
+  if( scaler_get_flags( job->scaler ) & SCALER_FLAGS_EXPAND )
     fill_rgb32_margin( rgb_data, rgb_stride, base_height, base_width );
 
   /* Actually scale the data here */
-  scaler_get_proc32( scaler )( rgb_data_centered, rgb_stride, scaled_data,
-                               scaled_stride, base_width, base_height );
+  scaler_get_proc32( job->scaler )( rgb_data_centered, rgb_stride,
+                                    scaled_data, scaled_stride, base_width,
+                                    base_height );
 
-  height = base_height * scaler_get_scaling_factor( scaler );
-  width  = base_width  * scaler_get_scaling_factor( scaler );
+  height = base_height * scaler_get_scaling_factor( job->scaler );
+  width  = base_width  * scaler_get_scaling_factor( job->scaler );
 
   /* Reduce from RGB(padding byte) to just RGB */
-  error = rgb32_to_rgb24( png_data, png_stride, scaled_data, scaled_stride,
-			  height, width );
-  if( error ) return error;
+  rgb32_to_rgb24( png_data, png_stride, scaled_data, scaled_stride,
+                  height, width );
 
   for( y = 0; y < height; y++ )
     row_pointers[y] = &png_data[ y * png_stride ];
 
-  f = fopen( filename, "wb" );
+  f = fopen( job->filename, "wb" );
   if( !f ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't open `%s': %s", filename,
-	      strerror( errno ) );
-    return 1;
+    job->error = SCREENSHOT_ERROR_OPEN;
+    job->error_errno = errno;
+    return;
   }
 
   png_ptr = png_create_write_struct( PNG_LIBPNG_VER_STRING,
 				     NULL, NULL, NULL );
   if( !png_ptr ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't allocate png_ptr" );
+    job->error = SCREENSHOT_ERROR_PNG_PTR;
     fclose( f );
-    return 1;
+    return;
   }
 
   info_ptr = png_create_info_struct( png_ptr );
   if( !info_ptr ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't allocate info_ptr" );
+    job->error = SCREENSHOT_ERROR_INFO_PTR;
     png_destroy_write_struct( &png_ptr, NULL );
     fclose( f );
-    return 1;
+    return;
   }
 
   /* Set up the error handling; libpng will return to here if it
      encounters an error */
   if( setjmp( png_jmpbuf( png_ptr ) ) ) {
-    ui_error( UI_ERROR_ERROR, "Error from libpng" );
+    job->error = SCREENSHOT_ERROR_LIBPNG;
     png_destroy_write_struct( &png_ptr, &info_ptr );
     fclose( f );
-    return 1;
+    return;
   }
 
   png_init_io( png_ptr, f );
@@ -191,17 +211,146 @@ screenshot_write( const char *filename, scaler_type scaler )
   png_destroy_write_struct( &png_ptr, &info_ptr );
 
   if( fclose( f ) ) {
-    ui_error( UI_ERROR_ERROR, "Couldn't close `%s': %s", filename,
-	      strerror( errno ) );
-    return 1;
+    job->error = SCREENSHOT_ERROR_CLOSE;
+    job->error_errno = errno;
+    return;
   }
+}
 
-  return 0;
+static void
+screenshot_job_free( screenshot_job *job )
+{
+  libspectrum_free( job->filename );
+  libspectrum_free( job->pixels );
+  libspectrum_free( job );
 }
 
+/* Tell the user how a screenshot went; must be called from the main
+   thread */
 static int
+screenshot_job_report( screenshot_job *job )
+{
+  int error = job->error != SCREENSHOT_OK;
+
+  switch( job->error ) {
+
+  case SCREENSHOT_OK:
+#if defined GCWZERO && defined USE_WIDGET
+    ui_widget_show_msg_update_info( "Screenshot saved" );
+#endif
+    break;
+
+  case SCREENSHOT_ERROR_OPEN:
+    ui_error( UI_ERROR_ERROR, "Couldn't open `%s': %s", job->filename,
+	      strerror( job->error_errno ) );
+    break;
+
+  case SCREENSHOT_ERROR_PNG_PTR:
+    ui_error( UI_ERROR_ERROR, "Couldn't allocate png_ptr" );
+    break;
+
+  case SCREENSHOT_ERROR_INFO_PTR:
+    ui_error( UI_ERROR_ERROR, "Couldn't allocate info_ptr" );
+    break;
+
+  case SCREENSHOT_ERROR_LIBPNG:
+    ui_error( UI_ERROR_ERROR, "Error from libpng" );
+    break;
+
+  case SCREENSHOT_ERROR_CLOSE:
+    ui_error( UI_ERROR_ERROR, "Couldn't close `%s': %s", job->filename,
+	      strerror( job->error_errno ) );
+    break;
+
+  }
+
+  screenshot_job_free( job );
+
+  return error;
+}
+
+static void
+screenshot_job_write( void *job )
+{
+  screenshot_encode( job );
+}
+
+static void
+screenshot_job_done( void *job )
+{
+  screenshot_job_report( job );
+}
+
+static void
+screenshot_job_discard( void *job )
+{
+  screenshot_job_free( job );
+}
+
+/* Wait for any screenshot in progress to finish, and report on it */
+static void
+screenshot_write_wait( void )
+{
+  if( screenshot_writer ) writer_queue_wait( screenshot_writer );
+}
+
+/* Hand a job to the writer thread. Returns non-zero if the thread isn't
+   available */
+static int
+screenshot_write_start( screenshot_job *job )
+{
+  screenshot_write_wait();
+
+  if( !screenshot_writer ) {
+    screenshot_writer = writer_queue_start( "screenshot",
+                                            screenshot_job_write,
+                                            screenshot_job_done, 0 );
+    if( !screenshot_writer ) return 1;
+  }
+
+  writer_queue_push( screenshot_writer, job, 0, 1 );
+
+  return 0;
+}
+
+/* Write a PNG of the current screen. With threads, this only captures
+   the screen; the result is reported from screenshot_frame() once the
+   file has been written */
+int
+screenshot_write( const char *filename, scaler_type scaler )
+{
+  screenshot_job *job;
+  size_t x, y;
+
+  job = libspectrum_new( screenshot_job, 1 );
+  job->filename = utils_safe_strdup( filename );
+  job->scaler = scaler;
+  job->bw_tv = settings_current.bw_tv;
+  job->error = SCREENSHOT_OK;
+  job->error_errno = 0;
+
+  if( machine_current->timex ) {
+    job->height = 2 * DISPLAY_SCREEN_HEIGHT;
+    job->width = DISPLAY_SCREEN_WIDTH; 
+  } else {
+    job->height = DISPLAY_SCREEN_HEIGHT;
+    job->width = DISPLAY_ASPECT_WIDTH;
+  }
+
+  job->pixels = libspectrum_new( libspectrum_byte, job->height * job->width );
+  for( y = 0; y < job->height; y++ )
+    for( x = 0; x < job->width; x++ )
+      job->pixels[ y * job->width + x ] = display_getpixel( x, y );
+
+  if( !screenshot_write_start( job ) ) return 0;
+
+  screenshot_encode( job );
+  return screenshot_job_report( job );
+}
+
+static void
 get_rgb32_data( libspectrum_byte *rgb32_data, size_t stride,
-		size_t height, size_t width )
+                const screenshot_job *job )
 {
   size_t i, x, y;
 
@@ -231,15 +380,15 @@ get_rgb32_data( libspectrum_byte *rgb32_data, size_t stride,
 			0.587 * palette[i][1] +
 			0.114 * palette[i][2]   ) + 0.5;
 
-  for( y = 0; y < height; y++ ) {
-    for( x = 0; x < width; x++ ) {
+  for( y = 0; y < job->height; y++ ) {
+    for( x = 0; x < job->width; x++ ) {
 
       size_t colour;
       libspectrum_byte red, green, blue;
 
-      colour = display_getpixel( x, y );
+      colour = job->pixels[ y * job->width + x ];
 
-      if( settings_current.bw_tv ) {
+      if( job->bw_tv ) {
 
 	red = green = blue = grey_palette[colour];
 
@@ -258,8 +407,6 @@ get_rgb32_data( libspectrum_byte *rgb32_data, size_t stride,
 
     }
   }
-
-  return 0;
 }
 
 static void
@@ -388,10 +535,22 @@ screenshot_available_scalers( scaler_type scaler )
 
 #endif				/* #ifdef USE_LIBPNG */
 
+void
+screenshot_frame( void )
+{
+#ifdef USE_LIBPNG
+  if( screenshot_writer ) writer_queue_poll( screenshot_writer );
+#endif
+}
+
 static void
 screenshot_end( void )
 {
 #ifdef USE_LIBPNG
+  if( screenshot_writer ) {
+    writer_queue_stop( screenshot_writer, screenshot_job_discard );
+    screenshot_writer = NULL;
+  }
   libspectrum_free( rgb_data ); rgb_data = NULL;
   libspectrum_free( scaled_data ); scaled_data = NULL;
   libspectrum_free( png_data ); png_data = NULL;
@@ -657,6 +816,7 @@ screenshot_scr_read( const char *filename )
 
   utils_close_file( &screen );
 
+  memory_ram_changed();
   display_refresh_all();
 
   return error;
@@ -700,6 +860,7 @@ screenshot_mlt_read( const char *filename )
 
   utils_close_file( &screen );
 
+  memory_ram_changed();
   display_refresh_all();
 
   return error;
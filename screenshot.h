@@ -30,6 +30,10 @@
 
 void screenshot_register_startup( void );
 
+/* Called once a frame to report on PNG screenshots which have finished
+   being written in the background */
+void screenshot_frame( void );
+
 #ifdef USE_LIBPNG
 
 int screenshot_write( const char *filename, scaler_type scaler );
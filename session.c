@@ -0,0 +1,300 @@
+/* session.c: Saving the session at exit and resuming it at startup
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "peripherals/disk/fdd.h"
+#include "peripherals/ide/divide.h"
+#include "peripherals/ide/divmmc.h"
+#include "peripherals/ide/simpleide.h"
+#include "peripherals/ide/zxatasp.h"
+#include "peripherals/ide/zxcf.h"
+#include "peripherals/ide/zxmmc.h"
+#include "peripherals/if1.h"
+#include "session.h"
+#include "settings.h"
+#include "snapshot.h"
+#include "tape.h"
+#include "ui/ui.h"
+#include "ui/uimedia.h"
+
+/* With --resume-session, the machine is written out as a snapshot when
+   Fuse exits normally and loaded back in on the next start if no other
+   files were given. The in-memory state used by rewind and run-ahead
+   can't be used for this as it holds pointers which are only good for
+   this run. Any tape is saved alongside the snapshot, with the block it
+   was at kept in a small text file. Disks, microdrive cartridges and
+   hard disks are put back in from the files they came from, which are
+   listed in another; dock and Interface 2 cartridges are part of the
+   snapshot. Media which has never been saved to a file can't come
+   back */
+
+static const char * const SESSION_SNAPSHOT = "fuse-session.szx";
+static const char * const SESSION_TAPE = "fuse-session.tzx";
+static const char * const SESSION_TAPE_BLOCK = "fuse-session.blk";
+static const char * const SESSION_MEDIA = "fuse-session.med";
+
+/* The most drives any disk interface has */
+#define SESSION_MAX_DRIVES 4
+
+/* The hard disks, which are only remembered in the settings until
+   they're ejected on the way out */
+typedef struct session_harddisk {
+  const char *name;
+  char **setting;
+  libspectrum_ide_unit unit;
+  int (*insert_unit)( const char *filename, libspectrum_ide_unit unit );
+  int (*insert)( const char *filename );
+} session_harddisk;
+
+static const session_harddisk harddisks[] = {
+  { "simpleide-master", &settings_current.simpleide_master_file,
+    LIBSPECTRUM_IDE_MASTER, simpleide_insert, NULL },
+  { "simpleide-slave", &settings_current.simpleide_slave_file,
+    LIBSPECTRUM_IDE_SLAVE, simpleide_insert, NULL },
+  { "zxatasp-master", &settings_current.zxatasp_master_file,
+    LIBSPECTRUM_IDE_MASTER, zxatasp_insert, NULL },
+  { "zxatasp-slave", &settings_current.zxatasp_slave_file,
+    LIBSPECTRUM_IDE_SLAVE, zxatasp_insert, NULL },
+  { "zxcf", &settings_current.zxcf_pri_file,
+    LIBSPECTRUM_IDE_MASTER, NULL, zxcf_insert },
+  { "divide-master", &settings_current.divide_master_file,
+    LIBSPECTRUM_IDE_MASTER, divide_insert, NULL },
+  { "divide-slave", &settings_current.divide_slave_file,
+    LIBSPECTRUM_IDE_SLAVE, divide_insert, NULL },
+  { "divmmc", &settings_current.divmmc_file,
+    LIBSPECTRUM_IDE_MASTER, NULL, divmmc_insert },
+  { "zxmmc", &settings_current.zxmmc_file,
+    LIBSPECTRUM_IDE_MASTER, NULL, zxmmc_insert },
+};
+
+/* Has this run's session already been written out? */
+static int session_saved = 0;
+
+static int
+session_path( char *buffer, const char *name )
+{
+  const char *cfgdir;
+
+  cfgdir = compat_get_config_path(); if( !cfgdir ) return 1;
+
+  snprintf( buffer, PATH_MAX, "%s" FUSE_DIR_SEP_STR "%s", cfgdir, name );
+
+  return 0;
+}
+
+static void
+session_remove( void )
+{
+  char path[ PATH_MAX ];
+
+  if( !session_path( path, SESSION_SNAPSHOT ) ) unlink( path );
+  if( !session_path( path, SESSION_TAPE ) ) unlink( path );
+  if( !session_path( path, SESSION_TAPE_BLOCK ) ) unlink( path );
+  if( !session_path( path, SESSION_MEDIA ) ) unlink( path );
+}
+
+static void
+session_harddisk_insert( const char *name, const char *filename )
+{
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( harddisks ); i++ ) {
+    if( strcmp( harddisks[i].name, name ) ) continue;
+
+    if( harddisks[i].insert_unit ) {
+      harddisks[i].insert_unit( filename, harddisks[i].unit );
+    } else {
+      harddisks[i].insert( filename );
+    }
+    return;
+  }
+}
+
+/* Put back the media listed in `filename' */
+static void
+session_media_resume( const char *filename )
+{
+  char line[ PATH_MAX + 64 ], name[ 32 ];
+  ui_media_drive_info_t *drive;
+  int controller, which, offset;
+  size_t length;
+  FILE *f;
+
+  f = fopen( filename, "r" );
+  if( !f ) return;
+
+  while( fgets( line, sizeof( line ), f ) ) {
+
+    length = strlen( line );
+    if( length && line[ length - 1 ] == '\n' ) line[ length - 1 ] = '\0';
+
+    if( sscanf( line, "disk %d %d %n", &controller, &which, &offset ) == 2 ) {
+      drive = ui_media_drive_find( controller, which );
+      if( drive && drive->is_available && drive->is_available() )
+        ui_media_drive_insert( drive, line + offset, 0 );
+    } else if( sscanf( line, "mdr %d %n", &which, &offset ) == 1 ) {
+      if1_mdr_insert( which, line + offset );
+    } else if( sscanf( line, "ide %31s %n", name, &offset ) == 1 ) {
+      session_harddisk_insert( name, line + offset );
+    }
+  }
+
+  fclose( f );
+}
+
+/* List the files the inserted media came from in `filename' */
+static int
+session_media_save( const char *filename )
+{
+  const ui_media_drive_info_t *drive;
+  const char *name;
+  int controller, which;
+  size_t i;
+  FILE *f;
+
+  f = fopen( filename, "w" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s' for writing", filename );
+    return 1;
+  }
+
+  for( controller = 0; controller <= UI_MEDIA_CONTROLLER_DIDAKTIK;
+       controller++ )
+    for( which = 0; which < SESSION_MAX_DRIVES; which++ ) {
+      drive = ui_media_drive_find( controller, which );
+      if( drive && drive->fdd && drive->fdd->loaded &&
+          drive->fdd->disk.filename )
+        fprintf( f, "disk %d %d %s\n", controller, which,
+                 drive->fdd->disk.filename );
+    }
+
+  for( which = 0; which < 8; which++ ) {
+    name = if1_mdr_filename( which );
+    if( name ) fprintf( f, "mdr %d %s\n", which, name );
+  }
+
+  for( i = 0; i < ARRAY_SIZE( harddisks ); i++ )
+    if( *harddisks[i].setting )
+      fprintf( f, "ide %s %s\n", harddisks[i].name, *harddisks[i].setting );
+
+  fclose( f );
+
+  return 0;
+}
+
+/* Load the session saved last time, if there is one. Returns 0 if a
+   session was resumed */
+int
+session_resume( void )
+{
+  char snapshot[ PATH_MAX ], tape[ PATH_MAX ], block[ PATH_MAX ],
+    media[ PATH_MAX ];
+  FILE *f;
+  int error, n;
+
+  if( !settings_current.resume_session ) return 1;
+
+  if( session_path( snapshot, SESSION_SNAPSHOT ) ||
+      session_path( tape, SESSION_TAPE ) ||
+      session_path( block, SESSION_TAPE_BLOCK ) ||
+      session_path( media, SESSION_MEDIA ) ) return 1;
+
+  if( !compat_file_exists( snapshot ) ) return 1;
+
+  error = snapshot_read( snapshot );
+
+  if( !error && compat_file_exists( tape ) &&
+      !tape_open( tape, 0 ) ) {
+    f = fopen( block, "r" );
+    if( f ) {
+      if( fscanf( f, "%d", &n ) == 1 && n >= 0 ) tape_select_block( n );
+      fclose( f );
+    }
+  }
+
+  if( !error ) session_media_resume( media );
+
+  /* The session is only good for one start, so a state which stops Fuse
+     from running can't keep on doing so */
+  session_remove();
+
+  return error;
+}
+
+/* Write out the current session for session_resume() to find */
+int
+session_save( void )
+{
+  char snapshot[ PATH_MAX ], tape[ PATH_MAX ], block[ PATH_MAX ],
+    media[ PATH_MAX ];
+  FILE *f;
+  int error;
+
+  if( !settings_current.resume_session || session_saved ) return 0;
+
+  if( session_path( snapshot, SESSION_SNAPSHOT ) ||
+      session_path( tape, SESSION_TAPE ) ||
+      session_path( block, SESSION_TAPE_BLOCK ) ||
+      session_path( media, SESSION_MEDIA ) ) return 1;
+
+  session_remove();
+
+  error = snapshot_write( snapshot );
+  if( error ) return error;
+
+  session_saved = 1;
+
+  error = session_media_save( media );
+  if( error ) return error;
+
+  if( !tape_present() ) return 0;
+
+  f = fopen( block, "w" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s' for writing", block );
+    return 1;
+  }
+  fprintf( f, "%d\n", tape_get_current_block() );
+  fclose( f );
+
+  return tape_write( tape );
+}
+
+void
+session_discard( void )
+{
+  if( !session_saved ) return;
+
+  session_remove();
+  session_saved = 0;
+}
@@ -0,0 +1,38 @@
+/* session.h: Saving the session at exit and resuming it at startup
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_SESSION_H
+#define FUSE_SESSION_H
+
+int session_resume( void );
+
+/* Write out the session, if one is being kept. This has to happen
+   before the media is ejected on the way out; once it has, later calls
+   do nothing */
+int session_save( void );
+
+/* Forget the session written by session_save(), as Fuse isn't going to
+   exit after all */
+void session_discard( void );
+
+#endif			/* #ifndef FUSE_SESSION_H */
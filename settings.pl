@@ -65,6 +65,7 @@ print hashline( __LINE__ ), << 'CODE';
 #include <config.h>
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -86,6 +87,7 @@ print hashline( __LINE__ ), << 'CODE';
 #include <libxml/parser.h>
 #endif        /* #ifdef HAVE_LIB_XML2 */
 
+#include "config_write.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
@@ -126,6 +128,84 @@ print hashline( __LINE__ ), << 'CODE';
   /* show_version */ 0,
 };
 
+/* Where each setting in the config file is stored. Sorted by name, so a
+   name can be looked up with a binary search rather than being compared
+   against every setting in turn */
+typedef enum settings_config_type {
+  SETTINGS_CONFIG_NULL,
+  SETTINGS_CONFIG_INT,
+  SETTINGS_CONFIG_STRING,
+} settings_config_type;
+
+typedef struct settings_config_entry {
+  const char *name;
+  settings_config_type type;
+  size_t offset;
+} settings_config_entry;
+
+static const settings_config_entry settings_config_entries[] = {
+CODE
+
+    {
+	my %configfile;
+	foreach my $name ( keys %options ) {
+	    my $configfile = $options{$name}->{configfile};
+	    die "Duplicate config file name `$configfile'"
+		if exists $configfile{$configfile};
+	    $configfile{$configfile} = $name;
+	}
+
+	foreach my $configfile ( sort keys %configfile ) {
+	    my $name = $configfile{$configfile};
+	    my $type = $options{$name}->{type};
+
+	    if( $type eq 'boolean' or $type eq 'numeric' ) {
+		print "  { \"$configfile\", SETTINGS_CONFIG_INT, offsetof( settings_info, $name ) },\n";
+	    } elsif( $type eq 'string' ) {
+		print "  { \"$configfile\", SETTINGS_CONFIG_STRING, offsetof( settings_info, $name ) },\n";
+	    } elsif( $type eq 'null' ) {
+		print "  { \"$configfile\", SETTINGS_CONFIG_NULL, 0 },\n";
+	    } else {
+		die "Unknown setting type `$type'";
+	    }
+	}
+    }
+
+print hashline( __LINE__ ), << 'CODE';
+};
+
+typedef struct settings_config_key {
+  const char *name;
+  size_t length;
+} settings_config_key;
+
+static int
+settings_config_compare( const void *key, const void *entry )
+{
+  const settings_config_key *k = key;
+  const settings_config_entry *e = entry;
+  int cmp;
+
+  cmp = strncmp( k->name, e->name, k->length ); if( cmp ) return cmp;
+
+  return e->name[ k->length ] ? -1 : 0;
+}
+
+/* Find the setting called `name', which is `length' bytes long and need
+   not be NUL-terminated */
+static const settings_config_entry*
+settings_config_find( const char *name, size_t length )
+{
+  settings_config_key key;
+
+  key.name = name; key.length = length;
+
+  return bsearch( &key, settings_config_entries,
+                  ARRAY_SIZE( settings_config_entries ),
+                  sizeof( settings_config_entries[0] ),
+                  settings_config_compare );
+}
+
 static int read_config_file( settings_info *settings );
 
 #ifdef HAVE_LIB_XML2
@@ -204,6 +284,7 @@ read_config_file( settings_info *settings )
 static int
 parse_xml( xmlDocPtr doc, settings_info *settings )
 {
+  const settings_config_entry *entry;
   xmlNodePtr node;
   xmlChar *xmlstring;
 
@@ -216,51 +297,25 @@ parse_xml( xmlDocPtr doc, settings_info *settings )
   node = node->xmlChildrenNode;
   while( node ) {
 
-CODE
-
-foreach my $name ( sort keys %options ) {
-
-    my $type = $options{$name}->{type};
-
-    if( $type eq 'boolean' or $type eq 'numeric' ) {
+    entry = settings_config_find( (const char*)node->name,
+                                  strlen( (const char*)node->name ) );
 
-  print << "CODE";
-    if( !strcmp( (const char*)node->name, "$options{$name}->{configfile}" ) ) {
-      xmlstring = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
+    if( entry ) {
+      xmlstring = entry->type == SETTINGS_CONFIG_NULL ? NULL :
+                  xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
       if( xmlstring ) {
-        settings->$name = atoi( (char*)xmlstring );
-        xmlFree( xmlstring );
-      }
-    } else
-CODE
+        char *field = (char*)settings + entry->offset;
 
-    } elsif( $type eq 'string' ) {
+        if( entry->type == SETTINGS_CONFIG_INT ) {
+          *(int*)field = atoi( (char*)xmlstring );
+        } else {
+          libspectrum_free( *(char**)field );
+          *(char**)field = utils_safe_strdup( (char*)xmlstring );
+        }
 
-      print << "CODE";
-    if( !strcmp( (const char*)node->name, "$options{$name}->{configfile}" ) ) {
-      xmlstring = xmlNodeListGetString( doc, node->xmlChildrenNode, 1 );
-      if( xmlstring ) {
-        libspectrum_free( settings->$name );
-        settings->$name = utils_safe_strdup( (char*)xmlstring );
         xmlFree( xmlstring );
       }
     } else
-CODE
-
-    } elsif( $type eq 'null' ) {
-
-      print << "CODE";
-    if( !strcmp( (const char*)node->name, "$options{$name}->{configfile}" ) ) {
-      /* Do nothing */
-    } else
-CODE
-
-    } else {
-  die "Unknown setting type `$type'";
-    }
-}
-
-print hashline( __LINE__ ), << 'CODE';
     if( !strcmp( (const char*)node->name, "text" ) ) {
       /* Do nothing */
     } else {
@@ -279,7 +334,7 @@ settings_write_config( settings_info *settings )
 {
   const char *cfgdir; char path[ PATH_MAX ], buffer[80];
 
-  xmlDocPtr doc; xmlNodePtr root;
+  xmlDocPtr doc; xmlNodePtr root; xmlChar *xml; int length, error;
 
   cfgdir = compat_get_config_path(); if( !cfgdir ) return 1;
 
@@ -319,11 +374,18 @@ CODE
 
   print hashline( __LINE__ ), << 'CODE';
 
-  xmlSaveFormatFile( path, doc, 1 );
-
+  xmlDocDumpFormatMemory( doc, &xml, &length, 1 );
   xmlFreeDoc( doc );
+  if( !xml ) {
+    ui_error( UI_ERROR_ERROR, "couldn't write `%s'", path );
+    return 1;
+  }
 
-  return 0;
+  error = config_write( path, (const char *)xml, length );
+
+  xmlFree( xml );
+
+  return error;
 }
 
 #else       /* #ifdef HAVE_LIB_XML2 */
@@ -374,6 +436,7 @@ static int
 settings_var( settings_info *settings, unsigned char *name, unsigned char *last,
               int **val_int, char ***val_char, unsigned char **next  )
 {
+  const settings_config_entry *entry;
   unsigned char* cpos;
   size_t n;
 
@@ -400,24 +463,21 @@ settings_var( settings_info *settings, unsigned char *name, unsigned char *last,
   if( *next < last) (*next)++;    /* set after '=' */
 /*  ui_error( UI_ERROR_WARNING, "Config: (%5s): ", name ); */
 
-CODE
-my %type = ('null' => 0, 'boolean' => 1, 'numeric' => 1, 'string' => 2 );
-foreach my $name ( sort keys %options ) {
-    my $len = length $options{$name}->{configfile};
-
-    print << "CODE";
-  if( n == $len && !strncmp( (const char *)name, "$options{$name}->{configfile}", n ) ) {
-CODE
-    print "    *val_int = \&settings->$name;\n" if( $options{$name}->{type} eq 'boolean' or $options{$name}->{type} eq 'numeric' );
-    print "    *val_char = \&settings->$name;\n" if( $options{$name}->{type} eq 'string' );
-    print "/*    *val_null = \&settings->$name; */\n" if( $options{$name}->{type} eq 'null' );
-    print << "CODE";
-    return 0;
+  entry = settings_config_find( (const char *)name, n );
+  if( !entry ) return 1;
+
+  switch( entry->type ) {
+  case SETTINGS_CONFIG_INT:
+    *val_int = (int*)( (char*)settings + entry->offset );
+    break;
+  case SETTINGS_CONFIG_STRING:
+    *val_char = (char**)( (char*)settings + entry->offset );
+    break;
+  case SETTINGS_CONFIG_NULL:
+    break;
   }
-CODE
-}
-    print << "CODE";
-  return 1;
+
+  return 0;
 }
 
 static int
@@ -443,12 +503,12 @@ parse_ini( utils_file *file, settings_info *settings )
     if( val_int ) {
   *val_int = atoi( (char *)cpos );
   while( cpos < file->buffer + file->length && 
-    ( *cpos != '\\0' && *cpos != '\\r' && *cpos != '\\n' ) ) cpos++;
+    ( *cpos != '\0' && *cpos != '\r' && *cpos != '\n' ) ) cpos++;
     } else if( val_char ) {
   char *value = (char *)cpos;
   size_t n = 0;
   while( cpos < file->buffer + file->length && 
-    ( *cpos != '\\0' && *cpos != '\\r' && *cpos != '\\n' ) ) cpos++;
+    ( *cpos != '\0' && *cpos != '\r' && *cpos != '\n' ) ) cpos++;
   n = (char *)cpos - value;
   if( n > 0 ) {
     if( *val_char != NULL ) {
@@ -456,13 +516,13 @@ parse_ini( utils_file *file, settings_info *settings )
       *val_char = NULL;
     }
     *val_char = libspectrum_new( char, n + 1 );
-    (*val_char)[n] = '\\0';
+    (*val_char)[n] = '\0';
     memcpy( *val_char, value, n );
   }
     }
     /* skip 'new line' like chars */
     while( ( cpos < ( file->buffer + file->length ) ) &&
-           ( *cpos == '\\r' || *cpos == '\\n' ) ) cpos++;
+           ( *cpos == '\r' || *cpos == '\n' ) ) cpos++;
 
 CODE
 print hashline( __LINE__ ), << 'CODE';
@@ -472,13 +532,14 @@ print hashline( __LINE__ ), << 'CODE';
 }
 
 static int
-settings_file_write( compat_fd fd, const char *buffer, size_t length )
+settings_file_write( config_write_buffer *doc, const char *buffer, size_t length )
 {
-  return compat_file_write( fd, (const unsigned char *)buffer, length );
+  config_write_buffer_append( doc, buffer, length );
+  return 0;
 }
 
 static int
-settings_string_write( compat_fd doc, const char* name, const char* config )
+settings_string_write( config_write_buffer *doc, const char* name, const char* config )
 {
   if( config != NULL &&
       ( settings_file_write( doc, name, strlen( name ) ) ||
@@ -490,13 +551,13 @@ settings_string_write( compat_fd doc, const char* name, const char* config )
 }
 
 static int
-settings_boolean_write( compat_fd doc, const char* name, int config )
+settings_boolean_write( config_write_buffer *doc, const char* name, int config )
 {
   return settings_string_write( doc, name, config ? "1" : "0" );
 }
 
 static int
-settings_numeric_write( compat_fd doc, const char* name, int config )
+settings_numeric_write( config_write_buffer *doc, const char* name, int config )
 {
   char buffer[80]; 
   snprintf( buffer, sizeof( buffer ), "%d", config );
@@ -508,18 +569,14 @@ settings_write_config( settings_info *settings )
 {
   const char *cfgdir; char path[ PATH_MAX ];
 
-  compat_fd doc;
+  config_write_buffer file, *doc = &file;
+  int error;
 
   cfgdir = compat_get_config_path(); if( !cfgdir ) return 1;
 
   snprintf( path, PATH_MAX, "%s/%s", cfgdir, CONFIG_FILE_NAME );
 
-  doc = compat_file_open( path, 1 );
-  if( doc == COMPAT_FILE_OPEN_FAILED ) {
-    ui_error( UI_ERROR_ERROR, "couldn't open `%s' for writing: %s\n",
-        path, strerror( errno ) );
-    return 1;
-  }
+  config_write_buffer_init( doc );
 
 CODE
 
@@ -559,11 +616,13 @@ CODE
 
   print hashline( __LINE__ ), << 'CODE';
 
-  compat_file_close( doc );
+  error = config_write( path, doc->data, doc->length );
 
-  return 0;
+  config_write_buffer_free( doc );
+
+  return error;
 error:
-  compat_file_close( doc );
+  config_write_buffer_free( doc );
 
   return 1;
 }
@@ -835,6 +894,7 @@ settings_register_startup( void )
   /* Fuse for OS X requires that settings_end is called before memory is
      deallocated as settings need to look up machine names etc */
     /* STARTUP_MANAGER_MODULE_MEMORY, */
+    STARTUP_MANAGER_MODULE_CONFIG_WRITE,
     STARTUP_MANAGER_MODULE_SETUID,
   };
   startup_manager_register( STARTUP_MANAGER_MODULE_SETTINGS_END, dependencies,
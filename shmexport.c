@@ -0,0 +1,270 @@
+/* shmexport.c: Publishing frames and sound through shared memory
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* With --shm-export, each frame shown and each frame's sound is written
+   once into a POSIX shared memory object laid out as in shmexport.h, so
+   streaming and capture tools can map it and take the frames from there
+   rather than grabbing the window */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+
+#if defined HAVE_SHM_OPEN && defined HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "display.h"
+#include "infrastructure/startup_manager.h"
+#include "machine.h"
+#include "settings.h"
+#include "shmexport.h"
+#include "sound.h"
+#include "ui/ui.h"
+
+int shmexport_active = 0;
+
+#if defined HAVE_SHM_OPEN && defined HAVE_SYS_MMAN_H
+
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ) )
+#define SHM_STORE( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELEASE )
+#define SHM_FENCE() __atomic_thread_fence( __ATOMIC_SEQ_CST )
+#else
+#define SHM_STORE( x, v ) ( *(volatile libspectrum_dword *)&(x) = (v) )
+#define SHM_FENCE()
+#endif
+
+static shmexport_t *shm;
+
+/* The object's name, kept so it can be unlinked at the end */
+static char *shm_name;
+
+static const libspectrum_byte palette[16][3] = {
+  {   0,   0,   0 }, {   0,   0, 192 }, { 192,   0,   0 }, { 192,   0, 192 },
+  {   0, 192,   0 }, {   0, 192, 192 }, { 192, 192,   0 }, { 192, 192, 192 },
+  {   0,   0,   0 }, {   0,   0, 255 }, { 255,   0,   0 }, { 255,   0, 255 },
+  {   0, 255,   0 }, {   0, 255, 255 }, { 255, 255,   0 }, { 255, 255, 255 },
+};
+
+static int
+shmexport_init( void *context )
+{
+  const char *name = settings_current.shm_export;
+  int fd;
+
+  if( !name || !*name ) return 0;
+
+  /* POSIX wants the name to start with a slash */
+  shm_name = libspectrum_new( char, strlen( name ) + 2 );
+  shm_name[0] = '/';
+  strcpy( shm_name + ( name[0] == '/' ? 0 : 1 ), name );
+
+  fd = shm_open( shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+  if( fd == -1 ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open shared memory '%s': %s",
+              shm_name, strerror( errno ) );
+    libspectrum_free( shm_name ); shm_name = NULL;
+    return 1;
+  }
+
+  if( ftruncate( fd, sizeof( *shm ) ) == -1 ) {
+    ui_error( UI_ERROR_ERROR, "couldn't size shared memory '%s': %s",
+              shm_name, strerror( errno ) );
+    close( fd ); shm_unlink( shm_name );
+    libspectrum_free( shm_name ); shm_name = NULL;
+    return 1;
+  }
+
+  shm = mmap( NULL, sizeof( *shm ), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+              0 );
+  close( fd );
+
+  if( shm == MAP_FAILED ) {
+    ui_error( UI_ERROR_ERROR, "couldn't map shared memory '%s': %s",
+              shm_name, strerror( errno ) );
+    shm = NULL; shm_unlink( shm_name );
+    libspectrum_free( shm_name ); shm_name = NULL;
+    return 1;
+  }
+
+  /* A new object is all zeros, which readers take as nothing yet */
+  memcpy( shm->palette, palette, sizeof( palette ) );
+  shm->version = SHMEXPORT_VERSION;
+  SHM_STORE( shm->magic, SHMEXPORT_MAGIC );
+
+  shmexport_active = 1;
+
+  return 0;
+}
+
+static void
+shmexport_end( void )
+{
+  if( !shm ) return;
+
+  shmexport_active = 0;
+
+  /* Anyone still mapping it keeps it until they let go */
+  munmap( shm, sizeof( *shm ) ); shm = NULL;
+  shm_unlink( shm_name );
+  libspectrum_free( shm_name ); shm_name = NULL;
+}
+
+/* The bytes of display_last_screen[] are the bitmap, then the attribute;
+   on a Timex, the SCLD mode decides what they mean, so leave that to
+   display_getpixel() */
+static void
+draw_frame( shmexport_frame_t *frame )
+{
+  libspectrum_byte ink, paper, data, mask;
+  int x, y;
+
+  if( machine_current->timex ) {
+    frame->width = 2 * DISPLAY_ASPECT_WIDTH;
+    frame->height = 2 * DISPLAY_SCREEN_HEIGHT;
+
+    for( y = 0; y < 2 * DISPLAY_SCREEN_HEIGHT; y++ )
+      for( x = 0; x < 2 * DISPLAY_ASPECT_WIDTH; x++ )
+        frame->pixels[y][x] = display_getpixel( x, y );
+
+    return;
+  }
+
+  frame->width = DISPLAY_ASPECT_WIDTH;
+  frame->height = DISPLAY_SCREEN_HEIGHT;
+
+  for( y = 0; y < DISPLAY_SCREEN_HEIGHT; y++ ) {
+    const libspectrum_dword *chunk =
+      &display_last_screen[ y * DISPLAY_SCREEN_WIDTH_COLS ];
+    libspectrum_byte *pixel = frame->pixels[y];
+
+    for( x = 0; x < DISPLAY_SCREEN_WIDTH_COLS; x++, chunk++ ) {
+      data = *chunk & 0xff;
+      display_parse_attr( ( *chunk >> 8 ) & 0xff, &ink, &paper );
+
+      for( mask = 0x80; mask; mask >>= 1 )
+        *pixel++ = ( data & mask ) ? ink : paper;
+    }
+  }
+}
+
+void
+shmexport_frame( void )
+{
+  libspectrum_dword sequence = shm->frame_sequence + 1;
+  shmexport_frame_t *frame;
+
+  /* Skip 0, which means a slot being written */
+  if( !sequence ) sequence = 1;
+
+  frame = &shm->frames[ ( sequence - 1 ) % SHMEXPORT_FRAME_SLOTS ];
+
+  shm->processor_speed = machine_current->timings.processor_speed;
+  shm->tstates_per_frame = machine_current->timings.tstates_per_frame;
+
+  SHM_STORE( frame->sequence, 0 );
+  SHM_FENCE();
+
+  draw_frame( frame );
+
+  SHM_STORE( frame->sequence, sequence );
+  SHM_STORE( shm->frame_sequence, sequence );
+}
+
+void
+shmexport_add_sound( const libspectrum_signed_word *buf, size_t count )
+{
+  libspectrum_dword position = shm->audio_position;
+  size_t start, n;
+
+  shm->audio_rate = sound_freq;
+  shm->audio_channels = sound_stereo_ay != SOUND_STEREO_AY_NONE ? 2 : 1;
+
+  /* Only the newest samples fit */
+  if( count > SHMEXPORT_AUDIO_SAMPLES ) {
+    position += count - SHMEXPORT_AUDIO_SAMPLES;
+    buf += count - SHMEXPORT_AUDIO_SAMPLES;
+    count = SHMEXPORT_AUDIO_SAMPLES;
+  }
+
+  while( count ) {
+    start = position % SHMEXPORT_AUDIO_SAMPLES;
+    n = SHMEXPORT_AUDIO_SAMPLES - start;
+    if( n > count ) n = count;
+
+    memcpy( &shm->audio[ start ], buf, n * sizeof( *buf ) );
+    position += n; buf += n; count -= n;
+  }
+
+  SHM_STORE( shm->audio_position, position );
+}
+
+#else				/* #if defined HAVE_SHM_OPEN && ... */
+
+static int
+shmexport_init( void *context )
+{
+  if( settings_current.shm_export && *settings_current.shm_export ) {
+    ui_error( UI_ERROR_ERROR,
+              "shared memory export isn't available on this system" );
+    return 1;
+  }
+
+  return 0;
+}
+
+static void
+shmexport_end( void )
+{
+}
+
+void
+shmexport_frame( void )
+{
+}
+
+void
+shmexport_add_sound( const libspectrum_signed_word *buf, size_t count )
+{
+}
+
+#endif				/* #if defined HAVE_SHM_OPEN && ... */
+
+void
+shmexport_register_startup( void )
+{
+  /* Made after any privileges have been given up, as the sound is */
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_SETUID,
+  };
+  startup_manager_register( STARTUP_MANAGER_MODULE_SHMEXPORT, dependencies,
+                            ARRAY_SIZE( dependencies ), shmexport_init, NULL,
+                            shmexport_end );
+}
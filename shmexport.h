@@ -0,0 +1,103 @@
+/* shmexport.h: Publishing frames and sound through shared memory
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_SHMEXPORT_H
+#define FUSE_SHMEXPORT_H
+
+#include <libspectrum.h>
+
+#include "display.h"
+
+/* The layout of the POSIX shared memory object named by --shm-export,
+   for capture tools to map read-only. Every field is in host byte
+   order, and only Fuse ever writes to it.
+
+   The frame most recently finished is in frames[ ( frame_sequence - 1 )
+   % SHMEXPORT_FRAME_SLOTS ]. A slot is rewritten in place, so a reader
+   should check that its `sequence' is still the one it expected once it
+   has finished with the pixels; it has SHMEXPORT_FRAME_SLOTS - 1 frames'
+   grace before that happens.
+
+   Sound is a ring of SHMEXPORT_AUDIO_SAMPLES 16 bit samples, interleaved
+   if there are two channels; `audio_position' counts every sample ever
+   written, and the newest is just before audio_position %
+   SHMEXPORT_AUDIO_SAMPLES.
+
+   The counters are only advanced once what they cover has been
+   written */
+
+#define SHMEXPORT_MAGIC 0x46555345	/* "FUSE" */
+#define SHMEXPORT_VERSION 1
+
+#define SHMEXPORT_FRAME_SLOTS 4
+#define SHMEXPORT_FRAME_WIDTH  ( 2 * DISPLAY_ASPECT_WIDTH )
+#define SHMEXPORT_FRAME_HEIGHT ( 2 * DISPLAY_SCREEN_HEIGHT )
+
+#define SHMEXPORT_AUDIO_SAMPLES 32768
+
+typedef struct shmexport_frame_t {
+
+  libspectrum_dword sequence;	/* 0 while being written */
+  libspectrum_dword width, height;	/* 320x240, or 640x480 on a Timex */
+  libspectrum_dword padding;
+
+  /* One byte per pixel, a Spectrum colour (0-7, or 8-15 if bright); rows
+     are always SHMEXPORT_FRAME_WIDTH bytes apart */
+  libspectrum_byte pixels[ SHMEXPORT_FRAME_HEIGHT ][ SHMEXPORT_FRAME_WIDTH ];
+
+} shmexport_frame_t;
+
+typedef struct shmexport_t {
+
+  libspectrum_dword magic, version;
+
+  /* The machine's frame rate is processor_speed / tstates_per_frame */
+  libspectrum_dword processor_speed, tstates_per_frame;
+
+  /* The Spectrum's colours, as RGB */
+  libspectrum_byte palette[16][3];
+
+  libspectrum_dword audio_rate, audio_channels;
+
+  libspectrum_dword frame_sequence;	/* Frames finished so far */
+  libspectrum_dword audio_position;	/* Samples written so far */
+
+  shmexport_frame_t frames[ SHMEXPORT_FRAME_SLOTS ];
+
+  libspectrum_signed_word audio[ SHMEXPORT_AUDIO_SAMPLES ];
+
+} shmexport_t;
+
+/* Non-zero while frames are being published */
+extern int shmexport_active;
+
+void shmexport_register_startup( void );
+
+/* Called once each frame has been drawn, before the UI is told */
+void shmexport_frame( void );
+
+/* Called with each frame's sound once it has been made; `count' is the
+   number of samples over all the channels */
+void shmexport_add_sound( const libspectrum_signed_word *buf, size_t count );
+
+#endif				/* #ifndef FUSE_SHMEXPORT_H */
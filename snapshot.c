@@ -23,8 +23,11 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
+#include "compat.h"
 #include "fuse.h"
 #include "machine.h"
 #include "memory_pages.h"
@@ -111,7 +114,84 @@ snapshot_copy_from( libspectrum_snap *snap )
   return 0;
 }
 
+/* Copy the screen out of the snapshot in `filename' into `screen',
+   which must hold SNAPSHOT_SCREEN_LENGTH bytes, without touching the
+   emulated machine. The screen is left black if the snapshot has no
+   usable screen page */
+int
+snapshot_read_screen( const char *filename, libspectrum_byte *screen )
+{
+  utils_file file;
+  int error;
+
+  memset( screen, 0, SNAPSHOT_SCREEN_LENGTH );
+
+  if( !compat_file_exists( filename ) ) return 1;
+
+  error = utils_read_file( filename, &file );
+  if( error ) return error;
+
+  error = snapshot_read_screen_buffer( file.buffer, file.length, filename,
+                                       screen, NULL );
+  utils_close_file( &file );
+
+  return error;
+}
+
+/* As snapshot_read_screen(), for a snapshot already in memory; if
+   `machine' isn't NULL, the machine the snapshot is for is put there */
+int
+snapshot_read_screen_buffer( const unsigned char *buffer, size_t length,
+                             const char *filename, libspectrum_byte *screen,
+                             libspectrum_machine *machine )
+{
+  libspectrum_snap *snap;
+  int error, page;
+
+  memset( screen, 0, SNAPSHOT_SCREEN_LENGTH );
+
+  snap = libspectrum_snap_alloc();
+
+  error = libspectrum_snap_read( snap, buffer, length,
+				 LIBSPECTRUM_ID_UNKNOWN, filename );
+  if( error ) { libspectrum_snap_free( snap ); return error; }
+
+  if( machine ) *machine = libspectrum_snap_machine( snap );
+
+  switch( libspectrum_snap_machine( snap ) ) {
+  case LIBSPECTRUM_MACHINE_PENT:
+  case LIBSPECTRUM_MACHINE_PENT512:
+  case LIBSPECTRUM_MACHINE_PENT1024:
+  case LIBSPECTRUM_MACHINE_SCORP:
+  case LIBSPECTRUM_MACHINE_PLUS3E:
+  case LIBSPECTRUM_MACHINE_PLUS2A:
+  case LIBSPECTRUM_MACHINE_PLUS3:
+  case LIBSPECTRUM_MACHINE_PLUS2:
+  case LIBSPECTRUM_MACHINE_128:
+  case LIBSPECTRUM_MACHINE_128E:
+  case LIBSPECTRUM_MACHINE_SE:
+    page = libspectrum_snap_out_128_memoryport( snap ) & 0x08 ? 7 : 5;
+    break;
+  default:
+    page = 5;
+    break;
+  }
+
+  if( libspectrum_snap_pages( snap, page ) )
+    memcpy( screen, libspectrum_snap_pages( snap, page ),
+	    SNAPSHOT_SCREEN_LENGTH );
+
+  error = libspectrum_snap_free( snap ); if( error ) return error;
+
+  return 0;
+}
+
 int snapshot_write( const char *filename )
+{
+  return snapshot_write_flags( filename, 0 );
+}
+
+int snapshot_write_flags( const char *filename, int write_flags )
 {
   libspectrum_id_t type;
   libspectrum_class_t class;
@@ -139,7 +219,7 @@ int snapshot_write( const char *filename )
   length = 0;
   buffer = NULL;
   error = libspectrum_snap_write( &buffer, &length, &flags, snap, type,
-				  fuse_creator, 0 );
+				  fuse_creator, write_flags );
   if( error ) { libspectrum_snap_free( snap ); return error; }
 
   if( flags & LIBSPECTRUM_FLAG_SNAPSHOT_MAJOR_INFO_LOSS ) {
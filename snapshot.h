@@ -34,7 +34,20 @@ int snapshot_read_buffer( const unsigned char *buffer, size_t length,
 
 int snapshot_copy_from( libspectrum_snap *snap );
 
+/* The length of a Spectrum screen: bitmap followed by attributes */
+#define SNAPSHOT_SCREEN_LENGTH 6912
+
+int snapshot_read_screen( const char *filename, libspectrum_byte *screen );
+int snapshot_read_screen_buffer( const unsigned char *buffer, size_t length,
+                                 const char *filename,
+                                 libspectrum_byte *screen,
+                                 libspectrum_machine *machine );
+
 int snapshot_write( const char *filename );
+
+/* As snapshot_write(), passing `write_flags' (LIBSPECTRUM_FLAG_SNAPSHOT_*)
+   on to libspectrum */
+int snapshot_write_flags( const char *filename, int write_flags );
 int snapshot_copy_to( libspectrum_snap *snap );
 
 #endif
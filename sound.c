@@ -28,17 +28,34 @@
 
 #include <config.h>
 
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif				/* #ifdef HAVE_PTHREAD */
+
+#include "compat.h"
+#include "debugger/debugger.h"
+#include "export.h"
+#include "frametime.h"
 #include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
+#include "memory_usage.h"
 #include "movie.h"
 #include "options.h"
 #include "settings.h"
+#include "shmexport.h"
 #include "sound.h"
+#include "soundrec.h"
 #include "tape.h"
+#include "thread_sched.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "sound/blipbuffer.h"
+#ifdef SOUND_FIFO
+#include "sound/sfifo.h"
+#endif
 
 /* Do we have any of our sound devices available? */
 
@@ -63,8 +80,46 @@ int sound_stereo_ay = SOUND_STEREO_AY_NONE; /* local copy of settings_current.st
  */
 #define AY_CHANGE_MAX		8000
 
+/* max. number of sub-frame beeper, SpecDrum and Covox level changes
+ * kept before they're passed on to the synths; a speaker toggled as fast
+ * as the Z80 can manage gives around 6000 a frame, and if there are
+ * more, they're just passed on early.
+ */
+#define SOURCE_CHANGE_MAX	8000
+
 int sound_framesiz;
 
+/* The sample rate actually in use; this is less than
+   settings_current.sound_freq in low power mode */
+int sound_freq;
+
+/* The lowest sample rate used in low power mode */
+#define SOUND_LOW_POWER_FREQ	22050
+
+sound_stats_t sound_stats;
+
+/* What sound_synthesize() has added to the overruns and blocked time,
+   not yet folded into sound_stats. Only the thread making the sound
+   touches this, so the emulation thread only while the sound thread is
+   idle or stopped */
+static sound_stats_t sound_stats_pending;
+
+/* How much the buffers allocated by sound_init() take up */
+static size_t sound_usage = 0;
+
+#ifdef SOUND_FIFO
+/* The size of one frame of sound in the fifo, in bytes */
+static int sound_frame_bytes;
+#endif                          /* #ifdef SOUND_FIFO */
+
+/* How full the fifo was after the last frame was added, in frames, and
+   how far the output rate is currently being adjusted, with a fifo or by
+   a driver's own measure of what it has queued; exposed so they can be
+   watched */
+float sound_fifo_depth = 0;
+float sound_rate_adjust = 0;
+
+
 static int sound_channels;
 
 static unsigned int ay_tone_levels[16];
@@ -74,6 +129,10 @@ static unsigned int ay_tone_cycles, ay_env_cycles;
 static unsigned int ay_env_internal_tick, ay_env_tick;
 static unsigned int ay_tone_period[3], ay_noise_period, ay_env_period;
 
+/* Tones with a period below this are too high to be heard at the sample
+   rate in use, and are just output at half their level */
+static unsigned int ay_tone_inaudible_period = 0;
+
 /* Local copy of the AY registers */
 static libspectrum_byte sound_ay_registers[16];
 
@@ -86,18 +145,62 @@ struct ay_change_tag
 static struct ay_change_tag ay_change[ AY_CHANGE_MAX ];
 static int ay_change_count;
 
+/* The most recently recorded beeper level, to drop writes which don't
+   change it */
+static int beeper_last_val;
+
 Blip_Buffer *left_buf = NULL;
 Blip_Buffer *right_buf = NULL;
 blip_sample_t *samples = NULL;
 
-Blip_Synth *left_beeper_synth = NULL, *right_beeper_synth = NULL;
+/* Everything is mixed into one synth for each side; the right one is
+   only there if the AY is in stereo */
+static Blip_Synth *left_synth = NULL, *right_synth = NULL;
+
+/* The things which make sound */
+typedef enum sound_source {
 
-Blip_Synth *ay_a_synth = NULL, *ay_b_synth = NULL, *ay_c_synth = NULL;
-Blip_Synth *ay_a_synth_r = NULL, *ay_b_synth_r = NULL, *ay_c_synth_r = NULL;
+  SOUND_SOURCE_BEEPER,
+  SOUND_SOURCE_AY_A,
+  SOUND_SOURCE_AY_B,
+  SOUND_SOURCE_AY_C,
+  SOUND_SOURCE_SPECDRUM,
+  SOUND_SOURCE_COVOX,
 
-Blip_Synth *left_specdrum_synth = NULL, *right_specdrum_synth = NULL;
+  SOUND_SOURCE_COUNT,		/* End marker */
 
-Blip_Synth *left_covox_synth = NULL, *right_covox_synth = NULL;
+} sound_source;
+
+/* How much of each source goes to each side, in 256ths, and what each
+   source is currently giving to each side */
+static int source_weight[2][ SOUND_SOURCE_COUNT ];
+static int source_output[2][ SOUND_SOURCE_COUNT ];
+
+/* Level changes of the sources other than the AY, recorded as they
+   happen and passed on to the synths by sound_frame() */
+struct source_change_tag
+{
+  libspectrum_dword tstates;
+  sound_source source;
+  int val;
+};
+
+static struct source_change_tag source_change[ SOURCE_CHANGE_MAX ];
+static int source_change_count;
+
+static void sound_thread_sync( void );
+static void sound_thread_stop( void );
+
+/* Whether any source has moved a synth this frame, and for how many
+   frames in a row none has */
+static int sound_output_changed = 0;
+static int sound_quiet_frames = 0;
+
+/* Once the output has settled to a constant level, frames are made by
+   just repeating it: `samples' then holds sound_silent_count samples (per
+   channel) of that level */
+static int sound_silent = 0;
+static long sound_silent_count = 0;
 
 struct speaker_type_tag
 {
@@ -117,6 +220,42 @@ sound_get_volume( int volume )
   return volume / 100.0;
 }
 
+/* Set how much of `source' goes to the left and right sides */
+static void
+sound_mix_weight( sound_source source, double left, double right )
+{
+  source_weight[0][ source ] = left * 256 + 0.5;
+  source_weight[1][ source ] = right * 256 + 0.5;
+  source_output[0][ source ] = source_output[1][ source ] = 0;
+}
+
+/* Change `source' to `level' at `at_tstates'. Each side's synth is just
+   moved by the difference this makes to its output, so the sources can
+   be mixed in any order */
+static inline void
+sound_mix( sound_source source, libspectrum_dword at_tstates, int level )
+{
+  int out;
+
+  out = ( level * source_weight[0][ source ] ) >> 8;
+  if( out != source_output[0][ source ] ) {
+    blip_synth_offset( left_synth, at_tstates,
+                       out - source_output[0][ source ] );
+    source_output[0][ source ] = out;
+    sound_output_changed = 1;
+  }
+
+  if( !right_synth ) return;
+
+  out = ( level * source_weight[1][ source ] ) >> 8;
+  if( out != source_output[1][ source ] ) {
+    blip_synth_offset( right_synth, at_tstates,
+                       out - source_output[1][ source ] );
+    source_output[1][ source ] = out;
+    sound_output_changed = 1;
+  }
+}
+
 /* Returns the emulation speed adjusted processor speed */
 libspectrum_dword
 sound_get_effective_processor_speed( void )
@@ -133,7 +272,7 @@ sound_init_blip( Blip_Buffer **buf, Blip_Synth **synth )
   /* Allow up to 1s of playback buffer - this allows us to cope with slowing
      down to 2% of speed where a single Speccy frame generates just under 1s
      of sound */
-  if ( blip_buffer_set_sample_rate( *buf, settings_current.sound_freq, 1000 ) ) {
+  if ( blip_buffer_set_sample_rate( *buf, sound_freq, 1000 ) ) {
     sound_end();
     ui_error( UI_ERROR_ERROR, "out of memory at %s:%d", __FILE__, __LINE__ );
     return 0;
@@ -141,7 +280,8 @@ sound_init_blip( Blip_Buffer **buf, Blip_Synth **synth )
 
   *synth = new_Blip_Synth();
 
-  blip_synth_set_volume( *synth, sound_get_volume( settings_current.volume_beeper ) );
+  /* The sources' volumes are applied by sound_mix() */
+  blip_synth_set_volume( *synth, 1.0 );
   blip_synth_set_output( *synth, *buf );
 
   blip_buffer_set_bass_freq( *buf, speaker_type[ option_enumerate_sound_speaker_type() ].bass );
@@ -150,6 +290,21 @@ sound_init_blip( Blip_Buffer **buf, Blip_Synth **synth )
   return 1;
 }
 
+/* Switch every synth over to the linear kernel; the output is the same,
+   but each update is a single loop. If there's no memory for the kernel,
+   the synth just carries on using the strided impulses */
+static void
+sound_init_kernels( void )
+{
+  Blip_Synth *synths[] = { left_synth, right_synth };
+  size_t i;
+
+  for( i = 0; i < ARRAY_SIZE( synths ); i++ )
+    if( synths[i] ) blip_synth_set_linear_kernel( synths[i], 1 );
+}
+
+static void sound_ay_set_tone_limit( int low_power );
+
 static void
 sound_ay_init( void )
 {
@@ -196,139 +351,167 @@ is_in_sound_enabled_range( void )
     settings_current.emulation_speed <= MAX_SPEED_PERCENTAGE;
 }
 
+/* Is the sound to be played? An export makes it without playing it */
+static int
+sound_device_wanted( void )
+{
+  return settings_current.sound && !export_active;
+}
+
+/* Work out how much sound a frame of the current machine makes, and
+   allocate `samples' to hold it */
+static void
+sound_init_frame( void )
+{
+  float hz;
+
+  /* Adjust relative processor speed to deal with adjusting sound generation
+     frequency against emulation speed (more flexible than adjusting generated
+     sample rate) */
+  hz = ( float )sound_get_effective_processor_speed() /
+                machine_current->timings.tstates_per_frame;
+
+  /* Size of audio data we will get from running a single Spectrum frame,
+     allowing for the rate control producing a little more */
+  sound_framesiz = ( float )sound_freq / hz *
+                   ( 1 + SOUND_RATE_ADJUST_MAX );
+  sound_framesiz++;
+
+#ifdef SOUND_FIFO
+  sound_frame_bytes = sound_freq / hz * sound_channels *
+                      sizeof( blip_sample_t );
+#endif                          /* #ifdef SOUND_FIFO */
+
+  samples = libspectrum_new0( blip_sample_t, sound_framesiz * sound_channels );
+
+  sound_usage = sound_framesiz * sound_channels * sizeof( blip_sample_t ) +
+                left_buf->buffer_size_ * sizeof( buf_t_ );
+  if( right_buf ) sound_usage += right_buf->buffer_size_ * sizeof( buf_t_ );
+  memory_usage_add( MEMORY_USAGE_SOUND, sound_usage );
+}
+
 void
 sound_init( const char *device )
 {
-  float hz;
-  double treble;
-  Blip_Synth **ay_left_synth;
-  Blip_Synth **ay_mid_synth;
-  Blip_Synth **ay_mid_synth_r;
-  Blip_Synth **ay_right_synth;
+  double ay, beeper, specdrum, covox;
 
   /* Allow sound as long as emulation speed is greater than 2%
      (less than that and a single Speccy frame generates more
      than a seconds worth of sound which is bigger than the
      maximum Blip_Buffer of 1 second) */
-  if( !( !sound_enabled && settings_current.sound &&
+  if( !( !sound_enabled &&
+         ( settings_current.sound ||
+           ( export_active && settings_current.export_audio ) ) &&
          is_in_sound_enabled_range() ) )
     return;
 
   /* only try for stereo if we need it */
   sound_stereo_ay = option_enumerate_sound_stereo_ay();
 
-  if( settings_current.sound &&
-      sound_lowlevel_init( device, &settings_current.sound_freq,
-                           &sound_stereo_ay ) )
-    return;
+  /* In low power mode, make half as much sound (or less) and all of it in
+     mono; the device can resample or upmix it if need be */
+  if( settings_current.sound_low_power ) {
+    sound_freq = settings_current.sound_freq < SOUND_LOW_POWER_FREQ ?
+                 settings_current.sound_freq : SOUND_LOW_POWER_FREQ;
+    sound_stereo_ay = SOUND_STEREO_AY_NONE;
+
+    if( sound_device_wanted() &&
+        sound_lowlevel_init( device, &sound_freq, &sound_stereo_ay ) )
+      return;
+  } else {
+    if( sound_device_wanted() &&
+        sound_lowlevel_init( device, &settings_current.sound_freq,
+                             &sound_stereo_ay ) )
+      return;
+
+    sound_freq = settings_current.sound_freq;
+  }
 
-  if( !sound_init_blip(&left_buf, &left_beeper_synth) ) return;
+  /* The new synths start from silence */
+  source_change_count = 0;
+  beeper_last_val = 0;
+
+  if( !sound_init_blip(&left_buf, &left_synth) ) return;
   if( sound_stereo_ay != SOUND_STEREO_AY_NONE &&
-      !sound_init_blip(&right_buf, &right_beeper_synth) )
+      !sound_init_blip(&right_buf, &right_synth) )
     return;
 
-  treble = speaker_type[ option_enumerate_sound_speaker_type() ].treble;
-
-  ay_a_synth = new_Blip_Synth();
-  blip_synth_set_volume( ay_a_synth,
-                         sound_get_volume( settings_current.volume_ay) );
-  blip_synth_set_treble_eq( ay_a_synth, treble );
-
-  ay_b_synth = new_Blip_Synth();
-  blip_synth_set_volume( ay_b_synth,
-                         sound_get_volume( settings_current.volume_ay) );
-  blip_synth_set_treble_eq( ay_b_synth, treble );
-
-  ay_c_synth = new_Blip_Synth();
-  blip_synth_set_volume( ay_c_synth,
-                         sound_get_volume( settings_current.volume_ay) );
-  blip_synth_set_treble_eq( ay_c_synth, treble );
-
-  left_specdrum_synth = new_Blip_Synth();
-  blip_synth_set_volume( left_specdrum_synth,
-                         sound_get_volume( settings_current.volume_specdrum ) );
-  blip_synth_set_output( left_specdrum_synth, left_buf );
-  blip_synth_set_treble_eq( left_specdrum_synth, treble );
-
-  left_covox_synth = new_Blip_Synth();
-  blip_synth_set_volume( left_covox_synth,
-                         sound_get_volume( settings_current.volume_covox ) );
-  blip_synth_set_output( left_covox_synth, left_buf );
-  blip_synth_set_treble_eq( left_covox_synth, treble );
-  
+  ay = sound_get_volume( settings_current.volume_ay );
+  beeper = sound_get_volume( settings_current.volume_beeper );
+  specdrum = sound_get_volume( settings_current.volume_specdrum );
+  covox = sound_get_volume( settings_current.volume_covox );
+
+  sound_mix_weight( SOUND_SOURCE_BEEPER, beeper, beeper );
+  sound_mix_weight( SOUND_SOURCE_SPECDRUM, specdrum, specdrum );
+  sound_mix_weight( SOUND_SOURCE_COVOX, covox, covox );
+
   /* important to override these settings if not using stereo
    * (it would probably be confusing to mess with the stereo
    * settings in settings_current though, which is why we make copies
    * rather than using the real ones).
    */
 
-  ay_a_synth_r = NULL;
-  ay_b_synth_r = NULL;
-  ay_c_synth_r = NULL;
-
-  if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
-    /* Attach the Blip_Synth's we've already created as appropriate, and
-     * create one more Blip_Synth for the middle channel's right buffer. */
-    if( sound_stereo_ay == SOUND_STEREO_AY_ACB ) {
-      ay_left_synth = &ay_a_synth;
-      ay_mid_synth = &ay_c_synth;
-      ay_mid_synth_r = &ay_c_synth_r;
-      ay_right_synth = &ay_b_synth;
-    } else if ( sound_stereo_ay == SOUND_STEREO_AY_ABC ) {
-      ay_left_synth = &ay_a_synth;
-      ay_mid_synth = &ay_b_synth;
-      ay_mid_synth_r = &ay_b_synth_r;
-      ay_right_synth = &ay_c_synth;
-    } else {
-      ui_error( UI_ERROR_ERROR, "unknown AY stereo separation type: %d", sound_stereo_ay );
-      fuse_abort();
-    }
-
-    blip_synth_set_output( *ay_left_synth, left_buf );
-    blip_synth_set_output( *ay_mid_synth, left_buf );
-    blip_synth_set_output( *ay_right_synth, right_buf );
-
-    *ay_mid_synth_r = new_Blip_Synth();
-    blip_synth_set_volume( *ay_mid_synth_r,
-                           sound_get_volume( settings_current.volume_ay ) );
-    blip_synth_set_output( *ay_mid_synth_r, right_buf );
-    blip_synth_set_treble_eq( *ay_mid_synth_r, treble );
-
-    right_specdrum_synth = new_Blip_Synth();
-    blip_synth_set_volume( right_specdrum_synth,
-                           sound_get_volume( settings_current.volume_specdrum ) );
-    blip_synth_set_output( right_specdrum_synth, right_buf );
-    blip_synth_set_treble_eq( right_specdrum_synth, treble );
-
-    right_covox_synth = new_Blip_Synth();
-    blip_synth_set_volume( right_covox_synth,
-                           sound_get_volume( settings_current.volume_covox ) );
-    blip_synth_set_output( right_covox_synth, right_buf );
-    blip_synth_set_treble_eq( right_covox_synth, treble );
+  if( sound_stereo_ay == SOUND_STEREO_AY_NONE ) {
+    sound_mix_weight( SOUND_SOURCE_AY_A, ay, 0 );
+    sound_mix_weight( SOUND_SOURCE_AY_B, ay, 0 );
+    sound_mix_weight( SOUND_SOURCE_AY_C, ay, 0 );
+  } else if( sound_stereo_ay == SOUND_STEREO_AY_ACB ) {
+    sound_mix_weight( SOUND_SOURCE_AY_A, ay, 0 );
+    sound_mix_weight( SOUND_SOURCE_AY_B, 0, ay );
+    sound_mix_weight( SOUND_SOURCE_AY_C, ay, ay );
+  } else if( sound_stereo_ay == SOUND_STEREO_AY_ABC ) {
+    sound_mix_weight( SOUND_SOURCE_AY_A, ay, 0 );
+    sound_mix_weight( SOUND_SOURCE_AY_B, ay, ay );
+    sound_mix_weight( SOUND_SOURCE_AY_C, 0, ay );
   } else {
-    blip_synth_set_output( ay_a_synth, left_buf );
-    blip_synth_set_output( ay_b_synth, left_buf );
-    blip_synth_set_output( ay_c_synth, left_buf );
+    ui_error( UI_ERROR_ERROR, "unknown AY stereo separation type: %d", sound_stereo_ay );
+    fuse_abort();
   }
 
+  sound_init_kernels();
+
+  sound_ay_set_tone_limit( settings_current.sound_low_power );
+
   sound_enabled = sound_enabled_ever = 1;
 
   sound_channels = ( sound_stereo_ay != SOUND_STEREO_AY_NONE ? 2 : 1 );
 
-  /* Adjust relative processor speed to deal with adjusting sound generation
-     frequency against emulation speed (more flexible than adjusting generated
-     sample rate) */
-  hz = ( float )sound_get_effective_processor_speed() /
-                machine_current->timings.tstates_per_frame;
+  sound_output_changed = sound_quiet_frames = sound_silent = 0;
 
-  /* Size of audio data we will get from running a single Spectrum frame */
-  sound_framesiz = ( float )settings_current.sound_freq / hz;
-  sound_framesiz++;
+  sound_fifo_depth = 0;
+  sound_rate_adjust = 0;
+
+  sound_init_frame();
 
-  samples = libspectrum_new0( blip_sample_t, sound_framesiz * sound_channels );
   /* initialize movie settings... */
-  movie_init_sound( settings_current.sound_freq, sound_stereo_ay );
+  movie_init_sound( sound_freq, sound_stereo_ay );
+  soundrec_init_sound( sound_freq, sound_channels );
+
+}
+
+static void sound_set_clock_rate( void );
+
+/* Move the sound over to a new machine. Only the emulated clock rate
+   and frame length change, so the device is left open and the buffers
+   are just re-rated; anything not yet made into sound is dropped */
+void
+sound_machine_changed( void )
+{
+  if( !sound_enabled ) {
+    sound_init( settings_current.sound_device );
+    return;
+  }
+
+  sound_thread_sync();
+
+  source_change_count = ay_change_count = 0;
+  sound_quiet_frames = sound_silent = 0;
 
+  sound_set_clock_rate();
+
+  libspectrum_free( samples );
+  memory_usage_remove( MEMORY_USAGE_SOUND, sound_usage );
+  sound_init_frame();
 }
 
 void
@@ -352,38 +535,149 @@ void
 sound_end( void )
 {
   if( sound_enabled ) {
-    delete_Blip_Synth( &left_beeper_synth );
-    delete_Blip_Synth( &right_beeper_synth );
-
-    delete_Blip_Synth( &ay_a_synth );
-    delete_Blip_Synth( &ay_b_synth );
-    delete_Blip_Synth( &ay_c_synth );
-    delete_Blip_Synth( &ay_a_synth_r );
-    delete_Blip_Synth( &ay_b_synth_r );
-    delete_Blip_Synth( &ay_c_synth_r );
+    sound_thread_stop();
 
-    delete_Blip_Synth( &left_specdrum_synth );
-    delete_Blip_Synth( &right_specdrum_synth );
-
-    delete_Blip_Synth( &left_covox_synth );
-    delete_Blip_Synth( &right_covox_synth );
+    delete_Blip_Synth( &left_synth );
+    delete_Blip_Synth( &right_synth );
 
     delete_Blip_Buffer( &left_buf );
     delete_Blip_Buffer( &right_buf );
 
-    if( settings_current.sound ) 
+    if( sound_device_wanted() )
       sound_lowlevel_end();
     libspectrum_free( samples );
+    memory_usage_remove( MEMORY_USAGE_SOUND, sound_usage );
+    sound_usage = 0;
     sound_enabled = 0;
   }
 }
 
+void
+sound_stats_blocked( double since )
+{
+  double now = compat_timer_get_time();
+
+  if( since >= 0 && now > since ) sound_stats_pending.blocked += now - since;
+}
+
+/* Add what the sound has made of the stats to them; called from the
+   emulation thread once the sound is in step with it */
+static void
+sound_stats_fold( void )
+{
+  sound_stats.overruns += sound_stats_pending.overruns;
+  sound_stats.blocked += sound_stats_pending.blocked;
+
+  sound_stats_pending.overruns = 0;
+  sound_stats_pending.blocked = 0;
+}
+
+/* Debugger system variables */
+static const char * const debugger_type_string = "sound";
+static const char * const underruns_detail_string = "underruns";
+static const char * const overruns_detail_string = "overruns";
+static const char * const blocked_detail_string = "blocked";
+#ifdef SOUND_FIFO
+static const char * const fifo_low_detail_string = "fifolow";
+static const char * const fifo_high_detail_string = "fifohigh";
+#endif                          /* #ifdef SOUND_FIFO */
+
+static libspectrum_dword
+get_underruns( void )
+{
+  return sound_stats.underruns;
+}
+
+static void
+set_underruns( libspectrum_dword value )
+{
+  sound_stats.underruns = value;
+}
+
+static libspectrum_dword
+get_overruns( void )
+{
+  return sound_stats.overruns;
+}
+
+static void
+set_overruns( libspectrum_dword value )
+{
+  sound_stats.overruns = value;
+}
+
+/* In milliseconds */
+static libspectrum_dword
+get_blocked( void )
+{
+  return sound_stats.blocked * 1000;
+}
+
+static void
+set_blocked( libspectrum_dword value )
+{
+  sound_stats.blocked = value / 1000.0;
+}
+
+#ifdef SOUND_FIFO
+extern sfifo_t sound_fifo;
+
+/* The fifo watermarks are in bytes, and writing either restarts both */
+static libspectrum_dword
+get_fifo_low( void )
+{
+  return sound_fifo.buffer ? sfifo_low_water( &sound_fifo ) : 0;
+}
+
+static libspectrum_dword
+get_fifo_high( void )
+{
+  return sound_fifo.buffer ? sfifo_high_water( &sound_fifo ) : 0;
+}
+
+static void
+set_fifo_watermarks( libspectrum_dword value )
+{
+  if( sound_fifo.buffer ) sfifo_reset_watermarks( &sound_fifo );
+}
+#endif                          /* #ifdef SOUND_FIFO */
+
+static int
+sound_module_init( void *context )
+{
+  debugger_system_variable_register(
+    debugger_type_string, underruns_detail_string, get_underruns,
+    set_underruns );
+  debugger_system_variable_register(
+    debugger_type_string, overruns_detail_string, get_overruns,
+    set_overruns );
+  debugger_system_variable_register(
+    debugger_type_string, blocked_detail_string, get_blocked, set_blocked );
+#ifdef SOUND_FIFO
+  debugger_system_variable_register(
+    debugger_type_string, fifo_low_detail_string, get_fifo_low,
+    set_fifo_watermarks );
+  debugger_system_variable_register(
+    debugger_type_string, fifo_high_detail_string, get_fifo_high,
+    set_fifo_watermarks );
+#endif                          /* #ifdef SOUND_FIFO */
+
+  return 0;
+}
+
 void
 sound_register_startup( void )
 {
-  startup_manager_module dependencies[] = { STARTUP_MANAGER_MODULE_SETUID };
+  /* The sound thread feeds the shared memory export, so that mustn't end
+     until the thread has been stopped */
+  startup_manager_module dependencies[] = {
+    STARTUP_MANAGER_MODULE_DEBUGGER,
+    STARTUP_MANAGER_MODULE_SETUID,
+    STARTUP_MANAGER_MODULE_SHMEXPORT,
+  };
   startup_manager_register( STARTUP_MANAGER_MODULE_SOUND, dependencies,
-                            ARRAY_SIZE( dependencies ), NULL, NULL, sound_end );
+                            ARRAY_SIZE( dependencies ), sound_module_init,
+                            NULL, sound_end );
 }
 
 static inline void
@@ -398,6 +692,11 @@ ay_do_tone( int level, unsigned int tone_count, int *var, int chan )
     ay_tone_high[ chan ] = !ay_tone_high[ chan ];
   }
 
+  if( ay_tone_period[ chan ] < ay_tone_inaudible_period ) {
+    *var = level / 2;
+    return;
+  }
+
   if( level ) {
     if( ay_tone_high[ chan ] )
       *var = level;
@@ -420,31 +719,328 @@ ay_do_tone( int level, unsigned int tone_count, int *var, int chan )
    master clock by 2 to drive the AY */
 #define AY_CLOCK_RATIO 2
 
+/* The number of tstates in each step of sound_ay_overlay() */
+#define AY_STEP ( AY_CLOCK_DIVISOR * AY_CLOCK_RATIO )
+
+/* In low power mode, don't bother generating tones which would only be
+   filtered out again; they're commonly used to make a channel's volume
+   into a DAC */
+static void
+sound_ay_set_tone_limit( int low_power )
+{
+  ay_tone_inaudible_period = 0;
+
+  /* The tone has a period of ay_tone_period steps */
+  if( low_power )
+    ay_tone_inaudible_period =
+      2 * sound_get_effective_processor_speed() / ( AY_STEP * sound_freq );
+}
+
+/* Envelope and noise generator state */
+static int ay_env_first = 1, ay_env_rev = 0, ay_env_counter = 15;
+static int ay_noise_rng = 1, ay_noise_toggle = 0;
+
+/* The envelope has reached the end of one of its periods */
+static void
+sound_ay_envelope_period( int envshape )
+{
+  /* do a 1/16th-of-period incr/decr if needed */
+  if( ay_env_first ||
+      ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
+    if( ay_env_rev )
+      ay_env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+    else
+      ay_env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
+    if( ay_env_counter < 0 )
+      ay_env_counter = 0;
+    if( ay_env_counter > 15 )
+      ay_env_counter = 15;
+  }
+
+  ay_env_internal_tick++;
+  while( ay_env_internal_tick >= 16 ) {
+    ay_env_internal_tick -= 16;
+
+    /* end of cycle */
+    if( !( envshape & AY_ENV_CONT ) )
+      ay_env_counter = 0;
+    else {
+      if( envshape & AY_ENV_HOLD ) {
+        if( ay_env_first && ( envshape & AY_ENV_ALT ) )
+          ay_env_counter = ( ay_env_counter ? 0 : 15 );
+      } else {
+        /* non-hold */
+        if( envshape & AY_ENV_ALT )
+          ay_env_rev = !ay_env_rev;
+        else
+          ay_env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
+      }
+    }
+
+    ay_env_first = 0;
+  }
+}
+
+/* Once its first cycle is done, a non-continuing or holding envelope
+   stays where it is */
+static int
+sound_ay_envelope_held( int envshape )
+{
+  return !ay_env_first &&
+         ( !( envshape & AY_ENV_CONT ) || ( envshape & AY_ENV_HOLD ) );
+}
+
+/* Advance the envelope by `count' envelope ticks */
+static void
+sound_ay_envelope_advance( unsigned int count, int envshape )
+{
+  while( count ) {
+
+    /* If the envelope is held, only the counters move */
+    if( sound_ay_envelope_held( envshape ) ) {
+      unsigned int periods;
+
+      if( ay_env_period ) {
+        periods = ( ay_env_tick + count ) / ay_env_period;
+        ay_env_tick = ( ay_env_tick + count ) % ay_env_period;
+      } else {
+        periods = count;
+        ay_env_tick += count;
+      }
+      ay_env_internal_tick = ( ay_env_internal_tick + periods ) % 16;
+      return;
+    }
+
+    /* Skip straight over ticks where nothing happens */
+    if( ay_env_period && ay_env_tick + 1 < ay_env_period ) {
+      unsigned int skip = ay_env_period - 1 - ay_env_tick;
+      if( skip > count ) skip = count;
+      ay_env_tick += skip;
+      count -= skip;
+      continue;
+    }
+
+    ay_env_tick++;
+    while( ay_env_tick >= ay_env_period ) {
+      ay_env_tick -= ay_env_period;
+
+      sound_ay_envelope_period( envshape );
+
+      /* don't keep trying if period is zero */
+      if( !ay_env_period )
+        break;
+    }
+    count--;
+  }
+}
+
+/* Advance the noise generator by `count' noise ticks */
+static void
+sound_ay_noise_advance( unsigned int count )
+{
+  while( count ) {
+
+    /* Skip straight over ticks where nothing happens */
+    if( ay_noise_period && ay_noise_tick + 1 < ay_noise_period ) {
+      unsigned int skip = ay_noise_period - 1 - ay_noise_tick;
+      if( skip > count ) skip = count;
+      ay_noise_tick += skip;
+      count -= skip;
+      continue;
+    }
+
+    ay_noise_tick++;
+    while( ay_noise_tick >= ay_noise_period ) {
+      ay_noise_tick -= ay_noise_period;
+
+      if( ( ay_noise_rng & 1 ) ^ ( ( ay_noise_rng & 2 ) ? 1 : 0 ) )
+        ay_noise_toggle = !ay_noise_toggle;
+
+      /* rng is 17-bit shift reg, bit 0 is output.
+       * input is bit 0 xor bit 3.
+       */
+      if( ay_noise_rng & 1 ) {
+        ay_noise_rng ^= 0x24000;
+      }
+      ay_noise_rng >>= 1;
+
+      /* don't keep trying if period is zero */
+      if( !ay_noise_period )
+        break;
+    }
+    count--;
+  }
+}
+
+/* Set the output of channel `chan' from tstate `f' */
+static void
+sound_ay_output( int chan, libspectrum_dword f, int out, int *last_chan )
+{
+  if( last_chan[ chan ] == out ) return;
+
+  sound_mix( SOUND_SOURCE_AY_A + chan, f, out );
+  last_chan[ chan ] = out;
+}
+
+/* Run channel `chan' for `count' steps from tstate `f', with a constant
+   level and no noise. Rather than stepping, go straight from one flip of
+   the tone to the next */
+static void
+sound_ay_tone_stretch( int chan, libspectrum_dword f, unsigned int count,
+                       int level, int tone, int *last_chan )
+{
+  unsigned int done = 0;
+
+  if( !tone ) {
+    sound_ay_output( chan, f, level, last_chan );
+    return;
+  }
+
+  /* If the tone can't be heard, only where it ends up matters; that's
+     not exactly where stepping would have left it, but no-one can tell */
+  if( ay_tone_period[ chan ] < ay_tone_inaudible_period ) {
+    unsigned int total = ay_tone_tick[ chan ] + 2 * count;
+
+    ay_tone_high[ chan ] ^= ( total / ay_tone_period[ chan ] ) & 1;
+    ay_tone_tick[ chan ] = total % ay_tone_period[ chan ];
+    sound_ay_output( chan, f, level / 2, last_chan );
+    return;
+  }
+
+  /* If the channel is silent, it doesn't matter when the tone flips, just
+     where it ends up. With a period of two or less, the tone flips every
+     step; otherwise, when the tick is in range, each step can flip it at
+     most once */
+  if( !level && ay_tone_period[ chan ] <= 2 ) {
+    ay_tone_high[ chan ] ^= count & 1;
+    ay_tone_tick[ chan ] += ( 2 - ay_tone_period[ chan ] ) * count;
+    sound_ay_output( chan, f, 0, last_chan );
+    return;
+  } else if( !level && ay_tone_tick[ chan ] < ay_tone_period[ chan ] ) {
+    unsigned int total = ay_tone_tick[ chan ] + 2 * count;
+
+    ay_tone_high[ chan ] ^= ( total / ay_tone_period[ chan ] ) & 1;
+    ay_tone_tick[ chan ] = total % ay_tone_period[ chan ];
+    sound_ay_output( chan, f, 0, last_chan );
+    return;
+  }
+
+  while( 1 ) {
+    unsigned int tick = ay_tone_tick[ chan ], period = ay_tone_period[ chan ];
+
+    /* Each step counts on two; how many until the tone next flips? */
+    unsigned int steps = tick + 2 >= period ? 1 : ( period - tick + 1 ) / 2;
+
+    if( !done && steps > 1 )
+      sound_ay_output( chan, f, ay_tone_high[ chan ] ? level : 0, last_chan );
+
+    if( done + steps > count ) {
+      ay_tone_tick[ chan ] = tick + 2 * ( count - done );
+      break;
+    }
+
+    ay_tone_tick[ chan ] = tick + 2 * steps - period;
+    ay_tone_high[ chan ] = !ay_tone_high[ chan ];
+    done += steps;
+
+    sound_ay_output( chan, f + ( done - 1 ) * AY_STEP,
+                     ay_tone_high[ chan ] ? level : 0, last_chan );
+  }
+}
+
+/* Try to run the AY from the step at tstate `f' up to the last step
+   before `until' in one go; this can be done if each channel's level is
+   constant and its output doesn't depend on the noise. Returns the number
+   of steps done, or 0 if they have to be done one at a time */
+static unsigned int
+sound_ay_stretch( libspectrum_dword f, libspectrum_dword until,
+                  int *last_chan )
+{
+  int mixer = sound_ay_registers[7], envshape = sound_ay_registers[13];
+  int level[3], env_held, g;
+  unsigned int count;
+
+  if( until <= f + AY_STEP ) return 0;
+  count = ( until - f + AY_STEP - 1 ) / AY_STEP;
+
+  /* Every step then moves each counter on by the same amount */
+  if( ay_env_cycles || ay_tone_cycles ) return 0;
+
+  env_held = sound_ay_envelope_held( envshape );
+
+  for( g = 0; g < 3; g++ ) {
+    if( sound_ay_registers[ 8 + g ] & 16 ) {
+      if( !env_held ) return 0;
+      level[g] = ay_tone_levels[ ay_env_counter ];
+    } else {
+      level[g] = ay_tone_levels[ sound_ay_registers[ 8 + g ] & 15 ];
+    }
+
+    if( level[g] && !( mixer & ( 0x08 << g ) ) ) return 0;
+  }
+
+  for( g = 0; g < 3; g++ )
+    sound_ay_tone_stretch( g, f, count, level[g], !( mixer & ( 1 << g ) ),
+                           last_chan );
+
+  sound_ay_envelope_advance( count, envshape );
+  sound_ay_noise_advance( count );
+
+  return count;
+}
+
+/* Is there anything here to make AY sound? */
+static int
+sound_ay_present( void )
+{
+  return periph_is_active( PERIPH_TYPE_FULLER ) ||
+         periph_is_active( PERIPH_TYPE_MELODIK ) ||
+         machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY;
+}
+
+/* With no register writes to come, will the AY's output stay where it
+   is for the whole frame? That's so if each channel is either silent or
+   has its tone and noise off, and doesn't follow a moving envelope */
+static int
+sound_ay_quiet( void )
+{
+  int mixer = sound_ay_registers[7];
+  int env_held = sound_ay_envelope_held( sound_ay_registers[13] );
+  int g, level;
+
+  if( !sound_ay_present() ) return 1;
+
+  for( g = 0; g < 3; g++ ) {
+    if( sound_ay_registers[ 8 + g ] & 16 ) {
+      if( !env_held ) return 0;
+      level = ay_tone_levels[ ay_env_counter ];
+    } else {
+      level = ay_tone_levels[ sound_ay_registers[ 8 + g ] & 15 ];
+    }
+
+    if( level && ( mixer & ( 0x09 << g ) ) != ( 0x09 << g ) ) return 0;
+  }
+
+  return 1;
+}
+
 static void
-sound_ay_overlay( void )
+sound_ay_overlay( const struct ay_change_tag *change_ptr, int changes_left )
 {
-  static int rng = 1;
-  static int noise_toggle = 0;
-  static int env_first = 1, env_rev = 0, env_counter = 15;
   int tone_level[3];
   int mixer, envshape;
   int g, level;
   libspectrum_dword f;
-  struct ay_change_tag *change_ptr = ay_change;
-  int changes_left = ay_change_count;
   int reg, r;
   int chan1, chan2, chan3;
-  int last_chan1 = 0, last_chan2 = 0, last_chan3 = 0;
-  unsigned int tone_count, noise_count;
+  int last_chan[3] = { 0, 0, 0 };
+  unsigned int tone_count, noise_count, steps;
 
   /* If no AY chip, don't produce any AY sound (!) */
-  if( !( periph_is_active( PERIPH_TYPE_FULLER) ||
-         periph_is_active( PERIPH_TYPE_MELODIK ) ||
-         machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_AY ) )
-    return;
+  if( !sound_ay_present() ) return;
 
   for( f = 0; f < machine_current->timings.tstates_per_frame;
-       f+= AY_CLOCK_DIVISOR * AY_CLOCK_RATIO ) {
+       f+= AY_STEP ) {
     /* update ay registers. */
     while( changes_left && f >= change_ptr->tstates ) {
       sound_ay_registers[ reg = change_ptr->reg ] = change_ptr->val;
@@ -477,20 +1073,33 @@ sound_ay_overlay( void )
         break;
       case 13:
         ay_env_internal_tick = ay_env_tick = ay_env_cycles = 0;
-        env_first = 1;
-        env_rev = 0;
-        env_counter = ( sound_ay_registers[13] & AY_ENV_ATTACK ) ? 0 : 15;
+        ay_env_first = 1;
+        ay_env_rev = 0;
+        ay_env_counter = ( sound_ay_registers[13] & AY_ENV_ATTACK ) ? 0 : 15;
         break;
       }
     }
 
+    /* Until the next register write nothing changes, so see if we can
+       skip straight there */
+    steps = sound_ay_stretch(
+      f, changes_left &&
+         change_ptr->tstates < machine_current->timings.tstates_per_frame ?
+         change_ptr->tstates : machine_current->timings.tstates_per_frame,
+      last_chan
+    );
+    if( steps ) {
+      f += ( steps - 1 ) * AY_STEP;
+      continue;
+    }
+
     /* the tone level if no enveloping is being used */
     for( g = 0; g < 3; g++ )
       tone_level[g] = ay_tone_levels[ sound_ay_registers[ 8 + g ] & 15 ];
 
     /* envelope */
     envshape = sound_ay_registers[13];
-    level = ay_tone_levels[ env_counter ];
+    level = ay_tone_levels[ ay_env_counter ];
 
     for( g = 0; g < 3; g++ )
       if( sound_ay_registers[ 8 + g ] & 16 )
@@ -506,41 +1115,7 @@ sound_ay_overlay( void )
       while( ay_env_tick >= ay_env_period ) {
         ay_env_tick -= ay_env_period;
 
-        /* do a 1/16th-of-period incr/decr if needed */
-        if( env_first ||
-            ( ( envshape & AY_ENV_CONT ) && !( envshape & AY_ENV_HOLD ) ) ) {
-          if( env_rev )
-            env_counter -= ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          else
-            env_counter += ( envshape & AY_ENV_ATTACK ) ? 1 : -1;
-          if( env_counter < 0 )
-            env_counter = 0;
-          if( env_counter > 15 )
-            env_counter = 15;
-        }
-
-        ay_env_internal_tick++;
-        while( ay_env_internal_tick >= 16 ) {
-          ay_env_internal_tick -= 16;
-
-          /* end of cycle */
-          if( !( envshape & AY_ENV_CONT ) )
-            env_counter = 0;
-          else {
-            if( envshape & AY_ENV_HOLD ) {
-              if( env_first && ( envshape & AY_ENV_ALT ) )
-                env_counter = ( env_counter ? 0 : 15 );
-            } else {
-              /* non-hold */
-              if( envshape & AY_ENV_ALT )
-                env_rev = !env_rev;
-              else
-                env_counter = ( envshape & AY_ENV_ATTACK ) ? 0 : 15;
-            }
-          }
-
-          env_first = 0;
-        }
+        sound_ay_envelope_period( envshape );
 
         /* don't keep trying if period is zero */
         if( !ay_env_period )
@@ -566,59 +1141,29 @@ sound_ay_overlay( void )
       level = chan1;
       ay_do_tone( level, tone_count, &chan1, 0 );
     }
-    if( ( mixer & 0x08 ) == 0 && noise_toggle )
+    if( ( mixer & 0x08 ) == 0 && ay_noise_toggle )
       chan1 = 0;
 
     if( ( mixer & 2 ) == 0 ) {
       level = chan2;
       ay_do_tone( level, tone_count, &chan2, 1 );
     }
-    if( ( mixer & 0x10 ) == 0 && noise_toggle )
+    if( ( mixer & 0x10 ) == 0 && ay_noise_toggle )
       chan2 = 0;
 
     if( ( mixer & 4 ) == 0 ) {
       level = chan3;
       ay_do_tone( level, tone_count, &chan3, 2 );
     }
-    if( ( mixer & 0x20 ) == 0 && noise_toggle )
+    if( ( mixer & 0x20 ) == 0 && ay_noise_toggle )
       chan3 = 0;
 
-    if( last_chan1 != chan1 ) {
-      blip_synth_update( ay_a_synth, f, chan1 );
-      if( ay_a_synth_r ) blip_synth_update( ay_a_synth_r, f, chan1 );
-      last_chan1 = chan1;
-    }
-    if( last_chan2 != chan2 ) {
-      blip_synth_update( ay_b_synth, f, chan2 );
-      if( ay_b_synth_r ) blip_synth_update( ay_b_synth_r, f, chan2 );
-      last_chan2 = chan2;
-    }
-    if( last_chan3 != chan3 ) {
-      blip_synth_update( ay_c_synth, f, chan3 );
-      if( ay_c_synth_r ) blip_synth_update( ay_c_synth_r, f, chan3 );
-      last_chan3 = chan3;
-    }
+    sound_ay_output( 0, f, chan1, last_chan );
+    sound_ay_output( 1, f, chan2, last_chan );
+    sound_ay_output( 2, f, chan3, last_chan );
 
     /* update noise RNG/filter */
-    ay_noise_tick += noise_count;
-    while( ay_noise_tick >= ay_noise_period ) {
-      ay_noise_tick -= ay_noise_period;
-
-      if( ( rng & 1 ) ^ ( ( rng & 2 ) ? 1 : 0 ) )
-        noise_toggle = !noise_toggle;
-
-      /* rng is 17-bit shift reg, bit 0 is output.
-       * input is bit 0 xor bit 3.
-       */
-      if( rng & 1 ) {
-        rng ^= 0x24000;
-      }
-      rng >>= 1;
-
-      /* don't keep trying if period is zero */
-      if( !ay_noise_period )
-        break;
-    }
+    sound_ay_noise_advance( noise_count );
   }
 }
 
@@ -644,6 +1189,9 @@ sound_ay_reset( void )
 {
   int f;
 
+  /* The AY's state belongs to whoever is making the sound */
+  sound_thread_sync();
+
   /* recalculate timings based on new machines ay clock */
   sound_ay_init();
 
@@ -655,6 +1203,37 @@ sound_ay_reset( void )
   ay_tone_cycles = ay_env_cycles = 0;
 }
 
+/* Pass the level changes in `changes' on to the synths */
+static void
+sound_source_flush( const struct source_change_tag *changes, int count )
+{
+  const struct source_change_tag *end = changes + count;
+
+  for( ; changes < end; changes++ )
+    sound_mix( changes->source, changes->tstates, changes->val );
+}
+
+/* Don't make the change immediately; record it for sound_frame() to
+   pass on with the rest of the frame's changes. If there are too many,
+   pass on those so far now, once the synths are free */
+static void
+sound_source_change( sound_source source, libspectrum_dword at_tstates,
+                     int val )
+{
+  if( !sound_enabled ) return;
+
+  if( source_change_count == SOURCE_CHANGE_MAX ) {
+    sound_thread_sync();
+    sound_source_flush( source_change, source_change_count );
+    source_change_count = 0;
+  }
+
+  source_change[ source_change_count ].tstates = at_tstates;
+  source_change[ source_change_count ].source = source;
+  source_change[ source_change_count ].val = val;
+  source_change_count++;
+}
+
 /*
  * sound_specdrum_write - very simple routine
  * as the output is already a digitized waveform
@@ -663,10 +1242,7 @@ void
 sound_specdrum_write( libspectrum_word port GCC_UNUSED, libspectrum_byte val )
 {
   if( periph_is_active( PERIPH_TYPE_SPECDRUM ) ) {
-    blip_synth_update( left_specdrum_synth, tstates, ( val - 128) * 128);
-    if( right_specdrum_synth ) {
-      blip_synth_update( right_specdrum_synth, tstates, ( val - 128) * 128);
-    }
+    sound_source_change( SOUND_SOURCE_SPECDRUM, tstates, ( val - 128) * 128);
     machine_current->specdrum.specdrum_dac = val - 128;
   }
 }
@@ -680,45 +1256,384 @@ sound_covox_write( libspectrum_word port GCC_UNUSED, libspectrum_byte val )
 {
   if( periph_is_active( PERIPH_TYPE_COVOX_FB ) ||
       periph_is_active( PERIPH_TYPE_COVOX_DD ) ) {
-    blip_synth_update( left_covox_synth, tstates, val * 128);
-    if( right_covox_synth ) {
-      blip_synth_update( right_covox_synth, tstates, val * 128);
-    }
+    sound_source_change( SOUND_SOURCE_COVOX, tstates, val * 128);
     machine_current->covox.covox_dac = val;
   }
 }
 
+/* Nudge the rate at which the emulated clock is turned into samples to
+   keep the output queue at its target depth: if we're falling behind,
+   every frame gives a little more sound, and the other way round. The
+   pitch changes by at most SOUND_RATE_ADJUST_MAX, which can't be heard */
+static void
+sound_rate_follow( double depth, double target )
+{
+  double deviation;
+
+  deviation = ( depth - target ) / target;
+  if( deviation > 1 ) deviation = 1;
+  else if( deviation < -1 ) deviation = -1;
+
+  /* Move gently towards the new adjustment so the pitch doesn't wobble */
+  sound_rate_adjust += ( deviation * SOUND_RATE_ADJUST_MAX -
+                         sound_rate_adjust ) / 16;
+
+  sound_set_clock_rate();
+}
+
+/* Turn the emulated clock into samples at the rate it's running at,
+   with the current adjustment */
+static void
+sound_set_clock_rate( void )
+{
+  long rate;
+
+  rate = sound_get_effective_processor_speed() * ( 1 + sound_rate_adjust ) +
+         0.5;
+  blip_buffer_set_clock_rate( left_buf, rate );
+  if( sound_stereo_ay != SOUND_STEREO_AY_NONE )
+    blip_buffer_set_clock_rate( right_buf, rate );
+}
+
 void
-sound_frame( void )
+sound_lowlevel_queued( double queued, double target )
 {
-  long count;
+  if( target > 0 && !timer_turbo ) sound_rate_follow( queued, target );
+}
 
-  if( !sound_enabled )
-    return;
+#ifdef SOUND_FIFO
+static void
+sound_rate_control( void )
+{
+  sound_fifo_depth = (double)sfifo_used( &sound_fifo ) / sound_frame_bytes;
+  sound_rate_follow( sound_fifo_depth, SOUND_FIFO_TARGET_FRAMES );
+}
+
+/* Wait until another frame of sound can be added without taking the fifo
+   over its target depth. Returns 0 on a timeout */
+int
+sound_fifo_wait( int timeout_ms )
+{
+  int space = sound_fifo.size - 1 -
+              ( SOUND_FIFO_TARGET_FRAMES - 1 ) * sound_frame_bytes;
+
+  return sfifo_wait_space( &sound_fifo, space, timeout_ms );
+}
+#endif                          /* #ifdef SOUND_FIFO */
+
+/* In turbo mode, drop any frame of sound which the device isn't ready
+   for rather than waiting for it to be played, which would pull the
+   emulation back down to normal speed */
+static int
+sound_turbo_drop( long count )
+{
+#ifdef SOUND_FIFO
+  return sfifo_space( &sound_fifo ) < count * (long)sizeof( blip_sample_t );
+#else                           /* #ifdef SOUND_FIFO */
+  /* Without a fifo, we can't tell; just pass on one frame in every n */
+  static int frame_count = 0;
+
+  if( ++frame_count < settings_current.turbo_frame_rate ) return 1;
+
+  frame_count = 0;
+  return 0;
+#endif                          /* #ifdef SOUND_FIFO */
+}
 
-  /* overlay AY sound */
-  sound_ay_overlay();
+/* Is every sample (on each side) of the `count' just read the same? */
+static int
+sound_samples_flat( long count )
+{
+  long i;
+
+  for( i = sound_channels; i < count; i++ )
+    if( samples[i] != samples[ i % sound_channels ] ) return 0;
+
+  return 1;
+}
+
+/* Make a frame of the settled output level without running the synths;
+   nothing has been added to the buffers, so they just need moving on.
+   Returns the number of samples, as blip_buffer_read_*() would */
+static long
+sound_silent_frame( void )
+{
+  long count, i;
 
   blip_buffer_end_frame( left_buf, machine_current->timings.tstates_per_frame );
+  count = blip_buffer_samples_avail( left_buf );
 
   if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
-    blip_buffer_end_frame( right_buf, machine_current->timings.tstates_per_frame );
+    blip_buffer_end_frame( right_buf,
+                           machine_current->timings.tstates_per_frame );
+    if( count > blip_buffer_samples_avail( right_buf ) )
+      count = blip_buffer_samples_avail( right_buf );
+  }
+
+  if( count > sound_framesiz ) count = sound_framesiz;
+
+  blip_buffer_remove_silence( left_buf, count );
+  if( sound_stereo_ay != SOUND_STEREO_AY_NONE )
+    blip_buffer_remove_silence( right_buf, count );
+
+  for( i = sound_silent_count * sound_channels; i < count * sound_channels;
+       i++ )
+    samples[i] = samples[ i % sound_channels ];
+  if( count > sound_silent_count ) sound_silent_count = count;
+
+  return count * sound_channels;
+}
 
-    /* Read left channel into even samples, right channel into odd samples:
-       LRLRLRLRLR... */
-    count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, 1 );
-    blip_buffer_read_samples( right_buf, samples + 1, count, 1 );
-    count <<= 1;
+/* Make and play a frame of sound from its level changes and AY register
+   writes. The frame timing probes belong to the emulation thread, so
+   the AY isn't timed when `threaded' says this is the sound thread */
+static void
+sound_synthesize( const struct source_change_tag *changes, int change_count,
+                  const struct ay_change_tag *ay_changes, int ay_count,
+                  int threaded )
+{
+  long count;
+
+  sound_source_flush( changes, change_count );
+
+  /* overlay AY sound, unless it can't be doing anything */
+  if( ay_count || !sound_ay_quiet() ) {
+    if( threaded ) {
+      sound_ay_overlay( ay_changes, ay_count );
+    } else {
+      FRAMETIME_ENTER( FRAMETIME_PROBE_AY );
+      sound_ay_overlay( ay_changes, ay_count );
+      FRAMETIME_LEAVE();
+    }
+  }
+
+  if( sound_output_changed ) {
+    sound_quiet_frames = 0;
+    sound_silent = 0;
   } else {
-    count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, BLIP_BUFFER_DEF_STEREO );
+    sound_quiet_frames++;
   }
+  sound_output_changed = 0;
+
+  if( sound_silent ) {
+    count = sound_silent_frame();
+  } else {
 
-  if( settings_current.sound ) 
-    sound_lowlevel_frame( samples, count );
+    blip_buffer_end_frame( left_buf,
+                           machine_current->timings.tstates_per_frame );
+
+    if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
+      blip_buffer_end_frame( right_buf,
+                             machine_current->timings.tstates_per_frame );
+
+      /* Read left channel into even samples, right channel into odd
+         samples: LRLRLRLRLR... */
+      count = blip_buffer_read_stereo_samples( left_buf, right_buf, samples,
+                                               sound_framesiz );
+      count <<= 1;
+    } else {
+      count = blip_buffer_read_samples( left_buf, samples, sound_framesiz,
+                                        BLIP_BUFFER_DEF_STEREO );
+    }
+
+    /* After a whole frame with nothing added, anything added before has
+       been read out; if that left the output flat, it'll stay there */
+    if( sound_quiet_frames >= 2 && count && sound_samples_flat( count ) ) {
+      sound_silent = 1;
+      sound_silent_count = count / sound_channels;
+    }
+  }
+
+  if( sound_device_wanted() ) {
+    if( timer_turbo && sound_turbo_drop( count ) ) {
+      sound_stats_pending.overruns++;
+    } else {
+      sound_lowlevel_frame( samples, count );
+#ifdef SOUND_FIFO
+      if( !timer_turbo ) sound_rate_control();
+#endif
+    }
+  }
 
   if( movie_recording )
       movie_add_sound( samples, count );
-  ay_change_count = 0;
+
+  if( export_active ) export_add_sound( samples, count );
+
+  if( shmexport_active ) shmexport_add_sound( samples, count );
+
+  if( soundrec_recording ) soundrec_add( samples, count );
+}
+
+/* Making the sound on a thread of its own, one frame behind the
+   emulation: at the end of each frame, its changes are handed over and
+   made into sound while the next frame is emulated */
+
+#ifdef HAVE_PTHREAD
+
+static pthread_t sound_thread;
+static int sound_thread_running = 0;
+
+/* Protects sound_job_pending and sound_thread_quit */
+static pthread_mutex_t sound_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sound_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sound_done_cond = PTHREAD_COND_INITIALIZER;
+static int sound_job_pending = 0;
+static int sound_thread_quit = 0;
+
+/* The frame being made into sound by the thread */
+static struct source_change_tag sound_job_change[ SOURCE_CHANGE_MAX ];
+static int sound_job_change_count;
+static struct ay_change_tag sound_job_ay_change[ AY_CHANGE_MAX ];
+static int sound_job_ay_change_count;
+
+static void*
+sound_thread_run( void *arg GCC_UNUSED )
+{
+  thread_sched_apply( THREAD_SCHED_AUDIO );
+
+  pthread_mutex_lock( &sound_thread_mutex );
+
+  while( 1 ) {
+    while( !sound_job_pending && !sound_thread_quit )
+      pthread_cond_wait( &sound_job_cond, &sound_thread_mutex );
+    if( !sound_job_pending ) break;
+
+    pthread_mutex_unlock( &sound_thread_mutex );
+    sound_synthesize( sound_job_change, sound_job_change_count,
+                      sound_job_ay_change, sound_job_ay_change_count, 1 );
+    pthread_mutex_lock( &sound_thread_mutex );
+
+    sound_job_pending = 0;
+    pthread_cond_signal( &sound_done_cond );
+  }
+
+  pthread_mutex_unlock( &sound_thread_mutex );
+
+  return NULL;
+}
+
+static void
+sound_thread_start( void )
+{
+  sound_job_pending = sound_thread_quit = 0;
+
+  if( pthread_create( &sound_thread, NULL, sound_thread_run, NULL ) ) return;
+
+  sound_thread_running = 1;
+}
+
+/* Wait for the thread to finish the frame it has, so the synths, buffers
+   and AY state can be used from here */
+static void
+sound_thread_sync( void )
+{
+  if( !sound_thread_running ) return;
+
+  pthread_mutex_lock( &sound_thread_mutex );
+  while( sound_job_pending )
+    pthread_cond_wait( &sound_done_cond, &sound_thread_mutex );
+  pthread_mutex_unlock( &sound_thread_mutex );
+}
+
+static void
+sound_thread_stop( void )
+{
+  if( !sound_thread_running ) return;
+
+  pthread_mutex_lock( &sound_thread_mutex );
+  sound_thread_quit = 1;
+  pthread_cond_signal( &sound_job_cond );
+  pthread_mutex_unlock( &sound_thread_mutex );
+
+  /* The thread finishes any frame it has before it looks at the quit
+     flag */
+  pthread_join( sound_thread, NULL );
+  sound_thread_running = 0;
+
+  sound_stats_fold();
+}
+
+/* Hand this frame's changes over to the thread */
+static void
+sound_thread_submit( void )
+{
+  sound_thread_sync();
+  sound_stats_fold();
+
+  memcpy( sound_job_change, source_change,
+          source_change_count * sizeof( *source_change ) );
+  sound_job_change_count = source_change_count;
+  memcpy( sound_job_ay_change, ay_change,
+          ay_change_count * sizeof( *ay_change ) );
+  sound_job_ay_change_count = ay_change_count;
+
+  pthread_mutex_lock( &sound_thread_mutex );
+  sound_job_pending = 1;
+  pthread_cond_signal( &sound_job_cond );
+  pthread_mutex_unlock( &sound_thread_mutex );
+}
+
+#else				/* #ifdef HAVE_PTHREAD */
+
+static void
+sound_thread_sync( void )
+{
+}
+
+static void
+sound_thread_stop( void )
+{
+}
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
+void
+sound_frame( void )
+{
+  if( !sound_enabled )
+    return;
+
+#ifdef HAVE_PTHREAD
+  /* A movie or an export needs each frame's sound as the frame is
+     recorded */
+  if( settings_current.sound_thread && !movie_recording && !export_active ) {
+    if( !sound_thread_running ) sound_thread_start();
+  } else {
+    sound_thread_stop();
+  }
+
+  if( sound_thread_running ) {
+    sound_thread_submit();
+    source_change_count = ay_change_count = 0;
+    return;
+  }
+#endif				/* #ifdef HAVE_PTHREAD */
+
+  sound_synthesize( source_change, source_change_count,
+                    ay_change, ay_change_count, 0 );
+  sound_stats_fold();
+  source_change_count = ay_change_count = 0;
+}
+
+/* Emulate frames which are going to be thrown away without generating
+   any sound for them; anything they write to the AY is forgotten again
+   when sound_discard_stop() is called */
+static int discard_sound_enabled, discard_ay_change_count;
+
+void
+sound_discard_start( void )
+{
+  discard_sound_enabled = sound_enabled;
+  discard_ay_change_count = ay_change_count;
+  sound_enabled = 0;
+}
+
+void
+sound_discard_stop( void )
+{
+  sound_enabled = discard_sound_enabled;
+  ay_change_count = discard_ay_change_count;
 }
 
 void
@@ -741,7 +1656,8 @@ sound_beeper( libspectrum_dword at_tstates, int on )
 
   val = beeper_ampl[on];
 
-  blip_synth_update( left_beeper_synth, at_tstates, val );
-  if( sound_stereo_ay != SOUND_STEREO_AY_NONE )
-    blip_synth_update( right_beeper_synth, at_tstates, val );
+  if( val == beeper_last_val ) return;
+  beeper_last_val = val;
+
+  sound_source_change( SOUND_SOURCE_BEEPER, at_tstates, val );
 }
@@ -33,16 +33,55 @@ void sound_init( const char *device );
 void sound_pause( void );
 void sound_unpause( void );
 void sound_end( void );
+void sound_machine_changed( void );
 void sound_ay_write( int reg, int val, libspectrum_dword now );
 void sound_ay_reset( void );
 void sound_specdrum_write( libspectrum_word port, libspectrum_byte val );
 void sound_covox_write( libspectrum_word port, libspectrum_byte val );
 void sound_frame( void );
 void sound_beeper( libspectrum_dword at_tstates, int on );
+void sound_discard_start( void );
+void sound_discard_stop( void );
 libspectrum_dword sound_get_effective_processor_speed( void );
 
 extern int sound_enabled;
 extern int sound_framesiz;
+extern int sound_freq;
+
+/* How well the sound device is keeping up. Each count is only ever
+   changed from one thread: underruns from whichever thread feeds the
+   device, everything else from the emulation thread, which folds in
+   what the sound thread has counted once it's in step */
+typedef struct sound_stats_t {
+
+  libspectrum_dword underruns;	/* Times the device ran out of sound */
+  libspectrum_dword overruns;	/* Frames dropped as the device was full */
+  double blocked;		/* Seconds spent waiting on the device */
+
+} sound_stats_t;
+
+extern sound_stats_t sound_stats;
+
+/* Called by the low-level drivers after anything which may block,
+   with the compat_timer_get_time() from before it */
+void sound_stats_blocked( double since );
+
+/* The fifo-based sound drivers are paced to keep this many frames of sound
+   queued, by nudging the output rate by up to this fraction */
+#define SOUND_FIFO_TARGET_FRAMES 2
+#define SOUND_RATE_ADJUST_MAX 0.005
+
+extern float sound_fifo_depth;
+extern float sound_rate_adjust;
+
+#ifdef SOUND_FIFO
+int sound_fifo_wait( int timeout_ms );
+#endif                          /* #ifdef SOUND_FIFO */
+
+/* Drivers without a fifo which can tell how much they have queued call
+   this after each frame, with that and how much they want queued in the
+   same units, so the output rate is nudged as it is for a fifo */
+void sound_lowlevel_queued( double queued, double target );
 
 /* Stereo separation types:
  *  * ACB is used in the Melodik interface.
@@ -37,6 +37,7 @@
 
 #include <alsa/asoundlib.h>
 
+#include "compat.h"
 #include "settings.h"
 #include "sfifo.h"
 #include "sound.h"
@@ -53,6 +54,17 @@ static const char *pcm_name = NULL;
 static int verb = 0;
 static snd_pcm_uframes_t exact_periodsize, exact_bsize;
 
+/* In low latency mode (the `latency=' option), the buffer is made of
+   small periods and is written through mmap; rather than blocking until
+   the whole frame fits, we wait a period at a time until what is still
+   queued is down to where this frame keeps it at the wanted latency */
+static int low_latency = 0;
+static int use_mmap;
+
+/* How many frames of sound to have queued on average, and how many to
+   wait for the queue to drop to before writing a Spectrum frame's worth */
+static snd_pcm_uframes_t latency_frames, wait_frames;
+
 static snd_output_t *output = NULL;
 
 void
@@ -75,7 +87,7 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
   static int init_running = 0;
   const char *option;
   char tmp;
-  int err, dir, nperiods = NUM_FRAMES;
+  int err, dir, nperiods = NUM_FRAMES, latency = 0;
 
   float hz;
 
@@ -112,6 +124,14 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
       } else {
         avail_min = val;
       }
+    } else if( ( err = sscanf( option, " latency=%i %n%c", &val, &n, &tmp ) > 0 ) &&
+		( tmp == ',' || strlen( option ) == n ) ) {
+      if( val < 1 ) {
+	fprintf( stderr, "Bad value for ALSA latency %i ms, not using low latency mode\n",
+		    val );
+      } else {
+        latency = val;
+      }
     } else if( ( err = sscanf( option, " verbose %n%c", &n, &tmp ) == 1 ) &&
 		( tmp == ','  || strlen( option ) == n ) ) {
       verb = 1;
@@ -167,7 +187,14 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     return 1;
   }
 
-  if( snd_pcm_hw_params_set_access( pcm_handle, hw_params,
+  /* Low latency mode writes straight into the buffer if it can */
+  low_latency = latency > 0;
+  use_mmap = low_latency &&
+             snd_pcm_hw_params_set_access( pcm_handle, hw_params,
+                                           SND_PCM_ACCESS_MMAP_INTERLEAVED ) >= 0;
+
+  if( !use_mmap &&
+      snd_pcm_hw_params_set_access( pcm_handle, hw_params,
                                     SND_PCM_ACCESS_RW_INTERLEAVED ) < 0) {
     settings_current.sound = 0;
     ui_error( UI_ERROR_ERROR, "couldn't set access interleaved on '%s'.",
@@ -241,12 +268,23 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     }
   }
 
-  if( bsize == 0 ) {
-    /* Adjust relative processor speed to deal with adjusting sound generation
-       frequency against emulation speed (more flexible than adjusting generated
-       sample rate) */
-    hz = (float)sound_get_effective_processor_speed() /
-              machine_current->timings.tstates_per_frame;
+  /* Adjust relative processor speed to deal with adjusting sound generation
+     frequency against emulation speed (more flexible than adjusting generated
+     sample rate) */
+  hz = (float)sound_get_effective_processor_speed() /
+            machine_current->timings.tstates_per_frame;
+
+  if( low_latency ) {
+    snd_pcm_uframes_t frame = *freqptr / hz;
+
+    /* Four periods to the wanted latency, and enough of them to hold that
+       much as well as a whole frame and a period to spare */
+    latency_frames = (snd_pcm_uframes_t)*freqptr * latency / 1000;
+    if( latency_frames < frame / 2 + 64 ) latency_frames = frame / 2 + 64;
+    exact_periodsize = sound_periodsize = latency_frames / 4;
+    nperiods = ( latency_frames + frame ) / sound_periodsize + 2;
+    bsize = 0;
+  } else if( bsize == 0 ) {
     /* Amount of audio data we will accumulate before yielding back to the OS.
        Not much point having more than 100Hz playback, we probably get
        downgraded by the OS as being a hog too (unlimited Hz limits playback
@@ -312,8 +350,23 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     return 1;
   }
 
+  if( low_latency ) {
+    /* Wait for the queue to drop to where adding a frame takes it to half
+       a frame over the latency, so it averages out at the latency. The
+       periods may not have been the size asked for */
+    snd_pcm_uframes_t frame = *freqptr / hz;
+
+    latency_frames = exact_periodsize * 4;
+    wait_frames = latency_frames > frame / 2 + exact_periodsize ?
+                  latency_frames - frame / 2 : exact_periodsize;
+    if( exact_bsize < wait_frames + frame + exact_periodsize )
+      fprintf( stderr, "ALSA buffer of %d frames is too small for %d ms "
+               "latency.\n", (int)exact_bsize, latency );
+  }
+
   if( ( err = snd_pcm_sw_params_set_start_threshold( pcm_handle,
-		     sw_params, exact_periodsize * ( nperiods - 1 ) ) ) < 0 ) {
+		     sw_params, low_latency ? wait_frames :
+                     exact_periodsize * ( nperiods - 1 ) ) ) < 0 ) {
     ui_error( UI_ERROR_ERROR,"couldn't set start_treshold on %s: %s", pcm_name,
               snd_strerror ( err ) );
     snd_pcm_close( pcm_handle );
@@ -321,8 +374,10 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     return 1;
   }
 
+  /* In low latency mode, wake every period to see how far the queue has
+     got */
   if( !avail_min )
-    avail_min = exact_periodsize >> 1;
+    avail_min = low_latency ? exact_periodsize : exact_periodsize >> 1;
   if( snd_pcm_sw_params_set_avail_min( pcm_handle,
 		    sw_params, avail_min ) < 0 ) {
 #if SND_LIB_VERSION < 0x10010
@@ -362,12 +417,122 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 
 
 
+/* Get going again after an underrun or a suspend */
+static void
+recover( int err )
+{
+  if( err == -EPIPE ) sound_stats.underruns++;
+  if( snd_pcm_recover( pcm_handle, err, 1 ) < 0 ) snd_pcm_prepare( pcm_handle );
+  if( verb )
+    fprintf( stderr, "ALSA: *buffer underrun*!\n" );
+}
+
+/* Wait a period at a time until `len' frames fit and what is queued is
+   down to wait_frames */
+static void
+wait_low_latency( snd_pcm_uframes_t len )
+{
+  snd_pcm_sframes_t avail, delay;
+  int err;
+
+  while( 1 ) {
+
+    /* Until it's running, there's nothing to wait for */
+    if( snd_pcm_state( pcm_handle ) != SND_PCM_STATE_RUNNING ) return;
+
+    avail = snd_pcm_avail_update( pcm_handle );
+    if( avail < 0 ) { recover( avail ); return; }
+
+    if( snd_pcm_delay( pcm_handle, &delay ) < 0 ) delay = 0;
+
+    if( (snd_pcm_uframes_t)avail >= len &&
+        ( delay < 0 || (snd_pcm_uframes_t)delay <= wait_frames ) )
+      return;
+
+    err = snd_pcm_wait( pcm_handle, 100 );
+    if( err < 0 ) { recover( err ); return; }
+  }
+}
+
+/* Copy the frame straight into the buffer */
+static void
+write_mmap( libspectrum_signed_word *data, snd_pcm_uframes_t len )
+{
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t offset, frames;
+  snd_pcm_sframes_t committed;
+  int err;
+
+  while( len ) {
+    frames = len;
+    err = snd_pcm_mmap_begin( pcm_handle, &areas, &offset, &frames );
+    if( err < 0 ) { recover( err ); continue; }
+
+    if( !frames ) {
+      err = snd_pcm_wait( pcm_handle, 100 );
+      if( err < 0 ) recover( err );
+      continue;
+    }
+
+    memcpy( (char*)areas[0].addr + ( areas[0].first +
+                                      offset * areas[0].step ) / 8,
+            data, frames * framesize );
+
+    committed = snd_pcm_mmap_commit( pcm_handle, offset, frames );
+    if( committed < 0 ) { recover( committed ); continue; }
+
+    data += committed * ch;
+    len -= committed;
+  }
+
+  /* mmap writes don't start the stream by themselves */
+  if( snd_pcm_state( pcm_handle ) == SND_PCM_STATE_PREPARED ) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update( pcm_handle );
+    if( avail >= 0 && exact_bsize - avail >= wait_frames )
+      snd_pcm_start( pcm_handle );
+  }
+}
+
+static void
+frame_low_latency( libspectrum_signed_word *data, snd_pcm_uframes_t len )
+{
+  snd_pcm_sframes_t delay;
+  snd_pcm_uframes_t left = len;
+  int ret;
+
+  wait_low_latency( len );
+
+  if( use_mmap ) {
+    write_mmap( data, len );
+  } else {
+    while( left ) {
+      ret = snd_pcm_writei( pcm_handle, data, left );
+      if( ret < 0 ) { recover( ret ); continue; }
+      data += ret * ch;
+      left -= ret;
+    }
+  }
+
+  /* Let the output rate follow what's actually queued, which should be
+     a frame more than we waited for */
+  if( snd_pcm_delay( pcm_handle, &delay ) >= 0 && delay >= 0 )
+    sound_lowlevel_queued( delay, wait_frames + len );
+}
+
 void
 sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 {
   int ret = 0;
+  double start;
   len /= ch;	/* now in frames */
 
+  if( low_latency ) {
+    start = compat_timer_get_time();
+    frame_low_latency( data, len );
+    sound_stats_blocked( start );
+    return;
+  }
+
 /*	to measure sound lag :-)
   snd_pcm_status_t *status;
   snd_pcm_sframes_t delay;
@@ -378,8 +543,11 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
   fprintf( stderr, "%d ", (int)delay );
 */
 
+  start = compat_timer_get_time();
+
   while( ( ret = snd_pcm_writei( pcm_handle, data, len ) ) != len ) {
     if( ret < 0 ) {
+      if( ret == -EPIPE ) sound_stats.underruns++;
       snd_pcm_prepare( pcm_handle );
       if( verb )
         fprintf( stderr, "ALSA: *buffer underrun*!\n" );
@@ -387,4 +555,6 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
         len -= ret;
     }
   }
+
+  sound_stats_blocked( start );
 }
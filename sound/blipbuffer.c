@@ -88,11 +88,28 @@ blip_synth_offset_resampled( Blip_Synth * synth, blip_resampled_time_t time,
   phase =
     ( int )( time >> ( BLIP_BUFFER_ACCURACY - BLIP_PHASE_BITS ) &
              ( BLIP_RES - 1 ) );
-  imp = synth->impulses + BLIP_RES - phase;
   buf = blip_buf->buffer_ + ( time >> BLIP_BUFFER_ACCURACY );
+  fwd = ( BLIP_WIDEST_IMPULSE_ - BLIP_SYNTH_QUALITY ) / 2;
+
+  if( synth->impl.kernel ) {
+    const short *kernel = synth->impl.kernel + phase * BLIP_SYNTH_QUALITY;
+    int i;
+
+    /* Every quality level is a multiple of four taps */
+    buf += fwd;
+    for( i = 0; i < BLIP_SYNTH_QUALITY; i += 4 ) {
+      buf[i] += ( long )kernel[i] * delta;
+      buf[i + 1] += ( long )kernel[i + 1] * delta;
+      buf[i + 2] += ( long )kernel[i + 2] * delta;
+      buf[i + 3] += ( long )kernel[i + 3] * delta;
+    }
+
+    return;
+  }
+
+  imp = synth->impulses + BLIP_RES - phase;
   i0 = *imp;
 
-  fwd = ( BLIP_WIDEST_IMPULSE_ - BLIP_SYNTH_QUALITY ) / 2;
   rev = fwd + BLIP_SYNTH_QUALITY - 2;
 
   BLIP_FWD( 0 );
@@ -140,6 +157,15 @@ blip_synth_update( Blip_Synth * synth, blip_time_t t, int amp )
                                synth->impl.buf );
 }
 
+void
+blip_synth_offset( Blip_Synth * synth, blip_time_t t, int delta )
+{
+  blip_synth_offset_resampled( synth,
+                               t * synth->impl.buf->factor_ +
+                               synth->impl.buf->offset_, delta,
+                               synth->impl.buf );
+}
+
 int
 _blip_synth_impulses_size( Blip_Synth_ * synth_ )
 {
@@ -222,6 +248,52 @@ blip_synth_end( Blip_Synth * synth )
     free( synth->impulses );
     synth->impulses = NULL;
   }
+  if( synth->impl.kernel ) {
+    free( synth->impl.kernel );
+    synth->impl.kernel = NULL;
+  }
+}
+
+/* Copy the impulses into the linear kernel: the first half of the taps for
+   a phase come from the forward half of the impulse, the rest from the
+   mirrored half, exactly as blip_synth_offset_resampled() walks them */
+static void
+blip_synth_fill_kernel( Blip_Synth_ * synth_ )
+{
+  int phase, i;
+
+  for( phase = 0; phase < BLIP_RES; phase++ ) {
+    short *kernel = synth_->kernel + phase * BLIP_SYNTH_QUALITY;
+
+    for( i = 0; i < BLIP_SYNTH_QUALITY / 2; i++ )
+      kernel[i] = synth_->impulses[BLIP_RES - phase + BLIP_RES * i];
+    for( ; i < BLIP_SYNTH_QUALITY; i++ )
+      kernel[i] =
+        synth_->impulses[phase + BLIP_RES * ( BLIP_SYNTH_QUALITY - 1 - i )];
+  }
+}
+
+blargg_err_t
+blip_synth_set_linear_kernel( Blip_Synth * synth, int linear )
+{
+  if( !linear ) {
+    if( synth->impl.kernel ) {
+      free( synth->impl.kernel );
+      synth->impl.kernel = NULL;
+    }
+    return 0;
+  }
+
+  if( !synth->impl.kernel ) {
+    synth->impl.kernel =
+      malloc( BLIP_RES * BLIP_SYNTH_QUALITY * sizeof( short ) );
+    if( !synth->impl.kernel )
+      return "Out of memory";
+  }
+
+  blip_synth_fill_kernel( &synth->impl );
+
+  return 0;
 }
 
 Blip_Synth *
@@ -366,6 +438,7 @@ _blip_synth_init( Blip_Synth_ * synth_, short *p )
   synth_->buf = NULL;
   synth_->last_amp = 0;
   synth_->delta_factor = 0;
+  synth_->kernel = NULL;
 }
 
 #define PI 3.1415926535897932384626433832795029
@@ -455,6 +528,9 @@ _blip_synth_adjust_impulse( Blip_Synth_ * synth_ )
 
     synth_->impulses[size - BLIP_RES + p] += error;
   }
+
+  if( synth_->kernel )
+    blip_synth_fill_kernel( synth_ );
 }
 
 
@@ -615,3 +691,57 @@ blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
 
   return count;
 }
+
+long
+blip_buffer_read_stereo_samples( Blip_Buffer * left, Blip_Buffer * right,
+                                 blip_sample_t * out, long max_samples )
+{
+  long count = blip_buffer_samples_avail( left );
+
+  if( count > blip_buffer_samples_avail( right ) )
+    count = blip_buffer_samples_avail( right );
+  if( count > max_samples )
+    count = max_samples;
+
+  if( count ) {
+    int sample_shift = BLIP_SAMPLE_BITS - 16;
+
+    int left_bass_shift = left->bass_shift;
+    int right_bass_shift = right->bass_shift;
+
+    long left_accum = left->reader_accum;
+    long right_accum = right->reader_accum;
+
+    buf_t_ *left_in = left->buffer_;
+    buf_t_ *right_in = right->buffer_;
+
+    int n;
+
+    for( n = count; n--; ) {
+      long l = left_accum >> sample_shift;
+      long r = right_accum >> sample_shift;
+
+      left_accum -= left_accum >> left_bass_shift;
+      left_accum += *left_in++;
+      right_accum -= right_accum >> right_bass_shift;
+      right_accum += *right_in++;
+
+      /* clamp samples */
+      if( ( blip_sample_t ) l != l )
+        l = 0x7FFF - ( l >> 24 );
+      if( ( blip_sample_t ) r != r )
+        r = 0x7FFF - ( r >> 24 );
+
+      out[0] = ( blip_sample_t ) l;
+      out[1] = ( blip_sample_t ) r;
+      out += 2;
+    }
+
+    left->reader_accum = left_accum;
+    right->reader_accum = right_accum;
+    blip_buffer_remove_samples( left, count );
+    blip_buffer_remove_samples( right, count );
+  }
+
+  return count;
+}
@@ -100,6 +100,14 @@ void blip_buffer_end_frame( Blip_Buffer * buff, blip_time_t time );
 long blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * dest,
                                long max_samples, int stereo );
 
+/*  Read at most 'max_samples' out of both 'left' and 'right' into 'dest' as
+ interleaved stereo pairs, removing them from both buffers. Gives exactly the
+ same output as two calls to read_samples() with stereo set, but in a single
+ pass. Returns number of pairs actually read and removed.
+*/
+long blip_buffer_read_stereo_samples( Blip_Buffer * left, Blip_Buffer * right,
+                                      blip_sample_t * dest, long max_samples );
+
 /*  Additional optional features */
 
 /*  Set frequency high-pass filter frequency, where higher values reduce bass more */
@@ -156,6 +164,9 @@ typedef struct Blip_Synth_s_ {
   Blip_Buffer *buf;
   int last_amp;
   int delta_factor;
+
+  /* If not NULL, the impulses rearranged so each phase's taps are adjacent */
+  short *kernel;
 } Blip_Synth_;
 
 int _blip_synth_impulses_size( Blip_Synth_ * synth_ );
@@ -195,6 +206,17 @@ Blip_Synth for each waveform. */
 void blip_synth_update( Blip_Synth * synth, blip_time_t time,
                         int amplitude );
 
+/*  Add an amplitude transition of specified delta at given time. Unlike
+ blip_synth_update(), this lets one Blip_Synth be shared by several
+ waveforms. */
+void blip_synth_offset( Blip_Synth * synth, blip_time_t time, int delta );
+
+/*  Use a linear copy of the impulses, so each update is a single
+ multiply-accumulate loop over adjacent taps, touching one cache line of
+ kernel rather than one per tap, and which the compiler can vectorise. The output is identical either way. Returns NULL on success,
+ otherwise an error if there isn't enough memory. */
+blargg_err_t blip_synth_set_linear_kernel( Blip_Synth * synth, int linear );
+
 /*  Low-level interface */
 
 void blip_synth_offset_resampled( Blip_Synth * synth,
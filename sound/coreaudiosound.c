@@ -26,6 +26,7 @@
 
 #include <AudioToolbox/AudioToolbox.h>
 
+#include "compat.h"
 #include "settings.h"
 #include "sfifo.h"
 #include "sound.h"
@@ -33,8 +34,9 @@
 
 sfifo_t sound_fifo;
 
-/* Number of Spectrum frames audio latency to use */
-#define NUM_FRAMES 2
+/* Number of Spectrum frames of sound the fifo can hold; the timer keeps
+   it at SOUND_FIFO_TARGET_FRAMES, leaving room for the odd late frame */
+#define NUM_FRAMES 4
 
 static
 OSStatus coreaudiowrite( void *inRefCon,
@@ -256,7 +258,9 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
     if( ( i = sfifo_write( &sound_fifo, bytes, len ) ) < 0 ) {
       break;
     } else if( !i ) {
-      usleep( 10000 );
+      double start = compat_timer_get_time();
+      sfifo_wait_space( &sound_fifo, len, 100 );
+      sound_stats_blocked( start );
     }
     bytes += i;
     len -= i;
@@ -295,9 +299,11 @@ OSStatus coreaudiowrite( void *inRefCon,
   int f;
   int len = deviceFormat.mBytesPerFrame * inNumberFrames;
   uint8_t* out = ioData->mBuffers[0].mData;
+  int used = sfifo_used( &sound_fifo );
 
   /* Try to only read an even number of bytes so as not to fragment a sample */
-  len = MIN( len, sfifo_used( &sound_fifo ) );
+  if( used < len ) sound_stats.underruns++;
+  len = MIN( len, used );
   len &= sound_stereo_ay != SOUND_STEREO_AY_NONE ? 0xfffc : 0xfffe;
 
   /* Read input_size bytes from fifo into sound stream */
@@ -37,10 +37,58 @@
 static LPDIRECTSOUND lpDS; /* DirectSound object */
 static LPDIRECTSOUNDBUFFER lpDSBuffer; /* sound buffer */
 
+/* The buffer signals an event at the boundary of each segment of
+   roughly this many milliseconds, so the writer can wait for space to
+   come free rather than polling the play cursor */
+#define NOTIFY_SEGMENT_MS 5
+#define MAX_NOTIFY_POSITIONS 64
+
 static DWORD nextpos; /* next position in circular buffer */
 
 static int sixteenbit;
 
+static HANDLE notify_event; /* NULL if notifications aren't available */
+
+static void
+notify_init( DWORD bytes_per_sec, WORD block_align )
+{
+  LPDIRECTSOUNDNOTIFY lpDSNotify;
+  DSBPOSITIONNOTIFY positions[ MAX_NOTIFY_POSITIONS ];
+  DWORD segment, count, i;
+
+  notify_event = NULL;
+
+  if( IDirectSoundBuffer_QueryInterface( lpDSBuffer, &IID_IDirectSoundNotify,
+                                         (void**)&lpDSNotify ) != DS_OK )
+    return;
+
+  segment = bytes_per_sec * NOTIFY_SEGMENT_MS / 1000;
+  segment -= segment % block_align;
+  if( segment < block_align ) segment = block_align;
+
+  count = MAX_AUDIO_BUFFER / segment;
+  if( count > MAX_NOTIFY_POSITIONS ) count = MAX_NOTIFY_POSITIONS;
+  if( count < 2 ) count = 2;
+
+  notify_event = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+  if( notify_event ) {
+    for( i = 0; i < count; i++ ) {
+      positions[i].dwOffset =
+        ( (DWORD)MAX_AUDIO_BUFFER / count * i ) / block_align * block_align;
+      positions[i].hEventNotify = notify_event;
+    }
+
+    if( IDirectSoundNotify_SetNotificationPositions( lpDSNotify, count,
+                                                     positions ) != DS_OK ) {
+      CloseHandle( notify_event );
+      notify_event = NULL;
+    }
+  }
+
+  IDirectSoundNotify_Release( lpDSNotify );
+}
+
 int
 sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 {
@@ -102,7 +150,8 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
   dsbd.dwBufferBytes = MAX_AUDIO_BUFFER;
 
   dsbd.dwFlags = DSBCAPS_GLOBALFOCUS | DSBCAPS_CTRLVOLUME | 
-                 DSBCAPS_CTRLFREQUENCY | DSBCAPS_STATIC | DSBCAPS_LOCSOFTWARE;
+                 DSBCAPS_CTRLFREQUENCY | DSBCAPS_STATIC | DSBCAPS_LOCSOFTWARE |
+                 DSBCAPS_CTRLPOSITIONNOTIFY;
 
   dsbd.dwSize = sizeof( DSBUFFERDESC );
   dsbd.lpwfxFormat = &pcmwf;
@@ -117,10 +166,14 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     return 1;
   }
   
+  /* notification positions must be set while the buffer is stopped */
+  notify_init( pcmwf.nAvgBytesPerSec, pcmwf.nBlockAlign );
+
   /* play buffer */
   if( IDirectSoundBuffer_Play( lpDSBuffer, 0, 0, DSBPLAY_LOOPING ) != DS_OK ) {
     settings_current.sound = 0;
     ui_error( UI_ERROR_ERROR, "Couldn't play sound." );
+    if( notify_event ) CloseHandle( notify_event );
     IDirectSoundBuffer_Release( lpDSBuffer );
     IDirectSound_Release( lpDS );
     CoUninitialize();
@@ -140,18 +193,36 @@ sound_lowlevel_end( void )
     ui_error( UI_ERROR_ERROR, "Couldn't stop sound." );
   }
 
+  if( notify_event ) {
+    CloseHandle( notify_event );
+    notify_event = NULL;
+  }
+
   IDirectSoundBuffer_Release( lpDSBuffer );
   IDirectSound_Release( lpDS );
   CoUninitialize();
 }
 
+/* Copy `bytes' bytes worth of samples into the buffer */
+static void
+copy_samples( UCHAR *dest, const libspectrum_signed_word *data, DWORD bytes )
+{
+  DWORD i;
+
+  if( sixteenbit ) {
+    /* DirectSound wants little-endian samples, as are ours */
+    memcpy( dest, data, bytes );
+  } else {
+    for( i = 0; i < bytes; i++ )
+      dest[i] = ( data[i] >> 8 ) ^ 0x80;
+  }
+}
+
 /* Copying data to the buffer */
 void
 sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 {
   HRESULT hres;
-  int i1, i2;
-  int lsb = 1;
 
   /* two pair because of circular buffer */
   UCHAR *ucbuffer1, *ucbuffer2;
@@ -174,7 +245,12 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
       if( cursordiff < len * 6 )
         break;
 
-      Sleep(10);
+      /* Sleep until the play cursor passes the next segment boundary;
+         the timeout covers a notification lost to a buffer restart */
+      if( notify_event )
+        WaitForSingleObject( notify_event, 50 );
+      else
+        Sleep(10);
     }
 
     /* lock the buffer */
@@ -185,46 +261,25 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
     if( hres != DS_OK ) return; /* couldn't get a lock on the buffer */
 
     /* write to the first part of buffer */
-    for( i1 = 0; i1 < length1 && len > 0; i1++ ) {
-      if( sixteenbit ) {
-        if( lsb ) {
-          ucbuffer1[ i1 ] = *data & 0xff;
-        } else {
-          ucbuffer1[ i1 ] = *data >> 8;
-          data++;
-        }
-        lsb = !lsb;
-      } else {
-        ucbuffer1[ i1 ] = ( ( *data++ ) >> 8 ) ^ 0x80;
-      }
-      nextpos++;
-      len--;
-    }
-
-    if( ucbuffer2 ) {
-      /* write to the second part of buffer */
-      for( i2 = 0; i2 < length2 && len > 0; i2++ ) {
-        if( sixteenbit ) {
-          if( lsb ) {
-            ucbuffer2[ i2 ] = *data & 0xff;
-          } else {
-            ucbuffer2[ i2 ] = *data >> 8;
-            data++;
-          }
-          lsb = !lsb;
-        } else {
-          ucbuffer2[ i2 ] = ( ( *data++ ) >> 8 ) ^ 0x80;
-        }
-        nextpos++;
-        len--;
-      }
-    } else {
-      i2 = 0;
+    if( length1 > (DWORD)len ) length1 = len;
+    copy_samples( ucbuffer1, data, length1 );
+    data += sixteenbit ? length1 / 2 : length1;
+    len -= length1;
+
+    /* write to the second part of buffer */
+    if( !ucbuffer2 ) length2 = 0;
+    if( length2 > (DWORD)len ) length2 = len;
+    if( length2 ) {
+      copy_samples( ucbuffer2, data, length2 );
+      data += sixteenbit ? length2 / 2 : length2;
+      len -= length2;
     }
 
+    nextpos += length1 + length2;
     if( nextpos >= MAX_AUDIO_BUFFER ) nextpos -= MAX_AUDIO_BUFFER;
 
     /* unlock the buffer */
-    IDirectSoundBuffer_Unlock( lpDSBuffer, ucbuffer1, i1, ucbuffer2, i2 );
+    IDirectSoundBuffer_Unlock( lpDSBuffer, ucbuffer1, length1,
+                               ucbuffer2, length2 );
   }
 }
@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <sys/soundcard.h>
 
+#include "compat.h"
 #include "settings.h"
 #include "sound.h"
 #include "spectrum.h"
@@ -153,6 +154,7 @@ void sound_lowlevel_frame(libspectrum_signed_word *data,int len)
 static unsigned char buf8[4096];
 unsigned char *data8=(unsigned char *)data;
 int ret=0,ofs=0;
+double start;
 
 len<<=1;	/* now in bytes */
 
@@ -170,10 +172,22 @@ if(!sixteenbit)
   data8=buf8;
   }
 
+start=compat_timer_get_time();
 while(len)
   {
   ret=write(soundfd,data8+ofs,len);
   if(ret>0)
     ofs+=ret,len-=ret;
   }
+sound_stats_blocked(start);
+
+#ifdef SNDCTL_DSP_GETERROR
+/* OSS 4 counts underruns for us, and clears the count when read */
+  {
+  audio_errinfo info;
+
+  if(ioctl(soundfd,SNDCTL_DSP_GETERROR,&info)==0)
+    sound_stats.underruns+=info.play_underruns;
+  }
+#endif
 }
@@ -31,21 +31,29 @@
 
 #include <SDL.h>
 
+#include "compat.h"
+#include "memory_usage.h"
 #include "settings.h"
 #include "sfifo.h"
 #include "sound.h"
+#include "thread_sched.h"
 #include "ui/ui.h"
 
 static void sdlwrite( void *userdata, Uint8 *stream, int len );
 
 sfifo_t sound_fifo;
 
-/* Number of Spectrum frames audio latency to use */
-#define NUM_FRAMES 2
+/* Number of Spectrum frames of sound the fifo can hold; the timer keeps
+   it at SOUND_FIFO_TARGET_FRAMES, leaving room for the odd late frame */
+#define NUM_FRAMES 4
 
 /* Records sound writer status information */
 static int audio_output_started;
 
+/* SDL starts the thread which calls sdlwrite() itself, so its scheduling
+   can only be set from the first call */
+static int audio_thread_scheduled;
+
 int
 sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 {
@@ -75,6 +83,8 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
 
   SDL_InitSubSystem( SDL_INIT_AUDIO );
 
+  audio_thread_scheduled = 0;
+
   memset( &requested, 0, sizeof( SDL_AudioSpec ) );
 
   requested.freq = *freqptr;
@@ -148,6 +158,8 @@ sound_lowlevel_init( const char *device, int *freqptr, int *stereoptr )
     return 1;
   }
 
+  memory_usage_add( MEMORY_USAGE_SOUND, sound_fifo.size );
+
   /* wait to run sound until we have some sound to play */
   audio_output_started = 0;
 
@@ -161,6 +173,7 @@ sound_lowlevel_end( void )
   SDL_LockAudio();
   SDL_CloseAudio();
   SDL_QuitSubSystem( SDL_INIT_AUDIO );
+  memory_usage_remove( MEMORY_USAGE_SOUND, sound_fifo.size );
   sfifo_flush( &sound_fifo );
   sfifo_close( &sound_fifo );
 }
@@ -179,7 +192,9 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
     if( ( i = sfifo_write( &sound_fifo, bytes, len ) ) < 0 ) {
       break;
     } else if (!i) {
-      SDL_Delay(10);
+      double start = compat_timer_get_time();
+      sfifo_wait_space( &sound_fifo, len, 100 );
+      sound_stats_blocked( start );
     }
     bytes += i;
     len -= i;
@@ -203,10 +218,17 @@ sound_lowlevel_frame( libspectrum_signed_word *data, int len )
 void
 sdlwrite( void *userdata, Uint8 *stream, int len )
 {
-  int f;
+  int f, used;
+
+  if( !audio_thread_scheduled ) {
+    thread_sched_apply( THREAD_SCHED_AUDIO );
+    audio_thread_scheduled = 1;
+  }
 
   /* Try to only read an even number of bytes so as not to fragment a sample */
-  len = MIN( len, sfifo_used( &sound_fifo ) );
+  used = sfifo_used( &sound_fifo );
+  if( used < len ) sound_stats.underruns++;
+  len = MIN( len, used );
   len &= sound_stereo_ay ? 0xfffc : 0xfffe;
 
   /* Read input_size bytes from fifo into sound stream */
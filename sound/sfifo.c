@@ -29,6 +29,8 @@ TODO:
 #else
 #	include	<string.h>
 #	include	<stdlib.h>
+#	include	<sys/time.h>
+#	include	<unistd.h>
 #	define	free(x, y)	free(x)
 #endif
 
@@ -73,6 +75,13 @@ int sfifo_init(sfifo_t *f, int size)
 	if( 0 == (f->buffer = malloc(f->size)) )
 		return -ENOMEM;
 
+	sfifo_reset_watermarks(f);
+
+#ifdef SFIFO_WAKEUP
+	pthread_mutex_init(&f->mutex, NULL);
+	pthread_cond_init(&f->space, NULL);
+#endif
+
 	return 0;
 }
 
@@ -82,7 +91,14 @@ int sfifo_init(sfifo_t *f, int size)
 void sfifo_close(sfifo_t *f)
 {
 	if(f->buffer)
+	{
 		free(f->buffer, f->size);
+#ifdef SFIFO_WAKEUP
+		pthread_cond_destroy(&f->space);
+		pthread_mutex_destroy(&f->mutex);
+#endif
+	}
+	f->buffer = 0;
 }
 
 /*
@@ -91,8 +107,19 @@ void sfifo_close(sfifo_t *f)
 void sfifo_flush(sfifo_t *f)
 {
 	/* Reset positions */
-	f->readpos = 0;
-	f->writepos = 0;
+	SFIFO_STORE(f->readpos, 0);
+	SFIFO_STORE(f->writepos, 0);
+}
+
+/*
+ * Start the watermarks again. Each is only updated by its own
+ * side, so a reset can be lost to an update already under way;
+ * that only costs one sample.
+ */
+void sfifo_reset_watermarks(sfifo_t *f)
+{
+	SFIFO_STORE(f->low_water, f->size - 1);
+	SFIFO_STORE(f->high_water, 0);
 }
 
 /*
@@ -125,7 +152,12 @@ int sfifo_write(sfifo_t *f, const void *_buf, int len)
 		i = 0;
 	}
 	memcpy(f->buffer + i, buf, len);
-	f->writepos = i + len;
+	SFIFO_STORE(f->writepos, (i + len) & SFIFO_SIZEMASK(f));
+
+	/* Track how full the writer has made the buffer */
+	i = sfifo_used(f);
+	if(i > SFIFO_LOAD(f->high_water))
+		SFIFO_STORE(f->high_water, i);
 
 	return total;
 }
@@ -200,11 +232,85 @@ int sfifo_read(sfifo_t *f, void *_buf, int len)
 		i = 0;
 	}
 	memcpy(buf, f->buffer + i, len);
-	f->readpos = i + len;
+	SFIFO_STORE_SC(f->readpos, (i + len) & SFIFO_SIZEMASK(f));
+
+	/* And how empty the reader has left it */
+	i = sfifo_used(f);
+	if(i < SFIFO_LOAD(f->low_water))
+		SFIFO_STORE(f->low_water, i);
+
+#ifdef SFIFO_WAKEUP
+	/* Wake the writer if it's waiting; the sequentially consistent
+	   accesses to readpos and waiting mean either we see it waiting,
+	   or it sees the space we've just made */
+	if(total && SFIFO_LOAD_SC(f->waiting))
+	{
+		pthread_mutex_lock(&f->mutex);
+		pthread_cond_signal(&f->space);
+		pthread_mutex_unlock(&f->mutex);
+	}
+#endif
 
 	return total;
 }
 
+#ifndef __KERNEL__
+#ifdef SFIFO_WAKEUP
+/* The space as seen by a waiting writer; see sfifo_read() */
+static int sfifo_space_sc(sfifo_t *f)
+{
+	return f->size - 1 -
+		((f->writepos - SFIFO_LOAD_SC(f->readpos)) & SFIFO_SIZEMASK(f));
+}
+#endif
+
+/*
+ * Wait until there are at least len bytes of space in a FIFO (or as
+ * many as it can hold), or until timeout_ms milliseconds have passed.
+ * Only the writer may call this.
+ * Return 1 if the space is there, 0 on a timeout
+ */
+int sfifo_wait_space(sfifo_t *f, int len, int timeout_ms)
+{
+	if(len > f->size - 1)
+		len = f->size - 1;
+
+	if(sfifo_space(f) >= len)
+		return 1;
+
+#ifdef SFIFO_WAKEUP
+	{
+		struct timeval now;
+		struct timespec until;
+		int error = 0;
+
+		gettimeofday(&now, NULL);
+		until.tv_sec = now.tv_sec + timeout_ms / 1000;
+		until.tv_nsec = now.tv_usec * 1000 +
+				(long)(timeout_ms % 1000) * 1000000;
+		if(until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock(&f->mutex);
+		SFIFO_STORE_SC(f->waiting, 1);
+		while(!error && sfifo_space_sc(f) < len)
+			error = pthread_cond_timedwait(&f->space, &f->mutex,
+						       &until);
+		SFIFO_STORE_SC(f->waiting, 0);
+		pthread_mutex_unlock(&f->mutex);
+	}
+#else
+	/* No way to be woken up, so just wait and see */
+	usleep(timeout_ms * 1000);
+#endif
+
+	return sfifo_space(f) >= len;
+}
+#endif
+
 #ifdef __KERNEL__
 /*
  * Read bytes from a FIFO into a user space buffer
@@ -30,6 +30,12 @@
  *	would result in memory thrashing. (Amazing that
  *	I've manage to use this to the extent I have
  *	without running into this... *heh*)
+ *
+ * Fuse:	Positions are read and written with acquire/release
+ *	atomics where the compiler has them, and a writer can
+ *	block until the reader frees some space, rather than
+ *	polling. Each side also keeps a watermark of how full
+ *	it has seen the buffer.
  */
 
 #ifndef	_SFIFO_H_
@@ -41,6 +47,11 @@ extern "C" {
 
 #include <errno.h>
 
+#if defined( HAVE_PTHREAD ) && !defined( __KERNEL__ )
+#include <pthread.h>
+#define SFIFO_WAKEUP
+#endif
+
 /*------------------------------------------------
 	"Private" stuff
 ------------------------------------------------*/
@@ -64,10 +75,35 @@ typedef struct sfifo_t
 	int size;			/* Number of bytes */
 	sfifo_atomic_t readpos;		/* Read position */
 	sfifo_atomic_t writepos;	/* Write position */
+	sfifo_atomic_t low_water;	/* Least used after a read */
+	sfifo_atomic_t high_water;	/* Most used after a write */
+#ifdef SFIFO_WAKEUP
+	sfifo_atomic_t waiting;		/* Is the writer waiting for space? */
+	pthread_mutex_t mutex;		/* Only protects the wakeup */
+	pthread_cond_t space;		/* Signalled when data is read */
+#endif
 } sfifo_t;
 
 #define SFIFO_SIZEMASK(x)	((x)->size - 1)
 
+/*
+ * Each position is only ever written by one side, so acquire and
+ * release ordering is all that is needed to make sure the data is
+ * in the buffer before the other side sees the new position.
+ */
+#if defined( __GNUC__ ) && \
+    ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 7 ) )
+#	define	SFIFO_LOAD(x)		__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#	define	SFIFO_STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#	define	SFIFO_LOAD_SC(x)	__atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#	define	SFIFO_STORE_SC(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#else
+#	define	SFIFO_LOAD(x)		(*(volatile sfifo_atomic_t *)&(x))
+#	define	SFIFO_STORE(x, v)	(*(volatile sfifo_atomic_t *)&(x) = (v))
+#	define	SFIFO_LOAD_SC(x)	SFIFO_LOAD(x)
+#	define	SFIFO_STORE_SC(x, v)	SFIFO_STORE(x, v)
+#endif
+
 
 /*------------------------------------------------
 	API
@@ -75,10 +111,17 @@ typedef struct sfifo_t
 int sfifo_init(sfifo_t *f, int size);
 void sfifo_close(sfifo_t *f);
 void sfifo_flush(sfifo_t *f);
+void sfifo_reset_watermarks(sfifo_t *f);
 int sfifo_write(sfifo_t *f, const void *buf, int len);
 int sfifo_read(sfifo_t *f, void *buf, int len);
-#define sfifo_used(x)	(((x)->writepos - (x)->readpos) & SFIFO_SIZEMASK(x))
+#ifndef __KERNEL__
+int sfifo_wait_space(sfifo_t *f, int len, int timeout_ms);
+#endif
+#define sfifo_used(x)	((SFIFO_LOAD((x)->writepos) - SFIFO_LOAD((x)->readpos)) \
+			 & SFIFO_SIZEMASK(x))
 #define sfifo_space(x)	((x)->size - 1 - sfifo_used(x))
+#define sfifo_low_water(x)	SFIFO_LOAD((x)->low_water)
+#define sfifo_high_water(x)	SFIFO_LOAD((x)->high_water)
 
 
 /*------------------------------------------------
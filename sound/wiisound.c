@@ -104,7 +104,7 @@ sound_lowlevel_frame(libspectrum_signed_word *data, int len)
     if( ( i = sfifo_write( &sound_fifo, bytes, len ) ) < 0 ) 
       break;
     else if( !i )
-      usleep(10000);
+      sfifo_wait_space( &sound_fifo, len, 10 );
     bytes += i;
     len -= i;
   }
@@ -0,0 +1,659 @@
+/* soundrec.c: record the sound to a WAV or FLAC file
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* The sound is taken as each frame's worth comes out of the Blip_Buffers
+   and queued for a writer thread, where there are threads, which encodes
+   it and writes it out, so neither the encoding nor a slow disk holds up
+   the emulation; if the writer falls a few seconds behind, sound is
+   dropped rather than the queue growing, and the gap is reported when
+   recording stops. Without threads, the sound is encoded and written as
+   it is made.
+
+   A file whose name ends in .flac is FLAC compressed by the small
+   encoder here: each block uses whichever of FLAC's fixed predictors
+   leaves the smallest residual, Rice coded in partitions. That's not as
+   tight as the reference encoder, but needs no library; anything else is
+   written as 16 bit PCM WAV */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "compat.h"
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "infrastructure/writer_queue.h"
+#include "sound.h"
+#include "soundrec.h"
+#include "ui/ui.h"
+
+/* Are we currently recording the sound? */
+int soundrec_recording;
+
+/* Samples per channel in each block written; 4096 has a FLAC block size
+   code of its own */
+#define SOUNDREC_BLOCK 4096
+#define SOUNDREC_BLOCK_CODE 12
+
+/* The writer is let fall this many samples over all channels behind,
+   around three seconds at 44.1kHz stereo */
+#define SOUNDREC_QUEUE_SAMPLES 0x40000
+
+static FILE *soundrec_file;
+static int soundrec_flac;
+static int soundrec_freq, soundrec_channels;
+
+/* Samples per channel written so far, and the next FLAC frame's number */
+static libspectrum_qword soundrec_length;
+static libspectrum_dword soundrec_frame_number;
+
+/* Set if anything couldn't be written */
+static int soundrec_write_failed;
+
+/* Samples thrown away because the writer was too far behind */
+static libspectrum_dword soundrec_dropped;
+
+/* The block being built up, interleaved as it comes from the sound code */
+static libspectrum_signed_word *block;
+static size_t block_fill;
+
+/* Space to encode a block in: one channel's samples, its residual and
+   the encoded frame, which is never bigger than the samples verbatim */
+static libspectrum_signed_dword *flac_samples, *flac_residual;
+static libspectrum_byte *flac_frame;
+#define SOUNDREC_FRAME_MAX( channels ) \
+  ( 32 + ( channels ) * ( 1 + SOUNDREC_BLOCK * 2 ) )
+
+/* Samples handed over to be written on the writer thread */
+typedef struct soundrec_chunk {
+  libspectrum_signed_word *samples;
+  size_t count;
+} soundrec_chunk;
+
+static writer_queue *soundrec_writer = NULL;
+
+#ifdef HAVE_PTHREAD
+/* soundrec_add() is called from the sound thread, so this keeps the
+   writer from being stopped under it */
+static pthread_mutex_t soundrec_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif	/* HAVE_PTHREAD */
+
+static void
+write_bytes( const void *data, size_t length )
+{
+  if( fwrite( data, 1, length, soundrec_file ) != length )
+    soundrec_write_failed = 1;
+}
+
+/* Writing bits, most significant first, as FLAC wants them */
+
+typedef struct bitwriter {
+  libspectrum_byte *buffer;
+  size_t length;
+  libspectrum_qword bits;
+  int count;
+} bitwriter;
+
+static void
+put_bits( bitwriter *w, libspectrum_dword value, int count )
+{
+  w->bits = ( w->bits << count ) |
+            ( value & ( ( (libspectrum_qword)1 << count ) - 1 ) );
+  w->count += count;
+
+  while( w->count >= 8 ) {
+    w->count -= 8;
+    w->buffer[ w->length++ ] = w->bits >> w->count;
+  }
+}
+
+static void
+put_unary( bitwriter *w, libspectrum_dword zeros )
+{
+  while( zeros > 24 ) { put_bits( w, 0, 24 ); zeros -= 24; }
+  put_bits( w, 1, zeros + 1 );
+}
+
+static void
+put_utf8( bitwriter *w, libspectrum_dword value )
+{
+  int bytes, i;
+
+  if( value < 0x80 ) { put_bits( w, value, 8 ); return; }
+
+  for( bytes = 2; bytes < 6 && value >= ( 1UL << ( 5 * bytes + 1 ) );
+       bytes++ )
+    ;
+
+  put_bits( w, ( ( 0xff00 >> bytes ) & 0xff ) |
+               ( value >> ( 6 * ( bytes - 1 ) ) ), 8 );
+  for( i = bytes - 2; i >= 0; i-- )
+    put_bits( w, 0x80 | ( ( value >> ( 6 * i ) ) & 0x3f ), 8 );
+}
+
+static void
+put_align( bitwriter *w )
+{
+  if( w->count ) put_bits( w, 0, 8 - w->count );
+}
+
+static libspectrum_byte
+crc8( const libspectrum_byte *data, size_t length )
+{
+  libspectrum_byte crc = 0;
+  int i;
+
+  while( length-- ) {
+    crc ^= *data++;
+    for( i = 0; i < 8; i++ )
+      crc = crc & 0x80 ? ( crc << 1 ) ^ 0x07 : crc << 1;
+  }
+
+  return crc;
+}
+
+static libspectrum_word
+crc16( const libspectrum_byte *data, size_t length )
+{
+  libspectrum_word crc = 0;
+  int i;
+
+  while( length-- ) {
+    crc ^= *data++ << 8;
+    for( i = 0; i < 8; i++ )
+      crc = crc & 0x8000 ? ( crc << 1 ) ^ 0x8005 : crc << 1;
+  }
+
+  return crc;
+}
+
+static libspectrum_dword
+zigzag( libspectrum_signed_dword e )
+{
+  return e >= 0 ? (libspectrum_dword)e << 1
+                : ( (libspectrum_dword)-e << 1 ) - 1;
+}
+
+/* The Rice parameter for samples `start' to `end' of the residual, and
+   the bits they'd take with it */
+static libspectrum_qword
+partition_bits( const libspectrum_signed_dword *residual, size_t start,
+                size_t end, int *parameter )
+{
+  libspectrum_qword sum = 0, bits;
+  size_t i, n = end - start;
+  int k = 0;
+
+  for( i = start; i < end; i++ ) sum += zigzag( residual[i] );
+
+  /* About log2 of the mean */
+  while( k < 14 && ( (libspectrum_qword)n << ( k + 1 ) ) <= sum ) k++;
+
+  bits = 4 + n * ( k + 1 );
+  for( i = start; i < end; i++ ) bits += zigzag( residual[i] ) >> k;
+
+  *parameter = k;
+  return bits;
+}
+
+/* Pick how finely to partition the residual of a block of `n' samples
+   predicted with order `order', returning the bits it would take */
+static libspectrum_qword
+residual_bits( const libspectrum_signed_dword *residual, size_t n, int order,
+               int *partition_order )
+{
+  libspectrum_qword best = (libspectrum_qword)-1, bits;
+  int p, i, k;
+
+  for( p = 0; p <= 8; p++ ) {
+    size_t size = n >> p;
+
+    if( n % ( 1 << p ) || size <= (size_t)order ) break;
+
+    bits = 6;
+    for( i = 0; i < 1 << p; i++ )
+      bits += partition_bits( residual, i ? i * size : order, ( i + 1 ) * size,
+                              &k );
+
+    if( bits < best ) { best = bits; *partition_order = p; }
+  }
+
+  return best;
+}
+
+static void
+put_residual( bitwriter *w, const libspectrum_signed_dword *residual, size_t n,
+              int order, int partition_order )
+{
+  size_t size = n >> partition_order, j;
+  int i, k;
+
+  put_bits( w, 0, 2 );			/* Rice coding, 4 bit parameters */
+  put_bits( w, partition_order, 4 );
+
+  for( i = 0; i < 1 << partition_order; i++ ) {
+    size_t start = i ? i * size : order, end = ( i + 1 ) * size;
+
+    partition_bits( residual, start, end, &k );
+    put_bits( w, k, 4 );
+
+    for( j = start; j < end; j++ ) {
+      libspectrum_dword u = zigzag( residual[j] );
+      put_unary( w, u >> k );
+      if( k ) put_bits( w, u, k );
+    }
+  }
+}
+
+/* The residual left by FLAC's fixed predictor of order `order' */
+static void
+fixed_residual( const libspectrum_signed_dword *x, size_t n, int order,
+                libspectrum_signed_dword *residual )
+{
+  size_t i;
+
+  for( i = order; i < n; i++ ) {
+    switch( order ) {
+    case 0: residual[i] = x[i]; break;
+    case 1: residual[i] = x[i] - x[i-1]; break;
+    case 2: residual[i] = x[i] - 2 * x[i-1] + x[i-2]; break;
+    case 3: residual[i] = x[i] - 3 * x[i-1] + 3 * x[i-2] - x[i-3]; break;
+    default:
+      residual[i] = x[i] - 4 * x[i-1] + 6 * x[i-2] - 4 * x[i-3] + x[i-4];
+      break;
+    }
+  }
+}
+
+static void
+put_subframe( bitwriter *w, const libspectrum_signed_dword *x, size_t n )
+{
+  libspectrum_qword best_sum = (libspectrum_qword)-1, bits;
+  size_t i;
+  int order, best_order = 0, partition_order = 0;
+
+  for( i = 1; i < n && x[i] == x[0]; i++ )
+    ;
+  if( i == n ) {
+    put_bits( w, 0x00, 8 );		/* CONSTANT */
+    put_bits( w, x[0], 16 );
+    return;
+  }
+
+  for( order = 0; order <= 4 && (size_t)order < n; order++ ) {
+    libspectrum_qword sum = 0;
+
+    fixed_residual( x, n, order, flac_residual );
+    for( i = order; i < n; i++ ) sum += zigzag( flac_residual[i] );
+
+    if( sum < best_sum ) { best_sum = sum; best_order = order; }
+  }
+
+  fixed_residual( x, n, best_order, flac_residual );
+  bits = 16 * best_order +
+         residual_bits( flac_residual, n, best_order, &partition_order );
+
+  if( bits >= 16 * (libspectrum_qword)n ) {
+    put_bits( w, 0x02, 8 );		/* VERBATIM */
+    for( i = 0; i < n; i++ ) put_bits( w, x[i], 16 );
+    return;
+  }
+
+  put_bits( w, 0x10 | ( best_order << 1 ), 8 );	/* FIXED */
+  for( i = 0; i < (size_t)best_order; i++ ) put_bits( w, x[i], 16 );
+  put_residual( w, flac_residual, n, best_order, partition_order );
+}
+
+static void
+write_flac_frame( size_t n )
+{
+  bitwriter w = { NULL, 0, 0, 0 };
+  size_t i;
+  int c, code = n == SOUNDREC_BLOCK ? SOUNDREC_BLOCK_CODE : 7;
+
+  w.buffer = flac_frame;
+
+  put_bits( &w, 0xfff8, 16 );		/* Sync, fixed block size */
+  put_bits( &w, code, 4 );
+  put_bits( &w, 0, 4 );			/* Rate from STREAMINFO */
+  put_bits( &w, soundrec_channels - 1, 4 );
+  put_bits( &w, 4, 3 );			/* 16 bits per sample */
+  put_bits( &w, 0, 1 );
+  put_utf8( &w, soundrec_frame_number++ );
+  if( code == 7 ) put_bits( &w, n - 1, 16 );
+  put_bits( &w, crc8( w.buffer, w.length ), 8 );
+
+  for( c = 0; c < soundrec_channels; c++ ) {
+    for( i = 0; i < n; i++ )
+      flac_samples[i] = block[ i * soundrec_channels + c ];
+    put_subframe( &w, flac_samples, n );
+  }
+
+  put_align( &w );
+  put_bits( &w, crc16( w.buffer, w.length ), 16 );
+
+  write_bytes( w.buffer, w.length );
+}
+
+static void
+write_wav_block( size_t n )
+{
+  libspectrum_byte out[ 1024 ];
+  size_t i, count = n * soundrec_channels, done;
+
+  /* WAV is little endian whatever the host is */
+  for( done = 0; done < count; ) {
+    size_t chunk = count - done > sizeof( out ) / 2 ? sizeof( out ) / 2
+                                                    : count - done;
+
+    for( i = 0; i < chunk; i++ ) {
+      out[ 2 * i ] = block[ done + i ] & 0xff;
+      out[ 2 * i + 1 ] = ( block[ done + i ] >> 8 ) & 0xff;
+    }
+
+    write_bytes( out, chunk * 2 );
+    done += chunk;
+  }
+}
+
+/* Write out the `n' samples per channel in the block */
+static void
+write_block( size_t n )
+{
+  if( !n ) return;
+
+  if( soundrec_flac ) {
+    write_flac_frame( n );
+  } else {
+    write_wav_block( n );
+  }
+
+  soundrec_length += n;
+  block_fill = 0;
+}
+
+/* Add sound to the block, writing it out each time it fills */
+static void
+consume( const libspectrum_signed_word *buf, size_t count )
+{
+  size_t size = SOUNDREC_BLOCK * soundrec_channels;
+
+  while( count ) {
+    size_t n = size - block_fill < count ? size - block_fill : count;
+
+    memcpy( block + block_fill, buf, n * sizeof( *buf ) );
+    block_fill += n; buf += n; count -= n;
+
+    if( block_fill == size ) write_block( SOUNDREC_BLOCK );
+  }
+}
+
+static void
+put_le( libspectrum_byte *p, libspectrum_dword value, int bytes )
+{
+  while( bytes-- ) { *p++ = value & 0xff; value >>= 8; }
+}
+
+/* The file's header; written with no length at the start, and again
+   once the length is known */
+static void
+write_header( void )
+{
+  if( soundrec_flac ) {
+    libspectrum_byte header[ 42 ];
+    bitwriter w = { NULL, 0, 0, 0 };
+
+    w.buffer = header;
+
+    memcpy( header, "fLaC", 4 ); w.length = 4;
+    put_bits( &w, 0x80, 8 );		/* Last block, STREAMINFO */
+    put_bits( &w, 34, 24 );
+    put_bits( &w, SOUNDREC_BLOCK, 16 );
+    put_bits( &w, SOUNDREC_BLOCK, 16 );
+    put_bits( &w, 0, 24 );		/* Frame sizes unknown */
+    put_bits( &w, 0, 24 );
+    put_bits( &w, soundrec_freq, 20 );
+    put_bits( &w, soundrec_channels - 1, 3 );
+    put_bits( &w, 15, 5 );		/* 16 bits per sample */
+    put_bits( &w, soundrec_length >> 32, 4 );
+    put_bits( &w, soundrec_length & 0xffffffff, 32 );
+    memset( header + w.length, 0, 16 );	/* No MD5 */
+
+    write_bytes( header, sizeof( header ) );
+  } else {
+    libspectrum_byte header[ 44 ];
+    libspectrum_dword data = soundrec_length * soundrec_channels * 2;
+
+    memcpy( header, "RIFF", 4 );
+    put_le( header + 4, 36 + data, 4 );
+    memcpy( header + 8, "WAVEfmt ", 8 );
+    put_le( header + 16, 16, 4 );
+    put_le( header + 20, 1, 2 );		/* PCM */
+    put_le( header + 22, soundrec_channels, 2 );
+    put_le( header + 24, soundrec_freq, 4 );
+    put_le( header + 28, soundrec_freq * soundrec_channels * 2, 4 );
+    put_le( header + 32, soundrec_channels * 2, 2 );
+    put_le( header + 34, 16, 2 );
+    memcpy( header + 36, "data", 4 );
+    put_le( header + 40, data, 4 );
+
+    write_bytes( header, sizeof( header ) );
+  }
+}
+
+/* Encode and write a queued chunk; runs on the writer thread */
+static void
+soundrec_write_chunk( void *job )
+{
+  soundrec_chunk *chunk = job;
+
+  consume( chunk->samples, chunk->count );
+
+  libspectrum_free( chunk->samples );
+  libspectrum_free( chunk );
+}
+
+void
+soundrec_add( const libspectrum_signed_word *buf, size_t count )
+{
+  soundrec_chunk *chunk;
+
+  if( !count ) return;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &soundrec_mutex );
+#endif	/* HAVE_PTHREAD */
+
+  if( soundrec_recording ) {
+    if( soundrec_writer ) {
+      chunk = libspectrum_new( soundrec_chunk, 1 );
+      chunk->samples = libspectrum_new( libspectrum_signed_word, count );
+      memcpy( chunk->samples, buf, count * sizeof( *buf ) );
+      chunk->count = count;
+
+      /* If the writer is too far behind, the samples are lost rather than
+         the queue growing */
+      if( writer_queue_push( soundrec_writer, chunk,
+                             count * sizeof( *buf ), 0 ) ) {
+        soundrec_dropped += count;
+        libspectrum_free( chunk->samples );
+        libspectrum_free( chunk );
+      }
+    } else {
+      consume( buf, count );
+    }
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock( &soundrec_mutex );
+#endif	/* HAVE_PTHREAD */
+}
+
+int
+soundrec_start( const char *filename )
+{
+  const char *dot;
+
+  if( soundrec_recording ) return 1;
+
+  if( !sound_enabled ) {
+    ui_error( UI_ERROR_ERROR, "sound must be on to be recorded" );
+    return 1;
+  }
+
+  soundrec_file = fopen( filename, "wb" );
+  if( !soundrec_file ) {
+    ui_error( UI_ERROR_ERROR, "unable to open sound file for writing" );
+    return 1;
+  }
+
+  dot = strrchr( filename, '.' );
+  soundrec_flac = dot && !strcasecmp( dot, ".flac" );
+
+  soundrec_freq = sound_freq;
+  soundrec_channels = sound_stereo_ay != SOUND_STEREO_AY_NONE ? 2 : 1;
+  soundrec_length = 0;
+  soundrec_frame_number = 0;
+  soundrec_write_failed = 0;
+  soundrec_dropped = 0;
+
+  block = libspectrum_new( libspectrum_signed_word,
+                           SOUNDREC_BLOCK * soundrec_channels );
+  block_fill = 0;
+
+  if( soundrec_flac ) {
+    flac_samples = libspectrum_new( libspectrum_signed_dword, SOUNDREC_BLOCK );
+    flac_residual = libspectrum_new( libspectrum_signed_dword,
+                                     SOUNDREC_BLOCK );
+    flac_frame = libspectrum_new( libspectrum_byte,
+                                  SOUNDREC_FRAME_MAX( soundrec_channels ) );
+  }
+
+  write_header();
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &soundrec_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  soundrec_writer = writer_queue_start(
+    "sound recording", soundrec_write_chunk, NULL,
+    SOUNDREC_QUEUE_SAMPLES * sizeof( libspectrum_signed_word )
+  );
+  soundrec_recording = 1;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock( &soundrec_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  return 0;
+}
+
+int
+soundrec_stop( void )
+{
+  writer_queue *writer;
+
+  if( !soundrec_recording ) return 1;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &soundrec_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  soundrec_recording = 0;
+  writer = soundrec_writer;
+  soundrec_writer = NULL;
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock( &soundrec_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  /* Nothing more is added now, so this just writes what's waiting */
+  if( writer ) writer_queue_stop( writer, NULL );
+
+  /* The last block can be short */
+  write_block( block_fill / soundrec_channels );
+
+  /* Now the length is known, fill it in */
+  if( !fseek( soundrec_file, 0, SEEK_SET ) ) write_header();
+
+  if( fclose( soundrec_file ) ) soundrec_write_failed = 1;
+
+  libspectrum_free( block ); block = NULL;
+  libspectrum_free( flac_samples ); flac_samples = NULL;
+  libspectrum_free( flac_residual ); flac_residual = NULL;
+  libspectrum_free( flac_frame ); flac_frame = NULL;
+
+  if( soundrec_write_failed ) {
+    ui_error( UI_ERROR_ERROR, "unable to write sound file" );
+    return 1;
+  }
+
+  if( soundrec_dropped ) {
+    ui_error( UI_ERROR_WARNING,
+              "sound recording couldn't keep up; %lu samples were lost",
+              (unsigned long)( soundrec_dropped / soundrec_channels ) );
+  }
+
+  return 0;
+}
+
+void
+soundrec_init_sound( int freq, int channels )
+{
+  if( !soundrec_recording ) return;
+
+  if( freq != soundrec_freq || channels != soundrec_channels ) {
+    ui_error( UI_ERROR_WARNING,
+              "sound settings changed; sound recording stopped" );
+    soundrec_stop();
+    ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 0 );
+  }
+}
+
+static int
+soundrec_init( void *context )
+{
+  soundrec_recording = 0;
+
+  return 0;
+}
+
+static void
+soundrec_end( void )
+{
+  if( soundrec_recording ) soundrec_stop();
+}
+
+void
+soundrec_register_startup( void )
+{
+  startup_manager_module dependencies[] = { STARTUP_MANAGER_MODULE_SETUID };
+  startup_manager_register( STARTUP_MANAGER_MODULE_SOUNDREC, dependencies,
+                            ARRAY_SIZE( dependencies ), soundrec_init, NULL,
+                            soundrec_end );
+}
@@ -0,0 +1,48 @@
+/* soundrec.h: record the sound to a WAV or FLAC file
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_SOUNDREC_H
+#define FUSE_SOUNDREC_H
+
+#include <libspectrum.h>
+
+/* Are we currently recording the sound? */
+extern int soundrec_recording;
+
+void soundrec_register_startup( void );
+
+/* Start recording to `filename'; FLAC if its name ends in .flac, WAV
+   otherwise */
+int soundrec_start( const char *filename );
+int soundrec_stop( void );
+
+/* Called with each frame's sound once it has been made; `count' is the
+   number of samples over all the channels. May be called from the sound
+   thread */
+void soundrec_add( const libspectrum_signed_word *buf, size_t count );
+
+/* Called when the sound is (re)started; a recording can't follow a
+   change of rate or channels, so it is stopped */
+void soundrec_init_sound( int freq, int channels );
+
+#endif			/* #ifndef FUSE_SOUNDREC_H */
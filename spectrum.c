@@ -25,22 +25,34 @@
 
 #include <libspectrum.h>
 
+#include "batch.h"
+#include "bench.h"
+#include "export.h"
 #include "compat.h"
 #include "debugger/debugger.h"
 #include "display.h"
 #include "event.h"
+#include "frametime.h"
+#include "fuse.h"
+#include "input.h"
 #include "keyboard.h"
 #include "infrastructure/startup_manager.h"
 #include "loader.h"
 #include "machine.h"
 #include "memory_pages.h"
 #include "module.h"
+#include "netplay.h"
+#include "peripherals/disk/fdd.h"
+#include "peripherals/ide/ide.h"
 #include "peripherals/printer.h"
 #include "peripherals/ula.h"
 #include "phantom_typist.h"
 #include "psg.h"
 #include "profile.h"
+#include "rewind.h"
+#include "runahead.h"
 #include "rzx.h"
+#include "screenshot.h"
 #include "settings.h"
 #include "sound.h"
 #include "spectrum.h"
@@ -48,6 +60,7 @@
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/uijoystick.h"
+#include "ui/uimedia.h"
 #include "z80/z80.h"
 
 /* 1040 KB of RAM */
@@ -70,27 +83,71 @@ static const char * const debugger_type_string = "spectrum";
 /* Debugger variable for frame count */
 static const char * const frame_count_name = "frames";
 
+/* Debugger variable for the hash of the screen */
+static const char * const screen_hash_name = "screenhash";
+
 /* Count of frames since last reset */
 static libspectrum_dword frames_since_reset;
 
+/* Functions to be called at the end of each frame; only those which
+   have something to do at the moment are here */
+#define FRAME_SUBSCRIBERS_MAX 8
+static spectrum_frame_fn frame_subscribers[ FRAME_SUBSCRIBERS_MAX ];
+static size_t frame_subscriber_count = 0;
+
 static void
 spectrum_reset( int hard_reset )
 {
   frames_since_reset = 0;
 }
 
+static void
+spectrum_state_to( module_state_t *state )
+{
+  module_state_write( state, &tstates, sizeof( tstates ) );
+  module_state_write( state, &frames_since_reset,
+                      sizeof( frames_since_reset ) );
+}
+
+static void
+spectrum_state_from( module_state_t *state )
+{
+  module_state_read( state, &tstates, sizeof( tstates ) );
+  module_state_read( state, &frames_since_reset,
+                     sizeof( frames_since_reset ) );
+}
+
 static module_info_t module_info = {
   /* .reset = */ spectrum_reset,
   /* .romcs = */ NULL,
   /* .snapshot_enabled = */ NULL,
   /* .snapshot_from = */ NULL,
-  /* .snapshot_to = */ NULL
+  /* .snapshot_to = */ NULL,
+  /* .state_to = */ spectrum_state_to,
+  /* .state_from = */ spectrum_state_from
 };
 
+/* Working backwards means a function can unsubscribe itself */
+static void
+spectrum_frame_call_subscribers( void )
+{
+  size_t i;
+
+  for( i = frame_subscriber_count; i-- != 0; )
+    frame_subscribers[i]();
+}
+
 static void
 spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
 			 void *user_data )
 {
+  /* Frames run ahead are only there to be looked at */
+  if( runahead_active ) {
+    spectrum_frame();
+    z80_interrupt();
+    return;
+  }
+
   if( rzx_playback ) event_force_events();
   rzx_frame();
   psg_frame();
@@ -98,9 +155,43 @@ spectrum_frame_event_fn( libspectrum_dword last_tstates, int type,
   z80_interrupt();
   ui_joystick_poll();
   timer_estimate_speed();
-  debugger_add_time_events();
+  spectrum_frame_call_subscribers();
+  rewind_frame();
+  screenshot_frame();
+  ui_media_drive_frame();
   ui_event();
-  ui_error_frame();
+  input_frame();
+}
+
+void
+spectrum_frame_subscribe( spectrum_frame_fn fn )
+{
+  size_t i;
+
+  for( i = 0; i < frame_subscriber_count; i++ )
+    if( frame_subscribers[i] == fn ) return;
+
+  if( frame_subscriber_count == FRAME_SUBSCRIBERS_MAX ) {
+    ui_error( UI_ERROR_ERROR, "too many end of frame functions" );
+    fuse_abort();
+  }
+
+  frame_subscribers[ frame_subscriber_count++ ] = fn;
+}
+
+void
+spectrum_frame_unsubscribe( spectrum_frame_fn fn )
+{
+  size_t i;
+
+  for( i = 0; i < frame_subscriber_count; i++ ) {
+    if( frame_subscribers[i] == fn ) {
+      frame_subscriber_count--;
+      for( ; i < frame_subscriber_count; i++ )
+        frame_subscribers[i] = frame_subscribers[ i + 1 ];
+      return;
+    }
+  }
 }
 
 static libspectrum_dword
@@ -109,6 +200,12 @@ get_frame_count( void )
   return frames_since_reset;
 }
 
+static libspectrum_dword
+get_screen_hash( void )
+{
+  return display_screen_hash();
+}
+
 static int
 spectrum_init( void *context )
 {
@@ -119,6 +216,8 @@ spectrum_init( void *context )
 
   debugger_system_variable_register( debugger_type_string,
       frame_count_name, get_frame_count, NULL );
+  debugger_system_variable_register( debugger_type_string,
+      screen_hash_name, get_screen_hash, NULL );
 
   return 0;
 }
@@ -149,15 +248,40 @@ spectrum_frame( void )
 
   event_frame( frame_length );
   debugger_breakpoint_reduce_tstates( frame_length );
+  fdd_frame( frame_length );
   tstates -= frame_length;
   if( z80.interrupts_enabled_at >= 0 )
     z80.interrupts_enabled_at -= frame_length;
 
+  if( bench_active ) bench_mark( BENCH_SUBSYSTEM_EVENTS );
+
+  FRAMETIME_ENTER( FRAMETIME_PROBE_SOUND );
   if( sound_enabled ) sound_frame();
+  FRAMETIME_LEAVE();
+  if( bench_active ) bench_mark( BENCH_SUBSYSTEM_SOUND );
+
+  runahead_frame();
+  netplay_frame();
 
   if( display_frame() ) return 1;
+
+  /* Frames run ahead are thrown away, so mustn't have any effect outside
+     the machine itself */
+  if( runahead_active ) {
+    event_add( machine_current->timings.tstates_per_frame,
+               spectrum_frame_event );
+    return 0;
+  }
+
+  if( bench_active ) bench_frame();
+  if( batch_active ) batch_frame();
+  if( export_active ) export_frame();
+#ifdef FRAME_TIMING
+  frametime_frame();
+#endif				/* #ifdef FRAME_TIMING */
   if( profile_active ) profile_frame( frame_length );
   printer_frame();
+  ide_frame();
 
   /* Add an interrupt unless they're being generated by .rzx playback */
   if( !rzx_playback )
@@ -165,6 +289,7 @@ spectrum_frame( void )
                spectrum_frame_event );
 
   loader_frame( frame_length );
+  tape_frame( frame_length );
   phantom_typist_frame();
 
   frames_since_reset++;
@@ -226,39 +351,40 @@ spectrum_contend_delay_76543210( libspectrum_dword time )
   return contend_delay_common( time, contention_pattern_76543210, 4 );
 }
 
-/* What happens if we read from an unattached port? */
-libspectrum_byte
-spectrum_unattached_port( void )
+/* What's on the floating bus at `time': an offset into the current
+   screen, or ULA_FLOATING_BUS_IDLE if the ULA isn't reading it */
+libspectrum_word
+spectrum_floating_bus_offset( libspectrum_dword time )
 {
   int line, tstates_through_line, column;
 
-  /* Return 0xff (idle bus) if we're in the top border */
-  if( tstates < machine_current->line_times[ DISPLAY_BORDER_HEIGHT ] )
-    return 0xff;
+  /* Idle bus if we're in the top border */
+  if( time < machine_current->line_times[ DISPLAY_BORDER_HEIGHT ] )
+    return ULA_FLOATING_BUS_IDLE;
 
   /* Work out which line we're on, relative to the top of the screen */
-  line = ( (libspectrum_signed_dword)tstates -
+  line = ( (libspectrum_signed_dword)time -
 	   machine_current->line_times[ DISPLAY_BORDER_HEIGHT ] ) /
     machine_current->timings.tstates_per_line;
 
   /* Idle bus if we're in the lower border */
-  if( line >= DISPLAY_HEIGHT ) return 0xff;
+  if( line >= DISPLAY_HEIGHT ) return ULA_FLOATING_BUS_IDLE;
 
   /* Work out where we are in this line, remembering that line_times[] holds
      the first pixel we display, not the start of where the Spectrum produced
      the left border */
-  tstates_through_line = tstates -
+  tstates_through_line = time -
     machine_current->line_times[ DISPLAY_BORDER_HEIGHT + line ] +
     ( machine_current->timings.left_border - DISPLAY_BORDER_WIDTH_COLS * 4 );
 
   /* Idle bus if we're in the left border */
   if( tstates_through_line < machine_current->timings.left_border )
-    return 0xff;
+    return ULA_FLOATING_BUS_IDLE;
 
   /* Or the right border or retrace */
   if( tstates_through_line >= machine_current->timings.left_border +
                               machine_current->timings.horizontal_screen  )
-    return 0xff;
+    return ULA_FLOATING_BUS_IDLE;
 
   column = ( ( tstates_through_line -
 	       machine_current->timings.left_border ) / 8 ) * 2;
@@ -279,20 +405,34 @@ spectrum_unattached_port( void )
     /* Attribute bytes */
     case 5: column++;
     case 3:
-      return RAM[ memory_current_screen ][ display_attr_start[line] + column ];
+      return display_attr_start[line] + column;
 
     /* Screen data */
     case 4: column++;
     case 2:
-      return RAM[ memory_current_screen ][ display_line_start[line] + column ];
+      return display_line_start[line] + column;
 
     /* Idle bus */
     case 0: case 1: case 6: case 7:
-      return 0xff;
+      return ULA_FLOATING_BUS_IDLE;
 
   }
 
-  return 0;		/* Keep gcc happy */
+  return ULA_FLOATING_BUS_IDLE;	/* Keep gcc happy */
+}
+
+/* What happens if we read from an unattached port? */
+libspectrum_byte
+spectrum_unattached_port( void )
+{
+  libspectrum_word offset;
+
+  if( tstates >= ULA_CONTENTION_SIZE ) return 0xff;
+
+  offset = ula_timing[ tstates ].floating_bus;
+  if( offset == ULA_FLOATING_BUS_IDLE ) return 0xff;
+
+  return RAM[ memory_current_screen ][ offset ];
 }
 
 libspectrum_byte
@@ -72,6 +72,7 @@ libspectrum_byte spectrum_contend_delay_none( libspectrum_dword time );
 libspectrum_byte spectrum_contend_delay_65432100( libspectrum_dword time );
 libspectrum_byte spectrum_contend_delay_76543210( libspectrum_dword time );
 
+libspectrum_word spectrum_floating_bus_offset( libspectrum_dword time );
 libspectrum_byte spectrum_unattached_port( void );
 libspectrum_byte spectrum_unattached_port_none( void );
 
@@ -82,4 +83,12 @@ extern int spectrum_frame_event;
 void spectrum_register_startup( void );
 int spectrum_frame( void );
 
+/* Functions called at the end of every frame, other than those run
+   ahead. Modules should only be subscribed while they've something to
+   do; a function may unsubscribe itself when called */
+typedef void (*spectrum_frame_fn)( void );
+
+void spectrum_frame_subscribe( spectrum_frame_fn fn );
+void spectrum_frame_unsubscribe( spectrum_frame_fn fn );
+
 #endif			/* #ifndef FUSE_SPECTRUM_H */
@@ -64,6 +64,26 @@ static int svg_y_size = 176;
 xmlBuffer* buffer;
 xmlTextWriter* writer;
 
+/* What's been printed in each character cell since the last CLS, so
+   printing the same thing in the same place again adds nothing to the
+   file. Rows are numbered down the whole document, so scrolling doesn't
+   move anything; svg_cell_row says which row each entry is for */
+#define SVG_CELL_ROWS 32
+#define SVG_CELL_NONE -1
+
+static int svg_cell[ SVG_CELL_ROWS ][ 32 ];
+static int svg_cell_row[ SVG_CELL_ROWS ];
+
+/* Characters printed one after another along a row in the same colours
+   are written out as a single box and a single text element */
+static struct {
+  int length;                   /* in cells; 0 if there's no run */
+  int x, y;                     /* of the first cell */
+  int ink, paper, flash;
+  char text[ 32 * 2 + 1 ];      /* UTF-8, without the spaces */
+  char glyph_x[ 32 * 5 + 1 ];   /* where each character in text goes */
+} svg_run;
+
 
 static const
 libspectrum_byte palette[16][3] = {
@@ -86,6 +106,14 @@ libspectrum_byte palette[16][3] = {
                                     { 255, 255, 255 } };
 
 
+static void
+svg_colour( char *buffer, int colour )
+{
+  snprintf( buffer, BUFSZ, "rgb(%u,%u,%u)", palette[ colour ][0],
+                                            palette[ colour ][1],
+                                            palette[ colour ][2] );
+}
+
 /* handle error messages setting attributes */
 
 static int
@@ -298,18 +326,158 @@ svg_closefile( void )
   snprintf( svg_fname, strlen( svg_fnameroot ) + BUFSIZ, "%s%d.svg", 
             svg_fnameroot, svg_filecount++ );
 
+  /* The whole document is already in memory, so write it in one go */
   if( ( fp = fopen( svg_fname, "w" ) ) != NULL ) {
-    fprintf( fp, "%s", buffer->content );
+    if( fwrite( xmlBufferContent( buffer ), 1, xmlBufferLength( buffer ),
+                fp ) != (size_t)xmlBufferLength( buffer ) ) {
+      ui_error( UI_ERROR_ERROR, "error writing SVG file '%s': %s", svg_fname,
+                strerror( errno ) );
+    }
 
     if( fclose( fp ) != 0 ) {
       ui_error( UI_ERROR_ERROR, "error closing SVG file '%s': %s", svg_fname,
                 strerror( errno ) );
     }
+  } else {
+    ui_error( UI_ERROR_ERROR, "error opening SVG file '%s': %s", svg_fname,
+              strerror( errno ) );
   }
 
+  xmlBufferFree( buffer );
   libspectrum_free( svg_fname );
 }
 
+static void
+svg_cells_clear( void )
+{
+  int i;
+
+  for( i = 0; i < SVG_CELL_ROWS; i++ ) svg_cell_row[i] = SVG_CELL_NONE;
+}
+
+/* Record that `value' is now in the cell at ( x, y ); returns non-zero
+   if it was there already */
+static int
+svg_cell_update( int x, int y, int value )
+{
+  int row = ( ( y % SVG_CELL_ROWS ) + SVG_CELL_ROWS ) % SVG_CELL_ROWS;
+  int i;
+
+  if( x < 0 || x > 31 ) return 0;
+
+  if( svg_cell_row[ row ] != y ) {
+    svg_cell_row[ row ] = y;
+    for( i = 0; i < 32; i++ ) svg_cell[ row ][i] = SVG_CELL_NONE;
+  }
+
+  if( svg_cell[ row ][ x ] == value ) return 1;
+
+  svg_cell[ row ][ x ] = value;
+  return 0;
+}
+
+/* Write out the characters waiting in svg_run */
+static void
+svg_run_flush( void )
+{
+  char path_element[ BUFSZ ];
+  char svgcolor_ink[ BUFSZ ];
+  char svgcolor_paper[ BUFSZ ];
+  int err;
+
+  if( !svg_run.length ) return;
+
+  svg_colour( svgcolor_ink, svg_run.ink );
+  svg_colour( svgcolor_paper, svg_run.paper );
+
+  /* -- PAPER */
+  snprintf( path_element, BUFSZ, "%d", svg_run.length * 16 );
+  svg_rect( svg_run.x * 16, ( svg_run.y - 1 ) * 16, path_element, "16", "0.4",
+            svgcolor_paper );
+
+  svg_run.length = 0;
+
+  if( !*svg_run.text ) return;
+
+  /* -- INK and chars */
+
+  if( xmlTextWriterStartElement( writer, BAD_CAST "text" ) < 0 ) {
+    ui_error( UI_ERROR_ERROR, "error creating the SVG text element" );
+    return;
+  }
+
+  err = 0;
+  err += ( svg_attribute( "x", svg_run.glyph_x, "text" ) != 0 );
+  snprintf( path_element, BUFSZ, "%d", svg_run.y * 16 - 3 );
+  err += ( svg_attribute( "y", path_element, "text" ) != 0 );
+  err += ( svg_attribute( "font-family", "monospace", "text" ) != 0 );
+  err += ( svg_attribute( "stroke", svgcolor_ink, "text" ) != 0 );
+
+  /* FLASH attribute */
+  if( svg_run.flash ) {
+    err += ( svg_attribute( "font-weight", "bold", "text" ) != 0 );
+    err += ( svg_attribute( "stroke-width", "0.9", "text" ) != 0 );
+    err += ( svg_attribute( "font-size", "21", "text" ) != 0 );
+    err += ( svg_attribute( "fill", svgcolor_paper, "text" ) != 0 );
+  } else {
+    err += ( svg_attribute( "stroke-width", "0.7", "text" ) != 0 );
+    err += ( svg_attribute( "font-size", "19", "text" ) != 0 );
+    err += ( svg_attribute( "fill", svgcolor_ink, "text" ) != 0 );
+  }
+
+  if( err ) {
+    ui_error( UI_ERROR_ERROR,
+              "error setting the SVG text element coordinates" );
+    return;
+  }
+
+  xmlTextWriterWriteString( writer, BAD_CAST svg_run.text );
+
+  if( xmlTextWriterEndElement( writer ) < 0 ) {
+    ui_error( UI_ERROR_ERROR, "error closing the SVG text element" );
+    return;
+  }
+}
+
+/* Add a character to svg_run, starting a new run if it doesn't follow
+   on from the current one */
+static void
+svg_run_add( int x_pos, int y_pos, int svg_char, int ink, int paper,
+             int flash )
+{
+  size_t length;
+
+  if( svg_run.length &&
+      ( y_pos != svg_run.y || x_pos != svg_run.x + svg_run.length ||
+        ink != svg_run.ink || paper != svg_run.paper ||
+        flash != svg_run.flash || svg_run.length == 32 ) )
+    svg_run_flush();
+
+  if( !svg_run.length ) {
+    svg_run.x = x_pos; svg_run.y = y_pos;
+    svg_run.ink = ink; svg_run.paper = paper; svg_run.flash = flash;
+    svg_run.text[0] = svg_run.glyph_x[0] = '\0';
+  }
+
+  svg_run.length++;
+
+  /* Spaces (and anything else unprintable) just need the paper; leaving
+     them out also stops the SVG viewer collapsing them */
+  if( svg_char <= ' ' ) return;
+
+  length = strlen( svg_run.text );
+  if( svg_char == 127 ) /* (C) symbol */
+    snprintf( svg_run.text + length, sizeof( svg_run.text ) - length,
+              "%c%c", 0xc2, 0xa9 );
+  else        /* Normal Character */
+    snprintf( svg_run.text + length, sizeof( svg_run.text ) - length,
+              "%c", svg_char );
+
+  length = strlen( svg_run.glyph_x );
+  snprintf( svg_run.glyph_x + length, sizeof( svg_run.glyph_x ) - length,
+            "%s%d", length ? " " : "", x_pos * 16 + 2 );
+}
+
 
 
 /* some init, open file (name)*/
@@ -323,7 +491,7 @@ svg_startcapture( const char *name, svg_capture_type mode )
     if( name == NULL || *name == '\0' )
       name = "fuse";
 
-    svg_fnameroot = libspectrum_new( char, strlen ( name ) );
+    svg_fnameroot = libspectrum_new( char, strlen ( name ) + 1 );
     strcpy( svg_fnameroot, name );
     svg_filecount = 0;
 
@@ -331,6 +499,9 @@ svg_startcapture( const char *name, svg_capture_type mode )
     svg_flag = 0;
     svg_y_size = 176;
 
+    svg_run.length = 0;
+    svg_cells_clear();
+
     svg_openfile();
     svg_openpath();
   }
@@ -340,6 +511,7 @@ void
 svg_stopcapture( void )
 {
   if( svg_capture_active ) {
+    svg_run_flush();
     svg_closepath();
     svg_closefile();
 
@@ -358,6 +530,10 @@ svg_capture_draw( void )
   int dx,dy;
   int svg_ink;
 
+  /* Lines can go over anything printed so far */
+  svg_run_flush();
+  svg_cells_clear();
+
   dx = z80.bc.b.l;
   dy = z80.bc.b.h;
   if( z80.de.b.l == 255 )
@@ -465,12 +641,12 @@ svg_byte( int xpos, int ypos, int udg_byte, char *color )
 void
 svg_capture_char( void )
 {
-  char path_element[ BUFSZ ];
   char svgcolor_ink[ BUFSZ ];
   char svgcolor_paper[ BUFSZ ];
-  int i, err;
+  int i;
   int svg_ink;
   int svg_paper;
+  int flash;
   int x_pos, y_pos;
   int svg_char, udg_ptr;
 
@@ -492,98 +668,62 @@ svg_capture_char( void )
       svg_paper = svg_ink;
       svg_ink = svg_char;
     }
+    flash = ( readbyte_internal( 0x5c8f ) & 128 ) != 0;
 
-    snprintf( svgcolor_paper, BUFSZ, "rgb(%u,%u,%u)", palette[ svg_paper ][0],
-                                                      palette[ svg_paper ][1],
-                                                      palette[ svg_paper ][2] );
-    snprintf( svgcolor_ink, BUFSZ, "rgb(%u,%u,%u)", palette[ svg_ink ][0],
-                                                    palette[ svg_ink ][1],
-                                                    palette[ svg_ink ][2] );
     svg_char = z80.af.b.h;
 
-
-    /* -- PAPER */
-    if( svg_char < 165 )
-      svg_rect( x_pos * 16, ( y_pos - 1 ) * 16, "16", "16", "0.4",
-                svgcolor_paper );
-
-    if( svg_char > 127 ) {
-
-      if( svg_char < 144 ) {
-        /* GRAPHICS BLOCKS */
-        if( svg_char & 1 )
-          svg_rect( 8 + x_pos * 16, ( y_pos - 1 ) * 16, "8", "8", "1",
-                    svgcolor_ink );
-
-        if( svg_char & 2 )
-          svg_rect( x_pos * 16, ( y_pos - 1 ) * 16, "8", "8", "1",
-                    svgcolor_ink );
-        
-        if( svg_char & 4 )
-          svg_rect( 8 + x_pos * 16, 8 + ( y_pos - 1 ) * 16, "8", "8", "1",
-                    svgcolor_ink );
-        
-        if( svg_char & 8 )
-          svg_rect( x_pos * 16, 8 + ( y_pos - 1 ) * 16, "8", "8", "1",
-                    svgcolor_ink );
-      }
-      else if( svg_char < 165 ) {
-        /* 144-164 -> UDG "A"-"U" (pointed by $5C7B/$5C7C) */
-        for( i = 0; i < 8; i++ ) {
-          udg_ptr = ( readbyte_internal( 0x5c7c ) << 8 ) +
-                      readbyte_internal( 0x5c7b );
-          svg_byte( x_pos * 16, ( i * 2 ) + ( y_pos - 1 ) * 16,
-                    readbyte_internal( udg_ptr + i + 8 * ( svg_char - 144 ) ),
-                    svgcolor_ink );
-        }
-      }
-
+    /* Nothing to do if this is already there; UDGs can be redefined, so
+       they're always drawn */
+    if( svg_char < 144 ) {
+      if( svg_cell_update( x_pos, y_pos, svg_char | svg_ink << 8 |
+                           svg_paper << 12 | flash << 16 ) )
+        return;
     } else {
+      svg_cell_update( x_pos, y_pos, SVG_CELL_NONE );
+    }
 
+    if( svg_char < 128 ) {
+      svg_run_add( x_pos, y_pos, svg_char, svg_ink, svg_paper, flash );
+      svg_flag = 1;
+      return;
+    }
 
-      /* -- INK and char */  
+    svg_run_flush();
 
-      if( xmlTextWriterStartElement( writer, BAD_CAST "text" ) < 0 ) {
-        ui_error( UI_ERROR_ERROR, "error creating the SVG text element" );
-        return;
-      }
+    svg_colour( svgcolor_paper, svg_paper );
+    svg_colour( svgcolor_ink, svg_ink );
 
-      err = 0;
-      snprintf( path_element, BUFSZ, "%d", x_pos * 16 + 2 );
-      err += ( svg_attribute( "x", path_element, "text" ) != 0 );
-      snprintf( path_element, BUFSZ, "%d", y_pos * 16 - 3 );
-      err += ( svg_attribute( "y", path_element, "text" ) != 0 );
-      err += ( svg_attribute( "font-family", "monospace", "text" ) != 0 );
-      err += ( svg_attribute( "stroke", svgcolor_ink, "text" ) != 0 );
-
-      /* FLASH attribute */
-      if( ( readbyte_internal( 0x5c8f ) & 128 ) != 0 ) {
-        err += ( svg_attribute( "font-weight", "bold", "text" ) != 0 );
-        err += ( svg_attribute( "stroke-width", "0.9", "text" ) != 0 );
-        err += ( svg_attribute( "font-size", "21", "text" ) != 0 );
-        err += ( svg_attribute( "fill", svgcolor_paper, "text" ) != 0 );
-      } else {
-        err += ( svg_attribute( "stroke-width", "0.7", "text" ) != 0 );
-        err += ( svg_attribute( "font-size", "19", "text" ) != 0 );
-        err += ( svg_attribute( "fill", svgcolor_ink, "text" ) != 0 );
-      }
+    /* -- PAPER */
+    if( svg_char < 165 )
+      svg_rect( x_pos * 16, ( y_pos - 1 ) * 16, "16", "16", "0.4",
+                svgcolor_paper );
 
-      if( err ) {
-        ui_error( UI_ERROR_ERROR,
-                  "error setting the SVG text element coordinates" );
-        return;
-      }
+    if( svg_char < 144 ) {
+      /* GRAPHICS BLOCKS */
+      if( svg_char & 1 )
+        svg_rect( 8 + x_pos * 16, ( y_pos - 1 ) * 16, "8", "8", "1",
+                  svgcolor_ink );
 
-      if( svg_char == 127 ) /* (C) symbol */
-          snprintf( path_element, BUFSZ, "%c%c", 0xc2, 0xa9 );
-      else        /* Normal Character */
-          snprintf( path_element, BUFSZ, "%c", svg_char );
+      if( svg_char & 2 )
+        svg_rect( x_pos * 16, ( y_pos - 1 ) * 16, "8", "8", "1",
+                  svgcolor_ink );
 
-      xmlTextWriterWriteString( writer, BAD_CAST path_element );
+      if( svg_char & 4 )
+        svg_rect( 8 + x_pos * 16, 8 + ( y_pos - 1 ) * 16, "8", "8", "1",
+                  svgcolor_ink );
 
-      if( xmlTextWriterEndElement( writer ) < 0 ) {
-        ui_error( UI_ERROR_ERROR, "error closing the SVG text element" );
-        return;
+      if( svg_char & 8 )
+        svg_rect( x_pos * 16, 8 + ( y_pos - 1 ) * 16, "8", "8", "1",
+                  svgcolor_ink );
+    }
+    else if( svg_char < 165 ) {
+      /* 144-164 -> UDG "A"-"U" (pointed by $5C7B/$5C7C) */
+      for( i = 0; i < 8; i++ ) {
+        udg_ptr = ( readbyte_internal( 0x5c7c ) << 8 ) +
+                    readbyte_internal( 0x5c7b );
+        svg_byte( x_pos * 16, ( i * 2 ) + ( y_pos - 1 ) * 16,
+                  readbyte_internal( udg_ptr + i + 8 * ( svg_char - 144 ) ),
+                  svgcolor_ink );
       }
     }
 
@@ -596,6 +736,9 @@ svg_capture_char( void )
 void
 svg_capture_cls( void )
 {
+  svg_run_flush();
+  svg_cells_clear();
+
   if( svg_flag ) {
     svg_closepath();
     svg_closefile();
@@ -619,6 +762,9 @@ svg_capture_scroll( void )
 {
   char svgcolor[ BUFSZ ];
   static int svg_paper;
+  int row;
+
+  svg_run_flush();
 
   /* Background */
   svg_paper = ( ( readbyte_internal( 0x5c8d ) >> 3 ) & 15 ); /* ATTR_P */
@@ -628,6 +774,11 @@ svg_capture_scroll( void )
 
   svg_y_size += 8;
   svg_rect( 0, svg_y_size * 2, "512", "16", "1", svgcolor );
+
+  /* Which blanks the row in the cell record too */
+  row = svg_y_size / 8 + 1;
+  svg_cell_row[ ( ( row % SVG_CELL_ROWS ) + SVG_CELL_ROWS ) % SVG_CELL_ROWS ] =
+    SVG_CELL_NONE;
     return;
 }
 
@@ -30,31 +30,78 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libspectrum.h>
 
+#include "batch.h"
+#include "bench.h"
 #include "debugger/debugger.h"
+#include "display.h"
 #include "event.h"
+#include "export.h"
 #include "fuse.h"
+#include "fuselib.h"
 #include "infrastructure/startup_manager.h"
 #include "loader.h"
 #include "machine.h"
 #include "memory_pages.h"
+#include "memory_usage.h"
+#include "movie.h"
+#include "netplay.h"
 #include "peripherals/ula.h"
 #include "phantom_typist.h"
+#include "runahead.h"
 #include "rzx.h"
 #include "settings.h"
 #include "sound.h"
 #include "snapshot.h"
+#include "spectrum.h"
 #include "tape.h"
+#include "thread_sched.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "utils.h"
 #include "z80/z80.h"
 #include "z80/z80_macros.h"
+#ifdef GCWZERO
+#include "savestates/savestates.h"
+#endif
 
 /* The current tape */
 static libspectrum_tape *tape;
 
+#ifdef HAVE_PTHREAD
+
+/* A compressed tape being inflated and parsed on a thread of its own, so
+   the emulation and the UI carry on meanwhile. It goes in as the current
+   tape, and autoloads if asked, at the end of the first frame after it's
+   ready */
+typedef struct tape_inflate_job {
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  int done;			/* Protected by mutex */
+
+  libspectrum_byte *buffer;	/* A copy of the compressed file */
+  size_t length;
+  libspectrum_id_t type;
+  char *filename;
+  int autoload;
+
+  libspectrum_tape *tape;
+  libspectrum_error error;	/* Reported from the main thread */
+
+} tape_inflate_job;
+
+static tape_inflate_job *inflate_job = NULL;
+
+static void tape_inflate_cancel( void );
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
 /* Has the current tape been modified since it was last loaded/saved? */
 int tape_modified;
 
@@ -78,25 +125,405 @@ static const char * const microphone_variable_name = "microphone";
 
 /* Spectrum events */
 int tape_edge_event;
-static int record_event;
+event_handle_t tape_edge_handle;	/* The next edge, if the tape's playing */
 static int tape_mic_off_event;
 
 static libspectrum_dword next_tape_edge_tstates;
 
+/* Edges are decoded from the tape a batch at a time, rather than going
+   back to libspectrum for every edge. A batch never goes past an edge
+   which ends a block or stops the tape, so the tape's current block is
+   always the one the next buffered edge comes from */
+#define TAPE_EDGE_BUFFER_SIZE 256
+
+typedef struct tape_edge_t {
+  libspectrum_dword tstates;
+  int flags;
+  libspectrum_tape_state_type state;	/* The tape's state before this edge */
+} tape_edge_t;
+
+/* libspectrum's pulse lengths are always at 3.5MHz */
+#define TAPE_TSTATES_PER_MS 3500
+
+static tape_edge_t tape_edges[ TAPE_EDGE_BUFFER_SIZE ];
+static size_t tape_edges_next, tape_edges_count;
+
+/* When each block starts, in T-states from the start of the tape, with
+   a final entry for the end of the tape; built when the tape is opened
+   and again whenever blocks are added to it */
+static libspectrum_qword *tape_index;
+static size_t tape_index_blocks;
+static int tape_index_valid;
+
+/* The current block, or -1 if that needs to be asked for */
+static int tape_block_index = -1;
+
+/* How far into the current block the emulated tape has got */
+static libspectrum_qword tape_block_elapsed;
+
+/* Is the current block being flash loaded? */
+static int tape_flash;
+
+/* Turbo blocks whose pulses are within this many T-states of the ROM's
+   are treated as standard speed */
+#define TAPE_FLASH_TOLERANCE 50
+
 /* Function prototypes */
 
 static int tape_autoload( libspectrum_machine hardware );
 static int trap_load_block( libspectrum_tape_block *block );
 static int tape_play( int autoplay );
 static void make_name( unsigned char *name, const unsigned char *data );
-static void
-tape_event_record_sample( libspectrum_dword last_tstates, int type,
-			  void *user_data );
 static void tape_stop_mic_off( libspectrum_dword last_tstates, int type,
                                void *user_data );
 
 /* Function definitions */
 
+/* Throw away any decoded edges; called whenever the tape's position is
+   changed other than by playing it */
+static void
+tape_edges_flush( void )
+{
+  tape_edges_next = tape_edges_count = 0;
+  tape_block_index = -1;
+  tape_block_elapsed = 0;
+}
+
+/* Decode the next batch of edges. Returns non-zero if there are none */
+static int
+tape_edges_fill( void )
+{
+  tape_edge_t *edge;
+
+  tape_edges_next = tape_edges_count = 0;
+
+  while( tape_edges_count < TAPE_EDGE_BUFFER_SIZE ) {
+
+    edge = &tape_edges[ tape_edges_count ];
+    edge->state = libspectrum_tape_state( tape );
+
+    if( libspectrum_tape_get_next_edge( &edge->tstates, &edge->flags, tape ) )
+      break;
+    tape_edges_count++;
+
+    if( edge->flags & ( LIBSPECTRUM_TAPE_FLAGS_BLOCK |
+                        LIBSPECTRUM_TAPE_FLAGS_STOP |
+                        LIBSPECTRUM_TAPE_FLAGS_STOP48 ) )
+      break;
+  }
+
+  return !tape_edges_count;
+}
+
+static int
+tape_flash_timing_matches( libspectrum_dword length, libspectrum_dword rom )
+{
+  return length + TAPE_FLASH_TOLERANCE >= rom &&
+         length <= rom + TAPE_FLASH_TOLERANCE;
+}
+
+/* Is `block' a data block at the ROM's timings? */
+static int
+tape_flash_block( libspectrum_tape_block *block )
+{
+  if( !block ) return 0;
+
+  switch( libspectrum_tape_block_type( block ) ) {
+
+  case LIBSPECTRUM_TAPE_BLOCK_ROM:
+    return 1;
+
+  case LIBSPECTRUM_TAPE_BLOCK_TURBO:
+    return
+      tape_flash_timing_matches( libspectrum_tape_block_pilot_length( block ),
+                                 2168 ) &&
+      tape_flash_timing_matches( libspectrum_tape_block_sync1_length( block ),
+                                 667 ) &&
+      tape_flash_timing_matches( libspectrum_tape_block_sync2_length( block ),
+                                 735 ) &&
+      tape_flash_timing_matches( libspectrum_tape_block_bit0_length( block ),
+                                 855 ) &&
+      tape_flash_timing_matches( libspectrum_tape_block_bit1_length( block ),
+                                 1710 );
+
+  default:
+    return 0;
+  }
+}
+
+/* Start or stop flash loading as the tape moves onto a new block, starts
+   or stops. While flash loading, the loader runs as fast as possible
+   with no frames drawn and no sound; it is still emulated exactly, so
+   anything which could load the block normally still can */
+static void
+tape_flash_update( void )
+{
+  int flash = settings_current.flash_load && tape_playing &&
+              !movie_recording &&
+              tape_flash_block( libspectrum_tape_current_block( tape ) );
+
+  if( flash == tape_flash ) return;
+
+  tape_flash = flash;
+
+  if( tape_flash ) {
+    if( !settings_current.fastload ) sound_pause();
+  } else {
+    if( !settings_current.fastload ) sound_unpause();
+    timer_estimate_reset();
+    display_refresh_all();
+  }
+}
+
+int
+tape_flash_loading( void )
+{
+  return tape_flash;
+}
+
+/* How many bits of data there are in `block', which must have data */
+static libspectrum_qword
+tape_block_bits( libspectrum_tape_block *block )
+{
+  size_t length = libspectrum_tape_block_data_length( block );
+
+  if( !length ) return 0;
+
+  return ( length - 1 ) * 8 + libspectrum_tape_block_bits_in_last_byte( block );
+}
+
+/* The T-states taken up by the data bits of `block', which must have
+   data */
+static libspectrum_qword
+tape_block_data_duration( libspectrum_tape_block *block, size_t bits )
+{
+  libspectrum_byte *data = libspectrum_tape_block_data( block );
+  libspectrum_dword bit0 = libspectrum_tape_block_bit0_length( block ),
+    bit1 = libspectrum_tape_block_bit1_length( block );
+  libspectrum_qword duration = 0;
+  size_t i;
+
+  for( i = 0; i < bits; i++ )
+    duration += 2 * ( data[ i / 8 ] & ( 0x80 >> ( i % 8 ) ) ? bit1 : bit0 );
+
+  return duration;
+}
+
+/* How long `block' takes to play, in T-states. Generalised data blocks
+   only count their pause, and jumps and loops are ignored */
+static libspectrum_qword
+tape_block_duration( libspectrum_tape_block *block )
+{
+  libspectrum_qword duration = 0;
+  libspectrum_byte *data;
+  size_t i, length;
+
+  switch( libspectrum_tape_block_type( block ) ) {
+
+  case LIBSPECTRUM_TAPE_BLOCK_ROM:
+    length = libspectrum_tape_block_data_length( block );
+    data = libspectrum_tape_block_data( block );
+    duration = ( length && data[0] & 0x80 ? 3223 : 8063 ) * 2168 + 667 + 735;
+    duration += tape_block_data_duration( block, length * 8 );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_TURBO:
+    duration = (libspectrum_qword)libspectrum_tape_block_pilot_pulses( block ) *
+               libspectrum_tape_block_pilot_length( block ) +
+               libspectrum_tape_block_sync1_length( block ) +
+               libspectrum_tape_block_sync2_length( block );
+    /* Fall through */
+  case LIBSPECTRUM_TAPE_BLOCK_PURE_DATA:
+    duration += tape_block_data_duration( block, tape_block_bits( block ) );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_RAW_DATA:
+    duration = tape_block_bits( block ) *
+               libspectrum_tape_block_bit_length( block );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_PURE_TONE:
+    duration = (libspectrum_qword)libspectrum_tape_block_count( block ) *
+               libspectrum_tape_block_pulse_length( block );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_PULSES:
+    for( i = 0; i < libspectrum_tape_block_count( block ); i++ )
+      duration += libspectrum_tape_block_pulse_lengths( block, i );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_PULSE_SEQUENCE:
+    for( i = 0; i < libspectrum_tape_block_count( block ); i++ )
+      duration += (libspectrum_qword)libspectrum_tape_block_pulse_lengths( block, i ) *
+                  libspectrum_tape_block_pulse_repeats( block, i );
+    break;
+
+  case LIBSPECTRUM_TAPE_BLOCK_RLE_PULSE:
+    /* CSW style run lengths: a zero byte means the length follows in the
+       next four bytes */
+    length = libspectrum_tape_block_data_length( block );
+    data = libspectrum_tape_block_data( block );
+    for( i = 0; i < length; i++ ) {
+      if( data[i] || i + 4 >= length ) {
+        duration += data[i];
+      } else {
+        duration += data[i+1] | data[i+2] << 8 | data[i+3] << 16 |
+                    (libspectrum_dword)data[i+4] << 24;
+        i += 4;
+      }
+    }
+    duration *= libspectrum_tape_block_scale( block );
+    return duration;
+
+  default:
+    break;
+  }
+
+  switch( libspectrum_tape_block_type( block ) ) {
+  case LIBSPECTRUM_TAPE_BLOCK_ROM:
+  case LIBSPECTRUM_TAPE_BLOCK_TURBO:
+  case LIBSPECTRUM_TAPE_BLOCK_PURE_DATA:
+  case LIBSPECTRUM_TAPE_BLOCK_RAW_DATA:
+  case LIBSPECTRUM_TAPE_BLOCK_GENERALISED_DATA:
+  case LIBSPECTRUM_TAPE_BLOCK_PAUSE:
+    duration += (libspectrum_qword)libspectrum_tape_block_pause( block ) *
+                TAPE_TSTATES_PER_MS;
+    break;
+  default:
+    break;
+  }
+
+  return duration;
+}
+
+/* How much data `block' holds, for the memory usage figures */
+static size_t
+tape_block_data_size( libspectrum_tape_block *block )
+{
+  switch( libspectrum_tape_block_type( block ) ) {
+
+  case LIBSPECTRUM_TAPE_BLOCK_ROM:
+  case LIBSPECTRUM_TAPE_BLOCK_TURBO:
+  case LIBSPECTRUM_TAPE_BLOCK_PURE_DATA:
+  case LIBSPECTRUM_TAPE_BLOCK_RAW_DATA:
+    return libspectrum_tape_block_data_length( block );
+
+  default:
+    return 0;
+
+  }
+}
+
+/* Also notes how much memory the tape takes up, so that figure is as
+   fresh as the index */
+static void
+tape_index_build( void )
+{
+  libspectrum_tape_block *block;
+  libspectrum_tape_iterator iterator;
+  size_t allocated = 64, data = 0;
+  libspectrum_qword time = 0;
+
+  libspectrum_free( tape_index );
+  tape_index = libspectrum_new( libspectrum_qword, allocated );
+  tape_index_blocks = 0;
+
+  for( block = libspectrum_tape_iterator_init( &iterator, tape );
+       block;
+       block = libspectrum_tape_iterator_next( &iterator ) ) {
+    if( tape_index_blocks + 1 == allocated ) {
+      allocated *= 2;
+      tape_index = libspectrum_renew( libspectrum_qword, tape_index,
+                                      allocated );
+    }
+    tape_index[ tape_index_blocks++ ] = time;
+    time += tape_block_duration( block );
+    data += tape_block_data_size( block );
+  }
+
+  tape_index[ tape_index_blocks ] = time;
+  tape_index_valid = 1;
+
+  memory_usage_set( MEMORY_USAGE_TAPE,
+                    data + allocated * sizeof( libspectrum_qword ) );
+}
+
+static void
+tape_index_update( void )
+{
+  if( !tape_index_valid ) tape_index_build();
+}
+
+int
+tape_get_times( libspectrum_qword *elapsed, libspectrum_qword *total )
+{
+  int block;
+
+  if( !libspectrum_tape_present( tape ) ) return 1;
+
+  block = tape_get_current_block();
+  if( block < 0 ) return 1;
+
+  tape_index_update();
+  if( (size_t)block >= tape_index_blocks ) return 1;
+
+  *elapsed = tape_index[ block ] + tape_block_elapsed;
+  if( *elapsed > tape_index[ block + 1 ] ) *elapsed = tape_index[ block + 1 ];
+  *total = tape_index[ tape_index_blocks ];
+
+  return 0;
+}
+
+libspectrum_qword
+tape_block_start_time( size_t n )
+{
+  tape_index_update();
+  if( n > tape_index_blocks ) n = tape_index_blocks;
+  return tape_index[ n ];
+}
+
+int
+tape_block_at_time( libspectrum_qword time )
+{
+  size_t low = 0, high;
+
+  if( !libspectrum_tape_present( tape ) ) return -1;
+
+  tape_index_update();
+  if( !tape_index_blocks ) return -1;
+
+  /* Find the last block starting no later than `time' */
+  high = tape_index_blocks;
+  while( high - low > 1 ) {
+    size_t middle = ( low + high ) / 2;
+    if( tape_index[ middle ] <= time ) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+int
+tape_seek_time( libspectrum_qword time )
+{
+  int block = tape_block_at_time( time );
+
+  if( block < 0 ) return 1;
+
+  return tape_select_block( block );
+}
+
+/* The state of the tape as far as the emulated machine has got */
+static libspectrum_tape_state_type
+tape_state( void )
+{
+  return tape_edges_next < tape_edges_count ?
+         tape_edges[ tape_edges_next ].state : libspectrum_tape_state( tape );
+}
+
 static libspectrum_dword
 get_microphone( void )
 {
@@ -124,8 +551,6 @@ tape_init( void *context )
 
   tape_edge_event = event_register( next_edge, "Tape edge" );
   tape_mic_off_event = event_register( tape_stop_mic_off, "Tape stop MIC off" );
-  record_event = event_register( tape_event_record_sample,
-				 "Tape sample record" );
 
   tape_modified = 0;
 
@@ -142,8 +567,16 @@ tape_init( void *context )
 static void
 tape_end( void )
 {
+#ifdef HAVE_PTHREAD
+  tape_inflate_cancel();
+#endif
+
   libspectrum_tape_free( tape );
   tape = NULL;
+
+  libspectrum_free( tape_index ); tape_index = NULL;
+  tape_index_valid = 0;
+  memory_usage_set( MEMORY_USAGE_TAPE, 0 );
 }
 
 void
@@ -177,29 +610,226 @@ tape_open( const char *filename, int autoload )
   return 0;
 }
 
+/* Inflate `buffer' and parse what comes out into `dest'. Left to
+   itself, libspectrum would inflate the file once to identify it and
+   again to read it */
+static libspectrum_error
+tape_read_compressed( libspectrum_tape *dest, const libspectrum_byte *buffer,
+                      size_t length, libspectrum_id_t type,
+                      const char *filename )
+{
+  unsigned char *inflated = NULL;
+  size_t inflated_length = 0;
+  char *inflated_name = NULL;
+  libspectrum_error error;
+
+  error = libspectrum_uncompress_file( &inflated, &inflated_length,
+                                       &inflated_name, type, buffer, length,
+                                       filename );
+  if( error ) return error;
+
+  error = libspectrum_tape_read( dest, inflated, inflated_length,
+                                 LIBSPECTRUM_ID_UNKNOWN, inflated_name );
+
+  libspectrum_free( inflated_name );
+  libspectrum_free( inflated );
+
+  return error;
+}
+
+/* Everything which happens once a new tape has been read in */
+static int
+tape_inserted( const char *filename, const libspectrum_byte *buffer,
+               size_t length, int autoload )
+{
+  int error;
+
+  tape_index_build();
+
+  tape_modified = 0;
+  ui_tape_browser_update( UI_TAPE_BROWSER_NEW_TAPE, NULL );
+
+  if( autoload ) {
+#ifdef GCWZERO
+    /* Carry on from where this tape finished loading last time */
+    if( !savestate_tape_ready_restore( filename, buffer, length ) ) return 0;
+#endif
+    error = tape_autoload( machine_current->machine );
+    if( error ) return error;
+  }
+
+  return 0;
+}
+
+#ifdef HAVE_PTHREAD
+
+static void
+tape_inflate_free( tape_inflate_job *job )
+{
+  if( job->tape ) libspectrum_tape_free( job->tape );
+  libspectrum_free( job->buffer );
+  libspectrum_free( job->filename );
+  pthread_mutex_destroy( &job->mutex );
+  libspectrum_free( job );
+}
+
+static void*
+tape_inflate_thread_fn( void *arg )
+{
+  tape_inflate_job *job = arg;
+
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+  job->error = tape_read_compressed( job->tape, job->buffer, job->length,
+                                     job->type, job->filename );
+
+  pthread_mutex_lock( &job->mutex );
+  job->done = 1;
+  pthread_mutex_unlock( &job->mutex );
+
+  return NULL;
+}
+
+/* Tell the user why a tape couldn't be inflated. libspectrum's own
+   message was raised on the inflate thread, so only went to stderr */
+static void
+tape_inflate_report( tape_inflate_job *job )
+{
+  const char *reason;
+
+  switch( job->error ) {
+  case LIBSPECTRUM_ERROR_MEMORY: reason = "out of memory"; break;
+  case LIBSPECTRUM_ERROR_CORRUPT: reason = "file is corrupt"; break;
+  case LIBSPECTRUM_ERROR_SIGNATURE: reason = "bad signature"; break;
+  case LIBSPECTRUM_ERROR_UNSUPPORTED: reason = "unsupported format"; break;
+  default: reason = "read error"; break;
+  }
+
+  ui_error( UI_ERROR_ERROR, "Couldn't read tape `%s': %s", job->filename,
+            reason );
+}
+
+/* Called at the end of every frame while a tape is being inflated */
+static void
+tape_inflate_frame( void )
+{
+  tape_inflate_job *job = inflate_job;
+  int done;
+
+  pthread_mutex_lock( &job->mutex );
+  done = job->done;
+  pthread_mutex_unlock( &job->mutex );
+
+  if( !done ) return;
+
+  spectrum_frame_unsubscribe( tape_inflate_frame );
+  pthread_join( job->thread, NULL );
+  inflate_job = NULL;
+
+  if( job->error ) {
+    tape_inflate_report( job );
+  } else {
+    libspectrum_tape_free( tape );
+    tape = job->tape; job->tape = NULL;
+    tape_edges_flush();
+    tape_index_valid = 0;
+
+    tape_inserted( job->filename, job->buffer, job->length, job->autoload );
+  }
+
+  tape_inflate_free( job );
+}
+
+/* Forget about any tape still being inflated */
+static void
+tape_inflate_cancel( void )
+{
+  if( !inflate_job ) return;
+
+  spectrum_frame_unsubscribe( tape_inflate_frame );
+  pthread_join( inflate_job->thread, NULL );
+  tape_inflate_free( inflate_job );
+  inflate_job = NULL;
+}
+
+/* Anything which has to see the same frames on every run waits for the
+   tape instead */
+static int
+tape_inflate_in_background( void )
+{
+  return !( bench_active || batch_active || export_active ||
+            fuselib_active || rzx_recording || rzx_playback ||
+            netplay_active );
+}
+
+/* Returns 0 if the tape is on its way, or non-zero if it'll have to be
+   read now */
+static int
+tape_inflate_start( const libspectrum_byte *buffer, size_t length,
+                    libspectrum_id_t type, const char *filename,
+                    int autoload )
+{
+  tape_inflate_job *job;
+
+  job = libspectrum_new0( tape_inflate_job, 1 );
+  job->buffer = libspectrum_new( libspectrum_byte, length );
+  memcpy( job->buffer, buffer, length );
+  job->length = length;
+  job->type = type;
+  job->filename = utils_safe_strdup( filename );
+  job->autoload = autoload;
+  job->tape = libspectrum_tape_alloc();
+  pthread_mutex_init( &job->mutex, NULL );
+
+  if( pthread_create( &job->thread, NULL, tape_inflate_thread_fn, job ) ) {
+    tape_inflate_free( job );
+    return 1;
+  }
+
+  inflate_job = job;
+  spectrum_frame_subscribe( tape_inflate_frame );
+
+  return 0;
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
 /* Use an already open tape file as the current tape */
 int
 tape_read_buffer( unsigned char *buffer, size_t length, libspectrum_id_t type,
 		  const char *filename, int autoload )
 {
+  libspectrum_id_t raw_type;
+  libspectrum_class_t raw_class;
   int error;
 
   if( libspectrum_tape_present( tape ) ) {
     error = tape_close(); if( error ) return error;
   }
 
-  error = libspectrum_tape_read( tape, buffer, length, type, filename );
-  if( error ) return error;
+#ifdef HAVE_PTHREAD
+  tape_inflate_cancel();
+#endif
 
-  tape_modified = 0;
-  ui_tape_browser_update( UI_TAPE_BROWSER_NEW_TAPE, NULL );
+  if( libspectrum_identify_file_raw( &raw_type, filename, buffer, length ) ||
+      libspectrum_identify_class( &raw_class, raw_type ) )
+    raw_class = LIBSPECTRUM_CLASS_UNKNOWN;
 
-  if( autoload ) {
-    error = tape_autoload( machine_current->machine );
-    if( error ) return error;
+  if( raw_class == LIBSPECTRUM_CLASS_COMPRESSED ) {
+#ifdef HAVE_PTHREAD
+    if( tape_inflate_in_background() &&
+        !tape_inflate_start( buffer, length, raw_type, filename, autoload ) )
+      return 0;
+#endif
+    error = tape_read_compressed( tape, buffer, length, raw_type, filename );
+  } else {
+    error = libspectrum_tape_read( tape, buffer, length, type, filename );
   }
+  tape_edges_flush();
+  tape_index_valid = 0;
+  if( error ) return error;
 
-  return 0;
+  return tape_inserted( filename, buffer, length, autoload );
 }
 
 static int
@@ -275,14 +905,25 @@ tape_close( void )
     }
   }
 
+#ifdef HAVE_PTHREAD
+  tape_inflate_cancel();
+#endif
+
   /* Stop the tape if it's currently playing */
   if( tape_playing ) {
     error = tape_stop();
     if( error ) return error;
   }
 
+#ifdef GCWZERO
+  savestate_tape_ready_forget();
+#endif
+
   /* And then remove it from memory */
   error = libspectrum_tape_clear( tape );
+  tape_edges_flush();
+  tape_index_valid = 0;
+  memory_usage_set( MEMORY_USAGE_TAPE, 0 );
   if( error ) return error;
 
   tape_modified = 0;
@@ -317,7 +958,13 @@ tape_select_block( size_t n )
 int
 tape_select_block_no_update( size_t n )
 {
-  return libspectrum_tape_nth_block( tape, n );
+  int error;
+
+  tape_edges_flush();
+  error = libspectrum_tape_nth_block( tape, n );
+  if( !error ) tape_block_index = n;
+
+  return error;
 }
 
 /* Which block is current? */
@@ -329,9 +976,13 @@ tape_get_current_block( void )
 
   if( !libspectrum_tape_present( tape ) ) return -1;
 
+  if( tape_block_index >= 0 ) return tape_block_index;
+
   error = libspectrum_tape_position( &n, tape );
   if( error ) return -1;
 
+  tape_block_index = n;
+
   return n;
 }
 
@@ -390,9 +1041,10 @@ tape_load_trap( void )
   libspectrum_tape_block *block, *next_block;
   int error;
 
-  /* Do nothing if tape traps aren't active, or the tape is already playing */
+  /* Do nothing if tape traps aren't active, or the tape is already
+     playing, or in a frame run ahead which will be thrown away */
   if( !settings_current.tape_traps || tape_playing ||
-      rzx_playback || rzx_recording )
+      rzx_playback || rzx_recording || runahead_active )
     return 2;
 
   /* Do nothing if we're not in the correct ROM */
@@ -405,6 +1057,7 @@ tape_load_trap( void )
 
   /* Skip over any meta-data blocks */
   while( libspectrum_tape_block_metadata( block ) ) {
+    tape_edges_flush();
     block = libspectrum_tape_select_next_block( tape );
     if( !block ) return 1;
   }
@@ -413,7 +1066,7 @@ tape_load_trap( void )
      that, return with `error' so that we actually do whichever
      instruction it was that caused the trap to hit */
   if( libspectrum_tape_block_type( block ) != LIBSPECTRUM_TAPE_BLOCK_ROM ||
-      libspectrum_tape_state( tape ) != LIBSPECTRUM_TAPE_STATE_PILOT ) {
+      tape_state() != LIBSPECTRUM_TAPE_STATE_PILOT ) {
     tape_play( 1 );
     return -1;
   }
@@ -428,6 +1081,10 @@ tape_load_trap( void )
   /* Deactivate the phantom typist */
   phantom_typist_deactivate();
 
+  /* The block is about to be loaded in one go, so any edges decoded from
+     its pilot tone won't be needed */
+  tape_edges_flush();
+
   /* All returns made via the RET at #05E2, except on Timex 2068 at #0136 */
   if ( machine_current->machine == LIBSPECTRUM_MACHINE_TC2068 ||
        machine_current->machine == LIBSPECTRUM_MACHINE_TS2068 ) {
@@ -446,6 +1103,7 @@ tape_load_trap( void )
   if( libspectrum_tape_block_type(next_block) == LIBSPECTRUM_TAPE_BLOCK_ROM ) {
 
     next_block = libspectrum_tape_select_next_block( tape );
+    tape_block_index = -1;
     if( !next_block ) return 1;
 
     ui_tape_browser_update( UI_TAPE_BROWSER_SELECT_BLOCK, NULL );
@@ -578,9 +1236,9 @@ tape_save_trap( void )
 
   int i;
 
-  /* Do nothing if tape traps aren't active */
+  /* Do nothing if tape traps aren't active, or in a frame run ahead */
   if( !settings_current.tape_traps || tape_recording ||
-      rzx_playback || rzx_recording )
+      rzx_playback || rzx_recording || runahead_active )
     return 2;
 
   /* Check we're in the right ROM */
@@ -612,6 +1270,7 @@ tape_save_trap( void )
   libspectrum_tape_block_set_pause( block, 1000 );
 
   libspectrum_tape_append_block( tape, block );
+  tape_index_valid = 0;
 
   tape_modified = 1;
   ui_tape_browser_update( UI_TAPE_BROWSER_NEW_BLOCK, block );
@@ -646,14 +1305,20 @@ tape_play( int autoplay )
   timer_start_fastloading();
 
   loader_tape_play();
+  tape_flash_update();
 
-  event_add( tstates + next_tape_edge_tstates, tape_edge_event );
+  tape_edge_handle = event_add( tstates + next_tape_edge_tstates,
+                                tape_edge_event );
   next_tape_edge_tstates = 0;
 
   /* Once the tape has started, the phantom typist has done its job so
      cancel any pending actions */
   phantom_typist_deactivate();
 
+#ifdef GCWZERO
+  savestate_tape_ready_started();
+#endif
+
   debugger_event( play_event );
 
   return 0;
@@ -679,20 +1344,12 @@ tape_toggle_play( int autoplay )
   }
 }
 
-static void
-save_next_tape_edge( gpointer data, gpointer user_data )
-{
-  event_t *ptr = data;
-
-  if( ptr->type == tape_edge_event ) {
-    next_tape_edge_tstates = ptr->tstates - tstates;
-  }
-}
-
 static void
 tape_save_next_edge( void )
 {
-  event_foreach( save_next_tape_edge, NULL );
+  event_t *ptr = event_pending( &tape_edge_handle );
+
+  if( ptr ) next_tape_edge_tstates = ptr->tstates - tstates;
 }
 
 int
@@ -703,11 +1360,12 @@ tape_stop( void )
     tape_playing = 0;
     ui_statusbar_update( UI_STATUSBAR_ITEM_TAPE, UI_STATUSBAR_STATE_INACTIVE );
     loader_tape_stop();
+    tape_flash_update();
 
     timer_stop_fastloading();
 
     tape_save_next_edge();
-    event_remove_type( tape_edge_event );
+    event_cancel( &tape_edge_handle );
 
     /* Turn off any lingering MIC level in a second (some loaders like Alkatraz
        seem to check the MIC level soon after loading is finished, presumably as
@@ -733,20 +1391,138 @@ tape_present( void )
   return libspectrum_tape_present( tape );
 }
 
+/* Recording samples the MIC level 44100 times a second as the ULA did,
+   but the samples are worked out whenever the level changes rather than
+   taken one by one, and go straight into CSW-style run lengths: a byte
+   for runs up to 255 samples, or a zero byte followed by a 32-bit length.
+   With --tape-record-stream, the run lengths are written out to a TZX
+   file as they build up rather than kept until recording stops */
+
+/* Write streamed run lengths out once there are this many bytes */
+#define TAPE_RECORD_STREAM_CHUNK 0x10000
+
+/* Where the fields which aren't known until the end are in a streamed
+   TZX file: the block length and the number of pulses */
+#define TAPE_RECORD_STREAM_LENGTH_OFFSET 11
+#define TAPE_RECORD_STREAM_PULSES_OFFSET 21
+#define TAPE_RECORD_STREAM_HEADER_LENGTH 25
+
 typedef struct
 {
   libspectrum_byte *tape_buffer;
   libspectrum_dword tape_buffer_size;
   libspectrum_dword tape_buffer_used;
   int tstates_per_sample;
-  int last_level;
-  int last_level_count;
+
+  int level;			/* The current MIC level */
+  libspectrum_dword level_tstates;	/* When it last changed */
+  libspectrum_dword sample_offset;	/* T-states from then to the next
+					   sample */
+
+  int last_level;		/* The level of the run being built up */
+  libspectrum_dword last_level_count;
+
+  FILE *stream;			/* The TZX file being streamed to */
+  char *stream_filename;
+  libspectrum_dword stream_length, stream_pulses;
+  int stream_error;
 } tape_rec_state;
 
 int tape_recording = 0;
 
 static tape_rec_state rec_state;
 
+static void
+tape_stream_write( const libspectrum_byte *buffer, size_t length )
+{
+  if( rec_state.stream_error || !length ) return;
+
+  if( fwrite( buffer, 1, length, rec_state.stream ) != length ) {
+    ui_error( UI_ERROR_ERROR, "error writing to '%s': %s",
+              rec_state.stream_filename, strerror( errno ) );
+    rec_state.stream_error = 1;
+  }
+}
+
+static void
+tape_stream_dword( libspectrum_byte *buffer, libspectrum_dword value )
+{
+  buffer[0] = value & 0xff;
+  buffer[1] = ( value >> 8 ) & 0xff;
+  buffer[2] = ( value >> 16 ) & 0xff;
+  buffer[3] = value >> 24;
+}
+
+/* Start a TZX file with a single CSW recording block, the lengths in
+   which are filled in when recording stops */
+static int
+tape_stream_start( const char *filename )
+{
+  libspectrum_byte header[ TAPE_RECORD_STREAM_HEADER_LENGTH ] = {
+    'Z', 'X', 'T', 'a', 'p', 'e', '!', 0x1a, 1, 20,
+    0x18,				/* CSW recording block */
+    0, 0, 0, 0,				/* Block length */
+    0, 0,				/* Pause */
+    0, 0, 0,				/* Sample rate */
+    0x01,				/* RLE compression */
+    0, 0, 0, 0,				/* Number of pulses */
+  };
+  libspectrum_dword rate = 3500000 / rec_state.tstates_per_sample;
+
+  rec_state.stream = fopen( filename, "wb" );
+  if( !rec_state.stream ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s': %s", filename,
+              strerror( errno ) );
+    return 1;
+  }
+
+  rec_state.stream_filename = utils_safe_strdup( filename );
+  rec_state.stream_length = rec_state.stream_pulses = 0;
+  rec_state.stream_error = 0;
+
+  header[17] = rate & 0xff;
+  header[18] = ( rate >> 8 ) & 0xff;
+  header[19] = rate >> 16;
+
+  tape_stream_write( header, sizeof( header ) );
+
+  return 0;
+}
+
+static void
+tape_stream_flush( void )
+{
+  tape_stream_write( rec_state.tape_buffer, rec_state.tape_buffer_used );
+  rec_state.stream_length += rec_state.tape_buffer_used;
+  rec_state.tape_buffer_used = 0;
+}
+
+static void
+tape_stream_end( void )
+{
+  libspectrum_byte buffer[4];
+
+  tape_stream_flush();
+
+  /* The block length doesn't include the length itself */
+  tape_stream_dword( buffer, rec_state.stream_length +
+                     TAPE_RECORD_STREAM_HEADER_LENGTH -
+                     TAPE_RECORD_STREAM_LENGTH_OFFSET - 4 );
+  if( !fseek( rec_state.stream, TAPE_RECORD_STREAM_LENGTH_OFFSET, SEEK_SET ) )
+    tape_stream_write( buffer, 4 );
+  tape_stream_dword( buffer, rec_state.stream_pulses );
+  if( !fseek( rec_state.stream, TAPE_RECORD_STREAM_PULSES_OFFSET, SEEK_SET ) )
+    tape_stream_write( buffer, 4 );
+
+  if( fclose( rec_state.stream ) && !rec_state.stream_error )
+    ui_error( UI_ERROR_ERROR, "error writing to '%s': %s",
+              rec_state.stream_filename, strerror( errno ) );
+
+  rec_state.stream = NULL;
+  libspectrum_free( rec_state.stream_filename );
+  rec_state.stream_filename = NULL;
+}
+
 void
 tape_record_start( void )
 {
@@ -754,16 +1530,18 @@ tape_record_start( void )
   rec_state.tstates_per_sample =
     machine_current->timings.processor_speed/44100;
 
+  if( settings_current.tape_record_stream &&
+      tape_stream_start( settings_current.tape_record_stream ) )
+    return;
+
   rec_state.tape_buffer_size = 8192;
   rec_state.tape_buffer = libspectrum_new(libspectrum_byte,
 					  rec_state.tape_buffer_size);
   rec_state.tape_buffer_used = 0;
 
-  /* start scheduling events that record into a buffer that we
-     start allocating here */
-  event_add( tstates + rec_state.tstates_per_sample, record_event );
-
-  rec_state.last_level = ula_tape_level();
+  rec_state.level = rec_state.last_level = ula_tape_level();
+  rec_state.level_tstates = tstates;
+  rec_state.sample_offset = rec_state.tstates_per_sample;
   rec_state.last_level_count = 1;
 
   tape_recording = 1;
@@ -775,7 +1553,7 @@ tape_record_start( void )
 static int
 write_rec_buffer( libspectrum_byte *tape_buffer,
                   libspectrum_dword tape_buffer_used,
-                  int last_level_count )
+                  libspectrum_dword last_level_count )
 {
   if( last_level_count <= 0xff ) {
     tape_buffer[ tape_buffer_used++ ] = last_level_count;
@@ -790,32 +1568,72 @@ write_rec_buffer( libspectrum_byte *tape_buffer,
   return tape_buffer_used;
 }
 
-void
-tape_event_record_sample( libspectrum_dword last_tstates, int type,
-			  void *user_data )
-{
-  if( rec_state.last_level != (ula_tape_level()) ) {
-    /* put a sample into the recording buffer */
-    rec_state.tape_buffer_used =
-      write_rec_buffer( rec_state.tape_buffer,
-                        rec_state.tape_buffer_used,
-                        rec_state.last_level_count );
-
-    rec_state.last_level_count = 0;
-    rec_state.last_level = ula_tape_level();
-    /* make sure we can still fit a dword and a flag byte in the buffer */
-    if( rec_state.tape_buffer_used+5 >= rec_state.tape_buffer_size ) {
-      rec_state.tape_buffer_size = rec_state.tape_buffer_size*2;
-      rec_state.tape_buffer =
-        libspectrum_renew( libspectrum_byte, rec_state.tape_buffer,
-                           rec_state.tape_buffer_size );
+/* Finish off the current run of samples */
+static void
+tape_record_run( void )
+{
+  rec_state.tape_buffer_used =
+    write_rec_buffer( rec_state.tape_buffer, rec_state.tape_buffer_used,
+                      rec_state.last_level_count );
+  rec_state.stream_pulses++;
+
+  if( rec_state.stream ) {
+    if( rec_state.tape_buffer_used >= TAPE_RECORD_STREAM_CHUNK )
+      tape_stream_flush();
+  }
+
+  /* make sure we can still fit a dword and a flag byte in the buffer */
+  if( rec_state.tape_buffer_used+5 >= rec_state.tape_buffer_size ) {
+    rec_state.tape_buffer_size = rec_state.tape_buffer_size*2;
+    rec_state.tape_buffer =
+      libspectrum_renew( libspectrum_byte, rec_state.tape_buffer,
+                         rec_state.tape_buffer_size );
+  }
+}
+
+/* Take all the samples due up to `time', at which the level is still the
+   one it was last changed to */
+static void
+tape_record_samples( libspectrum_dword time )
+{
+  libspectrum_dword elapsed = time - rec_state.level_tstates, samples;
+
+  if( elapsed < rec_state.sample_offset ) {
+    rec_state.sample_offset -= elapsed;
+  } else {
+    elapsed -= rec_state.sample_offset;
+    samples = elapsed / rec_state.tstates_per_sample + 1;
+    rec_state.sample_offset =
+      rec_state.tstates_per_sample - elapsed % rec_state.tstates_per_sample;
+
+    if( rec_state.level != rec_state.last_level ) {
+      tape_record_run();
+      rec_state.last_level = rec_state.level;
+      rec_state.last_level_count = 0;
     }
+    rec_state.last_level_count += samples;
   }
 
-  rec_state.last_level_count++;
+  rec_state.level_tstates = time;
+}
+
+void
+tape_record_level( libspectrum_dword time, int level )
+{
+  if( !tape_recording || level == rec_state.level ) return;
+
+  tape_record_samples( time );
+  rec_state.level = level;
+}
+
+void
+tape_frame( libspectrum_dword frame_length )
+{
+  if( !tape_recording ) return;
 
-  /* schedule next timer */
-  event_add( last_tstates + rec_state.tstates_per_sample, record_event );
+  /* Keep the time of the last level change relative to the new frame */
+  tape_record_samples( frame_length );
+  rec_state.level_tstates -= frame_length;
 }
 
 int
@@ -824,41 +1642,46 @@ tape_record_stop( void )
   libspectrum_tape_block* block;
 
   /* put last sample into the recording buffer */
+  tape_record_samples( tstates );
   rec_state.tape_buffer_used = write_rec_buffer( rec_state.tape_buffer,
                                                  rec_state.tape_buffer_used,
                                                  rec_state.last_level_count );
+  rec_state.stream_pulses++;
 
-  /* stop scheduling events and turn buffer into a block and
-     pop into the current tape */
-  event_remove_type( record_event );
+  tape_recording = 0;
 
-  block = libspectrum_tape_block_alloc( LIBSPECTRUM_TAPE_BLOCK_RLE_PULSE );
+  /* Also want to reenable other tape actions */
+  ui_menu_activate( UI_MENU_ITEM_TAPE_RECORDING, 0 );
 
-  libspectrum_tape_block_set_scale( block, rec_state.tstates_per_sample );
-  libspectrum_tape_block_set_data_length( block, rec_state.tape_buffer_used );
-  libspectrum_tape_block_set_data( block, rec_state.tape_buffer );
+  if( rec_state.stream ) {
+    tape_stream_end();
+    libspectrum_free( rec_state.tape_buffer );
+  } else {
+    /* turn buffer into a block and pop into the current tape */
+    block = libspectrum_tape_block_alloc( LIBSPECTRUM_TAPE_BLOCK_RLE_PULSE );
 
-  libspectrum_tape_append_block( tape, block );
+    libspectrum_tape_block_set_scale( block, rec_state.tstates_per_sample );
+    libspectrum_tape_block_set_data_length( block,
+                                            rec_state.tape_buffer_used );
+    libspectrum_tape_block_set_data( block, rec_state.tape_buffer );
+
+    libspectrum_tape_append_block( tape, block );
+    tape_index_valid = 0;
+
+    tape_modified = 1;
+    ui_tape_browser_update( UI_TAPE_BROWSER_NEW_BLOCK, block );
+  }
 
   rec_state.tape_buffer = NULL;
   rec_state.tape_buffer_size = 0;
   rec_state.tape_buffer_used = 0;
 
-  tape_modified = 1;
-  ui_tape_browser_update( UI_TAPE_BROWSER_NEW_BLOCK, block );
-
-  tape_recording = 0;
-
-  /* Also want to reenable other tape actions */
-  ui_menu_activate( UI_MENU_ITEM_TAPE_RECORDING, 0 );
-
   return 0;
 }
 
 void
 tape_next_edge( libspectrum_dword last_tstates, int from_acceleration )
 {
-  libspectrum_error libspec_error;
   libspectrum_tape_block *block;
 
   libspectrum_dword edge_tstates;
@@ -868,9 +1691,13 @@ tape_next_edge( libspectrum_dword last_tstates, int from_acceleration )
   if( ! tape_playing ) return;
 
   /* Get the time until the next edge */
-  libspec_error = libspectrum_tape_get_next_edge( &edge_tstates, &flags,
-						  tape );
-  if( libspec_error != LIBSPECTRUM_ERROR_NONE ) return;
+  if( tape_edges_next == tape_edges_count && tape_edges_fill() ) return;
+
+  edge_tstates = tape_edges[ tape_edges_next ].tstates;
+  flags = tape_edges[ tape_edges_next ].flags;
+  tape_edges_next++;
+
+  tape_block_elapsed += edge_tstates;
 
   /* Invert the microphone state */
   if( edge_tstates ||
@@ -904,13 +1731,22 @@ tape_next_edge( libspectrum_dword last_tstates, int from_acceleration )
     )
   {
     tape_stop();
+#ifdef GCWZERO
+    savestate_tape_ready_stopped();
+#endif
     return;
   }
 
   /* If that was the end of a block, update the browser */
   if( flags & LIBSPECTRUM_TAPE_FLAGS_BLOCK ) {
 
+    /* Jumps and loops mean the next block isn't necessarily the one
+       after this */
+    tape_block_index = -1;
+    tape_block_elapsed = 0;
+
     ui_tape_browser_update( UI_TAPE_BROWSER_SELECT_BLOCK, NULL );
+    tape_flash_update();
 
     /* If the tape was started automatically, tape traps are active
        and the new block is a ROM loader, stop the tape and return
@@ -920,6 +1756,9 @@ tape_next_edge( libspectrum_dword last_tstates, int from_acceleration )
         libspectrum_tape_block_type( block ) == LIBSPECTRUM_TAPE_BLOCK_ROM
       ) {
       tape_stop();
+#ifdef GCWZERO
+      savestate_tape_ready_stopped();
+#endif
       return;
     }
   }
@@ -928,7 +1767,8 @@ tape_next_edge( libspectrum_dword last_tstates, int from_acceleration )
      should occur 'edge_tstates' after the last edge, not after the
      current time (these will be slightly different as we only process
      events between instructions). */
-  event_add( last_tstates + edge_tstates, tape_edge_event );
+  tape_edge_handle = event_add( last_tstates + edge_tstates,
+                                tape_edge_event );
 
   /* Store length flags for acceleration purposes */
   loader_set_acceleration_flags( flags, from_acceleration );
@@ -27,6 +27,8 @@
 
 #include <libspectrum.h>
 
+#include "event.h"
+
 void tape_register_startup( void );
 
 int tape_open( const char *filename, int autoload );
@@ -54,11 +56,29 @@ void tape_next_edge( libspectrum_dword last_tstates, int from_acceleration );
 
 int tape_stop( void );
 int tape_is_playing( void );
+
+/* Tape times, in T-states at 3.5MHz from the start of the tape.
+   tape_get_times() gives how far the tape has got and how long it is
+   in total, returning non-zero if there's no tape. tape_block_at_time()
+   gives the block playing at `time', or -1 if there's no tape, and
+   tape_seek_time() selects that block */
+int tape_get_times( libspectrum_qword *elapsed, libspectrum_qword *total );
+libspectrum_qword tape_block_start_time( size_t n );
+int tape_block_at_time( libspectrum_qword time );
+int tape_seek_time( libspectrum_qword time );
+
+/* Is a standard speed block being loaded flat out? */
+int tape_flash_loading( void );
 int tape_present( void );
 
 void tape_record_start( void );
 int tape_record_stop( void );
 
+/* Called when the MIC level changes while recording, and at the end of
+   every frame */
+void tape_record_level( libspectrum_dword time, int level );
+void tape_frame( libspectrum_dword frame_length );
+
 /* Call a user-supplied function for every block in the current tape */
 int
 tape_foreach( void (*function)( libspectrum_tape_block *block,
@@ -76,5 +96,6 @@ extern int tape_playing;
 extern int tape_recording;
 
 extern int tape_edge_event;
+extern event_handle_t tape_edge_handle;
 
 #endif
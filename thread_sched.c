@@ -0,0 +1,227 @@
+/* thread_sched.c: Scheduling priority and CPU pinning for threads
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/* sched_setaffinity() and RUSAGE_THREAD are GNU extensions */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "fuse.h"
+#include "settings.h"
+#include "thread_sched.h"
+
+/* How far above the policy's minimum each role's realtime priority is
+   with --thread-priority=fifo or rr. Sound comes first as a late buffer
+   is heard, while a late frame can at worst be dropped */
+static const int realtime_boost[] = { 2, 3, 1, 1, 0 };
+
+/* And the nice level each role gets with --thread-priority=high */
+static const int nice_level[] = { -10, -15, -5, -5, 0 };
+
+/* Only complain once, however many threads fail. The audio callback
+   may be one of them, so this can't go through ui_error() */
+static int warned = 0;
+
+static void
+warn( const char *what, int error )
+{
+  if( warned ) return;
+  warned = 1;
+
+  fprintf( stderr, "%s: couldn't set thread %s: %s\n", fuse_progname, what,
+           error ? strerror( error ) : "not supported on this system" );
+}
+
+/* Run only on `cpu', or anywhere if it's negative */
+static void
+set_cpu( int cpu )
+{
+#ifdef __linux__
+  cpu_set_t set;
+  int i;
+
+  CPU_ZERO( &set );
+  if( cpu >= 0 ) {
+    CPU_SET( cpu, &set );
+  } else {
+    for( i = 0; i < CPU_SETSIZE; i++ ) CPU_SET( i, &set );
+  }
+
+  /* 0 is the calling thread rather than the whole of Fuse */
+  if( sched_setaffinity( 0, sizeof( set ), &set ) ) warn( "CPU", errno );
+#elif defined WIN32
+  DWORD_PTR process, system;
+
+  if( !GetProcessAffinityMask( GetCurrentProcess(), &process, &system ) ) {
+    warn( "CPU", 0 );
+    return;
+  }
+  if( cpu >= 0 )
+    process = cpu < (int)( 8 * sizeof( DWORD_PTR ) ) ?
+              (DWORD_PTR)1 << cpu : 0;
+
+  if( !process || !SetThreadAffinityMask( GetCurrentThread(), process ) )
+    warn( "CPU", 0 );
+#else
+  warn( "CPU", 0 );
+#endif
+}
+
+static void
+set_nice( thread_sched_role role )
+{
+#ifdef __linux__
+  /* On Linux, this affects just this thread rather than all of Fuse */
+  if( setpriority( PRIO_PROCESS, 0, nice_level[ role ] ) )
+    warn( "priority", errno );
+#elif defined WIN32
+  if( !SetThreadPriority( GetCurrentThread(), nice_level[ role ] <= -10 ?
+                          THREAD_PRIORITY_HIGHEST :
+                          THREAD_PRIORITY_ABOVE_NORMAL ) )
+    warn( "priority", 0 );
+#else
+  warn( "priority", 0 );
+#endif
+}
+
+static void
+set_realtime( thread_sched_role role, int round_robin )
+{
+#if defined( HAVE_PTHREAD ) && !defined( WIN32 )
+  struct sched_param param;
+  int policy = round_robin ? SCHED_RR : SCHED_FIFO;
+  int error;
+
+  memset( &param, 0, sizeof( param ) );
+  param.sched_priority = sched_get_priority_min( policy ) +
+                         realtime_boost[ role ];
+
+  error = pthread_setschedparam( pthread_self(), policy, &param );
+  if( error ) warn( "realtime priority", error );
+#elif defined WIN32
+  if( !SetThreadPriority( GetCurrentThread(), role == THREAD_SCHED_AUDIO ?
+                          THREAD_PRIORITY_TIME_CRITICAL :
+                          THREAD_PRIORITY_HIGHEST ) )
+    warn( "priority", 0 );
+#else
+  warn( "realtime priority", 0 );
+#endif
+}
+
+/* Undo anything inherited from the emulation thread */
+static void
+set_normal( void )
+{
+#if defined( HAVE_PTHREAD ) && !defined( WIN32 )
+  struct sched_param param;
+  int error;
+
+  memset( &param, 0, sizeof( param ) );
+  error = pthread_setschedparam( pthread_self(), SCHED_OTHER, &param );
+  if( error ) warn( "priority", error );
+#endif
+
+#ifdef __linux__
+  if( setpriority( PRIO_PROCESS, 0, 0 ) ) warn( "priority", errno );
+#elif defined WIN32
+  if( !SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_NORMAL ) )
+    warn( "priority", 0 );
+#endif
+}
+
+void
+thread_sched_apply( thread_sched_role role )
+{
+  const char *priority = settings_current.thread_priority;
+  int cpu = -1;
+
+  if( role == THREAD_SCHED_EMULATION ) {
+    cpu = settings_current.emulation_cpu;
+  } else if( role == THREAD_SCHED_AUDIO ) {
+    cpu = settings_current.audio_cpu;
+  }
+
+  /* Threads started once the emulation thread has been pinned inherit
+     its CPU, which they're not to share unless given it themselves */
+  if( cpu >= 0 ) {
+    set_cpu( cpu );
+  } else if( role != THREAD_SCHED_EMULATION &&
+             settings_current.emulation_cpu >= 0 ) {
+    set_cpu( -1 );
+  }
+
+  if( role == THREAD_SCHED_BACKGROUND ) {
+    if( priority && strcmp( priority, "normal" ) ) set_normal();
+    return;
+  }
+
+  if( !priority || !strcmp( priority, "normal" ) ) return;
+
+  if( !strcmp( priority, "high" ) ) {
+    set_nice( role );
+  } else if( !strcmp( priority, "fifo" ) ) {
+    set_realtime( role, 0 );
+  } else if( !strcmp( priority, "rr" ) ) {
+    set_realtime( role, 1 );
+  } else if( !warned ) {
+    warned = 1;
+    fprintf( stderr, "%s: unknown thread priority '%s'\n", fuse_progname,
+             priority );
+  }
+}
+
+libspectrum_dword
+thread_sched_preemptions( void )
+{
+#ifdef __linux__
+  struct rusage usage;
+
+  if( getrusage( RUSAGE_THREAD, &usage ) ) return 0;
+
+  return usage.ru_nivcsw;
+#else
+  return 0;
+#endif
+}
+
@@ -0,0 +1,53 @@
+/* thread_sched.h: Scheduling priority and CPU pinning for threads
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+
+#ifndef FUSE_THREAD_SCHED_H
+#define FUSE_THREAD_SCHED_H
+
+#include <libspectrum.h>
+
+/* What a thread does, which decides how it's scheduled */
+typedef enum thread_sched_role {
+
+  THREAD_SCHED_EMULATION,	/* The main thread running the Z80 */
+  THREAD_SCHED_AUDIO,		/* Making or feeding out sound */
+  THREAD_SCHED_RENDER,		/* Scaling and drawing the display */
+  THREAD_SCHED_IO,		/* Serving network and similar devices */
+  THREAD_SCHED_BACKGROUND,	/* Writing files and the like */
+
+} thread_sched_role;
+
+/* Apply the scheduling asked for by --thread-priority, --emulation-cpu
+   and --audio-cpu to the calling thread. Threads inherit these from
+   whoever started them, so background threads use this to go back to
+   normal scheduling rather than competing with the emulation. Failures
+   are reported once and otherwise ignored; the thread just carries on
+   as it was */
+void thread_sched_apply( thread_sched_role role );
+
+/* How many times the calling thread has been involuntarily switched
+   out so far, where the host can tell us; 0 otherwise */
+libspectrum_dword thread_sched_preemptions( void );
+
+#endif			/* #ifndef FUSE_THREAD_SCHED_H */
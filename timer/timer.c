@@ -23,10 +23,18 @@
 
 #include <config.h>
 
+#include "batch.h"
+#include "bench.h"
+#include "export.h"
+#include "display.h"
 #include "event.h"
+#include "frametime.h"
+#include "fuselib.h"
 #include "infrastructure/startup_manager.h"
+#include "input.h"
 #include "movie.h"
 #include "phantom_typist.h"
+#include "runahead.h"
 #include "settings.h"
 #include "sound.h"
 #include "tape.h"
@@ -53,12 +61,56 @@ static int samples;
 
 float current_speed = 100.0;
 
+/*
+ * Frame pacing when there's no sound to time us
+ */
+
+/* When the next frame is due to start */
 static double start_time;
 
+/* A moving average of how much longer than asked for timer_sleep() takes,
+   in seconds; each sleep is cut short by this much so we wake before the
+   deadline rather than after it */
+static double oversleep;
+
+/* The longest we sleep for before looking at the input again */
 static const int TEN_MS = 10;
 
+/* How much of the last millisecond or so before the deadline is left to
+   be yielded away rather than slept through, in seconds */
+static const double YIELD_TIME = 0.0005;
+
+/*
+ * Locking the emulation to the display's refresh
+ */
+
+/* Set while the display's page flips are pacing the emulation */
+int timer_vsync_locked = 0;
+
+/* When the last flip finished, and a moving average of the time between
+   flips which each waited for one refresh */
+static double vsync_last, vsync_period;
+static int vsync_samples;
+
+/* How many flips in a row have come back sooner than any refresh could */
+static int vsync_early;
+
+/* Set once the flips have turned out not to wait for the refresh at all;
+   cleared by timer_vsync_reset() */
+static int vsync_broken;
+
+/* Only lock when the display is this close to the emulated frame rate,
+   so the sound's rate control can make up the difference */
+static const double VSYNC_TOLERANCE = SOUND_RATE_ADJUST_MAX * 0.8;
+
+/* The number of flips to measure before locking */
+static const int VSYNC_SAMPLES = 50;
+
 int timer_event;
 
+/* Set while the user has asked for the emulation to run flat out */
+int timer_turbo = 0;
+
 static void timer_frame( libspectrum_dword last_tstates, int event GCC_UNUSED,
 			 void *user_data GCC_UNUSED );
 
@@ -120,6 +172,7 @@ int
 timer_estimate_reset( void )
 {
   start_time = timer_get_time(); if( start_time < 0 ) return 1;
+  oversleep = 0;
   samples = 0;
   next_stored_time = 0;
   frames_until_update = 0;
@@ -139,6 +192,76 @@ timer_init( void *context )
   return timer_estimate_reset();
 }
 
+void
+timer_vsync_reset( void )
+{
+  timer_vsync_locked = 0;
+  vsync_last = 0;
+  vsync_samples = 0;
+  vsync_early = 0;
+  vsync_broken = 0;
+}
+
+void
+timer_vsync( void )
+{
+  double current_time, interval, frame_length, error;
+
+  /* Locking makes each flip one emulated frame at its normal speed */
+  if( !settings_current.vsync_lock || settings_current.frame_rate != 1 ||
+      display_render_mode() == DISPLAY_RENDER_HALF_RATE ||
+      settings_current.emulation_speed != 100 || timer_turbo ) {
+    timer_vsync_reset();
+    return;
+  }
+
+#ifndef SOUND_FIFO
+  /* A sound device which blocks would be pacing us as well */
+  if( sound_enabled && settings_current.sound ) {
+    timer_vsync_reset();
+    return;
+  }
+#endif                          /* #ifndef SOUND_FIFO */
+
+  if( vsync_broken ) return;
+
+  current_time = timer_get_time(); if( current_time < 0 ) return;
+
+  interval = current_time - vsync_last;
+  vsync_last = current_time;
+
+  frame_length = (double)machine_current->timings.tstates_per_frame /
+                 machine_current->timings.processor_speed;
+
+  /* While locked, only the first couple of flips after the lock, which
+     fill up the spare pages, can come back straight away; if they keep
+     doing so, the flips aren't waiting for the refresh */
+  if( interval < frame_length / 2 ) {
+    if( timer_vsync_locked && ++vsync_early > 3 ) {
+      timer_vsync_locked = 0;
+      vsync_broken = 1;
+    }
+    return;
+  }
+  vsync_early = 0;
+
+  /* A flip which waited for more than one refresh, or which came after a
+   pause, says nothing about the refresh rate */
+  if( interval > frame_length * 1.5 ) return;
+
+  if( !vsync_samples++ ) vsync_period = interval;
+  vsync_period += ( interval - vsync_period ) / 16;
+
+  error = vsync_period / frame_length - 1;
+  if( error < 0 ) error = -error;
+
+  if( timer_vsync_locked ) {
+    if( error > VSYNC_TOLERANCE ) timer_vsync_locked = 0;
+  } else if( vsync_samples >= VSYNC_SAMPLES && error <= VSYNC_TOLERANCE ) {
+    timer_vsync_locked = 1;
+  }
+}
+
 static void
 timer_end( void )
 {
@@ -160,23 +283,15 @@ timer_register_startup( void )
 #ifdef SOUND_FIFO
 
 /* Callback-style sound based timer */
-#include "sound/sfifo.h"
-
-extern sfifo_t sound_fifo;
-
 static void
 timer_frame_callback_sound( libspectrum_dword last_tstates )
 {
-  for(;;) {
-
-    /* Sleep while fifo is full */
-    if( sfifo_space( &sound_fifo ) < sound_framesiz ) {
-      timer_sleep( TEN_MS );
-    } else {
-      break;
-    }
-
-  }
+  /* Wait while the fifo is at its target depth; the sound code wakes us
+     as soon as there is space */
+  FRAMETIME_ENTER( FRAMETIME_PROBE_SLEEP );
+  while( !sound_fifo_wait( settings_current.timed_input ? 2 : 100 ) )
+    input_poll_idle();
+  FRAMETIME_LEAVE();
 
   event_add( last_tstates + machine_current->timings.tstates_per_frame,
              timer_event );
@@ -212,62 +327,114 @@ timer_stop_fastloading( void )
   }
 }
 
+/* Turn turbo mode on or off. While it is on, the emulation runs as fast
+   as it can, only every nth frame is drawn and sound which the device
+   can't keep up with is dropped */
+void
+timer_set_turbo( int active )
+{
+  if( timer_turbo == active ) return;
+
+  timer_turbo = active;
+
+  /* Start timing again from now, or we would try to catch up with all
+     the time spent in turbo mode */
+  if( !timer_turbo ) timer_estimate_reset();
+}
+
 int
 timer_fastloading_active( void )
 {
   return tape_is_playing() || phantom_typist_is_active();
 }
 
-static void
-timer_frame( libspectrum_dword last_tstates, int event GCC_UNUSED,
-	     void *user_data GCC_UNUSED )
+/* Wait until `deadline': sleep while it's more than a millisecond or so
+   away, then yield the processor until it arrives. Returns the time we
+   finished waiting, or -1 on error */
+static double
+timer_pace( double deadline )
 {
-  double current_time, difference;
-  long tstates;
+  double current_time, woken, remaining, late;
+  int ms;
 
-  if( sound_enabled && settings_current.sound ) {
-    timer_frame_callback_sound( last_tstates );
-    return;
-  }
+  current_time = timer_get_time(); if( current_time < 0 ) return -1;
 
-  /* If we're fastloading, just schedule another check in a frame's time
-     and do nothing else */
-  if( settings_current.fastload && timer_fastloading_active() ) {
+  FRAMETIME_ENTER( FRAMETIME_PROBE_SLEEP );
 
-    libspectrum_dword next_check_time =
-      last_tstates + machine_current->timings.tstates_per_frame;
+  while( ( remaining = deadline - current_time ) > 0 ) {
 
-    event_add( next_check_time, timer_event );
+    ms = ( remaining - oversleep - YIELD_TIME ) * 1000;
+    if( ms > TEN_MS ) ms = TEN_MS;
 
-  } else {
+    if( ms > 0 ) {
+      timer_sleep( ms );
+      woken = timer_get_time(); if( woken < 0 ) { current_time = -1; break; }
 
-    float speed = ( settings_current.emulation_speed < 1 ?
-                    1.0                                  :
-                    settings_current.emulation_speed ) / 100.0;
+      /* Anything over what we asked for is how late the sleep woke us */
+      late = woken - current_time - ms / 1000.0;
+      if( late < 0 ) late = 0;
+      oversleep += ( late - oversleep ) / 8;
+
+      current_time = woken;
+      input_poll_idle();
+    } else {
+      timer_sleep( 0 );
+      current_time = timer_get_time(); if( current_time < 0 ) break;
+    }
 
-    while( 1 ) {
+  }
 
-      current_time = timer_get_time(); if( current_time < 0 ) return;
-      difference = current_time - start_time;
+  FRAMETIME_LEAVE();
 
-      /* Sleep while we are still 10ms ahead */
-      if( difference < 0 ) {
-        timer_sleep( TEN_MS );
-      } else {
-	break;
-      }
+  if( current_time < 0 ) return -1;
 
-    }
+  FRAMETIME_PACING( current_time - deadline );
 
-    current_time = timer_get_time(); if( current_time < 0 ) return;
-    difference = current_time - start_time;
+  return current_time;
+}
 
-    tstates = ( ( difference + TEN_MS / 1000.0 ) *
-		machine_current->timings.processor_speed
-		) * speed + 0.5;
-  
-    event_add( last_tstates + tstates, timer_event );
+static void
+timer_frame( libspectrum_dword last_tstates, int event GCC_UNUSED,
+	     void *user_data GCC_UNUSED )
+{
+  double current_time, frame_length;
+  int speed;
+
+  /* Benchmarks, batch runs, exports, programs driving us as a library,
+     turbo mode, flash loading and frames run ahead go flat out, and
+     while the display is locked, its page flips keep us to time */
+  if( bench_active || batch_active || export_active || fuselib_active ||
+      timer_turbo || tape_flash_loading() || runahead_active ||
+      timer_vsync_locked ) {
+    event_add( last_tstates + machine_current->timings.tstates_per_frame,
+               timer_event );
+    return;
+  }
 
-    start_time = current_time + TEN_MS / 1000.0;
+  if( sound_enabled && settings_current.sound ) {
+    timer_frame_callback_sound( last_tstates );
+    return;
   }
+
+  event_add( last_tstates + machine_current->timings.tstates_per_frame,
+             timer_event );
+
+  /* If we're fastloading, just check again in a frame's time and do
+     nothing else */
+  if( settings_current.fastload && timer_fastloading_active() ) return;
+
+  speed = settings_current.emulation_speed < 1 ?
+          1                                  :
+          settings_current.emulation_speed;
+
+  frame_length = (double)machine_current->timings.tstates_per_frame /
+                 machine_current->timings.processor_speed * 100 / speed;
+
+  current_time = timer_pace( start_time ); if( current_time < 0 ) return;
+
+  /* Each deadline follows on from the last, so small errors in waking
+     up don't accumulate. If we've fallen more than a frame behind, don't
+     try to catch up; just carry on from now */
+  start_time += frame_length;
+  if( start_time < current_time ) start_time = current_time + frame_length;
 }
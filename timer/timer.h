@@ -38,6 +38,19 @@ void timer_start_fastloading( void );
 void timer_stop_fastloading( void );
 int timer_fastloading_active( void );
 
+extern int timer_turbo;
+void timer_set_turbo( int active );
+
+/* Called by the display code after each page flip which waits for the
+   display's refresh. Once the flips have been seen to come close enough
+   to the emulated frame rate, timer_vsync_locked is set and the
+   emulation is paced by the flips instead */
+extern int timer_vsync_locked;
+void timer_vsync( void );
+
+/* Forget the display's refresh rate, e.g. after a change of mode */
+void timer_vsync_reset( void );
+
 /* Internal routines */
 
 double timer_get_time( void );
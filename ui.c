@@ -29,12 +29,17 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libspectrum.h>
 
 #include "fuse.h"
 #include "peripherals/if1.h"
 #include "peripherals/kempmouse.h"
 #include "settings.h"
+#include "spectrum.h"
 #include "tape.h"
 #include "ui/ui.h"
 #include "ui/uimedia.h"
@@ -45,6 +50,9 @@
 
 #define MESSAGE_MAX_LENGTH 256
 
+/* How long, in frames, a message is ignored if it's repeated */
+#define MESSAGE_REPEAT_FRAMES 50
+
 /* We don't start in a widget */
 int ui_widget_level = -1;
 
@@ -54,9 +62,22 @@ static size_t frames_since_last_message = 0;
 extern size_t frames_since_last_overlay_message_info;
 #endif
 
+#ifdef HAVE_PTHREAD
+/* The thread which owns the UI */
+static pthread_t ui_thread;
+#endif
+
 static int
 print_error_to_stderr( ui_error_level severity, const char *message );
 
+void
+ui_error_init( void )
+{
+#ifdef HAVE_PTHREAD
+  ui_thread = pthread_self();
+#endif
+}
+
 int
 ui_error( ui_error_level severity, const char *format, ... )
 {
@@ -77,15 +98,27 @@ ui_verror( ui_error_level severity, const char *format, va_list ap )
 
   vsnprintf( message, MESSAGE_MAX_LENGTH, format, ap );
 
+#ifdef HAVE_PTHREAD
+  /* Errors from background threads, such as libspectrum's while reading
+     a file on one, can only go to stderr */
+  if( !pthread_equal( pthread_self(), ui_thread ) ) {
+    print_error_to_stderr( severity, message );
+    return 0;
+  }
+#endif
+
   /* Skip the message if the same message was displayed recently */
-  if( frames_since_last_message < 50 && !strcmp( message, last_message ) ) {
+  if( frames_since_last_message < MESSAGE_REPEAT_FRAMES &&
+      !strcmp( message, last_message ) ) {
     frames_since_last_message = 0;
+    spectrum_frame_subscribe( ui_error_frame );
     return 0;
   }
 
   /* And store the 'last message' */
   strncpy( last_message, message, MESSAGE_MAX_LENGTH );
   last_message[ MESSAGE_MAX_LENGTH - 1 ] = '\0';
+  spectrum_frame_subscribe( ui_error_frame );
 
   print_error_to_stderr( severity, message );
 
@@ -155,13 +188,27 @@ ui_libspectrum_error( libspectrum_error error GCC_UNUSED, const char *format,
   return LIBSPECTRUM_ERROR_NONE;
 }
 
+/* Subscribed to the end of each frame only while a message is recent
+   enough for it to matter */
 void
 ui_error_frame( void )
 {
-  frames_since_last_message++;
-  #ifdef GCWZERO  
-  frames_since_last_overlay_message_info++;
+  int counting = 0;
+
+  if( frames_since_last_message < MESSAGE_REPEAT_FRAMES ) {
+    frames_since_last_message++;
+    counting = 1;
+  }
+
+  #ifdef GCWZERO
+  /* The status line overlay is shown for 150 frames */
+  if( frames_since_last_overlay_message_info <= 150 ) {
+    frames_since_last_overlay_message_info++;
+    counting = 1;
+  }
   #endif
+
+  if( !counting ) spectrum_frame_unsubscribe( ui_error_frame );
 }
 
 int ui_mouse_present = 0;
@@ -671,6 +718,10 @@ static const struct menu_item_entries menu_item_lookup[] = {
     "/File/AY Logging/Stop",
     "/File/AY Logging/Record...", 1, },
 
+  { UI_MENU_ITEM_SOUND_RECORDING,
+    "/File/Sound Recording/Stop",
+    "/File/Sound Recording/Record...", 1, },
+
   { UI_MENU_ITEM_TAPE_RECORDING,
     "/Media/Tape/Record Stop",
     "/Media/Tape/Record Start", 1,
@@ -834,6 +885,7 @@ size_t ui_widget_show_msg_update_info( const char* format, ... ) {
 
   od_show_msg_info = 1;
   frames_since_last_overlay_message_info = 0;
+  spectrum_frame_subscribe( ui_error_frame );
   od_msg_info_length = widget_show_msg_update_info( msg );
   return od_msg_info_length;
 }
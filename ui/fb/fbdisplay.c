@@ -74,6 +74,9 @@ static short rgbs[16], greys[16];
 static int fb_fd = -1;		/* The framebuffer's file descriptor */
 static libspectrum_word *gm = 0;
 
+/* One row of the image on its way to the framebuffer */
+static libspectrum_word fb_row[ 2 * DISPLAY_SCREEN_WIDTH ];
+
 static struct fb_fix_screeninfo fixed;
 static struct fb_var_screeninfo orig_display, display;
 static int got_orig_display = 0;
@@ -334,34 +337,54 @@ uidisplay_frame_end( void )
   return;
 }
 
+/* Build a row of `width' pixels from `src' in `fb_row', doubling each if
+   `doubled' is set */
+static const libspectrum_word *
+fb_build_row( const libspectrum_word *src, int width, int step, int doubled,
+              const short *colours )
+{
+  int i;
+
+  if( doubled ) {
+    for( i = 0; i < width; i++, src += step )
+      fb_row[ 2 * i ] = fb_row[ 2 * i + 1 ] = colours[ *src ];
+  } else {
+    for( i = 0; i < width; i++, src += step )
+      fb_row[i] = colours[ *src ];
+  }
+
+  return fb_row;
+}
+
 void
 uidisplay_area( int x, int start, int width, int height)
 {
   int y;
   const short *colours = settings_current.bw_tv ? greys : rgbs;
 
+  /* Each row is built up and then copied to the framebuffer in one go;
+     the framebuffer is usually uncached, and much slower to write to a
+     pixel at a time */
   switch( fb_resolution ) {
   case FB_RES( 640, 480 ):
     for( y = start; y < start + height; y++ )
     {
-      int i;
       libspectrum_word *point;
 
       if( hires ) {
 
-	for( i = 0, point = gm + y * display.xres_virtual + x;
-	     i < width;
-	     i++, point++ )
-	  *point = colours[fbdisplay_image[y][x+i]];
+        point = gm + y * display.xres_virtual + x;
+        memcpy( point,
+                fb_build_row( &fbdisplay_image[y][x], width, 1, 0, colours ),
+                width * sizeof( *point ) );
 
       } else {
 
-	for( i = 0, point = gm + 2 * y * display.xres_virtual + x * 2;
-	     i < width;
-	     i++, point += 2 )
-	  *  point       = *( point +     display.xres_virtual ) =
-	  *( point + 1 ) = *( point + 1 + display.xres_virtual ) = 
-	    colours[fbdisplay_image[y][x+i]];
+        point = gm + 2 * y * display.xres_virtual + x * 2;
+        fb_build_row( &fbdisplay_image[y][x], width, 1, 1, colours );
+        memcpy( point, fb_row, 2 * width * sizeof( *point ) );
+        memcpy( point + display.xres_virtual, fb_row,
+                2 * width * sizeof( *point ) );
 
       }
     }
@@ -371,22 +394,22 @@ uidisplay_area( int x, int start, int width, int height)
     if( hires ) { start >>= 1; height >>= 1; }
     for( y = start; y < start + height; y++ )
     {
-      int i;
       libspectrum_word *point;
 
       if( hires ) {
 
-	for ( i = 0, point = gm + y * display.xres_virtual + x;
-	      i < width;
-	      i++, point++ )
-	  *point = colours[fbdisplay_image[y*2][x+i]];
+        point = gm + y * display.xres_virtual + x;
+        memcpy( point,
+                fb_build_row( &fbdisplay_image[y*2][x], width, 1, 0,
+                              colours ),
+                width * sizeof( *point ) );
 
       } else {
 
-	for( i = 0, point = gm + y * display.xres_virtual + x * 2;
-	     i < width;
-	     i++, point+=2 )
-	  *point = *(point+1) = colours[fbdisplay_image[y][x+i]];
+        point = gm + y * display.xres_virtual + x * 2;
+        memcpy( point,
+                fb_build_row( &fbdisplay_image[y][x], width, 1, 1, colours ),
+                2 * width * sizeof( *point ) );
 
       }
     }
@@ -396,23 +419,21 @@ uidisplay_area( int x, int start, int width, int height)
     if( hires ) { start >>= 1; height >>= 1; x >>= 1; width >>= 1; }
     for( y = start; y < start + height; y++ )
     {
-      int i;
-      libspectrum_word *point;
+      libspectrum_word *point = gm + y * display.xres_virtual + x;
 
       if( hires ) {
 
 	/* Drop every second pixel */
-	for ( i = 0, point = gm + y * display.xres_virtual + x;
-	      i < width;
-	      i++, point++ )
-	  *point = colours[fbdisplay_image[y*2][(x+i)*2]];
+        memcpy( point,
+                fb_build_row( &fbdisplay_image[y*2][x*2], width, 2, 0,
+                              colours ),
+                width * sizeof( *point ) );
 
       } else {
 
-	for( i = 0, point = gm + y * display.xres_virtual + x;
-	     i < width;
-	     i++, point++ )
-	  *point = colours[fbdisplay_image[y][x+i]];
+        memcpy( point,
+                fb_build_row( &fbdisplay_image[y][x], width, 1, 0, colours ),
+                width * sizeof( *point ) );
 
       }
 
@@ -547,3 +568,10 @@ uidisplay_frame_restore( void )
   /* FIXME: Restore saved framebuffer state as the widget UI wants to draw a
      new menu */
 }
+
+void
+uidisplay_frame_release( void )
+{
+  /* The widgets were drawn over the image, so redraw all of it */
+  display_refresh_all();
+}
@@ -35,6 +35,7 @@
 
 #include <libspectrum.h>
 
+#include "compat.h"
 #include "debugger/debugger.h"
 #include "event.h"
 #include "fuse.h"
@@ -135,10 +136,17 @@ static int create_command_entry( GtkBox *parent, GtkAccelGroup *accel_group );
 static int create_buttons( GtkDialog *parent, GtkAccelGroup *accel_group );
 
 static int activate_debugger( void );
+static int pane_visible( debugger_pane pane );
+static void update_display( void );
+static gboolean update_timeout( gpointer data );
+static void update_pane( debugger_pane pane );
+static void update_registers( void );
 static void update_memory_map( void );
 static void update_breakpoints( void );
 static void update_disassembly( void );
+static void update_stack( void );
 static void update_events( void );
+static void get_row( GtkListStore *model, gint n, GtkTreeIter *it );
 static void add_event( gpointer data, gpointer user_data );
 static int deactivate_debugger( void );
 
@@ -190,6 +198,22 @@ static int dialog_created = 0;
 /* Is the debugger window active (as opposed to the debugger itself)? */
 static int debugger_active;
 
+/* The display is redrawn at most this often, in seconds; an update asked
+   for any sooner is put off until then */
+#define DEBUGGER_UPDATE_INTERVAL 0.05
+
+/* When the display was last redrawn, and the put off update if any */
+static double update_last = -1;
+static guint update_timeout_id = 0;
+
+/* What the memory map pane is showing, so it's only rebuilt when the
+   mapping changes */
+static struct {
+  int source, page_num, writable, contended;
+  libspectrum_word offset;
+} map_shown[ MEMORY_PAGES_IN_64K ];
+static const char *map_shown_format = NULL;
+
 /* The UIManager used to create the menu bar */
 static GtkUIManager *ui_manager_debugger = NULL;
 
@@ -259,7 +283,8 @@ ui_debugger_activate( void )
 void
 ui_breakpoints_updated( void )
 {
-  /* TODO: Refresh debugger list here */
+  if( dialog_created && pane_visible( DEBUGGER_PANE_BREAKPOINTS ) )
+    update_breakpoints();
 }
 
 static int
@@ -457,6 +482,8 @@ toggle_display( GtkToggleAction* action, debugger_pane pane_id )
   pane = get_pane( pane_id ); if( !pane ) return;
 
   if( gtk_toggle_action_get_active( action ) ) {
+    /* Hidden panes aren't kept up to date */
+    update_pane( pane_id );
     gtk_widget_show_all( pane );
   } else {
     gtk_widget_hide( pane );
@@ -811,14 +838,83 @@ activate_debugger( void )
   return 0;
 }
 
-/* Update the debugger's display */
+/* Update the debugger's display, unless it's been updated too recently,
+   in which case do it once the interval is up */
 int
 ui_debugger_update( void )
+{
+  double wait;
+
+  if( !dialog_created ) return 0;
+
+  /* Already put off */
+  if( update_timeout_id ) return 0;
+
+  wait = update_last + DEBUGGER_UPDATE_INTERVAL - compat_timer_get_time();
+  if( update_last >= 0 && wait > 0 ) {
+    update_timeout_id = g_timeout_add( wait * 1000 + 1, update_timeout, NULL );
+    return 0;
+  }
+
+  update_display();
+
+  return 0;
+}
+
+/* Is `pane' shown? */
+static int
+pane_visible( debugger_pane pane )
+{
+  GtkCheckMenuItem *checkitem;
+
+  checkitem = get_pane_menu_item( pane ); if( !checkitem ) return 0;
+
+  return gtk_check_menu_item_get_active( checkitem );
+}
+
+/* Redraw every pane which can be seen */
+static void
+update_display( void )
+{
+  debugger_pane i;
+
+  update_last = compat_timer_get_time();
+
+  for( i = DEBUGGER_PANE_BEGIN; i < DEBUGGER_PANE_END; i++ )
+    if( pane_visible( i ) ) update_pane( i );
+}
+
+static gboolean
+update_timeout( gpointer data GCC_UNUSED )
+{
+  update_timeout_id = 0;
+  update_display();
+
+  return FALSE;
+}
+
+static void
+update_pane( debugger_pane pane )
+{
+  if( !dialog_created ) return;
+
+  switch( pane ) {
+  case DEBUGGER_PANE_REGISTERS: update_registers(); break;
+  case DEBUGGER_PANE_MEMORYMAP: update_memory_map(); break;
+  case DEBUGGER_PANE_BREAKPOINTS: update_breakpoints(); break;
+  case DEBUGGER_PANE_DISASSEMBLY: update_disassembly(); break;
+  case DEBUGGER_PANE_STACK: update_stack(); break;
+  case DEBUGGER_PANE_EVENTS: update_events(); break;
+
+  case DEBUGGER_PANE_END: break;
+  }
+}
+
+static void
+update_registers( void )
 {
   size_t i;
   char buffer[1024], format_string[1024];
-  gchar buffer1[80], buffer2[80];
-  libspectrum_word address;
   int capabilities; size_t length;
 
   const char *register_name[] = { "PC", "SP",
@@ -834,8 +930,6 @@ ui_debugger_update( void )
 				    &HL, &HL_, &IX, &IY,
 				  };
 
-  if( !dialog_created ) return 0;
-
   for( i = 0; i < 12; i++ ) {
     snprintf( buffer, 5, "%3s ", register_name[i] );
     snprintf( &buffer[4], 76, format_16_bit(), *value_ptr[i] );
@@ -908,32 +1002,28 @@ ui_debugger_update( void )
   }
 
   gtk_label_set_text( GTK_LABEL( registers[17] ), buffer );
+}
 
-  update_memory_map();
-  update_breakpoints();
-  update_disassembly();
-
-  /* And the stack display */
-  gtk_list_store_clear( stack_model );
+static void
+update_stack( void )
+{
+  size_t i;
+  gchar buffer1[80], buffer2[80];
+  libspectrum_word address;
 
   for( i = 0, address = SP + 38; i < 20; i++, address -= 2 ) {
 
     GtkTreeIter it;
-    
+
     libspectrum_word contents = readbyte_internal( address ) +
 				0x100 * readbyte_internal( address + 1 );
 
     snprintf( buffer1, sizeof( buffer1 ), format_16_bit(), address );
     snprintf( buffer2, sizeof( buffer2 ), format_16_bit(), contents );
 
-    gtk_list_store_append( stack_model, &it );
+    get_row( stack_model, i, &it );
     gtk_list_store_set( stack_model, &it, STACK_COLUMN_ADDRESS, buffer1, STACK_COLUMN_VALUE_TEXT, buffer2, STACK_COLUMN_VALUE_INT, (gint)contents, -1 );
   }
-
-  /* And the events display */
-  update_events();
-
-  return 0;
 }
 
 static void
@@ -942,6 +1032,30 @@ update_memory_map( void )
   int source, page_num, writable, contended;
   libspectrum_word offset;
   size_t i, j, block, row;
+  int changed;
+
+  /* Rebuilding the table is slow, so don't unless it's changed */
+  changed = map_shown_format != format_16_bit();
+  map_shown_format = format_16_bit();
+
+  for( block = 0; block < MEMORY_PAGES_IN_64K; block++ ) {
+    memory_page *page = &memory_map_read[block];
+
+    if( page->source != map_shown[block].source ||
+        page->page_num != map_shown[block].page_num ||
+        page->offset != map_shown[block].offset ||
+        page->writable != map_shown[block].writable ||
+        page->contended != map_shown[block].contended ) {
+      map_shown[block].source = page->source;
+      map_shown[block].page_num = page->page_num;
+      map_shown[block].offset = page->offset;
+      map_shown[block].writable = page->writable;
+      map_shown[block].contended = page->contended;
+      changed = 1;
+    }
+  }
+
+  if( !changed ) return;
 
   for( i = 0; i < MEMORY_PAGES_IN_64K; i++ ) {
     if( map_label[i][0] ) {
@@ -1082,8 +1196,6 @@ update_disassembly( void )
   size_t i; libspectrum_word address;
   GtkTreeIter it;
 
-  gtk_list_store_clear( disassembly_model );
-
   for( i = 0, address = disassembly_top; i < 20; i++ ) {
     size_t l, length;
     char buffer1[40], buffer2[40];
@@ -1096,7 +1208,7 @@ update_disassembly( void )
     while( l < 16 ) buffer2[l++] = ' ';
     buffer2[l] = 0;
 
-    gtk_list_store_append( disassembly_model, &it );
+    get_row( disassembly_model, i, &it );
     gtk_list_store_set( disassembly_model, &it, DISASSEMBLY_COLUMN_ADDRESS, buffer1, DISASSEMBLY_COLUMN_INSTRUCTION, buffer2, -1 );
 
     address += length;
@@ -1112,6 +1224,15 @@ update_events( void )
   event_foreach( add_event, NULL );
 }
 
+/* Get row `n' of `model', adding it if need be, so panes with a fixed
+   number of rows can be rewritten in place rather than rebuilt */
+static void
+get_row( GtkListStore *model, gint n, GtkTreeIter *it )
+{
+  if( !gtk_tree_model_iter_nth_child( GTK_TREE_MODEL( model ), it, NULL, n ) )
+    gtk_list_store_append( model, it );
+}
+
 static void
 add_event( gpointer data, gpointer user_data GCC_UNUSED )
 {
@@ -1372,7 +1493,7 @@ static void
 gtkui_debugger_break( GtkWidget *widget GCC_UNUSED,
 		      gpointer user_data GCC_UNUSED )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
   gtk_widget_set_sensitive( continue_button, 1 );
   gtk_widget_set_sensitive( break_button, 0 );
 }
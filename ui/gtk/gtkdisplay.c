@@ -33,6 +33,10 @@
 #include <gdk/gdkwayland.h>
 #endif
 
+#ifdef USE_GTK_GL
+#include <epoxy/gl.h>
+#endif
+
 #include "display.h"
 #include "fuse.h"
 #include "gtkinternals.h"
@@ -112,6 +116,77 @@ static cairo_surface_t *surface = NULL;
 
 #endif                /* #if GTK_CHECK_VERSION( 3, 0, 0 ) */
 
+#ifdef USE_GTK_GL
+
+/* With OpenGL, gtkdisplay_image itself is uploaded as a texture of
+   palette indices and the colouring, scaling and TV effects are all done
+   by a shader; rgb_image and scaled_image are only used if OpenGL
+   couldn't be set up */
+static int gl_active = 0;
+
+static GLuint gl_program, gl_texture, gl_vertex_array;
+static GLint gl_scale_location, gl_image_size_location, gl_palette_location,
+  gl_effect_location;
+
+/* The rows of gtkdisplay_image changed since the last upload */
+static int gl_dirty_top = 0, gl_dirty_bottom = 0;
+
+/* The colour and black and white palettes as the shader wants them */
+static GLfloat gl_colours[16][3], gl_bw_colours[16][3];
+
+/* The effects the shader can apply */
+#define GL_EFFECT_SCANLINES 1
+#define GL_EFFECT_PAL       2
+
+/* Draw the image as a rectangle centred in the widget; corners are
+   numbered as for a triangle strip */
+static const char *gl_vertex_shader =
+  "#version 150\n"
+  "uniform vec2 scale;\n"
+  "out vec2 position;\n"
+  "void main() {\n"
+  "  vec2 corner = vec2( gl_VertexID & 1, gl_VertexID >> 1 );\n"
+  "  position = vec2( corner.x, 1.0 - corner.y );\n"
+  "  gl_Position = vec4( ( corner * 2.0 - 1.0 ) * scale, 0.0, 1.0 );\n"
+  "}\n";
+
+/* Look up each pixel's colour; the PAL effect keeps the pixel's own
+   brightness but smears its colour over its neighbours, and scanlines
+   darken the bottom half of each Spectrum line */
+static const char *gl_fragment_shader =
+  "#version 150\n"
+  "uniform usampler2D image;\n"
+  "uniform vec2 image_size;\n"
+  "uniform vec3 palette[16];\n"
+  "uniform int effect;\n"
+  "in vec2 position;\n"
+  "out vec4 colour;\n"
+  "vec3 texel( ivec2 at ) {\n"
+  "  at = clamp( at, ivec2( 0 ), ivec2( image_size ) - 1 );\n"
+  "  return palette[ texelFetch( image, at, 0 ).r & 15u ];\n"
+  "}\n"
+  "void main() {\n"
+  "  vec2 at = position * image_size;\n"
+  "  ivec2 pixel = ivec2( at );\n"
+  "  vec3 c = texel( pixel );\n"
+  "  if( ( effect & 2 ) != 0 ) {\n"
+  "    vec3 blurred = ( texel( pixel - ivec2( 1, 0 ) ) + 2.0 * c +\n"
+  "                     texel( pixel + ivec2( 1, 0 ) ) ) / 4.0;\n"
+  "    c = blurred + dot( c - blurred, vec3( 0.299, 0.587, 0.114 ) );\n"
+  "  }\n"
+  "  if( ( effect & 1 ) != 0 && fract( at.y ) >= 0.5 ) c *= 0.75;\n"
+  "  colour = vec4( c, 1.0 );\n"
+  "}\n";
+
+static void gl_setup( GtkGLArea *area );
+static gboolean gtkdisplay_gl_render( GtkGLArea *area, GdkGLContext *context,
+                                      gpointer user_data );
+static void gtkdisplay_gl_unrealize( GtkWidget *widget, gpointer user_data );
+static gboolean gtkdisplay_gl_fallback_draw( GtkWidget *widget, cairo_t *cr,
+                                             gpointer user_data );
+
+#endif                /* #ifdef USE_GTK_GL */
+
 /* The current size of the window (in units of DISPLAY_SCREEN_*) */
 static int gtkdisplay_current_size=1;
 
@@ -140,6 +215,7 @@ static int
 init_colours( colour_format_t format )
 {
   size_t i;
+  libspectrum_dword hq_colours[ 2 * 16 ];
 
   for( i = 0; i < 16; i++ ) {
 
@@ -153,6 +229,14 @@ init_colours( colour_format_t format )
     /* Addition of 0.5 is to avoid rounding errors */
     grey = ( 0.299 * red + 0.587 * green + 0.114 * blue ) + 0.5;
 
+#ifdef USE_GTK_GL
+    gl_colours[i][0] = red / 255.0;
+    gl_colours[i][1] = green / 255.0;
+    gl_colours[i][2] = blue / 255.0;
+    gl_bw_colours[i][0] = gl_bw_colours[i][1] = gl_bw_colours[i][2] =
+      grey / 255.0;
+#endif                /* #ifdef USE_GTK_GL */
+
 #ifdef WORDS_BIGENDIAN
 
     switch( format ) {
@@ -183,6 +267,15 @@ init_colours( colour_format_t format )
 
   }
 
+  for( i = 0; i < 16; i++ ) {
+    hq_colours[ 2 * i     ] = gtkdisplay_colours[i];
+    hq_colours[ 2 * i + 1 ] = bw_colours[i];
+  }
+
+  /* The display only uses these colours, so the HQ scalers can work on
+     palette indices */
+  scaler_hq_palette_32( hq_colours, 2 * 16 );
+
   return 0;
 }
 
@@ -206,9 +299,27 @@ uidisplay_init( int width, int height )
 
 #else
 
+#ifdef USE_GTK_GL
+
+  g_signal_connect( G_OBJECT( gtkui_drawing_area ), "render",
+                    G_CALLBACK( gtkdisplay_gl_render ), NULL );
+  g_signal_connect( G_OBJECT( gtkui_drawing_area ), "unrealize",
+                    G_CALLBACK( gtkdisplay_gl_unrealize ), NULL );
+
+  /* The main window has already been shown, so the GL context exists */
+  gl_setup( GTK_GL_AREA( gtkui_drawing_area ) );
+
+  if( !gl_active )
+    g_signal_connect( G_OBJECT( gtkui_drawing_area ), "draw",
+                      G_CALLBACK( gtkdisplay_gl_fallback_draw ), NULL );
+
+#else                 /* #ifdef USE_GTK_GL */
+
   g_signal_connect( G_OBJECT( gtkui_drawing_area ), "draw",
                     G_CALLBACK( gtkdisplay_draw ), NULL );
 
+#endif                /* #ifdef USE_GTK_GL */
+
   colour_format = FORMAT_x8r8g8b8;
 
   g_signal_connect( G_OBJECT( gtkui_window ), "configure_event",
@@ -354,8 +465,18 @@ register_scalers( int force_scaler )
 void
 uidisplay_frame_end( void )
 {
+#ifdef USE_GTK_GL
+  /* The shader does the scaling, so there's nothing to measure */
+  if( !gl_active )
+#endif                /* #ifdef USE_GTK_GL */
+    scaler_auto_frame( image_width * image_height );
+
 #if GTK_CHECK_VERSION( 3, 0, 0 )
   if( display_updated ) {
+#ifdef USE_GTK_GL
+    if( gl_active )
+      gtk_gl_area_queue_render( GTK_GL_AREA( gtkui_drawing_area ) );
+#endif                /* #ifdef USE_GTK_GL */
     gdk_window_process_updates( gtk_widget_get_window( gtkui_drawing_area ),
                                 FALSE );
     display_updated = 0;
@@ -371,6 +492,22 @@ uidisplay_area( int x, int y, int w, int h )
   float scale = (float)gtkdisplay_current_size / image_scale;
   int scaled_x, scaled_y, i, yy;
   libspectrum_dword *palette;
+  double start;
+
+#ifdef USE_GTK_GL
+  /* The shader does everything else, so just note which rows need
+     uploading again */
+  if( gl_active ) {
+    if( gl_dirty_top == gl_dirty_bottom ) {
+      gl_dirty_top = y; gl_dirty_bottom = y + h;
+    } else {
+      if( y < gl_dirty_top ) gl_dirty_top = y;
+      if( y + h > gl_dirty_bottom ) gl_dirty_bottom = y + h;
+    }
+    display_updated = 1;
+    return;
+  }
+#endif                /* #ifdef USE_GTK_GL */
 
   /* Extend the dirty region by 1 pixel for scalers
      that "smear" the screen, e.g. 2xSAI */
@@ -395,10 +532,12 @@ uidisplay_area( int x, int y, int w, int h )
   }
 
   /* Create scaled image */
+  start = scaler_auto_start();
   scaler_proc32( &rgb_image[ ( y + 2 ) * rgb_pitch + 4 * ( x + 1 ) ],
                  rgb_pitch,
                  &scaled_image[ scaled_y * scaled_pitch + 4 * scaled_x ],
                  scaled_pitch, w, h );
+  scaler_auto_end( start, w * h );
 
   w *= scale; h *= scale;
 
@@ -571,6 +710,171 @@ gtkdisplay_draw( GtkWidget *widget, cairo_t *cr, gpointer user_data )
   return FALSE;
 }
 
+#ifdef USE_GTK_GL
+
+static GLuint
+gl_compile( GLenum type, const char *source )
+{
+  GLuint shader;
+  GLint status;
+
+  shader = glCreateShader( type );
+  glShaderSource( shader, 1, &source, NULL );
+  glCompileShader( shader );
+
+  glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
+  if( !status ) {
+    char log[ 256 ];
+    glGetShaderInfoLog( shader, sizeof( log ), NULL, log );
+    ui_error( UI_ERROR_ERROR, "couldn't compile display shader: %s", log );
+    glDeleteShader( shader );
+    return 0;
+  }
+
+  return shader;
+}
+
+/* Create the shader and texture; if anything goes wrong, gl_active is
+   left clear and the display is drawn with Cairo instead */
+static void
+gl_setup( GtkGLArea *area )
+{
+  GLuint vertex, fragment;
+  GLint status;
+
+  gtk_gl_area_make_current( area );
+  if( gtk_gl_area_get_error( area ) ) {
+    ui_error( UI_ERROR_WARNING, "couldn't use OpenGL for the display: %s",
+              gtk_gl_area_get_error( area )->message );
+    return;
+  }
+
+  vertex = gl_compile( GL_VERTEX_SHADER, gl_vertex_shader );
+  if( !vertex ) return;
+  fragment = gl_compile( GL_FRAGMENT_SHADER, gl_fragment_shader );
+  if( !fragment ) { glDeleteShader( vertex ); return; }
+
+  gl_program = glCreateProgram();
+  glAttachShader( gl_program, vertex );
+  glAttachShader( gl_program, fragment );
+  glLinkProgram( gl_program );
+  glDeleteShader( vertex );
+  glDeleteShader( fragment );
+
+  glGetProgramiv( gl_program, GL_LINK_STATUS, &status );
+  if( !status ) {
+    ui_error( UI_ERROR_ERROR, "couldn't link display shader" );
+    glDeleteProgram( gl_program );
+    return;
+  }
+
+  gl_scale_location = glGetUniformLocation( gl_program, "scale" );
+  gl_image_size_location = glGetUniformLocation( gl_program, "image_size" );
+  gl_palette_location = glGetUniformLocation( gl_program, "palette" );
+  gl_effect_location = glGetUniformLocation( gl_program, "effect" );
+
+  /* The core profile won't draw without a vertex array, even though the
+     vertex shader makes up all the positions itself */
+  glGenVertexArrays( 1, &gl_vertex_array );
+
+  glGenTextures( 1, &gl_texture );
+  glBindTexture( GL_TEXTURE_2D, gl_texture );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, sizeof( libspectrum_word ) );
+  glTexImage2D( GL_TEXTURE_2D, 0, GL_R16UI, DISPLAY_SCREEN_WIDTH,
+                2 * DISPLAY_SCREEN_HEIGHT, 0, GL_RED_INTEGER,
+                GL_UNSIGNED_SHORT, gtkdisplay_image );
+
+  gl_dirty_top = gl_dirty_bottom = 0;
+  gl_active = 1;
+}
+
+static int
+gl_effect( void )
+{
+  switch( current_scaler ) {
+  case SCALER_TV2X: case SCALER_TV3X: case SCALER_TV4X: case SCALER_TIMEXTV:
+    return GL_EFFECT_SCANLINES;
+  case SCALER_PALTV:
+    return GL_EFFECT_PAL;
+  case SCALER_PALTV2X: case SCALER_PALTV3X:
+    return GL_EFFECT_PAL | GL_EFFECT_SCANLINES;
+  default:
+    return 0;
+  }
+}
+
+/* Called by gtkui_drawing_area on "render" */
+static gboolean
+gtkdisplay_gl_render( GtkGLArea *area, GdkGLContext *context GCC_UNUSED,
+                      gpointer user_data GCC_UNUSED )
+{
+  float width, height, aspect;
+
+  if( !gl_active ) return FALSE;
+
+  glBindTexture( GL_TEXTURE_2D, gl_texture );
+
+  if( gl_dirty_top != gl_dirty_bottom ) {
+    glPixelStorei( GL_UNPACK_ALIGNMENT, sizeof( libspectrum_word ) );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, gl_dirty_top, DISPLAY_SCREEN_WIDTH,
+                     gl_dirty_bottom - gl_dirty_top, GL_RED_INTEGER,
+                     GL_UNSIGNED_SHORT, gtkdisplay_image[ gl_dirty_top ] );
+    gl_dirty_top = gl_dirty_bottom = 0;
+  }
+
+  glClearColor( 0, 0, 0, 1 );
+  glClear( GL_COLOR_BUFFER_BIT );
+
+  /* Keep the Spectrum's aspect ratio, with black bars on whichever sides
+     the widget is too big */
+  width = gtk_widget_get_allocated_width( GTK_WIDGET( area ) );
+  height = gtk_widget_get_allocated_height( GTK_WIDGET( area ) );
+  if( !width || !height ) return TRUE;
+  aspect = ( width / height ) /
+           ( (float)DISPLAY_ASPECT_WIDTH / DISPLAY_SCREEN_HEIGHT );
+
+  glUseProgram( gl_program );
+  glUniform2f( gl_scale_location, aspect < 1 ? 1 : 1 / aspect,
+               aspect < 1 ? aspect : 1 );
+  glUniform2f( gl_image_size_location, image_width, image_height );
+  glUniform3fv( gl_palette_location, 16, settings_current.bw_tv ?
+                gl_bw_colours[0] : gl_colours[0] );
+  glUniform1i( gl_effect_location, gl_effect() );
+
+  glBindVertexArray( gl_vertex_array );
+  glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+
+  return TRUE;
+}
+
+/* Called by gtkui_drawing_area on "unrealize" */
+static void
+gtkdisplay_gl_unrealize( GtkWidget *widget, gpointer user_data GCC_UNUSED )
+{
+  if( !gl_active ) return;
+
+  gtk_gl_area_make_current( GTK_GL_AREA( widget ) );
+  glDeleteTextures( 1, &gl_texture );
+  glDeleteVertexArrays( 1, &gl_vertex_array );
+  glDeleteProgram( gl_program );
+
+  gl_active = 0;
+}
+
+/* Called by gtkui_drawing_area on "draw" if OpenGL couldn't be set up;
+   stops GtkGLArea trying to draw itself */
+static gboolean
+gtkdisplay_gl_fallback_draw( GtkWidget *widget, cairo_t *cr,
+                             gpointer user_data )
+{
+  gtkdisplay_draw( widget, cr, user_data );
+  return TRUE;
+}
+
+#endif                /* #ifdef USE_GTK_GL */
+
 /* Called by gtkui_window on "configure_event".
    On GTK+ 3 the window determines the size of the drawing area */
 static gint
@@ -214,7 +214,11 @@ ui_init( int *argc, char ***argv )
   gtk_window_add_accel_group( GTK_WINDOW(gtkui_window), accel_group );
   gtk_box_pack_start( GTK_BOX(box), menu_bar, FALSE, FALSE, 0 );
 
+#ifdef USE_GTK_GL
+  gtkui_drawing_area = gtk_gl_area_new();
+#else
   gtkui_drawing_area = gtk_drawing_area_new();
+#endif                /* #ifdef USE_GTK_GL */
   if(!gtkui_drawing_area) {
     fprintf(stderr,"%s: couldn't create drawing area at %s:%d\n",
 	    fuse_progname,__FILE__,__LINE__);
@@ -294,6 +298,7 @@ gtkui_make_menu(GtkAccelGroup **accel_group,
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING_ROLLBACK, 0 );
+  ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_TAPE_RECORDING, 0 );
 #ifdef HAVE_LIB_XML2
   ui_menu_activate( UI_MENU_ITEM_FILE_SVG_CAPTURE, 0 );
@@ -309,6 +314,13 @@ ui_event(void)
   return 0;
 }
 
+int
+ui_event_input( void )
+{
+  /* Input arrives through the main loop with everything else */
+  return 0;
+}
+
 int
 ui_end(void)
 {
@@ -649,7 +661,7 @@ void
 menu_machine_debugger( GtkAction *gtk_action GCC_UNUSED,
                        gpointer data GCC_UNUSED )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
   if( paused ) ui_debugger_activate();
 }
 
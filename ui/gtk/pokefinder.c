@@ -44,6 +44,10 @@ static void gtkui_pokefinder_incremented( GtkWidget *widget,
 					  gpointer user_data GCC_UNUSED );
 static void gtkui_pokefinder_decremented( GtkWidget *widget,
 					  gpointer user_data GCC_UNUSED );
+static void gtkui_pokefinder_changed( GtkWidget *widget,
+				      gpointer user_data GCC_UNUSED );
+static void gtkui_pokefinder_unchanged( GtkWidget *widget,
+					gpointer user_data GCC_UNUSED );
 static void gtkui_pokefinder_search( GtkWidget *widget, gpointer user_data );
 static void gtkui_pokefinder_reset( GtkWidget *widget, gpointer user_data );
 static void gtkui_pokefinder_close( GtkWidget *widget, gpointer user_data );
@@ -58,6 +62,7 @@ static int dialog_created = 0;
 static GtkWidget
   *dialog,			/* The dialog box itself */
   *count_label,			/* The number of possible locations */
+  *word_check,			/* Search for 16-bit values? */
   *location_list;		/* The list view of possible locations */
 
 static GtkTreeModel *location_model; /* The data of possible locations */
@@ -152,6 +157,9 @@ create_dialog( void )
 		    G_CALLBACK( gtkui_pokefinder_search ), NULL );
   gtk_box_pack_start( GTK_BOX( hbox ), entry, TRUE, TRUE, 5 );
 
+  word_check = gtk_check_button_new_with_label( "16-bit" );
+  gtk_box_pack_start( GTK_BOX( hbox ), word_check, FALSE, FALSE, 5 );
+
   vbox = gtk_box_new( GTK_ORIENTATION_VERTICAL, 0 );
   gtk_box_pack_start( GTK_BOX( hbox ), vbox, TRUE, TRUE, 5 );
 
@@ -165,10 +173,12 @@ create_dialog( void )
     static gtkstock_button btn[] = {
       { "Incremented", G_CALLBACK( gtkui_pokefinder_incremented ), NULL, NULL, 0, 0, 0, 0, GTK_RESPONSE_NONE },
       { "Decremented", G_CALLBACK( gtkui_pokefinder_decremented ), NULL, NULL, 0, 0, 0, 0, GTK_RESPONSE_NONE },
+      { "Changed", G_CALLBACK( gtkui_pokefinder_changed ), NULL, NULL, 0, 0, 0, 0, GTK_RESPONSE_NONE },
+      { "Unchanged", G_CALLBACK( gtkui_pokefinder_unchanged ), NULL, NULL, 0, 0, 0, 0, GTK_RESPONSE_NONE },
       { "!Search", G_CALLBACK( gtkui_pokefinder_search ), NULL, NULL, GDK_KEY_Return, 0, 0, 0, GTK_RESPONSE_NONE },
       { "Reset", G_CALLBACK( gtkui_pokefinder_reset ), NULL, NULL, 0, 0, 0, 0, GTK_RESPONSE_NONE }
     };
-    btn[2].actiondata = G_OBJECT( entry );
+    btn[4].actiondata = G_OBJECT( entry );
     accel_group = gtkstock_create_buttons( dialog, NULL, btn,
 					   ARRAY_SIZE( btn ) );
     gtkstock_create_close( dialog, accel_group,
@@ -200,24 +210,65 @@ gtkui_pokefinder_decremented( GtkWidget *widget GCC_UNUSED,
 }
 
 static void
-gtkui_pokefinder_search( GtkWidget *widget, gpointer user_data GCC_UNUSED )
+gtkui_pokefinder_changed( GtkWidget *widget GCC_UNUSED,
+			  gpointer user_data GCC_UNUSED )
+{
+  pokefinder_changed();
+  update_pokefinder();
+}
+
+static void
+gtkui_pokefinder_unchanged( GtkWidget *widget GCC_UNUSED,
+			    gpointer user_data GCC_UNUSED )
+{
+  pokefinder_unchanged();
+  update_pokefinder();
+}
+
+/* Read one decimal or 0x-prefixed hex value; -1 if there isn't one */
+static long
+parse_value( const gchar *text, char **endptr )
 {
   long value;
-  const gchar *entry;
-  char *endptr;
   int base;
 
+  while( g_ascii_isspace( *text ) ) text++;
+
   errno = 0;
+  base = ( g_str_has_prefix( text, "0x" ) )? 16 : 10;
+  value = strtol( text, endptr, base );
+  if( errno != 0 || *endptr == text || value < 0 ) return -1;
+
+  while( g_ascii_isspace( **endptr ) ) (*endptr)++;
+
+  return value;
+}
+
+static void
+gtkui_pokefinder_search( GtkWidget *widget, gpointer user_data GCC_UNUSED )
+{
+  long low, high, max;
+  const gchar *entry;
+  char *endptr;
+  pokefinder_width width;
+
+  width = gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON( word_check ) ) ?
+          POKEFINDER_WIDTH_WORD : POKEFINDER_WIDTH_BYTE;
+  max = width == POKEFINDER_WIDTH_WORD ? 0xffff : 0xff;
+
+  /* Either a single value, or a range such as "3-5" */
   entry = gtk_entry_get_text( GTK_ENTRY( widget ) );
-  base = ( g_str_has_prefix( entry, "0x" ) )? 16 : 10;
-  value = strtol( entry, &endptr, base );
+  low = high = parse_value( entry, &endptr );
+  if( low >= 0 && *endptr == '-' )
+    high = parse_value( endptr + 1, &endptr );
 
-  if( errno != 0 || value < 0 || value > 255 || endptr == entry ) {
-    ui_error( UI_ERROR_ERROR, "Invalid value: use an integer from 0 to 255" );
+  if( low < 0 || high < low || high > max || *endptr ) {
+    ui_error( UI_ERROR_ERROR,
+              "Invalid value: use an integer or a range from 0 to %ld", max );
     return;
   }
 
-  pokefinder_search( value );
+  pokefinder_search_range( width, low, high );
   update_pokefinder();
 }
 
@@ -23,7 +23,9 @@
 
 #include <config.h>
 
+#include "fuselib.h"
 #include "keyboard.h"
+#include "machine.h"
 #include "ui/ui.h"
 
 #include "../uijoystick.c"
@@ -114,6 +116,13 @@ ui_event( void )
   return 0;
 }
 
+int
+ui_event_input( void )
+{
+  /* No error */
+  return 0;
+}
+
 char*
 ui_get_open_filename( const char *title )
 {
@@ -238,6 +247,71 @@ uidisplay_init( int width, int height )
   return 0;
 }
 
+#ifdef FUSE_LIBRARY
+
+/* Draw the screen for fuselib_screen(), with every pixel doubled on a
+   Timex machine as the other UIs do */
+
+static void
+null_plot_bits( int x, int y, libspectrum_word data, int bits,
+                libspectrum_byte ink, libspectrum_byte paper )
+{
+  libspectrum_word mask;
+  libspectrum_byte *row = &fuselib_image[y][x];
+
+  for( mask = 1 << ( bits - 1 ); mask; mask >>= 1 )
+    *row++ = ( data & mask ) ? ink : paper;
+}
+
+void
+uidisplay_plot16( int x, int y, libspectrum_word data,
+    libspectrum_byte ink, libspectrum_byte paper )
+{
+  x <<= 4; y <<= 1;
+
+  null_plot_bits( x, y,     data, 16, ink, paper );
+  null_plot_bits( x, y + 1, data, 16, ink, paper );
+}
+
+void
+uidisplay_plot8( int x, int y, libspectrum_byte data,
+    libspectrum_byte ink, libspectrum_byte paper )
+{
+  libspectrum_word wide;
+  int i;
+
+  x <<= 3;
+
+  if( !machine_current->timex ) {
+    null_plot_bits( x, y, data, 8, ink, paper );
+    return;
+  }
+
+  for( wide = 0, i = 7; i >= 0; i-- )
+    wide = ( wide << 2 ) | ( ( data >> i ) & 1 ? 3 : 0 );
+
+  x <<= 1; y <<= 1;
+
+  null_plot_bits( x, y,     wide, 16, ink, paper );
+  null_plot_bits( x, y + 1, wide, 16, ink, paper );
+}
+
+void
+uidisplay_putpixel( int x, int y, int colour )
+{
+  if( machine_current->timex ) {
+    x <<= 1; y <<= 1;
+    fuselib_image[y  ][x  ] = colour;
+    fuselib_image[y  ][x+1] = colour;
+    fuselib_image[y+1][x  ] = colour;
+    fuselib_image[y+1][x+1] = colour;
+  } else {
+    fuselib_image[y][x] = colour;
+  }
+}
+
+#else				/* #ifdef FUSE_LIBRARY */
+
 void
 uidisplay_plot16( int x, int y, libspectrum_word data,
     libspectrum_byte ink, libspectrum_byte paper )
@@ -257,3 +331,5 @@ uidisplay_putpixel( int x, int y, int colour )
 {
   /* Do nothing */
 }
+
+#endif				/* #ifdef FUSE_LIBRARY */
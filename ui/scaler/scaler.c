@@ -29,11 +29,22 @@
 
 #include <string.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif				/* #ifdef HAVE_PTHREAD */
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif				/* #ifdef HAVE_UNISTD_H */
+
 #include <libspectrum.h>
 
+#include "machine.h"
 #include "scaler.h"
 #include "scaler_internals.h"
 #include "settings.h"
+#include "thread_sched.h"
+#include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/uidisplay.h"
 #include "utils.h"
@@ -129,6 +140,39 @@ ScalerProc *scaler_proc16, *scaler_proc32;
 scaler_flags_t scaler_flags;
 scaler_expand_fn *scaler_expander;
 
+/* Automatic selection looks at the scaler's speed this often, in frames */
+#define SCALER_AUTO_PERIOD 50
+
+/* The share of each frame the scaler may take */
+#define SCALER_AUTO_BUDGET 0.25
+
+/* The scalers of each size, best looking first; automatic selection
+   starts at the top of the current scaler's list and works down */
+static const scaler_type scaler_auto_order[] = {
+
+  SCALER_PALTV, SCALER_NORMAL, SCALER_NUM,
+
+  SCALER_HQ2X, SCALER_SUPER2XSAI, SCALER_SUPEREAGLE, SCALER_2XSAI,
+  SCALER_ADVMAME2X, SCALER_PALTV2X, SCALER_TV2X, SCALER_DOUBLESIZE,
+  SCALER_NUM,
+
+  SCALER_HQ3X, SCALER_ADVMAME3X, SCALER_PALTV3X, SCALER_TV3X,
+  SCALER_TRIPLESIZE, SCALER_NUM,
+
+  SCALER_HQ4X, SCALER_TV4X, SCALER_QUADSIZE, SCALER_NUM,
+
+};
+
+/* Time spent scaling, and pixels scaled, since the last look */
+static double scaler_auto_time;
+static double scaler_auto_pixels;
+static int scaler_auto_frames;
+
+/* Set once the best looking scaler has been tried */
+static int scaler_auto_started = 0;
+
+static void scaler_auto_reset( void );
+
 int
 scaler_select_scaler( scaler_type scaler )
 {
@@ -147,6 +191,8 @@ scaler_select_scaler( scaler_type scaler )
   scaler_flags = scaler_get_flags( current_scaler );
   scaler_expander = scaler_get_expander( current_scaler );
 
+  scaler_auto_reset();
+
   return uidisplay_hotswap_gfx_mode();
 }
 
@@ -223,6 +269,294 @@ scaler_get_expander( scaler_type scaler )
   return available_scalers[scaler].expander;
 }
 
+/* Can the vector versions of the scalers be used on this CPU? */
+int
+scaler_simd_available( void )
+{
+  static int available = -1;
+
+  if( available < 0 ) {
+#if defined( SCALER_SIMD_SSE2 ) && !defined( __SSE2__ )
+    __builtin_cpu_init();
+    available = __builtin_cpu_supports( "sse2" ) ? 1 : 0;
+#elif defined( SCALER_SIMD )
+    available = 1;
+#else
+    available = 0;
+#endif
+  }
+
+  return available;
+}
+
+/* Running a scaler in horizontal bands across several threads */
+
+/* The most threads (including the calling one) we will use */
+#define SCALER_MAX_THREADS 4
+
+/* Bands shorter than this are not worth handing to another thread */
+#define SCALER_BAND_MIN_HEIGHT 16
+
+#ifdef HAVE_PTHREAD
+
+typedef struct scaler_band_t {
+  ScalerProc *proc;
+  const libspectrum_byte *src;
+  libspectrum_dword src_pitch;
+  libspectrum_byte *dst;
+  libspectrum_dword dst_pitch;
+  int width, height;
+} scaler_band_t;
+
+/* Number of worker threads started, or -1 if the pool has not yet been
+   initialised. Zero means everything is run serially */
+static int scaler_workers = -1;
+
+static pthread_t scaler_worker_thread[ SCALER_MAX_THREADS - 1 ];
+
+/* Band 0 is always run by the calling thread; band n by worker n - 1 */
+static scaler_band_t scaler_bands[ SCALER_MAX_THREADS ];
+
+/* Held by whichever thread currently owns the worker pool */
+static pthread_mutex_t scaler_run_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Protects scaler_generation and scaler_bands_pending */
+static pthread_mutex_t scaler_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scaler_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scaler_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int scaler_generation = 0;
+static int scaler_bands_pending = 0;
+
+static void
+scaler_band_run( const scaler_band_t *band )
+{
+  band->proc( band->src, band->src_pitch, band->dst, band->dst_pitch,
+              band->width, band->height );
+}
+
+static void*
+scaler_worker( void *arg )
+{
+  scaler_band_t *band = arg;
+  unsigned int seen = 0;
+
+  thread_sched_apply( THREAD_SCHED_RENDER );
+
+  pthread_mutex_lock( &scaler_pool_mutex );
+
+  while( 1 ) {
+    while( scaler_generation == seen )
+      pthread_cond_wait( &scaler_work_cond, &scaler_pool_mutex );
+    seen = scaler_generation;
+
+    if( !band->height ) continue;
+
+    pthread_mutex_unlock( &scaler_pool_mutex );
+    scaler_band_run( band );
+    pthread_mutex_lock( &scaler_pool_mutex );
+
+    if( --scaler_bands_pending == 0 )
+      pthread_cond_signal( &scaler_done_cond );
+  }
+
+  return NULL;
+}
+
+/* Start one worker per extra online CPU. A single core machine (such as
+   RetroFW) gets no workers and everything stays on the calling thread */
+static void
+scaler_pool_init( void )
+{
+  long cpus = 1;
+  int i;
+
+#if defined( HAVE_UNISTD_H ) && defined( _SC_NPROCESSORS_ONLN )
+  cpus = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+  if( cpus < 1 ) cpus = 1;
+  if( cpus > SCALER_MAX_THREADS ) cpus = SCALER_MAX_THREADS;
+
+  scaler_workers = 0;
+
+  for( i = 0; i < cpus - 1; i++ ) {
+    if( pthread_create( &scaler_worker_thread[i], NULL, scaler_worker,
+                        &scaler_bands[ i + 1 ] ) )
+      break;
+    pthread_detach( scaler_worker_thread[i] );
+    scaler_workers++;
+  }
+}
+
+#endif				/* #ifdef HAVE_PTHREAD */
+
+/* Run `proc' over the image in horizontal bands, one per available
+   thread. `scale' is the number of destination lines `proc' writes for
+   each source line. Every band reads the source line above and below
+   itself, so neighbouring bands overlap by one line of input while
+   writing disjoint destination lines */
+void
+scaler_run_bands( ScalerProc *proc, int scale,
+                  const libspectrum_byte *srcPtr, libspectrum_dword srcPitch,
+                  libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+                  int width, int height )
+{
+#ifdef HAVE_PTHREAD
+  int bands, rows, i, y;
+
+  if( scaler_workers < 0 ) {
+    pthread_mutex_lock( &scaler_run_mutex );
+    if( scaler_workers < 0 ) scaler_pool_init();
+    pthread_mutex_unlock( &scaler_run_mutex );
+  }
+
+  bands = scaler_workers + 1;
+  if( bands > height / SCALER_BAND_MIN_HEIGHT )
+    bands = height / SCALER_BAND_MIN_HEIGHT;
+
+  if( bands < 2 || pthread_mutex_trylock( &scaler_run_mutex ) ) {
+    proc( srcPtr, srcPitch, dstPtr, dstPitch, width, height );
+    return;
+  }
+
+  rows = ( height + bands - 1 ) / bands;
+
+  pthread_mutex_lock( &scaler_pool_mutex );
+
+  for( i = 0, y = 0; i < SCALER_MAX_THREADS; i++ ) {
+    scaler_band_t *band = &scaler_bands[i];
+    int band_height = 0;
+
+    if( i < bands )
+      band_height = rows < height - y ? rows : height - y;
+
+    band->proc = proc;
+    band->src = srcPtr + y * srcPitch;
+    band->src_pitch = srcPitch;
+    band->dst = dstPtr + y * scale * dstPitch;
+    band->dst_pitch = dstPitch;
+    band->width = width;
+    band->height = band_height;
+
+    y += band_height;
+  }
+
+  scaler_bands_pending = bands - 1;
+  scaler_generation++;
+  pthread_cond_broadcast( &scaler_work_cond );
+
+  pthread_mutex_unlock( &scaler_pool_mutex );
+
+  scaler_band_run( &scaler_bands[0] );
+
+  pthread_mutex_lock( &scaler_pool_mutex );
+  while( scaler_bands_pending )
+    pthread_cond_wait( &scaler_done_cond, &scaler_pool_mutex );
+  pthread_mutex_unlock( &scaler_pool_mutex );
+
+  pthread_mutex_unlock( &scaler_run_mutex );
+#else				/* #ifdef HAVE_PTHREAD */
+  proc( srcPtr, srcPitch, dstPtr, dstPitch, width, height );
+#endif				/* #ifdef HAVE_PTHREAD */
+}
+
+static void
+scaler_auto_reset( void )
+{
+  scaler_auto_time = 0;
+  scaler_auto_pixels = 0;
+  scaler_auto_frames = 0;
+}
+
+double
+scaler_auto_start( void )
+{
+  return settings_current.auto_scaler ? timer_get_time() : 0;
+}
+
+void
+scaler_auto_end( double start, int pixels )
+{
+  if( !settings_current.auto_scaler ) return;
+
+  scaler_auto_time += timer_get_time() - start;
+  scaler_auto_pixels += pixels;
+}
+
+/* Where `scaler' is in scaler_auto_order, or -1 if it isn't there */
+static int
+scaler_auto_find( scaler_type scaler )
+{
+  size_t i;
+
+  for( i = 0; i < sizeof( scaler_auto_order ) / sizeof( scaler_type ); i++ )
+    if( scaler_auto_order[i] == scaler ) return i;
+
+  return -1;
+}
+
+/* How long the scaler may take over each frame, in seconds */
+static double
+scaler_auto_budget( void )
+{
+  double frame_length, speed;
+
+  frame_length = (double)machine_current->timings.tstates_per_frame /
+                 machine_current->timings.processor_speed;
+
+  speed = settings_current.emulation_speed;
+  if( speed > 0 ) frame_length = frame_length * 100 / speed;
+
+  return frame_length * SCALER_AUTO_BUDGET;
+}
+
+void
+scaler_auto_frame( int image_pixels )
+{
+  int i, next;
+  double cost;
+
+  if( !settings_current.auto_scaler ) {
+    scaler_auto_started = 0;
+    return;
+  }
+
+  i = scaler_auto_find( current_scaler );
+  if( i == -1 ) return;
+
+  /* Begin with the best looking scaler of this size */
+  if( !scaler_auto_started ) {
+    scaler_auto_started = 1;
+
+    while( i > 0 && scaler_auto_order[ i - 1 ] != SCALER_NUM ) i--;
+    while( !scaler_is_supported( scaler_auto_order[i] ) ) i++;
+
+    if( scaler_auto_order[i] != current_scaler )
+      scaler_select_scaler( scaler_auto_order[i] );
+    scaler_auto_reset();
+    return;
+  }
+
+  if( ++scaler_auto_frames < SCALER_AUTO_PERIOD ) return;
+  scaler_auto_frames = 0;
+
+  /* Wait until at least a whole image's worth has been scaled, as a
+     still screen hardly needs scaling at all */
+  if( scaler_auto_pixels < image_pixels ) return;
+
+  cost = scaler_auto_time / scaler_auto_pixels * image_pixels;
+  scaler_auto_time = scaler_auto_pixels = 0;
+
+  if( cost <= scaler_auto_budget() ) return;
+
+  /* Too slow: drop to the next supported scaler of the same size */
+  for( next = i + 1; scaler_auto_order[ next ] != SCALER_NUM; next++ ) {
+    if( scaler_is_supported( scaler_auto_order[ next ] ) ) {
+      scaler_select_scaler( scaler_auto_order[ next ] );
+      return;
+    }
+  }
+}
+
 /* The expansion functions */
 
 /* Clip after expansion */
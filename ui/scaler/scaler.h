@@ -92,4 +92,19 @@ scaler_expand_fn* scaler_get_expander( scaler_type scaler );
 
 int scaler_select_bitformat( libspectrum_dword BitFormat );
 
+/* Automatic selection of a scaler which fits in the time available:
+   bracket each use of scaler_proc16 or scaler_proc32 with
+   scaler_auto_start() and scaler_auto_end(), passing the number of pixels
+   scaled, and call scaler_auto_frame() at the end of every frame with the
+   number of pixels in the whole image */
+double scaler_auto_start( void );
+void scaler_auto_end( double start, int pixels );
+void scaler_auto_frame( int image_pixels );
+
+/* Register the colours the display uses, letting the HQ scalers compare
+   pixels by palette index and the PAL TV scalers look up their YUV
+   values */
+void scaler_hq_palette_16( const libspectrum_dword *colours, size_t count );
+void scaler_hq_palette_32( const libspectrum_dword *colours, size_t count );
+
 #endif
@@ -43,6 +43,23 @@
 					 libspectrum_dword dstPitch, \
 					 int width, int height );
 
+/* Vector versions of the Normal and TV scalers are built for x86 (SSE2,
+   checked at runtime) and for ARM with NEON */
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SCALER_SIMD 1
+#define SCALER_SIMD_SSE2 1
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#define SCALER_SIMD 1
+#define SCALER_SIMD_NEON 1
+#endif
+
+int scaler_simd_available( void );
+
+void scaler_run_bands( ScalerProc *proc, int scale,
+                       const libspectrum_byte *srcPtr,
+                       libspectrum_dword srcPitch, libspectrum_byte *dstPtr,
+                       libspectrum_dword dstPitch, int width, int height );
+
 DECLARE_SCALER(2xSaI);
 DECLARE_SCALER(Super2xSaI);
 DECLARE_SCALER(SuperEagle);
@@ -79,6 +79,8 @@ static const libspectrum_word dotmatrix_555[16] = {
 };
 static const libspectrum_word *dotmatrix;
 
+static void hq_palette_clear( void );
+
 int 
 scaler_select_bitformat( libspectrum_dword BitFormat )
 {
@@ -134,6 +136,9 @@ scaler_select_bitformat( libspectrum_dword BitFormat )
 
   }
 
+  /* The HQ palette's YUV values depend on the bit format */
+  hq_palette_clear();
+
   return 0;
 }
 
@@ -197,6 +202,13 @@ static const libspectrum_dword dotmatrix[16] = {
 #error Unknown SCALER_DATA_SIZE
 #endif				/* #if SCALER_DATA_SIZE == 2 or 4 */
 
+#include "scalers_simd.c"
+
+static inline void palette_yuv( libspectrum_qword pixel,
+                                libspectrum_signed_dword *y,
+                                libspectrum_signed_dword *u,
+                                libspectrum_signed_dword *v );
+
 static inline int 
 GetResult( libspectrum_dword A, libspectrum_dword B, libspectrum_dword C,
 	   libspectrum_dword D )
@@ -1137,6 +1149,14 @@ FUNCTION( scaler_Normal2x )( const libspectrum_byte *srcPtr,
   const scaler_data_type *s;
   scaler_data_type i, *d, *d2;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            2, 0 );
+    return;
+  }
+#endif
+
   while( height-- ) {
 
     for( i = 0, s = (const scaler_data_type*)srcPtr,
@@ -1163,6 +1183,14 @@ FUNCTION( scaler_Normal3x )( const libspectrum_byte *srcPtr,
   libspectrum_dword dstPitch2 = dstPitch * 2;
   libspectrum_dword dstPitch3 = dstPitch * 3;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            3, 0 );
+    return;
+  }
+#endif
+
   while (height--) {
     int i;
     r = dstPtr;
@@ -1196,6 +1224,14 @@ FUNCTION( scaler_Normal4x )( const libspectrum_byte *srcPtr,
   libspectrum_dword dstPitch3 = dstPitch * 3;
   libspectrum_dword dstPitch4 = dstPitch * 4;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            4, 0 );
+    return;
+  }
+#endif
+
   while (height--) {
     int i;
     r = dstPtr;
@@ -1277,6 +1313,14 @@ FUNCTION( scaler_TV2x )( const libspectrum_byte *srcPtr,
   unsigned int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q = (scaler_data_type*)dstPtr;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            2, 1 );
+    return;
+  }
+#endif
+
   while(height--) {
     for (i = 0, j = 0; i < width; ++i, j += 2) {
       scaler_data_type p1 = *(p + i);
@@ -1308,6 +1352,14 @@ FUNCTION( scaler_TV3x )( const libspectrum_byte *srcPtr,
   unsigned int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q = (scaler_data_type*)dstPtr;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            3, 1 );
+    return;
+  }
+#endif
+
   while(height--) {
     for (i = 0, j = 0; i < width; ++i, j += 3) {
       scaler_data_type p1 = *(p + i);
@@ -1346,6 +1398,14 @@ FUNCTION( scaler_TV4x )( const libspectrum_byte *srcPtr,
   unsigned int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q = (scaler_data_type*)dstPtr;
 
+#ifdef SCALER_SIMD
+  if( scaler_simd_available() ) {
+    FUNCTION( simd_scale )( srcPtr, srcPitch, dstPtr, dstPitch, width, height,
+                            4, 2 );
+    return;
+  }
+#endif
+
   while(height--) {
     for (i = 0, j = 0; i < width; ++i, j += 4) {
       scaler_data_type p1 = *(p + i);
@@ -1491,8 +1551,7 @@ FUNCTION( scaler_PalTV )( const libspectrum_byte *srcPtr,
                               int width, int height )
 {
 /*
-   1.a. RGB => 255,255,255 RGB
-   1.b. RGB => YUV
+   1.  RGB => YUV, looked up for palette colours
    2. 422 interstricial color subsampling 
    3.a. YUV => RGB
    3.b  255,255,255 RGB => RGB
@@ -1505,10 +1564,11 @@ FUNCTION( scaler_PalTV )( const libspectrum_byte *srcPtr,
   scaler_data_type *q, *q0 = (scaler_data_type *)dstPtr;
   
   libspectrum_byte  r0, g0, b0,
-                    r1, g1, b1,
-                    r2, g2, b2,
-                    r3, g3, b3;
-  libspectrum_signed_word y1, y2, u1, u2, v1, v2;
+                    r1, g1, b1;
+  libspectrum_signed_dword y0, y1, y2, y3,
+                           pu0, pu1, pu2, pu3,
+                           pv0, pv1, pv2, pv3,
+                           u1, u2, v1, v2;
 
 /*
  422 cosited
@@ -1522,78 +1582,30 @@ FUNCTION( scaler_PalTV )( const libspectrum_byte *srcPtr,
 */
   for( j = height; j; j-- ) {
     p = p0 - 1; q = q0;
-#if SCALER_DATA_SIZE == 2
-    /* 1.a. RGB => RGB */
-    r2 = R_TO_R( *p );
-    g2 = G_TO_G( *p );
-    b2 = B_TO_B( *p );
-    p++;
-    r0 = R_TO_R( *p );
-    g0 = G_TO_G( *p );
-    b0 = B_TO_B( *p );
-    p++;
-    r1 = R_TO_R( *p );
-    g1 = G_TO_G( *p );
-    b1 = B_TO_B( *p );
-    p++;
-#else
-    r2 = (*p & redMask);
-    g2 = (*p & greenMask) >> 8;
-    b2 = (*p & blueMask) >> 16;
-    p++;
-    r0 = (*p & redMask);
-    g0 = (*p & greenMask) >> 8;
-    b0 = (*p & blueMask) >> 16;
-    p++;
-    r1 = (*p & redMask);
-    g1 = (*p & greenMask) >> 8;
-    b1 = (*p & blueMask) >> 16;
-    p++;
-#endif
-    u1 = ( RGB_TO_U( r2, g2, b2 ) + 2 * RGB_TO_U( r0, g0, b0 ) +
-            RGB_TO_U( r1, g1, b1 ) ) >> 2;
-    v1 = ( RGB_TO_V( r2, g2, b2 ) + 2 * RGB_TO_V( r0, g0, b0 ) +
-            RGB_TO_V( r1, g1, b1 ) ) >> 2;
+    /* 1. RGB => YUV */
+    palette_yuv( *p++, &y2, &pu2, &pv2 );
+    palette_yuv( *p++, &y0, &pu0, &pv0 );
+    palette_yuv( *p++, &y1, &pu1, &pv1 );
+    u1 = ( pu2 + 2 * pu0 + pu1 ) >> 2;
+    v1 = ( pv2 + 2 * pv0 + pv1 ) >> 2;
     for( i = width; i; i -= 2 ) {
-#if SCALER_DATA_SIZE == 2
-      /* 1.a. RGB => RGB */
-      r2 = R_TO_R( *p );
-      g2 = G_TO_G( *p );
-      b2 = B_TO_B( *p );
-      p++;
-      r3 = R_TO_R( *p );
-      g3 = G_TO_G( *p );
-      b3 = B_TO_B( *p );
-      p++;
-#else
-      r2 = (*p & redMask);
-      g2 = (*p & greenMask) >> 8;
-      b2 = (*p & blueMask) >> 16;
-      p++;
-      r3 = (*p & redMask);
-      g3 = (*p & greenMask) >> 8;
-      b3 = (*p & blueMask) >> 16;
-      p++;
-#endif
-/* 1.b. RGB => YUV && 2. YUV subsampling */
-      y1 = RGB_TO_Y( r0, g0, b0 );
-      y2 = RGB_TO_Y( r1, g1, b1 );
-
-      u2 = ( RGB_TO_U( r1, g1, b1 ) + 2 * RGB_TO_U( r2, g2, b2 ) +
-            RGB_TO_U( r3, g3, b3 ) ) >> 2;
-      v2 = ( RGB_TO_V( r1, g1, b1 ) + 2 * RGB_TO_V( r2, g2, b2 ) +
-            RGB_TO_V( r3, g3, b3 ) ) >> 2;
+/* 1. RGB => YUV && 2. YUV subsampling */
+      palette_yuv( *p++, &y2, &pu2, &pv2 );
+      palette_yuv( *p++, &y3, &pu3, &pv3 );
+
+      u2 = ( pu1 + 2 * pu2 + pu3 ) >> 2;
+      v2 = ( pv1 + 2 * pv2 + pv3 ) >> 2;
 /* 3.a. YUV => RGB  */
-      r0 = YUV_TO_R(y1, u1, v1);
-      g0 = YUV_TO_G(y1, u1, v1);
-      b0 = YUV_TO_B(y1, u1, v1);
+      r0 = YUV_TO_R(y0, u1, v1);
+      g0 = YUV_TO_G(y0, u1, v1);
+      b0 = YUV_TO_B(y0, u1, v1);
       
       u1 = (u1 + u2) >> 1;
       v1 = (v1 + v2) >> 1;
 
-      r1 = YUV_TO_R(y2, u1, v1);
-      g1 = YUV_TO_G(y2, u1, v1);
-      b1 = YUV_TO_B(y2, u1, v1);
+      r1 = YUV_TO_R(y1, u1, v1);
+      g1 = YUV_TO_G(y1, u1, v1);
+      b1 = YUV_TO_B(y1, u1, v1);
 #if SCALER_DATA_SIZE == 2
 /* 3.b. RGB => RGB */
       if( green6bit ) {
@@ -1608,8 +1620,8 @@ FUNCTION( scaler_PalTV )( const libspectrum_byte *srcPtr,
       *q++ = r1 + (g1 << 8) + (b1 << 16);
 #endif
       u1 = u2; v1 = v2;
-      r0 = r2; g0 = g2; b0 = b2;
-      r1 = r3; g1 = g3; b1 = b3;
+      y0 = y2;
+      y1 = y3; pu1 = pu3; pv1 = pv3;
     }
     p0 += nextlineSrc;
     q0 += nextlineDst;
@@ -1624,8 +1636,7 @@ FUNCTION( scaler_PalTV2x )( const libspectrum_byte *srcPtr,
                               int width, int height )
 {
 /*
-   1.a. RGB => 255,255,255 RGB
-   1.b. RGB => YUV
+   1.  RGB => YUV, looked up for palette colours
    2. 4:2:2 cosited color subsampling 
    3.a. YUV => RGB
    3.b  255,255,255 RGB => RGB
@@ -1637,10 +1648,10 @@ FUNCTION( scaler_PalTV2x )( const libspectrum_byte *srcPtr,
   unsigned int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q, *q0 = (scaler_data_type *)dstPtr;
   
-  libspectrum_byte  r0, g0, b0,
-                    r1, g1, b1,
+  libspectrum_byte  r1, g1, b1,
                     rx, gx, bx;
-  libspectrum_signed_dword y1, y2, u1, v1, u2, v2;
+  libspectrum_signed_dword y0, y1, y2, u1, v1, u2, v2,
+                           pu0, pv0, pu1, pv1;
 
 /*
  422 cosited
@@ -1654,42 +1665,18 @@ FUNCTION( scaler_PalTV2x )( const libspectrum_byte *srcPtr,
 */
   for( j = height; j; j-- ) {
     p = p0 - 1; q = q0;
-#if SCALER_DATA_SIZE == 2
-    r0 = R_TO_R( *p );
-    g0 = G_TO_G( *p );
-    b0 = B_TO_B( *p );
-    p++;
-    r1 = R_TO_R( *p );
-    g1 = G_TO_G( *p );
-    b1 = B_TO_B( *p );
-#else
-    r0 = *p & redMask;
-    g0 = (*p & greenMask) >> 8;
-    b0 = (*p & blueMask) >> 16;
+    /* 1. RGB => YUV */
+    palette_yuv( *p, &y0, &pu0, &pv0 );
     p++;
-    r1 = *(p) & redMask;
-    g1 = (*(p) & greenMask) >> 8;
-    b1 = (*(p) & blueMask) >> 16;
-#endif
-    y1 = RGB_TO_Y( r1, g1, b1 );
-    u1 = ( RGB_TO_U( r0, g0, b0 ) + 3 * RGB_TO_U( r1, g1, b1 ) ) >> 2;
-    v1 = ( RGB_TO_V( r0, g0, b0 ) + 3 * RGB_TO_V( r1, g1, b1 ) ) >> 2;
+    palette_yuv( *p, &y1, &pu1, &pv1 );
+    u1 = ( pu0 + 3 * pu1 ) >> 2;
+    v1 = ( pv0 + 3 * pv1 ) >> 2;
     for( i = width; i; i-- ) {
       p++;      /* next point */
-#if SCALER_DATA_SIZE == 2
-      /* 1.a. RGB => RGB */
-      r0 = R_TO_R( *p );
-      g0 = G_TO_G( *p );
-      b0 = B_TO_B( *p );
-#else
-      r0 = (*p & redMask);
-      g0 = (*p & greenMask) >> 8;
-      b0 = (*p & blueMask) >> 16;
-#endif
-/* 1.b. RGB => YUV && 2. YUV subsampling */
-      y2 = RGB_TO_Y( r0, g0, b0 );
-      u2 = ( RGB_TO_U( r1, g1, b1 ) + 3 * RGB_TO_U( r0, g0, b0 ) ) >> 2;
-      v2 = ( RGB_TO_V( r1, g1, b1 ) + 3 * RGB_TO_V( r0, g0, b0 ) ) >> 2;
+/* 1. RGB => YUV && 2. YUV subsampling */
+      palette_yuv( *p, &y2, &pu0, &pv0 );
+      u2 = ( pu1 + 3 * pu0 ) >> 2;
+      v2 = ( pv1 + 3 * pv0 ) >> 2;
 
 /* 3.a. YUV => RGB  */
       rx = YUV_TO_R( y1, u1, v1 );      /* [x0][  ]*/
@@ -1741,7 +1728,7 @@ FUNCTION( scaler_PalTV2x )( const libspectrum_byte *srcPtr,
 
       q++;
       y1 = y2; u1 = u2; v1 = v2;        /* save for next point */
-      r1 = r0; g1 = g0; b1 = b0;
+      pu1 = pu0; pv1 = pv0;
     }
     p0 += nextlineSrc;
     q0 += nextlineDst << 1;
@@ -1756,8 +1743,7 @@ FUNCTION( scaler_PalTV3x )( const libspectrum_byte *srcPtr,
                               int width, int height )
 {
 /*
-   1.a. RGB => 255,255,255 RGB
-   1.b. RGB => YUV
+   1.  RGB => YUV, looked up for palette colours
    2. 4:2:2 cosited color subsampling 
    3.a. YUV => RGB
    3.b  255,255,255 RGB => RGB
@@ -1769,11 +1755,11 @@ FUNCTION( scaler_PalTV3x )( const libspectrum_byte *srcPtr,
   unsigned int nextlineDst = dstPitch / sizeof( scaler_data_type );
   scaler_data_type *q, *q0 = (scaler_data_type *)dstPtr;
   
-  libspectrum_byte  r0, g0, b0,
-                    r1, g1, b1,
+  libspectrum_byte  r1, g1, b1,
                     r2, g2, b2,
                     rx, gx, bx;
-  libspectrum_signed_dword y1, y2, u1, v1, u2, v2;
+  libspectrum_signed_dword y0, y1, y2, u1, v1, u2, v2,
+                           pu0, pv0, pu1, pv1;
 
 /*
  422 cosited
@@ -1787,42 +1773,18 @@ FUNCTION( scaler_PalTV3x )( const libspectrum_byte *srcPtr,
 */
   for( j = height; j; j-- ) {
     p = p0 - 1; q = q0;
-#if SCALER_DATA_SIZE == 2
-    r0 = R_TO_R( *p );
-    g0 = G_TO_G( *p );
-    b0 = B_TO_B( *p );
+    /* 1. RGB => YUV */
+    palette_yuv( *p, &y0, &pu0, &pv0 );
     p++;
-    r1 = R_TO_R( *p );
-    g1 = G_TO_G( *p );
-    b1 = B_TO_B( *p );
-#else
-    r0 = *p & redMask;
-    g0 = (*p & greenMask) >> 8;
-    b0 = (*p & blueMask) >> 16;
-    p++;        /* next point */
-    r1 = *(p) & redMask;
-    g1 = (*(p) & greenMask) >> 8;
-    b1 = (*(p) & blueMask) >> 16;
-#endif
-    y1 = RGB_TO_Y( r1, g1, b1 );
-    u1 = ( RGB_TO_U( r0, g0, b0 ) + 3 * RGB_TO_U( r1, g1, b1 ) ) >> 2;
-    v1 = ( RGB_TO_V( r0, g0, b0 ) + 3 * RGB_TO_V( r1, g1, b1 ) ) >> 2;
+    palette_yuv( *p, &y1, &pu1, &pv1 );
+    u1 = ( pu0 + 3 * pu1 ) >> 2;
+    v1 = ( pv0 + 3 * pv1 ) >> 2;
     for( i = width; i; i-- ) {
-      p++;
-#if SCALER_DATA_SIZE == 2
-      /* 1.a. RGB => RGB */
-      r0 = R_TO_R( *p );
-      g0 = G_TO_G( *p );
-      b0 = B_TO_B( *p );
-#else
-      r0 = (*p & redMask);
-      g0 = (*p & greenMask) >> 8;
-      b0 = (*p & blueMask) >> 16;
-#endif
-/* 1.b. RGB => YUV && 2. YUV subsampling */
-      y2 = RGB_TO_Y( r0, g0, b0 );
-      u2 = ( RGB_TO_U( r1, g1, b1 ) + 3 * RGB_TO_U( r0, g0, b0 ) ) >> 2;
-      v2 = ( RGB_TO_V( r1, g1, b1 ) + 3 * RGB_TO_V( r0, g0, b0 ) ) >> 2;
+      p++;      /* next point */
+/* 1. RGB => YUV && 2. YUV subsampling */
+      palette_yuv( *p, &y2, &pu0, &pv0 );
+      u2 = ( pu1 + 3 * pu0 ) >> 2;
+      v2 = ( pv1 + 3 * pv0 ) >> 2;
 
 /* 3.a. YUV => RGB  */
       rx = YUV_TO_R( y1, u1, v1 );      /* [x0][  ]*/
@@ -1905,17 +1867,200 @@ FUNCTION( scaler_PalTV3x )( const libspectrum_byte *srcPtr,
 
       q++;
       y1 = y2; u1 = u2; v1 = v2;        /* save for next point */
-      r1 = r0; g1 = g0; b1 = b0;
+      pu1 = pu0; pv1 = pv0;
     }
     p0 += nextlineSrc;
     q0 += (nextlineDst << 1) + nextlineDst;
   }
 }
 
+/* The HQ scalers compare each pixel with its eight neighbours in YUV
+   space. The emulated display only ever uses a handful of colours, so
+   the UI can register them with scaler_hq_palette(); pixels are then
+   mapped to palette indices and compared with a precomputed table.
+   Any colour not in the palette is compared the long way. The PAL TV
+   scalers look up the palette's YUV values the same way */
+
+#define HQ_PALETTE_MAX 64
+
+/* Index given to pixels not in the palette */
+#define HQ_UNKNOWN 0x80
+
+static size_t hq_palette_size = 0;
+
+/* hq_differ[a][b] is 1 if palette colours a and b differ */
+static libspectrum_byte hq_differ[ HQ_PALETTE_MAX ][ HQ_PALETTE_MAX ];
+
+/* The YUV value of each palette colour, also used by the PAL TV scalers */
+static libspectrum_signed_dword hq_y[ HQ_PALETTE_MAX ], hq_u[ HQ_PALETTE_MAX ],
+                                hq_v[ HQ_PALETTE_MAX ];
+
+#if SCALER_DATA_SIZE == 2
+
+/* Palette index of every 16-bit pixel value */
+static libspectrum_byte hq_index[ 0x10000 ];
+
+#else				/* #if SCALER_DATA_SIZE == 2 */
+
+/* An open addressed hash of the palette; never more than a quarter full,
+   so lookups almost always hit on the first probe */
+#define HQ_HASH( p ) ( ( (libspectrum_dword)(p) * 0x9e3779b1 ) >> 24 )
+
+static libspectrum_dword hq_hash_pixel[ 0x100 ];
+static libspectrum_byte hq_hash_index[ 0x100 ];
+
+#endif				/* #if SCALER_DATA_SIZE == 2 */
+
+static inline libspectrum_byte
+hq_lookup( libspectrum_qword pixel )
+{
+#if SCALER_DATA_SIZE == 2
+  return hq_index[ pixel & 0xffff ];
+#else
+  libspectrum_byte hash = HQ_HASH( pixel );
+
+  while( hq_hash_index[ hash ] != HQ_UNKNOWN ) {
+    if( hq_hash_pixel[ hash ] == pixel ) return hq_hash_index[ hash ];
+    hash++;
+  }
+
+  return HQ_UNKNOWN;
+#endif
+}
+
+static inline void
+hq_yuv( libspectrum_qword pixel, libspectrum_signed_dword *y,
+        libspectrum_signed_dword *u, libspectrum_signed_dword *v )
+{
+  libspectrum_byte r, g, b;
+
+#if SCALER_DATA_SIZE == 2
+  r = R_TO_R( pixel );
+  g = G_TO_G( pixel );
+  b = B_TO_B( pixel );
+#else
+  r =   pixel & redMask;
+  g = ( pixel & greenMask ) >> 8;
+  b = ( pixel & blueMask  ) >> 16;
+#endif
+  *y = RGB_TO_Y( r, g, b );
+  *u = RGB_TO_U( r, g, b );
+  *v = RGB_TO_V( r, g, b );
+}
+
+static void
+hq_palette_clear( void )
+{
+  hq_palette_size = 0;
+#if SCALER_DATA_SIZE == 2
+  memset( hq_index, HQ_UNKNOWN, sizeof( hq_index ) );
+#else
+  memset( hq_hash_pixel, 0, sizeof( hq_hash_pixel ) );
+  memset( hq_hash_index, HQ_UNKNOWN, sizeof( hq_hash_index ) );
+#endif
+}
+
+void
+FUNCTION( scaler_hq_palette )( const libspectrum_dword *colours, size_t count )
+{
+  size_t i, j;
+
+  hq_palette_clear();
+
+  for( i = 0; i < count && hq_palette_size < HQ_PALETTE_MAX; i++ ) {
+    scaler_data_type pixel = colours[i];
+
+    /* Duplicate colours (e.g. black and bright black) share an index */
+    if( hq_lookup( pixel ) != HQ_UNKNOWN ) continue;
+
+#if SCALER_DATA_SIZE == 2
+    hq_index[ pixel ] = hq_palette_size;
+#else
+    {
+      libspectrum_byte hash = HQ_HASH( pixel );
+      while( hq_hash_index[ hash ] != HQ_UNKNOWN ) hash++;
+      hq_hash_pixel[ hash ] = pixel;
+      hq_hash_index[ hash ] = hq_palette_size;
+    }
+#endif
+
+    hq_yuv( pixel, &hq_y[ hq_palette_size ], &hq_u[ hq_palette_size ],
+            &hq_v[ hq_palette_size ] );
+    hq_palette_size++;
+  }
+
+  for( i = 0; i < hq_palette_size; i++ )
+    for( j = 0; j < hq_palette_size; j++ )
+      hq_differ[i][j] = HQ_YUVDIFF( hq_y[i], hq_u[i], hq_v[i],
+                                    hq_y[j], hq_u[j], hq_v[j] );
+}
+
+/* The YUV value of a pixel, from the palette if it's there */
+static inline void
+palette_yuv( libspectrum_qword pixel, libspectrum_signed_dword *y,
+             libspectrum_signed_dword *u, libspectrum_signed_dword *v )
+{
+  libspectrum_byte index = hq_lookup( pixel );
+
+  if( index != HQ_UNKNOWN ) {
+    *y = hq_y[ index ]; *u = hq_u[ index ]; *v = hq_v[ index ];
+  } else {
+    hq_yuv( pixel, y, u, v );
+  }
+}
+
+static inline int
+hq_pattern_yuv( const libspectrum_signed_dword *y,
+                const libspectrum_signed_dword *u,
+                const libspectrum_signed_dword *v )
+{
+  int pattern = 0;
+
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
+  if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+
+  return pattern;
+}
+
+static inline int
+hq_pattern_indexed( const libspectrum_byte *c )
+{
+  const libspectrum_byte *differ = hq_differ[ c[5] ];
+
+  return   differ[ c[1] ]        | ( differ[ c[2] ] << 1 ) |
+         ( differ[ c[3] ] << 2 ) | ( differ[ c[4] ] << 3 ) |
+         ( differ[ c[6] ] << 4 ) | ( differ[ c[7] ] << 5 ) |
+         ( differ[ c[8] ] << 6 ) | ( differ[ c[9] ] << 7 );
+}
+
+/* Work out the pattern for the current pixel. `fast' is set if the
+   whole neighbourhood is in the palette; if not, the YUV values (which
+   are not tracked when working with indices) are filled in */
+#define HQ_PATTERN \
+  if( indexed ) { \
+    fast = !( ( c[1] | c[2] | c[3] | c[4] | c[5] | c[6] | c[7] | c[8] | \
+                c[9] ) & HQ_UNKNOWN ); \
+    if( !fast ) \
+      for( k = 1; k <= 9; k++ ) hq_yuv( w[k], &y[k], &u[k], &v[k] ); \
+  } \
+  pattern = fast ? hq_pattern_indexed( c ) : hq_pattern_yuv( y, u, v );
+
+/* Do neighbours A and B of the current pixel differ? */
+#define HQ_DIFF( A, B ) \
+  ( fast ? hq_differ[ c[A] ][ c[B] ] : \
+           HQ_YUVDIFF( y[A], u[A], v[A], y[B], u[B], v[B] ) )
+
 #define prevline (-nextlineSrc)
 #define nextline nextlineSrc
 #define MOVE_B_TO_A(A,B) \
-		w[A] = w[B]; y[A] = y[B]; u[A] = u[B]; v[A] = v[B];
+		w[A] = w[B]; c[A] = c[B]; \
+		y[A] = y[B]; u[A] = u[B]; v[A] = v[B];
 #define MOVE_P_RIGHT \
 	MOVE_B_TO_A(1,2) \
 	MOVE_B_TO_A(4,5) \
@@ -1924,12 +2069,12 @@ FUNCTION( scaler_PalTV3x )( const libspectrum_byte *srcPtr,
 	MOVE_B_TO_A(5,6) \
 	MOVE_B_TO_A(8,9)
 
-void
-FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
-                          libspectrum_dword srcPitch,
-                          libspectrum_byte *dstPtr,
-                          libspectrum_dword dstPitch,
-                          int width, int height )
+static void
+FUNCTION( scaler_HQ2x_band ) ( const libspectrum_byte *srcPtr,
+                               libspectrum_dword srcPitch,
+                               libspectrum_byte *dstPtr,
+                               libspectrum_dword dstPitch,
+                               int width, int height )
 {
   int i, j, k, pattern;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
@@ -1938,8 +2083,9 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
   scaler_data_type *q, *q1, *qN, *qN1, *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
   
-  libspectrum_byte  r, g, b;
+  libspectrum_byte c[10];
   libspectrum_signed_dword y[10], u[10], v[10];
+  int indexed = hq_palette_size > 0, fast = 0;
 
   /*   +----+----+----+
        |    |    |    |
@@ -1965,30 +2111,12 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
     for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
+      if( indexed ) c[k] = hq_lookup( w[k] );
+      else hq_yuv( w[k], &y[k], &u[k], &v[k] );
     }
 
     for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+      HQ_PATTERN
 
 #include "scaler_hq2x.c"
 
@@ -2000,18 +2128,8 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
       for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
+        if( indexed ) c[k] = hq_lookup( w[k] );
+        else hq_yuv( w[k], &y[k], &u[k], &v[k] );
       }
     }
     p0 += nextlineSrc;
@@ -2020,11 +2138,22 @@ FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
 }
 
 void
-FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
+FUNCTION( scaler_HQ2x ) ( const libspectrum_byte *srcPtr,
                           libspectrum_dword srcPitch,
                           libspectrum_byte *dstPtr,
                           libspectrum_dword dstPitch,
                           int width, int height )
+{
+  scaler_run_bands( FUNCTION( scaler_HQ2x_band ), 2, srcPtr, srcPitch,
+                    dstPtr, dstPitch, width, height );
+}
+
+static void
+FUNCTION( scaler_HQ3x_band ) ( const libspectrum_byte *srcPtr,
+                               libspectrum_dword srcPitch,
+                               libspectrum_byte *dstPtr,
+                               libspectrum_dword dstPitch,
+                               int width, int height )
 {
   int i, j, k, pattern;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
@@ -2034,8 +2163,9 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
 		   *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
   
-  libspectrum_byte  r, g, b;
+  libspectrum_byte c[10];
   libspectrum_signed_dword y[10], u[10], v[10];
+  int indexed = hq_palette_size > 0, fast = 0;
 
   /*   +----+----+----+
        |    |    |    |
@@ -2064,30 +2194,12 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
     for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
+      if( indexed ) c[k] = hq_lookup( w[k] );
+      else hq_yuv( w[k], &y[k], &u[k], &v[k] );
     }
 
     for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+      HQ_PATTERN
 
 #include "scaler_hq3x.c"
 
@@ -2100,18 +2212,8 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
       for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
+        if( indexed ) c[k] = hq_lookup( w[k] );
+        else hq_yuv( w[k], &y[k], &u[k], &v[k] );
       }
     }
     p0 += nextlineSrc;
@@ -2120,11 +2222,22 @@ FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
 }
 
 void
-FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
+FUNCTION( scaler_HQ3x ) ( const libspectrum_byte *srcPtr,
                           libspectrum_dword srcPitch,
                           libspectrum_byte *dstPtr,
                           libspectrum_dword dstPitch,
                           int width, int height )
+{
+  scaler_run_bands( FUNCTION( scaler_HQ3x_band ), 3, srcPtr, srcPitch,
+                    dstPtr, dstPitch, width, height );
+}
+
+static void
+FUNCTION( scaler_HQ4x_band ) ( const libspectrum_byte *srcPtr,
+                               libspectrum_dword srcPitch,
+                               libspectrum_byte *dstPtr,
+                               libspectrum_dword dstPitch,
+                               int width, int height )
 {
   int i, j, k, pattern;
   int nextlineSrc = srcPitch / sizeof( scaler_data_type );
@@ -2137,8 +2250,9 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
                    *q0 = (scaler_data_type *)dstPtr;
   libspectrum_qword w[10];
 
-  libspectrum_byte  r, g, b;
+  libspectrum_byte c[10];
   libspectrum_signed_dword y[10], u[10], v[10];
+  int indexed = hq_palette_size > 0, fast = 0;
 
   /*   +----+----+----+
        |    |    |    |
@@ -2168,30 +2282,12 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
     w[6] = *(p + 1);
     w[9] = *(p + nextline + 1);
     for( k = 1; k <= 9; k++ ) {
-#if SCALER_DATA_SIZE == 2
-      r = R_TO_R( w[k] );
-      g = G_TO_G( w[k] );
-      b = B_TO_B( w[k] );
-#else
-      r =  w[k] & redMask;
-      g = (w[k] & greenMask) >> 8;
-      b = (w[k] & blueMask) >> 16;
-#endif
-      y[k] = RGB_TO_Y( r, g, b );
-      u[k] = RGB_TO_U( r, g, b );
-      v[k] = RGB_TO_V( r, g, b );
+      if( indexed ) c[k] = hq_lookup( w[k] );
+      else hq_yuv( w[k], &y[k], &u[k], &v[k] );
     }
 
     for( i = 0; i < width; i++ ) {
-      pattern = 0;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[1], u[1], v[1] ) ) pattern |= 0x01;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[2], u[2], v[2] ) ) pattern |= 0x02;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[3], u[3], v[3] ) ) pattern |= 0x04;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[4], u[4], v[4] ) ) pattern |= 0x08;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[6], u[6], v[6] ) ) pattern |= 0x10;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[7], u[7], v[7] ) ) pattern |= 0x20;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[8], u[8], v[8] ) ) pattern |= 0x40;
-      if( HQ_YUVDIFF( y[5], u[5], v[5], y[9], u[9], v[9] ) ) pattern |= 0x80;
+      HQ_PATTERN
 
 #include "scaler_hq4x.c"
 
@@ -2205,21 +2301,22 @@ FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
       w[6] = *(p + 1);
       w[9] = *(p + nextline + 1);
       for( k = 3; k <= 9; k += 3 ) {
-#if SCALER_DATA_SIZE == 2
-        r = R_TO_R( w[k] );
-        g = G_TO_G( w[k] );
-        b = B_TO_B( w[k] );
-#else
-        r =   w[k] & redMask;
-        g = ( w[k] & greenMask ) >> 8;
-        b = ( w[k] & blueMask  ) >> 16;
-#endif
-        y[k] = RGB_TO_Y( r, g, b );
-        u[k] = RGB_TO_U( r, g, b );
-        v[k] = RGB_TO_V( r, g, b );
+        if( indexed ) c[k] = hq_lookup( w[k] );
+        else hq_yuv( w[k], &y[k], &u[k], &v[k] );
       }
     }
     p0 += nextlineSrc;
     q0 += ( nextlineDst << 2 );
   }
 }
+
+void
+FUNCTION( scaler_HQ4x ) ( const libspectrum_byte *srcPtr,
+                          libspectrum_dword srcPitch,
+                          libspectrum_byte *dstPtr,
+                          libspectrum_dword dstPitch,
+                          int width, int height )
+{
+  scaler_run_bands( FUNCTION( scaler_HQ4x_band ), 4, srcPtr, srcPitch,
+                    dstPtr, dstPitch, width, height );
+}
@@ -0,0 +1,300 @@
+/* scalers_simd.c: vector versions of the simple scalers; included into
+ *		   scalers.c
+ * Copyright (C) 2026 Fuse contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/* The Normal and TV scalers all replicate each source pixel across and
+   down, with the TV scalers darkening the last line or two. Here each
+   output row is built once with vector stores, and the remaining rows
+   are either copied from it or darkened from it. The results are
+   identical to the scalar versions, which are still used when the CPU
+   lacks the required instructions */
+
+#ifdef SCALER_SIMD
+
+#ifdef SCALER_SIMD_SSE2
+#include <emmintrin.h>
+#define SCALER_SIMD_TARGET __attribute__(( target( "sse2" ) ))
+#else				/* #ifdef SCALER_SIMD_SSE2 */
+#include <arm_neon.h>
+#define SCALER_SIMD_TARGET
+#endif				/* #ifdef SCALER_SIMD_SSE2 */
+
+/* Pixels in one 128-bit vector */
+#define SIMD_PIXELS ( 16 / SCALER_DATA_SIZE )
+
+/* The TV scanline colour: each of r, g and b scaled by 7/8 */
+static inline scaler_data_type
+FUNCTION( scanline_pixel )( scaler_data_type p )
+{
+  return ( ( ( ( p & redblueMask ) * 7 ) >> 3 ) & redblueMask ) |
+         ( ( ( ( p & greenMask   ) * 7 ) >> 3 ) & greenMask   );
+}
+
+#ifdef SCALER_SIMD_SSE2
+
+/* As scanline_pixel() for four pixels held in 32-bit lanes */
+static inline __m128i SCALER_SIMD_TARGET
+sse2_scanline_dword( __m128i p, __m128i rb, __m128i g )
+{
+  __m128i a = _mm_and_si128( p, rb );
+  __m128i b = _mm_and_si128( p, g );
+
+  /* SSE2 has no 32-bit multiply, so x * 7 is ( x << 3 ) - x */
+  a = _mm_sub_epi32( _mm_slli_epi32( a, 3 ), a );
+  b = _mm_sub_epi32( _mm_slli_epi32( b, 3 ), b );
+
+  a = _mm_and_si128( _mm_srli_epi32( a, 3 ), rb );
+  b = _mm_and_si128( _mm_srli_epi32( b, 3 ), g );
+
+  return _mm_or_si128( a, b );
+}
+
+static void SCALER_SIMD_TARGET
+FUNCTION( simd_scanline_row )( const scaler_data_type *s,
+			       scaler_data_type *d, int count )
+{
+  __m128i rb = _mm_set1_epi32( (int)redblueMask );
+  __m128i g = _mm_set1_epi32( (int)greenMask );
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= count; i += SIMD_PIXELS ) {
+    __m128i p = _mm_loadu_si128( (const __m128i*)( s + i ) );
+#if SCALER_DATA_SIZE == 2
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = sse2_scanline_dword( _mm_unpacklo_epi16( p, zero ), rb, g );
+    __m128i hi = sse2_scanline_dword( _mm_unpackhi_epi16( p, zero ), rb, g );
+
+    /* Sign extend so the saturating pack leaves the values untouched */
+    lo = _mm_srai_epi32( _mm_slli_epi32( lo, 16 ), 16 );
+    hi = _mm_srai_epi32( _mm_slli_epi32( hi, 16 ), 16 );
+    p = _mm_packs_epi32( lo, hi );
+#else
+    p = sse2_scanline_dword( p, rb, g );
+#endif
+    _mm_storeu_si128( (__m128i*)( d + i ), p );
+  }
+
+  for( ; i < count; i++ ) d[i] = FUNCTION( scanline_pixel )( s[i] );
+}
+
+static void SCALER_SIMD_TARGET
+FUNCTION( simd_double_row )( const scaler_data_type *s, scaler_data_type *d,
+			     int width )
+{
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= width; i += SIMD_PIXELS ) {
+    __m128i p = _mm_loadu_si128( (const __m128i*)( s + i ) );
+#if SCALER_DATA_SIZE == 2
+    __m128i lo = _mm_unpacklo_epi16( p, p ), hi = _mm_unpackhi_epi16( p, p );
+#else
+    __m128i lo = _mm_unpacklo_epi32( p, p ), hi = _mm_unpackhi_epi32( p, p );
+#endif
+    _mm_storeu_si128( (__m128i*)( d + 2 * i ), lo );
+    _mm_storeu_si128( (__m128i*)( d + 2 * i + SIMD_PIXELS ), hi );
+  }
+
+  for( ; i < width; i++ ) d[ 2 * i ] = d[ 2 * i + 1 ] = s[i];
+}
+
+/* SSE2 has no cheap way to triple pixels, so this one stays scalar; the
+   copying and darkening of the other rows is still vectorised */
+static void
+FUNCTION( simd_triple_row )( const scaler_data_type *s, scaler_data_type *d,
+			     int width )
+{
+  int i;
+
+  for( i = 0; i < width; i++, d += 3 ) d[0] = d[1] = d[2] = s[i];
+}
+
+static void SCALER_SIMD_TARGET
+FUNCTION( simd_quad_row )( const scaler_data_type *s, scaler_data_type *d,
+			   int width )
+{
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= width; i += SIMD_PIXELS ) {
+    __m128i p = _mm_loadu_si128( (const __m128i*)( s + i ) );
+    scaler_data_type *q = d + 4 * i;
+#if SCALER_DATA_SIZE == 2
+    __m128i lo = _mm_unpacklo_epi16( p, p ), hi = _mm_unpackhi_epi16( p, p );
+    _mm_storeu_si128( (__m128i*)( q                   ), _mm_unpacklo_epi16( lo, lo ) );
+    _mm_storeu_si128( (__m128i*)( q +     SIMD_PIXELS ), _mm_unpackhi_epi16( lo, lo ) );
+    _mm_storeu_si128( (__m128i*)( q + 2 * SIMD_PIXELS ), _mm_unpacklo_epi16( hi, hi ) );
+    _mm_storeu_si128( (__m128i*)( q + 3 * SIMD_PIXELS ), _mm_unpackhi_epi16( hi, hi ) );
+#else
+    __m128i lo = _mm_unpacklo_epi32( p, p ), hi = _mm_unpackhi_epi32( p, p );
+    _mm_storeu_si128( (__m128i*)( q                   ), _mm_unpacklo_epi32( lo, lo ) );
+    _mm_storeu_si128( (__m128i*)( q +     SIMD_PIXELS ), _mm_unpackhi_epi32( lo, lo ) );
+    _mm_storeu_si128( (__m128i*)( q + 2 * SIMD_PIXELS ), _mm_unpacklo_epi32( hi, hi ) );
+    _mm_storeu_si128( (__m128i*)( q + 3 * SIMD_PIXELS ), _mm_unpackhi_epi32( hi, hi ) );
+#endif
+  }
+
+  for( d += 4 * i; i < width; i++, d += 4 ) d[0] = d[1] = d[2] = d[3] = s[i];
+}
+
+#else				/* #ifdef SCALER_SIMD_SSE2 */
+
+/* As scanline_pixel() for four pixels held in 32-bit lanes */
+static inline uint32x4_t
+neon_scanline_dword( uint32x4_t p, uint32x4_t rb, uint32x4_t g )
+{
+  uint32x4_t a = vandq_u32( p, rb );
+  uint32x4_t b = vandq_u32( p, g );
+
+  a = vandq_u32( vshrq_n_u32( vmulq_n_u32( a, 7 ), 3 ), rb );
+  b = vandq_u32( vshrq_n_u32( vmulq_n_u32( b, 7 ), 3 ), g );
+
+  return vorrq_u32( a, b );
+}
+
+static void
+FUNCTION( simd_scanline_row )( const scaler_data_type *s,
+			       scaler_data_type *d, int count )
+{
+  uint32x4_t rb = vdupq_n_u32( redblueMask );
+  uint32x4_t g = vdupq_n_u32( greenMask );
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= count; i += SIMD_PIXELS ) {
+#if SCALER_DATA_SIZE == 2
+    uint16x8_t p = vld1q_u16( s + i );
+    uint32x4_t lo = neon_scanline_dword( vmovl_u16( vget_low_u16( p ) ),
+					 rb, g );
+    uint32x4_t hi = neon_scanline_dword( vmovl_u16( vget_high_u16( p ) ),
+					 rb, g );
+    vst1q_u16( d + i, vcombine_u16( vmovn_u32( lo ), vmovn_u32( hi ) ) );
+#else
+    vst1q_u32( d + i, neon_scanline_dword( vld1q_u32( s + i ), rb, g ) );
+#endif
+  }
+
+  for( ; i < count; i++ ) d[i] = FUNCTION( scanline_pixel )( s[i] );
+}
+
+/* The interleaving stores write each lane of their inputs in turn, so
+   storing N copies of one vector replicates every pixel N times */
+
+static void
+FUNCTION( simd_double_row )( const scaler_data_type *s, scaler_data_type *d,
+			     int width )
+{
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= width; i += SIMD_PIXELS ) {
+#if SCALER_DATA_SIZE == 2
+    uint16x8x2_t v;
+    v.val[0] = v.val[1] = vld1q_u16( s + i );
+    vst2q_u16( d + 2 * i, v );
+#else
+    uint32x4x2_t v;
+    v.val[0] = v.val[1] = vld1q_u32( s + i );
+    vst2q_u32( d + 2 * i, v );
+#endif
+  }
+
+  for( ; i < width; i++ ) d[ 2 * i ] = d[ 2 * i + 1 ] = s[i];
+}
+
+static void
+FUNCTION( simd_triple_row )( const scaler_data_type *s, scaler_data_type *d,
+			     int width )
+{
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= width; i += SIMD_PIXELS ) {
+#if SCALER_DATA_SIZE == 2
+    uint16x8x3_t v;
+    v.val[0] = v.val[1] = v.val[2] = vld1q_u16( s + i );
+    vst3q_u16( d + 3 * i, v );
+#else
+    uint32x4x3_t v;
+    v.val[0] = v.val[1] = v.val[2] = vld1q_u32( s + i );
+    vst3q_u32( d + 3 * i, v );
+#endif
+  }
+
+  for( d += 3 * i; i < width; i++, d += 3 ) d[0] = d[1] = d[2] = s[i];
+}
+
+static void
+FUNCTION( simd_quad_row )( const scaler_data_type *s, scaler_data_type *d,
+			   int width )
+{
+  int i;
+
+  for( i = 0; i + SIMD_PIXELS <= width; i += SIMD_PIXELS ) {
+#if SCALER_DATA_SIZE == 2
+    uint16x8x4_t v;
+    v.val[0] = v.val[1] = v.val[2] = v.val[3] = vld1q_u16( s + i );
+    vst4q_u16( d + 4 * i, v );
+#else
+    uint32x4x4_t v;
+    v.val[0] = v.val[1] = v.val[2] = v.val[3] = vld1q_u32( s + i );
+    vst4q_u32( d + 4 * i, v );
+#endif
+  }
+
+  for( d += 4 * i; i < width; i++, d += 4 ) d[0] = d[1] = d[2] = d[3] = s[i];
+}
+
+#endif				/* #ifdef SCALER_SIMD_SSE2 */
+
+/* Scale by `scale' in both directions, darkening the last `scanlines'
+   lines of each group as the TV scalers do */
+static void
+FUNCTION( simd_scale )( const libspectrum_byte *srcPtr,
+			libspectrum_dword srcPitch,
+			libspectrum_byte *dstPtr, libspectrum_dword dstPitch,
+			int width, int height, int scale, int scanlines )
+{
+  size_t row = scale * width * SCALER_DATA_SIZE;
+  int k;
+
+  while( height-- ) {
+    const scaler_data_type *s = (const scaler_data_type*)srcPtr;
+    scaler_data_type *d = (scaler_data_type*)dstPtr;
+
+    switch( scale ) {
+    case 2: FUNCTION( simd_double_row )( s, d, width ); break;
+    case 3: FUNCTION( simd_triple_row )( s, d, width ); break;
+    case 4: FUNCTION( simd_quad_row )( s, d, width ); break;
+    }
+
+    for( k = 1; k < scale; k++ ) {
+      libspectrum_byte *line = dstPtr + k * dstPitch;
+
+      if( k < scale - scanlines ) {
+        memcpy( line, dstPtr, row );
+      } else if( k == scale - scanlines ) {
+        FUNCTION( simd_scanline_row )( d, (scaler_data_type*)line,
+                                       scale * width );
+      } else {
+        memcpy( line, line - dstPitch, row );
+      }
+    }
+
+    srcPtr += srcPitch;
+    dstPtr += scale * dstPitch;
+  }
+}
+
+#endif				/* #ifdef SCALER_SIMD */
@@ -29,14 +29,22 @@
 #include <string.h>
 #include <SDL.h>
 
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+#include <pthread.h>
+#endif
+
 #include <libspectrum.h>
 
 #include "display.h"
+#include "embedded.h"
 #include "fuse.h"
 #include "machine.h"
+#include "memory_usage.h"
 #include "peripherals/scld.h"
 #include "screenshot.h"
 #include "settings.h"
+#include "thread_sched.h"
+#include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/scaler/scaler.h"
 #include "ui/uidisplay.h"
@@ -55,6 +63,33 @@
 SDL_Surface *sdldisplay_gc = NULL;   /* Hardware screen */
 static SDL_Surface *tmp_screen=NULL; /* Temporary screen for scalers */
 
+/* The surface uidisplay_plot8() and friends draw into, and the offset of
+   the Spectrum image within it. Normally this is tmp_screen, which has a
+   one pixel margin for the scalers, but when the frame would just be
+   copied to the screen unchanged we draw into sdldisplay_gc directly */
+static SDL_Surface *plot_screen = NULL;
+static int plot_offset = 1;
+
+/* When drawing into tmp_screen, the emulator's image is plotted as
+   palette indices into index_screen, one byte per pixel, and only the
+   areas which have changed are turned into colours in tmp_screen at the
+   end of each frame. index_synced is cleared whenever something else has
+   been drawing the image, until it has all been plotted again */
+static libspectrum_byte *index_screen = NULL;
+static int index_synced;
+
+/* While any widget is open, the emulator's image is parked here untouched
+   and tmp_screen is a copy of it which the widgets are drawn on, so
+   closing the last widget just means swapping the image back.
+   widget_layer keeps the copy's surface from one menu to the next */
+static SDL_Surface *widget_image = NULL;
+static SDL_Surface *widget_layer = NULL;
+
+/* The palette the parked image was drawn in */
+static int widget_image_bw_tv;
+
+static SDL_Surface *saved = NULL;
+
 #if VKEYBOARD
 static SDL_Surface *keyb_screen = NULL;
 static SDL_Surface *keyb_screen_save = NULL;
@@ -146,6 +181,15 @@ size_t od_info_length;
 size_t od_msg_info_length;
 size_t frames_since_last_overlay_message_info = 0;
 static SDL_Surface *od_status_line_overlay;
+
+/* What's currently drawn on od_status_line_overlay, so that it only has
+   to be redrawn when something changes */
+static struct {
+  int valid;
+  void (*print_info)( void );
+  unsigned int generation;
+  int length, scale, bw_tv;
+} od_status_line_contents;
 static SDL_Surface *red_cassette[4], *green_cassette[4];
 static SDL_Surface *red_mdr[4], *green_mdr[4];
 static SDL_Surface *red_disk[4], *green_disk[4];
@@ -184,6 +228,13 @@ static SDL_Color colour_palette[] = {
 
 static Uint32 bw_values[16];
 
+/* For every byte of screen data, a mask for each of its eight pixels:
+   all ones where the pixel is ink, zero where it is paper. Lets
+   uidisplay_plot8() and friends expand a byte without a branch per
+   pixel; index_masks is the same for index_screen */
+static libspectrum_word plot_masks[256][8];
+static libspectrum_byte index_masks[256][8];
+
 #if defined(VKEYBOARD) || defined(GCWZERO)
 static SDL_Surface *overlay_alpha_surface = NULL;
 static Uint32 colour_values_a[20];
@@ -197,6 +248,30 @@ static SDL_Rect updated_rects[MAX_UPDATE_RECT];
 static int num_rects = 0;
 static libspectrum_byte sdldisplay_force_full_refresh = 1;
 
+/* The areas plotted into index_screen since the end of the last frame,
+   and the palette tmp_screen was last converted with */
+static SDL_Rect index_rects[MAX_UPDATE_RECT];
+static int index_num_rects = 0;
+static int index_all = 1;
+static int index_bw_tv;
+
+#ifdef MIYOO
+/* With triple buffering the page being drawn was last shown a few frames
+   ago, so each page collects everything changed since then. Guessing
+   too many pages only means redrawing a little more than needed */
+#define SDLDISPLAY_PAGES 3
+static SDL_Rect page_rects[SDLDISPLAY_PAGES][MAX_UPDATE_RECT];
+static int page_num_rects[SDLDISPLAY_PAGES];
+static int page_full_refresh[SDLDISPLAY_PAGES] = { 1, 1, 1 };
+static int sdldisplay_page = 0;
+
+/* Is the frame being presented a full refresh? */
+static int sdldisplay_present_full = 1;
+
+/* Were there overlays on the screen last frame? */
+static int sdldisplay_overlays_shown = 0;
+#endif
+
 static int max_fullscreen_height;
 static int min_fullscreen_height;
 static int fullscreen_width = 0;
@@ -206,6 +281,10 @@ static int fullscreen_y_off = 0;
 /* The current size of the display (in units of DISPLAY_SCREEN_*) */
 static float sdldisplay_current_size = 1;
 
+/* The mode last asked of SDL_SetVideoMode() */
+static int sdldisplay_mode_width, sdldisplay_mode_height;
+static Uint32 sdldisplay_mode_flags;
+
 static libspectrum_byte sdldisplay_is_full_screen = 0;
 
 //Miyoo
@@ -270,6 +349,7 @@ static sdldisplay_t_od_border sdldisplay_last_od_border = Full;
 static sdldisplay_t_od_border sdldisplay_current_od_border = Full;
 static SDL_Rect clip_area;
 static libspectrum_byte sdldisplay_is_triple_buffer = 0;
+static libspectrum_byte sdldisplay_is_hardware_scaling = 0;
 static libspectrum_byte sdldisplay_flips_triple_buffer = 0;
 typedef enum sdldisplay_od_system_types {
       OPENDINGUX_2014,
@@ -363,11 +443,20 @@ static void uidisplay_show_msg_info_overlay( void );
 
 static int sdldisplay_load_gfx_mode( void );
 
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+static void sdldisplay_render_thread_start( void );
+static void sdldisplay_render_thread_stop( void );
+#endif
+
 static void
 init_scalers( void )
 {
   scaler_register_clear();
 
+#if defined( GCWZERO ) && !defined( MIYOO )
+  sdldisplay_is_hardware_scaling = settings_current.od_hardware_scaling;
+#endif
+
   scaler_register( SCALER_NORMAL );
 #ifndef GCWZERO
   scaler_register( SCALER_2XSAI );
@@ -391,15 +480,18 @@ init_scalers( void )
 #endif
   } else {
 #ifdef GCWZERO
-    scaler_register( SCALER_DOTMATRIX );
-    scaler_register( SCALER_DOUBLESIZE );
-    scaler_register( SCALER_TV2X );
-    scaler_register( SCALER_PALTV2X );
-    scaler_register( SCALER_2XSAI );
-    scaler_register( SCALER_SUPER2XSAI );
-    scaler_register( SCALER_SUPEREAGLE );
-    scaler_register( SCALER_ADVMAME2X );
-    scaler_register( SCALER_HQ2X );
+    /* With hardware scaling the IPU does all the scaling up */
+    if( !sdldisplay_is_hardware_scaling ) {
+      scaler_register( SCALER_DOTMATRIX );
+      scaler_register( SCALER_DOUBLESIZE );
+      scaler_register( SCALER_TV2X );
+      scaler_register( SCALER_PALTV2X );
+      scaler_register( SCALER_2XSAI );
+      scaler_register( SCALER_SUPER2XSAI );
+      scaler_register( SCALER_SUPEREAGLE );
+      scaler_register( SCALER_ADVMAME2X );
+      scaler_register( SCALER_HQ2X );
+    }
 #else
     scaler_register( SCALER_DOUBLESIZE );
     scaler_register( SCALER_TRIPLESIZE );
@@ -483,25 +575,23 @@ sdl_convert_icon( SDL_Surface *source, SDL_Surface **icon, int red )
   return 0;
 }
 
+/* Make the status bar icons from a BMP built into Fuse */
 static int
-sdl_load_status_icon( const char*filename, SDL_Surface **red, SDL_Surface **green )
+sdl_load_status_icon( const char *name, const unsigned char *bmp,
+                      size_t length, SDL_Surface **red, SDL_Surface **green )
 {
-  char path[ PATH_MAX ];
   SDL_Surface *temp;    /* Copy of image as loaded */
 
-  if( utils_find_file_path( filename, path, UTILS_AUXILIARY_LIB ) ) {
-    fprintf( stderr, "%s: Error getting path for icons\n", fuse_progname );
-    return -1;
-  }
-
-  if((temp = SDL_LoadBMP(path)) == NULL) {
+  temp = SDL_LoadBMP_RW( SDL_RWFromConstMem( bmp, length ), 1 );
+  if( temp == NULL ) {
     fprintf( stderr, "%s: Error loading icon \"%s\" text:%s\n", fuse_progname,
-             path, SDL_GetError() );
+             name, SDL_GetError() );
     return -1;
   }
 
   if(temp->format->palette == NULL) {
-    fprintf( stderr, "%s: Icon \"%s\" is not paletted\n", fuse_progname, path );
+    fprintf( stderr, "%s: Icon \"%s\" is not paletted\n", fuse_progname, name );
+    SDL_FreeSurface( temp );
     return -1;
   }
 
@@ -566,6 +656,35 @@ od_complete_modes( SDL_Rect **modes ) {
 }
 #endif /* #ifndef RETROFW */
 
+#ifndef MIYOO
+/* Ask the IPU to keep the image's aspect ratio when scaling it up to the
+   panel rather than stretching it to fill the screen. RetroFW has no
+   such control; its IPU setting is left as the firmware has it */
+static void
+od_ipu_keep_aspect_ratio( void )
+{
+  const char *path;
+  FILE *f;
+
+  switch( sdldisplay_od_system_type ) {
+  case OPENDINGUX:
+    path = "/sys/class/graphics/fb0/device/keep_aspect_ratio";
+    break;
+  case OPENDINGUX_2014:
+    path = "/sys/devices/platform/jz-lcd.0/keep_aspect_ratio";
+    break;
+  default:
+    return;
+  }
+
+  f = fopen( path, "w" );
+  if( f ) {
+    fwrite( "Y", 1, 1, f );
+    fclose( f );
+  }
+}
+#endif /* #ifndef MIYOO */
+
 /* Initializations for OpenDingux/RetroFW */
 void
 uidisplay_od_init( SDL_Rect **modes )
@@ -661,6 +780,18 @@ uidisplay_od_init( SDL_Rect **modes )
 }
 #endif /* #ifdef GCWZERO */
 
+static void
+init_plot_masks( void )
+{
+  int data, bit;
+
+  for( data = 0; data < 256; data++ )
+    for( bit = 0; bit < 8; bit++ ) {
+      plot_masks[ data ][ bit ] = ( data & ( 0x80 >> bit ) ) ? 0xffff : 0x0000;
+      index_masks[ data ][ bit ] = plot_masks[ data ][ bit ] & 0xff;
+    }
+}
+
 int
 uidisplay_init( int width, int height )
 {
@@ -668,6 +799,8 @@ uidisplay_init( int width, int height )
   int no_modes;
   int i = 0, mw = 0, mh = 0, mn = 0;
 
+  init_plot_masks();
+
   /* Get available fullscreen/software modes */
 #ifdef GCWZERO
   modes=SDL_ListModes(NULL, SDL_FULLSCREEN|SDL_HWSURFACE);
@@ -756,9 +889,13 @@ uidisplay_init( int width, int height )
   /* We can now output error messages to our output device */
   display_ui_initialised = 1;
 
-  sdl_load_status_icon( "cassette.bmp", red_cassette, green_cassette );
-  sdl_load_status_icon( "microdrive.bmp", red_mdr, green_mdr );
-  sdl_load_status_icon( "plus3disk.bmp", red_disk, green_disk );
+  sdl_load_status_icon( "cassette.bmp", embedded_cassette_bmp,
+                        embedded_cassette_bmp_length, red_cassette,
+                        green_cassette );
+  sdl_load_status_icon( "microdrive.bmp", embedded_microdrive_bmp,
+                        embedded_microdrive_bmp_length, red_mdr, green_mdr );
+  sdl_load_status_icon( "plus3disk.bmp", embedded_plus3disk_bmp,
+                        embedded_plus3disk_bmp_length, red_disk, green_disk );
 
 #if GCWZERO
   if (sdldisplay_current_od_border) {
@@ -781,6 +918,7 @@ sdldisplay_allocate_colours( int numColours, Uint32 *colour_values,
 {
   int i;
   Uint8 red, green, blue, grey;
+  libspectrum_dword hq_colours[ 2 * 16 ];
 
   for( i = 0; i < numColours; i++ ) {
 
@@ -793,8 +931,15 @@ sdldisplay_allocate_colours( int numColours, Uint32 *colour_values,
 
     colour_values[i] = SDL_MapRGB( tmp_screen->format,  red, green, blue );
     bw_values[i]     = SDL_MapRGB( tmp_screen->format, grey,  grey, grey );
+
+    hq_colours[ 2 * i     ] = colour_values[i];
+    hq_colours[ 2 * i + 1 ] = bw_values[i];
   }
 
+  /* The display only uses these colours, so the HQ scalers can work on
+     palette indices */
+  scaler_hq_palette_16( hq_colours, 2 * numColours );
+
   return 0;
 }
 
@@ -889,33 +1034,219 @@ sdldisplay_find_best_fullscreen_scaler( void )
   }
 }
 
-static int
-sdldisplay_load_gfx_mode( void )
+/* Create a surface like tmp_screen, with room around the image for the
+   scalers */
+static SDL_Surface*
+sdldisplay_create_tmp_screen( void )
 {
-  Uint16 *tmp_screen_pixels;
+  Uint16 *pixels;
+  SDL_Surface *surface;
+
+  pixels = (Uint16*)calloc( tmp_screen_width * ( image_height + 3 ),
+                            sizeof( Uint16 ) );
+  if( !pixels ) return NULL;
+
+  surface = SDL_CreateRGBSurfaceFrom( pixels, tmp_screen_width,
+                                      image_height + 3, 16,
+                                      tmp_screen_width * 2,
+                                      sdldisplay_gc->format->Rmask,
+                                      sdldisplay_gc->format->Gmask,
+                                      sdldisplay_gc->format->Bmask,
+                                      sdldisplay_gc->format->Amask );
+  if( !surface ) free( pixels );
+
+  return surface;
+}
 
-  sdldisplay_force_full_refresh = 1;
+static void
+sdldisplay_free_tmp_screen( SDL_Surface **surface )
+{
+  if( !*surface ) return;
+
+  free( (*surface)->pixels );
+  SDL_FreeSurface( *surface ); *surface = NULL;
+}
+
+/* Forget the widget layer when the surfaces change size; any widget still
+   open carries on drawing on the new tmp_screen */
+static void
+sdldisplay_free_widget_layer( void )
+{
+  sdldisplay_free_tmp_screen( &widget_image );
+  sdldisplay_free_tmp_screen( &widget_layer );
+}
 
-  /* Free the old surface */
-  if( tmp_screen ) {
-    free( tmp_screen->pixels );
-    SDL_FreeSurface( tmp_screen );
-    tmp_screen = NULL;
+/* Is the emulator's image being plotted into index_screen? Anything else
+   drawn on tmp_screen, and everything drawn elsewhere, is plotted in
+   colour straight away */
+static inline int
+sdldisplay_index_plotting( void )
+{
+#if defined(VKEYBOARD) || defined(GCWZERO)
+  if( overlay_alpha_surface ) return 0;
+#endif
+
+  return index_synced && plot_screen == tmp_screen && ui_widget_level == -1;
+}
+
+static void
+sdldisplay_index_area( int x, int y, int width, int height )
+{
+  if( index_all ) return;
+
+  if( index_num_rects == MAX_UPDATE_RECT ) {
+    index_all = 1;
+    return;
   }
 
-#if VKEYBOARD
-  if ( keyb_screen ) {
-    SDL_FreeSurface( keyb_screen );
-    keyb_screen = NULL;
+  index_rects[ index_num_rects ].x = x;
+  index_rects[ index_num_rects ].y = y;
+  index_rects[ index_num_rects ].w = width;
+  index_rects[ index_num_rects ].h = height;
+  index_num_rects++;
+}
+
+/* Turn an area of index_screen into colours in tmp_screen */
+static void
+sdldisplay_index_convert( int x, int y, int width, int height )
+{
+  const Uint32 *palette_values = settings_current.bw_tv ? bw_values :
+                                 colour_values;
+  const libspectrum_byte *src;
+  libspectrum_word *dest;
+  int i;
+
+  if( x < 0 ) { width += x; x = 0; }
+  if( y < 0 ) { height += y; y = 0; }
+  if( x + width > image_width ) width = image_width - x;
+  if( y + height > image_height ) height = image_height - y;
+  if( width <= 0 || height <= 0 ) return;
+
+  for( ; height; height--, y++ ) {
+    src = index_screen + y * image_width + x;
+    dest = (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
+                                ( x + 1 ) * 2 + ( y + 1 ) * tmp_screen->pitch );
+
+    for( i = 0; i < width; i++ ) dest[i] = palette_values[ src[i] ];
   }
-#endif
+}
 
-#ifdef GCWZERO
-  if ( od_status_line_overlay ) {
-    SDL_FreeSurface( od_status_line_overlay );
-    od_status_line_overlay = NULL;
+/* Called at the start of each frame end, before anything is drawn over
+   the image, to bring tmp_screen up to date with index_screen */
+static void
+sdldisplay_index_update( void )
+{
+  int i;
+
+  if( !index_screen || plot_screen != tmp_screen || ui_widget_level != -1 )
+    return;
+
+  if( !index_synced ) {
+    /* tmp_screen is right as it stands, but index_screen isn't; start
+       plotting into it again from the next frame, which will be drawn in
+       full */
+    display_refresh_all();
+    index_synced = 1;
+  } else if( index_all || index_bw_tv != settings_current.bw_tv ) {
+    sdldisplay_index_convert( 0, 0, image_width, image_height );
+    sdldisplay_force_full_refresh = 1;
+  } else {
+    for( i = 0; i < index_num_rects; i++ )
+      sdldisplay_index_convert( index_rects[i].x, index_rects[i].y,
+                                index_rects[i].w, index_rects[i].h );
   }
+
+  index_num_rects = 0; index_all = 0;
+  index_bw_tv = settings_current.bw_tv;
+}
+
+/* How many bytes the pixels of `surface' take up */
+static size_t
+sdldisplay_surface_size( const SDL_Surface *surface )
+{
+  return surface ? (size_t)surface->pitch * surface->h : 0;
+}
+
+/* Note how much the surfaces made by sdldisplay_load_gfx_mode() take up */
+static void
+sdldisplay_update_memory_usage( void )
+{
+  size_t total;
+
+  total = sdldisplay_surface_size( sdldisplay_gc ) +
+          sdldisplay_surface_size( tmp_screen );
+  if( index_screen ) total += image_width * image_height;
+#if VKEYBOARD
+  total += sdldisplay_surface_size( keyb_screen );
 #endif
+#ifdef GCWZERO
+  total += sdldisplay_surface_size( od_status_line_overlay );
+#endif
+
+  memory_usage_set( MEMORY_USAGE_SCALER, total );
+}
+
+/* Set the video mode, unless it's the one already in use: setting it
+   again stalls the display, and on OpenDingux resets the video mode */
+static SDL_Surface*
+sdldisplay_set_video_mode( int width, int height, Uint32 flags )
+{
+  if( sdldisplay_gc && width == sdldisplay_mode_width &&
+      height == sdldisplay_mode_height && flags == sdldisplay_mode_flags )
+    return sdldisplay_gc;
+
+  sdldisplay_mode_width = width;
+  sdldisplay_mode_height = height;
+  sdldisplay_mode_flags = flags;
+
+  return SDL_SetVideoMode( width, height, 16, flags );
+}
+
+/* Has the display's pixel format changed since the last time this was
+   called? */
+static int
+sdldisplay_format_changed( void )
+{
+  static Uint8 bits = 0;
+  static Uint32 rmask, gmask, bmask;
+  const SDL_PixelFormat *format = sdldisplay_gc->format;
+  int changed;
+
+  changed = format->BitsPerPixel != bits || format->Rmask != rmask ||
+            format->Gmask != gmask || format->Bmask != bmask;
+
+  bits = format->BitsPerPixel;
+  rmask = format->Rmask; gmask = format->Gmask; bmask = format->Bmask;
+
+  return changed;
+}
+
+/* Can `surface' be kept for something `width' by `height'? */
+static int
+sdldisplay_surface_fits( const SDL_Surface *surface, int width, int height )
+{
+  return surface && surface->w == width && surface->h == height;
+}
+
+static int
+sdldisplay_load_gfx_mode( void )
+{
+  int format_changed;
+
+#if defined( GCWZERO ) && !defined( MIYOO )
+  /* Hardware scaling changes which scalers can be used; if that means
+     changing the scaler, the mode is set from there */
+  if( sdldisplay_is_hardware_scaling != settings_current.od_hardware_scaling )
+    init_scalers();
+#endif
+
+  sdldisplay_force_full_refresh = 1;
+
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+  sdldisplay_render_thread_stop();
+#endif
+
+  plot_screen = NULL; plot_offset = 1;
 
   tmp_screen_width = (image_width + 3);
 
@@ -1003,8 +1334,15 @@ sdldisplay_load_gfx_mode( void )
     display_width = clip_area.w * sdldisplay_current_size;
     display_height = clip_area.h * sdldisplay_current_size;
 
+    /* Don't bother drawing the border which is cropped off */
+    display_set_viewport( ( DISPLAY_ASPECT_WIDTH - ssc[sdldisplay_current_od_border].w ) / 2,
+                          ( DISPLAY_SCREEN_HEIGHT - ssc[sdldisplay_current_od_border].h ) / 2,
+                          ssc[sdldisplay_current_od_border].w,
+                          ssc[sdldisplay_current_od_border].h );
+
   /* Full Border */
   } else {
+    display_set_viewport( 0, 0, DISPLAY_ASPECT_WIDTH, DISPLAY_SCREEN_HEIGHT );
     display_width =  settings_current.full_screen && fullscreen_width
         ? fullscreen_width
         : image_width * sdldisplay_current_size;
@@ -1012,14 +1350,17 @@ sdldisplay_load_gfx_mode( void )
         ? max_fullscreen_height
         : image_height * sdldisplay_current_size;
   }
-  sdldisplay_gc = SDL_SetVideoMode( display_width, display_height, 16, flags );
+#ifndef MIYOO
+  if ( sdldisplay_is_hardware_scaling ) od_ipu_keep_aspect_ratio();
+#endif
+  sdldisplay_gc = sdldisplay_set_video_mode( display_width, display_height,
+                                             flags );
 #else
-  sdldisplay_gc = SDL_SetVideoMode(
+  sdldisplay_gc = sdldisplay_set_video_mode(
     settings_current.full_screen && fullscreen_width ? fullscreen_width :
       image_width * sdldisplay_current_size,
     settings_current.full_screen && fullscreen_width ? max_fullscreen_height :
       image_height * sdldisplay_current_size,
-    16,
     settings_current.full_screen ? (SDL_FULLSCREEN|SDL_SWSURFACE)
                                  : SDL_SWSURFACE
   );
@@ -1040,66 +1381,107 @@ sdldisplay_load_gfx_mode( void )
   sdldisplay_last_od_border = sdldisplay_current_od_border;
 #endif
 
+  /* Surfaces which are still the right size and format are kept, along
+     with the colours; only what the new mode can't use is made again */
+  format_changed = sdldisplay_format_changed();
+
   /* Distinguish 555 and 565 mode */
-  if( sdldisplay_gc->format->Gmask >> sdldisplay_gc->format->Gshift == 0x1f )
-    scaler_select_bitformat( 555 );
-  else
-    scaler_select_bitformat( 565 );
+  if( format_changed ) {
+    if( sdldisplay_gc->format->Gmask >> sdldisplay_gc->format->Gshift == 0x1f )
+      scaler_select_bitformat( 555 );
+    else
+      scaler_select_bitformat( 565 );
+  }
 
   /* Create the surface used for the graphics in 16 bit before scaling */
 
   /* Need some extra bytes around when using 2xSaI */
-  tmp_screen_pixels = (Uint16*)calloc(tmp_screen_width*(image_height+3), sizeof(Uint16));
-  tmp_screen = SDL_CreateRGBSurfaceFrom(tmp_screen_pixels,
-                                        tmp_screen_width,
-                                        image_height + 3,
-                                        16, tmp_screen_width*2,
-                                        sdldisplay_gc->format->Rmask,
-                                        sdldisplay_gc->format->Gmask,
-                                        sdldisplay_gc->format->Bmask,
-                                        sdldisplay_gc->format->Amask );
-
-  if( !tmp_screen ) {
-    fprintf( stderr, "%s: couldn't create tmp_screen\n", fuse_progname );
-    fuse_abort();
+  if( format_changed ||
+      !sdldisplay_surface_fits( tmp_screen, tmp_screen_width,
+                                image_height + 3 ) ) {
+    sdldisplay_free_tmp_screen( &tmp_screen );
+    sdldisplay_free_widget_layer();
+    free( index_screen ); index_screen = NULL;
+
+    tmp_screen = sdldisplay_create_tmp_screen();
+
+    if( !tmp_screen ) {
+      fprintf( stderr, "%s: couldn't create tmp_screen\n", fuse_progname );
+      fuse_abort();
+    }
+
+    /* Without index_screen, the image is just plotted in colour */
+    index_screen = calloc( image_width * image_height, 1 );
   }
 
+  plot_screen = tmp_screen;
+  index_synced = 0;
+
 #if VKEYBOARD
   /* Create the surface that contains the keyboard graphics in 32 bit mode */
-  SDL_Surface *swap_screen;
-  swap_screen = SDL_CreateRGBSurface(SDL_HWSURFACE,
-                                     machine_current->timex ? VKEYB_WIDTH * 2  : VKEYB_WIDTH,
-                                     machine_current->timex ? VKEYB_HEIGHT * 2 : VKEYB_HEIGHT,
-                                     16,
-                                     sdldisplay_gc->format->Rmask,
-                                     sdldisplay_gc->format->Gmask,
-                                     sdldisplay_gc->format->Bmask,
-                                     ( SDL_BYTEORDER == SDL_BIG_ENDIAN ? 0x000000ff : 0xff000000 ) );
-  if ( !swap_screen ) {
-    fprintf( stderr, "%s: couldn't create keyb_screen\n", fuse_progname );
-    fuse_abort();
-  }
-  keyb_screen = SDL_DisplayFormatAlpha( swap_screen );
-  SDL_FreeSurface( swap_screen );
-#endif
+  int keyb_width = machine_current->timex ? VKEYB_WIDTH * 2  : VKEYB_WIDTH;
+  int keyb_height = machine_current->timex ? VKEYB_HEIGHT * 2 : VKEYB_HEIGHT;
 
-#ifdef GCWZERO
-  /* Create the surface that contains status in scaling */
-  SDL_Surface *od_tmp_screen;
-  od_tmp_screen = SDL_CreateRGBSurface(SDL_HWSURFACE,
-                                       machine_current->timex ? od_icon_position.status_line.w * 2 : od_icon_position.status_line.w,
-                                       machine_current->timex ? od_icon_position.status_line.h * 2 : od_icon_position.status_line.h,
+  if( format_changed ||
+      !sdldisplay_surface_fits( keyb_screen, keyb_width, keyb_height ) ) {
+    SDL_Surface *swap_screen;
+
+    if ( keyb_screen ) {
+      SDL_FreeSurface( keyb_screen );
+      keyb_screen = NULL;
+    }
+
+    swap_screen = SDL_CreateRGBSurface(SDL_HWSURFACE,
+                                       keyb_width,
+                                       keyb_height,
                                        16,
                                        sdldisplay_gc->format->Rmask,
                                        sdldisplay_gc->format->Gmask,
                                        sdldisplay_gc->format->Bmask,
                                        ( SDL_BYTEORDER == SDL_BIG_ENDIAN ? 0x000000ff : 0xff000000 ) );
-  if ( !od_tmp_screen ) {
-    fprintf( stderr, "%s: couldn't create status line overlay screen\n", fuse_progname );
-    fuse_abort();
+    if ( !swap_screen ) {
+      fprintf( stderr, "%s: couldn't create keyb_screen\n", fuse_progname );
+      fuse_abort();
+    }
+    keyb_screen = SDL_DisplayFormatAlpha( swap_screen );
+    init_vkeyboard_canvas = 0;
+    SDL_FreeSurface( swap_screen );
   }
-  od_status_line_overlay = SDL_DisplayFormatAlpha( od_tmp_screen );
-  SDL_FreeSurface( od_tmp_screen );
+#endif
+
+#ifdef GCWZERO
+  /* Create the surface that contains status in scaling */
+  int status_width = machine_current->timex ? od_icon_position.status_line.w * 2 : od_icon_position.status_line.w;
+  int status_height = machine_current->timex ? od_icon_position.status_line.h * 2 : od_icon_position.status_line.h;
+
+  if( format_changed ||
+      !sdldisplay_surface_fits( od_status_line_overlay, status_width,
+                                status_height ) ) {
+    SDL_Surface *od_tmp_screen;
+
+    if ( od_status_line_overlay ) {
+      SDL_FreeSurface( od_status_line_overlay );
+      od_status_line_overlay = NULL;
+    }
+
+    od_tmp_screen = SDL_CreateRGBSurface(SDL_HWSURFACE,
+                                         status_width,
+                                         status_height,
+                                         16,
+                                         sdldisplay_gc->format->Rmask,
+                                         sdldisplay_gc->format->Gmask,
+                                         sdldisplay_gc->format->Bmask,
+                                         ( SDL_BYTEORDER == SDL_BIG_ENDIAN ? 0x000000ff : 0xff000000 ) );
+    if ( !od_tmp_screen ) {
+      fprintf( stderr, "%s: couldn't create status line overlay screen\n", fuse_progname );
+      fuse_abort();
+    }
+    od_status_line_overlay = SDL_DisplayFormatAlpha( od_tmp_screen );
+    SDL_FreeSurface( od_tmp_screen );
+  }
+
+  /* The status line may have moved */
+  od_status_line_contents.valid = 0;
 #endif
 
   fullscreen_x_off = ( sdldisplay_gc->w - image_width * sdldisplay_current_size ) *
@@ -1107,10 +1489,14 @@ sdldisplay_load_gfx_mode( void )
   fullscreen_y_off = ( sdldisplay_gc->h - image_height * sdldisplay_current_size ) *
                      sdldisplay_is_full_screen / 2;
 
-  sdldisplay_allocate_colours( 16, colour_values, bw_values );
+  if( format_changed ) {
+    sdldisplay_allocate_colours( 16, colour_values, bw_values );
 #if defined(VKEYBOARD) || defined(GCWZERO)
-  sdldisplay_allocate_colours_alpha( 16, colour_values_a, bw_values_a );
+    sdldisplay_allocate_colours_alpha( 16, colour_values_a, bw_values_a );
 #endif
+  }
+
+  sdldisplay_update_memory_usage();
 
   /* Redraw the entire screen... */
   display_refresh_all();
@@ -1119,11 +1505,33 @@ sdldisplay_load_gfx_mode( void )
 }
 
 #ifdef MIYOO
-void uidisplay_fullscreen (void)
+/* Put the image in `source' on the screen. Unless `full' is set, only
+   the `count' areas in `rects' need updating; on return they hold the
+   areas of the screen which were changed */
+static void
+sdldisplay_fullscreen_from( SDL_Surface *source, SDL_Rect *rects, int *count,
+                            int full )
 {
+  int i;
+
   if(!settings_current.od_fullscreen && strncmp(settings_current.od_border,"Full", 4 ) == 0)  
   {
-    SDL_BlitSurface(tmp_screen, NULL, sdldisplay_gc, NULL);
+    /* Nothing to do if the image was drawn on the screen directly */
+    if( plot_screen == sdldisplay_gc ) return;
+
+    if( full ) {
+      SDL_BlitSurface(source, NULL, sdldisplay_gc, NULL);
+    } else {
+      /* The image is one pixel in from the corner of source, and is
+         blitted across with that margin */
+      for( i = 0; i < *count; i++ ) {
+        SDL_Rect src = rects[i];
+        src.x++; src.y++;
+        rects[i].x++; rects[i].y++;
+        SDL_BlitSurface( source, &src, sdldisplay_gc, &rects[i] );
+      }
+      return;
+    }
   } 
   else 
   {
@@ -1164,10 +1572,138 @@ void uidisplay_fullscreen (void)
     dst.y = position_border_height;
     dst.w = 320 - 2 * border_width;
     dst.h = 240 - 2 * border_height;
-    SDL_SoftStretch(tmp_screen, &dst, sdldisplay_gc, &src);
+    SDL_SoftStretch(source, &dst, sdldisplay_gc, &src);
+  }
+
+  /* Anything other than a partial 1:1 blit changes the whole screen */
+  if( rects ) {
+    rects[0].x = 0; rects[0].y = 0;
+    rects[0].w = sdldisplay_gc->w; rects[0].h = sdldisplay_gc->h;
+    *count = 1;
+  }
+}
+
+void uidisplay_fullscreen (void)
+{
+  sdldisplay_fullscreen_from( tmp_screen, NULL, NULL, 1 );
+}
+
+/* Is anything drawn on the screen over the top of the image? */
+static int
+sdldisplay_overlays_active( void )
+{
+#if VKEYBOARD
+  if( vkeyboard_enabled ) return 1;
+#endif
+
+  return ui_widget_level >= 0 || od_show_msg_info ||
+         settings_current.statusbar;
+}
+
+/* Can the Spectrum image be drawn straight onto the screen? Only when
+   the frame would otherwise be blitted across unchanged and nothing is
+   drawn on top of it */
+static int
+sdldisplay_direct_possible( void )
+{
+  if( settings_current.od_fullscreen ||
+      strncmp( settings_current.od_border, "Full", 4 ) ) return 0;
+
+  if( sdldisplay_is_triple_buffer || SDL_MUSTLOCK( sdldisplay_gc ) ||
+      sdldisplay_gc->format->BytesPerPixel != 2 ||
+      sdldisplay_gc->w < image_width || sdldisplay_gc->h < image_height )
+    return 0;
+
+#ifdef HAVE_PTHREAD
+  /* The render thread draws onto the screen itself */
+  if( settings_current.sdl_render_thread ) return 0;
+#endif
+
+  return !sdldisplay_overlays_active();
+}
+
+static void
+sdldisplay_start_direct( void )
+{
+  plot_screen = sdldisplay_gc; plot_offset = 0;
+  index_synced = 0;
+
+  /* What is on the screen was blitted across with tmp_screen's one pixel
+     margin, so redraw all of it */
+  display_refresh_all();
+}
+
+/* Go back to drawing into tmp_screen, optionally bringing it up to date
+   with what has been drawn on the screen in the meantime */
+static void
+sdldisplay_end_direct( int copy )
+{
+  if( !plot_screen || plot_screen != sdldisplay_gc ) return;
+
+  if( copy ) {
+    SDL_Rect dst = { 1, 1, 0, 0 };
+    SDL_BlitSurface( sdldisplay_gc, NULL, tmp_screen, &dst );
+  }
+
+  plot_screen = tmp_screen; plot_offset = 1;
+}
+
+static int
+sdldisplay_num_pages( void )
+{
+  return sdldisplay_is_triple_buffer ? SDLDISPLAY_PAGES : 1;
+}
+
+/* Add this frame's changes to what every page is waiting for, and leave
+   the changes the page about to be drawn needs in updated_rects */
+static void
+sdldisplay_damage_collect( void )
+{
+  int i, pages = sdldisplay_num_pages();
+
+  if( sdldisplay_page >= pages ) sdldisplay_page = 0;
+
+  for( i = 0; i < pages; i++ ) {
+    if( page_full_refresh[i] ) continue;
+
+    if( sdldisplay_force_full_refresh ||
+        page_num_rects[i] + num_rects > MAX_UPDATE_RECT ) {
+      page_full_refresh[i] = 1;
+      continue;
+    }
+
+    memcpy( &page_rects[i][ page_num_rects[i] ], updated_rects,
+            num_rects * sizeof( SDL_Rect ) );
+    page_num_rects[i] += num_rects;
+  }
+
+  sdldisplay_force_full_refresh = 0;
+
+  sdldisplay_present_full = page_full_refresh[ sdldisplay_page ];
+
+  if( sdldisplay_present_full ) {
+    num_rects = 1;
+    updated_rects[0].x = 0;
+    updated_rects[0].y = 0;
+    updated_rects[0].w = image_width;
+    updated_rects[0].h = image_height;
+  } else {
+    num_rects = page_num_rects[ sdldisplay_page ];
+    memcpy( updated_rects, page_rects[ sdldisplay_page ],
+            num_rects * sizeof( SDL_Rect ) );
   }
 }
 
+/* The current page is now up to date and on its way to the screen */
+static void
+sdldisplay_damage_presented( void )
+{
+  page_full_refresh[ sdldisplay_page ] = 0;
+  page_num_rects[ sdldisplay_page ] = 0;
+
+  if( ++sdldisplay_page >= sdldisplay_num_pages() ) sdldisplay_page = 0;
+}
+
 int
 uidisplay_hotswap_statusbar( void )
 {
@@ -1185,27 +1721,14 @@ uidisplay_hotswap_gfx_mode( void )
 {
   fuse_emulation_pause();
 
-  /* Free the old surface */
-  if( tmp_screen ) {
-    free( tmp_screen->pixels );
-    SDL_FreeSurface( tmp_screen ); tmp_screen = NULL;
-  }
-
-#if VKEYBOARD
-  if ( keyb_screen ) {
-    SDL_FreeSurface( keyb_screen );
-    keyb_screen = NULL;
-  }
-#endif
+  /* The new mode may refresh at a different rate */
+  timer_vsync_reset();
 
-#ifdef GCWZERO
-  if ( od_status_line_overlay ) {
-    SDL_FreeSurface( od_status_line_overlay );
-    od_status_line_overlay = NULL;
-  }
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+  sdldisplay_render_thread_stop();
 #endif
 
-  /* Setup the new GFX mode */
+  /* Setup the new GFX mode; whatever it can still use is kept */
   if( sdldisplay_load_gfx_mode() ) return 1;
 
   /* reset palette */
@@ -1225,16 +1748,35 @@ uidisplay_hotswap_gfx_mode( void )
   return 0;
 }
 
-SDL_Surface *saved = NULL;
-
 void
 uidisplay_frame_save( void )
 {
+#ifdef MIYOO
+  sdldisplay_end_direct( 1 );
+#endif
+
   if( saved ) {
     SDL_FreeSurface( saved );
     saved = NULL;
   }
 
+  /* For the first widget, park the image and start the widgets off on a
+     copy of it */
+  if( ui_widget_level == -1 && !widget_image ) {
+    if( !widget_layer ) widget_layer = sdldisplay_create_tmp_screen();
+
+    if( widget_layer ) {
+      memcpy( widget_layer->pixels, tmp_screen->pixels,
+              tmp_screen->h * tmp_screen->pitch );
+
+      widget_image = tmp_screen;
+      widget_image_bw_tv = settings_current.bw_tv;
+      tmp_screen = plot_screen = widget_layer;
+      widget_layer = NULL;
+      return;
+    }
+  }
+
   saved = SDL_ConvertSurface( tmp_screen, tmp_screen->format,
                               SDL_SWSURFACE );
 }
@@ -1243,9 +1785,42 @@ void
 uidisplay_frame_restore( void )
 {
   if( saved ) {
+#ifdef MIYOO
+    sdldisplay_end_direct( 0 );
+#endif
     SDL_BlitSurface( saved, NULL, tmp_screen, NULL );
     sdldisplay_force_full_refresh = 1;
+  } else if( widget_image ) {
+    memcpy( tmp_screen->pixels, widget_image->pixels,
+            tmp_screen->h * tmp_screen->pitch );
+    sdldisplay_force_full_refresh = 1;
+  }
+}
+
+void
+uidisplay_frame_release( void )
+{
+  if( saved ) {
+    SDL_FreeSurface( saved );
+    saved = NULL;
+  }
+
+  /* If the image wasn't parked, or the surfaces have been replaced since,
+     the Spectrum's display has to be drawn again */
+  if( !widget_image ) {
+    display_refresh_all();
+    return;
   }
+
+  widget_layer = tmp_screen;
+  tmp_screen = plot_screen = widget_image;
+  widget_image = NULL;
+
+  sdldisplay_force_full_refresh = 1;
+
+  /* The image is just as it was, unless it's to be shown in another
+     palette now */
+  if( widget_image_bw_tv != settings_current.bw_tv ) display_refresh_all();
 }
 
 static void
@@ -1477,6 +2052,20 @@ uidisplay_putpixel( int x, int y, int colour )
   }
 #endif
 
+  if( sdldisplay_index_plotting() ) {
+    libspectrum_byte *index;
+
+    if( machine_current->timex ) {
+      x <<= 1; y <<= 1;
+      index = index_screen + y * image_width + x;
+      index[0] = index[1] = index[ image_width ] = index[ image_width + 1 ] =
+        colour;
+    } else {
+      index_screen[ y * image_width + x ] = colour;
+    }
+    return;
+  }
+
   Uint32 *palette_values = settings_current.bw_tv ? bw_values :
                            colour_values;
 
@@ -1485,21 +2074,21 @@ uidisplay_putpixel( int x, int y, int colour )
   if( machine_current->timex ) {
     x <<= 1; y <<= 1;
     dest_base = dest =
-      (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
-                           (x+1) * tmp_screen->format->BytesPerPixel +
-                           (y+1) * tmp_screen->pitch);
+      (libspectrum_word*)( (libspectrum_byte*)plot_screen->pixels +
+                           (x+plot_offset) * plot_screen->format->BytesPerPixel +
+                           (y+plot_offset) * plot_screen->pitch);
 
     *(dest++) = palette_colour;
     *(dest++) = palette_colour;
     dest = (libspectrum_word*)
-      ( (libspectrum_byte*)dest_base + tmp_screen->pitch);
+      ( (libspectrum_byte*)dest_base + plot_screen->pitch);
     *(dest++) = palette_colour;
     *(dest++) = palette_colour;
   } else {
     dest =
-      (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
-                           (x+1) * tmp_screen->format->BytesPerPixel +
-                           (y+1) * tmp_screen->pitch);
+      (libspectrum_word*)( (libspectrum_byte*)plot_screen->pixels +
+                           (x+plot_offset) * plot_screen->format->BytesPerPixel +
+                           (y+plot_offset) * plot_screen->pitch);
 
     *dest = palette_colour;
   }
@@ -1587,12 +2176,27 @@ uidisplay_area_overlay( SDL_Surface* area, int length, widget_overlay_callback_f
 
   SDL_Rect r2 = { 0, 0, ( length + 3 ) * scale, od_icon_position.status_line.h * scale };
 
-  SDL_FillRect(area, NULL, settings_current.bw_tv ? bw_values_a[18] : colour_values_a[18]);
-  SDL_FillRect(area, &r2, settings_current.bw_tv ? bw_values_a[17] : colour_values_a[17]);
+  if( !od_status_line_contents.valid ||
+      od_status_line_contents.print_info != print_info ||
+      od_status_line_contents.generation != ui_widget_overlay_generation ||
+      od_status_line_contents.length != length ||
+      od_status_line_contents.scale != scale ||
+      od_status_line_contents.bw_tv != settings_current.bw_tv ) {
 
-  overlay_alpha_surface = area;
-  print_info();
-  overlay_alpha_surface = NULL;
+    SDL_FillRect(area, NULL, settings_current.bw_tv ? bw_values_a[18] : colour_values_a[18]);
+    SDL_FillRect(area, &r2, settings_current.bw_tv ? bw_values_a[17] : colour_values_a[17]);
+
+    overlay_alpha_surface = area;
+    print_info();
+    overlay_alpha_surface = NULL;
+
+    od_status_line_contents.valid = 1;
+    od_status_line_contents.print_info = print_info;
+    od_status_line_contents.generation = ui_widget_overlay_generation;
+    od_status_line_contents.length = length;
+    od_status_line_contents.scale = scale;
+    od_status_line_contents.bw_tv = settings_current.bw_tv;
+  }
 
   SDL_BlitSurface(area, NULL, tmp_screen, &r1);
 
@@ -1617,8 +2221,6 @@ uidisplay_status_overlay( void ) {
 static void
 uidisplay_show_msg_info_overlay(void) {
   /* 150 frames. 3 seconds */
-
-  fprintf( stderr, "%i: frames_since_last_overlay_message_info x\n", frames_since_last_overlay_message_info);
   if ( frames_since_last_overlay_message_info > 150 ) {
     od_show_msg_info = 0;
     return;
@@ -1630,8 +2232,10 @@ uidisplay_show_msg_info_overlay(void) {
 
 #if VKEYBOARD
 void
-uidisplay_vkeyboard( void (*print_fn)(void), int position ) {
+uidisplay_vkeyboard( void (*print_fn)( int redraw_all ), int position ) {
   static int old_position = -1;
+  static int canvas_bw_tv = -1;
+  int redraw_all = 0;
   int current_position;
   static SDL_Rect *current_positions = &vkeyboard_position[0];
 
@@ -1697,9 +2301,16 @@ uidisplay_vkeyboard( void (*print_fn)(void), int position ) {
                   machine_current->timex ? VKEYB_HEIGHT * 2 : VKEYB_HEIGHT };
 
 #ifdef GCWZERO
-  if ( !init_vkeyboard_canvas ) {
+  if ( !init_vkeyboard_canvas || canvas_bw_tv != settings_current.bw_tv ) {
     SDL_FillRect(keyb_screen, NULL, settings_current.bw_tv ? bw_values_a[16] : colour_values_a[16]);
     init_vkeyboard_canvas = 1;
+    canvas_bw_tv = settings_current.bw_tv;
+    redraw_all = 1;
+  }
+#else
+  if ( !init_vkeyboard_canvas ) {
+    init_vkeyboard_canvas = 1;
+    redraw_all = 1;
   }
 #endif
 
@@ -1717,7 +2328,7 @@ uidisplay_vkeyboard( void (*print_fn)(void), int position ) {
   }
 
   overlay_alpha_surface = keyb_screen;
-  print_fn();
+  print_fn( redraw_all );
   overlay_alpha_surface = NULL;
 
   SDL_BlitSurface(keyb_screen, NULL, tmp_screen, &r1);
@@ -1765,6 +2376,76 @@ uidisplay_vkeyboard_end( void ) {
 }
 #endif /* VKEYBOARD */
 
+/* Expand the pixels of one byte of screen data into `dest'; `diff' is
+   the ink colour XORed with the paper colour */
+static inline void
+plot_expand8( libspectrum_word *dest, libspectrum_byte data,
+              libspectrum_word paper, libspectrum_word diff )
+{
+  const libspectrum_word *mask = plot_masks[ data ];
+
+  dest[0] = paper ^ ( diff & mask[0] );
+  dest[1] = paper ^ ( diff & mask[1] );
+  dest[2] = paper ^ ( diff & mask[2] );
+  dest[3] = paper ^ ( diff & mask[3] );
+  dest[4] = paper ^ ( diff & mask[4] );
+  dest[5] = paper ^ ( diff & mask[5] );
+  dest[6] = paper ^ ( diff & mask[6] );
+  dest[7] = paper ^ ( diff & mask[7] );
+}
+
+/* The same, but with every pixel doubled for the Timex hi-res modes */
+static inline void
+plot_expand8_wide( libspectrum_word *dest, libspectrum_byte data,
+                   libspectrum_word paper, libspectrum_word diff )
+{
+  const libspectrum_word *mask = plot_masks[ data ];
+  libspectrum_word pixel;
+
+  pixel = paper ^ ( diff & mask[0] ); dest[ 0] = dest[ 1] = pixel;
+  pixel = paper ^ ( diff & mask[1] ); dest[ 2] = dest[ 3] = pixel;
+  pixel = paper ^ ( diff & mask[2] ); dest[ 4] = dest[ 5] = pixel;
+  pixel = paper ^ ( diff & mask[3] ); dest[ 6] = dest[ 7] = pixel;
+  pixel = paper ^ ( diff & mask[4] ); dest[ 8] = dest[ 9] = pixel;
+  pixel = paper ^ ( diff & mask[5] ); dest[10] = dest[11] = pixel;
+  pixel = paper ^ ( diff & mask[6] ); dest[12] = dest[13] = pixel;
+  pixel = paper ^ ( diff & mask[7] ); dest[14] = dest[15] = pixel;
+}
+
+/* The same again, as palette indices for index_screen */
+static inline void
+index_expand8( libspectrum_byte *dest, libspectrum_byte data,
+               libspectrum_byte paper, libspectrum_byte diff )
+{
+  const libspectrum_byte *mask = index_masks[ data ];
+
+  dest[0] = paper ^ ( diff & mask[0] );
+  dest[1] = paper ^ ( diff & mask[1] );
+  dest[2] = paper ^ ( diff & mask[2] );
+  dest[3] = paper ^ ( diff & mask[3] );
+  dest[4] = paper ^ ( diff & mask[4] );
+  dest[5] = paper ^ ( diff & mask[5] );
+  dest[6] = paper ^ ( diff & mask[6] );
+  dest[7] = paper ^ ( diff & mask[7] );
+}
+
+static inline void
+index_expand8_wide( libspectrum_byte *dest, libspectrum_byte data,
+                    libspectrum_byte paper, libspectrum_byte diff )
+{
+  const libspectrum_byte *mask = index_masks[ data ];
+  libspectrum_byte pixel;
+
+  pixel = paper ^ ( diff & mask[0] ); dest[ 0] = dest[ 1] = pixel;
+  pixel = paper ^ ( diff & mask[1] ); dest[ 2] = dest[ 3] = pixel;
+  pixel = paper ^ ( diff & mask[2] ); dest[ 4] = dest[ 5] = pixel;
+  pixel = paper ^ ( diff & mask[3] ); dest[ 6] = dest[ 7] = pixel;
+  pixel = paper ^ ( diff & mask[4] ); dest[ 8] = dest[ 9] = pixel;
+  pixel = paper ^ ( diff & mask[5] ); dest[10] = dest[11] = pixel;
+  pixel = paper ^ ( diff & mask[6] ); dest[12] = dest[13] = pixel;
+  pixel = paper ^ ( diff & mask[7] ); dest[14] = dest[15] = pixel;
+}
+
 /* Print the 8 pixels in `data' using ink colour `ink' and paper
    colour `paper' to the screen at ( (8*x) , y ) */
 void
@@ -1772,62 +2453,49 @@ uidisplay_plot8( int x, int y, libspectrum_byte data,
 	         libspectrum_byte ink, libspectrum_byte paper )
 {
   libspectrum_word *dest;
-  Uint32 *palette_values = settings_current.bw_tv ? bw_values :
-                           colour_values;
+  Uint32 *palette_values;
+  libspectrum_word palette_paper, palette_diff;
 
-  Uint32 palette_ink = palette_values[ ink ];
-  Uint32 palette_paper = palette_values[ paper ];
+  if( sdldisplay_index_plotting() ) {
+    libspectrum_byte *index;
 
-  if( machine_current->timex ) {
-    int i;
-    libspectrum_word *dest_base;
+    if( machine_current->timex ) {
+      x <<= 4; y <<= 1;
+      index = index_screen + y * image_width + x;
+      index_expand8_wide( index, data, paper, ink ^ paper );
+      index_expand8_wide( index + image_width, data, paper, ink ^ paper );
+    } else {
+      x <<= 3;
+      index = index_screen + y * image_width + x;
+      index_expand8( index, data, paper, ink ^ paper );
+    }
+    return;
+  }
 
+  palette_values = settings_current.bw_tv ? bw_values : colour_values;
+  palette_paper = palette_values[ paper ];
+  palette_diff = palette_values[ ink ] ^ palette_paper;
+
+  if( machine_current->timex ) {
     x <<= 4; y <<= 1;
 
-    dest_base =
-      (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
-                           (x+1) * tmp_screen->format->BytesPerPixel +
-                           (y+1) * tmp_screen->pitch);
-
-    for( i=0; i<2; i++ ) {
-      dest = dest_base;
-
-      *(dest++) = ( data & 0x80 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x80 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x40 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x40 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x20 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x20 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x10 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x10 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x08 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x08 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x04 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x04 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x02 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x02 ) ? palette_ink : palette_paper;
-      *(dest++) = ( data & 0x01 ) ? palette_ink : palette_paper;
-      *dest     = ( data & 0x01 ) ? palette_ink : palette_paper;
-
-      dest_base = (libspectrum_word*)
-        ( (libspectrum_byte*)dest_base + tmp_screen->pitch);
-    }
+    dest =
+      (libspectrum_word*)( (libspectrum_byte*)plot_screen->pixels +
+                           (x+plot_offset) * plot_screen->format->BytesPerPixel +
+                           (y+plot_offset) * plot_screen->pitch);
+
+    plot_expand8_wide( dest, data, palette_paper, palette_diff );
+    dest = (libspectrum_word*)( (libspectrum_byte*)dest + plot_screen->pitch );
+    plot_expand8_wide( dest, data, palette_paper, palette_diff );
   } else {
     x <<= 3;
 
     dest =
-      (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
-                           (x+1) * tmp_screen->format->BytesPerPixel +
-                           (y+1) * tmp_screen->pitch);
+      (libspectrum_word*)( (libspectrum_byte*)plot_screen->pixels +
+                           (x+plot_offset) * plot_screen->format->BytesPerPixel +
+                           (y+plot_offset) * plot_screen->pitch);
 
-    *(dest++) = ( data & 0x80 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x40 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x20 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x10 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x08 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x04 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x02 ) ? palette_ink : palette_paper;
-    *dest     = ( data & 0x01 ) ? palette_ink : palette_paper;
+    plot_expand8( dest, data, palette_paper, palette_diff );
   }
 }
 
@@ -1837,44 +2505,195 @@ void
 uidisplay_plot16( int x, int y, libspectrum_word data,
 		  libspectrum_byte ink, libspectrum_byte paper )
 {
-  libspectrum_word *dest_base, *dest;
-  int i;
-  Uint32 *palette_values = settings_current.bw_tv ? bw_values :
-                           colour_values;
-  Uint32 palette_ink = palette_values[ ink ];
-  Uint32 palette_paper = palette_values[ paper ];
+  libspectrum_word *dest;
+  Uint32 *palette_values;
+  libspectrum_word palette_paper, palette_diff;
   x <<= 4; y <<= 1;
 
-  dest_base =
-    (libspectrum_word*)( (libspectrum_byte*)tmp_screen->pixels +
-                         (x+1) * tmp_screen->format->BytesPerPixel +
-                         (y+1) * tmp_screen->pitch);
+  if( sdldisplay_index_plotting() ) {
+    libspectrum_byte *index = index_screen + y * image_width + x;
 
-  for( i=0; i<2; i++ ) {
-    dest = dest_base;
-
-    *(dest++) = ( data & 0x8000 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x4000 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x2000 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x1000 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0800 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0400 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0200 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0100 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0080 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0040 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0020 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0010 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0008 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0004 ) ? palette_ink : palette_paper;
-    *(dest++) = ( data & 0x0002 ) ? palette_ink : palette_paper;
-    *dest     = ( data & 0x0001 ) ? palette_ink : palette_paper;
-
-    dest_base = (libspectrum_word*)
-      ( (libspectrum_byte*)dest_base + tmp_screen->pitch);
+    index_expand8( index,     data >> 8,   paper, ink ^ paper );
+    index_expand8( index + 8, data & 0xff, paper, ink ^ paper );
+    index += image_width;
+    index_expand8( index,     data >> 8,   paper, ink ^ paper );
+    index_expand8( index + 8, data & 0xff, paper, ink ^ paper );
+    return;
+  }
+
+  palette_values = settings_current.bw_tv ? bw_values : colour_values;
+  palette_paper = palette_values[ paper ];
+  palette_diff = palette_values[ ink ] ^ palette_paper;
+
+  dest =
+    (libspectrum_word*)( (libspectrum_byte*)plot_screen->pixels +
+                         (x+plot_offset) * plot_screen->format->BytesPerPixel +
+                         (y+plot_offset) * plot_screen->pitch);
+
+  plot_expand8( dest,     data >> 8,   palette_paper, palette_diff );
+  plot_expand8( dest + 8, data & 0xff, palette_paper, palette_diff );
+  dest = (libspectrum_word*)( (libspectrum_byte*)dest + plot_screen->pitch );
+  plot_expand8( dest,     data >> 8,   palette_paper, palette_diff );
+  plot_expand8( dest + 8, data & 0xff, palette_paper, palette_diff );
+}
+
+/* Show the changed areas of sdldisplay_gc */
+static void
+sdldisplay_flip( SDL_Rect *rects, int count )
+{
+#ifdef GCWZERO
+  if ( sdldisplay_is_triple_buffer ) {
+    SDL_Flip( sdldisplay_gc );
+    /* On new kmsdrm driver no need to Flip page to deactivate triple buffer */
+    if ( sdldisplay_od_system_type != OPENDINGUX )
+      if ( ++sdldisplay_flips_triple_buffer >= 3 ) sdldisplay_flips_triple_buffer = 0;
+  } else
+#endif
+  SDL_UpdateRects( sdldisplay_gc, count, rects );
+}
+
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+
+/*
+ * Presenting frames on a separate thread: at the end of each frame the
+ * changed rows of tmp_screen are copied into render_screen and handed
+ * over, and the render thread does the scaling and the flip while the
+ * next frame is emulated. If the render thread is still busy, the
+ * dirty areas are kept and handed over at the end of the next frame
+ */
+
+static pthread_t render_thread;
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+
+static int render_thread_running = 0;
+static int render_pending, render_quit;
+
+static SDL_Surface *render_screen = NULL;
+static SDL_Rect render_rects[MAX_UPDATE_RECT];
+static int render_num_rects, render_full;
+
+static void*
+sdldisplay_render_thread_fn( void *arg GCC_UNUSED )
+{
+  thread_sched_apply( THREAD_SCHED_RENDER );
+
+  pthread_mutex_lock( &render_mutex );
+
+  while( 1 ) {
+
+    while( !render_pending && !render_quit )
+      pthread_cond_wait( &render_cond, &render_mutex );
+
+    if( render_quit ) break;
+
+    /* render_screen and render_rects belong to us until we clear
+       render_pending */
+    pthread_mutex_unlock( &render_mutex );
+
+    sdldisplay_fullscreen_from( render_screen, render_rects,
+                                &render_num_rects, render_full );
+
+    if( SDL_MUSTLOCK( sdldisplay_gc ) ) SDL_LockSurface( sdldisplay_gc );
+    if( SDL_MUSTLOCK( sdldisplay_gc ) ) SDL_UnlockSurface( sdldisplay_gc );
+
+    sdldisplay_flip( render_rects, render_num_rects );
+
+    pthread_mutex_lock( &render_mutex );
+    render_pending = 0;
   }
+
+  pthread_mutex_unlock( &render_mutex );
+
+  return NULL;
 }
 
+static void
+sdldisplay_render_thread_start( void )
+{
+  if( render_thread_running || !tmp_screen ) return;
+
+  render_screen = SDL_CreateRGBSurface( SDL_SWSURFACE, tmp_screen->w,
+                                        tmp_screen->h, 16,
+                                        tmp_screen->format->Rmask,
+                                        tmp_screen->format->Gmask,
+                                        tmp_screen->format->Bmask,
+                                        tmp_screen->format->Amask );
+  if( !render_screen ) return;
+
+  render_pending = render_quit = 0;
+
+  if( pthread_create( &render_thread, NULL, sdldisplay_render_thread_fn,
+                      NULL ) ) {
+    fprintf( stderr, "%s: couldn't start render thread\n", fuse_progname );
+    SDL_FreeSurface( render_screen ); render_screen = NULL;
+    settings_current.sdl_render_thread = 0;
+    return;
+  }
+
+  render_thread_running = 1;
+}
+
+/* Wait for the render thread to finish its frame and stop it; must be
+   done before any of the surfaces it uses go away */
+static void
+sdldisplay_render_thread_stop( void )
+{
+  if( !render_thread_running ) return;
+
+  pthread_mutex_lock( &render_mutex );
+  render_quit = 1;
+  pthread_cond_signal( &render_cond );
+  pthread_mutex_unlock( &render_mutex );
+
+  pthread_join( render_thread, NULL );
+  render_thread_running = 0;
+
+  SDL_FreeSurface( render_screen ); render_screen = NULL;
+}
+
+/* Hand the current frame to the render thread. Returns non-zero if it
+   is still busy with the previous one */
+static int
+sdldisplay_render_publish( void )
+{
+  int i, top = tmp_screen->h, bottom = 0;
+
+  pthread_mutex_lock( &render_mutex );
+
+  if( render_pending ) {
+    pthread_mutex_unlock( &render_mutex );
+    return 1;
+  }
+
+  /* Copy every row touched by a dirty rectangle, allowing for the one
+     pixel margin in tmp_screen */
+  for( i = 0; i < num_rects; i++ ) {
+    if( updated_rects[i].y < top ) top = updated_rects[i].y;
+    if( updated_rects[i].y + updated_rects[i].h + 2 > bottom )
+      bottom = updated_rects[i].y + updated_rects[i].h + 2;
+  }
+  if( bottom > tmp_screen->h ) bottom = tmp_screen->h;
+
+  if( top < bottom )
+    memcpy( (libspectrum_byte*)render_screen->pixels +
+              top * render_screen->pitch,
+            (libspectrum_byte*)tmp_screen->pixels + top * tmp_screen->pitch,
+            ( bottom - top ) * tmp_screen->pitch );
+
+  memcpy( render_rects, updated_rects, num_rects * sizeof( SDL_Rect ) );
+  render_num_rects = num_rects;
+  render_full = sdldisplay_present_full;
+
+  render_pending = 1;
+  pthread_cond_signal( &render_cond );
+  pthread_mutex_unlock( &render_mutex );
+
+  return 0;
+}
+
+#endif			/* #if defined( MIYOO ) && defined( HAVE_PTHREAD ) */
+
 void
 uidisplay_frame_end( void )
 {
@@ -1882,6 +2701,8 @@ uidisplay_frame_end( void )
   #ifndef MIYOO
   SDL_Rect *r;
   SDL_Rect *last_rect;
+  #else
+  int overlays;
   #endif
   Uint32 tmp_screen_pitch, dstPitch;
 
@@ -1893,6 +2714,9 @@ uidisplay_frame_end( void )
 #ifdef GCWZERO
   if ( ( sdldisplay_is_full_screen != settings_current.full_screen  ||
       sdldisplay_is_triple_buffer != settings_current.od_triple_buffer ||
+#ifndef MIYOO
+      sdldisplay_is_hardware_scaling != settings_current.od_hardware_scaling ||
+#endif
       sdldisplay_last_od_border != sdldisplay_current_od_border ) &&
 #else
   if( sdldisplay_is_full_screen != settings_current.full_screen &&
@@ -1902,6 +2726,22 @@ uidisplay_frame_end( void )
     fuse_abort();
   }
 
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+  if( settings_current.sdl_render_thread && !render_thread_running ) {
+    sdldisplay_end_direct( 1 );
+    sdldisplay_render_thread_start();
+  } else if( !settings_current.sdl_render_thread && render_thread_running ) {
+    sdldisplay_render_thread_stop();
+  }
+#endif
+
+#ifdef MIYOO
+  /* Anything about to be drawn over the image has to go via tmp_screen */
+  if( !sdldisplay_direct_possible() ) sdldisplay_end_direct( 1 );
+#endif
+
+  sdldisplay_index_update();
+
 #if VKEYBOARD
   if ( vkeyboard_enabled )
     ui_widget_print_vkeyboard();
@@ -1917,6 +2757,16 @@ uidisplay_frame_end( void )
 
 #endif
 
+#ifdef MIYOO
+  /* Overlays are redrawn every frame, and so then is everything under
+     them; once they go away, the screen has to be cleaned up too */
+  overlays = sdldisplay_overlays_active();
+  if( overlays || sdldisplay_overlays_shown )
+    sdldisplay_force_full_refresh = 1;
+  sdldisplay_overlays_shown = overlays;
+
+  sdldisplay_damage_collect();
+#else				/* #ifdef MIYOO */
   /* Force a full redraw if requested */
 #ifdef GCWZERO
   if ( sdldisplay_force_full_refresh || sdldisplay_is_triple_buffer ) {
@@ -1930,13 +2780,34 @@ uidisplay_frame_end( void )
     updated_rects[0].w = image_width;
     updated_rects[0].h = image_height;
   }
+#endif				/* #ifdef MIYOO */
 
-  if ( !(ui_widget_level >= 0) && num_rects == 0 && !sdl_status_updated )
+  /* While the emulation is locked to the display, every frame has to be
+     flipped, changed or not */
+  if ( !(ui_widget_level >= 0) && num_rects == 0 && !sdl_status_updated &&
+       !timer_vsync_locked )
     return;
+
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+  if( render_thread_running ) {
+    if( settings_current.statusbar )
+      sdl_icon_overlay( tmp_screen->pitch, sdldisplay_gc->pitch );
+
+    /* If the render thread is busy, its page keeps the changes for next
+       time */
+    if( !sdldisplay_render_publish() ) sdldisplay_damage_presented();
+    num_rects = 0;
+
+    /* The flips happen on the render thread, so they can't pace us */
+    timer_vsync_reset();
+    return;
+  }
+#endif
   
   //Miyoo 
   #ifdef MIYOO
-    uidisplay_fullscreen();
+    sdldisplay_fullscreen_from( tmp_screen, updated_rects, &num_rects,
+                                sdldisplay_present_full );
   #endif
 
   if( SDL_MUSTLOCK( sdldisplay_gc ) ) SDL_LockSurface( sdldisplay_gc );
@@ -2005,25 +2876,34 @@ uidisplay_frame_end( void )
   if( SDL_MUSTLOCK( sdldisplay_gc ) ) SDL_UnlockSurface( sdldisplay_gc );
 
   /* Finally, blit all our changes to the screen */
+  sdldisplay_flip( updated_rects, num_rects );
+
 #ifdef GCWZERO
-  if ( sdldisplay_is_triple_buffer ) {
-    SDL_Flip( sdldisplay_gc );
-    /* On new kmsdrm driver no need to Flip page to deactivate triple buffer */
-    if ( sdldisplay_od_system_type != OPENDINGUX )
-      if ( ++sdldisplay_flips_triple_buffer >= 3 ) sdldisplay_flips_triple_buffer = 0;
-  } else
+  /* Flips of a double or triple buffered display wait for its refresh */
+  if( sdldisplay_is_triple_buffer ) {
+    timer_vsync();
+  } else {
+    timer_vsync_reset();
+  }
 #endif
-  SDL_UpdateRects( sdldisplay_gc, num_rects, updated_rects );
 
   num_rects = 0;
   #ifndef MIYOO
   sdldisplay_force_full_refresh = 0;
+  #else
+  sdldisplay_damage_presented();
+
+  if( plot_screen != sdldisplay_gc && sdldisplay_direct_possible() )
+    sdldisplay_start_direct();
   #endif
 }
 
 void
 uidisplay_area( int x, int y, int width, int height )
 {
+  if( sdldisplay_index_plotting() )
+    sdldisplay_index_area( x, y, width, height );
+
   if ( sdldisplay_force_full_refresh )
     return;
 
@@ -2052,10 +2932,17 @@ uidisplay_end( void )
 
   display_ui_initialised = 0;
 
-  if ( tmp_screen ) {
-    free( tmp_screen->pixels );
-    SDL_FreeSurface( tmp_screen ); tmp_screen = NULL;
-  }
+#if defined( MIYOO ) && defined( HAVE_PTHREAD )
+  sdldisplay_render_thread_stop();
+#endif
+
+  plot_screen = NULL; plot_offset = 1;
+
+  sdldisplay_free_tmp_screen( &tmp_screen );
+  sdldisplay_free_widget_layer();
+  free( index_screen ); index_screen = NULL; index_synced = 0;
+  memory_usage_set( MEMORY_USAGE_SCALER, 0 );
+  sdldisplay_mode_width = sdldisplay_mode_height = 0;
 
   if( saved ) {
     SDL_FreeSurface( saved ); saved = NULL;
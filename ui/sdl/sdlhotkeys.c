@@ -30,6 +30,9 @@
 #include "savestates/savestates.h"
 #include "ui/hotkeys.h"
 #include "options.h"
+#include "rewind.h"
+#include "rzx.h"
+#include "timer/timer.h"
 
 #ifdef GCWZERO
 #define MAX_COMBO_KEYS_PENDING 10
@@ -63,6 +66,9 @@ static const char * const od_border[] = {
 #define DROP_EVENT 0
 #define PUSH_EVENT 1
 
+/* How far the slot combos move through an RZX file being played back */
+#define RZX_SCRUB_FRAMES ( 10 * 50 )
+
 /*
  Current keys used in combos: L1, R1, Select, Start, X, Y, A, B
 */
@@ -84,6 +90,7 @@ static const char * const od_border[] = {
     L1 + R1 + A      Toggle Full/None border size
     L1 + R1 + B      Toggle triple buffer
     L1 + R1 + X      Joystick
+    L1 + R1 + Y      Toggle turbo mode
 
     L1 + Select + Y  Tape play (F8)
 
@@ -96,6 +103,9 @@ static const char * const od_border[] = {
     R1 + B           Reset machine (F5)
     R1 + X           Exit fuse (F10)
     R1 + Y           Machine select (F9)
+    R1 + Down        Rewind
+    R1 + Right       Increase slot (forward 10s in RZX playback)
+    R1 + Left        Decrease slot (back 10s in RZX playback)
 */
 
 
@@ -104,9 +114,11 @@ static const char * const od_border[] = {
     L1 + R1          Exit fuse
     R + A            Load state - Open file (F3)
     R + B            Save state - Save file (F2)
-    R + Right        Increase Slot
-    R + Left         Decrease Slot
+    R + Right        Increase Slot (forward 10s in RZX playback)
+    R + Left         Decrease Slot (back 10s in RZX playback)
     R + Y           Machine select (F9)
+    R + X            Toggle turbo mode
+    R + Down         Rewind
 
     L + A            Fullscreen
     L + B            Status bar
@@ -127,12 +139,15 @@ static const char * const od_border[] = {
 #define INCREASE_SLOT   (FLAG_R1|FLAG_RIGHT)
 #define DECREASE_SLOT   (FLAG_R1|FLAG_LEFT)
 #define MACHINE_SELECT  (FLAG_R1|FLAG_Y)
+#define TURBO           (FLAG_R1|FLAG_X)
+#define REWIND          (FLAG_R1|FLAG_DOWN)
 
 #else
 
 #define OPEN_JOYSTICK   (FLAG_L1|FLAG_R1|FLAG_X)
 #define TRIPLE_BUFFER   (FLAG_L1|FLAG_R1|FLAG_B)
 #define CHANGE_BORDER   (FLAG_L1|FLAG_R1|FLAG_A)
+#define TURBO           (FLAG_L1|FLAG_R1|FLAG_Y)
 
 #define TAPE_PLAY       (FLAG_L1|FLAG_SELECT|FLAG_X)
 
@@ -151,6 +166,7 @@ static const char * const od_border[] = {
 #define DECREASE_SLOT   (FLAG_R1|FLAG_LEFT)
 
 #define QUICK_SAVE      (FLAG_L1|FLAG_DOWN)
+#define REWIND          (FLAG_R1|FLAG_DOWN)
 
 #endif
 
@@ -215,6 +231,8 @@ push_combo_event( Uint16* flags )
   int increase_save_slot = 0;
   int quicksave = 0;
   int quickload = 0;
+  int turbo = 0;
+  int step_back = 0;
 
   /* Nothing to do */
   if ( !flags ) return 0;
@@ -253,6 +271,12 @@ push_combo_event( Uint16* flags )
   case MACHINE_SELECT:
     combo_key = SDLK_F9; break;
 
+  case TURBO:
+    turbo = 1; break;
+
+  case REWIND:
+    step_back = 1; break;
+
   default:
     break;
   }
@@ -267,6 +291,12 @@ push_combo_event( Uint16* flags )
   case TRIPLE_BUFFER:
     toggle_triple_buffer = 1; break;
 
+  case TURBO:
+    turbo = 1; break;
+
+  case REWIND:
+    step_back = 1; break;
+
   case TAPE_PLAY:
     combo_key = SDLK_F8; break;
 
@@ -328,6 +358,30 @@ push_combo_event( Uint16* flags )
     combo_done = 1;
     return 1;
 
+  /* Switch turbo mode */
+  } else if ( turbo ) {
+    timer_set_turbo( !timer_turbo );
+    ui_widget_show_msg_update_info( "Turbo %s", timer_turbo ? "on" : "off" );
+
+    /* Clean flags and mark combo as done */
+    *flags = 0x0000;
+    combo_done = 1;
+    return 1;
+
+  /* Go back to the last rewind state */
+  } else if ( step_back ) {
+    if ( !settings_current.rewind )
+      ui_widget_show_msg_update_info( "Rewind is off" );
+    else if ( rewind_step_back() )
+      ui_widget_show_msg_update_info( "Nothing to rewind" );
+    else
+      ui_widget_show_msg_update_info( "Rewind" );
+
+    /* Clean flags and mark combo as done */
+    *flags = 0x0000;
+    combo_done = 1;
+    return 1;
+
   /* Switch triple buffer */
   } else if ( toggle_triple_buffer ) {
     settings_current.od_triple_buffer = !settings_current.od_triple_buffer;
@@ -409,6 +463,32 @@ push_combo_event( Uint16* flags )
     #endif
     return 1;
 
+  /* While playing back a recording, the slot keys scrub through it */
+  } else if ( increase_save_slot && rzx_playback ) {
+    size_t position = rzx_playback_position();
+    size_t length = rzx_playback_length();
+
+    if ( increase_save_slot > 0 )
+      position += RZX_SCRUB_FRAMES;
+    else
+      position = position > RZX_SCRUB_FRAMES ? position - RZX_SCRUB_FRAMES : 0;
+
+    if ( rzx_seek( position ) ) {
+      ui_widget_show_msg_update_info( "Can't go back any further" );
+    } else {
+      if ( position >= length ) position = length ? length - 1 : 0;
+      ui_widget_show_msg_update_info( "RZX %lu:%02lu / %lu:%02lu",
+                                      (unsigned long)position / 50 / 60,
+                                      (unsigned long)position / 50 % 60,
+                                      (unsigned long)length / 50 / 60,
+                                      (unsigned long)length / 50 % 60 );
+    }
+
+    /* Clean flags and mark combo as done */
+    *flags = 0x0000;
+    combo_done = 1;
+    return 1;
+
   } else if (increase_save_slot ) {
     if ( increase_save_slot > 0 ) {
       if ( settings_current.od_quicksave_slot < 99 ) settings_current.od_quicksave_slot++;
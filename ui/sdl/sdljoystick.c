@@ -32,6 +32,8 @@
 
 #else			/* #if !defined USE_JOYSTICK || defined HAVE_JSW_H */
 
+#include <string.h>
+
 #include <SDL.h>
 
 #include "compat.h"
@@ -44,6 +46,13 @@
 static SDL_Joystick *joystick1 = NULL;
 static SDL_Joystick *joystick2 = NULL;
 
+/* Which directions each stick's axes and hat were last reported as
+   pushing, indexed by input_key - INPUT_JOYSTICK_UP. An analogue stick
+   sends a stream of motion events as it moves, but almost none of them
+   change anything the Spectrum can see, so only changes are passed on */
+static int axis_states[2][4];
+static int hat_states[2][4];
+
 static void do_axis( int which, Sint16 value, input_key negative,
 		     input_key positive );
 static void do_hat( int which, Uint8 value, Uint8 mask, input_key direction );
@@ -53,6 +62,9 @@ ui_joystick_init( void )
 {
   int error, retval;
 
+  memset( axis_states, 0, sizeof( axis_states ) );
+  memset( hat_states, 0, sizeof( hat_states ) );
+
 #ifdef UI_SDL
   error = SDL_InitSubSystem( SDL_INIT_JOYSTICK );
 #else
@@ -174,29 +186,32 @@ sdljoystick_axismove( SDL_JoyAxisEvent *axisevent )
   }
 }
 
+/* Tell the emulation about `direction' being pressed or released, but only
+   if that's different from what it was last told */
+static void
+set_direction( int *states, int which, input_key direction, int pressed )
+{
+  input_event_t event;
+  int *state = &states[ direction - INPUT_JOYSTICK_UP ];
+
+  if( *state == pressed ) return;
+  *state = pressed;
+
+  event.type = pressed ? INPUT_EVENT_JOYSTICK_PRESS :
+                         INPUT_EVENT_JOYSTICK_RELEASE;
+  event.types.joystick.which = which;
+  event.types.joystick.button = direction;
+
+  input_event( &event );
+}
+
 static void
 do_axis( int which, Sint16 value, input_key negative, input_key positive )
 {
-  input_event_t event1, event2;
-
-  event1.types.joystick.which = event2.types.joystick.which = which;
-
-  event1.types.joystick.button = negative;
-  event2.types.joystick.button = positive;
-
-  if( value > 16384 ) {
-    event1.type = INPUT_EVENT_JOYSTICK_RELEASE;
-    event2.type = INPUT_EVENT_JOYSTICK_PRESS;
-  } else if( value < -16384 ) {
-    event1.type = INPUT_EVENT_JOYSTICK_PRESS;
-    event2.type = INPUT_EVENT_JOYSTICK_RELEASE;
-  } else {
-    event1.type = INPUT_EVENT_JOYSTICK_RELEASE;
-    event2.type = INPUT_EVENT_JOYSTICK_RELEASE;
-  }
+  if( which < 0 || which >= 2 ) return;
 
-  input_event( &event1 );
-  input_event( &event2 );
+  set_direction( axis_states[ which ], which, negative, value < -16384 );
+  set_direction( axis_states[ which ], which, positive, value > 16384 );
 }
 
 void
@@ -218,18 +233,9 @@ sdljoystick_hatmove( SDL_JoyHatEvent *hatevent )
 static void
 do_hat( int which, Uint8 value, Uint8 mask, input_key direction )
 {
-  input_event_t event;
+  if( which < 0 || which >= 2 ) return;
 
-  event.types.joystick.which = which;
-  event.types.joystick.button = direction;
-
-  event.type = INPUT_EVENT_JOYSTICK_RELEASE;
-  input_event( &event );
-
-  if( value & mask ) {
-    event.type = INPUT_EVENT_JOYSTICK_PRESS;
-    input_event( &event );
-  }
+  set_direction( hat_states[ which ], which, direction, !!( value & mask ) );
 }
 
 void
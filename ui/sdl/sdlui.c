@@ -41,6 +41,7 @@
 #include "ui/vkeyboard.h"
 #endif
 #ifdef GCWZERO
+#include "savestates/savestates.h"
 #include "ui/hotkeys.h"
 #endif
 
@@ -85,6 +86,7 @@ int
 ui_event( void )
 {
   SDL_Event event;
+  int mouse_moved = 0, mouse_x = 128, mouse_y = 128;
 #if VKEYBOARD
   int vkeyboard_enabled_old = vkeyboard_enabled;
 #endif
@@ -105,11 +107,14 @@ ui_event( void )
       ui_mouse_button( event.button.button, 0 );
       break;
     case SDL_MOUSEMOTION:
+      /* The pointer is only put back in the middle once all the events
+         have been handled, so the last position seen is how far it's
+         moved since then */
       if( ui_mouse_grabbed ) {
-        ui_mouse_motion( event.motion.x - 128, event.motion.y - 128 );
-        if( event.motion.x != 128 || event.motion.y != 128 )
-          SDL_WarpMouse( 128, 128 );
-      }	
+        mouse_x = event.motion.x;
+        mouse_y = event.motion.y;
+        mouse_moved = 1;
+      }
       break;
 
 #if defined USE_JOYSTICK && !defined HAVE_JSW_H
@@ -147,6 +152,68 @@ ui_event( void )
     }
   }
 
+  if( mouse_moved && ui_mouse_grabbed &&
+      ( mouse_x != 128 || mouse_y != 128 ) ) {
+    ui_mouse_motion( mouse_x - 128, mouse_y - 128 );
+    SDL_WarpMouse( 128, 128 );
+  }
+
+#if VKEYBOARD
+  if ( vkeyboard_enabled_old && !vkeyboard_enabled )
+    uidisplay_vkeyboard_end();
+#endif
+
+#ifdef GCWZERO
+  savestate_frame();
+#endif
+
+  return 0;
+}
+
+int
+ui_event_input( void )
+{
+  SDL_Event event;
+#if VKEYBOARD
+  int vkeyboard_enabled_old = vkeyboard_enabled;
+#endif
+
+  /* Leave anything else in the queue for ui_event() at the end of the
+     frame */
+  SDL_PumpEvents();
+  while( SDL_PeepEvents( &event, 1, SDL_GETEVENT,
+                         SDL_KEYDOWNMASK | SDL_KEYUPMASK |
+                         SDL_JOYEVENTMASK ) > 0 ) {
+    switch ( event.type ) {
+    case SDL_KEYDOWN:
+      sdlkeyboard_keypress( &(event.key) );
+      break;
+    case SDL_KEYUP:
+      sdlkeyboard_keyrelease( &(event.key) );
+      break;
+
+#if defined USE_JOYSTICK && !defined HAVE_JSW_H
+
+    case SDL_JOYBUTTONDOWN:
+      sdljoystick_buttonpress( &(event.jbutton) );
+      break;
+    case SDL_JOYBUTTONUP:
+      sdljoystick_buttonrelease( &(event.jbutton) );
+      break;
+    case SDL_JOYAXISMOTION:
+      sdljoystick_axismove( &(event.jaxis) );
+      break;
+    case SDL_JOYHATMOTION:
+      sdljoystick_hatmove( &(event.jhat) );
+      break;
+
+#endif			/* if defined USE_JOYSTICK && !defined HAVE_JSW_H */
+
+    default:
+      break;
+    }
+  }
+
 #if VKEYBOARD
   if ( vkeyboard_enabled_old && !vkeyboard_enabled )
     uidisplay_vkeyboard_end();
@@ -820,3 +820,10 @@ uidisplay_frame_restore( void )
   /* FIXME: Restore saved framebuffer state as the widget UI wants to draw a
      new menu */
 }
+
+void
+uidisplay_frame_release( void )
+{
+  /* The widgets were drawn over the image, so redraw all of it */
+  display_refresh_all();
+}
@@ -96,6 +96,17 @@ ui_event( void )
   return 0;
 }
 
+int
+ui_event_input( void )
+{
+  keyboard_update();
+#if defined USE_JOYSTICK && !defined HAVE_JSW_H
+  joystick_update();
+#endif
+
+  return 0;
+}
+
 int ui_end(void)
 {
   int error;
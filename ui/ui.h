@@ -55,9 +55,15 @@ typedef enum ui_error_level {
 
 int ui_init(int *argc, char ***argv);
 int ui_event(void);
+
+/* Read any pending keyboard and joystick input and nothing else. Called
+   part way through a frame for --late-input; UIs which can't separate
+   input from their other events may do nothing */
+int ui_event_input( void );
 int ui_end(void);
 
 /* Error handling routines */
+void ui_error_init( void );
 int ui_error( ui_error_level severity, const char *format, ... )
      GCC_PRINTF( 2, 3 );
 libspectrum_error ui_libspectrum_error( libspectrum_error error,
@@ -241,6 +247,7 @@ typedef enum ui_menu_item {
   UI_MENU_ITEM_RECORDING,
   UI_MENU_ITEM_RECORDING_ROLLBACK,
   UI_MENU_ITEM_AY_LOGGING,
+  UI_MENU_ITEM_SOUND_RECORDING,
   UI_MENU_ITEM_TAPE_RECORDING,
 #ifdef GCWZERO
   UI_MENU_ITEM_JOYSTICKS_CONTROL_MAPPING,
@@ -311,6 +318,8 @@ char *ui_get_save_savestate( const char *title );
 #ifdef USE_WIDGET
 extern int od_show_msg_info;
 extern size_t od_msg_info_length;
+/* Changes whenever the status line or message text does */
+extern unsigned int ui_widget_overlay_generation;
 size_t ui_widget_statusbar_update_info( float speed );
 size_t ui_widget_show_msg_update_info( const char* msg, ... );
 void ui_widget_statusbar_print_info( void );
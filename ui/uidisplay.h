@@ -42,6 +42,10 @@ int uidisplay_hotswap_statusbar( void );
    it's work */
 void uidisplay_frame_save( void );
 void uidisplay_frame_restore( void );
+
+/* Called when the last widget has gone, to put the emulator's image back
+   on the screen */
+void uidisplay_frame_release( void );
 #endif                          /* #ifdef USE_WIDGET */
 
 int uidisplay_end(void);
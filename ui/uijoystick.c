@@ -61,9 +61,14 @@ static js_data_struct jsd[2];
 
 static int js_button_states[2][NUM_JOY_BUTTONS];
 
+/* Which way each stick's axes were last reported as being pushed: -1, 0
+   or 1. Any event on the device makes the axes be read again, but they
+   only become input events if they've actually changed */
+static int js_axis_states[2][2];
+
 static void poll_joystick( int which );
-static void do_axis( int which, double position, input_key negative,
-		     input_key positive );
+static void do_axis( int which, int axis, double position,
+		     input_key negative, input_key positive );
 
 static int
 init_stick( int which, const char *const device,
@@ -158,6 +163,7 @@ ui_joystick_init( void )
     for( j = 0; j < NUM_JOY_BUTTONS; j++ ) {
       js_button_states[i][j] = 0;
     }
+    js_axis_states[i][0] = js_axis_states[i][1] = 0;
   }
 
   /* If we can't init the first, don't try the second */
@@ -207,10 +213,10 @@ poll_joystick( int which )
   if( JSUpdate( joystick ) != JSGotEvent ) return;
 
   position = JSGetAxisCoeffNZ( joystick, 0 );
-  do_axis( which, position, INPUT_JOYSTICK_LEFT, INPUT_JOYSTICK_RIGHT );
+  do_axis( which, 0, position, INPUT_JOYSTICK_LEFT, INPUT_JOYSTICK_RIGHT );
 
   position = JSGetAxisCoeffNZ( joystick, 1 );
-  do_axis( which, position, INPUT_JOYSTICK_UP,   INPUT_JOYSTICK_DOWN  );
+  do_axis( which, 1, position, INPUT_JOYSTICK_UP,   INPUT_JOYSTICK_DOWN  );
 
   event.types.joystick.which = which;
 
@@ -238,9 +244,15 @@ poll_joystick( int which )
 }
 
 static void
-do_axis( int which, double position, input_key negative, input_key positive )
+do_axis( int which, int axis, double position, input_key negative,
+	 input_key positive )
 {
   input_event_t event1, event2;
+  int state;
+
+  state = position == 0.0 ? 0 : position > 0.0 ? 1 : -1;
+  if( js_axis_states[which][axis] == state ) return;
+  js_axis_states[which][axis] = state;
 
   event1.types.joystick.which = event2.types.joystick.which = which;
 
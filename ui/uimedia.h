@@ -55,6 +55,8 @@ typedef struct ui_media_drive_info_t
 
 int ui_media_drive_register( ui_media_drive_info_t *drive );
 void ui_media_drive_end( void );
+/* Called once a frame; writes changed disks back with --disk-autosave */
+void ui_media_drive_frame( void );
 ui_media_drive_info_t *ui_media_drive_find( int controller, int drive );
 
 #define UI_MEDIA_DRIVE_UPDATE_ALL	(~0)
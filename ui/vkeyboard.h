@@ -32,7 +32,9 @@
 
 extern int vkeyboard_enabled;
 void uidisplay_putpixel_alpha( int x, int y, int colour );
-void uidisplay_vkeyboard( void (*print_fn)(void), int position );
+/* print_fn draws the keys on the keyboard canvas, which keeps its contents
+   between frames; redraw_all is set when the canvas has been cleared */
+void uidisplay_vkeyboard( void (*print_fn)( int redraw_all ), int position );
 void uidisplay_vkeyboard_input( void (*input_fn)(input_key key), input_key key);
 void uidisplay_vkeyboard_release( void (*release_fn)(input_key key), input_key key);
 void uidisplay_vkeyboard_end( void);
@@ -39,6 +39,10 @@
 
 #define MAX_BLOCK_DESC 30
 
+/* How far left and right move through the tape */
+#define SEEK_STEP_SECONDS 10
+#define TAPE_TSTATES_PER_SECOND 3500000
+
 /* The descriptions of the blocks */
 static GSList *blocks;
 
@@ -52,6 +56,7 @@ static int top_line;
 static int highlight;
 
 static void show_blocks( void );
+static void show_time( void );
 static void add_block_description( libspectrum_tape_block *block,
 				   void *user_data );
 static void free_description( gpointer data, gpointer user_data );
@@ -68,6 +73,7 @@ widget_browse_draw( void *data GCC_UNUSED )
   widget_dialog_with_border( 1, 2, 30, 20 );
 
   widget_printstring( 10, 16, WIDGET_COLOUR_TITLE, "Browse Tape" );
+  show_time();
   widget_display_lines( 2, 1 );
 
   highlight = tape_get_current_block();
@@ -96,6 +102,52 @@ add_block_description( libspectrum_tape_block *block, void *user_data )
   block_count++;
 }
 
+/* Show how much of the tape is left to play */
+static void
+show_time( void )
+{
+  libspectrum_qword elapsed, total;
+  unsigned long seconds;
+  char buffer[16];
+
+  if( tape_get_times( &elapsed, &total ) ) return;
+
+  seconds = ( total - elapsed ) / TAPE_TSTATES_PER_SECOND;
+  snprintf( buffer, sizeof( buffer ), "%lu:%02lu left", seconds / 60,
+            seconds % 60 );
+  widget_printstring_right( 30 * 8, 16, WIDGET_COLOUR_TITLE, buffer );
+}
+
+/* Move the highlight to the block playing `seconds' after or before the
+   start of the highlighted block */
+static void
+seek_highlight( int seconds )
+{
+  libspectrum_qword time = tape_block_start_time( highlight ),
+    step = (libspectrum_qword)( seconds < 0 ? -seconds : seconds ) *
+           TAPE_TSTATES_PER_SECOND;
+  int block;
+
+  if( seconds < 0 ) {
+    time = time > step ? time - step : 0;
+  } else {
+    time += step;
+  }
+
+  block = tape_block_at_time( time );
+  if( block < 0 || block == highlight ) {
+    /* Always move at least one block */
+    block = highlight + ( seconds < 0 ? -1 : 1 );
+    if( block < 0 || block >= block_count ) return;
+  }
+
+  highlight = block;
+  if( highlight < top_line || highlight >= top_line + 18 ) {
+    top_line = highlight - 8; if( top_line < 0 ) top_line = 0;
+  }
+  show_blocks();
+}
+
 static void
 show_blocks( void )
 {
@@ -183,6 +235,20 @@ widget_browse_keyhandler( input_key key )
     }
     break;
 
+  case INPUT_KEY_Left:
+  case INPUT_KEY_5:
+  case INPUT_KEY_h:
+  case INPUT_JOYSTICK_LEFT:
+    seek_highlight( -SEEK_STEP_SECONDS );
+    break;
+
+  case INPUT_KEY_Right:
+  case INPUT_KEY_8:
+  case INPUT_KEY_l:
+  case INPUT_JOYSTICK_RIGHT:
+    seek_highlight( SEEK_STEP_SECONDS );
+    break;
+
 #ifdef GCWZERO
   case INPUT_KEY_Tab:
 #else
@@ -65,6 +65,8 @@ static void display_text( void );
 static void display_disasm( void );
 static void display_breakpts( void );
 
+static void debugger_update( void );
+
 /* Scrolling for the data displays */
 static void scroll( int step );
 
@@ -81,6 +83,190 @@ static inline const char *format_16_bit( void )
   return debugger_output_base == 10 ? "%-5d" : "%04X";
 }
 
+/* The text currently on screen, so that redrawing while the debugger
+   is up (scrolling, changing base, after a command) only touches what
+   has changed. Anything which doesn't fit, or a change of display,
+   just means everything is drawn again next time */
+typedef struct drawn_text {
+  int x, y, col;
+  int fixed, right;		/* Fixed width, or right aligned at `x' */
+  char text[ 80 ];
+  size_t length;
+  int seen;			/* Drawn again on this pass */
+} drawn_text;
+
+#define DRAWN_TEXT_MAX 128
+
+static drawn_text drawn[ DRAWN_TEXT_MAX ];
+static size_t drawn_count;
+static int drawn_valid = 0, drawn_display;
+
+static void drawn_print( const drawn_text *text );
+
+/* Where `text' is on screen */
+static void
+drawn_extent( const drawn_text *text, int *x, int *y, int *w )
+{
+  if( text->fixed ) {
+    *x = text->x * 8; *y = text->y * 8; *w = text->length * 8;
+    return;
+  }
+
+  *w = text->length ? widget_stringwidth( text->text ) + 1 : 0;
+  *x = text->right ? text->x - *w + 1 : text->x;
+  *y = text->y;
+}
+
+/* Blank out an area, and put back any other text it overlapped */
+static void
+drawn_blank( int x, int y, int w, const drawn_text *except )
+{
+  int tx, ty, tw;
+  size_t i;
+
+  if( w <= 0 ) return;
+
+  widget_rectangle( x, y, w, 8, 1 );
+
+  for( i = 0; i < drawn_count; i++ ) {
+    if( &drawn[i] == except ) continue;
+    drawn_extent( &drawn[i], &tx, &ty, &tw );
+    if( ty < y + 8 && y < ty + 8 && tx < x + w && x < tx + tw )
+      drawn_print( &drawn[i] );
+  }
+}
+
+static void
+drawn_clear( const drawn_text *text )
+{
+  int x, y, w;
+
+  drawn_extent( text, &x, &y, &w );
+  drawn_blank( x, y, w, text );
+}
+
+static void
+drawn_print( const drawn_text *text )
+{
+  size_t i;
+
+  if( !text->fixed ) {
+    if( text->right )
+      widget_printstring_right( text->x, text->y, text->col, text->text );
+    else
+      widget_printstring( text->x, text->y, text->col, text->text );
+    return;
+  }
+
+  for( i = 0; i < text->length; i++ )
+    widget_printchar_fixed( text->x + i, text->y, text->col,
+                            (libspectrum_byte)text->text[i] );
+}
+
+/* Put `length' characters of `s' at (x,y), unless they're already there.
+   Fixed width text may contain NULs; only the characters which differ
+   from what's there are redrawn */
+static void
+drawn_text_show( int x, int y, int col, int fixed, int right, const char *s,
+                 size_t length )
+{
+  drawn_text *text, replacement;
+  size_t i;
+
+  if( length >= sizeof( text->text ) ) length = sizeof( text->text ) - 1;
+
+  for( i = 0; i < drawn_count; i++ ) {
+    text = &drawn[i];
+    if( text->x == x && text->y == y && text->fixed == fixed &&
+        text->right == right && !text->seen ) break;
+  }
+
+  if( i == drawn_count ) {
+    if( drawn_count == DRAWN_TEXT_MAX ) {
+      /* Can't keep track of this, so draw it and start again next time */
+      replacement.x = x; replacement.y = y; replacement.col = col;
+      replacement.fixed = fixed; replacement.right = right;
+      memcpy( replacement.text, s, length );
+      replacement.text[ length ] = 0;
+      replacement.length = length;
+      drawn_print( &replacement );
+      drawn_valid = 0;
+      return;
+    }
+
+    text = &drawn[ drawn_count++ ];
+    text->x = x; text->y = y; text->col = col;
+    text->fixed = fixed; text->right = right;
+    text->length = length;
+    memcpy( text->text, s, length );
+    text->text[ length ] = 0;
+    text->seen = 1;
+    drawn_print( text );
+    return;
+  }
+
+  text->seen = 1;
+
+  if( text->col == col && text->length == length &&
+      !memcmp( text->text, s, length ) )
+    return;
+
+  if( fixed && text->col == col && text->length == length ) {
+    for( i = 0; i < length; i++ ) {
+      if( text->text[i] == s[i] ) continue;
+      text->text[i] = s[i];
+      drawn_blank( ( x + i ) * 8, y * 8, 8, text );
+      widget_printchar_fixed( x + i, y, col, (libspectrum_byte)s[i] );
+    }
+    return;
+  }
+
+  drawn_clear( text );
+  text->col = col;
+  text->length = length;
+  memcpy( text->text, s, length );
+  text->text[ length ] = 0;
+  drawn_print( text );
+}
+
+/* Returns where the next string along should go, as widget_printstring()
+   does */
+static int
+show_string( int x, int y, int col, const char *s )
+{
+  drawn_text_show( x, y, col, 0, 0, s, strlen( s ) );
+  return *s ? x + widget_stringwidth( s ) + 1 : x;
+}
+
+static void
+show_string_right( int x, int y, int col, const char *s )
+{
+  drawn_text_show( x, y, col, 0, 1, s, strlen( s ) );
+}
+
+static void
+show_string_fixed( int x, int y, int col, const char *s )
+{
+  drawn_text_show( x, y, col, 1, 0, s, strlen( s ) );
+}
+
+/* Get rid of anything which wasn't drawn again on this pass */
+static void
+drawn_text_expire( void )
+{
+  size_t i;
+
+  for( i = 0; i < drawn_count; ) {
+    if( drawn[i].seen ) {
+      drawn[i].seen = 0;
+      i++;
+      continue;
+    }
+    drawn_clear( &drawn[i] );
+    drawn[i] = drawn[ --drawn_count ];
+  }
+}
+
 int ui_debugger_activate( void )
 {
   return widget_do_debugger();
@@ -98,7 +284,8 @@ int ui_debugger_deactivate( int interruptible GCC_UNUSED )
 
 int ui_debugger_update( void )
 {
-  return widget_debugger_draw( NULL );
+  debugger_update();
+  return 0;
 }
 
 int ui_debugger_disassemble( libspectrum_word addr )
@@ -113,7 +300,8 @@ void ui_breakpoints_updated( void )
 {
 }
 
-int widget_debugger_draw( void *data )
+static void
+debugger_update( void )
 {
   static const char state[][8] = {
     "Running", "Halted", "Stepped", "Breakpt"
@@ -123,8 +311,37 @@ int widget_debugger_draw( void *data )
 #if VKEYBOARD
   vkeyboard_enabled = 1;
 #endif
-  widget_rectangle( LC(0), LR(0), 40 * 8, 17 * 8 + 4, 1 );
-  widget_rectangle( LC(0), LR(17) + 2, 320, 1, 7 );
+
+  /* The breakpoint list's arrows aren't text, so it's always drawn in
+     full */
+  if( display != drawn_display || display == DB_BREAKPT ) drawn_valid = 0;
+
+  if( !drawn_valid ) {
+    widget_rectangle( LC(0), LR(0), 40 * 8, 17 * 8 + 4, 1 );
+    widget_rectangle( LC(0), LR(17) + 2, 320, 1, 7 );
+
+    widget_printstring( LC(10), LR(15) - 4, 6,
+		        "\022S\021ingle step  \022C\021ontinue  Co\022m\021mand" );
+
+    x = LC(-1);
+    if( display != DB_REGISTERS )
+      x = widget_printstring( x + 8, LR(16), 7, "\022R\021egs" );
+    if( display != DB_BYTES )
+      x = widget_printstring( x + 8, LR(16), 7, "\022B\021ytes" );
+    if( display != DB_TEXT )
+      x = widget_printstring( x + 8, LR(16), 7, "\022T\021ext" );
+    if( display != DB_DISASM )
+      x = widget_printstring( x + 8, LR(16), 7, "\022D\021isasm" );
+    if( display != DB_BREAKPT )
+      x = widget_printstring( x + 8, LR(16), 7, "Brea\022k\021pts" );
+
+    widget_printstring_right( LC(25) + 4, LR(16), 5, "PC" );
+    widget_printstring_right( LR(35) + 4, LR(16), 5, "Bas\022e\021" );
+
+    drawn_count = 0;
+    drawn_valid = 1;
+    drawn_display = display;
+  }
 
   switch ( display ) {
   case DB_REGISTERS: display_registers(); break;
@@ -134,35 +351,34 @@ int widget_debugger_draw( void *data )
   case DB_BREAKPT:   display_breakpts();  break;
   }
 
-  widget_printstring( LC(0), LR(15) - 4, 6, state[debugger_mode] );
-  widget_printstring( LC(10), LR(15) - 4, 6,
-		      "\022S\021ingle step  \022C\021ontinue  Co\022m\021mand" );
-
-  x = LC(-1);
-  if( display != DB_REGISTERS )
-    x = widget_printstring( x + 8, LR(16), 7, "\022R\021egs" );
-  if( display != DB_BYTES )
-    x = widget_printstring( x + 8, LR(16), 7, "\022B\021ytes" );
-  if( display != DB_TEXT )
-    x = widget_printstring( x + 8, LR(16), 7, "\022T\021ext" );
-  if( display != DB_DISASM )
-    x = widget_printstring( x + 8, LR(16), 7, "\022D\021isasm" );
-  if( display != DB_BREAKPT )
-    x = widget_printstring( x + 8, LR(16), 7, "Brea\022k\021pts" );
-
-  widget_printstring_right( LC(25) + 4, LR(16), 5, "PC" );
+  show_string( LC(0), LR(15) - 4, 6, state[debugger_mode] );
+
   sprintf( pbuf, "%04X", PC );
-  widget_printstring_fixed( LC(26) / 8, LR(16) / 8, 7, pbuf );
+  show_string_fixed( LC(26) / 8, LR(16) / 8, 7, pbuf );
 
-  widget_printstring_right( LR(35) + 4, LR(16), 5, "Bas\022e\021" );
   sprintf( pbuf, "%d", debugger_output_base );
-  widget_printstring( LR(36), LR(16), 7, pbuf );
+  show_string( LR(36), LR(16), 7, pbuf );
 
+  drawn_text_expire();
+
+  /* Only the parts drawn on above are actually sent to the display */
   widget_display_lines( LR(0) / 8, 18 );
+}
+
+int widget_debugger_draw( void *data )
+{
+  /* Whatever was here before has gone, so start again */
+  drawn_valid = 0;
+  debugger_update();
 
   return 0;
 }
 
+int widget_debugger_finish( widget_finish_state finished GCC_UNUSED )
+{
+  drawn_valid = 0;
+  return 0;
+}
 
 void widget_debugger_keyhandler( input_key key )
 {
@@ -197,38 +413,38 @@ void widget_debugger_keyhandler( input_key key )
     break;
 
   case INPUT_KEY_s:		/* Single step & reopen widget */
-    debugger_mode = DEBUGGER_MODE_HALTED;
+    debugger_set_mode( DEBUGGER_MODE_HALTED );
     widget_end_all( WIDGET_FINISHED_OK );
     break;
 
   case INPUT_KEY_r:		/* Display the registers */
     display = DB_REGISTERS;
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_b:		/* Display a memory dump (bytes) */
     display = DB_BYTES;
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_t:		/* Display a memory dump (text) */
     display = DB_TEXT;
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_d:		/* Display a disassembly */
     display = DB_DISASM;
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_k:		/* Display the breakpoints */
     display = DB_BREAKPT;
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_e:		/* Switch base */
     debugger_output_base = 26 - debugger_output_base;	/* 10 or 16 */
-    widget_debugger_draw( NULL );
+    debugger_update();
     break;
 
   case INPUT_KEY_m:		/* Enter a command */
@@ -295,8 +511,8 @@ static void show_register0( int x, int y, const char *label, int value )
   char pbuf[8];
 
   sprintf( pbuf, "%d", value );
-  widget_printstring_right( x - 4, y, 5, label );
-  widget_printstring_fixed( x / 8, y / 8, 7, pbuf );
+  show_string_right( x - 4, y, 5, label );
+  show_string_fixed( x / 8, y / 8, 7, pbuf );
 }
 
 static void show_register1( int x, int y, const char *label, int value )
@@ -304,8 +520,8 @@ static void show_register1( int x, int y, const char *label, int value )
   char pbuf[8];
 
   sprintf( pbuf, format_8_bit(), value );
-  widget_printstring_right( x - 4, y, 5, label );
-  widget_printstring_fixed( x / 8, y / 8, 7, pbuf );
+  show_string_right( x - 4, y, 5, label );
+  show_string_fixed( x / 8, y / 8, 7, pbuf );
 }
 
 static void show_register2( int x, int y, const char *label, int value )
@@ -313,8 +529,8 @@ static void show_register2( int x, int y, const char *label, int value )
   char pbuf[8];
 
   sprintf( pbuf, format_16_bit(), value );
-  widget_printstring_right( x - 4, y, 5, label );
-  widget_printstring_fixed( x / 8, y / 8, 7, pbuf );
+  show_string_right( x - 4, y, 5, label );
+  show_string_fixed( x / 8, y / 8, 7, pbuf );
 }
 
 static void display_registers( void )
@@ -346,17 +562,17 @@ static void display_registers( void )
   show_register0( LC(36), LR(2), "IFF2", IFF2 );
   show_register2( LC(3),  LR(3), "HL",   HL );
   show_register2( LC(12), LR(3), "HL'",  HL_ );
-  widget_printstring_fixed( LC(20) / 8, LR(3) / 8, 5, "SZ5H3PNC" );
+  show_string_fixed( LC(20) / 8, LR(3) / 8, 5, "SZ5H3PNC" );
   show_register0( LC(36), LR(3), "HALTED", z80.halted );
   show_register1( LC(36), LR(4), "ULA",  ula_last_byte() );
 
   sprintf( pbuf, "%d", tstates );
-  widget_printstring_right( LC(12) - 4, LR(4), 5, "Tstates" );
-  widget_printstring_fixed( LC(12) / 8, LR(4) / 8, 7, pbuf );
+  show_string_right( LC(12) - 4, LR(4), 5, "Tstates" );
+  show_string_fixed( LC(12) / 8, LR(4) / 8, 7, pbuf );
   for( i = 0; i < 8; ++i )
     pbuf[i] = ( F & ( 0x80 >> i ) ) ? '1' : '0';
   pbuf[8] = 0;
-  widget_printstring_fixed( LC(20) / 8, LR(4) / 8, 7, pbuf );
+  show_string_fixed( LC(20) / 8, LR(4) / 8, 7, pbuf );
 
   capabilities = libspectrum_machine_capabilities( machine_current->machine );
 
@@ -400,15 +616,15 @@ static void display_registers( void )
       int x = LC(5 + 20 * ( i & 1 ) ), y = LR(6 + ( i / 2 ) );
 
       sprintf( pbuf, format_16_bit(), (unsigned)block * MEMORY_PAGE_SIZE );
-      widget_printstring_right( x, y, 5, pbuf );
+      show_string_right( x, y, 5, pbuf );
       snprintf( pbuf, sizeof( pbuf ), "%s %d",
                 memory_source_description( memory_map_read[block].source ),
                 memory_map_read[block].page_num );
-      x = widget_printstring( x + 4, y, 7, pbuf ) + 4;
+      x = show_string( x + 4, y, 7, pbuf ) + 4;
       if( memory_map_read[block].writable )
-        x = widget_printstring( x, y, 4, "w" );
+        x = show_string( x, y, 4, "w" );
       if( memory_map_read[block].contended )
-        x = widget_printstring( x, y, 4, "c" );
+        x = show_string( x, y, 4, "c" );
 
       i++;
 
@@ -434,8 +650,8 @@ static void display_bytes( void )
     libspectrum_word addr = debugger_memaddr + y * 8;
 
     sprintf( pbuf, format_16_bit(), addr );
-    widget_printstring_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
-    widget_printstring( LC(6), LR(y), 5, ":" );
+    show_string_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
+    show_string( LC(6), LR(y), 5, ":" );
 
     for( x = 0; x < 8; ++x ) {
       sprintf( pbuf + x * 4, format_8_bit(),
@@ -443,7 +659,7 @@ static void display_bytes( void )
       if( x < 7 )
 	strcat( pbuf, "  " );
     }
-    widget_printstring_fixed( LC(7) / 8, LR(y) / 8, 7, pbuf );
+    show_string_fixed( LC(7) / 8, LR(y) / 8, 7, pbuf );
   }
 }
 
@@ -451,18 +667,18 @@ static void display_bytes( void )
 static void display_text( void )
 {
   int x, y;
-  char pbuf[8];
+  char pbuf[8], text[32];
 
   for( y = 0; y < 8; ++y ) {
     libspectrum_word addr = debugger_memaddr + y * 32;
 
     sprintf( pbuf, format_16_bit(), addr );
-    widget_printstring_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
-    widget_printstring( LC(6), LR(y), 5, ":" );
+    show_string_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
+    show_string( LC(6), LR(y), 5, ":" );
 
     for( x = 0; x < 32; ++x )
-      widget_printchar_fixed( LC(x + 8) / 8, LR(y) / 8, 7,
-			      readbyte_internal( addr + x ) );
+      text[x] = readbyte_internal( addr + x );
+    drawn_text_show( LC(8) / 8, LR(y) / 8, 7, 1, 0, text, 32 );
   }
 }
 
@@ -478,18 +694,18 @@ static void display_disasm( void )
     char *spc;
 
     sprintf( pbuf, format_16_bit(), addr );
-    widget_printstring_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
-    widget_printstring( LC(6), LR(y), 5, ":" );
+    show_string_fixed( LC(1) / 8, LR(y) / 8, 7, pbuf );
+    show_string( LC(6), LR(y), 5, ":" );
 
     debugger_disassemble( pbuf, sizeof( pbuf ), &length, addr );
     addr += length;
     spc = strchr( pbuf, ' ' );
     if( spc )
       *spc = 0;
-    widget_printstring( LC(8), LR(y), 7, pbuf );
+    show_string( LC(8), LR(y), 7, pbuf );
     if( spc ) {
       spc += 1 + strspn( spc + 1, " " );
-      widget_printstring( LC(12) + 4, LR(y), 7, spc );
+      show_string( LC(12) + 4, LR(y), 7, spc );
     }
   }
 }
@@ -619,5 +835,5 @@ static void scroll( int step )
     return;
   }
 
-  widget_debugger_draw( NULL );
+  debugger_update();
 }
@@ -26,6 +26,7 @@
 #include <config.h>
 
 #include <sys/types.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -34,18 +35,21 @@
 #include <strings.h>
 #endif      /* #ifdef HAVE_STRINGS_STRCASECMP */
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef WIN32
 #include <windows.h>
 #include <direct.h>
-#include <ctype.h>
 #endif				/* #ifdef WIN32 */
 
 #include "fuse.h"
+#include "snapshot.h"
 #include "ui/ui.h"
+#include "ui/uidisplay.h"
 #include "utils.h"
 #include "widget_internals.h"
+#include "zip.h"
 
 #if defined AMIGA || defined __MORPHOS__
 #include <proto/asl.h>
@@ -160,6 +164,8 @@ static widget_file_filter_t widget_file_filters[FILTER_CLASS_GENERAL+1] = {
                           "fmf", "fmf" },
   { FILTER_CLASS_AY_LOGGING,
                           "psg", "psg" },
+  { FILTER_CLASS_SOUND_RECORDING,
+                          "wav;flac", "wav;flac" },
   { FILTER_CLASS_POKE_FILE,
                           NULL, "pok" },
   { FILTER_CLASS_CONTROL_MAPPING,
@@ -218,6 +224,7 @@ static widget_last_positions_t last_known_positions[ FILTER_CLASS_GENERAL+1 ] =
                                   0, 0, 1, NULL },
   { FILTER_CLASS_MOVIE_FILE,      0, 0, 1, NULL },
   { FILTER_CLASS_AY_LOGGING,      0, 0, 1, NULL },
+  { FILTER_CLASS_SOUND_RECORDING, 0, 0, 1, NULL },
   { FILTER_CLASS_POKE_FILE,       0, 0, 1, NULL },
   { FILTER_CLASS_CONTROL_MAPPING, 0, 0, 1, NULL },
   { FILTER_CLASS_MEDIA_IF_RS232,  0, 0, 1, NULL },
@@ -245,12 +252,69 @@ static int widget_add_filename( int *allocated, int *number,
                                 struct widget_dirent ***namelist,
                                 const char *name );
 static void widget_scan( char *dir );
-static int widget_select_file( const char *name );
+static int widget_select_file( const char *name, mode_t mode );
 static int widget_scan_compare( const widget_dirent **a,
 				const widget_dirent **b );
 
 #if !defined AMIGA && !defined __MORPHOS__
 static char* widget_getcwd( void );
+
+/* How many of the most recently seen directories to remember */
+#define WIDGET_LISTING_CACHE_SIZE 8
+
+/* How many files to read from a big directory each time round the
+   widget loop once the first screenful is showing */
+#define WIDGET_SCAN_BATCH 64
+
+/* The sorted contents of a directory, as last seen */
+typedef struct widget_dir_listing {
+  char *dir;			/* NULL if this entry is unused */
+  char *key;			/* From widget_scan_key() */
+  time_t mtime;			/* The directory's modification time */
+  int cacheable;		/* Complete, and the mtime can be trusted */
+#ifdef WIN32
+  int is_rootdir;
+#endif				/* #ifdef WIN32 */
+
+  struct widget_dirent **filenames;
+  size_t numfiles;
+  unsigned int last_used;
+
+  /* The same files sorted by name ignoring case, for searching; NULL
+     until the listing is first searched */
+  struct widget_dirent **sorted;
+} widget_dir_listing;
+
+static widget_dir_listing listing_cache[ WIDGET_LISTING_CACHE_SIZE ];
+static unsigned int listing_clock;
+
+/* What's in widget_filenames; its own filenames and numfiles are
+   unused */
+static widget_dir_listing current_listing;
+
+/* The directory being read if widget_filenames isn't complete yet */
+static compat_dir scan_directory = NULL;
+static int scan_allocated;
+
+/* While a search is in effect, widget_filenames holds just the matching
+   files; the whole directory is kept here */
+static char *search_text = NULL;
+static struct widget_dirent **unfiltered_filenames;
+static size_t unfiltered_numfiles;
+
+/* Is the current snapshot's screen being shown in place of the list,
+   and is that still waiting for the screen to be extracted? */
+static int showing_preview = 0;
+static int preview_pending;
+
+static void widget_filesel_preview_show( void );
+static void widget_filesel_preview_close( void );
+
+/* The ZIP archive being shown as a directory, if any, and the directory
+   within it ("" for the top). The real current directory stays as the
+   one holding the archive */
+static char *archive_file = NULL;
+static char *archive_dir;
 #endif /* ifndef AMIGA */
 static int widget_print_all_filenames( struct widget_dirent **filenames, int n,
 				       int top_left, int current,
@@ -453,25 +517,181 @@ amiga_asl( char *title, BOOL is_saving ) {
 }
 #else /* ifdef AMIGA */
 
-static int widget_scandir( const char *dir, struct widget_dirent ***namelist,
-			   int (*select_fn)(const char*) )
+/* Free a list of filenames as built by widget_add_filename() */
+static void
+widget_free_filenames( struct widget_dirent **filenames, size_t number )
 {
-  compat_dir directory;
+  size_t i;
 
-  int allocated, number;
+  if( !filenames ) return;
+
+  for( i=0; i<number; i++ ) {
+    free( filenames[i]->name );
+    free( filenames[i] );
+  }
+  free( filenames );
+}
+
+static void
+widget_listing_free( widget_dir_listing *listing )
+{
+  free( listing->dir ); listing->dir = NULL;
+  free( listing->key ); listing->key = NULL;
+  free( listing->sorted ); listing->sorted = NULL;
+  widget_free_filenames( listing->filenames, listing->numfiles );
+  listing->filenames = NULL; listing->numfiles = 0;
+}
+
+/* Everything apart from the directory and its contents which affects
+   which files are shown */
+static char*
+widget_scan_key( void )
+{
+  char key[ 256 ];
+  size_t length;
+
+#ifdef GCWZERO
   int i;
-  int done = 0;
 
-  *namelist = malloc( 32 * sizeof(**namelist) );
-  if( !*namelist ) return -1;
+  length = snprintf( key, sizeof( key ), "%d%d",
+                     settings_current.od_hidden_files,
+                     settings_current.od_filter_known_extensions &&
+                     last_known_positions[last_filter].apply_filters );
+
+  if( last_row_extensions != -1 ) {
+    for( i = 0; i < MAX_FILTER_EXTENSIONS &&
+                filter_extensions[last_row_extensions][i]; i++ ) {
+      if( length >= sizeof( key ) ) break;
+      length += snprintf( key + length, sizeof( key ) - length, ";%s",
+                          filter_extensions[last_row_extensions][i] );
+    }
+  }
+#else				/* #ifdef GCWZERO */
+  length = snprintf( key, sizeof( key ), "-" );
+#endif				/* #ifdef GCWZERO */
 
-  allocated = 32; number = 0;
+  return utils_safe_strdup( key );
+}
 
-  directory = compat_opendir( dir );
-  if( !directory ) {
-    free( *namelist );
-    *namelist = NULL;
-    return -1;
+/* Move the current listing into the cache if it's worth keeping, throwing
+   away the least recently used entry if need be; otherwise just free it */
+static void
+widget_listing_stash( void )
+{
+  widget_dir_listing *slot = NULL;
+  size_t i;
+
+  if( widget_numfiles == (size_t)-1 ) widget_numfiles = 0;
+
+  if( !current_listing.dir || !current_listing.cacheable ) {
+    widget_free_filenames( widget_filenames, widget_numfiles );
+    widget_listing_free( &current_listing );
+    widget_filenames = NULL; widget_numfiles = 0;
+    return;
+  }
+
+  for( i = 0; i < WIDGET_LISTING_CACHE_SIZE; i++ ) {
+    if( !listing_cache[i].dir ) { slot = &listing_cache[i]; break; }
+    if( !slot || listing_cache[i].last_used < slot->last_used )
+      slot = &listing_cache[i];
+  }
+
+  widget_listing_free( slot );
+  *slot = current_listing;
+  slot->filenames = widget_filenames;
+  slot->numfiles = widget_numfiles;
+  slot->last_used = ++listing_clock;
+
+  memset( &current_listing, 0, sizeof( current_listing ) );
+  widget_filenames = NULL; widget_numfiles = 0;
+}
+
+/* Make a cached listing of `dir' the current one if we have one which is
+   still valid. Returns non-zero if we did */
+static int
+widget_listing_fetch( const char *dir, const char *key, time_t mtime )
+{
+  size_t i;
+
+  for( i = 0; i < WIDGET_LISTING_CACHE_SIZE; i++ ) {
+    widget_dir_listing *listing = &listing_cache[i];
+
+    if( !listing->dir || strcmp( listing->dir, dir ) ||
+        strcmp( listing->key, key ) )
+      continue;
+
+    /* Something has been added, removed or renamed since we looked */
+    if( listing->mtime != mtime ) {
+      widget_listing_free( listing );
+      return 0;
+    }
+
+    current_listing = *listing;
+    widget_filenames = listing->filenames;
+    widget_numfiles = listing->numfiles;
+    current_listing.filenames = NULL; current_listing.numfiles = 0;
+#ifdef WIN32
+    is_rootdir = current_listing.is_rootdir;
+#endif				/* #ifdef WIN32 */
+
+    memset( listing, 0, sizeof( *listing ) );
+    return 1;
+  }
+
+  return 0;
+}
+
+static void
+widget_scan_remember_directory( const char *dir GCC_UNUSED )
+{
+#ifdef GCWZERO
+  if ( settings_current.od_save_last_directory && 
+       ( !settings_current.od_last_directory ||
+         strcmp( settings_current.od_last_directory, dir ) ) ) {
+    libspectrum_free( settings_current.od_last_directory );
+    settings_current.od_last_directory = utils_safe_strdup( dir );
+  }
+#endif
+}
+
+/* Give up on a partially read directory; what we've got so far stays on
+   display, but isn't complete enough to be cached */
+static void
+widget_scan_cancel( void )
+{
+  if( !scan_directory ) return;
+
+  compat_closedir( scan_directory );
+  scan_directory = NULL;
+  current_listing.cacheable = 0;
+}
+
+static void
+widget_scan_fail( void )
+{
+  if( scan_directory ) {
+    compat_closedir( scan_directory );
+    scan_directory = NULL;
+  }
+
+  widget_free_filenames( widget_filenames, widget_numfiles );
+  widget_filenames = NULL;
+  widget_numfiles = (size_t)-1;
+  current_listing.cacheable = 0;
+}
+
+static int
+widget_scan_start( const char *dir )
+{
+  widget_filenames = malloc( 32 * sizeof(*widget_filenames) );
+  if( !widget_filenames ) { widget_numfiles = (size_t)-1; return 1; }
+
+  scan_allocated = 32; widget_numfiles = 0;
+
+  scan_directory = compat_opendir( dir );
+  if( !scan_directory ) {
+    widget_scan_fail();
+    return 1;
   }
 
 #ifdef WIN32
@@ -479,74 +699,230 @@ static int widget_scandir( const char *dir, struct widget_dirent ***namelist,
   is_rootdir = 1;
 #endif				/* #ifdef WIN32 */
 
-  while( !done ) {
-    char name[ PATH_MAX ];
+  widget_scan_remember_directory( dir );
 
-    compat_dir_result_t result =
-      compat_readdir( directory, name, sizeof( name ) );
+  return 0;
+}
+
+static void
+widget_scan_done( void )
+{
+  if( compat_closedir( scan_directory ) ) {
+    scan_directory = NULL;
+    widget_scan_fail();
+    return;
+  }
+  scan_directory = NULL;
 
-    switch( result )
-    {
-    case COMPAT_DIR_RESULT_OK:
-      if( select_fn( name ) ) {
 #ifdef WIN32
-        if( is_rootdir && !strcmp( name, ".." ) ) {
-          is_rootdir = 0;
-        }
+  current_listing.is_rootdir = is_rootdir;
+  if( is_rootdir ) {
+    int number = widget_numfiles;
+
+    /* Add a fake ".." entry for drive selection */
+    if( widget_add_filename( &scan_allocated, &number, &widget_filenames,
+                             ".." ) ) {
+      widget_filenames = NULL;
+      widget_numfiles = (size_t)-1;
+      current_listing.cacheable = 0;
+      return;
+    }
+    widget_filenames[ number - 1 ]->mode = S_IFDIR;
+    widget_numfiles = number;
+  }
 #endif				/* #ifdef WIN32 */
-        if( widget_add_filename( &allocated, &number, namelist, name ) ) {
-          compat_closedir( directory );
-          return -1;
-        }
-      }
-      break;
+}
+
+/* Read up to `count' more files from the directory being scanned, and
+   sort them in with the ones we've already got. Returns non-zero if the
+   list of files changed */
+static int
+widget_scan_continue( size_t count )
+{
+  struct stat file_info;
+  size_t added = 0;
+  int number = widget_numfiles;
+  int error;
+  mode_t mode;
+
+  if( !scan_directory ) return 0;
 
-    case COMPAT_DIR_RESULT_END:
-      done = 1;
+  while( added < count ) {
+    char name[ PATH_MAX ];
+
+    compat_dir_result_t result =
+      compat_readdir( scan_directory, name, sizeof( name ) );
+
+    if( result == COMPAT_DIR_RESULT_END ) {
+      widget_numfiles = number;
+      widget_scan_done();
+      if( widget_numfiles == (size_t)-1 ) return 1;
+      number = widget_numfiles;
+      added++;
       break;
+    }
 
-    case COMPAT_DIR_RESULT_ERROR:
-      for( i=0; i<number; i++ ) {
-        free( (*namelist)[i]->name );
-        free( (*namelist)[i] );
-      }
-      free( *namelist );
-      *namelist = NULL;
-      compat_closedir( directory );
-      return -1;
+    if( result == COMPAT_DIR_RESULT_ERROR ) {
+      widget_numfiles = number;
+      widget_scan_fail();
+      return 1;
     }
 
+    error = stat( name, &file_info );
+    mode = error ? 0 : file_info.st_mode;
+
+    if( !widget_select_file( name, mode ) ) continue;
+
+#ifdef WIN32
+    if( is_rootdir && !strcmp( name, ".." ) ) {
+      is_rootdir = 0;
+    }
+#endif				/* #ifdef WIN32 */
+
+    if( widget_add_filename( &scan_allocated, &number, &widget_filenames,
+                             name ) ) {
+      /* widget_add_filename() has already freed the list */
+      widget_filenames = NULL;
+      widget_numfiles = 0;
+      widget_scan_fail();
+      return 1;
+    }
+    widget_filenames[ number - 1 ]->mode = mode;
+    added++;
   }
 
-  if( compat_closedir( directory ) ) {
-    for( i=0; i<number; i++ ) {
-      free( (*namelist)[i]->name );
-      free( (*namelist)[i] );
+  widget_numfiles = number;
+
+  qsort( widget_filenames, widget_numfiles, sizeof(struct widget_dirent*),
+	 (int(*)(const void*,const void*))widget_scan_compare );
+
+  return added > 0;
+}
+
+static void
+widget_scan_complete( void )
+{
+  while( scan_directory ) widget_scan_continue( WIDGET_SCAN_BATCH );
+}
+
+static int
+widget_search_compare( const struct widget_dirent **a,
+                       const struct widget_dirent **b )
+{
+  return strcasecmp( (*a)->name, (*b)->name );
+}
+
+/* Find the alphabetically first file whose name starts with `text',
+   ignoring case. The index this uses is built the first time a listing
+   is searched, and cached along with it */
+static struct widget_dirent*
+widget_search_prefix( const char *text )
+{
+  size_t low = 0, high = widget_numfiles, mid, length = strlen( text );
+  struct widget_dirent **sorted;
+
+  if( !current_listing.sorted ) {
+    current_listing.sorted =
+      malloc( ( widget_numfiles ? widget_numfiles : 1 ) * sizeof( *sorted ) );
+    if( !current_listing.sorted ) return NULL;
+
+    memcpy( current_listing.sorted, widget_filenames,
+            widget_numfiles * sizeof( *sorted ) );
+    qsort( current_listing.sorted, widget_numfiles, sizeof( *sorted ),
+	   (int(*)(const void*,const void*))widget_search_compare );
+  }
+  sorted = current_listing.sorted;
+
+  while( low < high ) {
+    mid = low + ( high - low ) / 2;
+    if( strncasecmp( sorted[ mid ]->name, text, length ) < 0 ) {
+      low = mid + 1;
+    } else {
+      high = mid;
     }
-    free( *namelist );
-    *namelist = NULL;
-    return -1;
   }
 
-#ifdef WIN32
-  if( is_rootdir ) {
-    /* Add a fake ".." entry for drive selection */
-    if( widget_add_filename( &allocated, &number, namelist, ".." ) ) {
-      return -1;
+  if( low < widget_numfiles && !strncasecmp( sorted[ low ]->name, text, length ) )
+    return sorted[ low ];
+
+  return NULL;
+}
+
+/* Go back to showing the whole directory, keeping the cursor on the same
+   file */
+static void
+widget_search_clear( void )
+{
+  struct widget_dirent *current;
+  size_t i;
+
+  if( !search_text ) return;
+
+  current = widget_numfiles ? widget_filenames[ current_file ] : NULL;
+
+  free( widget_filenames );
+  widget_filenames = unfiltered_filenames;
+  widget_numfiles = unfiltered_numfiles;
+  unfiltered_filenames = NULL; unfiltered_numfiles = 0;
+
+  free( search_text ); search_text = NULL;
+
+  for( i = 0; i < widget_numfiles; i++ )
+    if( widget_filenames[i] == current ) break;
+  current_file = new_current_file = i < widget_numfiles ? i : 0;
+
+  if( current_file < top_left_file ||
+      current_file >= top_left_file + ENTRIES_PER_SCREEN )
+    top_left_file = current_file & ~1;
+}
+
+/* Show only the files whose names contain `text', with the cursor on the
+   first one which starts with it. An empty `text' shows everything again.
+   Returns non-zero if nothing matched */
+static int
+widget_search( const char *text )
+{
+  struct widget_dirent **matches, *first;
+  size_t i, count = 0, found = (size_t)-1;
+
+  widget_search_clear();
+  if( !*text ) return 0;
+
+  /* All the files need to be there to search them */
+  widget_scan_complete();
+  if( widget_numfiles == (size_t)-1 || !widget_numfiles ) return 1;
+
+  first = widget_search_prefix( text );
+
+  matches = malloc( widget_numfiles * sizeof( *matches ) );
+  if( !matches ) return 1;
+
+  for( i = 0; i < widget_numfiles; i++ ) {
+    const char *name = widget_filenames[i]->name;
+
+    /* Always keep the way out */
+    if( !strcmp( name, ".." ) ) {
+      matches[ count++ ] = widget_filenames[i];
+    } else if( utils_name_contains( name, text ) ) {
+      if( found == (size_t)-1 || widget_filenames[i] == first ) found = count;
+      matches[ count++ ] = widget_filenames[i];
     }
   }
-#endif				/* #ifdef WIN32 */
 
-#ifdef GCWZERO
-  if ( settings_current.od_save_last_directory && 
-       ( !settings_current.od_last_directory ||
-         strcmp( settings_current.od_last_directory, dir ) ) ) {
-    libspectrum_free( settings_current.od_last_directory );
-    settings_current.od_last_directory = utils_safe_strdup( dir );
+  if( found == (size_t)-1 ) {
+    free( matches );
+    return 1;
   }
-#endif
 
-  return number;
+  unfiltered_filenames = widget_filenames;
+  unfiltered_numfiles = widget_numfiles;
+  widget_filenames = matches;
+  widget_numfiles = count;
+  search_text = utils_safe_strdup( text );
+
+  new_current_file = found;
+
+  return 0;
 }
 
 #ifdef WIN32
@@ -587,44 +963,188 @@ static int widget_scandrives( struct widget_dirent ***namelist )
 }
 #endif
 
+static void
+widget_archive_close( void )
+{
+  libspectrum_free( archive_file ); archive_file = NULL;
+  libspectrum_free( archive_dir ); archive_dir = NULL;
+}
+
+/* Show the archive `filename' as a directory. Returns zero if it isn't
+   worth doing, as the archive has only one file, which libspectrum can
+   open directly */
+static int
+widget_archive_open( const char *filename )
+{
+  zip_archive *archive = zip_open( filename );
+
+  if( !archive || zip_count( archive ) < 2 ) return 0;
+
+  widget_archive_close();
+  archive_file = utils_safe_strdup( filename );
+  archive_dir = utils_safe_strdup( "" );
+
+  return 1;
+}
+
+/* Move to the directory `name' within the archive being shown; ".." at
+   the top leaves it */
+static void
+widget_archive_chdir( const char *name )
+{
+  char *dir, *slash;
+
+  if( !strcmp( name, ".." ) ) {
+    if( !*archive_dir ) {
+      widget_archive_close();
+    } else {
+      slash = strrchr( archive_dir, '/' );
+      *( slash ? slash : archive_dir ) = '\0';
+    }
+    return;
+  }
+
+  dir = libspectrum_new( char, strlen( archive_dir ) + strlen( name ) + 2 );
+  sprintf( dir, "%s%s%s", archive_dir, *archive_dir ? "/" : "", name );
+  libspectrum_free( archive_dir );
+  archive_dir = dir;
+}
+
+/* List what's in the current directory of the archive being shown, from
+   the archive's index; nothing is decompressed */
+static void
+widget_scan_archive( void )
+{
+  zip_archive *archive;
+  char name[ PATH_MAX ];
+  const char *member, *slash;
+  size_t i, count, length, prefix_length = strlen( archive_dir );
+  int allocated = 32, number = 0, kept;
+  mode_t mode;
+
+  widget_numfiles = (size_t)-1;
+
+  archive = zip_open( archive_file );
+  if( !archive ) return;
+
+  widget_filenames = malloc( allocated * sizeof(*widget_filenames) );
+  if( !widget_filenames ) return;
+
+  /* The way back out */
+  if( widget_add_filename( &allocated, &number, &widget_filenames, ".." ) ) {
+    widget_filenames = NULL;
+    return;
+  }
+  widget_filenames[0]->mode = S_IFDIR;
+
+  count = zip_count( archive );
+  for( i = 0; i < count; i++ ) {
+    member = zip_name( archive, i );
+
+    if( prefix_length ) {
+      if( strncmp( member, archive_dir, prefix_length ) ||
+          member[ prefix_length ] != '/' )
+        continue;
+      member += prefix_length + 1;
+    }
+
+    /* Anything further down shows up as the directory it's in */
+    slash = strchr( member, '/' );
+    length = slash ? (size_t)( slash - member ) : strlen( member );
+    if( !length || length >= sizeof( name ) ) continue;
+
+    memcpy( name, member, length ); name[ length ] = '\0';
+    mode = slash ? S_IFDIR : S_IFREG;
+
+    if( !widget_select_file( name, mode ) ) continue;
+
+    if( widget_add_filename( &allocated, &number, &widget_filenames,
+                             name ) ) {
+      widget_filenames = NULL;
+      return;
+    }
+    widget_filenames[ number - 1 ]->mode = mode;
+  }
+
+  qsort( widget_filenames, number, sizeof(struct widget_dirent*),
+	 (int(*)(const void*,const void*))widget_scan_compare );
+
+  /* Each directory turns up once for every file in it */
+  for( i = 1, kept = 1; i < (size_t)number; i++ ) {
+    if( S_ISDIR( widget_filenames[i]->mode ) &&
+        !strcmp( widget_filenames[i]->name,
+                 widget_filenames[ kept - 1 ]->name ) ) {
+      free( widget_filenames[i]->name );
+      free( widget_filenames[i] );
+      continue;
+    }
+    widget_filenames[ kept++ ] = widget_filenames[i];
+  }
+
+  widget_numfiles = kept;
+}
+
 static void widget_scan( char *dir )
 {
-  struct stat file_info;
+  struct stat dir_info;
+  char *key;
+  int error;
 
-  size_t i; int error;
-  
-  /* Free the memory belonging to the files in the previous directory */
-  for( i=0; i<widget_numfiles; i++ ) {
-    free( widget_filenames[i]->name );
-    free( widget_filenames[i] );
+  widget_search_clear();
+  widget_scan_cancel();
+  widget_listing_stash();
+
+  if( archive_file ) {
+    widget_scan_archive();
+    return;
   }
 
 #ifdef WIN32
-  if( dir ) {
-    widget_numfiles = widget_scandir( dir, &widget_filenames,
-				      widget_select_file );
-  } else {
+  if( !dir ) {
+    size_t i;
+    struct stat file_info;
+
     widget_numfiles = widget_scandrives( &widget_filenames );
+    if( widget_numfiles == (size_t)-1 ) return;
+
+    for( i=0; i<widget_numfiles; i++ ) {
+      error = stat( widget_filenames[i]->name, &file_info );
+      widget_filenames[i]->mode = error ? 0 : file_info.st_mode;
+    }
+
+    qsort( widget_filenames, widget_numfiles, sizeof(struct widget_dirent*),
+	   (int(*)(const void*,const void*))widget_scan_compare );
+    return;
   }
-#else				/* #ifdef WIN32 */
-  widget_numfiles = widget_scandir( dir, &widget_filenames,
-				    widget_select_file );
 #endif				/* #ifdef WIN32 */
 
-  if( widget_numfiles == (size_t)-1 ) return;
+  key = widget_scan_key();
+  error = stat( dir, &dir_info );
 
-  for( i=0; i<widget_numfiles; i++ ) {
-    error = stat( widget_filenames[i]->name, &file_info );
-    widget_filenames[i]->mode = error ? 0 : file_info.st_mode;
+  if( !error && widget_listing_fetch( dir, key, dir_info.st_mtime ) ) {
+    free( key );
+    widget_scan_remember_directory( dir );
+    return;
   }
 
-  qsort( widget_filenames, widget_numfiles, sizeof(struct widget_dirent*),
-	 (int(*)(const void*,const void*))widget_scan_compare );
+  current_listing.dir = utils_safe_strdup( dir );
+  current_listing.key = key;
+  current_listing.mtime = error ? 0 : dir_info.st_mtime;
+
+  /* Only trust the modification time if the directory hasn't been
+     changed within the last second, else a change made in the same
+     second as the scan could go unnoticed later */
+  current_listing.cacheable = !error && dir_info.st_mtime < time( NULL );
 
+  if( widget_scan_start( dir ) ) return;
+
+  /* Get enough to fill the first screen; the rest is read in the
+     background by widget_filesel_idle() */
+  widget_scan_continue( ENTRIES_PER_SCREEN );
 }
 
 static int
-widget_select_file( const char *name )
+widget_select_file( const char *name, mode_t mode GCC_UNUSED )
 {
   if( !name ) return 0;
 
@@ -640,10 +1160,12 @@ widget_select_file( const char *name )
 #endif				/* #ifdef WIN32 */
 
 #ifdef GCWZERO
-  /* Filtered extensions */
+  /* Filtered extensions; we already know whether this is a directory, so
+     there's no need for widget_filter_extensions() to look again */
   if ( settings_current.od_filter_known_extensions &&
        last_known_positions[last_filter].apply_filters &&
-       widget_filter_extensions( name, 1 ) )
+       mode && !S_ISDIR( mode ) &&
+       widget_filter_extensions( name, 0 ) )
     return 0;
 #endif
 
@@ -698,6 +1220,8 @@ widget_filesel_draw( void *data )
     Only for load operations */
   if ( !is_saving && last_known_positions[last_position].last_directory &&
        strcmp( directory, last_known_positions[last_position].last_directory ) == 0 ) {
+    /* The position is only meaningful once all the files are there */
+    widget_scan_complete();
     new_current_file = current_file = last_known_positions[last_position].last_current_file;
     top_left_file = last_known_positions[last_position].last_top_left_file;
   } else {
@@ -734,6 +1258,18 @@ widget_filesel_draw( void *data )
 
 int widget_filesel_finish( widget_finish_state finished ) {
 
+#if !defined AMIGA && !defined __MORPHOS__
+  widget_scan_cancel();
+  widget_search_clear();
+  showing_preview = 0;
+
+  /* Next time starts from the directory holding the archive */
+  if( archive_file ) {
+    widget_archive_close();
+    current_file = top_left_file = 0;
+  }
+#endif
+
   /* Return with null if we didn't finish cleanly */
   if( finished != WIDGET_FINISHED_OK ) {
     if( widget_filesel_name ) free( widget_filesel_name );
@@ -749,6 +1285,72 @@ int widget_filesel_finish( widget_finish_state finished ) {
   return 0;
 }
 
+/* Read some more of a big directory, keeping the cursor on the same
+   file as the new ones are sorted in */
+void
+widget_filesel_idle( void )
+{
+#if !defined AMIGA && !defined __MORPHOS__
+  struct widget_dirent *current;
+  char *dirtitle;
+  size_t i;
+
+  if( showing_preview ) {
+    if( preview_pending ) widget_filesel_preview_show();
+    return;
+  }
+
+  if( !scan_directory ) return;
+
+  current = widget_numfiles ? widget_filenames[ current_file ] : NULL;
+
+  if( !widget_scan_continue( WIDGET_SCAN_BATCH ) ) return;
+
+  if( widget_numfiles == (size_t)-1 ) {
+    current_file = new_current_file = top_left_file = 0;
+  } else {
+    for( i = 0; i < widget_numfiles; i++ )
+      if( widget_filenames[i] == current ) break;
+    current_file = new_current_file = i < widget_numfiles ? i : 0;
+  }
+
+  if( current_file < top_left_file ||
+      current_file >= top_left_file + ENTRIES_PER_SCREEN )
+    top_left_file = current_file & ~1;
+
+  dirtitle = widget_getcwd();
+  if( !dirtitle ) return;
+
+  widget_print_all_filenames( widget_filenames, widget_numfiles,
+			      top_left_file, current_file, dirtitle );
+
+  free( dirtitle );
+#endif /* ifndef AMIGA */
+}
+
+/* Free the current list of files and all the cached ones */
+void
+widget_filesel_end( void )
+{
+#if !defined AMIGA && !defined __MORPHOS__
+  size_t i;
+
+  widget_search_clear();
+  widget_scan_cancel();
+
+  if( widget_numfiles == (size_t)-1 ) widget_numfiles = 0;
+  widget_free_filenames( widget_filenames, widget_numfiles );
+  widget_filenames = NULL; widget_numfiles = 0;
+  widget_listing_free( &current_listing );
+
+  for( i = 0; i < WIDGET_LISTING_CACHE_SIZE; i++ )
+    widget_listing_free( &listing_cache[i] );
+
+  widget_preview_end();
+  widget_archive_close();
+#endif /* ifndef AMIGA */
+}
+
 int
 widget_filesel_load_draw( void *data )
 {
@@ -769,6 +1371,15 @@ static char* widget_getcwd( void )
   char *directory; size_t directory_length;
   char *ptr;
 
+  /* Where we are in an archive */
+  if( archive_file ) {
+    directory = malloc( strlen( archive_file ) + strlen( archive_dir ) + 2 );
+    if( directory == NULL ) return NULL;
+    sprintf( directory, "%s%s%s", archive_file,
+             *archive_dir ? FUSE_DIR_SEP_STR : "", archive_dir );
+    return directory;
+  }
+
   directory_length = 64;
   directory = malloc( directory_length * sizeof( char ) );
   if( directory == NULL ) {
@@ -875,6 +1486,9 @@ static int widget_print_all_filenames( struct widget_dirent **filenames, int n,
 {
   int i;
   int error;
+#if !defined AMIGA && !defined __MORPHOS__
+  char search_title[ PATH_MAX ];
+#endif /* ifndef AMIGA */
 
   /* Give us a clean box to start with */
   error = widget_dialog_with_border( 1, 2, 30, 22 );
@@ -887,6 +1501,13 @@ static int widget_print_all_filenames( struct widget_dirent **filenames, int n,
 #else
   widget_printstring( 10, 16, WIDGET_COLOUR_TITLE, title );
 #endif
+#if !defined AMIGA && !defined __MORPHOS__
+  if( search_text ) {
+    snprintf( search_title, sizeof( search_title ), "%s *%s*", dir,
+              search_text );
+    dir = search_title;
+  }
+#endif /* ifndef AMIGA */
   if( widget_stringwidth( dir ) > 223 ) {
     char buffer[128];
     int prefix = widget_stringwidth( "..." ) + 1;
@@ -1097,6 +1718,28 @@ widget_filesel_chdir( void )
 #endif				/* #ifndef GEKKO */
   strcat( fn, widget_filenames[ current_file ]->name );
 
+  /* There are no real directories to change to in an archive */
+  if( archive_file ) {
+    if( S_ISDIR( widget_filenames[ current_file ]->mode ) ) {
+      widget_archive_chdir( widget_filenames[ current_file ]->name );
+      free( fn );
+      fn = widget_getcwd();
+      if( fn ) widget_scan( fn );
+      new_current_file = 0;
+      /* Force a redisplay of all filenames */
+      current_file = 1; top_left_file = 1;
+    } else {
+      widget_filesel_name = fn; fn = NULL;
+      if( exit_all_widgets ) {
+	widget_end_all( WIDGET_FINISHED_OK );
+      } else {
+	widget_end_widget( WIDGET_FINISHED_OK );
+      }
+    }
+    free( fn );
+    return 0;
+  }
+
 /*
 in Win32 errno resulting from chdir on file is EINVAL which may mean many things
 this will not be fixed in mingw - must use native function instead
@@ -1109,6 +1752,15 @@ http://thread.gmane.org/gmane.comp.gnu.mingw.user/9197
 #else   /* #ifndef WIN32 */
     if( GetFileAttributes( fn ) != FILE_ATTRIBUTE_DIRECTORY ) {
 #endif  /* #ifndef WIN32 */
+      /* Show an archive's contents rather than opening it */
+      if( !is_saving && zip_is_archive( fn ) && widget_archive_open( fn ) ) {
+        widget_scan( fn );
+        new_current_file = 0;
+        /* Force a redisplay of all filenames */
+        current_file = 1; top_left_file = 1;
+        free( fn );
+        return 0;
+      }
       widget_filesel_name = fn; fn = NULL;
       if( exit_all_widgets ) {
 	widget_end_all( WIDGET_FINISHED_OK );
@@ -1128,6 +1780,120 @@ http://thread.gmane.org/gmane.comp.gnu.mingw.user/9197
   return 0;
 }
 
+#if !defined AMIGA && !defined __MORPHOS__
+/* Show the current file's screen in place of the list, if it's a
+   snapshot; if the screen isn't ready yet, this is called again from
+   the idle callback until it is */
+static void
+widget_filesel_preview_show( void )
+{
+  static const libspectrum_byte blank[ SNAPSHOT_SCREEN_LENGTH ];
+  const libspectrum_byte *screen = NULL;
+  struct widget_dirent *current = widget_filenames[ current_file ];
+  char path[ PATH_MAX ], buffer[ 80 ], *directory;
+  const char *name;
+  int ready = 1;
+
+  if( !S_ISDIR( current->mode ) &&
+      widget_preview_is_snapshot( current->name ) ) {
+    directory = widget_getcwd();
+    if( !directory ) return;
+    snprintf( path, sizeof( path ), "%s" FUSE_DIR_SEP_STR "%s", directory,
+              current->name );
+    free( directory );
+
+    screen = widget_preview_get( path, &ready );
+  }
+
+  /* Nothing more to show until the screen turns up */
+  if( !ready && preview_pending ) return;
+  preview_pending = !ready;
+
+  uidisplay_spectrum_screen( screen ? screen : blank, 0 );
+
+  name = current->name;
+  while( widget_stringwidth( name ) > 220 ) name++;
+  snprintf( buffer, sizeof( buffer ), "%s%s", name, ready ? "" : "..." );
+
+  widget_rectangle( 8, 23 * 8, 240, 8, WIDGET_COLOUR_BACKGROUND );
+  widget_printstring( 10, 23 * 8, WIDGET_COLOUR_FOREGROUND, buffer );
+  widget_display_lines( 23, 1 );
+}
+
+/* Go back to the list from a preview */
+static void
+widget_filesel_preview_close( void )
+{
+  char *dirtitle;
+
+  showing_preview = 0;
+  uidisplay_frame_restore();
+
+  dirtitle = widget_getcwd();
+  if( !dirtitle ) return;
+
+  widget_print_all_filenames( widget_filenames, widget_numfiles,
+			      top_left_file, current_file, dirtitle );
+
+  free( dirtitle );
+}
+
+/* While a preview is showing, the cursor keys move on to the next
+   file's screen and the keys which show it or cancel go back to the
+   list; anything else goes back to the list and then does whatever it
+   usually does. Returns non-zero if that's all to be done with `key' */
+static int
+widget_filesel_preview_key( input_key key )
+{
+  switch( key ) {
+
+  case INPUT_KEY_Left:
+  case INPUT_KEY_5:
+  case INPUT_KEY_h:
+  case INPUT_JOYSTICK_LEFT:
+  case INPUT_KEY_Down:
+  case INPUT_KEY_6:
+  case INPUT_KEY_j:
+  case INPUT_JOYSTICK_DOWN:
+  case INPUT_KEY_Up:
+  case INPUT_KEY_7:
+  case INPUT_KEY_k:
+  case INPUT_JOYSTICK_UP:
+  case INPUT_KEY_Right:
+  case INPUT_KEY_8:
+  case INPUT_KEY_l:
+  case INPUT_JOYSTICK_RIGHT:
+#ifdef GCWZERO
+  case INPUT_KEY_Tab:		/* L1 */
+  case INPUT_KEY_BackSpace:	/* R1 */
+#endif
+  case INPUT_KEY_Page_Up:
+  case INPUT_KEY_Page_Down:
+#ifndef GCWZERO
+  case INPUT_KEY_Home:
+  case INPUT_KEY_End:
+#endif
+    return 0;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Alt_L:		/* B */
+  case INPUT_KEY_space:		/* X */
+#else
+  case INPUT_KEY_Escape:
+  case INPUT_KEY_Tab:
+#endif
+  case INPUT_JOYSTICK_FIRE_2:
+    widget_filesel_preview_close();
+    return 1;
+
+  default:
+    widget_filesel_preview_close();
+    return 0;
+
+  }
+}
+#endif /* ifndef AMIGA */
+
 void
 widget_filesel_keyhandler( input_key key )
 {
@@ -1156,6 +1922,8 @@ widget_filesel_keyhandler( input_key key )
 
   new_current_file = current_file;
 
+  if( showing_preview && widget_filesel_preview_key( key ) ) return;
+
   switch(key) {
 
 #if 0
@@ -1353,6 +2121,38 @@ widget_filesel_keyhandler( input_key key )
       } else {
 	widget_end_widget( WIDGET_FINISHED_OK );
       }
+    } else {
+      /* Show the current snapshot's screen in place of the list */
+      showing_preview = 1;
+      preview_pending = 0;
+      widget_filesel_preview_show();
+    }
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Return: /* Start */
+#else
+  case INPUT_KEY_slash:
+#endif
+    {
+      widget_text_t text_data;
+      text_data.title = "Find files containing";
+      text_data.allow = WIDGET_INPUT_ASCII;
+      text_data.max_length = 30;
+      snprintf( text_data.text, sizeof( text_data.text ), "%s",
+                search_text ? search_text : "" );
+
+      /* Cancelling the search shows all the files again, as the
+         selector is redrawn from scratch when the text entry closes */
+      if( widget_do_text( &text_data ) || !widget_text_text ) break;
+
+      if( widget_search( widget_text_text ) ) {
+        ui_error( UI_ERROR_INFO, "No files match `%s'", widget_text_text );
+        break;
+      }
+
+      /* Force a redisplay of all filenames */
+      current_file = top_left_file = new_current_file + 1;
     }
     break;
 
@@ -1398,7 +2198,16 @@ widget_filesel_keyhandler( input_key key )
     /* If we've got off the top or bottom of the currently displayed
        file list, then reset the top-left corner and display the whole
        thing */
-    if( new_current_file < top_left_file ) {
+    if( showing_preview ) {
+
+      /* Just keep the list where it would have been, for going back */
+      if( new_current_file < top_left_file ) {
+        top_left_file = new_current_file & ~1;
+      } else if( new_current_file >= top_left_file+ENTRIES_PER_SCREEN ) {
+        top_left_file = ( new_current_file & ~1 ) - ( ENTRIES_PER_SCREEN - 2 );
+      }
+
+    } else if( new_current_file < top_left_file ) {
 
       top_left_file = new_current_file & ~1;
       widget_print_all_filenames( widget_filenames, widget_numfiles,
@@ -1432,6 +2241,11 @@ widget_filesel_keyhandler( input_key key )
     /* Reset the current file marker */
     current_file = new_current_file;
 
+    if( showing_preview ) {
+      preview_pending = 0;
+      widget_filesel_preview_show();
+    }
+
   }
 
   free( dirtitle );
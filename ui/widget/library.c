@@ -0,0 +1,385 @@
+/* library.c: Search the game library
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "fuse.h"
+#include "library.h"
+#include "utils.h"
+#include "widget_internals.h"
+
+/* How many names are shown at once, and where */
+#define LIBRARY_ROWS 13
+#define LIBRARY_LIST_Y 48
+#define LIBRARY_LIST_WIDTH 160
+
+#define LIBRARY_THUMBNAIL_X 180
+#define LIBRARY_THUMBNAIL_Y 48
+#define LIBRARY_INFO_WIDTH 64
+
+/* While the library is being updated, look for changes every this many
+   idle callbacks */
+#define LIBRARY_REFRESH_INTERVAL 50
+
+/* The file to open, or NULL if none was chosen */
+char *widget_library_name = NULL;
+
+static int is_open = 0;
+
+static library_entry **results = NULL;
+static size_t result_count = 0, current = 0, top = 0;
+
+static char search_text[ 31 ] = "";
+
+static unsigned long shown_generation;
+static size_t shown_files;
+static int shown_updating;
+static int idle_count;
+
+static const char*
+widget_library_class_name( libspectrum_class_t class )
+{
+  switch( class ) {
+  case LIBSPECTRUM_CLASS_SNAPSHOT: return "Snapshot";
+  case LIBSPECTRUM_CLASS_TAPE: return "Tape";
+  case LIBSPECTRUM_CLASS_RECORDING: return "Recording";
+  case LIBSPECTRUM_CLASS_MICRODRIVE: return "Microdrive";
+  case LIBSPECTRUM_CLASS_CARTRIDGE_IF2:
+  case LIBSPECTRUM_CLASS_CARTRIDGE_TIMEX: return "Cartridge";
+  case LIBSPECTRUM_CLASS_DISK_PLUS3:
+  case LIBSPECTRUM_CLASS_DISK_TRDOS:
+  case LIBSPECTRUM_CLASS_DISK_OPUS:
+  case LIBSPECTRUM_CLASS_DISK_PLUSD:
+  case LIBSPECTRUM_CLASS_DISK_DIDAKTIK:
+  case LIBSPECTRUM_CLASS_DISK_GENERIC: return "Disk";
+  default: return "";
+  }
+}
+
+/* Print `text' at (`x',`y'), cut short to fit in `width' pixels */
+static void
+widget_library_print( int x, int y, int width, int colour, const char *text )
+{
+  char buffer[ 64 ];
+
+  snprintf( buffer, sizeof( buffer ), "%s", text );
+  while( *buffer && widget_stringwidth( buffer ) > (size_t)width )
+    buffer[ strlen( buffer ) - 1 ] = '\0';
+
+  widget_printstring( x, y, colour, buffer );
+}
+
+static void
+widget_library_print_thumbnail( const library_entry *entry )
+{
+  libspectrum_byte pixels;
+  int x, y;
+
+  if( !entry->thumbnail ) return;
+
+  for( y = 0; y < LIBRARY_THUMBNAIL_HEIGHT; y++ ) {
+    for( x = 0; x < LIBRARY_THUMBNAIL_WIDTH; x += 2 ) {
+      pixels = entry->thumbnail[ ( y * LIBRARY_THUMBNAIL_WIDTH + x ) / 2 ];
+      widget_putpixel( LIBRARY_THUMBNAIL_X + x, LIBRARY_THUMBNAIL_Y + y,
+                       pixels >> 4 );
+      widget_putpixel( LIBRARY_THUMBNAIL_X + x + 1, LIBRARY_THUMBNAIL_Y + y,
+                       pixels & 0x0f );
+    }
+  }
+}
+
+static void
+widget_library_redraw( void )
+{
+  const library_entry *entry;
+  char buffer[ 64 ];
+  size_t i;
+  int y;
+
+  widget_dialog_with_border( 1, 2, 30, 20 );
+  widget_printstring( 10, 16, WIDGET_COLOUR_TITLE, "Game Library" );
+
+  snprintf( buffer, sizeof( buffer ), "Find: %s", search_text );
+  widget_library_print( 16, 32, 224, WIDGET_COLOUR_FOREGROUND, buffer );
+
+  if( top ) widget_up_arrow( 1, LIBRARY_LIST_Y / 8, WIDGET_COLOUR_FOREGROUND );
+
+  for( i = top; i < result_count && i < top + LIBRARY_ROWS; i++ ) {
+    y = LIBRARY_LIST_Y + ( i - top ) * 8;
+    widget_rectangle( 16, y, LIBRARY_LIST_WIDTH, 8,
+                      i == current ? WIDGET_COLOUR_HIGHLIGHT :
+                                     WIDGET_COLOUR_BACKGROUND );
+    widget_library_print( 17, y, LIBRARY_LIST_WIDTH - 2,
+                          WIDGET_COLOUR_FOREGROUND, results[i]->name );
+  }
+
+  if( top + LIBRARY_ROWS < result_count )
+    widget_down_arrow( 1, LIBRARY_LIST_Y / 8 + LIBRARY_ROWS - 1,
+                       WIDGET_COLOUR_FOREGROUND );
+
+  if( result_count ) {
+    entry = results[ current ];
+
+    widget_library_print_thumbnail( entry );
+
+    y = LIBRARY_THUMBNAIL_Y + LIBRARY_THUMBNAIL_HEIGHT + 8;
+    widget_library_print( LIBRARY_THUMBNAIL_X, y, LIBRARY_INFO_WIDTH,
+                          WIDGET_COLOUR_FOREGROUND,
+                          widget_library_class_name( entry->class ) );
+    if( entry->machine != LIBSPECTRUM_MACHINE_UNKNOWN )
+      widget_library_print( LIBRARY_THUMBNAIL_X, y + 8, LIBRARY_INFO_WIDTH,
+                            WIDGET_COLOUR_FOREGROUND,
+                            libspectrum_machine_name( entry->machine ) );
+    snprintf( buffer, sizeof( buffer ), "%lu bytes",
+              (unsigned long)entry->size );
+    widget_library_print( LIBRARY_THUMBNAIL_X, y + 16, LIBRARY_INFO_WIDTH,
+                          WIDGET_COLOUR_FOREGROUND, buffer );
+  } else {
+    widget_printstring( 17, LIBRARY_LIST_Y, WIDGET_COLOUR_FOREGROUND,
+                        shown_updating ? "Looking for games..." :
+                                         "No games found" );
+  }
+
+  shown_updating = library_updating( &shown_files );
+  if( shown_updating ) {
+    snprintf( buffer, sizeof( buffer ), "Indexing: %lu files",
+              (unsigned long)shown_files );
+  } else {
+    snprintf( buffer, sizeof( buffer ), "%lu of %lu", (unsigned long)
+              ( result_count ? current + 1 : 0 ),
+              (unsigned long)result_count );
+  }
+  widget_printstring_right( 240, 160, WIDGET_COLOUR_FOREGROUND, buffer );
+
+  widget_display_lines( 2, 20 );
+}
+
+/* Search the library again, staying on the same file if it's still
+   there */
+static void
+widget_library_search( void )
+{
+  library_entry *selected = result_count ? results[ current ] : NULL;
+  size_t i;
+
+  libspectrum_free( results );
+
+  shown_generation = library_generation();
+  result_count = library_search( search_text, &results );
+
+  current = 0;
+  for( i = 0; selected && i < result_count; i++ )
+    if( results[i] == selected ) { current = i; break; }
+
+  if( current < top || current >= top + LIBRARY_ROWS )
+    top = current > LIBRARY_ROWS / 2 ? current - LIBRARY_ROWS / 2 : 0;
+}
+
+int
+widget_library_draw( void *data GCC_UNUSED )
+{
+  /* This is called again whenever a widget opened from here closes */
+  if( !is_open ) {
+    is_open = 1;
+
+    libspectrum_free( widget_library_name );
+    widget_library_name = NULL;
+
+    library_update();
+
+    result_count = current = top = 0;
+    idle_count = 0;
+    widget_library_search();
+  }
+
+  widget_library_redraw();
+
+  return 0;
+}
+
+void
+widget_library_idle( void )
+{
+  size_t files;
+  int updating;
+
+  if( ++idle_count < LIBRARY_REFRESH_INTERVAL ) return;
+  idle_count = 0;
+
+  updating = library_updating( &files );
+
+  if( library_generation() != shown_generation ) {
+    widget_library_search();
+  } else if( updating == shown_updating && files == shown_files ) {
+    return;
+  }
+
+  widget_library_redraw();
+}
+
+int
+widget_library_finish( widget_finish_state finished GCC_UNUSED )
+{
+  is_open = 0;
+
+  libspectrum_free( results );
+  results = NULL;
+  result_count = current = top = 0;
+
+  return 0;
+}
+
+void
+widget_library_keyhandler( input_key key )
+{
+  size_t new_current = current;
+
+  switch( key ) {
+
+#ifdef GCWZERO
+  case INPUT_KEY_Home: /* Power   */
+  case INPUT_KEY_End:  /* RetroFW */
+    widget_end_all( WIDGET_FINISHED_CANCEL );
+    return;
+#endif
+
+#ifdef GCWZERO
+  case INPUT_KEY_Alt_L: /* B */
+#else
+  case INPUT_KEY_Escape:
+#endif
+  case INPUT_JOYSTICK_FIRE_2:
+    widget_end_widget( WIDGET_FINISHED_CANCEL );
+    return;
+
+  case INPUT_KEY_Up:
+  case INPUT_KEY_7:
+  case INPUT_KEY_k:
+  case INPUT_JOYSTICK_UP:
+    if( current ) new_current--;
+    break;
+
+  case INPUT_KEY_Down:
+  case INPUT_KEY_6:
+  case INPUT_KEY_j:
+  case INPUT_JOYSTICK_DOWN:
+    if( current + 1 < result_count ) new_current++;
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Tab: /* L1 */
+#else
+  case INPUT_KEY_Page_Up:
+#endif
+  case INPUT_KEY_Left:
+  case INPUT_KEY_5:
+  case INPUT_KEY_h:
+  case INPUT_JOYSTICK_LEFT:
+    new_current = current > LIBRARY_ROWS ? current - LIBRARY_ROWS : 0;
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_BackSpace: /* R1 */
+#else
+  case INPUT_KEY_Page_Down:
+#endif
+  case INPUT_KEY_Right:
+  case INPUT_KEY_8:
+  case INPUT_KEY_l:
+  case INPUT_JOYSTICK_RIGHT:
+    new_current = current + LIBRARY_ROWS;
+    if( new_current >= result_count )
+      new_current = result_count ? result_count - 1 : 0;
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Page_Up:  /* L2 */
+#else
+  case INPUT_KEY_Home:
+#endif
+    new_current = 0;
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Page_Down: /* R2 */
+#else
+  case INPUT_KEY_End:
+#endif
+    new_current = result_count ? result_count - 1 : 0;
+    break;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Return: /* Start */
+#else
+  case INPUT_KEY_slash:
+#endif
+    {
+      widget_text_t text_data;
+      text_data.title = "Find games containing";
+      text_data.allow = WIDGET_INPUT_ASCII;
+      text_data.max_length = sizeof( search_text ) - 1;
+      snprintf( text_data.text, sizeof( text_data.text ), "%s", search_text );
+
+      /* This widget is drawn again when the text entry closes */
+      if( widget_do_text( &text_data ) || !widget_text_text ) return;
+
+      snprintf( search_text, sizeof( search_text ), "%s", widget_text_text );
+      result_count = current = top = 0;
+      widget_library_search();
+      widget_library_redraw();
+    }
+    return;
+
+#ifdef GCWZERO
+  case INPUT_KEY_Control_L: /* A */
+#else
+  case INPUT_KEY_Return:
+  case INPUT_KEY_KP_Enter:
+#endif
+  case INPUT_JOYSTICK_FIRE_1:
+    if( !result_count ) return;
+    widget_library_name = utils_safe_strdup( results[ current ]->path );
+    widget_end_all( WIDGET_FINISHED_OK );
+    return;
+
+  default:	/* Keep gcc happy */
+    return;
+
+  }
+
+  if( new_current == current ) return;
+
+  current = new_current;
+  if( current < top ) {
+    top = current;
+  } else if( current >= top + LIBRARY_ROWS ) {
+    top = current - LIBRARY_ROWS + 1;
+  }
+
+  widget_library_redraw();
+}
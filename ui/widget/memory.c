@@ -28,6 +28,7 @@
 
 #include "compat.h"
 #include "debugger/debugger.h"
+#include "memory_usage.h"
 #include "pokefinder/pokefinder.h"
 #include "ui/ui.h"
 #include "widget.h"
@@ -35,38 +36,76 @@
 
 static libspectrum_word memaddr = 0;
 
+/* What's on screen, so moving around only redraws the addresses and
+   bytes which have changed */
+static int drawn_valid = 0;
+static libspectrum_word drawn_addr;
+static libspectrum_byte drawn_bytes[ 16 * 8 ];
+
 #define LC(X) ( (X)*8 - DISPLAY_BORDER_ASPECT_WIDTH )
 #define LR(Y) ( (Y)*8 - DISPLAY_BORDER_HEIGHT )
 
-int
-widget_memory_draw( void *data )
+static void
+memory_update( void )
 {
-  int x, y;
-  char pbuf[36];
+  int x, y, full = !drawn_valid;
+  char pbuf[8];
 
-  widget_rectangle( LC(0), LR(0), 40 * 8, 16 * 8 + 4, 1 );
-  widget_rectangle( LC(0), LR(16) + 2, 320, 1, 7 );
+  if( full ) {
+    widget_rectangle( LC(0), LR(0), 40 * 8, 16 * 8 + 4, 1 );
+    widget_rectangle( LC(0), LR(16) + 2, 320, 1, 7 );
+  }
 
   for( y = 0; y < 16; ++y ) {
     libspectrum_word addr = memaddr + y * 8;
 
-    sprintf( pbuf, "%04X:", addr );
-    widget_printstring_right( LC(5) - 4, LR(y), 5, pbuf );
+    if( full || memaddr != drawn_addr ) {
+      sprintf( pbuf, "%04X:", addr );
+      if( !full ) widget_rectangle( LC(0), LR(y), 5 * 8 - 4, 8, 1 );
+      widget_printstring_right( LC(5) - 4, LR(y), 5, pbuf );
+    }
 
     for( x = 0; x < 8; ++x ) {
       libspectrum_byte b = readbyte_internal( addr + x );
 
+      if( !full && b == drawn_bytes[ y * 8 + x ] ) continue;
+      drawn_bytes[ y * 8 + x ] = b;
+
+      if( !full ) {
+        widget_rectangle( LC(x * 3 + 5), LR(y), 2 * 8, 8, 1 );
+        widget_rectangle( LC(x + 29), LR(y), 8, 8, 1 );
+      }
       widget_printchar_fixed( LC(x + 29) / 8, LR(y) / 8, 7 - (y & 1), b );
-      sprintf( pbuf + x * 3, "%02X ", b );
+      sprintf( pbuf, "%02X", b );
+      widget_printstring_fixed( LC(x * 3 + 5) / 8, LR(y) / 8, 7 - (y & 1),
+                                pbuf );
     }
-    widget_printstring_fixed( LC(5) / 8, LR(y) / 8, 7 - (y & 1), pbuf );
   }
 
+  drawn_addr = memaddr;
+  drawn_valid = 1;
+
+  /* Only the parts drawn on above are actually sent to the display */
   widget_display_lines( LR(0) / 8, 17 );
+}
+
+int
+widget_memory_draw( void *data )
+{
+  /* Whatever was here before has gone, so start again */
+  drawn_valid = 0;
+  memory_update();
 
   return 0;
 }
 
+int
+widget_memory_finish( widget_finish_state finished GCC_UNUSED )
+{
+  drawn_valid = 0;
+  return 0;
+}
+
 void
 widget_memory_keyhandler( input_key key )
 {
@@ -95,34 +134,106 @@ widget_memory_keyhandler( input_key key )
 
   /* Address selection */
   case INPUT_KEY_Up:
-    memaddr -= 16;    widget_memory_draw( NULL ); break;
+    memaddr -= 16;    memory_update(); break;
   case INPUT_KEY_Down:
-    memaddr += 16;    widget_memory_draw( NULL ); break;
+    memaddr += 16;    memory_update(); break;
 #ifdef GCWZERO
   case INPUT_KEY_Tab:
 #else
   case INPUT_KEY_Page_Up:
 #endif
-    memaddr -= 128;   widget_memory_draw( NULL ); break;
+    memaddr -= 128;   memory_update(); break;
 #ifdef GCWZERO
   case INPUT_KEY_BackSpace:
 #else
   case INPUT_KEY_Page_Down:
 #endif
-    memaddr += 128;   widget_memory_draw( NULL ); break;
+    memaddr += 128;   memory_update(); break;
 #ifdef GCWZERO
   case INPUT_KEY_Page_Up:
 #else
   case INPUT_KEY_Home:
 #endif
-    memaddr = 0;      widget_memory_draw( NULL ); break;
+    memaddr = 0;      memory_update(); break;
 #ifdef GCWZERO
   case INPUT_KEY_Page_Down:
 #else
   case INPUT_KEY_End:
 #endif
-    memaddr = 0xFF80; widget_memory_draw( NULL ); break;
+    memaddr = 0xFF80; memory_update(); break;
 
   default:;
   }
 }
+
+int
+widget_memory_usage_draw( void *data GCC_UNUSED )
+{
+  char buffer[16];
+  size_t current = 0, peak = 0;
+  int i, line = 0;
+
+  widget_dialog_with_border( 1, 2, 30, MEMORY_USAGE_TYPES + 4 );
+  widget_printstring( 10, 16, WIDGET_COLOUR_TITLE, "Memory Usage" );
+
+  widget_printstring_right( 176, ++line * 8 + 24, WIDGET_COLOUR_FOREGROUND,
+                            "Current" );
+  widget_printstring_right( 240, line * 8 + 24, WIDGET_COLOUR_FOREGROUND,
+                            "Peak" );
+
+  for( i = 0; i < MEMORY_USAGE_TYPES; i++ ) {
+    widget_printstring( 16, ++line * 8 + 24, WIDGET_COLOUR_FOREGROUND,
+                        memory_usage_name( i ) );
+
+    memory_usage_describe( buffer, sizeof( buffer ),
+                           memory_usage_current( i ) );
+    widget_printstring_right( 176, line * 8 + 24, WIDGET_COLOUR_FOREGROUND,
+                              buffer );
+
+    memory_usage_describe( buffer, sizeof( buffer ), memory_usage_peak( i ) );
+    widget_printstring_right( 240, line * 8 + 24, WIDGET_COLOUR_FOREGROUND,
+                              buffer );
+
+    current += memory_usage_current( i ); peak += memory_usage_peak( i );
+  }
+
+  /* As in memory_usage_print(), the total peak is only an upper bound */
+  widget_printstring( 16, ++line * 8 + 24, WIDGET_COLOUR_TITLE, "Total" );
+  memory_usage_describe( buffer, sizeof( buffer ), current );
+  widget_printstring_right( 176, line * 8 + 24, WIDGET_COLOUR_TITLE, buffer );
+  memory_usage_describe( buffer, sizeof( buffer ), peak );
+  widget_printstring_right( 240, line * 8 + 24, WIDGET_COLOUR_TITLE, buffer );
+
+  widget_display_lines( 2, line + 3 );
+
+  return 0;
+}
+
+void
+widget_memory_usage_keyhandler( input_key key )
+{
+  switch( key ) {
+#ifdef GCWZERO
+  case INPUT_KEY_Home:
+  case INPUT_KEY_End: /* RetroFW */
+    widget_end_all( WIDGET_FINISHED_OK );
+    return;
+#endif
+
+#ifdef GCWZERO
+  case INPUT_KEY_Alt_L:
+  case INPUT_KEY_Control_L:
+#endif
+  case INPUT_KEY_Escape:
+  case INPUT_KEY_Return:
+  case INPUT_KEY_KP_Enter:
+  case INPUT_JOYSTICK_FIRE_1:
+  case INPUT_JOYSTICK_FIRE_2:
+    widget_end_widget( WIDGET_FINISHED_OK );
+    return;
+
+  default:	/* Keep gcc happy */
+    break;
+
+  }
+}
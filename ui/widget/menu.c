@@ -29,6 +29,7 @@
 #include <string.h>
 
 #include "debugger/debugger.h"
+#include "embedded.h"
 #include "event.h"
 #include "fuse.h"
 #include "keyboard.h"
@@ -656,6 +657,24 @@ menu_get_scaler( scaler_available_fn selector )
   fuse_abort();
 }
 
+void
+menu_file_library( int action )
+{
+  fuse_emulation_pause();
+
+  widget_do_library();
+  if( !widget_library_name ) { fuse_emulation_unpause(); return; }
+
+  utils_open_file( widget_library_name, tape_can_autoload(), NULL );
+
+  libspectrum_free( widget_library_name );
+  widget_library_name = NULL;
+
+  display_refresh_all();
+
+  fuse_emulation_unpause();
+}
+
 void
 menu_file_exit( int action )
 {
@@ -1094,7 +1113,7 @@ menu_machine_select( int action )
 void
 menu_machine_debugger( int action )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
   widget_do_debugger();
 }
 
@@ -1116,6 +1135,12 @@ menu_machine_memorybrowser( int action )
   widget_do_memorybrowser();
 }
 
+void
+menu_machine_memoryusage( int action )
+{
+  widget_do_memoryusage();
+}
+
 void
 menu_media_tape_browse( int action )
 {
@@ -1125,22 +1150,13 @@ menu_media_tape_browse( int action )
 void
 menu_help_keyboard( int action )
 {
-  utils_file screen;
   widget_picture_data info;
 
-  static const char * const filename = "keyboard.scr";
-
-  if( utils_read_screen( filename, &screen ) ) {
-    return;
-  }
-
-  info.filename = filename;
-  info.screen = screen.buffer;
+  info.filename = "keyboard.scr";
+  info.screen = embedded_keyboard_scr;
   info.border = 0;
 
   widget_do_picture( &info );
-
-  utils_close_file( &screen );
 }
 
 void
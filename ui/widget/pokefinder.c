@@ -64,8 +64,11 @@ widget_pokefinder_draw( void *data )
   display_value();
 
   widget_printstring( 16, 88, WIDGET_COLOUR_FOREGROUND,
-		      "\x0AI\x01nc'd \x0A" "D\x01" "ec'd \x0AS\x01" "earch" );
+		      "\x0AI\x01nc'd \x0A" "D\x01" "ec'd \x0AS\x01" "earch "
+		      "\x0AW\x01ord" );
   widget_printstring( 16, 96, WIDGET_COLOUR_FOREGROUND, "\x0AR\x01" "eset \x0A" "C\x01lose" );
+  widget_printstring( 16, 104, WIDGET_COLOUR_FOREGROUND,
+		      "Ch\x0A" "a\x01nged U\x0An\x01" "changed" );
 
   widget_display_lines( 2, 12 );
 
@@ -143,7 +146,7 @@ display_value( void )
   char buf[16];
 
   snprintf( buf, sizeof( buf ), "%d", value );
-  widget_rectangle( 72, 32, 24, 8, WIDGET_COLOUR_BACKGROUND );
+  widget_rectangle( 72, 32, 40, 8, WIDGET_COLOUR_BACKGROUND );
   widget_printstring( 72, 32, WIDGET_COLOUR_FOREGROUND, buf );
   widget_display_lines( 4, 1 );
 }
@@ -199,12 +202,24 @@ widget_pokefinder_keyhandler( input_key key )
     display_possible();
     break;
 
-  case INPUT_KEY_d:		/* Search for incremented */
+  case INPUT_KEY_d:		/* Search for decremented */
     pokefinder_decremented();
     update_possible();
     display_possible();
     break;
 
+  case INPUT_KEY_a:		/* Search for changed */
+    pokefinder_changed();
+    update_possible();
+    display_possible();
+    break;
+
+  case INPUT_KEY_n:		/* Search for unchanged */
+    pokefinder_unchanged();
+    update_possible();
+    display_possible();
+    break;
+
   case INPUT_KEY_Return:
   case INPUT_KEY_KP_Enter:
   case INPUT_KEY_s:		/* Search */
@@ -215,6 +230,12 @@ widget_pokefinder_keyhandler( input_key key )
     }
     break;
 
+  case INPUT_KEY_w:		/* Search for a 16-bit value */
+    pokefinder_search_range( POKEFINDER_WIDTH_WORD, value, value );
+    update_possible();
+    display_possible();
+    break;
+
   case INPUT_KEY_r:		/* Reset */
     pokefinder_clear();
     update_possible();
@@ -274,7 +295,8 @@ widget_pokefinder_keyhandler( input_key key )
   case INPUT_KEY_7:
   case INPUT_KEY_8:
   case INPUT_KEY_9:
-    value = (value % 100) * 10 + key - INPUT_KEY_0;
+    value = (value % 10000) * 10 + key - INPUT_KEY_0;
+    if( value > 0xffff ) value = key - INPUT_KEY_0;
     display_value();
     break;
 
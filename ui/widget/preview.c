@@ -0,0 +1,397 @@
+/* preview.c: Snapshot screens for the file selector
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * Getting the screen out of a snapshot means reading and decompressing
+ * all of it, which is too slow to do while the file selector is waiting
+ * for a key. The screens are extracted on a background thread instead,
+ * and the selector picks them up from its idle callback once they're
+ * ready. Each screen is also kept on disk in "previews" in the
+ * configuration directory, named after a hash of the snapshot's path and
+ * marked with its size and modification time, so it's only extracted
+ * again if the snapshot changes. A cache file is "FPRV", a dword version
+ * (1), the snapshot's size and mtime as dwords, then the screen.
+ */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_STRCASECMP
+#include <strings.h>
+#endif      /* #ifdef HAVE_STRINGS_STRCASECMP */
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "compat.h"
+#include "fuse.h"
+#include "snapshot.h"
+#include "thread_sched.h"
+#include "utils.h"
+#include "widget_internals.h"
+
+#define PREVIEW_DIRECTORY "previews"
+#define PREVIEW_VERSION 1
+#define PREVIEW_HEADER_LENGTH 16
+
+/* The screens looked at most recently, most recent first */
+#define PREVIEW_CACHE_SIZE 16
+
+typedef struct preview_cache_entry {
+  char *filename;
+  int valid;			/* Did we get a screen out of the snapshot? */
+  libspectrum_byte screen[ SNAPSHOT_SCREEN_LENGTH ];
+} preview_cache_entry;
+
+static preview_cache_entry *preview_cache[ PREVIEW_CACHE_SIZE ];
+
+/* Where the screens are kept on disk; NULL until first needed */
+static char *preview_dir = NULL;
+
+static const char * const snapshot_extensions[] = {
+  ".mgtsnp", ".slt", ".sna", ".snp", ".sp", ".szx", ".z80", ".zx-state",
+  ".zxs", NULL
+};
+
+int
+widget_preview_is_snapshot( const char *filename )
+{
+  const char *dot, *end;
+  size_t i, length;
+
+  /* Look past any compression to what's inside */
+  end = filename + strlen( filename );
+  dot = strrchr( filename, '.' );
+  if( dot && ( !strcasecmp( dot, ".gz" ) || !strcasecmp( dot, ".bz2" ) ) ) {
+    end = dot;
+    for( dot = end - 1; dot >= filename && *dot != '.'; dot-- )
+      ;
+    if( dot < filename ) return 0;
+  }
+  if( !dot || dot == filename ) return 0;
+
+  length = end - dot;
+  for( i = 0; snapshot_extensions[i]; i++ )
+    if( strlen( snapshot_extensions[i] ) == length &&
+        !strncasecmp( dot, snapshot_extensions[i], length ) )
+      return 1;
+
+  return 0;
+}
+
+/* The disk cache file for `filename': the 64-bit FNV-1a hash of the
+   name, in hex */
+static void
+preview_cache_filename( char *buffer, size_t length, const char *filename )
+{
+  libspectrum_qword hash = 0xcbf29ce484222325ULL;
+  const unsigned char *ptr;
+
+  for( ptr = (const unsigned char*)filename; *ptr; ptr++ ) {
+    hash ^= *ptr;
+    hash *= 0x100000001b3ULL;
+  }
+
+  snprintf( buffer, length, "%s" FUSE_DIR_SEP_STR "%08lx%08lx.fpv",
+            preview_dir, (unsigned long)( hash >> 32 ),
+            (unsigned long)( hash & 0xffffffff ) );
+}
+
+/* Fill in `header' with what a cache file for a snapshot with `info'
+   starts with */
+static void
+preview_cache_header( libspectrum_byte *header, const struct stat *info )
+{
+  libspectrum_byte *ptr = header;
+
+  memcpy( ptr, "FPRV", 4 ); ptr += 4;
+  libspectrum_write_dword( &ptr, PREVIEW_VERSION );
+  libspectrum_write_dword( &ptr, info->st_size );
+  libspectrum_write_dword( &ptr, info->st_mtime );
+}
+
+/* Get the screen for the snapshot `filename' from the disk cache,
+   extracting it and adding it there if it isn't. This can run on the
+   extraction thread, so doesn't touch the UI. Returns non-zero if the
+   snapshot couldn't be read */
+static int
+preview_load( const char *filename, libspectrum_byte *screen )
+{
+  char cache_name[ PATH_MAX ], tmpname[ PATH_MAX ];
+  libspectrum_byte header[ PREVIEW_HEADER_LENGTH ],
+    cached[ PREVIEW_HEADER_LENGTH ];
+  struct stat info;
+  FILE *f;
+  int found = 0;
+
+  if( stat( filename, &info ) ) return 1;
+
+  preview_cache_header( header, &info );
+  preview_cache_filename( cache_name, sizeof( cache_name ), filename );
+
+  f = fopen( cache_name, "rb" );
+  if( f ) {
+    found =
+      fread( cached, 1, PREVIEW_HEADER_LENGTH, f ) == PREVIEW_HEADER_LENGTH &&
+      !memcmp( cached, header, PREVIEW_HEADER_LENGTH ) &&
+      fread( screen, 1, SNAPSHOT_SCREEN_LENGTH, f ) == SNAPSHOT_SCREEN_LENGTH;
+    fclose( f );
+    if( found ) return 0;
+  }
+
+  if( snapshot_read_screen( filename, screen ) ) return 1;
+
+  /* Not being able to cache the screen just means extracting it again
+     next time, so failures here are ignored. Written to a temporary file
+     and renamed into place, so a half-written file is never read */
+#ifdef WIN32
+  mkdir( preview_dir );
+#else
+  mkdir( preview_dir, 0755 );
+#endif
+
+  snprintf( tmpname, sizeof( tmpname ), "%s.tmp", cache_name );
+  f = fopen( tmpname, "wb" );
+  if( !f ) return 0;
+
+  found =
+    fwrite( header, 1, PREVIEW_HEADER_LENGTH, f ) == PREVIEW_HEADER_LENGTH &&
+    fwrite( screen, 1, SNAPSHOT_SCREEN_LENGTH, f ) == SNAPSHOT_SCREEN_LENGTH;
+
+  if( fclose( f ) || !found || rename( tmpname, cache_name ) )
+    unlink( tmpname );
+
+  return 0;
+}
+
+/* Put the screen for `filename' at the front of the memory cache,
+   dropping the least recently used one if it's full */
+static void
+preview_cache_add( const char *filename, const libspectrum_byte *screen,
+                   int valid )
+{
+  preview_cache_entry *entry;
+  size_t i;
+
+  for( i = 0; i < PREVIEW_CACHE_SIZE && preview_cache[i]; i++ )
+    ;
+
+  if( i == PREVIEW_CACHE_SIZE ) {
+    entry = preview_cache[ --i ];
+    libspectrum_free( entry->filename );
+  } else {
+    entry = libspectrum_new( preview_cache_entry, 1 );
+  }
+
+  entry->filename = utils_safe_strdup( filename );
+  entry->valid = valid;
+  if( valid ) memcpy( entry->screen, screen, SNAPSHOT_SCREEN_LENGTH );
+
+  memmove( &preview_cache[1], &preview_cache[0],
+           i * sizeof( *preview_cache ) );
+  preview_cache[0] = entry;
+}
+
+/* Find `filename' in the memory cache, moving it to the front */
+static preview_cache_entry*
+preview_cache_find( const char *filename )
+{
+  preview_cache_entry *entry;
+  size_t i;
+
+  for( i = 0; i < PREVIEW_CACHE_SIZE && preview_cache[i]; i++ )
+    if( !strcmp( preview_cache[i]->filename, filename ) ) break;
+
+  if( i == PREVIEW_CACHE_SIZE || !preview_cache[i] ) return NULL;
+
+  entry = preview_cache[i];
+  memmove( &preview_cache[1], &preview_cache[0],
+           i * sizeof( *preview_cache ) );
+  preview_cache[0] = entry;
+
+  return entry;
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * Only one screen is ever waiting to be extracted: if the selector moves
+ * on before it's started, whatever it wants now replaces it. `wanted'
+ * and `preview_cache' belong to whoever holds `preview_mutex'.
+ */
+
+static pthread_t preview_thread;
+static pthread_mutex_t preview_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t preview_cond = PTHREAD_COND_INITIALIZER;
+
+static int preview_running = 0;
+static int preview_quit;
+
+static char *wanted = NULL;	/* Waiting to be extracted */
+static char *working = NULL;	/* Being extracted */
+
+static void*
+preview_thread_fn( void *arg GCC_UNUSED )
+{
+  libspectrum_byte screen[ SNAPSHOT_SCREEN_LENGTH ];
+  int error;
+
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+  pthread_mutex_lock( &preview_mutex );
+
+  while( 1 ) {
+
+    if( preview_quit ) break;
+
+    if( !wanted ) {
+      pthread_cond_wait( &preview_cond, &preview_mutex );
+      continue;
+    }
+
+    working = wanted;
+    wanted = NULL;
+
+    pthread_mutex_unlock( &preview_mutex );
+
+    error = preview_load( working, screen );
+
+    pthread_mutex_lock( &preview_mutex );
+
+    preview_cache_add( working, screen, !error );
+    libspectrum_free( working );
+    working = NULL;
+  }
+
+  pthread_mutex_unlock( &preview_mutex );
+
+  return NULL;
+}
+
+/* Start the extraction thread if it isn't already running. Returns
+   non-zero if it couldn't be */
+static int
+preview_start( void )
+{
+  if( preview_running ) return 0;
+
+  preview_quit = 0;
+  if( pthread_create( &preview_thread, NULL, preview_thread_fn, NULL ) ) {
+    fprintf( stderr, "%s: couldn't start preview thread\n", fuse_progname );
+    return 1;
+  }
+  preview_running = 1;
+
+  return 0;
+}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+const libspectrum_byte*
+widget_preview_get( const char *filename, int *ready )
+{
+  libspectrum_byte screen[ SNAPSHOT_SCREEN_LENGTH ];
+  preview_cache_entry *entry;
+  int error;
+
+  if( !preview_dir ) {
+    char buffer[ PATH_MAX ];
+    snprintf( buffer, sizeof( buffer ), "%s" FUSE_DIR_SEP_STR
+              PREVIEW_DIRECTORY, compat_get_config_path() );
+    preview_dir = utils_safe_strdup( buffer );
+  }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock( &preview_mutex );
+#endif
+
+  entry = preview_cache_find( filename );
+  if( entry ) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &preview_mutex );
+#endif
+    /* This is at the front of the cache now, so won't be reused for
+       another screen until many more have been added */
+    *ready = 1;
+    return entry->valid ? entry->screen : NULL;
+  }
+
+#ifdef HAVE_PTHREAD
+  if( !preview_start() ) {
+    if( !working || strcmp( working, filename ) ) {
+      libspectrum_free( wanted );
+      wanted = utils_safe_strdup( filename );
+      pthread_cond_signal( &preview_cond );
+    }
+    pthread_mutex_unlock( &preview_mutex );
+    *ready = 0;
+    return NULL;
+  }
+  pthread_mutex_unlock( &preview_mutex );
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  /* No extraction thread, so do it now */
+  error = preview_load( filename, screen );
+  preview_cache_add( filename, screen, !error );
+
+  *ready = 1;
+  return error ? NULL : preview_cache[0]->screen;
+}
+
+void
+widget_preview_end( void )
+{
+  size_t i;
+
+#ifdef HAVE_PTHREAD
+  if( preview_running ) {
+    pthread_mutex_lock( &preview_mutex );
+    preview_quit = 1;
+    pthread_cond_signal( &preview_cond );
+    pthread_mutex_unlock( &preview_mutex );
+
+    pthread_join( preview_thread, NULL );
+    preview_running = 0;
+  }
+
+  libspectrum_free( wanted );
+  wanted = NULL;
+#endif			/* #ifdef HAVE_PTHREAD */
+
+  for( i = 0; i < PREVIEW_CACHE_SIZE && preview_cache[i]; i++ ) {
+    libspectrum_free( preview_cache[i]->filename );
+    libspectrum_free( preview_cache[i] );
+    preview_cache[i] = NULL;
+  }
+
+  libspectrum_free( preview_dir );
+  preview_dir = NULL;
+}
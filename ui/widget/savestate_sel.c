@@ -189,7 +189,7 @@ widget_add_savestate( int *allocated, int index, int slot,
     return -1;
   }
 
-  char* info = get_savestate_last_change( slot );
+  char* info = savestate_slot_last_change( slot );
   if (!info) info = strdup( "Empty" );
   int length_info = strlen( info ) + 1;
   (*namelist)[index]->info = malloc( length_info );
@@ -237,17 +237,18 @@ widget_search_savestates( struct widget_stateent ***namelist )
   number = 0;
   index = 0;
 
+  /* Everything we need to know about the slots comes from the index */
+  savestate_index_refresh();
+
   for ( number = 0; number < MAX_SAVESTATES; number++ ) {
-    if ( !is_saving && !check_current_savestate_exist(number) )
+    if ( !is_saving && !savestate_slot_used(number) )
       continue;
 
-    char* name;
-    name = quicksave_get_filename(number);
-    if( widget_add_savestate( &allocated, index, number, namelist, name ) ) {
-      if ( name ) libspectrum_free( name );
+    char name[ 16 ];
+    snprintf( name, sizeof( name ), "%02d%s", number,
+              settings_current.od_quicksave_format );
+    if( widget_add_savestate( &allocated, index, number, namelist, name ) )
       return -1;
-    }
-    libspectrum_free(name);
 
     index++;
   }
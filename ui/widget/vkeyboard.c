@@ -36,10 +36,10 @@
 #include "keyboard.h"
 
 static int position = 1;
-static void widget_print_keyboard( void );
+static void widget_print_keyboard( int redraw_all );
 static void widget_input_keyboard( input_key key );
 static void widget_release_keyboard( input_key key );
-static void widget_print_key( int row, int key, int active );
+static void widget_print_key( int row, int key, int active, int redraw_all );
 static void widget_vkeyboard_input( keyboard_key_name spectrum_key, int press );
 static void widget_vkeyboard_options_input( input_key, int press );
 
@@ -93,6 +93,14 @@ static int actual_row = 0, actual_key = 0;
 static int press_row = 0, press_key = 0;
 static int keyboard_upper = 0;
 
+/* How each key was last drawn on the keyboard canvas */
+typedef struct keyboard_drawn_key {
+  int paper, ink;
+  const char *label;
+} keyboard_drawn_key;
+
+static keyboard_drawn_key drawn_keys[4][10];
+
 #define LOCK_KEY                  1 /* Blue bright 0 */
 #define FIXED_KEY                 2 /* Red bright 0 */
 #define SELECTED_KEY              5 /* Cyan bright 0 */
@@ -101,9 +109,11 @@ static int keyboard_upper = 0;
 #define INK_KEY                  15 /* White bright 1 */
 #define INK_KEY_OPTIONS           0 /* Black bright 0 */
 
-void widget_print_key( int row, int key, int active )
+void widget_print_key( int row, int key, int active, int redraw_all )
 {
   int paper, ink, x, y;
+  const char *label;
+  keyboard_drawn_key *drawn = &drawn_keys[row][key];
 
   if ( one_time_fixed_keys[row][key] )
     paper = LOCK_KEY;
@@ -116,24 +126,36 @@ void widget_print_key( int row, int key, int active )
   else
     paper = NOT_SELECTED_KEY;
   ink = (ui_widget_level >= 0) ? INK_KEY_OPTIONS : INK_KEY;
+  label = (ui_widget_level >= 0)
+            ? (keyboard_upper) ? vkeyboard_options_u[row][key].label
+                               : vkeyboard_options[row][key].label
+            : vkeyboard[row][key].label;
+
+  /* The canvas keeps what was drawn on it, so only keys which look
+     different need drawing again */
+  if ( !redraw_all && drawn->paper == paper && drawn->ink == ink &&
+       drawn->label == label )
+    return;
+
+  drawn->paper = paper;
+  drawn->ink = ink;
+  drawn->label = label;
+
   x = key * 16 + 4;
   y = row * 10 + 4;
 
   widget_rectangle(x, y, 16, 10, paper);
-  widget_printstring(x + 2, y + 1, ink,
-                     (ui_widget_level >= 0)
-                       ? (keyboard_upper) ? vkeyboard_options_u[row][key].label
-                                          : vkeyboard_options[row][key].label
-                       : vkeyboard[row][key].label);
+  widget_printstring(x + 2, y + 1, ink, label);
 }
 
 void
-widget_print_keyboard( void )
+widget_print_keyboard( int redraw_all )
 {
   int row, key;
   for (row = 0; row < 4; row++) {
     for (key = 0; key < 10; key++) {
-      widget_print_key(row, key, ( actual_row == row && actual_key == key ));
+      widget_print_key(row, key, ( actual_row == row && actual_key == key ),
+                       redraw_all);
     }
   }
 }
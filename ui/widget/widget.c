@@ -39,6 +39,8 @@
 
 #include "fuse.h"
 #include "display.h"
+#include "embedded.h"
+#include "frametime.h"
 #include "machine.h"
 #include "ui/uidisplay.h"
 #include "keyboard.h"
@@ -46,6 +48,7 @@
 #include "periph.h"
 #include "peripherals/joystick.h"
 #include "pokefinder/pokefinder.h"
+#include "profile.h"
 #include "screenshot.h"
 #include "timer/timer.h"
 #include "ui/widget/options_internals.h"
@@ -63,25 +66,42 @@
 int vkeyboard_enabled = 0;
 #endif
 
-/* Bitmap font storage */
+/* Bitmap font storage. Each character's bitmap is also decoded into a
+   list of the pixels which are set, as ( x << 3 ) | y, so printing it
+   doesn't have to test every bit */
 typedef struct {
   libspectrum_byte bitmap[15], left, width, defined;
+  libspectrum_byte npixels, pixels[ 15 * 8 ];
 } widget_font_character;
 
 static widget_font_character *widget_font[1] = {0};
+static int widget_font_read = 0;
 
-static const widget_font_character default_invalid = {
+static widget_font_character default_invalid = {
   { 0x7E, 0xDF, 0x9F, 0xB5, 0xA5, 0x8F, 0xDF, 0x7E }, 0, 8, 1
 }; /* "(?)" (inv) */
 
-static const widget_font_character default_unknown = {
+static widget_font_character default_unknown = {
   { 0x7C, 0xDE, 0xBE, 0xAA, 0xDE, 0x7C }, 1, 6, 1
 }; /* "(?)" */
 
-static const widget_font_character default_keyword = {
+static widget_font_character default_keyword = {
   { 0x7C, 0x82, 0xEE, 0xD6, 0xBA, 0x7C }, 1, 6, 1
 }; /* "(K)" */
 
+/* The parts of the screen drawn on since they were last displayed, in
+   uidisplay co-ordinates. If there were too many to keep track of, just
+   display whatever's asked for until the next full refresh */
+typedef struct widget_damage_rect {
+  int x, y, w, h;
+} widget_damage_rect;
+
+#define WIDGET_MAX_DAMAGE 16
+
+static widget_damage_rect widget_damage_rects[ WIDGET_MAX_DAMAGE ];
+static int widget_damage_count;
+static int widget_damage_untracked;
+
 /* The current widget keyhandler */
 widget_keyhandler_fn widget_keyhandler;
 
@@ -131,44 +151,48 @@ static int widget_do_for_path( widget_menu_entry *data, const char* path )
 }
 #endif
 
-static int widget_read_font( const char *filename )
+static void
+widget_decode_character( widget_font_character *character )
 {
-  utils_file file;
-  int error;
-  int i;
+  int mx, my;
 
-  error = utils_read_auxiliary_file( filename, &file, UTILS_AUXILIARY_WIDGET );
-  if( error == -1 ) {
-    ui_error( UI_ERROR_ERROR, "couldn't find font file '%s'", filename );
-    return 1;
-  }
-  if( error ) return error;
+  character->npixels = 0;
+  for( mx = 0; mx < character->width; mx++ )
+    for( my = 0; my < 8; my++ )
+      if( character->bitmap[mx] & 128 >> my )
+        character->pixels[ character->npixels++ ] = mx << 3 | my;
+}
+
+/* Decode the font built in from fuse.font */
+static int widget_read_font( void )
+{
+  const libspectrum_byte *buffer = embedded_fuse_font;
+  size_t length = embedded_fuse_font_length;
+  size_t i;
 
   i = 0;
-  while( i < file.length ) {
+  while( i < length ) {
     int code, page, left, width;
 
-    if( i + 3 > file.length ) {
+    if( i + 3 > length ) {
       ui_error( UI_ERROR_ERROR, "font contains invalid character" );
-      utils_close_file( &file );
       return 1;
     }
 
-    code = file.buffer[i];
-    page = file.buffer[i+1];
+    code = buffer[i];
+    page = buffer[i+1];
     if( page == 0 && ( code == 0xA3 || ( code < 0x7F && code != 0x60 ) ) ) {
-      left = file.buffer[i+2] & 7;
+      left = buffer[i+2] & 7;
     } else {
       left = -1;
     }
-    width = file.buffer[i+2] >> 4 & 15;
+    width = buffer[i+2] >> 4 & 15;
 
     /* weed out invalid character codes and misdefined characters */
     if( page != 0 /* we don't currently have more than page 0 */
-	|| i + 3 + width > file.length || (left >= 0 && left + width > 8) )
+	|| i + 3 + width > length || (left >= 0 && left + width > 8) )
     {
       ui_error( UI_ERROR_ERROR, "font contains invalid character" );
-      utils_close_file( &file );
       return 1;
     }
 
@@ -178,7 +202,6 @@ static int widget_read_font( const char *filename )
       if( !widget_font[page] )
       {
         ui_error( UI_ERROR_ERROR, "out of memory" );
-        utils_close_file( &file );
         return 1;
       }
     }
@@ -186,19 +209,71 @@ static int widget_read_font( const char *filename )
     widget_font[page][code].defined = 1;
     widget_font[page][code].left = left < 0 ? 0 : left;
     widget_font[page][code].width = width ? width : 3;
-    memcpy( &widget_font[page][code].bitmap, &file.buffer[i+3], width );
+    memcpy( &widget_font[page][code].bitmap, &buffer[i+3], width );
+    widget_decode_character( &widget_font[page][code] );
 
     i += 3 + width;
   }
 
-  utils_close_file( &file );
-
   return 0;
 }
 
+/* Note that an area has been drawn on */
+static void
+widget_damage( int x, int y, int w, int h )
+{
+  widget_damage_rect *rect;
+  int i, x2, y2;
+
+  if( ui_widget_level < 0 || widget_damage_untracked || w <= 0 || h <= 0 )
+    return;
+
+  /* Anything overlapping or touching an existing area is merged into it;
+     most drawing follows on from what was drawn just before */
+  for( i = widget_damage_count - 1; i >= 0; i-- ) {
+    rect = &widget_damage_rects[i];
+
+    if( x > rect->x + rect->w || x + w < rect->x ||
+        y > rect->y + rect->h || y + h < rect->y )
+      continue;
+
+    x2 = x + w > rect->x + rect->w ? x + w : rect->x + rect->w;
+    y2 = y + h > rect->y + rect->h ? y + h : rect->y + rect->h;
+    if( x < rect->x ) rect->x = x;
+    if( y < rect->y ) rect->y = y;
+    rect->w = x2 - rect->x;
+    rect->h = y2 - rect->y;
+    return;
+  }
+
+  if( widget_damage_count == WIDGET_MAX_DAMAGE ) {
+    widget_damage_untracked = 1;
+    return;
+  }
+
+  rect = &widget_damage_rects[ widget_damage_count++ ];
+  rect->x = x; rect->y = y; rect->w = w; rect->h = h;
+}
+
+/* The whole screen is about to be displayed, so forget what's been
+   drawn */
+static void
+widget_damage_reset( void )
+{
+  widget_damage_count = 0;
+  widget_damage_untracked = 0;
+}
+
 static const widget_font_character *
 widget_char( int pp )
 {
+  /* The font is decoded the first time it's needed rather than at
+     startup; if it's bad, every character is shown as unknown */
+  if( !widget_font_read ) {
+    widget_font_read = 1;
+    widget_read_font();
+  }
+
   if( pp < 0 || pp >= 256 ) return &default_invalid;
   if( !widget_font[pp >> 8] || !widget_font[pp >> 8][pp & 255].defined )
     return &default_unknown;
@@ -208,14 +283,15 @@ widget_char( int pp )
 static int
 printchar( int x, int y, int col, int ch )
 {
-  int mx, my;
+  int i;
   const widget_font_character *bitmap = widget_char( ch );
+  int dx = x + DISPLAY_BORDER_ASPECT_WIDTH, dy = y + DISPLAY_BORDER_HEIGHT;
 
-  for( mx = 0; mx < bitmap->width; mx++ ) {
-    int b = bitmap->bitmap[mx];
-    for( my = 0; my < 8; my++ )
-      if( b & 128 >> my ) widget_putpixel( x + mx, y + my, col );
-  }
+  widget_damage( dx, dy, bitmap->width, 8 );
+
+  for( i = 0; i < bitmap->npixels; i++ )
+    uidisplay_putpixel( dx + ( bitmap->pixels[i] >> 3 ),
+                        dy + ( bitmap->pixels[i] & 7 ), col );
 
   return x + bitmap->width + 1;
 }
@@ -355,10 +431,13 @@ size_t widget_charwidth( int c )
 void widget_rectangle( int x, int y, int w, int h, int col )
 {
     int mx, my;
-    
+
+    x += DISPLAY_BORDER_ASPECT_WIDTH; y += DISPLAY_BORDER_HEIGHT;
+    widget_damage( x, y, w, h );
+
     for( my = 0; my < h; my++ )
       for( mx = 0; mx < w; mx++ )
-        widget_putpixel( x + mx, y + my, col );
+        uidisplay_putpixel( x + mx, y + my, col );
 }
 
 void
@@ -366,6 +445,8 @@ widget_draw_line_horiz(int x, int y, int length, int colour )
 {
   int i;
 
+  widget_damage( x, y, length, 1 );
+
   for (i=0; i<length; i++) {
     uidisplay_putpixel( x+i, y, colour );
   }
@@ -376,6 +457,8 @@ widget_draw_line_vert(int x, int y, int length, int colour )
 {
   int i;
 
+  widget_damage( x, y, 1, length );
+
   for (i=0; i<length; i++) {
     uidisplay_putpixel( x, y+i, colour );
   }
@@ -412,6 +495,8 @@ widget_draw_rectangle_solid( int x, int y, int w, int h, int colour )
   if( y + h > DISPLAY_SCREEN_HEIGHT - 1 )
     h = DISPLAY_SCREEN_HEIGHT - y;
 
+  widget_damage( x, y, w, h );
+
   for (v=0; v<h; v++) {
     for (p=0; p<w; p++) {
         uidisplay_putpixel( x+p, y+v, colour );
@@ -427,6 +512,7 @@ widget_draw_rectangle_outline_rounded( int x, int y, int w, int h, int colour )
   widget_draw_line_vert( x, y+1, h-2, colour );
   widget_draw_line_vert( x+w-1, y+1, h-2, colour );
 
+  widget_damage( x, y, w, h );
   uidisplay_putpixel( x+1, y+h-2, colour );
   uidisplay_putpixel( x+1, y+1, colour );
   uidisplay_putpixel( x+w-2, y+1, colour );
@@ -492,14 +578,40 @@ widget_down_arrow( int x, int y, int colour )
   }
 }
 
-/* Force screen rasters y to (y+h) inclusive to be redrawn */
+/* Force screen rasters y to (y+h) inclusive to be redrawn; only the
+   parts of them which have actually been drawn on are sent to the
+   display */
 void
 widget_display_rasters( int y, int h )
 {
   int scale = machine_current->timex ? 2 : 1;
+  int top = DISPLAY_BORDER_HEIGHT + y, bottom = top + h;
+  int i;
+
+  if( ui_widget_level < 0 || widget_damage_untracked ) {
+    uidisplay_area( 0, scale * top, scale * DISPLAY_ASPECT_WIDTH, scale * h );
+    uidisplay_frame_end();
+    return;
+  }
+
+  for( i = 0; i < widget_damage_count; ) {
+    widget_damage_rect *rect = &widget_damage_rects[i];
+    int rect_top = rect->y > top ? rect->y : top;
+    int rect_bottom =
+      rect->y + rect->h < bottom ? rect->y + rect->h : bottom;
+
+    if( rect_top < rect_bottom )
+      uidisplay_area( scale * rect->x, scale * rect_top, scale * rect->w,
+                      scale * ( rect_bottom - rect_top ) );
+
+    /* Forget areas which have now been completely displayed */
+    if( rect->y >= top && rect->y + rect->h <= bottom ) {
+      *rect = widget_damage_rects[ --widget_damage_count ];
+    } else {
+      i++;
+    }
+  }
 
-  uidisplay_area( 0, scale * ( DISPLAY_BORDER_HEIGHT + y ),
-		  scale * DISPLAY_ASPECT_WIDTH, scale * h );
   uidisplay_frame_end();
 }
 
@@ -507,19 +619,19 @@ widget_display_rasters( int y, int h )
 
 int widget_init( void )
 {
-  int error;
-
-  error = widget_read_font( "fuse.font" );
-  if( error ) return error;
-
   widget_filenames = NULL;
   widget_numfiles = 0;
 
+  widget_decode_character( &default_invalid );
+  widget_decode_character( &default_unknown );
+  widget_decode_character( &default_keyword );
+
   ui_menu_activate( UI_MENU_ITEM_AY_LOGGING, 0 );
   ui_menu_activate( UI_MENU_ITEM_FILE_MOVIE_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING_ROLLBACK, 0 );
+  ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_TAPE_RECORDING, 0 );
 #ifdef HAVE_LIB_XML2
   ui_menu_activate( UI_MENU_ITEM_FILE_SVG_CAPTURE, 0 );
@@ -529,18 +641,12 @@ int widget_init( void )
 
 int widget_end( void )
 {
-  size_t i;
-
-  if( widget_filenames ) {
-    for( i=0; i<widget_numfiles; i++) {
-      free( widget_filenames[i]->name );
-      free( widget_filenames[i] );
-    }
-    free( widget_filenames );
-  }
+  widget_filesel_end();
 
   /* we don't currently have more than page 0 */
   free( widget_font[0] );
+  widget_font[0] = NULL;
+  widget_font_read = 0;
 
   return 0;
 }
@@ -551,6 +657,8 @@ int widget_end( void )
 static char msg_info[WIDGET_MAX_MSG_INFO_LENGTH];
 static char status_info[WIDGET_MAX_INFO_LENGTH];
 
+unsigned int ui_widget_overlay_generation = 0;
+
 static char* od_machine_name( libspectrum_machine type ) {
   char* name = utils_safe_strdup( libspectrum_machine_name( type ) );
 
@@ -564,6 +672,39 @@ static char* od_machine_name( libspectrum_machine type ) {
 
 size_t widget_statusbar_update_info( float speed ) {
   char suffix[14];
+  char old_info[WIDGET_MAX_INFO_LENGTH];
+
+  memcpy( old_info, status_info, sizeof( old_info ) );
+
+  profile_live_set( settings_current.od_show_hotspots );
+
+  if ( timer_turbo )
+    /* Show how many times faster than normal we're running */
+    snprintf(status_info, WIDGET_MAX_INFO_LENGTH, "%s - x%.1f (1:%d)",
+             od_machine_name( machine_current->machine ),
+             current_speed / 100,
+             settings_current.turbo_frame_rate);
+#ifdef FRAME_TIMING
+  else if ( settings_current.od_show_frame_timing ) {
+    /* Average ms per frame in each probe in place of the machine name */
+    char timings[WIDGET_MAX_INFO_LENGTH];
+
+    frametime_summary( timings, WIDGET_MAX_INFO_LENGTH );
+    snprintf(status_info, WIDGET_MAX_INFO_LENGTH,
+             settings_current.od_show_fps ? "%3.0ffps %s" : "%3.0f%% %s",
+             speed, timings);
+  }
+#endif
+  else if ( settings_current.od_show_hotspots ) {
+    /* The routines taking the most time, in place of the machine name */
+    char hotspots[WIDGET_MAX_INFO_LENGTH];
+
+    profile_hotspot_summary( hotspots, WIDGET_MAX_INFO_LENGTH );
+    snprintf(status_info, WIDGET_MAX_INFO_LENGTH,
+             settings_current.od_show_fps ? "%3.0ffps %s" : "%3.0f%% %s",
+             speed, hotspots);
+  }
+  else
   snprintf(status_info, WIDGET_MAX_INFO_LENGTH,
            settings_current.od_show_fps ? "%s - %3.0ffps (1:%d)" : "%s - %3.0f%% (1:%d)",
            od_machine_name( machine_current->machine ),
@@ -590,6 +731,8 @@ size_t widget_statusbar_update_info( float speed ) {
     strlcat(&status_info[0], &suffix[0], WIDGET_MAX_INFO_LENGTH);
   }
 
+  if ( strcmp( old_info, status_info ) ) ui_widget_overlay_generation++;
+
   return widget_stringwidth( status_info );
 }
 
@@ -605,6 +748,8 @@ void widget_statusbar_print_info(void) {
 }
 
 size_t widget_show_msg_update_info(const char* msg) {
+  if ( strncmp( msg_info, msg, WIDGET_MAX_MSG_INFO_LENGTH - 1 ) )
+    ui_widget_overlay_generation++;
   snprintf(msg_info, WIDGET_MAX_MSG_INFO_LENGTH, "%s", msg );
   return widget_stringwidth( msg_info );
 }
@@ -642,7 +787,10 @@ int widget_do( widget_type which, void *data )
   widget_return[ui_widget_level].type = which;
   widget_return[ui_widget_level].data = data;
 
-  uidisplay_frame_restore();
+  /* A widget opened over another one starts from a clean screen; the
+     first one starts from the image as it is */
+  if( ui_widget_level > 0 ) uidisplay_frame_restore();
+  widget_damage_reset();
 
   /* Draw this widget */
   widget_data[ which ].draw( data );
@@ -659,6 +807,11 @@ int widget_do( widget_type which, void *data )
 
     /* Process any events */
     ui_event();
+
+    /* And let the widget get on with anything it's doing in the
+       background */
+    if( widget_data[which].idle && ! widget_return[ui_widget_level].finished )
+      widget_data[which].idle();
   }
 
   /* Do any post-widget processing if it exists */
@@ -666,7 +819,10 @@ int widget_do( widget_type which, void *data )
     widget_data[which].finish( widget_return[ui_widget_level].finished );
   }
 
-  uidisplay_frame_restore();
+  /* Clear this widget away if there's another one to go back to; if not,
+     uidisplay_frame_release() below deals with the whole screen */
+  if( ui_widget_level > 0 ) uidisplay_frame_restore();
+  widget_damage_reset();
 
   /* Now return to the previous widget level */
   ui_widget_level--;
@@ -685,8 +841,8 @@ int widget_do( widget_type which, void *data )
 
   } else {
 
-    /* Refresh the Spectrum's display, including the border */
-    display_refresh_all();
+    /* Put the Spectrum's display back, including the border */
+    uidisplay_frame_release();
 
   }
 
@@ -807,6 +963,8 @@ int widget_dialog_with_border( int x, int y, int width, int height )
 void
 widget_putpixel( int x, int y, int colour )
 {
+  widget_damage( x + DISPLAY_BORDER_ASPECT_WIDTH, y + DISPLAY_BORDER_HEIGHT,
+                 1, 1 );
   uidisplay_putpixel( x + DISPLAY_BORDER_ASPECT_WIDTH, y + DISPLAY_BORDER_HEIGHT,
                       colour );
 }
@@ -816,8 +974,10 @@ widget_putpixel( int x, int y, int colour )
 
 widget_t widget_data[] = {
 
-  { widget_filesel_load_draw, widget_filesel_finish, widget_filesel_keyhandler  },
-  { widget_filesel_save_draw, widget_filesel_finish, widget_filesel_keyhandler  },
+  { widget_filesel_load_draw, widget_filesel_finish, widget_filesel_keyhandler,
+    widget_filesel_idle },
+  { widget_filesel_save_draw, widget_filesel_finish, widget_filesel_keyhandler,
+    widget_filesel_idle },
   { widget_general_draw,  widget_options_finish, widget_general_keyhandler  },
   { widget_picture_draw,  NULL,                  widget_picture_keyhandler  },
   { widget_about_draw,    NULL,                  widget_about_keyhandler    },
@@ -830,10 +990,11 @@ widget_t widget_data[] = {
   { widget_movie_draw,    widget_options_finish, widget_movie_keyhandler    },
   { widget_browse_draw,   widget_browse_finish,  widget_browse_keyhandler   },
   { widget_text_draw,	  widget_text_finish,	 widget_text_keyhandler     },
-  { widget_debugger_draw, NULL,			 widget_debugger_keyhandler },
+  { widget_debugger_draw, widget_debugger_finish, widget_debugger_keyhandler },
   { widget_pokefinder_draw, NULL,		 widget_pokefinder_keyhandler },
   { widget_pokemem_draw, widget_pokemem_finish,	widget_pokemem_keyhandler },
-  { widget_memory_draw,   NULL,			 widget_memory_keyhandler   },
+  { widget_memory_draw,   widget_memory_finish,	 widget_memory_keyhandler   },
+  { widget_memory_usage_draw, NULL,		 widget_memory_usage_keyhandler },
   { widget_roms_draw,     widget_roms_finish,	 widget_roms_keyhandler     },
   { widget_peripherals_general_draw, widget_options_finish, widget_peripherals_general_keyhandler },
   { widget_peripherals_disk_draw, widget_options_finish, widget_peripherals_disk_keyhandler },
@@ -841,6 +1002,8 @@ widget_t widget_data[] = {
   { widget_query_save_draw,widget_query_finish,	 widget_query_save_keyhandler },
   { widget_diskoptions_draw, widget_options_finish, widget_diskoptions_keyhandler  },
   { widget_binary_draw, widget_binary_finish, widget_binary_keyhandler  },
+  { widget_library_draw, widget_library_finish, widget_library_keyhandler,
+    widget_library_idle },
 #ifdef VKEYBOARD
   { widget_vkeyboard_draw, widget_vkeyboard_finish, widget_vkeyboard_keyhandler  },
 #endif
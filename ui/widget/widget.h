@@ -71,6 +71,7 @@ typedef enum widget_type {
   WIDGET_TYPE_POKEFINDER,	/* Poke finder widget */
   WIDGET_TYPE_POKEMEM,  	/* Poke memory widget */
   WIDGET_TYPE_MEMORYBROWSER,	/* Memory browser widget */
+  WIDGET_TYPE_MEMORYUSAGE,	/* Memory usage widget */
   WIDGET_TYPE_ROM,		/* ROM selector widget */
   WIDGET_TYPE_PERIPHERALS_GENERAL, /* General peripherals options */
   WIDGET_TYPE_PERIPHERALS_DISK, /* Disk peripherals options */
@@ -78,6 +79,7 @@ typedef enum widget_type {
   WIDGET_TYPE_QUERY_SAVE,	/* Query (save/don't save/cancel) */
   WIDGET_TYPE_DISKOPTIONS,	/* Disk options widget */
   WIDGET_TYPE_BINARY,		/* Binary load/save */
+  WIDGET_TYPE_LIBRARY,		/* Game library */
 #ifdef VKEYBOARD
   WIDGET_TYPE_VKEYBOARD,	/* Virtual Keyboard */
 #endif
@@ -114,6 +116,7 @@ typedef enum widget_filter_class {
   FILTER_CLASS_SCALABLE_VECTOR_GRAPHICS,
   FILTER_CLASS_MOVIE_FILE,
   FILTER_CLASS_AY_LOGGING,
+  FILTER_CLASS_SOUND_RECORDING,
   FILTER_CLASS_POKE_FILE,
   FILTER_CLASS_CONTROL_MAPPING,
   FILTER_CLASS_MEDIA_IF_RS232,
@@ -174,6 +177,9 @@ int widget_calculate_menu_width( widget_menu_entry *menu );
 /* The name returned from the file selector */
 extern char* widget_filesel_name;
 
+/* The file chosen from the game library */
+extern char *widget_library_name;
+
 /* Select a machine */
 int widget_select_machine( void *data );
      
@@ -337,6 +343,18 @@ static inline int widget_do_memorybrowser( void )
   return widget_do( WIDGET_TYPE_MEMORYBROWSER, NULL );
 }
 
+/* Memory usage widget */
+static inline int widget_do_memoryusage( void )
+{
+  return widget_do( WIDGET_TYPE_MEMORYUSAGE, NULL );
+}
+
+/* Game library widget */
+static inline int widget_do_library( void )
+{
+  return widget_do( WIDGET_TYPE_LIBRARY, NULL );
+}
+
 /* ROM selector widget */
 static inline int widget_do_rom( widget_roms_info *data )
 {
@@ -54,6 +54,7 @@ typedef struct widget_t {
   widget_draw_fn draw;			/* Draw this widget */
   int (*finish)( widget_finish_state finished ); /* Post-widget processing */
   widget_keyhandler_fn keyhandler;	/* Keyhandler */
+  void (*idle)( void );			/* Background work; may be NULL */
 } widget_t;
 
 #ifdef GCWZERO
@@ -121,6 +122,17 @@ int widget_filesel_load_draw( void* data );
 int widget_filesel_save_draw( void* data );
 int widget_filesel_finish( widget_finish_state finished );
 void widget_filesel_keyhandler( input_key key );
+void widget_filesel_idle( void );
+void widget_filesel_end( void );
+
+/* Snapshot screens for the file selector. widget_preview_get() returns
+   the screen of the snapshot `filename', or NULL if it has none; if it
+   hasn't been extracted yet, it's started on in the background and
+   `ready' is set to 0, so ask again later */
+int widget_preview_is_snapshot( const char *filename );
+const libspectrum_byte* widget_preview_get( const char *filename,
+                                            int *ready );
+void widget_preview_end( void );
 
 /* Tape menu */
 
@@ -144,7 +156,7 @@ void widget_machine_keyhandler( input_key key );
 
 typedef struct widget_picture_data {
   const char *filename;
-  libspectrum_byte *screen;
+  const libspectrum_byte *screen;
   int border;
 } widget_picture_data;
 
@@ -221,6 +233,7 @@ void widget_error_keyhandler( input_key key );
 /* The debugger widget */
 
 int widget_debugger_draw( void *data );
+int widget_debugger_finish( widget_finish_state finished );
 void widget_debugger_keyhandler( input_key key );
 
 /* The poke file widget */
@@ -237,7 +250,17 @@ void widget_pokefinder_keyhandler( input_key key );
 /* The memory browser widget */
 
 int widget_memory_draw( void *data );
+int widget_memory_finish( widget_finish_state finished );
 void widget_memory_keyhandler( input_key key );
+int widget_memory_usage_draw( void *data );
+void widget_memory_usage_keyhandler( input_key key );
+
+/* The game library widget */
+
+int widget_library_draw( void *data );
+int widget_library_finish( widget_finish_state finished );
+void widget_library_keyhandler( input_key key );
+void widget_library_idle( void );
 
 /* The about fuse widget */
 
@@ -535,3 +535,10 @@ uidisplay_frame_restore( void )
 {
   /* FIXME: implement */
 }
+
+void
+uidisplay_frame_release( void )
+{
+  /* The widgets were drawn over the image, so redraw all of it */
+  display_refresh_all();
+}
@@ -69,6 +69,13 @@ ui_event( void )
   return 0;
 }
 
+int
+ui_event_input( void )
+{
+  keyboard_update();
+  return 0;
+}
+
 int ui_end(void)
 {
   /* Cleanup handled by atexit function */
@@ -36,6 +36,7 @@
 #include <tchar.h>
 #include <windows.h>
  
+#include "compat.h"
 #include "debugger/debugger.h"
 #include "event.h"
 #include "fuse.h"
@@ -90,10 +91,16 @@ static void events_click( LPNMITEMACTIVATE lpnmitem );
 /* int create_buttons( void ); this function is handled by rc */
 
 static int activate_debugger( void );
+static int pane_visible( debugger_pane pane );
+static void update_display( void );
+static void update_pane( debugger_pane pane );
+static void update_registers( void );
 static void update_memory_map( void );
 static void update_breakpoints( void );
 static void update_disassembly( void );
+static void update_stack( void );
 static void update_events( void );
+static void set_list_row( int control, int row, TCHAR **text, int columns );
 static void add_event( gpointer data, gpointer user_data GCC_UNUSED );
 static int deactivate_debugger( void );
 
@@ -132,6 +139,23 @@ static int dialog_created = 0;
 /* Is the debugger window active (as opposed to the debugger itself)? */
 static int debugger_active;
 
+/* The display is redrawn at most this often, in seconds; an update asked
+   for any sooner is put off until then, using this timer */
+#define DEBUGGER_UPDATE_INTERVAL 0.05
+#define DEBUGGER_UPDATE_TIMER 1
+
+/* When the display was last redrawn, and whether an update is put off */
+static double update_last = -1;
+static int update_pending = 0;
+
+/* What the memory map pane is showing, so it's only redrawn when the
+   mapping changes */
+static struct {
+  int source, page_num, writable, contended;
+  libspectrum_word offset;
+} map_shown[ MEMORY_PAGES_IN_64K ];
+static const TCHAR *map_shown_format = NULL;
+
 #define STUB do { printf("STUB: %s()\n", __func__); fflush(stdout); } while(0)
 
 static const TCHAR*
@@ -169,7 +193,8 @@ ui_debugger_activate( void )
 void
 ui_breakpoints_updated( void )
 {
-  /* TODO: Refresh debugger list here */
+  if( dialog_created && pane_visible( DEBUGGER_PANE_BREAKPOINTS ) )
+    update_breakpoints();
 }
 
 static int
@@ -348,6 +373,8 @@ toggle_display( debugger_pane pane, UINT menu_item_id )
     mii.fState = MFS_UNCHECKED;
     SetMenuItemInfo( GetMenu( fuse_hDBGWnd ), menu_item_id, FALSE, &mii );
   } else {
+    /* Hidden panes aren't kept up to date */
+    update_pane( pane );
     show_hide_pane( pane, SW_SHOW );
     mii.fState = MFS_CHECKED;
     SetMenuItemInfo( GetMenu( fuse_hDBGWnd ), menu_item_id, FALSE, &mii );
@@ -608,14 +635,87 @@ activate_debugger( void )
   return 0;
 }
 
-/* Update the debugger's display */
+/* Update the debugger's display, unless it's been updated too recently,
+   in which case do it once the interval is up */
 int
 ui_debugger_update( void )
+{
+  double wait;
+
+  if( !dialog_created ) return 0;
+
+  /* Already put off */
+  if( update_pending ) return 0;
+
+  wait = update_last + DEBUGGER_UPDATE_INTERVAL - compat_timer_get_time();
+  if( update_last >= 0 && wait > 0 &&
+      SetTimer( fuse_hDBGWnd, DEBUGGER_UPDATE_TIMER, wait * 1000 + 1,
+                NULL ) ) {
+    update_pending = 1;
+    return 0;
+  }
+
+  update_display();
+
+  return 0;
+}
+
+/* Is `pane' shown? */
+static int
+pane_visible( debugger_pane pane )
+{
+  UINT checkitem;
+  MENUITEMINFO mii;
+
+  checkitem = get_pane_menu_item( pane ); if( !checkitem ) return 0;
+
+  mii.fMask = MIIM_STATE;
+  mii.cbSize = sizeof( MENUITEMINFO );
+  if( ! GetMenuItemInfo( GetMenu( fuse_hDBGWnd ), checkitem, FALSE, &mii ) )
+    return 0;
+
+  return ( mii.fState & MFS_CHECKED ) ? 1 : 0;
+}
+
+/* Redraw every pane which can be seen */
+static void
+update_display( void )
+{
+  debugger_pane i;
+
+  if( update_pending ) {
+    KillTimer( fuse_hDBGWnd, DEBUGGER_UPDATE_TIMER );
+    update_pending = 0;
+  }
+
+  update_last = compat_timer_get_time();
+
+  for( i = DEBUGGER_PANE_BEGIN; i < DEBUGGER_PANE_END; i++ )
+    if( pane_visible( i ) ) update_pane( i );
+}
+
+static void
+update_pane( debugger_pane pane )
+{
+  if( !dialog_created ) return;
+
+  switch( pane ) {
+  case DEBUGGER_PANE_REGISTERS: update_registers(); break;
+  case DEBUGGER_PANE_MEMORYMAP: update_memory_map(); break;
+  case DEBUGGER_PANE_BREAKPOINTS: update_breakpoints(); break;
+  case DEBUGGER_PANE_DISASSEMBLY: update_disassembly(); break;
+  case DEBUGGER_PANE_STACK: update_stack(); break;
+  case DEBUGGER_PANE_EVENTS: update_events(); break;
+
+  case DEBUGGER_PANE_END: break;
+  }
+}
+
+static void
+update_registers( void )
 {
   size_t i;
   TCHAR buffer[1024], format_string[1024];
-  TCHAR *disassembly_text[2] = { &buffer[0], &buffer[40] };
-  libspectrum_word address;
   int capabilities; size_t length;
 
   const char *register_name[] = { TEXT( "PC" ), TEXT( "SP" ),
@@ -631,8 +731,6 @@ ui_debugger_update( void )
 				    &HL, &HL_, &IX, &IY,
 				  };
 
-  if( !dialog_created ) return 0;
-
   /* FIXME: verify all functions below are unicode compliant */
   for( i = 0; i < 12; i++ ) {
     _sntprintf( buffer, 5, "%3s ", register_name[i] );
@@ -719,42 +817,26 @@ ui_debugger_update( void )
 
   SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_REG_ULA,
                       WM_SETTEXT, (WPARAM) 0, (LPARAM) buffer );
+}
 
-  update_memory_map();
-  update_breakpoints();
-  update_disassembly();
-
-  /* And the stack display */
-  SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_STACK,
-                      LVM_DELETEALLITEMS, 0, 0 );
-  
-  LV_ITEM lvi;
-  lvi.mask = LVIF_TEXT;
+static void
+update_stack( void )
+{
+  size_t i;
+  TCHAR buffer[80];
+  TCHAR *stack_text[2] = { &buffer[0], &buffer[40] };
+  libspectrum_word address;
 
   for( i = 0, address = SP + 38; i < 20; i++, address -= 2 ) {
-    
+
     libspectrum_word contents = readbyte_internal( address ) +
 				0x100 * readbyte_internal( address + 1 );
 
-    _sntprintf( disassembly_text[0], 40, format_16_bit(), address );
-    _sntprintf( disassembly_text[1], 40, format_16_bit(), contents );
-
-    /* add the item */
-    lvi.iItem = i;
-    lvi.iSubItem = 0;
-    lvi.pszText = disassembly_text[0];
-    SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_STACK, LVM_INSERTITEM, 0,
-                        ( LPARAM ) &lvi );
-    lvi.iSubItem = 1;
-    lvi.pszText = disassembly_text[1];
-    SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_STACK, LVM_SETITEM, 0,
-                        ( LPARAM ) &lvi );
-  }
-
-  /* And the events display */
-  update_events();
+    _sntprintf( stack_text[0], 40, format_16_bit(), address );
+    _sntprintf( stack_text[1], 40, format_16_bit(), contents );
 
-  return 0;
+    set_list_row( IDC_DBG_LV_STACK, i, stack_text, 2 );
+  }
 }
 
 static void
@@ -764,6 +846,30 @@ update_memory_map( void )
   int source, page_num, writable, contended;
   libspectrum_word offset;
   size_t i, j, block, row;
+  int changed;
+
+  /* Don't redraw the map unless it's changed */
+  changed = map_shown_format != format_16_bit();
+  map_shown_format = format_16_bit();
+
+  for( block = 0; block < MEMORY_PAGES_IN_64K; block++ ) {
+    memory_page *page = &memory_map_read[block];
+
+    if( page->source != map_shown[block].source ||
+        page->page_num != map_shown[block].page_num ||
+        page->offset != map_shown[block].offset ||
+        page->writable != map_shown[block].writable ||
+        page->contended != map_shown[block].contended ) {
+      map_shown[block].source = page->source;
+      map_shown[block].page_num = page->page_num;
+      map_shown[block].offset = page->offset;
+      map_shown[block].writable = page->writable;
+      map_shown[block].contended = page->contended;
+      changed = 1;
+    }
+  }
+
+  if( !changed ) return;
 
   source = page_num = writable = contended = -1;
   offset = 0;
@@ -916,12 +1022,6 @@ update_disassembly( void )
   TCHAR buffer[80];
   TCHAR *disassembly_text[2] = { &buffer[0], &buffer[40] };
 
-  SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_PC,
-                      LVM_DELETEALLITEMS, 0, 0 );
-
-  LV_ITEM lvi;
-  lvi.mask = LVIF_TEXT;
-
   for( i = 0, address = disassembly_top; i < disassembly_page; i++ ) {
     int l;
     _sntprintf( disassembly_text[0], 40, format_16_bit(), address );
@@ -934,16 +1034,7 @@ update_disassembly( void )
 
     address += length;
 
-    /* append the item */
-    lvi.iItem = i;
-    lvi.iSubItem = 0;
-    lvi.pszText = disassembly_text[0];
-    SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_PC, LVM_INSERTITEM, 0,
-                        ( LPARAM ) &lvi );
-    lvi.iSubItem = 1;
-    lvi.pszText = disassembly_text[1];
-    SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_PC, LVM_SETITEM, 0,
-                        ( LPARAM ) &lvi );
+    set_list_row( IDC_DBG_LV_PC, i, disassembly_text, 2 );
   }
 
   disassembly_bottom = address;
@@ -952,11 +1043,42 @@ update_disassembly( void )
 static void
 update_events( void )
 {
+  /* Don't redraw the list until it's all there */
+  SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_EVENTS, WM_SETREDRAW,
+                      FALSE, 0 );
+
   /* clear the listview */
   SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_EVENTS,
                       LVM_DELETEALLITEMS, 0, 0 );
 
   event_foreach( add_event, NULL );
+
+  SendDlgItemMessage( fuse_hDBGWnd, IDC_DBG_LV_EVENTS, WM_SETREDRAW,
+                      TRUE, 0 );
+  InvalidateRect( GetDlgItem( fuse_hDBGWnd, IDC_DBG_LV_EVENTS ), NULL, TRUE );
+}
+
+/* Set the text of row `row' of list view `control', adding the row if
+   need be, so panes with a fixed number of rows can be rewritten in
+   place rather than rebuilt */
+static void
+set_list_row( int control, int row, TCHAR **text, int columns )
+{
+  LV_ITEM lvi;
+  int i, count;
+
+  count = SendDlgItemMessage( fuse_hDBGWnd, control, LVM_GETITEMCOUNT, 0, 0 );
+
+  lvi.mask = LVIF_TEXT;
+  lvi.iItem = row;
+
+  for( i = 0; i < columns; i++ ) {
+    lvi.iSubItem = i;
+    lvi.pszText = text[i];
+    SendDlgItemMessage( fuse_hDBGWnd, control,
+                        i == 0 && row >= count ? LVM_INSERTITEM : LVM_SETITEM,
+                        0, ( LPARAM ) &lvi );
+  }
 }
 
 static void
@@ -1129,7 +1251,7 @@ win32ui_debugger_done_continue( void )
 static void
 win32ui_debugger_break( void )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
 
   EnableWindow( GetDlgItem( fuse_hDBGWnd, IDC_DBG_BTN_CONT ), TRUE);
   EnableWindow( GetDlgItem( fuse_hDBGWnd, IDC_DBG_BTN_BREAK ), FALSE );
@@ -1198,6 +1320,13 @@ win32ui_debugger_proc( HWND hWnd GCC_UNUSED, UINT msg,
       delete_dialog();
       return 0;
 
+    case WM_TIMER:
+      if( wParam == DEBUGGER_UPDATE_TIMER ) {
+        update_display();
+        return 0;
+      }
+      break;
+
     case WM_NOTIFY:
       switch ( ( ( LPNMHDR ) lParam )->code ) {
 
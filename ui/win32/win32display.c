@@ -52,17 +52,25 @@ static unsigned char rgb_image[ 4 * 2 * ( DISPLAY_SCREEN_HEIGHT + 4 ) *
                                         ( DISPLAY_SCREEN_WIDTH  + 3 )   ];
 static const int rgb_pitch = ( DISPLAY_SCREEN_WIDTH + 3 ) * 4;
 
-/* The scaled image */
-static unsigned char scaled_image[ MAX_SCALE * DISPLAY_SCREEN_HEIGHT *
-                                   MAX_SCALE * DISPLAY_SCREEN_WIDTH * 2 ];
+/* The scaled image is written by the scalers straight into the DIB
+   section, which is as wide as the largest scaled screen */
 static const ptrdiff_t scaled_pitch = MAX_SCALE * DISPLAY_SCREEN_WIDTH * 2;
 
 /* Win32 specific variables */
 static void *win32_pixdata;
-static BITMAPINFO fuse_BMI;
 static HBITMAP fuse_BMP;
+static HDC fuse_BMP_dc;
+static HGDIOBJ fuse_BMP_dc_old;
 static RECT invalidated_area;
 
+/* The scalers produce pixels with red in the lowest byte, which isn't
+   the DIB default, so the bitmap carries explicit colour masks and the
+   conversion happens in the blit */
+static struct {
+  BITMAPINFOHEADER bmiHeader;
+  DWORD masks[3];
+} fuse_BMI;
+
 static const unsigned char rgb_colours[16][3] = {
 
   {   0,   0,   0 },
@@ -98,8 +106,7 @@ void
 blit( void )
 {
   PAINTSTRUCT ps;
-  HDC dest_dc, src_dc;
-  HBITMAP src_bmp;
+  HDC dest_dc;
   int x, y, width, height;
 
   dest_dc = BeginPaint( fuse_hWnd, &ps );
@@ -109,15 +116,8 @@ blit( void )
   width = ps.rcPaint.right - ps.rcPaint.left;
   height = ps.rcPaint.bottom - ps.rcPaint.top;
 
-  if( width && height ) {
-    src_dc = CreateCompatibleDC( dest_dc );
-    src_bmp = SelectObject( src_dc, fuse_BMP );
-
-    BitBlt( dest_dc, x, y, width, height, src_dc, x, y, SRCCOPY );
-
-    SelectObject( src_dc, src_bmp );
-    DeleteDC( src_dc );
-  }
+  if( width && height )
+    BitBlt( dest_dc, x, y, width, height, fuse_BMP_dc, x, y, SRCCOPY );
 
   EndPaint( fuse_hWnd, &ps );
 }
@@ -127,6 +127,7 @@ win32display_init( void )
 {
   int x, y, error;
   libspectrum_dword black;
+  HDC dc;
 
   error = init_colours(); if( error ) return error;
 
@@ -140,26 +141,35 @@ win32display_init( void )
 
   memset( &fuse_BMI, 0, sizeof( fuse_BMI ) );
   fuse_BMI.bmiHeader.biSize = sizeof( fuse_BMI.bmiHeader );
-  fuse_BMI.bmiHeader.biWidth = (size_t)( 0.5 * MAX_SCALE * DISPLAY_SCREEN_WIDTH );
+  fuse_BMI.bmiHeader.biWidth = scaled_pitch / 4;
   /* negative to avoid "shep-mode": */
   fuse_BMI.bmiHeader.biHeight = -( MAX_SCALE * DISPLAY_SCREEN_HEIGHT );
   fuse_BMI.bmiHeader.biPlanes = 1;
   fuse_BMI.bmiHeader.biBitCount = 32;
-  fuse_BMI.bmiHeader.biCompression = BI_RGB;
+  fuse_BMI.bmiHeader.biCompression = BI_BITFIELDS;
   fuse_BMI.bmiHeader.biSizeImage = 0;
   fuse_BMI.bmiHeader.biXPelsPerMeter = 0;
   fuse_BMI.bmiHeader.biYPelsPerMeter = 0;
   fuse_BMI.bmiHeader.biClrUsed = 0;
   fuse_BMI.bmiHeader.biClrImportant = 0;
-  fuse_BMI.bmiColors[0].rgbRed = 0;
-  fuse_BMI.bmiColors[0].rgbGreen = 0;
-  fuse_BMI.bmiColors[0].rgbBlue = 0;
-  fuse_BMI.bmiColors[0].rgbReserved = 0;
-
-  HDC dc = GetDC( fuse_hWnd );
+  fuse_BMI.masks[0] = 0x000000ff; /* red */
+  fuse_BMI.masks[1] = 0x0000ff00; /* green */
+  fuse_BMI.masks[2] = 0x00ff0000; /* blue */
+
+  dc = GetDC( fuse_hWnd );
+
+  fuse_BMP = CreateDIBSection( dc, (BITMAPINFO*)&fuse_BMI, DIB_RGB_COLORS,
+                               &win32_pixdata, NULL, 0 );
+  if( !fuse_BMP ) {
+    ReleaseDC( fuse_hWnd, dc );
+    ui_error( UI_ERROR_ERROR, "couldn't create the display bitmap" );
+    return 1;
+  }
 
-  fuse_BMP = CreateDIBSection( dc, &fuse_BMI, DIB_RGB_COLORS, &win32_pixdata,
-                               NULL, 0 );
+  /* Keep the bitmap selected into a DC for the life of the display,
+     rather than making a new one for every paint */
+  fuse_BMP_dc = CreateCompatibleDC( dc );
+  fuse_BMP_dc_old = SelectObject( fuse_BMP_dc, fuse_BMP );
 
   ReleaseDC( fuse_hWnd, dc );
 
@@ -172,6 +182,7 @@ static int
 init_colours( void )
 {
   size_t i;
+  libspectrum_dword hq_colours[ 2 * 16 ];
 
   for( i = 0; i < 16; i++ ) {
 
@@ -198,6 +209,15 @@ init_colours( void )
 
   }
 
+  for( i = 0; i < 16; i++ ) {
+    hq_colours[ 2 * i     ] = win32display_colours[i];
+    hq_colours[ 2 * i + 1 ] = bw_colours[i];
+  }
+
+  /* The display only uses these colours, so the HQ scalers can work on
+     palette indices */
+  scaler_hq_palette_32( hq_colours, 2 * 16 );
+
   return 0;
 }
 
@@ -217,7 +237,11 @@ win32display_drawing_area_resize( int width, int height, int force_scaler )
 
   register_scalers( force_scaler );
 
-  memset( scaled_image, 0, sizeof( scaled_image ) );
+  if( win32_pixdata ) {
+    GdiFlush();
+    memset( win32_pixdata, 0,
+            scaled_pitch * MAX_SCALE * DISPLAY_SCREEN_HEIGHT );
+  }
   display_refresh_all();
 
   return 0;
@@ -345,43 +369,29 @@ uidisplay_area( int x, int y, int w, int h )
     for( i = 0; i < w; i++, rgb++, display++ ) *rgb = palette[ *display ];
   }
 
-  /* Create scaled image */
+  /* GDI may still be reading the bitmap from the last paint */
+  GdiFlush();
+
+  /* Create scaled image directly in the back buffer */
   scaler_proc32( &rgb_image[ ( y + 2 ) * rgb_pitch + 4 * ( x + 1 ) ],
                  rgb_pitch,
-                 &scaled_image[ scaled_y * scaled_pitch + 4 * scaled_x ],
+                 (libspectrum_byte*)win32_pixdata +
+                   scaled_y * scaled_pitch + 4 * scaled_x,
                  scaled_pitch, w, h );
 
   w *= scale; h *= scale;
 
-  /* Blit to the real screen */
+  /* Mark it for the next paint */
   win32display_area( scaled_x, scaled_y, w, h );
 }
 
 void
 win32display_area(int x, int y, int width, int height)
 {
-  int disp_x,disp_y;
-  int bottom, right;
-  long ofs;
   RECT r;
-  char *pixdata = win32_pixdata;
-
-  bottom = y + height;
-  right = x + width;
-
-  for( disp_y = y; disp_y < bottom; disp_y++ ) {
-    for( disp_x = x; disp_x < right; disp_x++ ) {
-      ofs = ( disp_x << 2 ) + ( disp_y * scaled_pitch );
-
-      pixdata[ ofs + 0 ] = scaled_image[ ofs + 2 ]; /* blue */
-      pixdata[ ofs + 1 ] = scaled_image[ ofs + 1 ]; /* green */
-      pixdata[ ofs + 2 ] = scaled_image[ ofs + 0 ]; /* red */
-      pixdata[ ofs + 3 ] = 0; /* unused */
-    }
-  }
 
   /* Mark area for updating */
-  SetRect( &r, x, y, right, bottom );
+  SetRect( &r, x, y, x + width, y + height );
   UnionRect( &invalidated_area, &invalidated_area, &r );
 }
 
@@ -407,8 +417,15 @@ uidisplay_end( void )
 int
 win32display_end( void )
 {
+  if( fuse_BMP_dc ) {
+    SelectObject( fuse_BMP_dc, fuse_BMP_dc_old );
+    DeleteDC( fuse_BMP_dc );
+    fuse_BMP_dc = NULL;
+  }
+
   DeleteObject( fuse_BMP );
-        
+  fuse_BMP = NULL; win32_pixdata = NULL;
+
   return 0;
 }
 
@@ -395,6 +395,7 @@ win32ui_make_menu( void )
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_RECORDING_ROLLBACK, 0 );
+  ui_menu_activate( UI_MENU_ITEM_SOUND_RECORDING, 0 );
   ui_menu_activate( UI_MENU_ITEM_TAPE_RECORDING, 0 );
 #ifdef HAVE_LIB_XML2
   ui_menu_activate( UI_MENU_ITEM_FILE_SVG_CAPTURE, 0 );
@@ -410,6 +411,13 @@ ui_event( void )
   return 0;
 }
 
+int
+ui_event_input( void )
+{
+  /* Input arrives through the message loop with everything else */
+  return 0;
+}
+
 int
 ui_end( void )
 {
@@ -640,7 +648,7 @@ menu_machine_select( int action )
 void
 menu_machine_debugger( int action )
 {
-  debugger_mode = DEBUGGER_MODE_HALTED;
+  debugger_set_mode( DEBUGGER_MODE_HALTED );
   if( paused ) ui_debugger_activate();
 }
 
@@ -112,6 +112,14 @@ static int xdisplay_bw = -1;
 static redmask_t xdisplay_redpos = MSB_RED;	/* red_mask 0xff000 ...*/
 static int rShift = 16, gShift = 8, bShift = 0;
 
+/* If the image's pixels are in a format we can write directly, rather
+   than going through XPutPixel() one pixel at a time, how many bits each
+   is, otherwise 0 */
+static int xdisplay_direct_bpp = 0;
+
+/* Each component of a 565 pixel's contribution to a 24 bit one */
+static libspectrum_dword direct_red[32], direct_green[64], direct_blue[32];
+
 /* This is a rule of thumb for the maximum number of rects that can be updated
    each frame. If more are generated we just update the whole screen */
 typedef struct {
@@ -126,8 +134,13 @@ static libspectrum_byte xdisplay_force_full_refresh = 1;
 static XShmSegmentInfo shm_info;
 int shm_eventtype;
 
+/* How many XShmPutImage()s the server hasn't yet finished with; the
+   image mustn't be written to until it has */
+static int shm_pending = 0;
+
 static int try_shm( void );
 static int get_shm_id( const int size );
+static void xdisplay_shm_wait( void );
 #endif				/* #ifdef X_USE_SHM */
 
 static int shm_used = 0;
@@ -139,6 +152,7 @@ static xdisplay_update_rect_t xdisplay_update_rect_noscale;
 static xdisplay_update_rect_t xdisplay_update_rect_scale;
 
 static int xdisplay_find_visual( void );
+static void xdisplay_setup_direct( void );
 static int xdisplay_allocate_colours4( void );
 static int xdisplay_allocate_colours8( void );
 static int xdisplay_allocate_gc( Window window, GC *new_gc );
@@ -453,11 +467,88 @@ xdisplay_allocate_image( void )
       xdisplay_redpos = LSB_RED;
       break;
     }
+
+    xdisplay_setup_direct();
   }
 
   return 0;
 }
 
+/* See if the image's pixels can be written directly: they must be in our
+   own byte order, and either 16 bits with the same layout as rgb_image or
+   32 bits with 8 bits for each component */
+static void
+xdisplay_setup_direct( void )
+{
+  int i;
+
+#ifdef WORDS_BIGENDIAN
+  const int host_order = MSBFirst;
+#else                           /* #ifdef WORDS_BIGENDIAN */
+  const int host_order = LSBFirst;
+#endif                          /* #ifdef WORDS_BIGENDIAN */
+
+  xdisplay_direct_bpp = 0;
+
+  if( image->byte_order != host_order ) return;
+
+  if( image->bits_per_pixel == 16 && xdisplay_depth == 16 ) {
+    xdisplay_direct_bpp = 16;
+  } else if( image->bits_per_pixel == 32 &&
+             ( xdisplay_depth == 24 || xdisplay_depth == 32 ) ) {
+    for( i = 0; i < 32; i++ ) {
+      direct_red[i] = (libspectrum_dword)( i * 255 / 31 ) << rShift;
+      direct_blue[i] = (libspectrum_dword)( i * 255 / 31 ) << bShift;
+    }
+    for( i = 0; i < 64; i++ )
+      direct_green[i] = (libspectrum_dword)( i * 255 / 63 ) << gShift;
+
+    xdisplay_direct_bpp = 32;
+  }
+}
+
+/* Copy the `w' x `h' pixels at `src' into the image at ( x, y ) */
+static void
+xdisplay_put_rect( int x, int y, int w, int h, const libspectrum_word *src,
+                   size_t src_pitch )
+{
+  int xx, yy;
+
+#ifdef X_USE_SHM
+  if( shm_used ) xdisplay_shm_wait();
+#endif				/* #ifdef X_USE_SHM */
+
+  switch( xdisplay_direct_bpp ) {
+
+  case 16:
+    for( yy = 0; yy < h; yy++, src += src_pitch )
+      memcpy( image->data + ( y + yy ) * image->bytes_per_line + x * 2, src,
+              w * 2 );
+    break;
+
+  case 32:
+    for( yy = 0; yy < h; yy++, src += src_pitch ) {
+      libspectrum_dword *dest = (libspectrum_dword *)
+        ( image->data + ( y + yy ) * image->bytes_per_line ) + x;
+
+      for( xx = 0; xx < w; xx++ ) {
+        libspectrum_word c = src[ xx ];
+        dest[ xx ] = direct_blue[ c & 0x1f ] |
+                     direct_green[ ( c >> 5 ) & 0x3f ] |
+                     direct_red[ c >> 11 ];
+      }
+    }
+    break;
+
+  default:
+    for( yy = 0; yy < h; yy++, src += src_pitch )
+      for( xx = 0; xx < w; xx++ )
+        xdisplay_putpixel( x + xx, y + yy, (libspectrum_word *)&src[ xx ] );
+    break;
+
+  }
+}
+
 #ifdef X_USE_SHM
 static int
 try_shm( void )
@@ -560,6 +651,25 @@ get_shm_id( const int size )
 
   return id;
 }
+
+static Bool
+is_shm_completion( Display *dpy, XEvent *event, XPointer arg )
+{
+  return event->type == shm_eventtype;
+}
+
+/* Wait for the server to finish with every image we've put */
+static void
+xdisplay_shm_wait( void )
+{
+  XEvent event;
+
+  while( shm_pending ) {
+    XIfEvent( display, &event, is_shm_completion, NULL );
+    shm_pending--;
+  }
+}
+
 #endif			/* #ifdef X_USE_SHM */
 
 int
@@ -693,12 +803,7 @@ xdisplay_configure_notify( int width, int height )
 static void
 xdisplay_update_rect_noscale( int x, int y, int w, int h )
 {
- int yy, xx;
-
-  /* Call putpixel multiple times */
-  for( yy = y; yy < y + h; yy++ )
-    for( xx = x; xx < x + w; xx++ )
-      xdisplay_putpixel( xx, yy, &rgb_image[yy + 2][xx + 1] );
+  xdisplay_put_rect( x, y, w, h, &rgb_image[y + 2][x + 1], rgb_pitch );
   /* Blit to the real screen at the frame end end */
   xdisplay_area( x, y, w, h );
 }
@@ -707,9 +812,11 @@ static void
 xdisplay_update_rect_scale( int x, int y, int w, int h )
 {
   int yy = y, xx = x;
+  double start;
 
   y = y * image_scale >> 2;
   x = x * image_scale >> 2;
+  start = scaler_auto_start();
   scaler_proc16(
         (libspectrum_byte *)&(rgb_image[yy + 2][xx + 1]),
         rgb_pitch * sizeof(rgb_image[0][0]),
@@ -717,14 +824,13 @@ xdisplay_update_rect_scale( int x, int y, int w, int h )
         scaled_pitch,
         w, h
       );
+  scaler_auto_end( start, w * h );
 
   w = w * image_scale >> 2;
   h = h * image_scale >> 2;
 
-  /* Call putpixel multiple times */
-  for( yy = y; yy < y + h; yy++ )
-    for( xx = x; xx < x + w; xx++ )
-      xdisplay_putpixel( xx, yy, &scaled_image[yy][xx] );
+  xdisplay_put_rect( x, y, w, h, &scaled_image[y][x],
+                     4 * DISPLAY_SCREEN_WIDTH );
   /* Blit to the real screen */
   xdisplay_area( x, y, w, h );
 }
@@ -734,6 +840,8 @@ uidisplay_frame_end( void )
 {
   X_Rect *r, *last_rect;
 
+  scaler_auto_frame( image_width * image_height );
+
   /* Force a full redraw if requested */
   if ( xdisplay_force_full_refresh ) {
     num_rects = 1;
@@ -769,6 +877,13 @@ uidisplay_frame_restore( void )
   xdisplay_update_rect( 0, 0, image_width, image_height );
 }
 
+void
+uidisplay_frame_release( void )
+{
+  /* The widgets were drawn over the image, so redraw all of it */
+  display_refresh_all();
+}
+
 void
 uidisplay_area( int x, int y, int w, int h )
 {
@@ -792,6 +907,15 @@ uidisplay_area( int x, int y, int w, int h )
   num_rects++;
 }
 
+/* Called for events ui_event() doesn't otherwise handle */
+void
+xdisplay_event( XEvent *event )
+{
+#ifdef X_USE_SHM
+  if( shm_pending && event->type == shm_eventtype ) shm_pending--;
+#endif				/* #ifdef X_USE_SHM */
+}
+
 void
 xdisplay_area( int x, int y, int w, int h )
 {
@@ -805,7 +929,7 @@ xdisplay_area( int x, int y, int w, int h )
   if( shm_used ) {
 #ifdef X_USE_SHM
     XShmPutImage( display, xui_mainWindow, gc, image, x, y, x, y, w, h, True );
-    /* FIXME: should wait for an ShmCompletion event here */
+    shm_pending++;
 #endif				/* #ifdef X_USE_SHM */
   } else {
     XPutImage( display, xui_mainWindow, gc, image, x, y, x, y, w, h );
@@ -819,6 +943,7 @@ xdisplay_destroy_image(void)
      data */
 #ifdef X_USE_SHM
   if( shm_used ) {
+    xdisplay_shm_wait();
     XShmDetach( display, &shm_info );
     shmdt( shm_info.shmaddr );
     image->data = NULL;
@@ -29,6 +29,7 @@ int xdisplay_end( void );
 
 int xdisplay_configure_notify(int width, int height);
 void xdisplay_area(int x, int y, int width, int height);
+void xdisplay_event( XEvent *event );
 
 /* Are we expecting an X error to occur? */
 extern int xerror_expecting;
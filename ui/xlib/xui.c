@@ -247,11 +247,20 @@ int ui_event(void)
         fuse_emulation_unpause();
       }
       break;
+    default:
+      xdisplay_event( &event );
+      break;
     }
   }
   return 0;
 }
 
+int ui_event_input(void)
+{
+  /* Key events arrive in the same queue as everything else */
+  return 0;
+}
+
 int ui_end(void)
 {
   int error;
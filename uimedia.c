@@ -29,8 +29,15 @@
 #include <glib.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "fuse.h"
+#include "machine.h"
 #include "options.h"
+#include "settings.h"
+#include "thread_sched.h"
 #include "ui/ui.h"
 #include "ui/uimedia.h"
 #include "utils.h"
@@ -41,6 +48,22 @@
 
 static GSList *registered_drives = NULL;
 
+/* With --disk-autosave, changes to disks are gathered up for this many
+   seconds and then the changed tracks written into the image files */
+#define AUTOSAVE_DELAY 3
+
+typedef struct autosave_job {
+  struct fdd_t *fdd;		/* The drive the disk is in */
+  char *filename;
+  disk_writeback_t writeback;
+  int error;
+} autosave_job;
+
+static int autosave_frames = 0;
+
+static void autosave_wait( void );
+static void autosave_end( void );
+
 static inline int
 menu_item_valid( ui_menu_item item )
 {
@@ -57,6 +80,7 @@ ui_media_drive_register( ui_media_drive_info_t *drive )
 void
 ui_media_drive_end( void )
 {
+  autosave_end();
   g_slist_free( registered_drives );
   registered_drives = NULL;
 }
@@ -186,6 +210,8 @@ drive_disk_write( const ui_media_drive_info_t *drive, const char *filename )
 {
   int error;
 
+  autosave_wait();
+
   drive->fdd->disk.type = DISK_TYPE_NONE;
   if( filename == NULL )
     filename = drive->fdd->disk.filename; /* write over original file */
@@ -287,12 +313,20 @@ ui_media_drive_save( int controller, int which, int saveas )
   return drive_save( drive, saveas );
 }
 
+static void autosave_drive( gpointer data, gpointer user_data );
+
 static int
 drive_eject( const ui_media_drive_info_t *drive )
 {
   if( !drive->fdd->loaded )
     return 0;
 
+  /* Only ask about changes which couldn't be written back */
+  if( settings_current.disk_autosave ) {
+    autosave_drive( (gpointer)drive, NULL );
+    autosave_wait();
+  }
+
   if( drive->fdd->disk.dirty ) {
 
     ui_confirm_save_t confirm = ui_confirm_save(
@@ -397,3 +431,218 @@ ui_media_drive_insert( const ui_media_drive_info_t *drive,
 
   return 0;
 }
+
+static void
+autosave_job_free( autosave_job *job )
+{
+  disk_writeback_free( &job->writeback );
+  libspectrum_free( job->filename );
+  libspectrum_free( job );
+}
+
+static void
+autosave_job_report( autosave_job *job )
+{
+  if( job->error ) {
+    /* Whatever didn't get written still needs saving */
+    if( job->fdd->loaded ) job->fdd->disk.dirty = 1;
+    ui_error( UI_ERROR_ERROR, "couldn't autosave '%s': %s", job->filename,
+              disk_strerror( job->error ) );
+  }
+  autosave_job_free( job );
+}
+
+#ifdef HAVE_PTHREAD
+
+/* The tracks are copied out of the disk in-frame, and written into the
+   image file on a background thread so the emulation doesn't stall on
+   slow storage. Any errors are reported from ui_media_drive_frame() */
+
+static pthread_t autosave_thread;
+static pthread_mutex_t autosave_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t autosave_cond = PTHREAD_COND_INITIALIZER;
+
+static int autosave_running = 0;
+static int autosave_quit;
+
+/* Jobs waiting to be written, and those which have been */
+static GSList *autosave_pending = NULL, *autosave_done = NULL;
+static int autosave_busy;
+
+static void*
+autosave_thread_fn( void *arg GCC_UNUSED )
+{
+  autosave_job *job;
+
+  thread_sched_apply( THREAD_SCHED_BACKGROUND );
+
+  pthread_mutex_lock( &autosave_mutex );
+
+  while( 1 ) {
+
+    while( !autosave_pending && !autosave_quit )
+      pthread_cond_wait( &autosave_cond, &autosave_mutex );
+
+    /* Finish everything we've been given before quitting */
+    if( !autosave_pending ) break;
+
+    job = autosave_pending->data;
+    autosave_pending = g_slist_delete_link( autosave_pending,
+                                            autosave_pending );
+    autosave_busy = 1;
+    pthread_mutex_unlock( &autosave_mutex );
+
+    job->error = disk_writeback_write( &job->writeback, job->filename );
+
+    pthread_mutex_lock( &autosave_mutex );
+    autosave_busy = 0;
+    autosave_done = g_slist_append( autosave_done, job );
+    pthread_cond_broadcast( &autosave_cond );
+  }
+
+  pthread_mutex_unlock( &autosave_mutex );
+
+  return NULL;
+}
+
+/* Report on the jobs which have been written */
+static void
+autosave_report( void )
+{
+  GSList *done, *item;
+
+  pthread_mutex_lock( &autosave_mutex );
+  done = autosave_done;
+  autosave_done = NULL;
+  pthread_mutex_unlock( &autosave_mutex );
+
+  for( item = done; item; item = item->next )
+    autosave_job_report( item->data );
+  g_slist_free( done );
+}
+
+/* Hand a job to the writer thread. Returns non-zero if the thread isn't
+   available */
+static int
+autosave_start( autosave_job *job )
+{
+  if( !autosave_running ) {
+    autosave_quit = 0;
+    if( pthread_create( &autosave_thread, NULL, autosave_thread_fn, NULL ) ) {
+      fprintf( stderr, "%s: couldn't start disk autosave thread\n",
+               fuse_progname );
+      return 1;
+    }
+    autosave_running = 1;
+  }
+
+  pthread_mutex_lock( &autosave_mutex );
+  autosave_pending = g_slist_append( autosave_pending, job );
+  pthread_cond_signal( &autosave_cond );
+  pthread_mutex_unlock( &autosave_mutex );
+
+  return 0;
+}
+
+/* Wait for everything outstanding to be written, and report on it */
+static void
+autosave_wait( void )
+{
+  if( !autosave_running ) return;
+
+  pthread_mutex_lock( &autosave_mutex );
+  while( autosave_pending || autosave_busy )
+    pthread_cond_wait( &autosave_cond, &autosave_mutex );
+  pthread_mutex_unlock( &autosave_mutex );
+
+  autosave_report();
+}
+
+static void
+autosave_end( void )
+{
+  GSList *item;
+
+  if( !autosave_running ) return;
+
+  pthread_mutex_lock( &autosave_mutex );
+  autosave_quit = 1;
+  pthread_cond_signal( &autosave_cond );
+  pthread_mutex_unlock( &autosave_mutex );
+
+  pthread_join( autosave_thread, NULL );
+  autosave_running = 0;
+
+  /* The drives may have gone by now, so just tidy up */
+  for( item = autosave_done; item; item = item->next )
+    autosave_job_free( item->data );
+  g_slist_free( autosave_done );
+  autosave_done = NULL;
+}
+
+#else			/* #ifdef HAVE_PTHREAD */
+
+static void autosave_report( void ) {}
+static int autosave_start( autosave_job *job GCC_UNUSED ) { return 1; }
+static void autosave_wait( void ) {}
+static void autosave_end( void ) {}
+
+#endif			/* #ifdef HAVE_PTHREAD */
+
+/* Copy out the tracks changed on the disk in `data' (a drive), and get
+   them written */
+static void
+autosave_drive( gpointer data, gpointer user_data GCC_UNUSED )
+{
+  const ui_media_drive_info_t *drive = data;
+  autosave_job *job;
+
+  if( !drive->fdd || !drive->fdd->loaded || !drive->fdd->disk.dirty )
+    return;
+
+  job = libspectrum_new( autosave_job, 1 );
+  if( disk_writeback_get( &drive->fdd->disk, &job->writeback ) ||
+      !job->writeback.count ) {
+    libspectrum_free( job );
+    return;
+  }
+  job->fdd = drive->fdd;
+  job->filename = utils_safe_strdup( drive->fdd->disk.filename );
+  job->error = 0;
+
+  if( autosave_start( job ) ) {
+    job->error = disk_writeback_write( &job->writeback, job->filename );
+    autosave_job_report( job );
+  }
+}
+
+static gint
+drive_dirty( gconstpointer data, gconstpointer user_data GCC_UNUSED )
+{
+  const ui_media_drive_info_t *drive = data;
+
+  return !( drive->fdd && drive->fdd->loaded && drive->fdd->disk.dirty );
+}
+
+void
+ui_media_drive_frame( void )
+{
+  libspectrum_dword frames_per_second;
+
+  autosave_report();
+
+  if( !settings_current.disk_autosave ||
+      !g_slist_find_custom( registered_drives, NULL, drive_dirty ) ) {
+    autosave_frames = 0;
+    return;
+  }
+
+  /* Give the DOS time to finish what it's doing, so a whole batch of
+     changes goes out together */
+  frames_per_second = machine_current->timings.processor_speed /
+                      machine_current->timings.tstates_per_frame;
+  if( ++autosave_frames < AUTOSAVE_DELAY * frames_per_second ) return;
+  autosave_frames = 0;
+
+  g_slist_foreach( registered_drives, autosave_drive, NULL );
+}
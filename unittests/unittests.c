@@ -24,13 +24,19 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <libspectrum.h>
 
 #include "debugger/debugger.h"
+#include "display.h"
+#include "event.h"
 #include "fuse.h"
 #include "machine.h"
 #include "mempool.h"
+#include "module.h"
 #include "periph.h"
+#include "pokefinder/pokefinder.h"
 #include "peripherals/disk/beta.h"
 #include "peripherals/disk/didaktik.h"
 #include "peripherals/disk/disciple.h"
@@ -47,8 +53,11 @@
 #include "peripherals/ttx2000s.h"
 #include "peripherals/ula.h"
 #include "peripherals/usource.h"
+#include "rectangle.h"
 #include "settings.h"
+#include "sound/blipbuffer.h"
 #include "unittests.h"
+#include "z80/z80.h"
 
 static int
 contention_test( void )
@@ -58,7 +67,7 @@ contention_test( void )
 
   for( i = 0; i < ULA_CONTENTION_SIZE; i++ ) {
     /* Naive, but it will do for now */
-    checksum += ula_contention[ i ] * ( i + 1 );
+    checksum += ula_timing[ i ].contention * ( i + 1 );
   }
 
   if( settings_current.late_timings ) {
@@ -251,7 +260,8 @@ floating_bus_merge_test( void )
 static int
 mempool_test( void )
 {
-  int pool1, pool2;
+  int pool1, pool2, i;
+  char *first;
   int initial_pools = mempool_get_pools();
 
   pool1 = mempool_register_pool();
@@ -306,6 +316,19 @@ mempool_test( void )
   TEST_ASSERT( mempool_get_pool_size( pool1 ) == 0 );
   TEST_ASSERT( mempool_get_pool_size( pool2 ) == 0 );
 
+  /* Enough small allocations to need several blocks, and one too big for
+     any block */
+  first = mempool_strdup( pool1, "fuse" );
+  for( i = 1; i < 1000; i++ ) mempool_strdup( pool1, "fuse" );
+  mempool_malloc( pool1, 10000 );
+
+  TEST_ASSERT( mempool_get_pool_size( pool1 ) == 1001 );
+  TEST_ASSERT( !strcmp( first, "fuse" ) );
+
+  mempool_free( pool1 );
+
+  TEST_ASSERT( mempool_get_pool_size( pool1 ) == 0 );
+
   return 0;
 }
 
@@ -777,6 +800,395 @@ paging_test( void )
   return r;
 }
 
+/* Is chunk x of line y inside one of the inactive rectangles? */
+static int
+rectangle_covered( int x, int y )
+{
+  size_t i;
+
+  for( i = 0; i < rectangle_inactive_count; i++ ) {
+    struct rectangle *r = &rectangle_inactive[i];
+    if( x >= r->x && x < r->x + r->w && y >= r->y && y < r->y + r->h )
+      return 1;
+  }
+
+  return 0;
+}
+
+static int
+rectangle_coalesce_test( void )
+{
+  int x, y;
+
+  rectangle_inactive_count = 0;
+
+  /* A solid block should give exactly one rectangle */
+  for( y = 10; y < 50; y++ )
+    rectangle_add_line( y, (libspectrum_qword)0xff << 4 );
+  rectangle_coalesce();
+
+  TEST_ASSERT( rectangle_inactive_count == 1 );
+  TEST_ASSERT( rectangle_inactive[0].x == 4 );
+  TEST_ASSERT( rectangle_inactive[0].w == 8 );
+  TEST_ASSERT( rectangle_inactive[0].y == 10 );
+  TEST_ASSERT( rectangle_inactive[0].h == 40 );
+
+  /* And the bitmap should now be clear */
+  rectangle_inactive_count = 0;
+  rectangle_coalesce();
+  TEST_ASSERT( rectangle_inactive_count == 0 );
+
+  /* A checkerboard of single chunks should stay bounded but covered */
+  for( y = 0; y < DISPLAY_SCREEN_HEIGHT; y++ )
+    for( x = y & 1; x < DISPLAY_SCREEN_WIDTH_COLS; x += 2 )
+      rectangle_add_line( y, (libspectrum_qword)1 << x );
+  rectangle_coalesce();
+
+  TEST_ASSERT( rectangle_inactive_count <= 148 );
+  for( y = 0; y < DISPLAY_SCREEN_HEIGHT; y++ )
+    for( x = y & 1; x < DISPLAY_SCREEN_WIDTH_COLS; x += 2 )
+      TEST_ASSERT( rectangle_covered( x, y ) );
+
+  rectangle_inactive_count = 0;
+
+  return 0;
+}
+
+#define BLIP_TEST_SAMPLES 4000
+
+static int
+blipbuffer_test( void )
+{
+  Blip_Buffer *buf[4];
+  Blip_Synth *synth[4];
+  blip_sample_t *strided, *linear;
+  libspectrum_dword seed = 1;
+  long count, count_r;
+  int i, frame, error = 0, last_amp = 0;
+
+  /* Buffers 0 and 2 use the strided impulses, 1 and 3 the linear kernel;
+     0 and 1 get one waveform, 2 and 3 another, which 3 is given as the
+     changes in its level */
+  for( i = 0; i < 4; i++ ) {
+    buf[i] = new_Blip_Buffer();
+    synth[i] = new_Blip_Synth();
+    TEST_ASSERT( buf[i] && synth[i] );
+    blip_buffer_set_clock_rate( buf[i], 3500000 );
+    TEST_ASSERT( !blip_buffer_set_sample_rate( buf[i], 44100, 1000 ) );
+    blip_buffer_set_bass_freq( buf[i], 16 );
+    blip_synth_set_volume( synth[i], 0.5 );
+    blip_synth_set_output( synth[i], buf[i] );
+    blip_synth_set_treble_eq( synth[i], -37.0 );
+    TEST_ASSERT( !blip_synth_set_linear_kernel( synth[i], i & 1 ) );
+  }
+
+  strided = libspectrum_new( blip_sample_t, BLIP_TEST_SAMPLES * 2 );
+  linear = libspectrum_new( blip_sample_t, BLIP_TEST_SAMPLES * 2 );
+
+  for( frame = 0; frame < 10 && !error; frame++ ) {
+    blip_time_t t;
+
+    for( t = 0; t < 69888; t += 1 + ( seed >> 24 ) ) {
+      int amp;
+
+      seed = seed * 1664525 + 1013904223;
+      amp = ( seed >> 8 ) & 0xffff;
+      if( seed & 1 ) {
+        blip_synth_update( synth[2], t, amp - 0x8000 );
+        blip_synth_offset( synth[3], t, amp - 0x8000 - last_amp );
+        last_amp = amp - 0x8000;
+      } else {
+        blip_synth_update( synth[0], t, amp - 0x8000 );
+        blip_synth_update( synth[1], t, amp - 0x8000 );
+      }
+    }
+
+    for( i = 0; i < 4; i++ )
+      blip_buffer_end_frame( buf[i], 69888 );
+
+    count = blip_buffer_read_samples( buf[0], strided, BLIP_TEST_SAMPLES, 1 );
+    count_r = blip_buffer_read_samples( buf[2], strided + 1, count, 1 );
+    if( count_r != count ) error = 1;
+
+    count_r = blip_buffer_read_stereo_samples( buf[1], buf[3], linear,
+                                               BLIP_TEST_SAMPLES );
+    if( count_r != count ) error = 1;
+
+    if( memcmp( strided, linear, count * 2 * sizeof( blip_sample_t ) ) )
+      error = 1;
+  }
+
+  libspectrum_free( strided );
+  libspectrum_free( linear );
+  for( i = 0; i < 4; i++ ) {
+    delete_Blip_Synth( &synth[i] );
+    delete_Blip_Buffer( &buf[i] );
+  }
+
+  TEST_ASSERT( !error );
+
+  return 0;
+}
+
+static int
+pokefinder_test( void )
+{
+  size_t pages = MEMORY_PAGES_IN_16K * machine_current->ram.valid_pages;
+  size_t page;
+  libspectrum_byte *saved;
+
+  saved = libspectrum_new( libspectrum_byte, pages * MEMORY_PAGE_SIZE );
+  for( page = 0; page < pages; page++ ) {
+    memcpy( saved + page * MEMORY_PAGE_SIZE, memory_map_ram[ page ].page,
+            MEMORY_PAGE_SIZE );
+    memset( memory_map_ram[ page ].page, 0, MEMORY_PAGE_SIZE );
+  }
+
+  /* 0x1234 split across the first two pages, and one more byte */
+  memory_map_ram[0].page[ MEMORY_PAGE_SIZE - 1 ] = 0x34;
+  memory_map_ram[1].page[0] = 0x12;
+  memory_map_ram[2].page[5] = 0x36;
+
+  pokefinder_clear();
+  TEST_ASSERT( pokefinder_count == pages * MEMORY_PAGE_SIZE );
+  pokefinder_search_range( POKEFINDER_WIDTH_BYTE, 0x30, 0x36 );
+  TEST_ASSERT( pokefinder_count == 2 );
+
+  /* A word can't start at the last byte of a 16K bank */
+  pokefinder_clear();
+  pokefinder_search_range( POKEFINDER_WIDTH_WORD, 0, 0 );
+  TEST_ASSERT( pokefinder_count ==
+               pages * MEMORY_PAGE_SIZE - machine_current->ram.valid_pages - 5 );
+
+  pokefinder_clear();
+  pokefinder_search_range( POKEFINDER_WIDTH_WORD, 0x1234, 0x1234 );
+  TEST_ASSERT( pokefinder_count == 1 );
+  TEST_ASSERT( !( pokefinder_impossible[0][ ( MEMORY_PAGE_SIZE - 1 ) / 8 ] &
+                  0x80 ) );
+
+  /* Only the high byte changes, so a byte search would miss this */
+  memory_map_ram[1].page[0] = 0x13;
+  pokefinder_incremented();
+  TEST_ASSERT( pokefinder_count == 1 );
+
+  memory_map_ram[0].page[ MEMORY_PAGE_SIZE - 1 ] = 0x35;
+  pokefinder_decremented();
+  TEST_ASSERT( pokefinder_count == 0 );
+
+  /* Few enough locations are left here to be searched as a list */
+  pokefinder_clear();
+  pokefinder_search( 0x36 );
+  TEST_ASSERT( pokefinder_count == 1 );
+  memory_map_ram[2].page[5] = 0x37;
+  pokefinder_changed();
+  TEST_ASSERT( pokefinder_count == 1 );
+  pokefinder_unchanged();
+  TEST_ASSERT( pokefinder_count == 1 );
+  pokefinder_changed();
+  TEST_ASSERT( pokefinder_count == 0 );
+  TEST_ASSERT( pokefinder_impossible[2][0] & 0x20 );
+
+  for( page = 0; page < pages; page++ )
+    memcpy( memory_map_ram[ page ].page, saved + page * MEMORY_PAGE_SIZE,
+            MEMORY_PAGE_SIZE );
+  libspectrum_free( saved );
+  pokefinder_clear();
+
+  return 0;
+}
+
+static int
+module_state_test( void )
+{
+  module_state_t state, other;
+  size_t length;
+  libspectrum_word pc = z80.pc.w;
+  libspectrum_dword original_tstates = tstates, next = event_next_event;
+  libspectrum_byte byte = RAM[5][0x1234];
+  int type = event_register( NULL, "Module state test" );
+
+  module_state_init( &state );
+  module_state_save( &state );
+
+  z80.pc.w = pc + 1;
+  tstates = original_tstates + 1;
+  writebyte_internal( 0x5234, byte ^ 0xff );
+  event_add( 0, type );
+  TEST_ASSERT( event_next_event != next );
+
+  TEST_ASSERT( !module_state_restore( &state ) );
+  TEST_ASSERT( z80.pc.w == pc );
+  TEST_ASSERT( tstates == original_tstates );
+  TEST_ASSERT( RAM[5][0x1234] == byte );
+  TEST_ASSERT( event_next_event == next );
+
+  /* A damaged state mustn't be restored, and going back to the full
+     state afterwards fixes up anything a partial restore has done */
+  length = state.length;
+  state.length = 0;
+  TEST_ASSERT( module_state_restore( &state ) );
+  state.length = length - 1;
+  TEST_ASSERT( module_state_restore( &state ) );
+  state.length = length;
+  TEST_ASSERT( !module_state_restore( &state ) );
+
+  /* Only the RAM written to since a state last matched is copied, so
+     going back to one state must count as a change for any other */
+  writebyte_internal( 0x5234, byte ^ 0xff );
+  module_state_init( &other );
+  module_state_save( &other );
+  TEST_ASSERT( !module_state_restore( &state ) );
+  TEST_ASSERT( RAM[5][0x1234] == byte );
+  TEST_ASSERT( !module_state_restore( &other ) );
+  TEST_ASSERT( RAM[5][0x1234] == ( byte ^ 0xff ) );
+  TEST_ASSERT( !module_state_restore( &state ) );
+  TEST_ASSERT( RAM[5][0x1234] == byte );
+
+  /* Changes made behind the memory code's back are picked up too */
+  RAM[5][0x1234] = byte ^ 0xff;
+  memory_ram_changed();
+  TEST_ASSERT( !module_state_restore( &state ) );
+  TEST_ASSERT( RAM[5][0x1234] == byte );
+
+  module_state_free( &other );
+  module_state_free( &state );
+
+  return 0;
+}
+
+/* What the event test's events have done, in order */
+static int event_test_ids[] = { 0, 1, 2, 3 };
+static int event_test_done[ 8 ];
+static size_t event_test_count;
+
+/* What an event_test_cancel() event removes */
+static event_handle_t event_test_handle;
+static int event_test_remove;
+
+static void
+event_test_record( libspectrum_dword ts GCC_UNUSED, int type GCC_UNUSED,
+                   void *user_data )
+{
+  if( event_test_count < ARRAY_SIZE( event_test_done ) )
+    event_test_done[ event_test_count ] = *(int*)user_data;
+  event_test_count++;
+}
+
+static void
+event_test_cancel( libspectrum_dword ts GCC_UNUSED, int type GCC_UNUSED,
+                   void *user_data GCC_UNUSED )
+{
+  event_cancel( &event_test_handle );
+  event_remove_type( event_test_remove );
+}
+
+/* Enough events for cancelling half of them to clear them out */
+#define EVENT_TEST_MANY 128
+
+static int
+event_test( void )
+{
+  module_state_t state;
+  event_pool_stats_t stats;
+  event_handle_t handles[ EVENT_TEST_MANY ], done;
+  size_t i, in_use;
+  int cancel_type = event_register( event_test_cancel, "Event test (cancel)" );
+  int type = event_register( event_test_record, "Event test" );
+  int later_type = event_register( event_test_record, "Event test (later)" );
+
+  /* Put the machine's own events aside while the list is played with */
+  module_state_init( &state );
+  module_state_save( &state );
+  event_reset();
+
+  /* Events due at the same time happen in type order, and the most
+     recently added first within a type */
+  tstates = 0;
+  event_test_count = 0;
+  event_add_with_data( 100, type, &event_test_ids[0] );
+  event_add_with_data( 100, type, &event_test_ids[1] );
+  event_add_with_data( 100, later_type, &event_test_ids[2] );
+  event_add_with_data( 50, later_type, &event_test_ids[3] );
+  TEST_ASSERT( event_next_event == 50 );
+
+  tstates = 100;
+  event_do_events();
+  TEST_ASSERT( event_test_count == 4 );
+  TEST_ASSERT( event_test_done[0] == 3 );
+  TEST_ASSERT( event_test_done[1] == 1 );
+  TEST_ASSERT( event_test_done[2] == 0 );
+  TEST_ASSERT( event_test_done[3] == 2 );
+  TEST_ASSERT( event_next_event == 0xffffffff );
+
+  /* An event can cancel or remove ones which are due after it, even at
+     the same time */
+  tstates = 0;
+  event_test_count = 0;
+  event_test_remove = later_type;
+  event_add_with_data( 10, cancel_type, NULL );
+  event_test_handle = event_add_with_data( 20, type, &event_test_ids[0] );
+  event_add_with_data( 10, later_type, &event_test_ids[1] );
+  event_add_with_data( 30, later_type, &event_test_ids[2] );
+  done = event_add_with_data( 40, type, &event_test_ids[3] );
+  TEST_ASSERT( event_pending( &event_test_handle ) );
+
+  tstates = 40;
+  event_do_events();
+  TEST_ASSERT( event_test_count == 1 );
+  TEST_ASSERT( event_test_done[0] == 3 );
+  TEST_ASSERT( !event_pending( &event_test_handle ) );
+  TEST_ASSERT( !event_pending( &done ) );
+
+  /* Cancelled events stay in the heap until at least half of it is
+     cancelled, and are then cleared out all at once */
+  tstates = 0;
+  event_pool_stats( &stats );
+  in_use = stats.in_use;
+
+  for( i = 0; i < EVENT_TEST_MANY; i++ )
+    handles[i] = event_add_with_data( 1000 + i, type, &event_test_ids[0] );
+  for( i = 0; i < EVENT_TEST_MANY / 2 - 1; i++ )
+    event_cancel( &handles[i] );
+
+  event_pool_stats( &stats );
+  TEST_ASSERT( stats.in_use == in_use + EVENT_TEST_MANY );
+  TEST_ASSERT( event_next_event == 1000 );
+
+  event_cancel( &handles[ EVENT_TEST_MANY / 2 - 1 ] );
+  event_pool_stats( &stats );
+  TEST_ASSERT( stats.in_use == in_use + EVENT_TEST_MANY / 2 );
+  TEST_ASSERT( event_next_event == 1000 + EVENT_TEST_MANY / 2 );
+  TEST_ASSERT( event_pending( &handles[ EVENT_TEST_MANY / 2 ] ) );
+
+  event_remove_type( type );
+  event_pool_stats( &stats );
+  TEST_ASSERT( stats.in_use == in_use );
+  TEST_ASSERT( event_next_event == 0xffffffff );
+
+  /* The end of each frame moves the epoch on rather than the events
+     back, and that mustn't go wrong once it's past 32 bits */
+  for( i = 0; i < 3; i++ ) event_frame( 0x80000000 );
+
+  event_test_count = 0;
+  event_add_with_data( 0xfffffff0, type, &event_test_ids[0] );
+  event_frame( 0x80000000 );
+  TEST_ASSERT( event_next_event == 0x7ffffff0 );
+  event_add_with_data( 5, type, &event_test_ids[1] );
+  TEST_ASSERT( event_next_event == 5 );
+
+  tstates = 0x7ffffff0;
+  event_do_events();
+  TEST_ASSERT( event_test_count == 2 );
+  TEST_ASSERT( event_test_done[0] == 1 );
+  TEST_ASSERT( event_test_done[1] == 0 );
+
+  event_reset();
+  TEST_ASSERT( !module_state_restore( &state ) );
+  module_state_free( &state );
+
+  return 0;
+}
+
 int
 unittests_run( void )
 {
@@ -786,6 +1198,11 @@ unittests_run( void )
   r += floating_bus_test();
   r += floating_bus_merge_test();
   r += mempool_test();
+  r += rectangle_coalesce_test();
+  r += blipbuffer_test();
+  r += pokefinder_test();
+  r += module_state_test();
+  r += event_test();
   r += paging_test();
   r += debugger_disassemble_unittest();
 
@@ -33,6 +33,7 @@
 #include <libgen.h>
 #endif				/* #ifdef HAVE_LIBGEN_H */
 #include <string.h>
+#include <strings.h>
 #include <ui/ui.h>
 #include <unistd.h>
 
@@ -57,6 +58,7 @@
 #include "snapshot.h"
 #include "tape.h"
 #include "utils.h"
+#include "zip.h"
 
 #ifdef GCWZERO
 #include "controlmapping/controlmapping.h"
@@ -69,6 +71,37 @@ static void init_path_context( path_context *ctx, utils_aux_type type );
 
 static int networking_init_count = 0;
 
+/* Identifying a compressed file by its contents means inflating all of
+   it, which is then done again to read it. If the name without the
+   compression extension says it's a tape, as in "game.tzx.gz", take its
+   word for it; the tape code can then do the inflating the once, in the
+   background. Returns 0 if so */
+static int
+identify_compressed_tape( libspectrum_id_t *type, libspectrum_class_t *class,
+                          const char *filename, const utils_file *file )
+{
+  libspectrum_id_t raw_type;
+  libspectrum_class_t raw_class;
+  char *name, *dot;
+  int error;
+
+  if( !filename ||
+      libspectrum_identify_file_raw( &raw_type, filename, file->buffer,
+                                     file->length ) ||
+      libspectrum_identify_class( &raw_class, raw_type ) ||
+      raw_class != LIBSPECTRUM_CLASS_COMPRESSED )
+    return 1;
+
+  name = utils_safe_strdup( filename );
+  dot = strrchr( name, '.' );
+  if( dot ) *dot = '\0';
+
+  error = libspectrum_identify_file_with_class( type, class, name, NULL, 0 );
+  libspectrum_free( name );
+
+  return error || *class != LIBSPECTRUM_CLASS_TAPE;
+}
+
 /* Open `filename' and do something sensible with it; autoload tapes
    if `autoload' is true and return the type of file found in `type' */
 int
@@ -89,7 +122,8 @@ utils_open_file( const char *filename, int autoload,
   if( utils_read_file( filename, &file ) ) return 1;
 
   /* See if we can work out what it is */
-  if( libspectrum_identify_file_with_class( &type, &class, filename,
+  if( identify_compressed_tape( &type, &class, filename, &file ) &&
+      libspectrum_identify_file_with_class( &type, &class, filename,
 					    file.buffer, file.length ) ) {
     utils_close_file( &file );
     return 1;
@@ -349,12 +383,18 @@ utils_read_file( const char *filename, utils_file *file )
 {
   compat_fd fd;
 
-  int error;
+  int error, open_errno;
 
   fd = compat_file_open( filename, 0 );
   if( fd == COMPAT_FILE_OPEN_FAILED ) {
+    open_errno = errno;
+
+    /* Perhaps a file inside an archive, as chosen in the file selector */
+    error = zip_read_path( filename, file );
+    if( error != -1 ) return error;
+
     ui_error( UI_ERROR_ERROR, "couldn't open '%s': %s", filename,
-	      strerror( errno ) );
+	      strerror( open_errno ) );
     return 1;
   }
 
@@ -370,6 +410,15 @@ utils_read_fd( compat_fd fd, const char *filename, utils_file *file )
   file->length = compat_file_get_length( fd );
   if( file->length == -1 ) return 1;
 
+  /* Big files are mapped rather than read, so only the parts which are
+     actually looked at get paged in; if that isn't possible, fall back
+     to reading the whole thing */
+  if( file->length >= UTILS_MAP_THRESHOLD && !compat_file_map( fd, file ) ) {
+    compat_file_close( fd );
+    return 0;
+  }
+
+  file->mapped = 0;
   file->buffer = libspectrum_new( unsigned char, file->length );
 
   if( compat_file_read( fd, file ) ) {
@@ -391,7 +440,11 @@ utils_read_fd( compat_fd fd, const char *filename, utils_file *file )
 void
 utils_close_file( utils_file *file )
 {
-  libspectrum_free( file->buffer );
+  if( file->mapped ) {
+    compat_file_unmap( file );
+  } else {
+    libspectrum_free( file->buffer );
+  }
 }
 
 int utils_write_file( const char *filename, const unsigned char *buffer,
@@ -468,6 +521,18 @@ utils_safe_strdup( const char *src )
   return dest;
 }
 
+/* Does `name' contain `text', ignoring case? */
+int
+utils_name_contains( const char *name, const char *text )
+{
+  size_t length = strlen( text );
+
+  for( ; *name; name++ )
+    if( !strncasecmp( name, text, length ) ) return 1;
+
+  return !length;
+}
+
 int
 utils_save_binary( libspectrum_word start, size_t length,
                    const char *filename )
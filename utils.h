@@ -33,8 +33,13 @@ typedef struct utils_file {
   unsigned char *buffer;
   size_t length;
 
+  int mapped;			/* Is `buffer' a view of the file itself? */
+
 } utils_file;
 
+/* Files at least this big are mapped into memory rather than read */
+#define UTILS_MAP_THRESHOLD 0x10000
+
 #ifdef GCWZERO
 /* Last filename loaded */
 extern char* last_filename;
@@ -61,6 +66,8 @@ int utils_read_screen( const char *filename, utils_file *screen );
 
 char* utils_safe_strdup( const char *src );
 
+int utils_name_contains( const char *name, const char *text );
+
 int
 utils_save_binary( libspectrum_word start, size_t length,
                    const char *filename );
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "fuse.h"
 #include "peripherals/disk/beta.h"
@@ -56,6 +57,9 @@
 static const char *progname;		/* argv[0] */
 static const char *testsfile;		/* argv[1] */
 
+/* Whether to print the bus activity; turned off when benchmarking */
+static int trace = 1;
+
 static int init_dummies( void );
 
 libspectrum_dword tstates;
@@ -76,6 +80,8 @@ static int read_test( FILE *f, libspectrum_dword *end_tstates );
 static void dump_z80_state( void );
 static void dump_memory_state( void );
 
+static int run_benchmarks( unsigned long count );
+
 int
 main( int argc, char **argv )
 {
@@ -84,17 +90,24 @@ main( int argc, char **argv )
   progname = argv[0];
 
   if( argc < 2 ) {
-    fprintf( stderr, "Usage: %s <testsfile>\n", progname );
+    fprintf( stderr, "Usage: %s <testsfile>\n"
+                     "       %s --bench [<instructions per opcode>]\n",
+             progname, progname );
     return 1;
   }
 
-  testsfile = argv[1];
-
   if( init_dummies() ) return 1;
 
   /* Initialise the tables used by the Z80 core */
   z80_init( NULL );
 
+  if( !strcmp( argv[1], "--bench" ) ) {
+    unsigned long count = argc > 2 ? strtoul( argv[2], NULL, 0 ) : 100000;
+    return run_benchmarks( count ? count : 1 );
+  }
+
+  testsfile = argv[1];
+
   f = fopen( testsfile, "r" );
   if( !f ) {
     fprintf( stderr, "%s: couldn't open tests file `%s': %s\n", progname,
@@ -118,22 +131,29 @@ main( int argc, char **argv )
 libspectrum_byte
 readbyte( libspectrum_word address )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace ) printf( "%5d MC %04x\n", tstates, address );
   tstates += 3;
   return readbyte_internal( address );
 }
 
+libspectrum_word
+readword( libspectrum_word address )
+{
+  libspectrum_byte low = readbyte( address );
+  return low | ( readbyte( address + 1 ) << 8 );
+}
+
 libspectrum_byte
 readbyte_internal( libspectrum_word address )
 {
-  printf( "%5d MR %04x %02x\n", tstates, address, memory[ address ] );
+  if( trace ) printf( "%5d MR %04x %02x\n", tstates, address, memory[ address ] );
   return memory[ address ];
 }
 
 void
 writebyte( libspectrum_word address, libspectrum_byte b )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace ) printf( "%5d MC %04x\n", tstates, address );
   tstates += 3;
   writebyte_internal( address, b );
 }
@@ -141,14 +161,14 @@ writebyte( libspectrum_word address, libspectrum_byte b )
 void
 writebyte_internal( libspectrum_word address, libspectrum_byte b )
 {
-  printf( "%5d MW %04x %02x\n", tstates, address, b );
+  if( trace ) printf( "%5d MW %04x %02x\n", tstates, address, b );
   memory[ address ] = b;
 }
 
 void
 contend_read( libspectrum_word address, libspectrum_dword time )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace ) printf( "%5d MC %04x\n", tstates, address );
   tstates += time;
 }
 
@@ -161,14 +181,14 @@ contend_read_no_mreq( libspectrum_word address, libspectrum_dword time )
 void
 contend_write_no_mreq( libspectrum_word address, libspectrum_dword time )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace ) printf( "%5d MC %04x\n", tstates, address );
   tstates += time;
 }
 
 static void
 contend_port_preio( libspectrum_word port )
 {
-  if( ( port & 0xc000 ) == 0x4000 ) {
+  if( trace && ( port & 0xc000 ) == 0x4000 ) {
     printf( "%5d PC %04x\n", tstates, port );
   }
 
@@ -180,7 +200,7 @@ contend_port_postio( libspectrum_word port )
 {
   if( port & 0x0001 ) {
     
-    if( ( port & 0xc000 ) == 0x4000 ) {
+    if( trace && ( port & 0xc000 ) == 0x4000 ) {
       printf( "%5d PC %04x\n", tstates, port ); tstates++;
       printf( "%5d PC %04x\n", tstates, port ); tstates++;
       printf( "%5d PC %04x\n", tstates, port ); tstates++;
@@ -190,7 +210,8 @@ contend_port_postio( libspectrum_word port )
 
   } else {
 
-    printf( "%5d PC %04x\n", tstates, port ); tstates += 3;
+    if( trace ) printf( "%5d PC %04x\n", tstates, port );
+    tstates += 3;
 
   }
 }
@@ -202,7 +223,7 @@ readport( libspectrum_word port )
 
   contend_port_preio( port );
 
-  printf( "%5d PR %04x %02x\n", tstates, port, r );
+  if( trace ) printf( "%5d PR %04x %02x\n", tstates, port, r );
 
   contend_port_postio( port );
 
@@ -214,7 +235,7 @@ writeport( libspectrum_word port, libspectrum_byte b )
 {
   contend_port_preio( port );
 
-  printf( "%5d PW %04x %02x\n", tstates, port, b );
+  if( trace ) printf( "%5d PW %04x %02x\n", tstates, port, b );
 
   contend_port_postio( port );
 }
@@ -351,6 +372,208 @@ dump_memory_state( void )
   }
 }
 
+/*
+ * Benchmarking: run long streams of a single instruction through the
+ * core with tracing turned off and report how long each one takes
+ */
+
+/* Where the stream of instructions lives: clear of the ROM traps at the
+   bottom of memory, and below the data area the instructions work on */
+#define BENCH_PROGRAM_START 0x4000
+#define BENCH_PROGRAM_SIZE 0x4000
+
+/* How many instructions to run before putting the registers back to
+   their initial state; small enough that nothing walking through
+   memory (PUSH, LDI etc) reaches the program */
+#define BENCH_CHUNK 4096
+
+/* The filler for operands and the data area. Chosen so that any
+   absolute address, displacement or popped return address points well
+   away from the program */
+#define BENCH_FILL 0xc0
+
+typedef struct bench_group_t {
+
+  const char *name;
+  libspectrum_byte prefix[2];	/* Prefix bytes, if any */
+  size_t prefix_length;
+  int displacement;		/* Whether a displacement precedes the opcode */
+
+} bench_group_t;
+
+static const bench_group_t bench_groups[] = {
+  { "base",   { 0x00, 0x00 }, 0, 0 },
+  { "cb",     { 0xcb, 0x00 }, 1, 0 },
+  { "ddfd",   { 0xdd, 0x00 }, 1, 0 },
+  { "ed",     { 0xed, 0x00 }, 1, 0 },
+  { "ddfdcb", { 0xdd, 0xcb }, 2, 1 },
+};
+
+static libspectrum_byte bench_program[ BENCH_PROGRAM_SIZE ];
+
+/* Put the machine into the state every benchmark chunk starts from */
+static void
+bench_reset_state( void )
+{
+  z80_reset( 1 ); tstates = 0;
+
+  AF = 0x0000; BC = 0xc000; DE = 0xc000; HL = 0xc000;
+  AF_ = 0x0000; BC_ = 0xc000; DE_ = 0xc000; HL_ = 0xc000;
+  IX = 0xe000; IY = 0xe000; SP = 0xfff0; PC = BENCH_PROGRAM_START;
+  z80.halted = 0;
+}
+
+/* Encode one instruction of `group' with opcode `opcode'; returns the
+   number of bytes written to `buffer', which includes enough filler to
+   cover any operands */
+static size_t
+bench_encode( const bench_group_t *group, libspectrum_byte opcode,
+              libspectrum_byte *buffer )
+{
+  size_t length = 0;
+
+  memcpy( buffer, group->prefix, group->prefix_length );
+  length += group->prefix_length;
+
+  if( group->displacement ) buffer[ length++ ] = BENCH_FILL;
+  buffer[ length++ ] = opcode;
+
+  /* Room for up to two bytes of immediate data */
+  buffer[ length++ ] = BENCH_FILL;
+  buffer[ length++ ] = BENCH_FILL;
+
+  return length;
+}
+
+/* Opcodes which aren't worth benchmarking as a stream: prefixes (which
+   would just be a different group), DJNZ (which changes behaviour as B
+   counts down) and HALT */
+static int
+bench_excluded( const bench_group_t *group, libspectrum_byte opcode )
+{
+  /* Only the unprefixed and DD/FD groups see these as opcodes */
+  if( group->prefix_length == 0 ||
+      ( group->prefix_length == 1 && group->prefix[0] == 0xdd ) ) {
+    switch( opcode ) {
+    case 0x10: case 0x76: case 0xcb: case 0xdd: case 0xed: case 0xfd:
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Time a stream of one instruction. Returns 0 and fills in the counts
+   on success, or non-zero if the instruction can't be run as a stream
+   (it jumps, loops, or writes over the program) */
+static int
+bench_opcode( const bench_group_t *group, libspectrum_byte opcode,
+              unsigned long count, unsigned long *instructions,
+              double *seconds )
+{
+  libspectrum_byte encoded[8];
+  size_t encoded_length, length, length_run, copies, chunk, i;
+  libspectrum_dword instruction_tstates;
+  clock_t start, taken = 0;
+
+  if( bench_excluded( group, opcode ) ) return 1;
+
+  encoded_length = bench_encode( group, opcode, encoded );
+
+  /* First, run the instruction once to find out how long it is, both
+     in bytes and in tstates */
+  memset( memory, BENCH_FILL, sizeof( memory ) );
+  memcpy( &memory[ BENCH_PROGRAM_START ], encoded, encoded_length );
+  bench_reset_state();
+  event_next_event = 1;
+  z80_do_opcodes();
+
+  length = (libspectrum_word)( PC - BENCH_PROGRAM_START );
+  instruction_tstates = tstates;
+  if( length == 0 || length > encoded_length || z80.halted ) return 1;
+
+  /* Then lay out as many copies of it as will fit */
+  memset( memory, BENCH_FILL, sizeof( memory ) );
+  copies = BENCH_PROGRAM_SIZE / length;
+  for( i = 0; i < copies; i++ )
+    memcpy( &memory[ BENCH_PROGRAM_START + i * length ], encoded, length );
+  memcpy( bench_program, &memory[ BENCH_PROGRAM_START ], BENCH_PROGRAM_SIZE );
+
+  /* Stop a couple of instructions short of the end of the program */
+  chunk = copies - 2;
+  if( chunk > BENCH_CHUNK ) chunk = BENCH_CHUNK;
+
+  *instructions = 0;
+
+  while( *instructions < count ) {
+
+    bench_reset_state();
+
+    event_next_event = chunk * instruction_tstates;
+
+    start = clock();
+    z80_do_opcodes();
+    taken += clock() - start;
+
+    length_run = (libspectrum_word)( PC - BENCH_PROGRAM_START );
+    if( length_run % length ||
+        memcmp( &memory[ BENCH_PROGRAM_START ], bench_program,
+                BENCH_PROGRAM_SIZE ) )
+      return 1;
+
+    *instructions += length_run / length;
+  }
+
+  *seconds = (double)taken / CLOCKS_PER_SEC;
+
+  return 0;
+}
+
+/* Benchmark every opcode in every group, printing one line per opcode
+   and a summary line per group:
+
+   <group> <opcode> <instructions> <ns per instruction>
+
+   with "all" as the opcode for the summary lines */
+static int
+run_benchmarks( unsigned long count )
+{
+  size_t i;
+  int opcode;
+
+  trace = 0;
+
+  printf( "# group opcode instructions ns_per_instruction\n" );
+
+  for( i = 0; i < ARRAY_SIZE( bench_groups ); i++ ) {
+
+    const bench_group_t *group = &bench_groups[i];
+    unsigned long group_instructions = 0;
+    double group_seconds = 0;
+
+    for( opcode = 0; opcode < 0x100; opcode++ ) {
+
+      unsigned long instructions;
+      double seconds;
+
+      if( bench_opcode( group, opcode, count, &instructions, &seconds ) )
+        continue;
+
+      printf( "%s %02x %lu %.3f\n", group->name, (unsigned)opcode,
+              instructions, seconds * 1e9 / instructions );
+
+      group_instructions += instructions;
+      group_seconds += seconds;
+    }
+
+    if( group_instructions )
+      printf( "%s all %lu %.3f\n", group->name, group_instructions,
+              group_seconds * 1e9 / group_instructions );
+  }
+
+  return 0;
+}
+
 /* Error 'handing': dump core as these should never be called */
 
 void
@@ -74,6 +74,8 @@ int z80_nmos_iff2_event;
 static void z80_init_tables(void);
 static void z80_from_snapshot( libspectrum_snap *snap );
 static void z80_to_snapshot( libspectrum_snap *snap );
+static void z80_state_to( module_state_t *state );
+static void z80_state_from( module_state_t *state );
 static void z80_nmi( libspectrum_dword ts, int type, void *user_data );
 
 static module_info_t z80_module_info = {
@@ -83,6 +85,8 @@ static module_info_t z80_module_info = {
   NULL,
   z80_from_snapshot,
   z80_to_snapshot,
+  z80_state_to,
+  z80_state_from,
 
 };
 
@@ -352,3 +356,16 @@ z80_to_snapshot( libspectrum_snap *snap )
      independent of this flag */
   libspectrum_snap_set_last_instruction_set_f( snap, !!Q );
 }
+
+/* The in-memory state is just the processor as it stands */
+static void
+z80_state_to( module_state_t *state )
+{
+  module_state_write( state, &z80, sizeof( z80 ) );
+}
+
+static void
+z80_state_from( module_state_t *state )
+{
+  module_state_read( state, &z80, sizeof( z80 ) );
+}
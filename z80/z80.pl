@@ -105,8 +105,7 @@ sub call_jp ($$$) {
     my( $opcode, $condition, $offset ) = @_;
 
     print << "CALL";
-      z80.memptr.b.l = readbyte(PC++);
-      z80.memptr.b.h = readbyte(PC);
+      z80.memptr.w = readword(PC++);
 CALL
 
     if( not defined $offset ) {
@@ -162,7 +161,7 @@ sub cpir_cpdr ($) {
     my $modifier = ( $opcode eq 'CPIR' ? '++' : '--' );
 
     print << "CODE";
-      {
+      do {
 	libspectrum_byte value = readbyte( HL ), bytetemp = A - value,
 	  lookup = ( (        A & 0x08 ) >> 3 ) |
 		   ( (  (value) & 0x08 ) >> 2 ) |
@@ -187,7 +186,7 @@ sub cpir_cpdr ($) {
 	  z80.memptr.w$modifier;
 	}
 	HL$modifier;
-      }
+      } while( ( F & ( FLAG_V | FLAG_Z ) ) == FLAG_V && block_repeat() );
 CODE
 }
 
@@ -266,7 +265,7 @@ sub inir_indr ($) {
     my $modifier = ( $opcode eq 'INIR' ? '+' : '-' );
 
     print << "CODE";
-      {
+      do {
 	libspectrum_byte initemp, initemp2;
 
 	contend_read_no_mreq( IR, 1 );
@@ -289,7 +288,7 @@ sub inir_indr ($) {
 	  PC -= 2;
 	}
         HL$modifier$modifier;
-      }
+      } while( B && block_repeat() );
 CODE
 }
 
@@ -322,7 +321,7 @@ sub ldir_lddr ($) {
     my $modifier = ( $opcode eq 'LDIR' ? '++' : '--' );
 
     print << "CODE";
-      {
+      do {
 	libspectrum_byte bytetemp=readbyte( HL );
 	writebyte(DE,bytetemp);
 	contend_write_no_mreq( DE, 1 ); contend_write_no_mreq( DE, 1 );
@@ -339,7 +338,7 @@ sub ldir_lddr ($) {
 	  z80.memptr.w = PC+1;
 	}
         HL$modifier; DE$modifier;
-      }
+      } while( BC && block_repeat() );
 CODE
 }
 
@@ -350,7 +349,7 @@ sub otir_otdr ($) {
     my $modifier = ( $opcode eq 'OTIR' ? '+' : '-' );
 
     print << "CODE";
-      {
+      do {
 	libspectrum_byte outitemp, outitemp2;
 
 	contend_read_no_mreq( IR, 1 );
@@ -373,7 +372,7 @@ sub otir_otdr ($) {
 	  contend_read_no_mreq( BC, 1 );
 	  PC -= 2;
 	}
-      }
+      } while( B && block_repeat() );
 CODE
 }
 
@@ -653,7 +652,7 @@ sub opcode_EXX (@) {
 EXX
 }
 
-sub opcode_HALT (@) { print "      z80.halted=1;\n      PC--;\n"; }
+sub opcode_HALT (@) { print "      z80.halted=1;\n      PC--;\n      HALT_SKIP();\n"; }
 
 sub opcode_IM (@) {
 
@@ -784,8 +783,7 @@ LD
         } elsif( $src eq '(nnnn)' ) {
 	    print << "LD";
       {
-	z80.memptr.b.l = readbyte(PC++);
-	z80.memptr.b.h = readbyte(PC++);
+	z80.memptr.w = readword(PC); PC+=2;
 	A=readbyte(z80.memptr.w++);
       }
 LD
@@ -816,8 +814,7 @@ LD
 	if( $src eq 'nnnn' ) {
 
 	    print << "LD";
-      $low=readbyte(PC++);
-      $high=readbyte(PC++);
+      $dest=readword(PC); PC+=2;
 LD
         } elsif( $src eq 'HL' or $src eq 'REGISTER' ) {
 	    print << "LD";
@@ -854,8 +851,7 @@ LD
 	if( $src eq 'A' ) {
 	    print << "LD";
       {
-	libspectrum_word wordtemp = readbyte( PC++ );
-	wordtemp|=readbyte(PC++) << 8;
+	libspectrum_word wordtemp = readword( PC ); PC+=2;
 	z80.memptr.b.l = wordtemp + 1;
 	z80.memptr.b.h = A;
 	writebyte(wordtemp,A);
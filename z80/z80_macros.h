@@ -108,17 +108,19 @@
 
 #define contend_read(address,time) \
   if( memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
-    tstates += ula_contention[ tstates ]; \
+    tstates += ula_timing[ tstates ].contention; \
   tstates += (time);
 
 #define contend_read_no_mreq(address,time) \
-  if( memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
-    tstates += ula_contention_no_mreq[ tstates ]; \
+  if( ula_contention_model == ULA_CONTENTION_MODEL_FULL && \
+      memory_map_read[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
+    tstates += ula_timing[ tstates ].contention_no_mreq; \
   tstates += (time);
 
 #define contend_write_no_mreq(address,time) \
-  if( memory_map_write[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
-    tstates += ula_contention_no_mreq[ tstates ]; \
+  if( ula_contention_model == ULA_CONTENTION_MODEL_FULL && \
+      memory_map_write[ (address) >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) \
+    tstates += ula_timing[ tstates ].contention_no_mreq; \
   tstates += (time);
 
 #else				/* #ifndef CORETEST */
@@ -129,6 +131,19 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 
 #endif				/* #ifndef CORETEST */
 
+/* The half carry is bit 4 (or bit 12) of the arguments and the result
+   XORed together, and there's an overflow if the result's sign differs
+   from the first argument's when the arguments' signs were the same (for
+   addition) or different (for subtraction). Working these out directly is
+   cheaper than building an index into halfcarry_*_table and
+   overflow_*_table, and gives the same flags */
+#define HALFCARRY8(a,b,r)     ( ( (a) ^ (b) ^ (r) ) & FLAG_H )
+#define HALFCARRY16(a,b,r)    ( ( ( (a) ^ (b) ^ (r) ) >> 8 ) & FLAG_H )
+#define OVERFLOW_ADD8(a,b,r)  ( ( ( ~( (a) ^ (b) ) & ( (a) ^ (r) ) ) >> 5 ) & FLAG_V )
+#define OVERFLOW_SUB8(a,b,r)  ( ( ( (a) ^ (b) ) & ( (a) ^ (r) ) ) >> 5 & FLAG_V )
+#define OVERFLOW_ADD16(a,b,r) ( ( ( ~( (a) ^ (b) ) & ( (a) ^ (r) ) ) >> 13 ) & FLAG_V )
+#define OVERFLOW_SUB16(a,b,r) ( ( ( (a) ^ (b) ) & ( (a) ^ (r) ) ) >> 13 & FLAG_V )
+
 /* Some commonly used instructions */
 #define AND(value)\
 {\
@@ -140,28 +155,23 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 #define ADC(value)\
 {\
   libspectrum_word adctemp = A + (value) + ( F & FLAG_C ); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( adctemp & 0x88 ) >> 1 );  \
+  F = ( adctemp >> 8 ) |\
+    HALFCARRY8( A, (value), adctemp ) | OVERFLOW_ADD8( A, (value), adctemp ) |\
+    sz53_table[ adctemp & 0xff ];\
   A=adctemp;\
-  F = ( adctemp & 0x100 ? FLAG_C : 0 ) |\
-    halfcarry_add_table[lookup & 0x07] | overflow_add_table[lookup >> 4] |\
-    sz53_table[A];\
   Q = F;\
 }
 
 #define ADC16(value)\
 {\
   libspectrum_dword add16temp= HL + (value) + ( F & FLAG_C ); \
-  libspectrum_byte lookup = ( (        HL & 0x8800 ) >> 11 ) | \
-			    ( (   (value) & 0x8800 ) >> 10 ) | \
-			    ( ( add16temp & 0x8800 ) >>  9 );  \
+  libspectrum_byte adc16flags = ( add16temp >> 16 ) |\
+    OVERFLOW_ADD16( HL, (value), add16temp ) |\
+    HALFCARRY16( HL, (value), add16temp );\
   z80.memptr.w=HL+1;\
   HL = add16temp;\
-  F = ( add16temp & 0x10000 ? FLAG_C : 0 )|\
-    overflow_add_table[lookup >> 4] |\
+  F = adc16flags |\
     ( H & ( FLAG_3 | FLAG_5 | FLAG_S ) ) |\
-    halfcarry_add_table[lookup&0x07]|\
     ( HL ? 0 : FLAG_Z );\
   Q = F;\
 }
@@ -169,28 +179,22 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 #define ADD(value)\
 {\
   libspectrum_word addtemp = A + (value); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( addtemp & 0x88 ) >> 1 );  \
+  F = ( addtemp >> 8 ) |\
+    HALFCARRY8( A, (value), addtemp ) | OVERFLOW_ADD8( A, (value), addtemp ) |\
+    sz53_table[ addtemp & 0xff ];\
   A=addtemp;\
-  F = ( addtemp & 0x100 ? FLAG_C : 0 ) |\
-    halfcarry_add_table[lookup & 0x07] | overflow_add_table[lookup >> 4] |\
-    sz53_table[A];\
   Q = F;\
 }
 
 #define ADD16(value1,value2)\
 {\
   libspectrum_dword add16temp = (value1) + (value2); \
-  libspectrum_byte lookup = ( (  (value1) & 0x0800 ) >> 11 ) | \
-			    ( (  (value2) & 0x0800 ) >> 10 ) | \
-			    ( ( add16temp & 0x0800 ) >>  9 );  \
+  libspectrum_byte add16flags = ( add16temp >> 16 ) |\
+    ( ( add16temp >> 8 ) & ( FLAG_3 | FLAG_5 ) ) |\
+    HALFCARRY16( (value1), (value2), add16temp );\
   z80.memptr.w=(value1)+1;\
   (value1) = add16temp;\
-  F = ( F & ( FLAG_V | FLAG_Z | FLAG_S ) ) |\
-    ( add16temp & 0x10000 ? FLAG_C : 0 )|\
-    ( ( add16temp >> 8 ) & ( FLAG_3 | FLAG_5 ) ) |\
-    halfcarry_add_table[lookup];\
+  F = ( F & ( FLAG_V | FLAG_Z | FLAG_S ) ) | add16flags;\
   Q = F;\
 }
 
@@ -222,12 +226,9 @@ void contend_write_no_mreq( libspectrum_word address, libspectrum_dword time );
 #define CP(value)\
 {\
   libspectrum_word cptemp = A - value; \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( (  cptemp & 0x88 ) >> 1 );  \
   F = ( cptemp & 0x100 ? FLAG_C : ( cptemp ? 0 : FLAG_Z ) ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] |\
-    overflow_sub_table[lookup >> 4] |\
+    HALFCARRY8( A, (value), cptemp ) |\
+    OVERFLOW_SUB8( A, (value), cptemp ) |\
     ( value & ( FLAG_3 | FLAG_5 ) ) |\
     ( cptemp & FLAG_S );\
   Q = F;\
@@ -270,8 +271,7 @@ break
 #define LD16_NNRR(regl,regh)\
 {\
   libspectrum_word ldtemp; \
-  ldtemp=readbyte(PC++);\
-  ldtemp|=readbyte(PC++) << 8;\
+  ldtemp=readword(PC); PC+=2;\
   writebyte(ldtemp++,(regl));\
   z80.memptr.w=ldtemp;\
   writebyte(ldtemp,(regh));\
@@ -281,8 +281,7 @@ break
 #define LD16_RRNN(regl,regh)\
 {\
   libspectrum_word ldtemp; \
-  ldtemp=readbyte(PC++);\
-  ldtemp|=readbyte(PC++) << 8;\
+  ldtemp=readword(PC); PC+=2;\
   (regl)=readbyte(ldtemp++);\
   z80.memptr.w=ldtemp;\
   (regh)=readbyte(ldtemp);\
@@ -371,28 +370,23 @@ break
 #define SBC(value)\
 {\
   libspectrum_word sbctemp = A - (value) - ( F & FLAG_C ); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    ( ( sbctemp & 0x88 ) >> 1 );  \
+  F = ( ( sbctemp >> 8 ) & FLAG_C ) | FLAG_N |\
+    HALFCARRY8( A, (value), sbctemp ) | OVERFLOW_SUB8( A, (value), sbctemp ) |\
+    sz53_table[ sbctemp & 0xff ];\
   A=sbctemp;\
-  F = ( sbctemp & 0x100 ? FLAG_C : 0 ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] | overflow_sub_table[lookup >> 4] |\
-    sz53_table[A];\
   Q = F;\
 }
 
 #define SBC16(value)\
 {\
   libspectrum_dword sub16temp = HL - (value) - (F & FLAG_C); \
-  libspectrum_byte lookup = ( (        HL & 0x8800 ) >> 11 ) | \
-			    ( (   (value) & 0x8800 ) >> 10 ) | \
-			    ( ( sub16temp & 0x8800 ) >>  9 );  \
+  libspectrum_byte sbc16flags = ( ( sub16temp >> 16 ) & FLAG_C ) | FLAG_N |\
+    OVERFLOW_SUB16( HL, (value), sub16temp ) |\
+    HALFCARRY16( HL, (value), sub16temp );\
   z80.memptr.w=HL+1;\
   HL = sub16temp;\
-  F = ( sub16temp & 0x10000 ? FLAG_C : 0 ) |\
-    FLAG_N | overflow_sub_table[lookup >> 4] |\
+  F = sbc16flags |\
     ( H & ( FLAG_3 | FLAG_5 | FLAG_S ) ) |\
-    halfcarry_sub_table[lookup&0x07] |\
     ( HL ? 0 : FLAG_Z) ;\
   Q = F;\
 }
@@ -432,13 +426,10 @@ break
 #define SUB(value)\
 {\
   libspectrum_word subtemp = A - (value); \
-  libspectrum_byte lookup = ( (       A & 0x88 ) >> 3 ) | \
-			    ( ( (value) & 0x88 ) >> 2 ) | \
-			    (  (subtemp & 0x88 ) >> 1 );  \
+  F = ( ( subtemp >> 8 ) & FLAG_C ) | FLAG_N |\
+    HALFCARRY8( A, (value), subtemp ) | OVERFLOW_SUB8( A, (value), subtemp ) |\
+    sz53_table[ subtemp & 0xff ];\
   A=subtemp;\
-  F = ( subtemp & 0x100 ? FLAG_C : 0 ) | FLAG_N |\
-    halfcarry_sub_table[lookup & 0x07] | overflow_sub_table[lookup >> 4] |\
-    sz53_table[A];\
   Q = F;\
 }
 
@@ -108,6 +108,158 @@ enum {
 static libspectrum_byte opcode = 0x00;
 #endif
 
+/* Once HALTed, the Z80 just keeps on executing the HALT (effectively a NOP)
+   until the next interrupt or other event. When nothing needs to look at
+   each of those instructions individually, run straight through them
+   here rather than going round the main loop for each one; this has
+   exactly the same effect on tstates, R, Q and contention, but avoids
+   decoding the same opcode thousands of times a frame. */
+#ifndef CORETEST
+
+/* Only a HALT in contended memory during the part of the frame which can
+   be contended needs doing one at a time; everything else is 4 tstates
+   and one R increment each, so is done all at once */
+#define HALT_SKIP() \
+  if( halt_skip && !z80.iff2_read ) { \
+    if( memory_map_read[ PC >> MEMORY_PAGE_SIZE_LOGARITHM ].contended ) { \
+      while( tstates < event_next_event && tstates < ula_contention_end ) { \
+        contend_read( PC, 4 ); \
+        R++; last_Q = 0; \
+      } \
+    } \
+    if( tstates < event_next_event ) { \
+      libspectrum_dword halts = ( event_next_event - tstates + 3 ) / 4; \
+      tstates += halts * 4; \
+      R += halts; last_Q = 0; \
+    } \
+  }
+
+#else				/* #ifndef CORETEST */
+
+/* The fetch is repeated so the core tester sees the same memory accesses
+   as it would without skipping */
+#define HALT_SKIP() \
+  if( halt_skip && !z80.iff2_read ) { \
+    while( tstates < event_next_event ) { \
+      contend_read( PC, 4 ); \
+      (void)readbyte_internal( PC ); \
+      R++; last_Q = 0; \
+    } \
+  }
+
+#endif				/* #ifndef CORETEST */
+
+/* Similarly, a repeating block instruction (LDIR, CPIR, INIR, OTIR and
+   their decrementing versions) which hasn't finished puts PC back to
+   its start and goes round the main loop again. When the main loop
+   would do nothing but fetch the same two bytes again, go straight back
+   into the instruction instead; contention, R and memory writes all
+   happen exactly as they would have done */
+static int block_repeat_allowed;
+
+#ifndef CORETEST
+
+static inline int
+block_repeat( void )
+{
+  if( !block_repeat_allowed || tstates >= event_next_event ) return 0;
+
+  contend_read( PC, 4 ); PC++; R++;
+  contend_read( PC, 4 ); PC++; R++;
+  Q = 0;
+
+  return 1;
+}
+
+#else				/* #ifndef CORETEST */
+
+/* As with HALT_SKIP(), the fetches are repeated for the core tester */
+static inline int
+block_repeat( void )
+{
+  if( !block_repeat_allowed || tstates >= event_next_event ) return 0;
+
+  contend_read( PC, 4 ); (void)readbyte_internal( PC ); PC++; R++;
+  contend_read( PC, 4 ); (void)readbyte_internal( PC ); PC++; R++;
+  Q = 0;
+
+  return 1;
+}
+
+#endif				/* #ifndef CORETEST */
+
+/* Each 2K page of the address space as one bit of a dword */
+#define FETCH_PAGE( address ) \
+  ( (libspectrum_dword)1 << ( (address) >> MEMORY_PAGE_SIZE_LOGARITHM ) )
+
+/* The pages from which an opcode fetch might make the Beta 128 or the
+   DivIDE/DivMMC page their ROMs in or out. Fetches from anywhere else
+   don't need comparing against their trap addresses at all; only the
+   Beta 128's paging changes the pages, and that happens either here or
+   between runs of the core */
+static libspectrum_dword
+fetch_trap_pages( void )
+{
+  libspectrum_dword pages = 0;
+
+  if( beta_available ) {
+    if( beta_active ) {
+      /* Running anything outside the ROM pages it out again */
+      pages |= ~( FETCH_PAGE( 0x4000 ) - 1 );
+    } else {
+      pages |= FETCH_PAGE( beta_pc_value ) |
+               FETCH_PAGE( beta_pc_value | ( ~beta_pc_mask & 0xffff ) );
+    }
+  }
+
+  if( settings_current.divide_enabled || settings_current.divmmc_enabled )
+    pages |= FETCH_PAGE( 0x0000 ) | FETCH_PAGE( 0x1ff8 ) |
+             FETCH_PAGE( 0x3d00 );
+
+  return pages;
+}
+
+/* The same core with none of the checks in z80_checks.h compiled in at
+   all, for when none of them are needed: a plain 48K, 128K or +3 with no
+   interfaces attached. As with the computed gotos, which checks are
+   needed is only decided each time z80_do_opcodes() is called, and
+   anything turning one on in the middle of a run adds an event to get
+   back there */
+static void
+z80_do_opcodes_plain( void )
+{
+#ifdef HAVE_ENOUGH_MEMORY
+  libspectrum_byte opcode = 0x00;
+#endif
+  libspectrum_byte last_Q;
+
+  /* Everything which stops HALTs being skipped or block instructions
+     being repeated has a check of its own */
+  const int halt_skip = 1;
+
+  block_repeat_allowed = 1;
+
+  while( tstates < event_next_event ) {
+
+    contend_read( PC, 4 );
+
+    /* Do the instruction fetch; readbyte_internal used here to avoid
+       triggering read breakpoints */
+    opcode = readbyte_internal( PC );
+
+  end_opcode:
+    PC++; R++;
+    last_Q = Q; /* keep Q value from previous opcode for SCF and CCF */
+    Q = 0;      /* preempt Q value assuming next opcode doesn't set flags */
+
+    switch(opcode) {
+#include "z80/opcodes_base.c"
+    }
+
+  }
+
+}
+
 /* Execute Z80 opcodes until the next event */
 void
 z80_do_opcodes( void )
@@ -120,6 +272,37 @@ z80_do_opcodes( void )
   int even_m1 =
     machine_current->capabilities & LIBSPECTRUM_MACHINE_CAPABILITY_EVEN_M1; 
 
+  libspectrum_dword trap_pages;
+
+#undef SETUP_CHECK
+#define SETUP_CHECK( label, condition ) ( condition ) ||
+
+#undef SETUP_NEXT
+#define SETUP_NEXT( label )
+
+  /* If none of the checks is needed, use the core without them */
+  if( !(
+#include "z80_checks.h"
+         0 ) ) {
+    z80_do_opcodes_plain();
+    return;
+  }
+
+  trap_pages = fetch_trap_pages();
+
+  /* Can we run straight through repeated HALTs? Not if anything below
+     wants to see every instruction, or might not do the same thing each
+     time round */
+  int halt_skip = !( profile_active || debugger_trace_active ||
+                     rzx_playback || even_m1 ||
+                     debugger_mode != DEBUGGER_MODE_INACTIVE ||
+                     svg_capture_active || usource_available ||
+                     didaktik80_snap || spectranet_available );
+
+  /* Any of the checks might want to see the fetch of each repeat of a
+     block instruction, so they're always done one at a time here */
+  block_repeat_allowed = 0;
+
 #ifdef __GNUC__
 
 #undef SETUP_CHECK
@@ -147,6 +330,13 @@ z80_do_opcodes( void )
 
     END_CHECK
 
+    /* Instruction trace */
+    CHECK( trace, debugger_trace_active )
+
+    debugger_trace_record();
+
+    END_CHECK
+
     /* If we're due an end of frame from RZX playback, generate one */
     CHECK( rzx, rzx_playback )
 
@@ -172,13 +362,17 @@ z80_do_opcodes( void )
             LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY ) || \
             machine_current->ram.current_rom )
 
-    if( beta_active ) {
-      if( NOT_128_TYPE_OR_IS_48_TYPE && PC >= 16384 ) {
-	beta_unpage();
+    if( trap_pages & FETCH_PAGE( PC ) ) {
+      if( beta_active ) {
+        if( NOT_128_TYPE_OR_IS_48_TYPE && PC >= 16384 ) {
+          beta_unpage();
+          trap_pages = fetch_trap_pages();
+        }
+      } else if( ( PC & beta_pc_mask ) == beta_pc_value &&
+                 NOT_128_TYPE_OR_IS_48_TYPE ) {
+        beta_page();
+        trap_pages = fetch_trap_pages();
       }
-    } else if( ( PC & beta_pc_mask ) == beta_pc_value &&
-               NOT_128_TYPE_OR_IS_48_TYPE ) {
-      beta_page();
     }
 
     END_CHECK
@@ -290,22 +484,26 @@ z80_do_opcodes( void )
 
     CHECK( divide_late, settings_current.divide_enabled )
 
-    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
-      divide_set_automap( 0 );
-    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
-      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
-      divide_set_automap( 1 );
+    if( trap_pages & FETCH_PAGE( PC ) ) {
+      if( ( PC & 0xfff8 ) == 0x1ff8 ) {
+        divide_set_automap( 0 );
+      } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
+        || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
+        divide_set_automap( 1 );
+      }
     }
     
     END_CHECK
 
     CHECK( divmmc_late, settings_current.divmmc_enabled )
 
-    if( ( PC & 0xfff8 ) == 0x1ff8 ) {
-      divmmc_set_automap( 0 );
-    } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
-      || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
-      divmmc_set_automap( 1 );
+    if( trap_pages & FETCH_PAGE( PC ) ) {
+      if( ( PC & 0xfff8 ) == 0x1ff8 ) {
+        divmmc_set_automap( 0 );
+      } else if( (PC == 0x0000) || (PC == 0x0008) || (PC == 0x0038)
+        || (PC == 0x0066) || (PC == 0x04c6) || (PC == 0x0562) ) {
+        divmmc_set_automap( 1 );
+      }
     }
     
     END_CHECK
@@ -0,0 +1,501 @@
+/* zip.c: Reading files from ZIP archives
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+/*
+ * libspectrum can open a ZIP archive, but only by decompressing it all
+ * and taking the first file it recognises, which is no help for an
+ * archive holding a few thousand games. Here, just the central
+ * directory at the end of the archive is read, giving an index of the
+ * files in it, and a file is only decompressed when it's asked for.
+ * Files inside an archive are named by the archive's path followed by
+ * their path within it, as in "games.zip/dir/game.tzx", so the file
+ * selector can show an archive as a directory and utils_read_file() can
+ * read what's chosen from it. Stored and deflated files are supported;
+ * ZIP64 archives and encrypted files are not.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_STRCASECMP
+#include <strings.h>
+#endif      /* #ifdef HAVE_STRINGS_STRCASECMP */
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB_H
+#define ZLIB_CONST
+#include <zlib.h>
+#endif
+
+#include <libspectrum.h>
+
+#include "fuse.h"
+#include "infrastructure/startup_manager.h"
+#include "ui/ui.h"
+#include "utils.h"
+#include "zip.h"
+
+#define ZIP_END_SIGNATURE 0x06054b50
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_LOCAL_SIGNATURE 0x04034b50
+
+#define ZIP_END_LENGTH 22
+#define ZIP_CENTRAL_LENGTH 46
+#define ZIP_LOCAL_LENGTH 30
+
+/* The end of central directory record is followed by a comment of up to
+   this length */
+#define ZIP_MAX_COMMENT 0xffff
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+#define ZIP_FLAG_ENCRYPTED 0x0001
+
+/* Nothing a Spectrum can use comes anywhere near this, and it stops an
+   archive which claims otherwise from having us try to allocate
+   gigabytes for it */
+#define ZIP_MAX_LENGTH ( 64 * 1024 * 1024 )
+
+typedef struct zip_entry {
+
+  char *name;
+  int method;
+  int flags;
+  libspectrum_dword crc;
+  libspectrum_dword compressed_length;
+  libspectrum_dword length;
+  libspectrum_dword offset;	/* Of the local header */
+
+} zip_entry;
+
+struct zip_archive {
+
+  char *filename;
+  off_t size;			/* To spot the archive changing */
+  time_t mtime;
+
+  zip_entry *entries;
+  size_t count;
+
+};
+
+/* The one archive whose index we're keeping */
+static zip_archive *current = NULL;
+
+static libspectrum_word
+zip_read_word( const libspectrum_byte *ptr )
+{
+  return ptr[0] | ptr[1] << 8;
+}
+
+static libspectrum_dword
+zip_read_dword( const libspectrum_byte *ptr )
+{
+  return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (libspectrum_dword)ptr[3] << 24;
+}
+
+int
+zip_is_archive( const char *filename )
+{
+  const char *dot = strrchr( filename, '.' );
+
+  return dot && !strcasecmp( dot, ".zip" );
+}
+
+static void
+zip_free( zip_archive *archive )
+{
+  size_t i;
+
+  if( !archive ) return;
+
+  for( i = 0; i < archive->count; i++ )
+    libspectrum_free( archive->entries[i].name );
+  libspectrum_free( archive->entries );
+  libspectrum_free( archive->filename );
+  libspectrum_free( archive );
+}
+
+/* Read `length' bytes at `offset' in `f' */
+static int
+zip_read_at( FILE *f, long offset, libspectrum_byte *buffer, size_t length )
+{
+  return fseek( f, offset, SEEK_SET ) ||
+         fread( buffer, 1, length, f ) != length;
+}
+
+/* Find the end of central directory record, and from that where the
+   central directory is */
+static int
+zip_find_directory( FILE *f, long size, libspectrum_dword *count,
+                    libspectrum_dword *offset, libspectrum_dword *length )
+{
+  libspectrum_byte *buffer, *ptr;
+  long start;
+  size_t got, i;
+
+  if( size < ZIP_END_LENGTH ) return 1;
+
+  start = size - ( ZIP_END_LENGTH + ZIP_MAX_COMMENT );
+  if( start < 0 ) start = 0;
+  got = size - start;
+
+  buffer = libspectrum_new( libspectrum_byte, got );
+  if( zip_read_at( f, start, buffer, got ) ) {
+    libspectrum_free( buffer );
+    return 1;
+  }
+
+  /* The record is the last thing in the file apart from its comment, so
+     look backwards from the end */
+  for( i = got - ZIP_END_LENGTH + 1; i > 0; i-- ) {
+    ptr = buffer + i - 1;
+    if( zip_read_dword( ptr ) != ZIP_END_SIGNATURE ) continue;
+
+    *count = zip_read_word( ptr + 10 );
+    *length = zip_read_dword( ptr + 12 );
+    *offset = zip_read_dword( ptr + 16 );
+    libspectrum_free( buffer );
+
+    /* ZIP64 archives have these maxed out here and the real values
+       elsewhere */
+    return *count == 0xffff || *offset == 0xffffffff ||
+           (long)*offset + (long)*length > size;
+  }
+
+  libspectrum_free( buffer );
+  return 1;
+}
+
+/* Read the central directory of `archive', which is open as `f' */
+static int
+zip_read_directory( zip_archive *archive, FILE *f )
+{
+  libspectrum_dword count, offset, length, i;
+  libspectrum_byte *directory;
+  const libspectrum_byte *ptr, *end;
+  size_t name_length, extra_length, comment_length;
+  zip_entry *entry;
+
+  if( zip_find_directory( f, archive->size, &count, &offset, &length ) )
+    return 1;
+
+  directory = libspectrum_new( libspectrum_byte, length ? length : 1 );
+  if( zip_read_at( f, offset, directory, length ) ) {
+    libspectrum_free( directory );
+    return 1;
+  }
+
+  archive->entries = libspectrum_new( zip_entry, count ? count : 1 );
+  archive->count = 0;
+
+  ptr = directory; end = directory + length;
+
+  for( i = 0; i < count; i++ ) {
+
+    if( end - ptr < ZIP_CENTRAL_LENGTH ||
+        zip_read_dword( ptr ) != ZIP_CENTRAL_SIGNATURE )
+      break;
+
+    name_length = zip_read_word( ptr + 28 );
+    extra_length = zip_read_word( ptr + 30 );
+    comment_length = zip_read_word( ptr + 32 );
+    if( (size_t)( end - ptr ) <
+        ZIP_CENTRAL_LENGTH + name_length + extra_length + comment_length )
+      break;
+
+    /* Directories are implied by the names of the files in them */
+    if( name_length && ptr[ ZIP_CENTRAL_LENGTH + name_length - 1 ] != '/' ) {
+      entry = &archive->entries[ archive->count++ ];
+      entry->flags = zip_read_word( ptr + 8 );
+      entry->method = zip_read_word( ptr + 10 );
+      entry->crc = zip_read_dword( ptr + 16 );
+      entry->compressed_length = zip_read_dword( ptr + 20 );
+      entry->length = zip_read_dword( ptr + 24 );
+      entry->offset = zip_read_dword( ptr + 42 );
+      entry->name = libspectrum_new( char, name_length + 1 );
+      memcpy( entry->name, ptr + ZIP_CENTRAL_LENGTH, name_length );
+      entry->name[ name_length ] = '\0';
+    }
+
+    ptr += ZIP_CENTRAL_LENGTH + name_length + extra_length + comment_length;
+  }
+
+  libspectrum_free( directory );
+
+  return i != count;
+}
+
+zip_archive*
+zip_open( const char *filename )
+{
+  zip_archive *archive;
+  struct stat info;
+  FILE *f;
+
+  if( stat( filename, &info ) ) {
+    ui_error( UI_ERROR_ERROR, "couldn't stat '%s': %s", filename,
+              strerror( errno ) );
+    return NULL;
+  }
+
+  if( current && !strcmp( current->filename, filename ) &&
+      current->size == info.st_size && current->mtime == info.st_mtime )
+    return current;
+
+  zip_free( current );
+  current = NULL;
+
+  f = fopen( filename, "rb" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s': %s", filename,
+              strerror( errno ) );
+    return NULL;
+  }
+
+  archive = libspectrum_new( zip_archive, 1 );
+  archive->filename = utils_safe_strdup( filename );
+  archive->size = info.st_size;
+  archive->mtime = info.st_mtime;
+  archive->entries = NULL;
+  archive->count = 0;
+
+  if( zip_read_directory( archive, f ) ) {
+    ui_error( UI_ERROR_ERROR, "couldn't read the contents of ZIP archive '%s'",
+              filename );
+    fclose( f );
+    zip_free( archive );
+    return NULL;
+  }
+
+  fclose( f );
+
+  current = archive;
+  return current;
+}
+
+size_t
+zip_count( const zip_archive *archive )
+{
+  return archive->count;
+}
+
+const char*
+zip_name( const zip_archive *archive, size_t n )
+{
+  return archive->entries[n].name;
+}
+
+#ifdef HAVE_ZLIB_H
+static int
+zip_inflate( const libspectrum_byte *data, size_t length,
+             libspectrum_byte *buffer, size_t buffer_length )
+{
+  z_stream stream;
+  int error;
+
+  memset( &stream, 0, sizeof( stream ) );
+  stream.next_in = data;
+  stream.avail_in = length;
+  stream.next_out = buffer;
+  stream.avail_out = buffer_length;
+
+  /* A ZIP archive holds raw deflate data, without the zlib header */
+  if( inflateInit2( &stream, -MAX_WBITS ) != Z_OK ) return 1;
+
+  error = inflate( &stream, Z_FINISH );
+  inflateEnd( &stream );
+
+  return error != Z_STREAM_END || stream.total_out != buffer_length;
+}
+#endif			/* #ifdef HAVE_ZLIB_H */
+
+int
+zip_read( zip_archive *archive, const char *name, utils_file *file )
+{
+  libspectrum_byte header[ ZIP_LOCAL_LENGTH ], *data;
+  const zip_entry *entry = NULL;
+  off_t end;
+  long start;
+  size_t i;
+  FILE *f;
+  int error;
+
+  for( i = 0; i < archive->count; i++ )
+    if( !strcmp( archive->entries[i].name, name ) ) {
+      entry = &archive->entries[i];
+      break;
+    }
+
+  if( !entry ) {
+    ui_error( UI_ERROR_ERROR, "'%s' isn't in ZIP archive '%s'", name,
+              archive->filename );
+    return 1;
+  }
+
+  if( entry->flags & ZIP_FLAG_ENCRYPTED ) {
+    ui_error( UI_ERROR_ERROR, "'%s' in ZIP archive '%s' is encrypted", name,
+              archive->filename );
+    return 1;
+  }
+
+#ifdef HAVE_ZLIB_H
+  if( entry->method != ZIP_METHOD_STORED &&
+      entry->method != ZIP_METHOD_DEFLATED ) {
+#else
+  if( entry->method != ZIP_METHOD_STORED ) {
+#endif
+    ui_error( UI_ERROR_ERROR,
+              "'%s' in ZIP archive '%s' uses unsupported compression %d",
+              name, archive->filename, entry->method );
+    return 1;
+  }
+
+  f = fopen( archive->filename, "rb" );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "couldn't open '%s': %s", archive->filename,
+              strerror( errno ) );
+    return 1;
+  }
+
+  /* The local header's name and extra field can differ in length from
+     the central directory's */
+  if( zip_read_at( f, entry->offset, header, ZIP_LOCAL_LENGTH ) ||
+      zip_read_dword( header ) != ZIP_LOCAL_SIGNATURE ) {
+    fclose( f );
+    ui_error( UI_ERROR_ERROR, "couldn't read '%s' from ZIP archive '%s'",
+              name, archive->filename );
+    return 1;
+  }
+  end = (off_t)entry->offset + ZIP_LOCAL_LENGTH +
+        zip_read_word( header + 26 ) + zip_read_word( header + 28 );
+  start = end;
+  end += entry->compressed_length;
+
+  if( end > archive->size ) {
+    fclose( f );
+    ui_error( UI_ERROR_ERROR, "'%s' runs past the end of ZIP archive '%s'",
+              name, archive->filename );
+    return 1;
+  }
+
+  if( entry->length > ZIP_MAX_LENGTH ) {
+    fclose( f );
+    ui_error( UI_ERROR_ERROR, "'%s' in ZIP archive '%s' is too big", name,
+              archive->filename );
+    return 1;
+  }
+
+  data = libspectrum_new( libspectrum_byte,
+                          entry->compressed_length ?
+                            entry->compressed_length : 1 );
+  error = zip_read_at( f, start, data, entry->compressed_length );
+  fclose( f );
+
+  file->length = entry->length;
+  file->mapped = 0;
+
+  if( !error && entry->method == ZIP_METHOD_STORED ) {
+    error = entry->compressed_length != entry->length;
+    file->buffer = data;
+    data = NULL;
+  } else {
+    file->buffer =
+      libspectrum_new( unsigned char, entry->length ? entry->length : 1 );
+#ifdef HAVE_ZLIB_H
+    if( !error )
+      error = zip_inflate( data, entry->compressed_length, file->buffer,
+                           entry->length );
+#endif
+  }
+
+  libspectrum_free( data );
+
+#ifdef HAVE_ZLIB_H
+  if( !error &&
+      crc32( 0, file->buffer, file->length ) != entry->crc )
+    error = 1;
+#endif
+
+  if( error ) {
+    libspectrum_free( file->buffer );
+    ui_error( UI_ERROR_ERROR, "couldn't read '%s' from ZIP archive '%s'",
+              name, archive->filename );
+    return 1;
+  }
+
+  return 0;
+}
+
+int
+zip_read_path( const char *path, utils_file *file )
+{
+  char *archive_name, *name, *ptr;
+  zip_archive *archive;
+  struct stat info;
+  int error = -1;
+
+  archive_name = utils_safe_strdup( path );
+
+  /* Find the first part of the path which is an archive rather than a
+     directory */
+  for( ptr = strchr( archive_name, FUSE_DIR_SEP_CHR ); ptr;
+       ptr = strchr( ptr + 1, FUSE_DIR_SEP_CHR ) ) {
+    *ptr = '\0';
+    if( zip_is_archive( archive_name ) && !stat( archive_name, &info ) &&
+        S_ISREG( info.st_mode ) )
+      break;
+    *ptr = FUSE_DIR_SEP_CHR;
+  }
+
+  if( ptr ) {
+    /* Names in the archive always use `/' */
+    name = ptr + 1;
+    for( ptr = name; *ptr; ptr++ )
+      if( *ptr == FUSE_DIR_SEP_CHR ) *ptr = '/';
+
+    archive = zip_open( archive_name );
+    error = archive ? zip_read( archive, name, file ) : 1;
+  }
+
+  libspectrum_free( archive_name );
+
+  return error;
+}
+
+static void
+zip_end( void )
+{
+  zip_free( current );
+  current = NULL;
+}
+
+void
+zip_register_startup( void )
+{
+  startup_manager_register_no_dependencies( STARTUP_MANAGER_MODULE_ZIP, NULL,
+                                            NULL, zip_end );
+}
@@ -0,0 +1,56 @@
+/* zip.h: Reading files from ZIP archives
+   Copyright (c) 2026 Fuse contributors
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+   Author contact information:
+
+   E-mail: philip-fuse@shadowmagic.org.uk
+
+*/
+
+#ifndef FUSE_ZIP_H
+#define FUSE_ZIP_H
+
+#include <stdlib.h>
+
+#include "utils.h"
+
+typedef struct zip_archive zip_archive;
+
+void zip_register_startup( void );
+
+/* Does `filename' look like a ZIP archive? Just checks the extension */
+int zip_is_archive( const char *filename );
+
+/* The index of the archive `filename', read from its central directory
+   the first time it's asked for and then kept until a different archive
+   is opened. NULL if it couldn't be read */
+zip_archive* zip_open( const char *filename );
+
+/* The number of files in `archive', and the name of each, with `/'
+   separating directories as in the archive itself */
+size_t zip_count( const zip_archive *archive );
+const char* zip_name( const zip_archive *archive, size_t n );
+
+/* Decompress the file `name' from `archive' into memory */
+int zip_read( zip_archive *archive, const char *name, utils_file *file );
+
+/* If `path' is a file inside an archive, as in "games.zip/dir/game.tzx",
+   read it into `file' and return 0, or 1 on error; return -1 if `path'
+   doesn't go through an archive */
+int zip_read_path( const char *path, utils_file *file );
+
+#endif			/* #ifndef FUSE_ZIP_H */